@@ -117,6 +117,26 @@ PCPROPERTY_ITEM MicArray1PropertiesMute[] =
 
 DEFINE_PCAUTOMATION_TABLE_PROP(AutomationMicArray1Mute, MicArray1PropertiesMute);
 
+//=============================================================================
+static
+PCPROPERTY_ITEM MicArray1PropertiesPeakMeter[] =
+{
+  {
+    &KSPROPSETID_Audio,
+    KSPROPERTY_AUDIO_PEAKMETER2,
+    KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+    PropertyHandler_MicArrayTopology
+  },
+  {
+    &KSPROPSETID_Audio,
+    KSPROPERTY_AUDIO_DEV_SPECIFIC,      // RMS level
+    KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+    PropertyHandler_MicArrayTopology
+  }
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationMicArray1PeakMeter, MicArray1PropertiesPeakMeter);
+
 //=============================================================================
 static
 PCNODE_DESCRIPTOR MicArray1TopologyNodes[] =
@@ -134,11 +154,19 @@ PCNODE_DESCRIPTOR MicArray1TopologyNodes[] =
       &AutomationMicArray1Mute,       // AutomationTable
       &KSNODETYPE_MUTE,               // Type
       &KSAUDFNAME_MIC_MUTE            // Name
+    },
+    // KSNODE_TOPO_PEAKMETER
+    {
+      0,                              // Flags
+      &AutomationMicArray1PeakMeter,  // AutomationTable
+      &KSNODETYPE_PEAKMETER,          // Type
+      &KSAUDFNAME_PEAKMETER           // Name
     }
 };
 
 C_ASSERT(KSNODE_TOPO_VOLUME == 0);
 C_ASSERT(KSNODE_TOPO_MUTE == 1);
+C_ASSERT(KSNODE_TOPO_PEAKMETER == 2);
 
 static
 PCCONNECTION_DESCRIPTOR MicArray1TopoMiniportConnections[] =
@@ -146,7 +174,8 @@ PCCONNECTION_DESCRIPTOR MicArray1TopoMiniportConnections[] =
     //  FromNode,                 FromPin,                    ToNode,                 ToPin
     {   PCFILTER_NODE,            KSPIN_TOPO_MIC_ELEMENTS,    KSNODE_TOPO_VOLUME,     1 },
     {   KSNODE_TOPO_VOLUME,       0,                          KSNODE_TOPO_MUTE,       1 },
-    {   KSNODE_TOPO_MUTE,         0,                          PCFILTER_NODE,          KSPIN_TOPO_BRIDGE }
+    {   KSNODE_TOPO_MUTE,         0,                          KSNODE_TOPO_PEAKMETER,  1 },
+    {   KSNODE_TOPO_PEAKMETER,    0,                          PCFILTER_NODE,          KSPIN_TOPO_BRIDGE }
 };
 
 
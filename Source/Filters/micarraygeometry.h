@@ -0,0 +1,35 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    micarraygeometry.h
+
+Abstract:
+
+    Declaration of the mic array's microphone coordinates, shared by the
+    geometry the topology advertises and the capture stream that simulates
+    a source for it.
+
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_MICARRAYGEOMETRY_H_
+#define _VIRTUALAUDIODRIVER_MICARRAYGEOMETRY_H_
+
+//
+// A linear array of two cardioids 200 mm apart, facing ahead (x) and
+// lying across (y). Coordinates are in mm, angles in 1/10000 radians.
+//
+#define MICARRAY_MICROPHONES                    2
+
+//=============================================================================
+static
+const KSAUDIO_MICROPHONE_COORDINATES MicArrayMicrophones[MICARRAY_MICROPHONES] =
+{
+    //  usType                               X       Y       Z       Vertical    Horizontal
+    {   (USHORT)KSMICARRAY_MICTYPE_CARDIOID, 0,      100,    0,      0,          0 },
+    {   (USHORT)KSMICARRAY_MICTYPE_CARDIOID, 0,      -100,   0,      0,          0 },
+};
+
+#endif // _VIRTUALAUDIODRIVER_MICARRAYGEOMETRY_H_
@@ -20,6 +20,7 @@ Abstract:
 #include "kshelper.h"
 #include "micarraytopo.h"
 #include "micarray1toptable.h"
+#include "micarraygeometry.h"
 
 constexpr float MICARRAY_SENSITIVITY = -46.5f;
 constexpr float MICARRAY_SENSITIVITY2 = -23.5f;
@@ -85,7 +86,8 @@ Return Value:
         CMicArrayMiniportTopology(UnknownOuter,
             MiniportPair->TopoDescriptor,
             MiniportPair->DeviceMaxChannels,
-            MiniportPair->DeviceType);
+            MiniportPair->DeviceType,
+            MiniportPair->PairIndex);
     if (NULL == obj)
     {
         return STATUS_INSUFFICIENT_RESOURCES;
@@ -371,7 +373,7 @@ Return Value:
             }
             else
             {
-                ULONG cElements = 2;
+                ULONG cElements = MICARRAY_MICROPHONES;
                 ULONG cbNeeded = FIELD_OFFSET(KSAUDIO_MIC_ARRAY_GEOMETRY, KsMicCoord) +
                     cElements * sizeof(KSAUDIO_MICROPHONE_COORDINATES);
 
@@ -401,21 +403,12 @@ Return Value:
                         pMAG->usFrequencyBandLo = 100;      // Low end of Freq Range
                         pMAG->usFrequencyBandHi = 8000;     // High end of Freq Range
 
-                        pMAG->usNumberOfMicrophones = 2;    // Count of microphone coordinate structures to follow.
-
-                        pMAG->KsMicCoord[0].usType = (USHORT)KSMICARRAY_MICTYPE_CARDIOID;
-                        pMAG->KsMicCoord[0].wXCoord = 0;
-                        pMAG->KsMicCoord[0].wYCoord = 100;
-                        pMAG->KsMicCoord[0].wZCoord = 0;
-                        pMAG->KsMicCoord[0].wVerticalAngle = 0;
-                        pMAG->KsMicCoord[0].wHorizontalAngle = 0;
-
-                        pMAG->KsMicCoord[1].usType = (USHORT)KSMICARRAY_MICTYPE_CARDIOID;
-                        pMAG->KsMicCoord[1].wXCoord = 0;
-                        pMAG->KsMicCoord[1].wYCoord = -100;
-                        pMAG->KsMicCoord[1].wZCoord = 0;
-                        pMAG->KsMicCoord[1].wVerticalAngle = 0;
-                        pMAG->KsMicCoord[1].wHorizontalAngle = 0;
+                        pMAG->usNumberOfMicrophones = MICARRAY_MICROPHONES; // Count of microphone coordinate structures to follow.
+
+                        for (ULONG i = 0; i < MICARRAY_MICROPHONES; i++)
+                        {
+                            pMAG->KsMicCoord[i] = MicArrayMicrophones[i];
+                        }
                         ntStatus = STATUS_SUCCESS;
                     }
                 }
@@ -39,10 +39,11 @@ public:
         _In_opt_    PUNKNOWN                UnknownOuter,
         _In_        PCFILTER_DESCRIPTOR* FilterDesc,
         _In_        USHORT                  DeviceMaxChannels,
-        _In_        eDeviceType             DeviceType
+        _In_        eDeviceType             DeviceType,
+        _In_        ULONG                   PairIndex
     )
         : CUnknown(UnknownOuter),
-        CMiniportTopologyVirtualAudioDriver(FilterDesc, DeviceMaxChannels),
+        CMiniportTopologyVirtualAudioDriver(FilterDesc, DeviceMaxChannels, DeviceType, PairIndex),
         m_DeviceType(DeviceType)
     {
         ASSERT(m_DeviceType == eMicArrayDevice1);
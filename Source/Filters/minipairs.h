@@ -91,7 +91,7 @@ ENDPOINT_MINIPAIR SpeakerMiniports =
     SIZEOF_ARRAY(SpeakerPinDeviceFormatsAndModes),
     SpeakerTopologyPhysicalConnections,
     SIZEOF_ARRAY(SpeakerTopologyPhysicalConnections),
-    ENDPOINT_NO_FLAGS,
+    ENDPOINT_SAVE_DATA_FLAC,
 };
 
 //
@@ -170,8 +170,15 @@ PENDPOINT_MINIPAIR  g_CaptureEndpoints[] =
 
 //=============================================================================
 //
-// Total miniports = # endpoints * 2 (topology + wave).
+// Total miniports per pair = # endpoints * 2 (topology + wave).
 //
 #define g_MaxMiniports  ((g_cRenderEndpoints + g_cCaptureEndpoints) * 2)
 
+//=============================================================================
+//
+// Pairs installed, from the EndpointPairs registry value.
+//
+#define g_cEndpointPairs \
+    (g_EndpointPairs < 1 ? 1 : g_EndpointPairs > MAX_ENDPOINT_PAIRS ? MAX_ENDPOINT_PAIRS : (ULONG)g_EndpointPairs)
+
 #endif // _VIRTUALAUDIODRIVER_MINIPAIRS_H_
@@ -207,6 +207,26 @@ PCPROPERTY_ITEM SpeakerPropertiesAec[] =
 
 DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpeakerAec, SpeakerPropertiesAec);
 
+//=============================================================================
+static
+PCPROPERTY_ITEM SpeakerPropertiesPeakMeter[] =
+{
+    {
+        &KSPROPSETID_Audio,
+        KSPROPERTY_AUDIO_PEAKMETER2,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_SpeakerTopology
+    },
+    {
+        &KSPROPSETID_Audio,
+        KSPROPERTY_AUDIO_DEV_SPECIFIC,      // RMS level
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_SpeakerTopology
+    }
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpeakerPeakMeter, SpeakerPropertiesPeakMeter);
+
 //=============================================================================
 static
 PCNODE_DESCRIPTOR SpeakerTopologyNodes[] =
@@ -259,6 +279,13 @@ PCNODE_DESCRIPTOR SpeakerTopologyNodes[] =
       &AutomationSpeakerAec,        // AutomationTable
       &KSNODETYPE_ACOUSTIC_ECHO_CANCEL, // Type
       NULL                            // Name
+    },
+    // KSNODE_TOPO_SPEAKER_PEAKMETER
+    {
+      0,                              // Flags
+      &AutomationSpeakerPeakMeter,  // AutomationTable
+      &KSNODETYPE_PEAKMETER,          // Type
+      &KSAUDFNAME_PEAKMETER           // Name
     }
 };
 
@@ -269,6 +296,7 @@ C_ASSERT(KSNODE_TOPO_TREBLE == 3);
 C_ASSERT(KSNODE_TOPO_REVERB == 4);
 C_ASSERT(KSNODE_TOPO_CHORUS == 5);
 C_ASSERT(KSNODE_TOPO_AEC == 6);
+C_ASSERT(KSNODE_TOPO_SPEAKER_PEAKMETER == 7);
 
 static
 PCCONNECTION_DESCRIPTOR SpeakerTopoMiniportConnections[] =
@@ -280,7 +308,8 @@ PCCONNECTION_DESCRIPTOR SpeakerTopoMiniportConnections[] =
     {   KSNODE_TOPO_TREBLE,       0,                          KSNODE_TOPO_REVERB,     1 },
     {   KSNODE_TOPO_REVERB,       0,                          KSNODE_TOPO_CHORUS,     1 },
     {   KSNODE_TOPO_CHORUS,       0,                          KSNODE_TOPO_SPEAKER_MUTE,       1 },
-    {   KSNODE_TOPO_SPEAKER_MUTE,         0,                          PCFILTER_NODE,          KSPIN_TOPO_LINEOUT_DEST }
+    {   KSNODE_TOPO_SPEAKER_MUTE,         0,                          KSNODE_TOPO_SPEAKER_PEAKMETER,  1 },
+    {   KSNODE_TOPO_SPEAKER_PEAKMETER,    0,                          PCFILTER_NODE,          KSPIN_TOPO_LINEOUT_DEST }
 };
 
 //=============================================================================
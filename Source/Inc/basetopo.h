@@ -30,11 +30,14 @@ class CMiniportTopologyVirtualAudioDriver
     PPCFILTER_DESCRIPTOR        m_FilterDescriptor;     // Filter descriptor.
     PPORTEVENTS                 m_PortEvents;           // Event interface.
     USHORT                      m_DeviceMaxChannels;    // Max device channels.
+    ULONG                       m_ulMixerNodeBase;      // First mixer register of this device.
 
   public:
     CMiniportTopologyVirtualAudioDriver(
         _In_        PCFILTER_DESCRIPTOR    *FilterDesc,
-        _In_        USHORT                  DeviceMaxChannels
+        _In_        USHORT                  DeviceMaxChannels,
+        _In_        eDeviceType             DeviceType,
+        _In_        ULONG                   PairIndex
         );
     
     ~CMiniportTopologyVirtualAudioDriver();
@@ -127,6 +127,22 @@ typedef enum
     eMaxDeviceType,
 } eDeviceType;
 
+//
+// The adapter installs its endpoints once per endpoint pair (registry value
+// EndpointPairs), up to MAX_ENDPOINT_PAIRS.
+//
+#define MAX_ENDPOINT_PAIRS          64
+
+//
+// Each device of each pair has its own bank of mixer registers in the
+// adapter. A topology node's register is its node id within the device's
+// bank.
+//
+#define MIXER_NODES_PER_DEVICE      10
+#define MIXER_NODES_PER_PAIR        (eMaxDeviceType * MIXER_NODES_PER_DEVICE)
+#define MIXER_NODE(Pair, DeviceType, Node) \
+    ((ULONG)(Pair) * MIXER_NODES_PER_PAIR + (ULONG)(DeviceType) * MIXER_NODES_PER_DEVICE + (ULONG)(Node))
+
 //
 // Signal processing modes and default formats structs.
 //
@@ -195,6 +211,7 @@ typedef struct _VIRTUALAUDIODRIVER_DEVPROPERTY {
 #define ENDPOINT_NO_FLAGS                       0x00000000
 #define ENDPOINT_CELLULAR_PROVIDER1             0x00000008
 #define ENDPOINT_CELLULAR_PROVIDER2             0x00000010
+#define ENDPOINT_SAVE_DATA_FLAC                 0x00000020  // Data files are FLAC instead of WAVE.
 
 //
 // Endpoint miniport pair (wave/topology) descriptor.
@@ -229,6 +246,9 @@ typedef struct _ENDPOINT_MINIPAIR
 
     // General endpoint flags (one of more ENDPOINT_<flag-type>, see above)
     ULONG                           DeviceFlags;
+
+    // Endpoint pair this copy belongs to; the static templates are pair 0.
+    ULONG                           PairIndex;
 } ENDPOINT_MINIPAIR;
 
 //=============================================================================
@@ -238,6 +258,21 @@ typedef struct _ENDPOINT_MINIPAIR
 DEFINE_GUID(IID_IAdapterCommon,
 0x7eda2950, 0xbf9f, 0x11d0, 0x87, 0x1f, 0x0, 0xa0, 0xc9, 0x11, 0xb5, 0x44);
 
+//=============================================================================
+// Referenced Forward
+//=============================================================================
+class CLoopbackCable;
+typedef CLoopbackCable *PCLoopbackCable;
+
+class CCaptureFileCache;
+typedef CCaptureFileCache *PCCaptureFileCache;
+
+struct _SCHEDULER_ENTRY;
+typedef struct _SCHEDULER_ENTRY *PSCHEDULER_ENTRY;
+
+struct _PEAK_METER_LEVELS;
+typedef struct _PEAK_METER_LEVELS *PPEAK_METER_LEVELS;
+
 //=============================================================================
 // Interfaces
 //=============================================================================
@@ -355,6 +390,20 @@ DECLARE_INTERFACE_(IAdapterCommon, IUnknown)
         _In_  ULONG               Channel
     ) PURE;
 
+    STDMETHOD_(LONG,            MixerRmsMeterRead) 
+    ( 
+        THIS_ 
+        _In_  ULONG               Index,
+        _In_  ULONG               Channel
+    ) PURE;
+
+    STDMETHOD_(VOID,            MixerPeakMeterWrite) 
+    ( 
+        THIS_ 
+        _In_  ULONG               Index,
+        _In_  PPEAK_METER_LEVELS  Levels
+    ) PURE;
+
     // Tone Control (Bass/Treble)
     STDMETHOD_(LONG,            MixerBassRead) 
     ( 
@@ -436,6 +485,50 @@ DECLARE_INTERFACE_(IAdapterCommon, IUnknown)
         THIS 
     ) PURE;
 
+    // Generates the endpoints, TemplateCount per pair, with the state
+    // they index; see CEndpointArena.
+    STDMETHOD_(NTSTATUS,        InitEndpoints)
+    (
+        THIS_
+        _In_reads_(TemplateCount) PENDPOINT_MINIPAIR * Templates,
+        _In_  ULONG               TemplateCount,
+        _In_  ULONG               PairCount
+    ) PURE;
+
+    STDMETHOD_(PENDPOINT_MINIPAIR, GetEndpoint)
+    (
+        THIS_
+        _In_  ULONG               Pair,
+        _In_  ULONG               Template
+    ) PURE;
+
+    // A pair's speaker-to-microphone loopback, NULL when disabled.
+    STDMETHOD_(PCLoopbackCable, GetLoopbackCable)
+    (
+        THIS_
+        _In_  ULONG               Pair
+    ) PURE;
+
+    // Decoded capture source files, shared by the capture streams.
+    STDMETHOD_(PCCaptureFileCache, GetCaptureFileCache)
+    (
+        THIS
+    ) PURE;
+
+    // Adapter-wide stream timer.
+    STDMETHOD_(NTSTATUS,        ScheduleStreamTimer)
+    (
+        THIS_
+        _In_  PSCHEDULER_ENTRY    Entry,
+        _In_  ULONG               IntervalMs
+    ) PURE;
+
+    STDMETHOD_(VOID,            CancelStreamTimer)
+    (
+        THIS_
+        _In_  PSCHEDULER_ENTRY    Entry
+    ) PURE;
+
     STDMETHOD_(NTSTATUS,        WriteEtwEvent) 
     ( 
         THIS_ 
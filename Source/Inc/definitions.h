@@ -79,6 +79,11 @@ DEFINE_GUIDSTRUCT("836BA6D1-3FF7-4411-8BCD-469553452DCE", PID_VIRTUALAUDIODRIVER
 #define VOLUME_SIGNED_MAXIMUM       0x00000000
 #define VOLUME_SIGNED_MINIMUM       (-96 * 0x10000)
 
+// Default tone control (bass/treble) settings.
+#define TONE_STEPPING_DELTA         0x8000
+#define TONE_SIGNED_MAXIMUM         (12 * 0x10000)
+#define TONE_SIGNED_MINIMUM         (-12 * 0x10000)
+
 // Default peak meter settings
 #define PEAKMETER_STEPPING_DELTA    0x1000
 #define PEAKMETER_SIGNED_MAXIMUM    LONG_MAX
@@ -99,6 +104,10 @@ DEFINE_GUIDSTRUCT("836BA6D1-3FF7-4411-8BCD-469553452DCE", PID_VIRTUALAUDIODRIVER
 #define VOLUME_NORMALIZE_IN_RANGE(v) \
     VALUE_NORMALIZE_IN_RANGE_EX((v), VOLUME_SIGNED_MINIMUM, VOLUME_SIGNED_MAXIMUM, VOLUME_STEPPING_DELTA)
 
+// to normalize tone control values.
+#define TONE_NORMALIZE_IN_RANGE(v) \
+    VALUE_NORMALIZE_IN_RANGE_EX((v), TONE_SIGNED_MINIMUM, TONE_SIGNED_MAXIMUM, TONE_STEPPING_DELTA)
+
 // to normalize sample peak meter.
 #define PEAKMETER_NORMALIZE_IN_RANGE(v) \
     VALUE_NORMALIZE_IN_RANGE_EX((v), PEAKMETER_SIGNED_MINIMUM, PEAKMETER_SIGNED_MAXIMUM, PEAKMETER_STEPPING_DELTA)
@@ -172,6 +181,16 @@ typedef struct _PortClassDeviceContext              // 32       64      Byte off
 // Global settings.
 //
 extern DWORD g_DoNotCreateDataFiles;
+extern DWORD g_DisableLoopback;
+extern DWORD g_LoopbackResamplerQuality;
+extern DWORD g_LoopbackDriftCompensation;
+extern DWORD g_BinauralRender;
+extern DWORD g_MicArraySource;
+extern DWORD g_MicArraySourceAzimuth;
+extern DWORD g_MicArraySourceElevation;
+extern DWORD g_DataFileSegmentMB;
+extern DWORD g_DataFileSegmentSeconds;
+extern DWORD g_EndpointPairs;
 extern DWORD g_DisableBthScoBypass;
 extern UNICODE_STRING g_RegistryPath;
 
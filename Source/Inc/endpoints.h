@@ -82,7 +82,8 @@ enum
     KSNODE_TOPO_TREBLE,
     KSNODE_TOPO_REVERB,
     KSNODE_TOPO_CHORUS,
-    KSNODE_TOPO_AEC
+    KSNODE_TOPO_AEC,
+    KSNODE_TOPO_SPEAKER_PEAKMETER
 };
 
 //----------------------------------------------------
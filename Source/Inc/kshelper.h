@@ -45,6 +45,13 @@ PropertyHandler_BasicSupportVolume
     _In_  ULONG                 MaxChannels
 );
 
+NTSTATUS
+PropertyHandler_BasicSupportTone
+(
+    _In_  PPCPROPERTY_REQUEST   PropertyRequest,
+    _In_  ULONG                 MaxChannels
+);
+
 NTSTATUS
 PropertyHandler_BasicSupportMute
 (
@@ -70,7 +77,8 @@ PropertyHandler_Volume
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 );
 
 NTSTATUS                            
@@ -78,7 +86,8 @@ PropertyHandler_Mute
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 );
 
 NTSTATUS
@@ -86,7 +95,17 @@ PropertyHandler_PeakMeter2
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
+);
+
+NTSTATUS
+PropertyHandler_PeakMeterRms
+(
+    _In_  PADAPTERCOMMON        AdapterCommon,
+    _In_  PPCPROPERTY_REQUEST   PropertyRequest,
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 );
 
 NTSTATUS
@@ -94,7 +113,8 @@ PropertyHandler_Bass
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 );
 
 NTSTATUS
@@ -102,7 +122,8 @@ PropertyHandler_Treble
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 );
 
 NTSTATUS
@@ -110,7 +131,8 @@ PropertyHandler_Reverb
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 );
 
 NTSTATUS
@@ -118,7 +140,8 @@ PropertyHandler_Chorus
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 );
 
 NTSTATUS
@@ -126,7 +149,8 @@ PropertyHandler_AcousticEchoCancel
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 );
 
 //=============================================================================
@@ -45,10 +45,11 @@ public:
         _In_        PCFILTER_DESCRIPTOR    *FilterDesc,
         _In_        USHORT                  DeviceMaxChannels,
         _In_        eDeviceType             DeviceType, 
+        _In_        ULONG                   PairIndex,
         _In_opt_    PVOID                   DeviceContext
     )
     : CUnknown(UnknownOuter),
-      CMiniportTopologyVirtualAudioDriver(FilterDesc, DeviceMaxChannels),
+      CMiniportTopologyVirtualAudioDriver(FilterDesc, DeviceMaxChannels, DeviceType, PairIndex),
       m_DeviceType(DeviceType),
       m_DeviceContext(DeviceContext)
     {
@@ -0,0 +1,103 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    portable.h
+
+Abstract:
+
+    Minimal kernel/user-mode shim for the self-contained streaming cores
+    (rings, clocks, signal processing blocks). Those cores only use the types
+    and primitives below so they can also be built into a user-mode host for
+    stress testing and profiling.
+
+    None of the cores allocates. The ones with sizeable state (the
+    resampler, reverb, chorus, echo canceller, binaural virtualizer, mic
+    array source and format index) report what they need through
+    GetStorageBytes and run on storage the caller provides; the rest keep
+    their state inline.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_PORTABLE_H_
+#define _VIRTUALAUDIODRIVER_PORTABLE_H_
+
+#if defined(_KERNEL_MODE)
+
+//
+// Full barrier; orders payload copies against the index or sequence number
+// that publishes them in the lock-free structures.
+//
+#define VAD_MEMORY_BARRIER()    KeMemoryBarrier()
+
+// Spin-wait hint.
+#define VAD_CPU_PAUSE()         YieldProcessor()
+
+#else // !_KERNEL_MODE
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#if !defined(_WIN32)
+typedef uint8_t             BYTE;
+typedef BYTE               *PBYTE;
+typedef int16_t             SHORT;
+typedef uint16_t            USHORT;
+typedef int32_t             LONG;
+typedef LONG               *PLONG;
+typedef uint32_t            ULONG;
+typedef ULONG              *PULONG;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef int                 BOOL;
+typedef uint32_t            DWORD;
+typedef char16_t            WCHAR;
+typedef WCHAR              *PWSTR;
+typedef const WCHAR        *PCWSTR;
+typedef void                VOID;
+typedef void               *PVOID;
+typedef uintptr_t           ULONG_PTR;
+
+#ifndef TRUE
+#define TRUE                1
+#define FALSE               0
+#endif
+
+#define RtlCopyMemory(d, s, l)  memcpy((d), (s), (l))
+#define RtlMoveMemory(d, s, l)  memmove((d), (s), (l))
+#define RtlZeroMemory(d, l)     memset((d), 0, (l))
+#define RtlFillMemory(d, l, f)  memset((d), (f), (l))
+
+#define UNREFERENCED_PARAMETER(P)   ((void)(P))
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_updates_(s)
+#define _Inout_updates_bytes_(s)
+#define _In_reads_(s)
+#define _In_reads_bytes_(s)
+#define _Out_writes_(s)
+#define _Out_writes_bytes_(s)
+#define _Out_writes_bytes_to_(s, c)
+#endif // !_WIN32
+
+#define VAD_MEMORY_BARRIER()    std::atomic_thread_fence(std::memory_order_seq_cst)
+
+#if defined(_WIN32)
+#define VAD_CPU_PAUSE()         YieldProcessor()
+#elif defined(__x86_64__) || defined(__i386__)
+#define VAD_CPU_PAUSE()         __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define VAD_CPU_PAUSE()         __asm__ __volatile__("yield")
+#else
+#define VAD_CPU_PAUSE()         ((void)0)
+#endif
+
+#endif // _KERNEL_MODE
+
+#endif // _VIRTUALAUDIODRIVER_PORTABLE_H_
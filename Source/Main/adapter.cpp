@@ -50,6 +50,16 @@ DRIVER_DISPATCH PnpHandler;
 //
 DWORD g_DoNotCreateDataFiles = 1;  // default is off.
 DWORD g_DisableToneGenerator = 1;  // default is to not generate tones.
+DWORD g_DisableLoopback = 0;       // default is to loop speaker audio back to the mic.
+DWORD g_LoopbackResamplerQuality = 1; // default is the medium eResamplerQuality tier.
+DWORD g_LoopbackDriftCompensation = 0; // default is to pass matching formats byte for byte.
+DWORD g_BinauralRender = 0;        // default is to save and loop back surround render audio as is.
+DWORD g_MicArraySource = 0;        // default is to capture the same audio on every mic array channel.
+DWORD g_MicArraySourceAzimuth = 0; // degrees, signed; default is straight ahead.
+DWORD g_MicArraySourceElevation = 0;
+DWORD g_DataFileSegmentMB = 0;     // default is one data file per stream, RF64 past 4 GB.
+DWORD g_DataFileSegmentSeconds = 0;
+DWORD g_EndpointPairs = 1;         // default is one speaker and one mic array; up to MAX_ENDPOINT_PAIRS.
 UNICODE_STRING g_RegistryPath;      // This is used to store the registry settings path for the driver
 
 //-----------------------------------------------------------------------------
@@ -200,6 +210,16 @@ Returns:
     // QueryRoutine     Flags                                               Name                     EntryContext             DefaultType                                                    DefaultData              DefaultLength
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"DoNotCreateDataFiles", &g_DoNotCreateDataFiles, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_DoNotCreateDataFiles, sizeof(ULONG)},
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"DisableToneGenerator", &g_DisableToneGenerator, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_DisableToneGenerator, sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"DisableLoopback",      &g_DisableLoopback,      (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_DisableLoopback,      sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"LoopbackResamplerQuality", &g_LoopbackResamplerQuality, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_LoopbackResamplerQuality, sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"LoopbackDriftCompensation", &g_LoopbackDriftCompensation, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_LoopbackDriftCompensation, sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"BinauralRender",       &g_BinauralRender,       (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_BinauralRender,       sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"MicArraySource",       &g_MicArraySource,       (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_MicArraySource,       sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"MicArraySourceAzimuth", &g_MicArraySourceAzimuth, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_MicArraySourceAzimuth, sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"MicArraySourceElevation", &g_MicArraySourceElevation, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_MicArraySourceElevation, sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"DataFileSegmentMB",    &g_DataFileSegmentMB,    (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_DataFileSegmentMB,    sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"DataFileSegmentSeconds", &g_DataFileSegmentSeconds, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_DataFileSegmentSeconds, sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"EndpointPairs",        &g_EndpointPairs,        (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_EndpointPairs,        sizeof(ULONG)},
         { NULL,   0,                                                        NULL,                    NULL,                    0,                                                             NULL,                    0}
     };
 
@@ -240,6 +260,16 @@ Returns:
     //
     DPF(D_VERBOSE, ("DoNotCreateDataFiles: %u", g_DoNotCreateDataFiles));
     DPF(D_VERBOSE, ("DisableToneGenerator: %u", g_DisableToneGenerator));
+    DPF(D_VERBOSE, ("DisableLoopback: %u", g_DisableLoopback));
+    DPF(D_VERBOSE, ("LoopbackResamplerQuality: %u", g_LoopbackResamplerQuality));
+    DPF(D_VERBOSE, ("LoopbackDriftCompensation: %u", g_LoopbackDriftCompensation));
+    DPF(D_VERBOSE, ("BinauralRender: %u", g_BinauralRender));
+    DPF(D_VERBOSE, ("MicArraySource: %u", g_MicArraySource));
+    DPF(D_VERBOSE, ("MicArraySourceAzimuth: %d", (LONG)g_MicArraySourceAzimuth));
+    DPF(D_VERBOSE, ("MicArraySourceElevation: %d", (LONG)g_MicArraySourceElevation));
+    DPF(D_VERBOSE, ("DataFileSegmentMB: %u", g_DataFileSegmentMB));
+    DPF(D_VERBOSE, ("DataFileSegmentSeconds: %u", g_DataFileSegmentSeconds));
+    DPF(D_VERBOSE, ("EndpointPairs: %u", g_EndpointPairs));
 
     if (DriverKey)
     {
@@ -411,7 +441,7 @@ Return Value:
 
     DPF(D_TERSE, ("[AddDevice]"));
 
-    maxObjects = g_MaxMiniports;
+    maxObjects = g_MaxMiniports * g_cEndpointPairs;
 
     // Tell the class driver to add the device.
     //
@@ -601,14 +631,19 @@ InstallAllRenderFilters(
     )
 {
     NTSTATUS            ntStatus;
-    PENDPOINT_MINIPAIR* ppAeMiniports   = g_RenderEndpoints;
     
     PAGED_CODE();
 
-    for(ULONG i = 0; i < g_cRenderEndpoints; ++i, ++ppAeMiniports)
+    //
+    // Render templates come first in each pair; see StartDevice.
+    //
+    for (ULONG p = 0; p < g_cEndpointPairs; ++p)
     {
-        ntStatus = InstallEndpointRenderFilters(_pDeviceObject, _pIrp, _pAdapterCommon, *ppAeMiniports);
-        IF_FAILED_JUMP(ntStatus, Exit);
+        for (ULONG i = 0; i < g_cRenderEndpoints; ++i)
+        {
+            ntStatus = InstallEndpointRenderFilters(_pDeviceObject, _pIrp, _pAdapterCommon, _pAdapterCommon->GetEndpoint(p, i));
+            IF_FAILED_JUMP(ntStatus, Exit);
+        }
     }
     
     ntStatus = STATUS_SUCCESS;
@@ -652,14 +687,16 @@ InstallAllCaptureFilters(
 )
 {
     NTSTATUS            ntStatus;
-    PENDPOINT_MINIPAIR* ppAeMiniports = g_CaptureEndpoints;
 
     PAGED_CODE();
 
-    for (ULONG i = 0; i < g_cCaptureEndpoints; ++i, ++ppAeMiniports)
+    for (ULONG p = 0; p < g_cEndpointPairs; ++p)
     {
-        ntStatus = InstallEndpointCaptureFilters(_pDeviceObject, _pIrp, _pAdapterCommon, *ppAeMiniports);
-        IF_FAILED_JUMP(ntStatus, Exit);
+        for (ULONG i = 0; i < g_cCaptureEndpoints; ++i)
+        {
+            ntStatus = InstallEndpointCaptureFilters(_pDeviceObject, _pIrp, _pAdapterCommon, _pAdapterCommon->GetEndpoint(p, g_cRenderEndpoints + i));
+            IF_FAILED_JUMP(ntStatus, Exit);
+        }
     }
 
     ntStatus = STATUS_SUCCESS;
@@ -712,6 +749,7 @@ Return Value:
     NTSTATUS                    ntStatus        = STATUS_SUCCESS;
 
     PADAPTERCOMMON              pAdapterCommon  = NULL;
+    PENDPOINT_MINIPAIR          templates[g_cRenderEndpoints + g_cCaptureEndpoints];
     PUNKNOWN                    pUnknownCommon  = NULL;
     PortClassDeviceContext*     pExtension      = static_cast<PortClassDeviceContext*>(DeviceObject->DeviceExtension);
 
@@ -734,6 +772,15 @@ Return Value:
     ntStatus = pAdapterCommon->Init(DeviceObject);
     IF_FAILED_JUMP(ntStatus, Exit);
 
+    //
+    // Generate g_cEndpointPairs copies of the endpoints: render, then capture.
+    //
+    RtlCopyMemory(templates, g_RenderEndpoints, sizeof(g_RenderEndpoints));
+    RtlCopyMemory(templates + g_cRenderEndpoints, g_CaptureEndpoints, sizeof(g_CaptureEndpoints));
+
+    ntStatus = pAdapterCommon->InitEndpoints(templates, SIZEOF_ARRAY(templates), g_cEndpointPairs);
+    IF_FAILED_JUMP(ntStatus, Exit);
+
     //
     // register with PortCls for power-management services
     ntStatus = PcRegisterAdapterPowerManagement( PUNKNOWN(pAdapterCommon), DeviceObject);
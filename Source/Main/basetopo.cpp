@@ -24,7 +24,9 @@ Abstract:
 CMiniportTopologyVirtualAudioDriver::CMiniportTopologyVirtualAudioDriver
 (
     _In_        PCFILTER_DESCRIPTOR    *FilterDesc,
-    _In_        USHORT                  DeviceMaxChannels
+    _In_        USHORT                  DeviceMaxChannels,
+    _In_        eDeviceType             DeviceType,
+    _In_        ULONG                   PairIndex
 )
 /*++
 
@@ -38,6 +40,10 @@ Arguments:
 
   DeviceMaxChannels - 
 
+  DeviceType - picks the device's bank of mixer registers
+
+  PairIndex - and the endpoint pair's
+
 Return Value:
 
   void
@@ -56,6 +62,8 @@ Return Value:
     
     ASSERT(DeviceMaxChannels > 0);
     m_DeviceMaxChannels = DeviceMaxChannels;
+
+    m_ulMixerNodeBase   = MIXER_NODE(PairIndex, DeviceType, 0);
 } // CMiniportTopologyVirtualAudioDriver
 
 CMiniportTopologyVirtualAudioDriver::~CMiniportTopologyVirtualAudioDriver
@@ -279,21 +287,24 @@ Return Value:
             ntStatus = PropertyHandler_Volume(
                                 m_AdapterCommon,
                                 PropertyRequest,
-                                m_DeviceMaxChannels);
+                                m_DeviceMaxChannels,
+                                m_ulMixerNodeBase + PropertyRequest->Node);
             break;
         
         case KSPROPERTY_AUDIO_MUTE:
             ntStatus = PropertyHandler_Mute(
                                 m_AdapterCommon,
                                 PropertyRequest,
-                                m_DeviceMaxChannels);
+                                m_DeviceMaxChannels,
+                                m_ulMixerNodeBase + PropertyRequest->Node);
             break;
 
         case KSPROPERTY_AUDIO_PEAKMETER2:
             ntStatus = PropertyHandler_PeakMeter2(
                                 m_AdapterCommon,
                                 PropertyRequest,
-                                m_DeviceMaxChannels);
+                                m_DeviceMaxChannels,
+                                m_ulMixerNodeBase + PropertyRequest->Node);
             break;
 
         case KSPROPERTY_AUDIO_CPU_RESOURCES:
@@ -305,42 +316,58 @@ Return Value:
             break;
 
         case KSPROPERTY_AUDIO_DEV_SPECIFIC:
+            // Peak meter nodes report their RMS level. Their ids differ
+            // between filters, so they are picked by node type.
+            if (PropertyRequest->Node < m_FilterDescriptor->NodeCount &&
+                IsEqualGUIDAligned(*m_FilterDescriptor->Nodes[PropertyRequest->Node].Type, KSNODETYPE_PEAKMETER))
+            {
+                ntStatus = PropertyHandler_PeakMeterRms(
+                                    m_AdapterCommon,
+                                    PropertyRequest,
+                                    m_DeviceMaxChannels,
+                                    m_ulMixerNodeBase + PropertyRequest->Node);
+            }
             // Route to appropriate handler based on node
             // Node IDs: KSNODE_TOPO_BASS=2, KSNODE_TOPO_TREBLE=3, KSNODE_TOPO_REVERB=4, KSNODE_TOPO_CHORUS=5, KSNODE_TOPO_AEC=6
-            if (PropertyRequest->Node == KSNODE_TOPO_BASS)
+            else if (PropertyRequest->Node == KSNODE_TOPO_BASS)
             {
                 ntStatus = PropertyHandler_Bass(
                                     m_AdapterCommon,
                                     PropertyRequest,
-                                    m_DeviceMaxChannels);
+                                    m_DeviceMaxChannels,
+                                    m_ulMixerNodeBase + PropertyRequest->Node);
             }
             else if (PropertyRequest->Node == KSNODE_TOPO_TREBLE)
             {
                 ntStatus = PropertyHandler_Treble(
                                     m_AdapterCommon,
                                     PropertyRequest,
-                                    m_DeviceMaxChannels);
+                                    m_DeviceMaxChannels,
+                                    m_ulMixerNodeBase + PropertyRequest->Node);
             }
             else if (PropertyRequest->Node == KSNODE_TOPO_REVERB)
             {
                 ntStatus = PropertyHandler_Reverb(
                                     m_AdapterCommon,
                                     PropertyRequest,
-                                    m_DeviceMaxChannels);
+                                    m_DeviceMaxChannels,
+                                    m_ulMixerNodeBase + PropertyRequest->Node);
             }
             else if (PropertyRequest->Node == KSNODE_TOPO_CHORUS)
             {
                 ntStatus = PropertyHandler_Chorus(
                                     m_AdapterCommon,
                                     PropertyRequest,
-                                    m_DeviceMaxChannels);
+                                    m_DeviceMaxChannels,
+                                    m_ulMixerNodeBase + PropertyRequest->Node);
             }
             else if (PropertyRequest->Node == KSNODE_TOPO_AEC)
             {
                 ntStatus = PropertyHandler_AcousticEchoCancel(
                                     m_AdapterCommon,
                                     PropertyRequest,
-                                    m_DeviceMaxChannels);
+                                    m_DeviceMaxChannels,
+                                    m_ulMixerNodeBase + PropertyRequest->Node);
             }
             else
             {
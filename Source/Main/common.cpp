@@ -17,18 +17,45 @@ Abstract:
 #include "definitions.h"
 #include "hw.h"
 #include "savedata.h"
+#include "loopback.h"
+#include "endpointarena.h"
+#include "subdevicetable.h"
+#include "capturefile.h"
+#include "streamscheduler.h"
 #include "endpoints.h"
 
 //-----------------------------------------------------------------------------
 // CSaveData statics
 //-----------------------------------------------------------------------------
 
-PSAVEWORKER_PARAM       CSaveData::m_pWorkItems = NULL;
 PDEVICE_OBJECT          CSaveData::m_pDeviceObject = NULL;
+
+EXT_CALLBACK            StreamTimerNotify;
 //=============================================================================
 // Classes
 //=============================================================================
 
+//=============================================================================
+// Cached subdevice, see CAdapterCommon::CacheSubdevice.
+//
+typedef struct _MINIPAIR_UNKNOWN
+{
+    LIST_ENTRY              ListEntry;
+    WCHAR                   Name[MAX_PATH];
+    ULONG                   NameHash;               // CSubdeviceTable::Hash(Name)
+    PUNKNOWN                PortInterface;
+    PUNKNOWN                MiniportInterface;
+    PADAPTERPOWERMANAGEMENT PowerInterface;
+} MINIPAIR_UNKNOWN;
+
+//
+// Name index slots; half of them can be used. Each endpoint caches a
+// topology and a wave subdevice.
+//
+#define SUBDEVICE_CACHE_SLOTS   1024
+
+typedef CSubdeviceTable<MINIPAIR_UNKNOWN, SUBDEVICE_CACHE_SLOTS> CSubdeviceCacheIndex;
+
 ///////////////////////////////////////////////////////////////////////////////
 // CAdapterCommon
 //   
@@ -45,6 +72,17 @@ class CAdapterCommon :
         DEVICE_POWER_STATE      m_PowerState;  
 
         PCVirtualAudioDriverHW   m_pHW;                  // Virtual Simple Audio Sample HW object
+        PVOID                   m_pEndpointArena;       // Backs m_Endpoints
+        CEndpointArena<ENDPOINT_MINIPAIR> m_Endpoints;  // Endpoints, their mixer registers and loopbacks
+        PCLoopbackCable *       m_ppLoopbacks;          // Speaker-to-microphone loopback per pair
+        ULONG                   m_ulPairs;
+        PCCaptureFileCache      m_pCaptureFileCache;    // Capture source files
+
+        // One periodic timer drives every running stream.
+        PEX_TIMER               m_pStreamTimer;
+        BOOL                    m_bStreamTimerRunning;
+        KSPIN_LOCK              m_StreamSchedulerLock;
+        CStreamScheduler        m_StreamScheduler;
         PPORTCLSETWHELPER       m_pPortClsEtwHelper;
 
         static LONG             m_AdapterInstances;     // # of adapter objects.
@@ -122,6 +160,36 @@ class CAdapterCommon :
 
         STDMETHODIMP_(void)     MixerReset(void);
 
+        STDMETHODIMP_(NTSTATUS) InitEndpoints
+        (
+            _In_reads_(TemplateCount) PENDPOINT_MINIPAIR * Templates,
+            _In_  ULONG           TemplateCount,
+            _In_  ULONG           PairCount
+        );
+
+        STDMETHODIMP_(PENDPOINT_MINIPAIR) GetEndpoint
+        (
+            _In_  ULONG           Pair,
+            _In_  ULONG           Template
+        );
+
+        STDMETHODIMP_(PCLoopbackCable) GetLoopbackCable
+        (
+            _In_  ULONG           Pair
+        );
+        STDMETHODIMP_(PCCaptureFileCache) GetCaptureFileCache(void);
+
+        STDMETHODIMP_(NTSTATUS) ScheduleStreamTimer
+        (
+            _In_  PSCHEDULER_ENTRY    Entry,
+            _In_  ULONG               IntervalMs
+        );
+
+        STDMETHODIMP_(void)     CancelStreamTimer
+        (
+            _In_  PSCHEDULER_ENTRY    Entry
+        );
+
         STDMETHODIMP_(LONG)     MixerVolumeRead
         ( 
             _In_  ULONG           Index,
@@ -141,6 +209,18 @@ class CAdapterCommon :
             _In_  ULONG           Channel
         );
 
+        STDMETHODIMP_(LONG)     MixerRmsMeterRead
+        ( 
+            _In_  ULONG           Index,
+            _In_  ULONG           Channel
+        );
+
+        STDMETHODIMP_(VOID)     MixerPeakMeterWrite
+        ( 
+            _In_  ULONG           Index,
+            _In_  PPEAK_METER_LEVELS Levels
+        );
+
         // Tone Control (Bass/Treble)
         STDMETHODIMP_(LONG)     MixerBassRead
         (
@@ -298,6 +378,8 @@ class CAdapterCommon :
 
         //=====================================================================
         // friends
+        friend EXT_CALLBACK     StreamTimerNotify;
+
         friend NTSTATUS         NewAdapterCommon
         ( 
             _Out_       PUNKNOWN *              Unknown,
@@ -308,7 +390,8 @@ class CAdapterCommon :
 
     private:
 
-    LIST_ENTRY m_SubdeviceCache;
+    LIST_ENTRY m_SubdeviceCache;            // In caching order, for power changes
+    CSubdeviceCacheIndex m_SubdeviceIndex;  // Same records by name
 
     NTSTATUS GetCachedSubdevice
     (
@@ -347,15 +430,6 @@ class CAdapterCommon :
     );
 };
 
-typedef struct _MINIPAIR_UNKNOWN
-{
-    LIST_ENTRY              ListEntry;
-    WCHAR                   Name[MAX_PATH];
-    PUNKNOWN                PortInterface;
-    PUNKNOWN                MiniportInterface;
-    PADAPTERPOWERMANAGEMENT PowerInterface;
-} MINIPAIR_UNKNOWN;
-
 #define MAX_DEVICE_REG_KEY_LENGTH 0x100
 
 //
@@ -497,13 +571,52 @@ Return Value:
     PAGED_CODE();
     DPF_ENTER(("[CAdapterCommon::~CAdapterCommon]"));
 
+    if (m_pStreamTimer)
+    {
+        ExDeleteTimer
+        (
+            m_pStreamTimer,
+            TRUE, // Cancel the timer if it is currently set.
+            TRUE, // Wait for a running StreamTimerNotify to finish.
+            NULL
+        );
+        m_pStreamTimer = NULL;
+    }
+
     if (m_pHW)
     {
         delete m_pHW;
         m_pHW = NULL;
     }
+
+    if (m_ppLoopbacks)
+    {
+        for (ULONG i = 0; i < m_ulPairs; i++)
+        {
+            if (m_ppLoopbacks[i])
+            {
+                delete m_ppLoopbacks[i];
+                m_ppLoopbacks[i] = NULL;
+            }
+        }
+        m_ppLoopbacks = NULL;
+    }
+
+    //
+    // The HW's registers and the loopback array live in the arena.
+    //
+    if (m_pEndpointArena)
+    {
+        ExFreePoolWithTag(m_pEndpointArena, MINADAPTER_POOLTAG);
+        m_pEndpointArena = NULL;
+    }
+
+    if (m_pCaptureFileCache)
+    {
+        delete m_pCaptureFileCache;
+        m_pCaptureFileCache = NULL;
+    }
     
-    CSaveData::DestroyWorkItems();
     SAFE_RELEASE(m_pPortClsEtwHelper);
     SAFE_RELEASE(m_pServiceGroupWave);
  
@@ -633,9 +746,18 @@ Return Value:
     m_WdfDevice             = NULL;
     m_PowerState            = PowerDeviceD0;
     m_pHW                   = NULL;
+    m_pEndpointArena        = NULL;
+    m_ppLoopbacks           = NULL;
+    m_ulPairs               = 0;
+    m_pCaptureFileCache     = NULL;
+    m_pStreamTimer          = NULL;
+    m_bStreamTimerRunning   = FALSE;
     m_pPortClsEtwHelper     = NULL;
 
+    KeInitializeSpinLock(&m_StreamSchedulerLock);
+
     InitializeListHead(&m_SubdeviceCache);
+    m_SubdeviceIndex.Reset();
 
     //
     // Get the PDO.
@@ -673,14 +795,38 @@ Return Value:
     }
     IF_FAILED_JUMP(ntStatus, Done);
     
+    // Its registers come with the endpoints; see InitEndpoints.
+    //
     m_pHW->MixerReset();
 
+    //
+    // Shared stream timer. It is only armed while at least one stream runs.
+    //
+    m_pStreamTimer = ExAllocateTimer(StreamTimerNotify, this, EX_TIMER_HIGH_RESOLUTION);
+    if (!m_pStreamTimer)
+    {
+        DPF(D_TERSE, ("Insufficient memory for stream timer"));
+        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    IF_FAILED_JUMP(ntStatus, Done);
+
+    //
+    // Files the capture streams play instead of the loopback; see
+    // CMiniportWaveRTStream::WriteBytes.
+    //
+    m_pCaptureFileCache = new (POOL_FLAG_NON_PAGED, VIRTUALAUDIODRIVER_POOLTAG) CCaptureFileCache;
+    if (!m_pCaptureFileCache)
+    {
+        DPF(D_TERSE, ("Insufficient memory for capture file cache"));
+        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    IF_FAILED_JUMP(ntStatus, Done);
+
     //
     // Initialize SaveData class.
     //
     CSaveData::SetDeviceObject(DeviceObject);   //device object is needed by CSaveData
-    ntStatus = CSaveData::InitializeWorkItems(DeviceObject);
-    IF_FAILED_JUMP(ntStatus, Done);
+
 Done:
 
     return ntStatus;
@@ -715,6 +861,393 @@ Return Value:
     }
 } // MixerReset
 
+//=============================================================================
+#pragma code_seg("PAGE")
+STDMETHODIMP_(NTSTATUS)
+CAdapterCommon::InitEndpoints
+( 
+    _In_reads_(TemplateCount) PENDPOINT_MINIPAIR * Templates,
+    _In_  ULONG           TemplateCount,
+    _In_  ULONG           PairCount
+)
+/*++
+
+Routine Description:
+
+  Generates PairCount copies of the TemplateCount endpoint descriptors in
+  Templates, and with them each pair's mixer registers and
+  speaker-to-microphone loopback. Everything but the loopback cables
+  themselves comes out of one nonpaged block; see CEndpointArena.
+
+  Call once, after Init and before the endpoints are installed.
+
+Arguments:
+
+  Templates - the endpoint descriptors of one pair
+
+  TemplateCount - number of entries in Templates
+
+  PairCount - number of pairs, clamped to 1..MAX_ENDPOINT_PAIRS
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    PAGED_CODE();
+    DPF_ENTER(("[CAdapterCommon::InitEndpoints]"));
+
+    ASSERT(m_pHW);
+    ASSERT(m_pEndpointArena == NULL);
+
+    NTSTATUS                ntStatus = STATUS_SUCCESS;
+    ULONG                   cbArena;
+    ULONG                   ulNodes;
+    PMIXER_NODE_REGISTERS   pNodes;
+
+    if (Templates == NULL || TemplateCount == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (PairCount < 1)
+    {
+        PairCount = 1;
+    }
+    else if (PairCount > MAX_ENDPOINT_PAIRS)
+    {
+        PairCount = MAX_ENDPOINT_PAIRS;
+    }
+
+    ulNodes = PairCount * MIXER_NODES_PER_PAIR;
+    cbArena = CEndpointArena<ENDPOINT_MINIPAIR>::GetDescriptorBytes(TemplateCount, PairCount) +
+              CEndpointArena<ENDPOINT_MINIPAIR>::Align(ulNodes * sizeof(MIXER_NODE_REGISTERS)) +
+              CEndpointArena<ENDPOINT_MINIPAIR>::Align(PairCount * sizeof(PCLoopbackCable));
+
+    m_pEndpointArena = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbArena, MINADAPTER_POOLTAG);
+    if (!m_pEndpointArena)
+    {
+        DPF(D_TERSE, ("Insufficient memory for %u endpoint pairs", PairCount));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    m_Endpoints.Init(m_pEndpointArena, cbArena);
+    if (!m_Endpoints.Generate(Templates, TemplateCount, PairCount))
+    {
+        DPF(D_ERROR, ("Endpoint names too long for %u pairs", PairCount));
+        return STATUS_NAME_TOO_LONG;
+    }
+
+    pNodes = (PMIXER_NODE_REGISTERS)m_Endpoints.Allocate(ulNodes * sizeof(MIXER_NODE_REGISTERS));
+    m_ppLoopbacks = (PCLoopbackCable *)m_Endpoints.Allocate(PairCount * sizeof(PCLoopbackCable));
+    ASSERT(pNodes && m_ppLoopbacks);
+
+    m_pHW->AttachNodes(pNodes, ulNodes);
+    m_ulPairs = PairCount;
+
+    //
+    // Speaker-to-microphone loopback, one per pair so pairs stay apart.
+    // Render streams feed it and capture streams drain it; see
+    // CMiniportWaveRTStream::ReadBytes/WriteBytes.
+    //
+    if (!g_DisableLoopback)
+    {
+        for (ULONG i = 0; i < PairCount; i++)
+        {
+            m_ppLoopbacks[i] = new (POOL_FLAG_NON_PAGED, VIRTUALAUDIODRIVER_POOLTAG) CLoopbackCable;
+            if (!m_ppLoopbacks[i])
+            {
+                DPF(D_TERSE, ("Insufficient memory for loopback cable"));
+                ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+            }
+            IF_FAILED_JUMP(ntStatus, Done);
+
+            ntStatus = m_ppLoopbacks[i]->Init(g_LoopbackResamplerQuality, g_LoopbackDriftCompensation != 0);
+            IF_FAILED_JUMP(ntStatus, Done);
+        }
+    }
+
+Done:
+
+    return ntStatus;
+} // InitEndpoints
+
+//=============================================================================
+#pragma code_seg("PAGE")
+STDMETHODIMP_(PENDPOINT_MINIPAIR)
+CAdapterCommon::GetEndpoint
+( 
+    _In_  ULONG           Pair,
+    _In_  ULONG           Template
+)
+/*++
+
+Routine Description:
+
+  Returns a generated endpoint descriptor.
+
+Arguments:
+
+  Pair - endpoint pair
+
+  Template - index into the templates given to InitEndpoints
+
+Return Value:
+
+  PENDPOINT_MINIPAIR, or NULL past the end.
+
+--*/
+{
+    PAGED_CODE();
+
+    return m_Endpoints.GetEndpoint(Pair, Template);
+} // GetEndpoint
+
+//=============================================================================
+#pragma code_seg()
+STDMETHODIMP_(PCLoopbackCable)
+CAdapterCommon::GetLoopbackCable
+( 
+    _In_  ULONG           Pair
+)
+/*++
+
+Routine Description:
+
+  Returns a pair's speaker-to-microphone loopback cable. Streams call this
+  from Init and cache the pointer; the adapter outlives its streams.
+
+Arguments:
+
+  Pair - endpoint pair, see ENDPOINT_MINIPAIR
+
+Return Value:
+
+  PCLoopbackCable, or NULL if loopback is disabled.
+
+--*/
+{
+    if (m_ppLoopbacks == NULL || Pair >= m_ulPairs)
+    {
+        return NULL;
+    }
+
+    return m_ppLoopbacks[Pair];
+} // GetLoopbackCable
+
+//=============================================================================
+#pragma code_seg()
+STDMETHODIMP_(PCCaptureFileCache)
+CAdapterCommon::GetCaptureFileCache
+( 
+    void 
+)
+/*++
+
+Routine Description:
+
+  Returns the cache of decoded capture source files. Streams call this from
+  Init and cache the pointer; the adapter outlives its streams.
+
+Arguments:
+
+Return Value:
+
+  PCCaptureFileCache.
+
+--*/
+{
+    return m_pCaptureFileCache;
+} // GetCaptureFileCache
+
+//=============================================================================
+#pragma code_seg()
+STDMETHODIMP_(NTSTATUS)
+CAdapterCommon::ScheduleStreamTimer
+(
+    _In_  PSCHEDULER_ENTRY    Entry,
+    _In_  ULONG               IntervalMs
+)
+/*++
+
+Routine Description:
+
+  Adds a running stream to the shared timer. The stream's callback runs on
+  the next 1 ms tick and then whenever the deadline it returns has passed.
+  Arms the timer if this is the first stream.
+
+Arguments:
+
+  Entry - stream's scheduler entry, initialized with its callback.
+
+  IntervalMs - stream's notification interval, used to group streams.
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    NTSTATUS    ntStatus = STATUS_SUCCESS;
+    KIRQL       oldIrql;
+
+    KeAcquireSpinLock(&m_StreamSchedulerLock, &oldIrql);
+
+    if (!m_StreamScheduler.Add(Entry, IntervalMs, 0))
+    {
+        ntStatus = STATUS_INVALID_DEVICE_STATE;
+    }
+    else if (!m_bStreamTimerRunning)
+    {
+        // Fire every 1 ms. The timer emulates the hardware interrupt that would
+        // signal packet completion; real hardware should not run a 1 ms timer as
+        // it will drain power.
+        ExSetTimer
+        (
+            m_pStreamTimer,
+            (-1) * HNSTIME_PER_MILLISECOND,
+            HNSTIME_PER_MILLISECOND,
+            NULL
+        );
+        m_bStreamTimerRunning = TRUE;
+    }
+
+    KeReleaseSpinLock(&m_StreamSchedulerLock, oldIrql);
+
+    return ntStatus;
+} // ScheduleStreamTimer
+
+//=============================================================================
+#pragma code_seg()
+STDMETHODIMP_(void)
+CAdapterCommon::CancelStreamTimer
+(
+    _In_  PSCHEDULER_ENTRY    Entry
+)
+/*++
+
+Routine Description:
+
+  Removes a stream from the shared timer. Ticks run the callbacks outside
+  the scheduler lock, so this waits for one that is already running; once
+  it returns the stream's callback is not running and will not run again.
+  Disarms the timer when no stream is left.
+
+  Must not be called from the stream's own callback.
+
+Arguments:
+
+  Entry - stream's scheduler entry.
+
+--*/
+{
+    KIRQL       oldIrql;
+
+    KeAcquireSpinLock(&m_StreamSchedulerLock, &oldIrql);
+
+    m_StreamScheduler.Remove(Entry);
+
+    if (m_bStreamTimerRunning && m_StreamScheduler.GetEntryCount() == 0)
+    {
+        ExCancelTimer(m_pStreamTimer, NULL);
+        m_bStreamTimerRunning = FALSE;
+    }
+
+    KeReleaseSpinLock(&m_StreamSchedulerLock, oldIrql);
+
+    //
+    // A tick may have collected the entry before it was removed. Complete
+    // clears the flag under the lock, so once it is clear, taking the lock
+    // waits out the rest of Complete and the tick is done with the entry.
+    //
+    while (CStreamScheduler::IsInCallback(Entry))
+    {
+        YieldProcessor();
+    }
+
+    KeAcquireSpinLock(&m_StreamSchedulerLock, &oldIrql);
+    KeReleaseSpinLock(&m_StreamSchedulerLock, oldIrql);
+} // CancelStreamTimer
+
+//=============================================================================
+#pragma code_seg()
+void
+StreamTimerNotify
+(
+    _In_      PEX_TIMER    Timer,
+    _In_opt_  PVOID        DeferredContext
+)
+/*++
+
+Routine Description:
+
+  Shared 1 ms tick. Runs every stream whose deadline has passed; see
+  TimerNotifyRT for the per-stream work. Only picking the due streams and
+  booking their next deadlines happen under the scheduler lock; the
+  callbacks run without it, so one stream's processing never holds up
+  another stream starting or stopping.
+
+Arguments:
+
+  Timer - m_pStreamTimer.
+
+  DeferredContext - the adapter.
+
+--*/
+{
+    LARGE_INTEGER       qpc;
+    LARGE_INTEGER       qpcFrequency;
+    KIRQL               oldIrql;
+    ULONGLONG           hnsNow;
+    PSCHEDULER_ENTRY    pEntry;
+
+    UNREFERENCED_PARAMETER(Timer);
+
+    _IRQL_limited_to_(DISPATCH_LEVEL);
+
+    CAdapterCommon* _this = (CAdapterCommon*)DeferredContext;
+
+    if (NULL == _this)
+    {
+        return;
+    }
+
+    qpc = KeQueryPerformanceCounter(&qpcFrequency);
+    hnsNow = KSCONVERT_PERFORMANCE_TIME(qpcFrequency.QuadPart, qpc);
+
+    KeAcquireSpinLock(&_this->m_StreamSchedulerLock, &oldIrql);
+    pEntry = _this->m_StreamScheduler.CollectDue(hnsNow);
+    KeReleaseSpinLock(&_this->m_StreamSchedulerLock, oldIrql);
+
+    //
+    // The entries stay valid until completed: CancelStreamTimer waits for
+    // IsInCallback to clear before the stream goes away.
+    //
+    while (pEntry != NULL)
+    {
+        PSCHEDULER_ENTRY    pNextDue = pEntry->pNextDue;
+        ULONGLONG           hnsDue = pEntry->pfnCallback(pEntry->Context, hnsNow);
+
+        KeAcquireSpinLock(&_this->m_StreamSchedulerLock, &oldIrql);
+        _this->m_StreamScheduler.Complete(pEntry, hnsDue);
+        KeReleaseSpinLock(&_this->m_StreamSchedulerLock, oldIrql);
+
+        pEntry = pNextDue;
+    }
+
+    KeAcquireSpinLock(&_this->m_StreamSchedulerLock, &oldIrql);
+
+    // Streams that finished (last buffer rendered) drop out during the tick.
+    if (_this->m_bStreamTimerRunning && _this->m_StreamScheduler.GetEntryCount() == 0)
+    {
+        ExCancelTimer(_this->m_pStreamTimer, NULL);
+        _this->m_bStreamTimerRunning = FALSE;
+    }
+
+    KeReleaseSpinLock(&_this->m_StreamSchedulerLock, oldIrql);
+} // StreamTimerNotify
+
 //=============================================================================
 /* Here are the definitions of the standard miniport events.
 
@@ -1306,41 +1839,90 @@ Return Value:
 } // MixerPeakMeterRead
 
 //=============================================================================
-// Tone Control (Bass/Treble)
-//=============================================================================
-#pragma code_seg("PAGE")
+#pragma code_seg()
 STDMETHODIMP_(LONG)
-CAdapterCommon::MixerBassRead
+CAdapterCommon::MixerRmsMeterRead
 ( 
     _In_  ULONG                   Index,
     _In_  ULONG                   Channel
 )
-{
-    PAGED_CODE();
+/*++
+
+Routine Description:
+
+  Return the RMS level metered at a peak meter node.
 
+Arguments:
+
+  Index - node id
+
+  Channel = which channel
+
+Return Value:
+
+    LONG - RMS level of this line
+
+--*/
+{
     if (m_pHW)
     {
-        return m_pHW->GetMixerBass(Index, Channel);
+        return m_pHW->GetMixerRmsMeter(Index, Channel);
     }
 
     return 0;
-} // MixerBassRead
+} // MixerRmsMeterRead
 
-STDMETHODIMP_(void)
-CAdapterCommon::MixerBassWrite
+//=============================================================================
+#pragma code_seg()
+STDMETHODIMP_(VOID)
+CAdapterCommon::MixerPeakMeterWrite
 ( 
     _In_  ULONG                   Index,
-    _In_  ULONG                   Channel,
-    _In_  LONG                    Value 
+    _In_  PPEAK_METER_LEVELS      Levels
 )
+/*++
+
+Routine Description:
+
+  Publish the levels a stream metered for a peak meter node. Callable at
+  DISPATCH_LEVEL.
+
+Arguments:
+
+  Index - node id
+
+  Levels - per-channel peak and RMS levels
+
+Return Value:
+
+    void
+
+--*/
 {
-    PAGED_CODE();
+    if (m_pHW)
+    {
+        m_pHW->SetMixerPeakMeter(Index, Levels);
+    }
+} // MixerPeakMeterWrite
 
+//=============================================================================
+// Tone Control (Bass/Treble)
+//=============================================================================
+#pragma code_seg()
+STDMETHODIMP_(LONG)
+CAdapterCommon::MixerBassRead
+( 
+    _In_  ULONG                   Index,
+    _In_  ULONG                   Channel
+)
+{
     if (m_pHW)
     {
-        m_pHW->SetMixerBass(Index, Channel, Value);
+        return m_pHW->GetMixerBass(Index, Channel);
     }
-} // MixerBassWrite
+
+    return 0;
+} // MixerBassRead
 
 STDMETHODIMP_(LONG)
 CAdapterCommon::MixerTrebleRead
@@ -1349,8 +1931,6 @@ CAdapterCommon::MixerTrebleRead
     _In_  ULONG                   Channel
 )
 {
-    PAGED_CODE();
-
     if (m_pHW)
     {
         return m_pHW->GetMixerTreble(Index, Channel);
@@ -1359,6 +1939,23 @@ CAdapterCommon::MixerTrebleRead
     return 0;
 } // MixerTrebleRead
 
+#pragma code_seg("PAGE")
+STDMETHODIMP_(void)
+CAdapterCommon::MixerBassWrite
+( 
+    _In_  ULONG                   Index,
+    _In_  ULONG                   Channel,
+    _In_  LONG                    Value 
+)
+{
+    PAGED_CODE();
+
+    if (m_pHW)
+    {
+        m_pHW->SetMixerBass(Index, Channel, Value);
+    }
+} // MixerBassWrite
+
 STDMETHODIMP_(void)
 CAdapterCommon::MixerTrebleWrite
 ( 
@@ -1379,7 +1976,7 @@ CAdapterCommon::MixerTrebleWrite
 //=============================================================================
 // Audio Effects (Reverb/Chorus)
 //=============================================================================
-#pragma code_seg("PAGE")
+#pragma code_seg()
 STDMETHODIMP_(LONG)
 CAdapterCommon::MixerReverbRead
 ( 
@@ -1387,8 +1984,6 @@ CAdapterCommon::MixerReverbRead
     _In_  ULONG                   Channel
 )
 {
-    PAGED_CODE();
-
     if (m_pHW)
     {
         return m_pHW->GetMixerReverb(Index, Channel);
@@ -1397,38 +1992,37 @@ CAdapterCommon::MixerReverbRead
     return 0;
 } // MixerReverbRead
 
-STDMETHODIMP_(void)
-CAdapterCommon::MixerReverbWrite
+STDMETHODIMP_(LONG)
+CAdapterCommon::MixerChorusRead
 ( 
     _In_  ULONG                   Index,
-    _In_  ULONG                   Channel,
-    _In_  LONG                    Value 
+    _In_  ULONG                   Channel
 )
 {
-    PAGED_CODE();
-
     if (m_pHW)
     {
-        m_pHW->SetMixerReverb(Index, Channel, Value);
+        return m_pHW->GetMixerChorus(Index, Channel);
     }
-} // MixerReverbWrite
 
-STDMETHODIMP_(LONG)
-CAdapterCommon::MixerChorusRead
+    return 0;
+} // MixerChorusRead
+
+#pragma code_seg("PAGE")
+STDMETHODIMP_(void)
+CAdapterCommon::MixerReverbWrite
 ( 
     _In_  ULONG                   Index,
-    _In_  ULONG                   Channel
+    _In_  ULONG                   Channel,
+    _In_  LONG                    Value 
 )
 {
     PAGED_CODE();
 
     if (m_pHW)
     {
-        return m_pHW->GetMixerChorus(Index, Channel);
+        m_pHW->SetMixerReverb(Index, Channel, Value);
     }
-
-    return 0;
-} // MixerChorusRead
+} // MixerReverbWrite
 
 STDMETHODIMP_(void)
 CAdapterCommon::MixerChorusWrite
@@ -1450,15 +2044,13 @@ CAdapterCommon::MixerChorusWrite
 //=============================================================================
 // Acoustic Echo Cancellation
 //=============================================================================
-#pragma code_seg("PAGE")
+#pragma code_seg()
 STDMETHODIMP_(BOOL)
 CAdapterCommon::AecEnabledRead
 (
     _In_  ULONG                   Index
 )
 {
-    PAGED_CODE();
-
     if (m_pHW)
     {
         return m_pHW->GetAecEnabled(Index);
@@ -1467,6 +2059,7 @@ CAdapterCommon::AecEnabledRead
     return FALSE;
 } // AecEnabledRead
 
+#pragma code_seg("PAGE")
 STDMETHODIMP_(void)
 CAdapterCommon::AecEnabledWrite
 (
@@ -2193,33 +2786,25 @@ CAdapterCommon::GetCachedSubdevice
     PAGED_CODE();
     DPF_ENTER(("[CAdapterCommon::GetCachedSubdevice]"));
 
-    // search list, return interface to device if found, fail if not found
-    PLIST_ENTRY le = NULL;
-    BOOL bFound = FALSE;
+    // look up the name, return interface to device if found, fail if not found
+    MINIPAIR_UNKNOWN *pRecord = m_SubdeviceIndex.Find(Name, CSubdeviceCacheIndex::Hash(Name));
 
-    for (le = m_SubdeviceCache.Flink; le != &m_SubdeviceCache && !bFound; le = le->Flink)
+    if (pRecord)
     {
-        MINIPAIR_UNKNOWN *pRecord = CONTAINING_RECORD(le, MINIPAIR_UNKNOWN, ListEntry);
-
-        if (0 == wcscmp(Name, pRecord->Name))
+        if (OutUnknownPort)
         {
-            if (OutUnknownPort)
-            {
-                *OutUnknownPort = pRecord->PortInterface;
-                (*OutUnknownPort)->AddRef();
-            }
-
-            if (OutUnknownMiniport)
-            {
-                *OutUnknownMiniport = pRecord->MiniportInterface;
-                (*OutUnknownMiniport)->AddRef();
-            }
+            *OutUnknownPort = pRecord->PortInterface;
+            (*OutUnknownPort)->AddRef();
+        }
 
-            bFound = TRUE;
+        if (OutUnknownMiniport)
+        {
+            *OutUnknownMiniport = pRecord->MiniportInterface;
+            (*OutUnknownMiniport)->AddRef();
         }
     }
 
-    return bFound?STATUS_SUCCESS:STATUS_OBJECT_NAME_NOT_FOUND;
+    return pRecord?STATUS_SUCCESS:STATUS_OBJECT_NAME_NOT_FOUND;
 }
 
 
@@ -2256,6 +2841,17 @@ CAdapterCommon::CacheSubdevice
         ntStatus = RtlStringCchCopyW(pNewSubdevice->Name, SIZEOF_ARRAY(pNewSubdevice->Name), Name);
     }
 
+    if (NT_SUCCESS(ntStatus))
+    {
+        pNewSubdevice->NameHash = CSubdeviceCacheIndex::Hash(pNewSubdevice->Name);
+
+        if (!m_SubdeviceIndex.Insert(pNewSubdevice))
+        {
+            DPF(D_TERSE, ("Subdevice cache full (%u)", CSubdeviceCacheIndex::Capacity));
+            ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
     if (NT_SUCCESS(ntStatus))
     {
         pNewSubdevice->PortInterface = UnknownPort;
@@ -2294,26 +2890,18 @@ CAdapterCommon::RemoveCachedSubdevice
     PAGED_CODE();
     DPF_ENTER(("[CAdapterCommon::RemoveCachedSubdevice]"));
 
-    // search list, remove the entry from the list
-
-    PLIST_ENTRY le = NULL;
-    BOOL bRemoved = FALSE;
+    // look up the name, remove the entry from the index and the list
+    MINIPAIR_UNKNOWN *pRecord = m_SubdeviceIndex.Remove(Name, CSubdeviceCacheIndex::Hash(Name));
+    BOOL bRemoved = pRecord != NULL;
 
-    for (le = m_SubdeviceCache.Flink; le != &m_SubdeviceCache && !bRemoved; le = le->Flink)
+    if (pRecord)
     {
-        MINIPAIR_UNKNOWN *pRecord = CONTAINING_RECORD(le, MINIPAIR_UNKNOWN, ListEntry);
-
-        if (0 == wcscmp(Name, pRecord->Name))
-        {
-            SAFE_RELEASE(pRecord->PortInterface);
-            SAFE_RELEASE(pRecord->MiniportInterface);
-            SAFE_RELEASE(pRecord->PowerInterface);
-            memset(pRecord->Name, 0, sizeof(pRecord->Name));
-            RemoveEntryList(le);
-            bRemoved = TRUE;
-            delete pRecord;
-            break;
-        }
+        SAFE_RELEASE(pRecord->PortInterface);
+        SAFE_RELEASE(pRecord->MiniportInterface);
+        SAFE_RELEASE(pRecord->PowerInterface);
+        memset(pRecord->Name, 0, sizeof(pRecord->Name));
+        RemoveEntryList(&pRecord->ListEntry);
+        delete pRecord;
     }
 
     return bRemoved?STATUS_SUCCESS:STATUS_OBJECT_NAME_NOT_FOUND;
@@ -2338,6 +2926,8 @@ CAdapterCommon::EmptySubdeviceCache()
 
         delete pRecord;
     }
+
+    m_SubdeviceIndex.Reset();
 }
 
 #pragma code_seg("PAGE")
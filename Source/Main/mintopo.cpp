@@ -70,6 +70,7 @@ Return Value:
                                MiniportPair->TopoDescriptor,
                                MiniportPair->DeviceMaxChannels,
                                MiniportPair->DeviceType, 
+                               MiniportPair->PairIndex,
                                DeviceContext );
     if (NULL == obj)
     {
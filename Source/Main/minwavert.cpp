@@ -157,6 +157,18 @@ Return Value:
         m_SystemStreams = NULL;
     }
 
+    if (m_pFormatIndexes)
+    {
+        ExFreePoolWithTag( m_pFormatIndexes, MINWAVERT_POOLTAG );
+        m_pFormatIndexes = NULL;
+    }
+
+    if (m_pFormatIndexStorage)
+    {
+        ExFreePoolWithTag( m_pFormatIndexStorage, MINWAVERT_POOLTAG );
+        m_pFormatIndexStorage = NULL;
+    }
+
 } // ~CMiniportWaveRT
 
 //=============================================================================
@@ -375,6 +387,8 @@ Return Value:
     m_ulMixDrmContentId                 = 0;
     m_pbMuted = NULL;
     m_plVolumeLevel = NULL;
+    m_pFormatIndexes                    = NULL;
+    m_pFormatIndexStorage               = NULL;
     RtlZeroMemory(&m_MixDrmRights, sizeof(m_MixDrmRights));
 
     //
@@ -411,10 +425,136 @@ Return Value:
     {
         m_pPortEvents = NULL;
     }
+
+    //
+    // Format probes; without the index they scan the pin's format table.
+    //
+    if (!NT_SUCCESS(BuildFormatIndexes()))
+    {
+        DPF(D_TERSE, ("Format index unavailable, scanning format tables"));
+    }
     
     return ntStatus;
 } // Init
 
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+CMiniportWaveRT::BuildFormatIndexes
+( 
+    void
+)
+/*++
+
+Routine Description:
+
+  Builds two format indexes for each pin that has device formats: one
+  for WAVE_FORMAT_EXTENSIBLE probes, keyed on everything
+  IsFormatSupported compares, and one for plain WAVEFORMATEX probes,
+  keyed on the tag instead of valid bits, mask and subformat.
+
+  On failure nothing is kept and IsFormatSupported scans.
+
+Arguments:
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    PAGED_CODE();
+
+    DPF_ENTER(("[CMiniportWaveRT::BuildFormatIndexes]"));
+
+    NTSTATUS            ntStatus    = STATUS_SUCCESS;
+    ULONG               cbStorage   = 0;
+    ULONG               cMaxFormats = 0;
+    PFORMAT_INDEX_KEY   pKeys       = NULL;
+    PBYTE               pbStorage;
+
+    for (ULONG iPin = 0; iPin < m_DeviceFormatsAndModesCount; iPin++)
+    {
+        ULONG cFormats = m_DeviceFormatsAndModes[iPin].WaveFormats != NULL ?
+                         m_DeviceFormatsAndModes[iPin].WaveFormatsCount : 0;
+
+        if (cFormats > FORMAT_INDEX_MAX_ENTRIES)
+        {
+            return STATUS_NOT_SUPPORTED;
+        }
+        if (cFormats > 0)
+        {
+            cbStorage += 2 * CFormatIndex::GetStorageBytes(cFormats);
+            cMaxFormats = max(cMaxFormats, cFormats);
+        }
+    }
+
+    if (cbStorage == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    m_pFormatIndexes = (CFormatIndex *)ExAllocatePool2(POOL_FLAG_NON_PAGED, m_DeviceFormatsAndModesCount * 2 * sizeof(CFormatIndex), MINWAVERT_POOLTAG);
+    m_pFormatIndexStorage = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbStorage, MINWAVERT_POOLTAG);
+    pKeys = (PFORMAT_INDEX_KEY)ExAllocatePool2(POOL_FLAG_NON_PAGED, cMaxFormats * sizeof(FORMAT_INDEX_KEY), MINWAVERT_POOLTAG);
+    if (!m_pFormatIndexes || !m_pFormatIndexStorage || !pKeys)
+    {
+        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pbStorage = (PBYTE)m_pFormatIndexStorage;
+    for (ULONG iPin = 0; iPin < m_DeviceFormatsAndModesCount && NT_SUCCESS(ntStatus); iPin++)
+    {
+        PKSDATAFORMAT_WAVEFORMATEXTENSIBLE  pFormats = m_DeviceFormatsAndModes[iPin].WaveFormats;
+        ULONG                               cFormats = pFormats != NULL ? m_DeviceFormatsAndModes[iPin].WaveFormatsCount : 0;
+        ULONG                               cbIndex  = CFormatIndex::GetStorageBytes(cFormats);
+
+        if (cFormats == 0)
+        {
+            continue;
+        }
+
+        for (ULONG bExtensible = 0; bExtensible < 2 && NT_SUCCESS(ntStatus); bExtensible++)
+        {
+            for (ULONG i = 0; i < cFormats; i++)
+            {
+                PWAVEFORMATEXTENSIBLE pWaveFormatExt = &pFormats[i].WaveFormatExt;
+
+                GetFormatIndexKey(&pWaveFormatExt->Format,
+                                  bExtensible ? WAVE_FORMAT_EXTENSIBLE : EXTRACT_WAVEFORMATEX_ID(&pWaveFormatExt->SubFormat),
+                                  &pKeys[i]);
+            }
+
+            if (!m_pFormatIndexes[iPin * 2 + bExtensible].Init(pKeys, cFormats, pbStorage, cbIndex))
+            {
+                ntStatus = STATUS_UNSUCCESSFUL;
+            }
+            pbStorage += cbIndex;
+        }
+    }
+
+    if (pKeys)
+    {
+        ExFreePoolWithTag(pKeys, MINWAVERT_POOLTAG);
+    }
+
+    if (!NT_SUCCESS(ntStatus))
+    {
+        if (m_pFormatIndexes)
+        {
+            ExFreePoolWithTag(m_pFormatIndexes, MINWAVERT_POOLTAG);
+            m_pFormatIndexes = NULL;
+        }
+        if (m_pFormatIndexStorage)
+        {
+            ExFreePoolWithTag(m_pFormatIndexStorage, MINWAVERT_POOLTAG);
+            m_pFormatIndexStorage = NULL;
+        }
+    }
+
+    return ntStatus;
+} // BuildFormatIndexes
+
 //=============================================================================
 #pragma code_seg("PAGE")
 STDMETHODIMP_(NTSTATUS)
@@ -1101,42 +1241,20 @@ CMiniportWaveRT::IsFormatSupported
 
     cPinFormats = GetPinSupportedDeviceFormats(_ulPin, &pPinFormats);
 
-    for (UINT iFormat = 0; iFormat < cPinFormats; iFormat++)
+    if (m_pFormatIndexes != NULL && m_pFormatIndexes[_ulPin * 2].IsActive())
     {
-        PKSDATAFORMAT_WAVEFORMATEXTENSIBLE pFormat = &pPinFormats[iFormat];
-        // KSDATAFORMAT VALIDATION
-        if (!IsEqualGUIDAligned(pFormat->DataFormat.MajorFormat, _pDataFormat->MajorFormat)) { continue; }
-        if (!IsEqualGUIDAligned(pFormat->DataFormat.SubFormat, _pDataFormat->SubFormat)) { continue; }
-        if (!IsEqualGUIDAligned(pFormat->DataFormat.Specifier, _pDataFormat->Specifier)) { continue; }
-        if (pFormat->DataFormat.FormatSize < sizeof(KSDATAFORMAT_WAVEFORMATEX)) { continue; }
+        // Only the entries with the probe's key can match; check those.
+        return FindIndexedFormat(&m_pFormatIndexes[_ulPin * 2], pPinFormats, _pDataFormat) ?
+               STATUS_SUCCESS : STATUS_NO_MATCH;
+    }
 
-        // WAVEFORMATEX VALIDATION
-        PWAVEFORMATEX pWaveFormat = reinterpret_cast<PWAVEFORMATEX>(_pDataFormat + 1);
-        
-        if (pWaveFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE)
-        {
-            if (pWaveFormat->wFormatTag != EXTRACT_WAVEFORMATEX_ID(&(pFormat->WaveFormatExt.SubFormat))) { continue; }
-        }
-        if (pWaveFormat->nChannels  != pFormat->WaveFormatExt.Format.nChannels) { continue; }
-        if (pWaveFormat->nSamplesPerSec != pFormat->WaveFormatExt.Format.nSamplesPerSec) { continue; }
-        if (pWaveFormat->nBlockAlign != pFormat->WaveFormatExt.Format.nBlockAlign) { continue; }
-        if (pWaveFormat->wBitsPerSample != pFormat->WaveFormatExt.Format.wBitsPerSample) { continue; }
-        if (pWaveFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE)
+    for (UINT iFormat = 0; iFormat < cPinFormats; iFormat++)
+    {
+        if (IsFormatMatch(&pPinFormats[iFormat], _pDataFormat))
         {
             ntStatus = STATUS_SUCCESS;
             break;
         }
-
-        // WAVEFORMATEXTENSIBLE VALIDATION
-        if (pWaveFormat->cbSize < sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) { continue; }
-
-        PWAVEFORMATEXTENSIBLE pWaveFormatExt = reinterpret_cast<PWAVEFORMATEXTENSIBLE>(pWaveFormat);
-        if (pWaveFormatExt->Samples.wValidBitsPerSample != pFormat->WaveFormatExt.Samples.wValidBitsPerSample) { continue; }
-        if (pWaveFormatExt->dwChannelMask != pFormat->WaveFormatExt.dwChannelMask) { continue; }
-        if (!IsEqualGUIDAligned(pWaveFormatExt->SubFormat, pFormat->WaveFormatExt.SubFormat)) { continue; }
-
-        ntStatus = STATUS_SUCCESS;
-        break;
     }
 
     return ntStatus;
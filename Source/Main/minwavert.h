@@ -14,6 +14,8 @@ Abstract:
 #ifndef _VIRTUALAUDIODRIVER_MINWAVERT_H_
 #define _VIRTUALAUDIODRIVER_MINWAVERT_H_
 
+#include "formatindex.h"
+
 //=============================================================================
 // Referenced Forward
 //=============================================================================
@@ -51,6 +53,10 @@ private:
     KSPIN_LOCK                          m_DeviceFormatsAndModesLock; // To serialize access.
     KIRQL                               m_DeviceFormatsAndModesIrql;
     ULONG                               m_DeviceFormatsAndModesCount; 
+    // Format probe index per pin, [pin * 2 + extensible], NULL when the
+    // formats are scanned instead; see IsFormatSupported.
+    CFormatIndex *                      m_pFormatIndexes;
+    PVOID                               m_pFormatIndexStorage;
     USHORT                              m_DeviceMaxChannels;
     PDRMPORT                            m_pDrmPort;
     DRMRIGHTS                           m_MixDrmRights;
@@ -64,6 +70,7 @@ protected:
     PADAPTERCOMMON                      m_pAdapterCommon;
     ULONG                               m_DeviceFlags;
     eDeviceType                         m_DeviceType;
+    ULONG                               m_ulPairIndex;          // Endpoint pair, see ENDPOINT_MINIPAIR.
     PPORTEVENTS                         m_pPortEvents;
     PENDPOINT_MINIPAIR                  m_pMiniportPair;
     
@@ -111,6 +118,11 @@ protected:
         void
     );
 
+    NTSTATUS BuildFormatIndexes
+    (
+        void
+    );
+
 public:
     DECLARE_STD_UNKNOWN();
 
@@ -123,6 +135,7 @@ public:
         :CUnknown(0),
         m_ulMaxSystemStreams(0),
         m_DeviceType(MiniportPair->DeviceType),
+        m_ulPairIndex(MiniportPair->PairIndex),
         m_DeviceContext(DeviceContext),
         m_DeviceMaxChannels(MiniportPair->DeviceMaxChannels),
         m_DeviceFormatsAndModes(MiniportPair->PinDeviceFormatsAndModes),
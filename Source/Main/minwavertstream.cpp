@@ -4,6 +4,7 @@
 #include "endpoints.h"
 #include "minwavert.h"
 #include "minwavertstream.h"
+#include "micarraygeometry.h"
 #define MINWAVERTSTREAM_POOLTAG 'SRWM'
 
 #pragma warning (disable : 4127)
@@ -35,7 +36,20 @@ Return Value:
     PAGED_CODE();
     if (NULL != m_pMiniport)
     {
-    
+        // Make sure the shared timer no longer calls into this stream.
+        m_pMiniport->GetAdapterCommObj()->CancelStreamTimer(&m_SchedulerEntry);
+
+        // No more position updates can run; stop feeding the loopback. The
+        // cable belongs to the adapter, which the miniport keeps alive.
+        if (m_pLoopback && !m_bCapture)
+        {
+            m_pLoopback->DisconnectRender();
+            m_pLoopback = NULL;
+        }
+
+        // The file cache belongs to the adapter; let go of it first.
+        m_CaptureFile.Cleanup();
+
         if (m_bUnregisterStream)
         {
             m_pMiniport->StreamClosed(m_ulPin, this);
@@ -46,18 +60,6 @@ Return Value:
         m_pMiniport = NULL;
     }
 
-    if (m_pDpc)
-    {
-        ExFreePoolWithTag( m_pDpc, MINWAVERTSTREAM_POOLTAG );
-        m_pDpc = NULL;
-    }
-
-    if (m_pTimer)
-    {
-        ExFreePoolWithTag( m_pTimer, MINWAVERTSTREAM_POOLTAG );
-        m_pTimer = NULL;
-    }
-
     if (m_pbMuted)
     {
         ExFreePoolWithTag( m_pbMuted, MINWAVERTSTREAM_POOLTAG );
@@ -70,32 +72,55 @@ Return Value:
         m_plVolumeLevel = NULL;
     }
 
-    if (m_plPeakMeter)
-    {
-        ExFreePoolWithTag( m_plPeakMeter, MINWAVERTSTREAM_POOLTAG );
-        m_plPeakMeter = NULL;
-    }
-
     if (m_pWfExt)
     {
         ExFreePoolWithTag( m_pWfExt, MINWAVERTSTREAM_POOLTAG );
         m_pWfExt = NULL;
     }
-    if (m_pNotificationTimer)
+
+    if (m_pProcessBuffer)
     {
-        ExDeleteTimer
-        (
-            m_pNotificationTimer, 
-            TRUE, // Cancel the timer if it is currently set.
-            TRUE, // Wait for the timer to finish expiring and for any callback to a ExTimerCallback routine to finish.
-            NULL
-         );
+        ExFreePoolWithTag( m_pProcessBuffer, MINWAVERTSTREAM_POOLTAG );
+        m_pProcessBuffer = NULL;
     }
 
-    // Since we just cancelled the notification timer, wait for all queued 
-    // DPCs to complete before we free the notification DPC.
-    //
-    KeFlushQueuedDpcs();
+    if (m_pReverbStorage)
+    {
+        ExFreePoolWithTag( m_pReverbStorage, MINWAVERTSTREAM_POOLTAG );
+        m_pReverbStorage = NULL;
+    }
+
+    if (m_pChorusStorage)
+    {
+        ExFreePoolWithTag( m_pChorusStorage, MINWAVERTSTREAM_POOLTAG );
+        m_pChorusStorage = NULL;
+    }
+
+    if (m_pEchoCancellerStorage)
+    {
+        ExFreePoolWithTag( m_pEchoCancellerStorage, MINWAVERTSTREAM_POOLTAG );
+        m_pEchoCancellerStorage = NULL;
+    }
+
+    if (m_pBinauralStorage)
+    {
+        ExFreePoolWithTag( m_pBinauralStorage, MINWAVERTSTREAM_POOLTAG );
+        m_pBinauralStorage = NULL;
+    }
+
+    if (m_pBinauralBuffer)
+    {
+        ExFreePoolWithTag( m_pBinauralBuffer, MINWAVERTSTREAM_POOLTAG );
+        m_pBinauralBuffer = NULL;
+    }
+
+    if (m_pMicArraySourceStorage)
+    {
+        ExFreePoolWithTag( m_pMicArraySourceStorage, MINWAVERTSTREAM_POOLTAG );
+        m_pMicArraySourceStorage = NULL;
+    }
+
+    RtlFreeUnicodeString(&m_HostCaptureFileName);
 
     DPF_ENTER(("[CMiniportWaveRTStream::~CMiniportWaveRTStream]"));
 } // ~CMiniportWaveRTStream
@@ -116,6 +141,7 @@ NTSTATUS CMiniportWaveRTStream::ReadRegistrySettings()
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"HostCaptureToneAmplitude",        &m_dwHostCaptureToneAmplitude,          (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD,  &m_dwHostCaptureToneAmplitude,              sizeof(DWORD) },
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"HostCaptureToneDCOffset",         &m_dwHostCaptureToneDCOffset,           (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD,  &m_dwHostCaptureToneDCOffset,               sizeof(DWORD) },
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"HostCaptureToneInitialPhase",     &m_dwHostCaptureToneInitialPhase,       (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD,  &m_dwHostCaptureToneInitialPhase,           sizeof(DWORD) },
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"HostCaptureFileName",             &m_HostCaptureFileName,                 (REG_SZ << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE,      NULL,                                       0 },
         { NULL,   0,                                                        NULL,                               NULL,                                   0,                                                              NULL,                                       0 }
     };
 
@@ -200,22 +226,33 @@ Return Value:
     m_ulDmaBufferSize = 0;
     m_pDmaBuffer = NULL;
     m_ulNotificationsPerBuffer = 0;
+    m_ulFramesPerPacket = 0;
     m_KsState = KSSTATE_STOP;
-    m_pTimer = NULL;
-    m_pDpc = NULL;
     m_llPacketCounter = 0;
     m_ullPlayPosition = 0;
     m_ullWritePosition = 0;
-    m_ullDmaTimeStamp = 0;
-    m_hnsElapsedTimeCarryForward = 0;
-    m_ullLastDPCTimeStamp = 0;
-    m_hnsDPCTimeCarryForward = 0;
     m_ulDmaMovementRate = 0;
-    m_byteDisplacementCarryForward = 0;
     m_bLfxEnabled = FALSE;
     m_pbMuted = NULL;
     m_plVolumeLevel = NULL;
-    m_plPeakMeter = NULL;
+    m_ulPeakMeterNode = 0;
+    m_ulVolumeNode = 0;
+    m_ulMuteNode = 0;
+    m_ulBassNode = 0;
+    m_ulTrebleNode = 0;
+    m_pReverbStorage = NULL;
+    m_ulReverbNode = 0;
+    m_pChorusStorage = NULL;
+    m_ulChorusNode = 0;
+    m_pEchoCancellerStorage = NULL;
+    m_ulAecNode = 0;
+    m_bAecEnabled = FALSE;
+    m_pBinauralStorage = NULL;
+    m_pBinauralBuffer = NULL;
+    RtlZeroMemory(&m_BinauralFormat, sizeof(m_BinauralFormat));
+    m_pMicArraySourceStorage = NULL;
+    m_pProcessBuffer = NULL;
+    m_ulProcessBufferBytes = 0;
     m_pWfExt = NULL;
     m_ullLinearPosition = 0;
     m_ullPresentationPosition = 0;
@@ -227,6 +264,10 @@ Return Value:
     m_SignalProcessingMode = SignalProcessingMode;
     m_bEoSReceived = FALSE;
     m_bLastBufferRendered = FALSE;
+    m_pLoopback = NULL;
+    m_lLoopbackFormatKey = 0;
+    m_ulLoopbackChannelMask = 0;
+    RtlZeroMemory(&m_HostCaptureFileName, sizeof(m_HostCaptureFileName));
 
     m_ulHostCaptureToneFrequency = IsEqualGUID(SignalProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW) ? 1000 : 2000;
     m_dwHostCaptureToneAmplitude = 50;
@@ -237,18 +278,11 @@ Return Value:
     InitializeListHead(&m_NotificationList);
     m_ulNotificationIntervalMs = 0;
 
-    // Initialize the spinlock to synchronize position updates
+    // Initialize the spinlocks to synchronize position updates
+    KeInitializeSpinLock(&m_DataSpinLock);
     KeInitializeSpinLock(&m_PositionSpinLock);
 
-    m_pNotificationTimer = ExAllocateTimer(
-         TimerNotifyRT,
-         this,
-         EX_TIMER_HIGH_RESOLUTION
-    );
-    if (!m_pNotificationTimer)
-    {
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
+    CStreamScheduler::InitializeEntry(&m_SchedulerEntry, TimerNotifyRT, this);
 
     pWfEx = GetWaveFormatEx(DataFormat_);
     if (NULL == pWfEx) 
@@ -269,12 +303,8 @@ Return Value:
     m_ulPin = Pin_;
     m_bCapture = Capture_;
     m_ulDmaMovementRate = pWfEx->nAvgBytesPerSec;
-
-    m_pDpc = (PRKDPC)ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(KDPC), MINWAVERTSTREAM_POOLTAG);
-    if (!m_pDpc)
-    {
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
+    m_FrameClock.Init(pWfEx->nSamplesPerSec);
+    PublishPositions(0);
 
     m_pWfExt = (PWAVEFORMATEXTENSIBLE)ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(WAVEFORMATEX) + pWfEx->cbSize, MINWAVERTSTREAM_POOLTAG);
     if (m_pWfExt == NULL)
@@ -295,10 +325,208 @@ Return Value:
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    m_plPeakMeter = (PLONG)ExAllocatePool2(POOL_FLAG_NON_PAGED, m_pWfExt->Format.nChannels * sizeof(LONG), MINWAVERTSTREAM_POOLTAG);
-    if (m_plPeakMeter == NULL)
+    //
+    // Apply the topology's volume and mute to the host streams and meter
+    // them for its peak meter node. Formats the meter does not cover read
+    // as silence; formats the volume does not cover pass at full volume.
+    //
+    if (m_pMiniport->IsSystemRenderPin(m_ulPin) || m_pMiniport->IsSystemCapturePin(m_ulPin))
     {
-        return STATUS_INSUFFICIENT_RESOURCES;
+        BOOL bFloat = FALSE;
+
+        if (pWfEx->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+        {
+            bFloat = TRUE;
+        }
+        else if (pWfEx->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+                 pWfEx->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))
+        {
+            bFloat = IsEqualGUIDAligned(m_pWfExt->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+        }
+
+        m_ulPeakMeterNode = MIXER_NODE(m_pMiniport->m_ulPairIndex, m_pMiniport->m_DeviceType,
+                                       m_bCapture ? KSNODE_TOPO_PEAKMETER : KSNODE_TOPO_SPEAKER_PEAKMETER);
+        if (!m_PeakMeter.Init(pWfEx->nSamplesPerSec, pWfEx->wBitsPerSample, pWfEx->nChannels, bFloat))
+        {
+            DPF(D_TERSE, ("Peak meter does not support this format"));
+        }
+
+        m_ulVolumeNode = MIXER_NODE(m_pMiniport->m_ulPairIndex, m_pMiniport->m_DeviceType,
+                                    m_bCapture ? KSNODE_TOPO_VOLUME : KSNODE_TOPO_SPEAKER_VOLUME);
+        m_ulMuteNode = MIXER_NODE(m_pMiniport->m_ulPairIndex, m_pMiniport->m_DeviceType,
+                                  m_bCapture ? KSNODE_TOPO_MUTE : KSNODE_TOPO_SPEAKER_MUTE);
+        if (!m_Volume.Init(pWfEx->nSamplesPerSec, pWfEx->wBitsPerSample, pWfEx->nChannels, bFloat))
+        {
+            DPF(D_TERSE, ("Volume does not support this format"));
+        }
+
+        if (!m_bCapture)
+        {
+            m_ulBassNode = MIXER_NODE(m_pMiniport->m_ulPairIndex, m_pMiniport->m_DeviceType, KSNODE_TOPO_BASS);
+            m_ulTrebleNode = MIXER_NODE(m_pMiniport->m_ulPairIndex, m_pMiniport->m_DeviceType, KSNODE_TOPO_TREBLE);
+            if (!m_ToneControl.Init(pWfEx->nSamplesPerSec, pWfEx->wBitsPerSample, pWfEx->nChannels, bFloat))
+            {
+                DPF(D_TERSE, ("Tone control does not support this format"));
+            }
+
+            // The delay lines are allocated up front; the position update
+            // must not allocate.
+            ULONG cbReverbStorage = CReverb::GetStorageBytes(pWfEx->nSamplesPerSec);
+
+            m_ulReverbNode = MIXER_NODE(m_pMiniport->m_ulPairIndex, m_pMiniport->m_DeviceType, KSNODE_TOPO_REVERB);
+            if (cbReverbStorage != 0)
+            {
+                m_pReverbStorage = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbReverbStorage, MINWAVERTSTREAM_POOLTAG);
+                if (m_pReverbStorage == NULL)
+                {
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+            }
+            if (!m_Reverb.Init(pWfEx->nSamplesPerSec, pWfEx->wBitsPerSample, pWfEx->nChannels, bFloat,
+                               m_pReverbStorage, cbReverbStorage))
+            {
+                DPF(D_TERSE, ("Reverb does not support this format"));
+            }
+
+            ULONG cbChorusStorage = CChorus::GetStorageBytes(pWfEx->nSamplesPerSec, pWfEx->nChannels);
+
+            m_ulChorusNode = MIXER_NODE(m_pMiniport->m_ulPairIndex, m_pMiniport->m_DeviceType, KSNODE_TOPO_CHORUS);
+            if (cbChorusStorage != 0)
+            {
+                m_pChorusStorage = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbChorusStorage, MINWAVERTSTREAM_POOLTAG);
+                if (m_pChorusStorage == NULL)
+                {
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+            }
+            if (!m_Chorus.Init(pWfEx->nSamplesPerSec, pWfEx->wBitsPerSample, pWfEx->nChannels, bFloat,
+                               m_pChorusStorage, cbChorusStorage))
+            {
+                DPF(D_TERSE, ("Chorus does not support this format"));
+            }
+
+            //
+            // Surround audio can be saved and looped back as binaural
+            // stereo instead, for listening on headphones.
+            //
+            if (g_BinauralRender && pWfEx->nChannels > 2)
+            {
+                ULONG cbBinauralStorage = CBinauralVirtualizer::GetStorageBytes(pWfEx->nChannels);
+
+                if (cbBinauralStorage != 0)
+                {
+                    m_pBinauralStorage = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbBinauralStorage, MINWAVERTSTREAM_POOLTAG);
+                    if (m_pBinauralStorage == NULL)
+                    {
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                    }
+                }
+                if (!m_Binaural.Init(pWfEx->nSamplesPerSec, pWfEx->wBitsPerSample, pWfEx->nChannels,
+                                     CLoopbackCable::GetChannelMask(pWfEx), bFloat,
+                                     m_pBinauralStorage, cbBinauralStorage))
+                {
+                    DPF(D_TERSE, ("Binaural virtualizer does not support this format"));
+                }
+                else
+                {
+                    PWAVEFORMATEXTENSIBLE pStereo = &m_BinauralFormat.WaveFormatExt;
+
+                    m_pBinauralBuffer = (PBYTE)ExAllocatePool2(POOL_FLAG_NON_PAGED,
+                                                               m_Binaural.GetOutputBytes(STREAM_PROCESS_BUFFER_FRAMES * pWfEx->nBlockAlign),
+                                                               MINWAVERTSTREAM_POOLTAG);
+                    if (m_pBinauralBuffer == NULL)
+                    {
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                    }
+
+                    m_BinauralFormat.DataFormat = *DataFormat_;
+                    m_BinauralFormat.DataFormat.FormatSize = sizeof(m_BinauralFormat);
+                    m_BinauralFormat.DataFormat.SubFormat = bFloat ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
+                    m_BinauralFormat.DataFormat.Specifier = KSDATAFORMAT_SPECIFIER_WAVEFORMATEX;
+                    pStereo->Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+                    pStereo->Format.nChannels = 2;
+                    pStereo->Format.nSamplesPerSec = pWfEx->nSamplesPerSec;
+                    pStereo->Format.wBitsPerSample = pWfEx->wBitsPerSample;
+                    pStereo->Format.nBlockAlign = 2 * pWfEx->wBitsPerSample / 8;
+                    pStereo->Format.nAvgBytesPerSec = pStereo->Format.nBlockAlign * pWfEx->nSamplesPerSec;
+                    pStereo->Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+                    pStereo->Samples.wValidBitsPerSample = pWfEx->wBitsPerSample;
+                    pStereo->dwChannelMask = KSAUDIO_SPEAKER_STEREO;
+                    pStereo->SubFormat = m_BinauralFormat.DataFormat.SubFormat;
+                }
+            }
+        }
+        else
+        {
+            // The echo is the speaker's render audio, so the speaker
+            // topology switches its cancellation.
+            ULONG cbEchoCancellerStorage = CEchoCanceller::GetStorageBytes(pWfEx->nChannels);
+
+            m_ulAecNode = MIXER_NODE(m_pMiniport->m_ulPairIndex, eSpeakerDevice, KSNODE_TOPO_AEC);
+            if (cbEchoCancellerStorage != 0)
+            {
+                m_pEchoCancellerStorage = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbEchoCancellerStorage, MINWAVERTSTREAM_POOLTAG);
+                if (m_pEchoCancellerStorage == NULL)
+                {
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+            }
+            if (!m_EchoCanceller.Init(pWfEx->wBitsPerSample, pWfEx->nChannels, bFloat,
+                                      m_pEchoCancellerStorage, cbEchoCancellerStorage))
+            {
+                DPF(D_TERSE, ("Echo canceller does not support this format"));
+            }
+
+            //
+            // The mic array can hear its audio as a source from a set
+            // direction, so beamforming clients see the inter-channel
+            // delays its advertised geometry implies.
+            //
+            if (g_MicArraySource && m_pMiniport->m_DeviceType == eMicArrayDevice1 &&
+                pWfEx->nChannels == MICARRAY_MICROPHONES)
+            {
+                ULONG cbMicArraySourceStorage = CMicArraySource::GetStorageBytes(pWfEx->nChannels);
+                MIC_SOURCE_ELEMENT elements[MICARRAY_MICROPHONES];
+
+                for (ULONG i = 0; i < MICARRAY_MICROPHONES; i++)
+                {
+                    elements[i].ulType = MicArrayMicrophones[i].usType;
+                    elements[i].lX = MicArrayMicrophones[i].wXCoord;
+                    elements[i].lY = MicArrayMicrophones[i].wYCoord;
+                    elements[i].lZ = MicArrayMicrophones[i].wZCoord;
+                    elements[i].lVerticalAngle = MicArrayMicrophones[i].wVerticalAngle;
+                    elements[i].lHorizontalAngle = MicArrayMicrophones[i].wHorizontalAngle;
+                }
+
+                m_pMicArraySourceStorage = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbMicArraySourceStorage, MINWAVERTSTREAM_POOLTAG);
+                if (m_pMicArraySourceStorage == NULL)
+                {
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+                if (!m_MicArraySource.Init(pWfEx->nSamplesPerSec, pWfEx->wBitsPerSample, bFloat,
+                                           elements, MICARRAY_MICROPHONES,
+                                           MIC_SOURCE_DEGREES((LONG)g_MicArraySourceElevation),
+                                           MIC_SOURCE_DEGREES((LONG)g_MicArraySourceAzimuth),
+                                           m_pMicArraySourceStorage, cbMicArraySourceStorage))
+                {
+                    DPF(D_TERSE, ("Mic array source does not support this format"));
+                }
+            }
+        }
+
+        if (m_bCapture ? m_EchoCanceller.IsActive() :
+            (m_Volume.IsActive() || m_ToneControl.IsActive() || m_Reverb.IsActive() || m_Chorus.IsActive()))
+        {
+            // Capture audio is ours and is processed in place, against the
+            // echo reference in this buffer; render audio is the client's
+            // and is processed in a copy.
+            m_ulProcessBufferBytes = STREAM_PROCESS_BUFFER_FRAMES * pWfEx->nBlockAlign;
+            m_pProcessBuffer = (PBYTE)ExAllocatePool2(POOL_FLAG_NON_PAGED, m_ulProcessBufferBytes, MINWAVERTSTREAM_POOLTAG);
+            if (m_pProcessBuffer == NULL)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
     }
 
     if (m_bCapture)
@@ -354,6 +582,21 @@ Return Value:
         {
             return ntStatus;
         }
+
+        //
+        // Play a file instead of the loopback if one is configured. A file
+        // that cannot be played leaves the stream on the loopback.
+        //
+        if (m_HostCaptureFileName.Length > 0)
+        {
+            NTSTATUS fileStatus = m_CaptureFile.Init(m_pMiniport->GetAdapterCommObj()->GetCaptureFileCache(),
+                                                     &m_HostCaptureFileName,
+                                                     &m_pWfExt->Format);
+            if (!NT_SUCCESS(fileStatus))
+            {
+                DPF(D_TERSE, ("Capture file %wZ not played, 0x%x", &m_HostCaptureFileName, fileStatus));
+            }
+        }
     }
     else if (!g_DoNotCreateDataFiles)
     {
@@ -361,10 +604,11 @@ Return Value:
         // Create an output file for the render data.
         //
         DPF(D_TERSE, ("SaveData %p", &m_SaveData));
-        ntStatus = m_SaveData.SetDataFormat(DataFormat_);
+        ntStatus = m_SaveData.SetDataFormat(m_Binaural.IsActive() ? &m_BinauralFormat.DataFormat : DataFormat_);
         if (NT_SUCCESS(ntStatus))
         {
-            ntStatus = m_SaveData.Initialize();
+            ntStatus = m_SaveData.Initialize((m_pMiniport->m_DeviceFlags & ENDPOINT_SAVE_DATA_FLAC) ?
+                                             eSaveDataFlac : eSaveDataWave);
         }
     
         if (!NT_SUCCESS(ntStatus))
@@ -373,6 +617,24 @@ Return Value:
         }
     }
 
+    //
+    // Hook up the speaker-to-microphone loopback. Render streams produce into
+    // it, capture streams consume from it.
+    //
+    m_pLoopback = m_pMiniport->GetAdapterCommObj()->GetLoopbackCable(m_pMiniport->m_ulPairIndex);
+    if (m_pLoopback)
+    {
+        if (m_bCapture)
+        {
+            m_lLoopbackFormatKey = CLoopbackCable::MakeFormatKey(&m_pWfExt->Format);
+            m_ulLoopbackChannelMask = CLoopbackCable::GetChannelMask(&m_pWfExt->Format);
+        }
+        else
+        {
+            m_pLoopback->ConnectRender(m_Binaural.IsActive() ? &m_BinauralFormat.WaveFormatExt.Format : &m_pWfExt->Format);
+        }
+    }
+
     //
     // Register this stream.
     //
@@ -527,6 +789,7 @@ NTSTATUS CMiniportWaveRTStream::AllocateBufferWithNotification
     m_ulDmaBufferSize = RequestedSize_;
     ulBufferDurationMs = (RequestedSize_ * 1000) / m_ulDmaMovementRate;
     m_ulNotificationIntervalMs = ulBufferDurationMs / NotificationCount_;
+    m_ulFramesPerPacket = max((RequestedSize_ / NotificationCount_) / m_pWfExt->Format.nBlockAlign, 1UL);
 
     *AudioBufferMdl_ = pBufferMdl;
     *ActualSize_ = RequestedSize_;
@@ -779,23 +1042,20 @@ NTSTATUS CMiniportWaveRTStream::GetPosition
 )
 {
     NTSTATUS ntStatus;
-
-    KIRQL oldIrql;
-    KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+    POSITION_SNAPSHOT snapshot;
 
     if (m_KsState == KSSTATE_RUN)
     {
         //
-        // Get the current time and update position.
+        // Bring the position up to date unless someone else is already doing so.
         //
-        LARGE_INTEGER ilQPC = KeQueryPerformanceCounter(NULL);
-        UpdatePosition(ilQPC);
+        TryUpdatePosition();
     }
 
-    Position_->PlayOffset = m_ullPlayPosition;
-    Position_->WriteOffset = m_ullWritePosition;
+    m_PositionSnapshot.Read(&snapshot);
 
-    KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+    Position_->PlayOffset = snapshot.ullPlayPosition;
+    Position_->WriteOffset = snapshot.ullWritePosition;
 
     ntStatus = STATUS_SUCCESS;
     
@@ -844,15 +1104,16 @@ NTSTATUS CMiniportWaveRTStream::GetReadPacket
         return STATUS_INVALID_DEVICE_STATE;
     }
 
-    KIRQL oldIrql;
-    KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+    POSITION_SNAPSHOT snapshot;
+    m_PositionSnapshot.Read(&snapshot);
 
-    LONGLONG packetCounter = m_llPacketCounter;
-    ULONGLONG ullLinearPosition = m_ullLinearPosition;
-    ULONGLONG hnsElapsedTimeCarryForward = m_hnsElapsedTimeCarryForward;
-    ULONGLONG ullDmaTimeStamp = m_ullDmaTimeStamp;
+    LONGLONG packetCounter = snapshot.llPacketCounter;
 
-    KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+    // Compute the timestamp corresponding to the end of the available packet. In a real hardware
+    // driver, the timestamp would be computed in a driver and hardware specific manner. In this sample
+    // driver it is the instant the simulated DMA clock completed the packet's last frame, which is the
+    // same frame boundary TimerNotifyRT uses to signal the packet.
+    LONGLONG timeOfAvailablePacketInHns = snapshot.FrameClock.GetTimeOfFrame((ULONGLONG)packetCounter * m_ulFramesPerPacket);
 
     // The 0-based number of the last completed packet
     // FUTURE-2014/10/27 Update to allow different numbers of packets per WaveRT buffer
@@ -875,18 +1136,10 @@ NTSTATUS CMiniportWaveRTStream::GetReadPacket
     // Return next packet number to be read
     *PacketNumber = availablePacketNumber;
 
-    // Compute and return timestamp corresponding to the end of the available packet. In a real hardware
-    // driver, the timestamp would be computed in a driver and hardware specific manner. In this sample
-    // driver, it is extrapolated from the sample driver's internal simulated position correlation
-    // [m_ullLinearPosition @ m_ullDmaTimeStamp] and the sample's internal 64-bit packet counter, subtracting
-    // 1 from the packet counter to compute the time at the start of that last completed packet.
-    ULONGLONG linearPositionOfAvailablePacket = packetCounter * (m_ulDmaBufferSize / m_ulNotificationsPerBuffer);
-    // Need to divide by (1000 * 10000 because m_ulDmaMovementRate is average bytes per sec
-    ULONGLONG carryForwardBytes = (hnsElapsedTimeCarryForward * m_ulDmaMovementRate) / 10000000;
-    ULONGLONG deltaLinearPosition = ullLinearPosition + carryForwardBytes - linearPositionOfAvailablePacket;
-    ULONGLONG deltaTimeInHns = deltaLinearPosition * 10000000 / m_ulDmaMovementRate;
-    ULONGLONG timeOfAvailablePacketInHns = ullDmaTimeStamp - deltaTimeInHns;
-    ULONGLONG timeOfAvailablePacketInQpc = timeOfAvailablePacketInHns * m_ullPerformanceCounterFrequency.QuadPart / 10000000;
+    // Convert back to QPC ticks; split at whole seconds so the product cannot overflow.
+    ULONGLONG timeOfAvailablePacketInQpc =
+        (ULONGLONG)(timeOfAvailablePacketInHns / 10000000) * m_ullPerformanceCounterFrequency.QuadPart +
+        (ULONGLONG)(timeOfAvailablePacketInHns % 10000000) * m_ullPerformanceCounterFrequency.QuadPart / 10000000;
 
     *PerformanceCounterValue = timeOfAvailablePacketInQpc;
 
@@ -929,11 +1182,10 @@ NTSTATUS CMiniportWaveRTStream::SetWritePacket
         return STATUS_INVALID_DEVICE_STATE;
     }
 
-    KIRQL oldIrql;
-    KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+    POSITION_SNAPSHOT snapshot;
+    m_PositionSnapshot.Read(&snapshot);
     // 1-based count of completed packets, 0-based packet number of current packet
-    LONGLONG currentPacket = m_llPacketCounter;
-    KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+    LONGLONG currentPacket = snapshot.llPacketCounter;
 
     // If not running, the current packet hasn't actually started transfering so OS should be writing
     // to the current packet. If running, then the current packing is already transfering to hardware
@@ -973,6 +1225,7 @@ NTSTATUS CMiniportWaveRTStream::SetWritePacket
         // Will not return an error when the passed in parameter is 0.
         // Will also check if this function was called with the same write position(in event mode only)
         // Underruning will also be checked via timer mechanism
+        KIRQL oldIrql;
         KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
         ntStatus = SetCurrentWritePositionInternal(ulCurrentWritePosition);
         KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
@@ -1021,18 +1274,16 @@ NTSTATUS CMiniportWaveRTStream::GetPacketCount
         return STATUS_NOT_SUPPORTED;
     }
     
-    KIRQL oldIrql;
-    KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+    POSITION_SNAPSHOT snapshot;
 
     if (m_KsState == KSSTATE_RUN)
     {
-        // Get the current time and update simulated position.
-        LARGE_INTEGER ilQPC = KeQueryPerformanceCounter(NULL);
-        UpdatePosition(ilQPC);
+        // Update the simulated position unless someone else is already doing so.
+        TryUpdatePosition();
     }
 
-    *pPacketCount = LODWORD(m_llPacketCounter);
-    KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+    m_PositionSnapshot.Read(&snapshot);
+    *pPacketCount = LODWORD(snapshot.llPacketCounter);
 
     return STATUS_SUCCESS;
 }
@@ -1047,32 +1298,39 @@ NTSTATUS CMiniportWaveRTStream::GetPositions(
 {
     DPF_ENTER(("[CMiniportWaveRTStream::GetPositions]"));
 
-    NTSTATUS        ntStatus;
-    LARGE_INTEGER   ilQPC;
-    KIRQL           oldIrql;
+    NTSTATUS            ntStatus;
+    LARGE_INTEGER       ilQPC;
+    POSITION_SNAPSHOT   snapshot;
 
     // Update *_pullLinearBufferPosition with the the number of bytes fetched from waveRT ever since a stream got set into RUN
     // state.
     // Once the stream is set to STOP state, any further read on this call would return zero.
 
     //
-    // Get the current time and update position.
+    // Update the position unless an update (and its audio copy) is already in progress. In that case
+    // the last published positions are returned with the time they were taken, which keeps the pair
+    // consistent without waiting.
     //
-    KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+    BOOL bRunning = (m_KsState == KSSTATE_RUN);
+    if (bRunning)
+    {
+        TryUpdatePosition();
+    }
+    m_PositionSnapshot.Read(&snapshot);
     ilQPC = KeQueryPerformanceCounter(NULL);
-    if (m_KsState == KSSTATE_RUN)
+    if (bRunning)
     {
-        UpdatePosition(ilQPC);
+        ilQPC.QuadPart = snapshot.llQPC;
     }
+
     if (_pullLinearBufferPosition)
     {
-        *_pullLinearBufferPosition = m_ullLinearPosition;
+        *_pullLinearBufferPosition = snapshot.ullLinearPosition;
     }
     if (_pullPresentationPosition)
     {
-        *_pullPresentationPosition = m_ullPresentationPosition;
+        *_pullPresentationPosition = snapshot.ullPresentationPosition;
     }
-    KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
     if (_pliQPCTime)
     {
         *_pliQPCTime = ilQPC;
@@ -1100,7 +1358,8 @@ NTSTATUS CMiniportWaveRTStream::GetPresentationPosition(_Out_  KSAUDIO_PRESENTAT
         return status;
     }
 
-    _pPresentationPosition->u64PositionInBlocks = ullPresentationPosition * m_pWfExt->Format.nSamplesPerSec / m_pWfExt->Format.nAvgBytesPerSec;
+    // The position always advances in whole frames.
+    _pPresentationPosition->u64PositionInBlocks = ullPresentationPosition / m_pWfExt->Format.nBlockAlign;
     _pPresentationPosition->u64QPCPosition = (UINT64)timeStamp.QuadPart;
 
     return STATUS_SUCCESS;
@@ -1181,13 +1440,15 @@ NTSTATUS CMiniportWaveRTStream::SetState
             {
                 // Acquire stream resources
             }
-            KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+            KeAcquireSpinLock(&m_DataSpinLock, &oldIrql);
+            KeAcquireSpinLockAtDpcLevel(&m_PositionSpinLock);
             // Reset DMA
             m_llPacketCounter = 0;
             m_ullPlayPosition = 0;
             m_ullWritePosition = 0;
             m_ullLinearPosition = 0;
             m_ullPresentationPosition = 0;
+            m_FrameClock.Reset();
             
             // Reset OS read/write positions
             m_ulLastOsReadPacket = ULONG_MAX;
@@ -1196,12 +1457,14 @@ NTSTATUS CMiniportWaveRTStream::SetState
             m_bEoSReceived = FALSE;
             m_bLastBufferRendered = FALSE;
 
-            KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+            PublishPositions(0);
+            KeReleaseSpinLockFromDpcLevel(&m_PositionSpinLock);
+            KeReleaseSpinLock(&m_DataSpinLock, oldIrql);
 
-            // Wait until all work items are completed.
+            // Wait until everything queued so far is in the data file.
             if (!m_bCapture && !g_DoNotCreateDataFiles)
             {
-                m_SaveData.WaitAllWorkItems();
+                m_SaveData.Flush();
             }
             break;
 
@@ -1223,49 +1486,52 @@ NTSTATUS CMiniportWaveRTStream::SetState
                 // Pause DMA
                 if (m_ulNotificationIntervalMs > 0)
                 {
-                    ExCancelTimer(m_pNotificationTimer, NULL);
-                    KeFlushQueuedDpcs(); 
-
-                    // If pin is transitioning from RUN, save the time since last buffer completion event was sent 
-                    // so if the pin goes to RUN state again we can send the buffer completion event at correct time.
-                    if (m_ullLastDPCTimeStamp > 0)
-                    {
-                        LARGE_INTEGER qpc;
-                        LARGE_INTEGER qpcFrequency;
-                        LONGLONG  hnsCurrentTime;
-
-                        qpc = KeQueryPerformanceCounter(&qpcFrequency);
-
-                        // Convert ticks to 100ns units.
-                        hnsCurrentTime = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, qpc);
-                        m_hnsDPCTimeCarryForward = hnsCurrentTime - m_ullLastDPCTimeStamp + m_hnsDPCTimeCarryForward;
-                    }
+                    m_pMiniport->GetAdapterCommObj()->CancelStreamTimer(&m_SchedulerEntry);
                 }
+
+                // Bring the linear buffer and presentation positions up to date and stop the
+                // clock at the same instant. Packet boundaries are frame counts on the clock, so
+                // the next RUN resumes notifications exactly where this one left off.
+                LARGE_INTEGER qpc;
+                KeAcquireSpinLock(&m_DataSpinLock, &oldIrql);
+                qpc = KeQueryPerformanceCounter(NULL);
+                UpdatePosition(qpc);
+                KeAcquireSpinLockAtDpcLevel(&m_PositionSpinLock);
+                m_FrameClock.Pause(KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, qpc));
+                PublishPositions(qpc.QuadPart);
+                KeReleaseSpinLockFromDpcLevel(&m_PositionSpinLock);
+
+                // No audio while paused; drop the meter to silence.
+                m_PeakMeter.Reset();
+                PublishPeakMeter();
+                KeReleaseSpinLock(&m_DataSpinLock, oldIrql);
             }
-            // This call updates the linear buffer and presentation positions.
-            GetPositions(NULL, NULL, NULL);
             break;
 
         case KSSTATE_RUN:
             // Start DMA
+            if (m_bCapture && m_pLoopback && m_KsState < KSSTATE_RUN)
+            {
+                // Begin with the freshest render audio.
+                m_pLoopback->ResetCapture();
+            }
+
             LARGE_INTEGER ullPerfCounterTemp;
+            KeAcquireSpinLock(&m_DataSpinLock, &oldIrql);
+            KeAcquireSpinLockAtDpcLevel(&m_PositionSpinLock);
             ullPerfCounterTemp = KeQueryPerformanceCounter(&m_ullPerformanceCounterFrequency);
-            m_ullLastDPCTimeStamp = m_ullDmaTimeStamp = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ullPerfCounterTemp);
+            m_FrameClock.Start(KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ullPerfCounterTemp));
+            PublishPositions(ullPerfCounterTemp.QuadPart);
+            KeReleaseSpinLockFromDpcLevel(&m_PositionSpinLock);
+            KeReleaseSpinLock(&m_DataSpinLock, oldIrql);
 
             if (m_ulNotificationIntervalMs > 0)
             {
-                // Set timer for 1 ms. This will cause DPC to run every 1 ms but driver will send out 
-                // notification events only after notification interval. This timer is used by Simple Audio Sample to 
-                // emulate hardware and send out notification event. Real hardware should not use this
-                // timer to fire notification event as it will drain power if the timer is running at 1 msec.
-                ExSetTimer
-                (
-                    m_pNotificationTimer,
-                    (-1) * HNSTIME_PER_MILLISECOND,
-                    HNSTIME_PER_MILLISECOND, // 1 ms 
-                    NULL
-                 );
-
+                // Join the adapter's 1 ms stream timer. TimerNotifyRT runs on the next tick and
+                // then on the first tick after each packet boundary, and sends out the notification
+                // events. Simple Audio Sample uses this timer to emulate hardware; real hardware
+                // should not use a 1 ms timer to fire notification events as it will drain power.
+                ntStatus = m_pMiniport->GetAdapterCommObj()->ScheduleStreamTimer(&m_SchedulerEntry, m_ulNotificationIntervalMs);
             }
 
             break;
@@ -1303,153 +1569,505 @@ VOID CMiniportWaveRTStream::UpdatePosition
 (
     _In_ LARGE_INTEGER ilQPC
 )
+/*++
+
+Routine Description:
+
+  Advances the simulated DMA engine to ilQPC. The new positions are worked
+  out under m_PositionSpinLock, the audio is copied with only m_DataSpinLock
+  held, and the positions are then committed and published. Pollers reading
+  the snapshot therefore never wait for the copy, and never see a position
+  whose audio has not been copied yet.
+
+  The caller holds m_DataSpinLock.
+
+Arguments:
+
+  ilQPC - current performance counter value.
+
+--*/
 {
     // Convert ticks to 100ns units.
     LONGLONG  hnsCurrentTime = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ilQPC);
-    
-    // Calculate the time elapsed since the last call to GetPosition() or since the
-    // DMA engine started.  Note that the division by 10000 to convert to milliseconds
-    // may cause us to lose some of the time, so we will carry the remainder forward 
-    // to the next GetPosition() call.
-    //
-    ULONG TimeElapsedInMS = (ULONG)(hnsCurrentTime - m_ullDmaTimeStamp + m_hnsElapsedTimeCarryForward)/10000;
-    
-    // Carry forward the remainder of this division so we don't fall behind with our position too much.
-    //
-    m_hnsElapsedTimeCarryForward = (hnsCurrentTime - m_ullDmaTimeStamp + m_hnsElapsedTimeCarryForward) % 10000;
-    
-    // Calculate how many bytes in the DMA buffer would have been processed in the elapsed
-    // time.  Note that the division by 1000 to convert to milliseconds may cause us to 
-    // lose some bytes, so we will carry the remainder forward to the next GetPosition() call.
-    //
-    // need to divide by 1000 because m_ulDmaMovementRate is average bytes per sec.
+    ULONG     ulBlockAlign = m_pWfExt->Format.nBlockAlign;
+    ULONG     ByteDisplacement;
+    ULONG     bufferOffset;
 
-    ULONG ByteDisplacement = ((m_ulDmaMovementRate * TimeElapsedInMS) + m_byteDisplacementCarryForward) / 1000 ;
-    m_byteDisplacementCarryForward = ((m_ulDmaMovementRate * TimeElapsedInMS) + m_byteDisplacementCarryForward) % 1000;
+    KeAcquireSpinLockAtDpcLevel(&m_PositionSpinLock);
+
+    // Calculate how many whole frames the DMA engine would have processed since the
+    // last call. The frame clock derives this from the total running time, so nothing
+    // is lost between calls and the displacement never splits a frame. Anything past
+    // what a ULONG can hold is reported by the next call.
+    //
+    ByteDisplacement = (ULONG)m_FrameClock.Advance(hnsCurrentTime, MAXULONG / ulBlockAlign) * ulBlockAlign;
 
     // Increment presentation position even after last buffer is rendered.
     m_ullPresentationPosition += ByteDisplacement;
 
-    if (m_bCapture)
+    if (!m_bCapture && m_bEoSReceived)
     {
-        // Write sine wave to buffer.
-        WriteBytes(ByteDisplacement);
-    }
-    else
-    {
-
-        if (m_bEoSReceived)
+        // since EoS flag is set, we'll need to make sure not to read data beyond EOS position.
+        // If driver's current position is less than EoS position, then make sure not to read data beyond EoS.
+        if (m_ullWritePosition <= m_ulCurrentWritePosition)
         {
-            // since EoS flag is set, we'll need to make sure not to read data beyond EOS position.
-            // If driver's current position is less than EoS position, then make sure not to read data beyond EoS.
-            if (m_ullWritePosition <= m_ulCurrentWritePosition)
-            {
-                ByteDisplacement = min(ByteDisplacement, m_ulCurrentWritePosition - (ULONG)m_ullWritePosition);
-            }
-            // If our current position is ahead of EoS position and we'll wrap around after new position then adjust
-            // new position if it crosses EoS.
-            else if ((m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize < m_ullWritePosition)
+            ByteDisplacement = min(ByteDisplacement, m_ulCurrentWritePosition - (ULONG)m_ullWritePosition);
+        }
+        // If our current position is ahead of EoS position and we'll wrap around after new position then adjust
+        // new position if it crosses EoS.
+        else if ((m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize < m_ullWritePosition)
+        {
+            if ((m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize > m_ulCurrentWritePosition)
             {
-                if ((m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize > m_ulCurrentWritePosition)
-                {
-                    ByteDisplacement = ByteDisplacement - (((ULONG)m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize - m_ulCurrentWritePosition);
-                }
+                ByteDisplacement = ByteDisplacement - (((ULONG)m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize - m_ulCurrentWritePosition);
             }
         }
 
         // If the last packet was rendered(read in the sample driver's case), send out an etw event.
-        if (m_bEoSReceived && !m_bLastBufferRendered
+        if (!m_bLastBufferRendered
             && (m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize == m_ulCurrentWritePosition)
         {
             m_bLastBufferRendered = TRUE;
         }
+    }
 
-        if (!g_DoNotCreateDataFiles)
-        {
-            // Read from buffer and write to a file.
-            ReadBytes(ByteDisplacement);
-        }
+    bufferOffset = m_ullLinearPosition % m_ulDmaBufferSize;
+
+    KeReleaseSpinLockFromDpcLevel(&m_PositionSpinLock);
+
+    if (m_bCapture)
+    {
+        // Fill the buffer from the loopback, or with silence.
+        WriteBytes(bufferOffset, ByteDisplacement);
     }
-    
+    else
+    {
+        // Read from buffer, meter it and write it to a file and/or the
+        // loopback.
+        ReadBytes(bufferOffset, ByteDisplacement);
+    }
+
+    KeAcquireSpinLockAtDpcLevel(&m_PositionSpinLock);
+
     // Increment the DMA position by the number of bytes displaced since the last
     // call to UpdatePosition() and ensure we properly wrap at buffer length.
     //
     m_ullPlayPosition = m_ullWritePosition =
         (m_ullWritePosition + ByteDisplacement) % m_ulDmaBufferSize;
     
-    // m_ullDmaTimeStamp is updated in both GetPostion and GetLinearPosition calls
-    // so m_ullLinearPosition needs to be updated accordingly here
+    // Keep the linear position in step with the frames reported by the clock.
     //
     m_ullLinearPosition += ByteDisplacement;
-    
-    // Update the DMA time stamp for the next call to GetPosition()
-    //
-    m_ullDmaTimeStamp = hnsCurrentTime;
+
+    PublishPositions(ilQPC.QuadPart);
+
+    KeReleaseSpinLockFromDpcLevel(&m_PositionSpinLock);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CMiniportWaveRTStream::TryUpdatePosition()
+/*++
+
+Routine Description:
+
+  Brings the positions up to date for a poller, unless the timer or another
+  poller is already advancing the stream. Either way the caller then reads
+  the published snapshot, so it never spins behind an audio copy.
+
+--*/
+{
+    KIRQL oldIrql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+
+    if (KeTryToAcquireSpinLockAtDpcLevel(&m_DataSpinLock))
+    {
+        if (m_KsState == KSSTATE_RUN)
+        {
+            UpdatePosition(KeQueryPerformanceCounter(NULL));
+        }
+        KeReleaseSpinLockFromDpcLevel(&m_DataSpinLock);
+    }
+
+    KeLowerIrql(oldIrql);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CMiniportWaveRTStream::PublishPositions
+(
+    _In_ LONGLONG llQPC
+)
+/*++
+
+Routine Description:
+
+  Publishes the current position state for lock-free readers. The caller
+  holds m_PositionSpinLock, which also serializes the publishers.
+
+Arguments:
+
+  llQPC - performance counter value the positions correspond to.
+
+--*/
+{
+    POSITION_SNAPSHOT snapshot;
+
+    snapshot.ullPlayPosition = m_ullPlayPosition;
+    snapshot.ullWritePosition = m_ullWritePosition;
+    snapshot.ullLinearPosition = m_ullLinearPosition;
+    snapshot.ullPresentationPosition = m_ullPresentationPosition;
+    snapshot.llPacketCounter = m_llPacketCounter;
+    snapshot.llQPC = llQPC;
+    snapshot.FrameClock = m_FrameClock;
+
+    m_PositionSnapshot.Publish(snapshot);
 }
 
 //=============================================================================
 #pragma code_seg()
 VOID CMiniportWaveRTStream::WriteBytes
 (
+    _In_ ULONG BufferOffset,
     _In_ ULONG ByteDisplacement
 )
 /*++
 
 Routine Description:
 
-This function writes the audio buffer using silence instead of a tone generator
+This function writes the audio buffer with the configured capture file,
+else with the audio looped back from the render endpoint, or with silence
+when there is neither. On the mic array it can then render that audio as
+heard from a set direction. With the speaker's AEC switch on it cancels the
+echo of the render audio, then it applies the volume and meters what it
+wrote.
 
 Arguments:
 
+BufferOffset - offset in the DMA buffer to start at.
+
 ByteDisplacement - # of bytes to process.
 
 --*/
 {
-    ULONG bufferOffset = m_ullLinearPosition % m_ulDmaBufferSize;
+    ULONG bufferOffset = BufferOffset;
+    BOOL  bCancelEcho;
+
+    UpdateVolume();
+    UpdateEchoCanceller();
+
+    // The far end reference is the render audio in the loopback.
+    bCancelEcho = m_bAecEnabled && m_pLoopback != NULL;
 
     // Normally this will loop no more than once for a single wrap, but if
     // many bytes have been displaced then this may loops many times.
     while (ByteDisplacement > 0)
     {
         ULONG runWrite = min(ByteDisplacement, m_ulDmaBufferSize - bufferOffset);
+
+        if (bCancelEcho)
+        {
+            runWrite = min(runWrite, m_ulProcessBufferBytes);
+        }
         
-        // Instead of generating a tone, just output silence
-        RtlZeroMemory(m_pDmaBuffer + bufferOffset, runWrite);
-           	
+        if (m_CaptureFile.IsActive())
+        {
+            m_CaptureFile.Read(m_pDmaBuffer + bufferOffset, runWrite);
+            if (bCancelEcho)
+            {
+                m_pLoopback->Read(m_lLoopbackFormatKey,
+                                  m_ulLoopbackChannelMask,
+                                  m_pWfExt->Format.nBlockAlign,
+                                  m_pProcessBuffer,
+                                  runWrite);
+            }
+        }
+        else if (m_pLoopback)
+        {
+            m_pLoopback->Read(m_lLoopbackFormatKey,
+                              m_ulLoopbackChannelMask,
+                              m_pWfExt->Format.nBlockAlign,
+                              m_pDmaBuffer + bufferOffset,
+                              runWrite);
+            if (bCancelEcho)
+            {
+                // The microphone hears the speaker directly.
+                RtlCopyMemory(m_pProcessBuffer, m_pDmaBuffer + bufferOffset, runWrite);
+            }
+        }
+        else
+        {
+            RtlZeroMemory(m_pDmaBuffer + bufferOffset, runWrite);
+        }
+
+        if (m_MicArraySource.IsActive())
+        {
+            m_MicArraySource.Process(m_pDmaBuffer + bufferOffset, runWrite);
+        }
+
+        if (bCancelEcho)
+        {
+            m_EchoCanceller.Process(m_pDmaBuffer + bufferOffset, m_pProcessBuffer, runWrite);
+        }
+
+        if (!m_Volume.IsUnity())
+        {
+            m_Volume.Process(m_pDmaBuffer + bufferOffset, runWrite);
+        }
+
+        if (m_PeakMeter.IsActive())
+        {
+            m_PeakMeter.Process(m_pDmaBuffer + bufferOffset, runWrite);
+        }
+
         bufferOffset = (bufferOffset + runWrite) % m_ulDmaBufferSize;
         ByteDisplacement -= runWrite;
     }
+
+    PublishPeakMeter();
 }
 
 //=============================================================================
 #pragma code_seg()
 VOID CMiniportWaveRTStream::ReadBytes
 (
+    _In_ ULONG BufferOffset,
     _In_ ULONG ByteDisplacement
 )
 /*++
 
 Routine Description:
 
-This function reads the audio buffer and saves the data in a file.
+This function reads the audio buffer, applies the tone control, reverb,
+chorus, volume and mute in the topology's order, meters it, saves the data in
+a file and feeds the speaker-to-microphone loopback. Volume and mute come
+last so a mute also silences the reverb tail. With the binaural virtualizer
+active the file and the loopback get its stereo rendering instead.
 
 Arguments:
 
+BufferOffset - offset in the DMA buffer to start at.
+
 ByteDisplacement - # of bytes to process.
 
 --*/
 {
-    ULONG bufferOffset = m_ullLinearPosition % m_ulDmaBufferSize;
+    ULONG bufferOffset = BufferOffset;
+
+    UpdateVolume();
+    UpdateToneControl();
+    UpdateReverb();
+    UpdateChorus();
 
     // Normally this will loop no more than once for a single wrap, but if
     // many bytes have been displaced then this may loops many times.
     while (ByteDisplacement > 0)
     {
         ULONG runWrite = min(ByteDisplacement, m_ulDmaBufferSize - bufferOffset);
-        m_SaveData.WriteData(m_pDmaBuffer + bufferOffset, runWrite);
+        PBYTE pData = m_pDmaBuffer + bufferOffset;
+        PBYTE pOutput;
+        ULONG runOutput;
+
+        if (m_Binaural.IsActive())
+        {
+            runWrite = min(runWrite, STREAM_PROCESS_BUFFER_FRAMES * m_pWfExt->Format.nBlockAlign);
+        }
+
+        if (m_pProcessBuffer &&
+            (!m_Volume.IsUnity() || !m_ToneControl.IsFlat() || !m_Reverb.IsIdle() || !m_Chorus.IsIdle()))
+        {
+            runWrite = min(runWrite, m_ulProcessBufferBytes);
+            RtlCopyMemory(m_pProcessBuffer, pData, runWrite);
+            m_ToneControl.Process(m_pProcessBuffer, runWrite);
+            m_Reverb.Process(m_pProcessBuffer, runWrite);
+            m_Chorus.Process(m_pProcessBuffer, runWrite);
+            m_Volume.Process(m_pProcessBuffer, runWrite);
+            pData = m_pProcessBuffer;
+        }
+        else
+        {
+            // Flat and off; these only record the history.
+            m_ToneControl.Process(pData, runWrite);
+            m_Chorus.Process(pData, runWrite);
+        }
+
+        pOutput = pData;
+        runOutput = runWrite;
+        if (m_Binaural.IsActive())
+        {
+            m_Binaural.Process(pData, runWrite, m_pBinauralBuffer);
+            pOutput = m_pBinauralBuffer;
+            runOutput = m_Binaural.GetOutputBytes(runWrite);
+        }
+
+        if (!g_DoNotCreateDataFiles)
+        {
+            m_SaveData.WriteData(pOutput, runOutput);
+        }
+        if (m_pLoopback)
+        {
+            m_pLoopback->Write(pOutput, runOutput);
+        }
+        if (m_PeakMeter.IsActive())
+        {
+            m_PeakMeter.Process(pData, runWrite);
+        }
         bufferOffset = (bufferOffset + runWrite) % m_ulDmaBufferSize;
         ByteDisplacement -= runWrite;
     }
+
+    PublishPeakMeter();
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CMiniportWaveRTStream::PublishPeakMeter()
+/*++
+
+Routine Description:
+
+Publishes the metered levels to the topology's peak meter node. Called with
+m_DataSpinLock held.
+
+--*/
+{
+    PEAK_METER_LEVELS levels;
+
+    if (m_PeakMeter.IsActive())
+    {
+        m_PeakMeter.GetLevels(&levels);
+        m_pMiniport->GetAdapterCommObj()->MixerPeakMeterWrite(m_ulPeakMeterNode, &levels);
+    }
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CMiniportWaveRTStream::UpdateVolume()
+/*++
+
+Routine Description:
+
+Picks up the topology's volume and mute settings; a change starts a ramp to
+the new gains. Called with m_DataSpinLock held.
+
+--*/
+{
+    PADAPTERCOMMON  pAdapterComm = m_pMiniport->GetAdapterCommObj();
+    LONG            lGain[GAIN_MAX_CHANNELS] = { 0 };
+
+    if (!m_Volume.IsActive())
+    {
+        return;
+    }
+
+    for (ULONG i = 0; i < m_pWfExt->Format.nChannels && i < GAIN_MAX_CHANNELS; i++)
+    {
+        if (!pAdapterComm->MixerMuteRead(m_ulMuteNode, i))
+        {
+            lGain[i] = GainFromVolume(pAdapterComm->MixerVolumeRead(m_ulVolumeNode, i));
+        }
+    }
+
+    m_Volume.SetTargets(lGain);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CMiniportWaveRTStream::UpdateToneControl()
+/*++
+
+Routine Description:
+
+Picks up the topology's bass and treble settings; a change starts a glide
+to the new filters. Called with m_DataSpinLock held.
+
+--*/
+{
+    PADAPTERCOMMON  pAdapterComm = m_pMiniport->GetAdapterCommObj();
+    LONG            lBass[TONE_MAX_CHANNELS] = { 0 };
+    LONG            lTreble[TONE_MAX_CHANNELS] = { 0 };
+
+    if (!m_ToneControl.IsActive())
+    {
+        return;
+    }
+
+    for (ULONG i = 0; i < m_pWfExt->Format.nChannels && i < TONE_MAX_CHANNELS; i++)
+    {
+        lBass[i] = pAdapterComm->MixerBassRead(m_ulBassNode, i);
+        lTreble[i] = pAdapterComm->MixerTrebleRead(m_ulTrebleNode, i);
+    }
+
+    m_ToneControl.SetTargets(lBass, lTreble);
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CMiniportWaveRTStream::UpdateReverb()
+/*++
+
+Routine Description:
+
+Picks up the topology's reverb level, which sets the wet mix; a change
+crossfades to it. Called with m_DataSpinLock held.
+
+--*/
+{
+    if (!m_Reverb.IsActive())
+    {
+        return;
+    }
+
+    m_Reverb.SetLevel(m_pMiniport->GetAdapterCommObj()->MixerReverbRead(m_ulReverbNode, 0));
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CMiniportWaveRTStream::UpdateChorus()
+/*++
+
+Routine Description:
+
+Picks up the topology's chorus level, which sets the wet mix; a change fades
+to it. Called with m_DataSpinLock held.
+
+--*/
+{
+    if (!m_Chorus.IsActive())
+    {
+        return;
+    }
+
+    m_Chorus.SetLevel(m_pMiniport->GetAdapterCommObj()->MixerChorusRead(m_ulChorusNode, 0));
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID CMiniportWaveRTStream::UpdateEchoCanceller()
+/*++
+
+Routine Description:
+
+Picks up the speaker's AEC switch. Switching it on starts over with an
+untrained filter; the canceller's output lags the microphone by one block.
+Called with m_DataSpinLock held.
+
+--*/
+{
+    BOOL bEnabled;
+
+    if (!m_EchoCanceller.IsActive())
+    {
+        return;
+    }
+
+    bEnabled = m_pMiniport->GetAdapterCommObj()->AecEnabledRead(m_ulAecNode);
+    if (bEnabled && !m_bAecEnabled)
+    {
+        m_EchoCanceller.Reset();
+    }
+    m_bAecEnabled = bEnabled;
 }
 
 //=============================================================================
@@ -1544,18 +2162,39 @@ Return Value:
 
 //=============================================================================
 #pragma code_seg()
-void
+ULONGLONG
 TimerNotifyRT
 (
-    _In_      PEX_TIMER    Timer,
-    _In_opt_  PVOID        DeferredContext
+    _In_opt_  PVOID        DeferredContext,
+    _In_      ULONGLONG    hnsNow
 )
+/*++
+
+Routine Description:
+
+  Per-stream work of the adapter's stream timer: advances the simulated DMA
+  position and signals the notification events when a packet completes.
+
+Arguments:
+
+  DeferredContext - the stream.
+
+  hnsNow - tick time.
+
+Return Value:
+
+  Time the stream next needs to run: the end of the current packet, the
+  next tick while draining towards EoS, or SCHEDULER_DONE once the last
+  buffer has been rendered.
+
+--*/
 {
     LARGE_INTEGER qpc;
     LARGE_INTEGER qpcFrequency;
     BOOL bufferCompleted = FALSE;
+    ULONGLONG hnsNextDue = 0;
 
-    UNREFERENCED_PARAMETER(Timer);
+    UNREFERENCED_PARAMETER(hnsNow);
 
     _IRQL_limited_to_(DISPATCH_LEVEL);
 
@@ -1563,28 +2202,23 @@ TimerNotifyRT
     
     if (NULL == _this)
     {
-        return;
+        return SCHEDULER_DONE;
     }
 
     KIRQL oldIrql;
-    KeAcquireSpinLock(&_this->m_PositionSpinLock, &oldIrql);
+    KeAcquireSpinLock(&_this->m_DataSpinLock, &oldIrql);
 
     qpc = KeQueryPerformanceCounter(&qpcFrequency);
 
     // Convert ticks to 100ns units.
     LONGLONG  hnsCurrentTime = KSCONVERT_PERFORMANCE_TIME(_this->m_ullPerformanceCounterFrequency.QuadPart, qpc);
 
-    // Calculate the time elapsed since the last we ran DPC that matched Notification interval. Note that the division by 10000 
-    // to convert to milliseconds may cause us to lose some of the time, so we will carry the remainder forward.
-
-    ULONG TimeElapsedInMS = (ULONG)(hnsCurrentTime - _this->m_ullLastDPCTimeStamp + _this->m_hnsDPCTimeCarryForward)/10000;
-
-    if (TimeElapsedInMS >= _this->m_ulNotificationIntervalMs)
+    // The current packet is complete once the frame clock has passed its last frame. This is
+    // the same boundary GetReadPacket reports, and since it is a frame count rather than a
+    // millisecond interval the notifications cannot drift from the data.
+    if (_this->m_FrameClock.GetFrames(hnsCurrentTime) >=
+        (ULONGLONG)(_this->m_llPacketCounter + 1) * _this->m_ulFramesPerPacket)
     {
-        // Carry forward the time greater than notification interval to adjust time to signal next buffer completion event accordingly.
-        _this->m_hnsDPCTimeCarryForward = hnsCurrentTime - _this->m_ullLastDPCTimeStamp + _this->m_hnsDPCTimeCarryForward - (_this->m_ulNotificationIntervalMs * 10000);
-        // Save the last time DPC ran at notification interval
-        _this->m_ullLastDPCTimeStamp = hnsCurrentTime;
         bufferCompleted = TRUE;
     }
 
@@ -1597,7 +2231,10 @@ TimerNotifyRT
 
     if (!_this->m_bEoSReceived)
     {
+        KeAcquireSpinLockAtDpcLevel(&_this->m_PositionSpinLock);
         _this->m_llPacketCounter++;
+        _this->PublishPositions(qpc.QuadPart);
+        KeReleaseSpinLockFromDpcLevel(&_this->m_PositionSpinLock);
     }
 
     if (_this->m_KsState != KSSTATE_RUN)
@@ -1639,14 +2276,19 @@ TimerNotifyRT
         }
     }
 
+End:
     if (_this->m_bLastBufferRendered)
     {
-        ExCancelTimer(_this->m_pNotificationTimer, NULL);
+        hnsNextDue = SCHEDULER_DONE;
+    }
+    else if (!_this->m_bEoSReceived)
+    {
+        hnsNextDue = (ULONGLONG)_this->m_FrameClock.GetTimeOfFrame(
+            (ULONGLONG)(_this->m_llPacketCounter + 1) * _this->m_ulFramesPerPacket);
     }
 
-End:
-    KeReleaseSpinLock(&_this->m_PositionSpinLock, oldIrql);
-    return;
+    KeReleaseSpinLock(&_this->m_DataSpinLock, oldIrql);
+    return hnsNextDue;
 }
 //=============================================================================
 
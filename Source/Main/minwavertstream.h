@@ -16,6 +16,22 @@ Abstract:
 
 #include "savedata.h"
 #include "ToneGenerator.h"
+#include "loopback.h"
+#include "capturefile.h"
+#include "frameclock.h"
+#include "streamscheduler.h"
+#include "seqlock.h"
+#include "peakmeter.h"
+#include "gainramp.h"
+#include "tonecontrol.h"
+#include "reverb.h"
+#include "chorus.h"
+#include "echocanceller.h"
+#include "binaural.h"
+#include "micarraysource.h"
+
+// Render audio is processed in a copy this long.
+#define STREAM_PROCESS_BUFFER_FRAMES    1024
 
 //
 // Structure to store notifications events in a protected list
@@ -26,7 +42,22 @@ typedef struct _NotificationListEntry
     PKEVENT     NotificationEvent;
 } NotificationListEntry;
 
-EXT_CALLBACK   TimerNotifyRT;
+//
+// Position state as seen by the pollers. Published by whoever advances the
+// simulated DMA and read back without taking a lock.
+//
+typedef struct _POSITION_SNAPSHOT
+{
+    ULONGLONG       ullPlayPosition;
+    ULONGLONG       ullWritePosition;
+    ULONGLONG       ullLinearPosition;
+    ULONGLONG       ullPresentationPosition;
+    LONGLONG        llPacketCounter;
+    LONGLONG        llQPC;                  // When the positions were taken.
+    CFrameClock     FrameClock;
+} POSITION_SNAPSHOT;
+
+SCHEDULER_CALLBACK  TimerNotifyRT;
 
 //=============================================================================
 // Referenced Forward
@@ -50,7 +81,7 @@ class CMiniportWaveRTStream :
 protected:
     PPORTWAVERTSTREAM           m_pPortStream;
     LIST_ENTRY                  m_NotificationList;
-    PEX_TIMER                   m_pNotificationTimer;
+    SCHEDULER_ENTRY             m_SchedulerEntry;       // Link into the adapter's stream timer.
     ULONG                       m_ulNotificationIntervalMs;
     ULONG                       m_ulCurrentWritePosition;
     LONG                        m_IsCurrentWritePositionUpdated;
@@ -79,7 +110,7 @@ public:
 
     // Friends
     friend class                CMiniportWaveRT;
-    friend EXT_CALLBACK         TimerNotifyRT;
+    friend SCHEDULER_CALLBACK   TimerNotifyRT;
 protected:
     CMiniportWaveRT*            m_pMiniport;
     ULONG                       m_ulPin;
@@ -88,9 +119,8 @@ protected:
     ULONG                       m_ulDmaBufferSize;
     BYTE*                       m_pDmaBuffer;
     ULONG                       m_ulNotificationsPerBuffer;
+    ULONG                       m_ulFramesPerPacket;
     KSSTATE                     m_KsState;
-    PKTIMER                     m_pTimer;
-    PRKDPC                      m_pDpc;
     ULONGLONG                   m_ullPlayPosition;
     ULONGLONG                   m_ullWritePosition;
     ULONGLONG                   m_ullLinearPosition;
@@ -98,25 +128,57 @@ protected:
     ULONG                       m_ulLastOsReadPacket;
     ULONG                       m_ulLastOsWritePacket;
     LONGLONG                    m_llPacketCounter;
-    ULONGLONG                   m_ullDmaTimeStamp;
     LARGE_INTEGER               m_ullPerformanceCounterFrequency;
-    ULONGLONG                   m_hnsElapsedTimeCarryForward;
-    ULONGLONG                   m_ullLastDPCTimeStamp;
-    ULONGLONG                   m_hnsDPCTimeCarryForward;
-    ULONG                       m_byteDisplacementCarryForward;
+    CFrameClock                 m_FrameClock;           // Simulated DMA clock, see m_DataSpinLock.
     ULONG                       m_ulDmaMovementRate;
     BOOL                        m_bLfxEnabled;
     PBOOL                       m_pbMuted;
     PLONG                       m_plVolumeLevel;
-    PLONG                       m_plPeakMeter;
+    CPeakMeter                  m_PeakMeter;            // Active on system pins, see m_DataSpinLock.
+    ULONG                       m_ulPeakMeterNode;      // Mixer register the levels are published to.
+    CGainRamp                   m_Volume;               // Active on system pins, see m_DataSpinLock.
+    ULONG                       m_ulVolumeNode;         // Mixer registers of the topology volume
+    ULONG                       m_ulMuteNode;           // and mute.
+    CToneControl                m_ToneControl;          // Active on system render pins, see m_DataSpinLock.
+    ULONG                       m_ulBassNode;           // Mixer registers of the topology bass
+    ULONG                       m_ulTrebleNode;         // and treble.
+    CReverb                     m_Reverb;               // Active on system render pins, see m_DataSpinLock.
+    PVOID                       m_pReverbStorage;       // m_Reverb's delay lines.
+    ULONG                       m_ulReverbNode;         // Mixer register of the topology reverb.
+    CChorus                     m_Chorus;               // Active on system render pins, see m_DataSpinLock.
+    PVOID                       m_pChorusStorage;       // m_Chorus's delay lines.
+    ULONG                       m_ulChorusNode;         // Mixer register of the topology chorus.
+    CEchoCanceller              m_EchoCanceller;        // Active on system capture pins, see m_DataSpinLock.
+    PVOID                       m_pEchoCancellerStorage; // m_EchoCanceller's filters.
+    ULONG                       m_ulAecNode;            // Mixer register of the speaker's AEC switch.
+    BOOL                        m_bAecEnabled;          // The switch as last read.
+    CBinauralVirtualizer        m_Binaural;             // Active on system render pins with BinauralRender set.
+    PVOID                       m_pBinauralStorage;     // m_Binaural's state.
+    PBYTE                       m_pBinauralBuffer;      // STREAM_PROCESS_BUFFER_FRAMES of its stereo output.
+    KSDATAFORMAT_WAVEFORMATEXTENSIBLE m_BinauralFormat; // Format the saved and looped back audio has then.
+    CMicArraySource             m_MicArraySource;       // Active on mic array capture pins with MicArraySource set.
+    PVOID                       m_pMicArraySourceStorage; // m_MicArraySource's filters.
+    PBYTE                       m_pProcessBuffer;       // Render audio being processed, or the echo reference.
+    ULONG                       m_ulProcessBufferBytes;
     PWAVEFORMATEXTENSIBLE       m_pWfExt;
     ULONG                       m_ulContentId;
     CSaveData                   m_SaveData;
     ToneGenerator               m_ToneGenerator;
+    PCLoopbackCable             m_pLoopback;            // Owned by the adapter.
+    LONG                        m_lLoopbackFormatKey;
+    ULONG                       m_ulLoopbackChannelMask;
+    CCaptureFilePlayer          m_CaptureFile;          // Active when a capture file is set.
     GUID                        m_SignalProcessingMode;
     BOOLEAN                     m_bEoSReceived;
     BOOLEAN                     m_bLastBufferRendered;
+    // m_DataSpinLock serializes advancing the simulated DMA, including the
+    // audio copy. m_PositionSpinLock is only held while the position state is
+    // changed and published. The clock, positions and packet counter are
+    // written with both held and may be read with either. Lock order is
+    // m_DataSpinLock, then m_PositionSpinLock.
+    KSPIN_LOCK                  m_DataSpinLock;
     KSPIN_LOCK                  m_PositionSpinLock;
+    CSeqLockSnapshot<POSITION_SNAPSHOT> m_PositionSnapshot;
     // Member variable as config params for tone generator
     ULONG                       m_ulHostCaptureToneFrequency;
     // If abs(m_dwHostCaptureToneAmplitude) + abs(m_dwHostCaptureToneDCValue) > 100
@@ -128,6 +190,7 @@ protected:
     DWORD                       m_dwHostCaptureToneInitialPhase;   // must be between -31416 to 31416
     DWORD                       m_dwLoopbackCaptureToneInitialPhase; // must be between -31416 to 31416
     // Member variable as config params for tone generator
+    UNICODE_STRING              m_HostCaptureFileName;  // WAVE/RF64 file capture plays, if set
 
 public:
 
@@ -163,18 +226,39 @@ private:
 
     VOID WriteBytes
     (
+        _In_ ULONG BufferOffset,
         _In_ ULONG ByteDisplacement
     );
         
     VOID ReadBytes
     (
+        _In_ ULONG BufferOffset,
         _In_ ULONG ByteDisplacement
     );
+
+    VOID PublishPeakMeter();
+
+    VOID UpdateVolume();
+
+    VOID UpdateToneControl();
+
+    VOID UpdateReverb();
+
+    VOID UpdateChorus();
+
+    VOID UpdateEchoCanceller();
     
     VOID UpdatePosition
     (
         _In_ LARGE_INTEGER ilQPC
     );
+
+    VOID TryUpdatePosition();
+
+    VOID PublishPositions
+    (
+        _In_ LONGLONG llQPC
+    );
     
     NTSTATUS SetCurrentWritePositionInternal
     (
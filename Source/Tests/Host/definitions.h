@@ -0,0 +1,163 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    definitions.h
+
+Abstract:
+
+    Host stand-in for the driver's definitions.h, with just what the
+    translation units the tests build from Utilities use beyond portable.h:
+    status codes, pool allocation, debug output, the wave format
+    structures, and the kernel streaming data format types, GUIDs and
+    microphone coordinates the device tables in Filters are written with.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_TESTS_DEFINITIONS_H_
+#define _VIRTUALAUDIODRIVER_TESTS_DEFINITIONS_H_
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef LONG                NTSTATUS;
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+
+#define PAGED_CODE()
+#define DPF(_level, _args)      (printf _args, printf("\n"))
+
+#define POOL_FLAG_NON_PAGED     0
+
+inline PVOID ExAllocatePool2(ULONGLONG Flags, size_t NumberOfBytes, ULONG Tag)
+{
+    (void)Flags;
+    (void)Tag;
+    return calloc(1, NumberOfBytes);
+}
+
+inline VOID ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+    (void)Tag;
+    free(P);
+}
+
+inline LONG InterlockedExchange(volatile LONG *Target, LONG Value)
+{
+    return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+typedef struct _GUID
+{
+    ULONG           Data1;
+    USHORT          Data2;
+    USHORT          Data3;
+    BYTE            Data4[8];
+} GUID;
+
+inline BOOL IsEqualGUIDAligned(const GUID &guid1, const GUID &guid2)
+{
+    return memcmp(&guid1, &guid2, sizeof(GUID)) == 0;
+}
+
+#define STATICGUIDOF(guid)      guid
+
+static const GUID KSDATAFORMAT_TYPE_AUDIO =
+    { 0x73647561, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const GUID KSDATAFORMAT_SUBTYPE_PCM =
+    { 0x00000001, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const GUID KSDATAFORMAT_SUBTYPE_IEEE_FLOAT =
+    { 0x00000003, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const GUID KSDATAFORMAT_SUBTYPE_ANALOG =
+    { 0x6dba3190, 0x67bd, 0x11cf, { 0xa0, 0xf7, 0x00, 0x20, 0xaf, 0xd1, 0x56, 0xe4 } };
+static const GUID KSDATAFORMAT_SPECIFIER_WAVEFORMATEX =
+    { 0x05589f81, 0xc356, 0x11ce, { 0xbf, 0x01, 0x00, 0xaa, 0x00, 0x55, 0x59, 0x5a } };
+
+// The wave format tag a WAVEFORMATEX-based subformat GUID stands for.
+#define EXTRACT_WAVEFORMATEX_ID(pGuid)  ((USHORT)((pGuid)->Data1))
+
+#define KSAUDIO_SPEAKER_MONO        0x00000004
+#define KSAUDIO_SPEAKER_STEREO      0x00000003
+#define KSAUDIO_SPEAKER_5POINT1     0x0000003F
+#define KSAUDIO_SPEAKER_7POINT1     0x000000FF
+
+#define WAVE_FORMAT_PCM         1
+#define WAVE_FORMAT_IEEE_FLOAT  3
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+#pragma pack(push, 1)
+typedef struct
+{
+    USHORT          wFormatTag;
+    USHORT          nChannels;
+    ULONG           nSamplesPerSec;
+    ULONG           nAvgBytesPerSec;
+    USHORT          nBlockAlign;
+    USHORT          wBitsPerSample;
+    USHORT          cbSize;
+} WAVEFORMATEX, *PWAVEFORMATEX;
+
+typedef struct
+{
+    WAVEFORMATEX    Format;
+    union
+    {
+        USHORT      wValidBitsPerSample;
+        USHORT      wSamplesPerBlock;
+        USHORT      wReserved;
+    } Samples;
+    ULONG           dwChannelMask;
+    GUID            SubFormat;
+} WAVEFORMATEXTENSIBLE, *PWAVEFORMATEXTENSIBLE;
+#pragma pack(pop)
+
+typedef struct
+{
+    ULONG           FormatSize;
+    ULONG           Flags;
+    ULONG           SampleSize;
+    ULONG           Reserved;
+    GUID            MajorFormat;
+    GUID            SubFormat;
+    GUID            Specifier;
+} KSDATAFORMAT, *PKSDATAFORMAT;
+
+typedef struct
+{
+    KSDATAFORMAT    DataFormat;
+    WAVEFORMATEX    WaveFormatEx;
+} KSDATAFORMAT_WAVEFORMATEX, *PKSDATAFORMAT_WAVEFORMATEX;
+
+typedef struct
+{
+    KSDATAFORMAT            DataFormat;
+    WAVEFORMATEXTENSIBLE    WaveFormatExt;
+} KSDATAFORMAT_WAVEFORMATEXTENSIBLE, *PKSDATAFORMAT_WAVEFORMATEXTENSIBLE;
+
+typedef enum
+{
+    KSMICARRAY_MICTYPE_OMNIDIRECTIONAL = 0,
+    KSMICARRAY_MICTYPE_SUBCARDIOID,
+    KSMICARRAY_MICTYPE_CARDIOID,
+    KSMICARRAY_MICTYPE_SUPERCARDIOID,
+    KSMICARRAY_MICTYPE_HYPERCARDIOID,
+    KSMICARRAY_MICTYPE_8SHAPED,
+    KSMICARRAY_MICTYPE_VENDORDEFINED = 0x0F
+} KSMICARRAY_MICTYPE;
+
+typedef struct
+{
+    USHORT          usType;
+    SHORT           wXCoord;
+    SHORT           wYCoord;
+    SHORT           wZCoord;
+    SHORT           wVerticalAngle;
+    SHORT           wHorizontalAngle;
+} KSAUDIO_MICROPHONE_COORDINATES, *PKSAUDIO_MICROPHONE_COORDINATES;
+
+#endif // _VIRTUALAUDIODRIVER_TESTS_DEFINITIONS_H_
@@ -0,0 +1,39 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    benchutil.h
+
+Abstract:
+
+    Timing shared by the host benchmarks. The benchmarks build next to the
+    tests but are not registered with ctest; they print what they measure
+    and are run by hand, optimized.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_BENCHUTIL_H_
+#define _VIRTUALAUDIODRIVER_BENCHUTIL_H_
+
+#include <chrono>
+#include <stdio.h>
+
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(_a)   (sizeof(_a) / sizeof((_a)[0]))
+#endif
+
+// Monotonic time in seconds.
+inline double BenchSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Keeps the optimizer from dropping work whose result is never read.
+template <typename T>
+inline void BenchKeep(const T &value)
+{
+    __asm__ __volatile__("" : : "g"(&value) : "memory");
+}
+
+#endif // _VIRTUALAUDIODRIVER_BENCHUTIL_H_
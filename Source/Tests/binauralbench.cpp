@@ -0,0 +1,161 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    binauralbench.cpp
+
+Abstract:
+
+    CPU per virtualized stream: CBinauralVirtualizer::Process on 1 ms
+    blocks at 44.1 and 48 kHz, 16-bit and float, from stereo, 5.1 and
+    7.1, against the same BINAURAL_TAPS responses convolved directly in
+    the time domain. Also how long Init takes to transform the responses.
+--*/
+
+#include "binaural.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define BENCH_AUDIO_SECONDS     4
+#define BENCH_BUFFER_BLOCKS     10      // A 10 ms DMA buffer, cycled.
+#define BENCH_INITS             2000
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// Both ears of ulFrames frames by direct convolution, from a history of
+// BINAURAL_TAPS - 1 frames before plIn.
+//
+__attribute__((noinline)) static VOID DirectConvolve(const LONG *plIn, ULONG ulFrames, ULONG ulChannels,
+                                                     const LONG * const *pplTaps, PLONG plOut)
+{
+    for (ULONG n = 0; n < ulFrames; n++)
+    {
+        for (ULONG e = 0; e < BINAURAL_EARS; e++)
+        {
+            LONGLONG llSum = 0;
+
+            for (ULONG c = 0; c < ulChannels; c++)
+            {
+                const LONG * plTaps = pplTaps[c * BINAURAL_EARS + e];
+
+                for (ULONG t = 0; t < BINAURAL_TAPS; t++)
+                {
+                    llSum += (LONGLONG)plIn[((LONG)n - (LONG)t) * (LONG)ulChannels + (LONG)c] * plTaps[t];
+                }
+            }
+
+            plOut[n * BINAURAL_EARS + e] = (LONG)(llSum >> BINAURAL_TAP_SHIFT);
+        }
+    }
+}
+
+static double TimeDirect(ULONG ulRate, ULONG ulChannels, ULONG ulBlockFrames, ULONG ulBlocks)
+{
+    std::vector<LONG>   input((BINAURAL_TAPS + ulBlockFrames * BENCH_BUFFER_BLOCKS) * ulChannels);
+    std::vector<LONG>   output(ulBlockFrames * BINAURAL_EARS);
+    const LONG *        taps[BINAURAL_MAX_CHANNELS * BINAURAL_EARS];
+    ULONG               ulMask = ChannelMatrixMask(0, ulChannels);
+    ULONG               ulState = 1;
+    double              dStart;
+
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        input[i] = (LONG)(Random(&ulState) << 8) >> 10;
+    }
+
+    for (ULONG c = 0; c < ulChannels; c++)
+    {
+        const BINAURAL_SPEAKER & speaker = g_BinauralSpeakers[ChannelMatrixCountBits((ulMask & (0 - ulMask)) - 1)];
+
+        taps[c * BINAURAL_EARS] = speaker.bRight ? g_BinauralResponses.Far[ulRate][speaker.ulPosition] : g_BinauralResponses.Near[ulRate][speaker.ulPosition];
+        taps[c * BINAURAL_EARS + 1] = speaker.bRight ? g_BinauralResponses.Near[ulRate][speaker.ulPosition] : g_BinauralResponses.Far[ulRate][speaker.ulPosition];
+        ulMask &= ulMask - 1;
+    }
+
+    dStart = BenchSeconds();
+    for (ULONG b = 0; b < ulBlocks; b++)
+    {
+        DirectConvolve(&input[(BINAURAL_TAPS + (b % BENCH_BUFFER_BLOCKS) * ulBlockFrames) * ulChannels],
+                       ulBlockFrames, ulChannels, taps, output.data());
+        BenchKeep(output[0]);
+    }
+
+    return (BenchSeconds() - dStart) / ulBlocks;
+}
+
+//=============================================================================
+static VOID BenchFormat(ULONG ulRate, ULONG ulBits, ULONG ulChannels, BOOL bFloat)
+{
+    ULONG                   ulSampleRate = g_BinauralRates[ulRate];
+    ULONG                   ulBlockFrames = ulSampleRate / 1000;
+    ULONG                   ulInBlockBytes = ulBlockFrames * ulChannels * ulBits / 8;
+    ULONG                   ulOutBlockBytes = ulBlockFrames * BINAURAL_EARS * ulBits / 8;
+    ULONG                   ulBlocks = BENCH_AUDIO_SECONDS * 1000;
+    std::vector<BYTE>       input(ulInBlockBytes * BENCH_BUFFER_BLOCKS);
+    std::vector<BYTE>       output(ulOutBlockBytes * BENCH_BUFFER_BLOCKS);
+    std::vector<BYTE>       storage(CBinauralVirtualizer::GetStorageBytes(ulChannels));
+    CBinauralVirtualizer    virtualizer;
+    ULONG                   ulState = 1;
+    double                  dStart;
+    double                  dVirtualizer;
+    double                  dInit;
+
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        input[i] = (BYTE)Random(&ulState);
+    }
+
+    // Float samples within [-1, 1].
+    if (bFloat)
+    {
+        for (size_t i = 3; i < input.size(); i += 4)
+        {
+            input[i] = (input[i] & 0x80) | 0x3E;
+        }
+    }
+
+    dStart = BenchSeconds();
+    for (ULONG k = 0; k < BENCH_INITS; k++)
+    {
+        virtualizer.Init(ulSampleRate, ulBits, ulChannels, 0, bFloat, storage.data(), (ULONG)storage.size());
+    }
+    dInit = (BenchSeconds() - dStart) / BENCH_INITS;
+
+    dStart = BenchSeconds();
+    for (ULONG b = 0; b < ulBlocks; b++)
+    {
+        virtualizer.Process(&input[(b % BENCH_BUFFER_BLOCKS) * ulInBlockBytes], ulInBlockBytes,
+                            &output[(b % BENCH_BUFFER_BLOCKS) * ulOutBlockBytes]);
+    }
+    dVirtualizer = (BenchSeconds() - dStart) / ulBlocks;
+    BenchKeep(output[0]);
+
+    printf("%6u Hz %2u%-1s %u ch: %7.2f us per 1 ms block (%5.2f%% of real time), direct convolution %7.2f us, init %5.1f us\n",
+           ulSampleRate, ulBits, bFloat ? "f" : "", ulChannels, dVirtualizer * 1e6, dVirtualizer * 1e5,
+           TimeDirect(ulRate, ulChannels, ulBlockFrames, ulBlocks / 4) * 1e6, dInit * 1e6);
+}
+
+//=============================================================================
+int main()
+{
+    static const ULONG channelCounts[] = { 2, 6, 8 };
+
+    for (ULONG r = 0; r < BINAURAL_RATES; r++)
+    {
+        for (ULONG n = 0; n < ARRAYSIZE(channelCounts); n++)
+        {
+            BenchFormat(r, 16, channelCounts[n], FALSE);
+            BenchFormat(r, 32, channelCounts[n], TRUE);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    binauraltest.cpp
+
+Abstract:
+
+    CBinauralVirtualizer: the partitioned convolution against a direct one
+    with the same responses, for 5.1 and 7.1 at both rates and in uneven
+    calls, and the head model's interaural delay and level.
+--*/
+
+#include "binaural.h"
+#include "testutil.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#define TEST_FRAMES     24000
+
+//=============================================================================
+static VOID TestAgainstDirect()
+{
+    static const ULONG channelCounts[] = { 6, 8 };
+
+    for (ULONG r = 0; r < BINAURAL_RATES; r++)
+    {
+        for (ULONG k = 0; k < ARRAYSIZE(channelCounts); k++)
+        {
+            ULONG                   C = channelCounts[k];
+            std::vector<BYTE>       storage(CBinauralVirtualizer::GetStorageBytes(C));
+            std::vector<float>      in(TEST_FRAMES * C);
+            std::vector<float>      out(TEST_FRAMES * BINAURAL_EARS);
+            const LONG *            plResponses[BINAURAL_EARS][BINAURAL_MAX_CHANNELS];
+            CBinauralVirtualizer    virtualizer;
+            ULONG                   ulMask = ChannelMatrixMask(0, C);
+            double                  dSignal = 0;
+            double                  dError = 0;
+            double                  dSnr;
+
+            TEST_CHECK(virtualizer.Init(g_BinauralRates[r], 32, C, 0, TRUE, storage.data(), (ULONG)storage.size()));
+            TEST_CHECK(virtualizer.GetOutputBytes(C * sizeof(float) * 10) == BINAURAL_EARS * sizeof(float) * 10);
+
+            srand(1);
+            for (size_t i = 0; i < in.size(); i++)
+            {
+                in[i] = (float)((rand() / (double)RAND_MAX * 2 - 1) * 0.3);
+            }
+
+            // Calls that end mid-block.
+            for (ULONG f = 0; f < TEST_FRAMES; )
+            {
+                ULONG ulRun = 1 + (f * 7919) % 150;
+
+                ulRun = ulRun < TEST_FRAMES - f ? ulRun : TEST_FRAMES - f;
+                virtualizer.Process((const BYTE *)&in[f * C], ulRun * C * sizeof(float), (PBYTE)&out[f * BINAURAL_EARS]);
+                f += ulRun;
+            }
+
+            // The responses the virtualizer picks for each channel.
+            for (ULONG c = 0; c < C; c++)
+            {
+                ULONG ulSpeaker = ulMask & (0 - ulMask);
+                const BINAURAL_SPEAKER & speaker = g_BinauralSpeakers[ChannelMatrixCountBits(ulSpeaker - 1)];
+                const LONG * plNear = g_BinauralResponses.Near[r][speaker.ulPosition];
+                const LONG * plFar = g_BinauralResponses.Far[r][speaker.ulPosition];
+
+                plResponses[0][c] = speaker.bRight ? plFar : plNear;
+                plResponses[1][c] = speaker.bRight ? plNear : plFar;
+                ulMask &= ulMask - 1;
+            }
+
+            // Output lags the input by a block.
+            for (ULONG n = BINAURAL_BLOCK_FRAMES; n < TEST_FRAMES; n++)
+            {
+                ULONG m = n - BINAURAL_BLOCK_FRAMES;
+
+                for (ULONG e = 0; e < BINAURAL_EARS; e++)
+                {
+                    double dExpected = 0;
+                    double d;
+
+                    for (ULONG c = 0; c < C; c++)
+                    {
+                        for (ULONG t = 0; t < BINAURAL_TAPS && t <= m; t++)
+                        {
+                            dExpected += in[(m - t) * C + c] * plResponses[e][c][t] / (double)(1L << BINAURAL_TAP_SHIFT);
+                        }
+                    }
+
+                    d = out[n * BINAURAL_EARS + e] - dExpected;
+                    dSignal += dExpected * dExpected;
+                    dError += d * d;
+                }
+            }
+
+            dSnr = 10 * log10(dSignal / dError);
+            printf("%u Hz, %u channels: SNR against direct convolution %.1f dB\n", g_BinauralRates[r], C, dSnr);
+            TEST_CHECK(dSnr >= 82);
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestHeadModel()
+{
+    for (ULONG r = 0; r < BINAURAL_RATES; r++)
+    {
+        // Lateral positions: 30, 90 and 135 degrees.
+        for (ULONG p = 2; p <= 4; p++)
+        {
+            const LONG *    plNear = g_BinauralResponses.Near[r][p];
+            const LONG *    plFar = g_BinauralResponses.Far[r][p];
+            ULONG           ulNearPeak = 0;
+            ULONG           ulFarPeak = 0;
+            double          dNear = 0;
+            double          dFar = 0;
+
+            for (ULONG t = 0; t < BINAURAL_TAPS; t++)
+            {
+                ulNearPeak = labs(plNear[t]) > labs(plNear[ulNearPeak]) ? t : ulNearPeak;
+                ulFarPeak = labs(plFar[t]) > labs(plFar[ulFarPeak]) ? t : ulFarPeak;
+                dNear += (double)plNear[t] * plNear[t];
+                dFar += (double)plFar[t] * plFar[t];
+            }
+
+            // The far ear hears it later, by up to the ~0.7 ms around the head,
+            // and quieter.
+            TEST_CHECK(ulFarPeak > ulNearPeak);
+            TEST_CHECK(ulFarPeak - ulNearPeak <= g_BinauralRates[r] / 1000);
+            TEST_CHECK(dFar < dNear);
+        }
+    }
+
+    // Rates without tables are turned down.
+    {
+        CBinauralVirtualizer    virtualizer;
+        std::vector<BYTE>       storage(CBinauralVirtualizer::GetStorageBytes(2));
+
+        TEST_CHECK(!virtualizer.Init(96000, 16, 2, 0, FALSE, storage.data(), (ULONG)storage.size()));
+        TEST_CHECK(!virtualizer.IsActive());
+        TEST_CHECK(CBinauralVirtualizer::GetStorageBytes(BINAURAL_MAX_CHANNELS + 1) == 0);
+    }
+}
+
+//=============================================================================
+int main()
+{
+    TestAgainstDirect();
+    TestHeadModel();
+
+    return TestResult("binaural");
+}
@@ -0,0 +1,155 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    channelmatrixbench.cpp
+
+Abstract:
+
+    Cost of up and downmixing a stream: CChannelMixer::Process on 1 ms
+    blocks at 48 and 384 kHz, 16-bit and float, for each shape with a
+    dense kernel and a few that run the sparse one. For the dense shapes
+    the kernel alone is timed against the sparse kernel on the same
+    matrix. Also how long building a matrix takes on a cache miss.
+--*/
+
+#include "channelmatrix.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define BENCH_SAMPLES           (1 << 23)
+#define BENCH_BUFFER_BLOCKS     10      // A 10 ms DMA buffer, cycled.
+#define BENCH_BUILDS            100000
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// Seconds for one kernel call on CHANNEL_MATRIX_BLOCK_FRAMES frames.
+//
+static double TimeKernel(PFN_CHANNEL_MIX pfnMix, const CHANNEL_MATRIX *pMatrix, ULONG ulCalls)
+{
+    std::vector<LONG>   input(CHANNEL_MATRIX_BLOCK_FRAMES * BENCH_BUFFER_BLOCKS * pMatrix->ulInChannels);
+    std::vector<LONG>   output(CHANNEL_MATRIX_BLOCK_FRAMES * pMatrix->ulOutChannels);
+    ULONG               ulState = 1;
+    double              dStart;
+
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        input[i] = (LONG)(Random(&ulState) << 8) >> 3;
+    }
+
+    dStart = BenchSeconds();
+    for (ULONG k = 0; k < ulCalls; k++)
+    {
+        pfnMix(pMatrix, &input[(k % BENCH_BUFFER_BLOCKS) * CHANNEL_MATRIX_BLOCK_FRAMES * pMatrix->ulInChannels],
+               output.data(), CHANNEL_MATRIX_BLOCK_FRAMES);
+        BenchKeep(output[0]);
+    }
+
+    return (BenchSeconds() - dStart) / ulCalls;
+}
+
+//=============================================================================
+static VOID BenchShape(CChannelMatrixCache *pCache, ULONG ulInChannels, ULONG ulOutChannels, ULONG ulSampleRate, ULONG ulBits, BOOL bFloat)
+{
+    const CHANNEL_MATRIX *  pMatrix = pCache->Get(0, ulInChannels, 0, ulOutChannels, 0);
+    ULONG                   ulBlockFrames = ulSampleRate / 1000;
+    ULONG                   ulInBlockBytes = ulBlockFrames * ulInChannels * ulBits / 8;
+    ULONG                   ulOutBlockBytes = ulBlockFrames * ulOutChannels * ulBits / 8;
+    ULONG                   ulBlocks = BENCH_SAMPLES / (ulBlockFrames * (ulInChannels + ulOutChannels));
+    std::vector<BYTE>       input(ulInBlockBytes * BENCH_BUFFER_BLOCKS);
+    std::vector<BYTE>       output(ulOutBlockBytes * BENCH_BUFFER_BLOCKS);
+    CChannelMixer           mixer;
+    ULONG                   ulState = 1;
+    double                  dStart;
+    double                  dMixer;
+    BOOL                    bDense = GetChannelMix(ulInChannels, ulOutChannels) != ChannelMixSparse;
+
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        input[i] = (BYTE)Random(&ulState);
+    }
+
+    // Float samples within [-1, 1].
+    if (bFloat)
+    {
+        for (size_t i = 3; i < input.size(); i += 4)
+        {
+            input[i] = (input[i] & 0x80) | 0x3E;
+        }
+    }
+
+    mixer.Init(pMatrix, ulBits, bFloat, ulBits, bFloat);
+
+    dStart = BenchSeconds();
+    for (ULONG b = 0; b < ulBlocks; b++)
+    {
+        mixer.Process(&input[(b % BENCH_BUFFER_BLOCKS) * ulInBlockBytes],
+                      &output[(b % BENCH_BUFFER_BLOCKS) * ulOutBlockBytes], ulBlockFrames);
+    }
+    dMixer = (BenchSeconds() - dStart) / ulBlocks;
+    BenchKeep(output[0]);
+
+    printf("%u -> %u %-6s %6u Hz %2u%-1s: %7.2f us per 1 ms block (%5.2f%% of real time)",
+           ulInChannels, ulOutChannels, bDense ? "dense" : "sparse", ulSampleRate, ulBits, bFloat ? "f" : "",
+           dMixer * 1e6, dMixer * 1e5);
+
+    // The kernels alone, once per shape.
+    if (bDense && ulSampleRate == 48000 && !bFloat)
+    {
+        ULONG ulCalls = BENCH_SAMPLES / (CHANNEL_MATRIX_BLOCK_FRAMES * (ulInChannels + ulOutChannels));
+
+        printf(", kernel %5.1f ns per %u frames, sparse kernel %5.1f ns",
+               TimeKernel(GetChannelMix(ulInChannels, ulOutChannels), pMatrix, ulCalls) * 1e9,
+               CHANNEL_MATRIX_BLOCK_FRAMES, TimeKernel(ChannelMixSparse, pMatrix, ulCalls) * 1e9);
+    }
+
+    printf("\n");
+}
+
+//=============================================================================
+static VOID BenchBuild(ULONG ulInChannels, ULONG ulOutChannels)
+{
+    CHANNEL_MATRIX  matrix;
+    double          dStart = BenchSeconds();
+
+    for (ULONG k = 0; k < BENCH_BUILDS; k++)
+    {
+        BuildChannelMatrix(&matrix, 0, ulInChannels, 0, ulOutChannels, 0);
+        BenchKeep(matrix.lGains[0][0]);
+    }
+
+    printf("build %u -> %u: %.2f us\n", ulInChannels, ulOutChannels, (BenchSeconds() - dStart) / BENCH_BUILDS * 1e6);
+}
+
+//=============================================================================
+int main()
+{
+    static const ULONG shapes[][2] =
+    {
+        { 8, 2 }, { 6, 2 }, { 2, 8 }, { 2, 6 }, { 2, 1 }, { 1, 2 },
+        { 8, 6 }, { 6, 8 }, { 4, 2 },
+    };
+    CChannelMatrixCache cache;
+
+    for (ULONG s = 0; s < ARRAYSIZE(shapes); s++)
+    {
+        BenchShape(&cache, shapes[s][0], shapes[s][1], 48000, 16, FALSE);
+        BenchShape(&cache, shapes[s][0], shapes[s][1], 48000, 32, TRUE);
+        BenchShape(&cache, shapes[s][0], shapes[s][1], 384000, 16, FALSE);
+        BenchShape(&cache, shapes[s][0], shapes[s][1], 384000, 32, TRUE);
+    }
+
+    BenchBuild(8, 2);
+    BenchBuild(2, 8);
+    BenchBuild(8, 6);
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    channelmatrixtest.cpp
+
+Abstract:
+
+    Channel matrices: the ITU-R BS.775 folds between common layouts, back
+    and side twins, the no-clip scaling, the cache, and the dense kernels
+    against the sparse one.
+--*/
+
+#include "channelmatrix.h"
+#include "testutil.h"
+
+#include <math.h>
+#include <vector>
+
+#define MASK_STEREO     (SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT)
+#define MASK_QUAD       (MASK_STEREO | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT)
+#define MASK_5POINT1    (MASK_QUAD | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY)
+#define MASK_5POINT1_SIDE \
+                        (MASK_STEREO | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT)
+#define MASK_7POINT1    (MASK_5POINT1 | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT)
+
+static double Gain(const CHANNEL_MATRIX *pMatrix, ULONG ulOut, ULONG ulIn)
+{
+    return (double)pMatrix->lGains[ulOut][ulIn] / CHANNEL_MATRIX_UNITY;
+}
+
+//
+// Checks a whole matrix against expected, row by row.
+//
+static VOID CheckMatrix
+(
+    ULONG           ulInMask,
+    ULONG           ulInChannels,
+    ULONG           ulOutMask,
+    ULONG           ulOutChannels,
+    LONG            lLfeGain,
+    const double *  pdExpected
+)
+{
+    CHANNEL_MATRIX matrix;
+
+    TEST_CHECK(BuildChannelMatrix(&matrix, ulInMask, ulInChannels, ulOutMask, ulOutChannels, lLfeGain));
+
+    for (ULONG o = 0; o < ulOutChannels; o++)
+    {
+        for (ULONG i = 0; i < ulInChannels; i++)
+        {
+            if (fabs(Gain(&matrix, o, i) - pdExpected[o * ulInChannels + i]) > 1e-6)
+            {
+                printf("%x -> %x: gain [%u][%u] %.6f, expected %.6f\n",
+                       ulInMask, ulOutMask, o, i, Gain(&matrix, o, i), pdExpected[o * ulInChannels + i]);
+                TEST_CHECK(FALSE);
+            }
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestFolds()
+{
+    const double s = 1 / sqrt(2.0);
+
+    // 5.1 -> stereo: L + 0.7071 C + 0.7071 Ls, scaled by the row sum.
+    {
+        const double n = 1 / (1 + 2 * s);
+        const double expected[] =
+        {
+            n, 0, s * n, 0, s * n, 0,
+            0, n, s * n, 0, 0, s * n,
+        };
+
+        CheckMatrix(0, 6, 0, 2, 0, expected);
+    }
+
+    // The same with LFE kept at -3 dB into the center, which folds on at
+    // -3 dB.
+    {
+        const double n = 1 / (1 + 2 * s + 0.5);
+        const double expected[] =
+        {
+            n, 0, s * n, 0.5 * n, s * n, 0,
+            0, n, s * n, 0.5 * n, 0, s * n,
+        };
+
+        CheckMatrix(0, 6, 0, 2, CHANNEL_MATRIX_MINUS_3DB, expected);
+    }
+
+    // Mono to stereo and back.
+    {
+        const double up[] = { s, s };
+        const double down[] = { 0.5, 0.5 };
+
+        CheckMatrix(0, 1, 0, 2, 0, up);
+        CheckMatrix(0, 2, 0, 1, 0, down);
+    }
+
+    // Stereo into 7.1 goes to the front pair only.
+    {
+        double expected[8 * 2] = { 1, 0, 0, 1 };
+
+        CheckMatrix(0, 2, 0, 8, 0, expected);
+    }
+}
+
+//=============================================================================
+static VOID TestTwins()
+{
+    // Back and side name the same surround, so a lone twin moves across
+    // at unity: 5.1 back into 5.1 side is the identity.
+    {
+        double expected[6 * 6] = {};
+
+        for (ULONG c = 0; c < 6; c++)
+        {
+            expected[c * 6 + c] = 1;
+        }
+        CheckMatrix(MASK_5POINT1, 6, MASK_5POINT1_SIDE, 6, 0, expected);
+    }
+
+    // Quad into 5.1 side: backs land on the sides at unity.
+    {
+        const double expected[] =
+        {
+            1, 0, 0, 0,
+            0, 1, 0, 0,
+            0, 0, 0, 0,
+            0, 0, 0, 0,
+            0, 0, 1, 0,
+            0, 0, 0, 1,
+        };
+
+        CheckMatrix(MASK_QUAD, 4, MASK_5POINT1_SIDE, 6, 0, expected);
+    }
+
+    // 7.1 into 5.1: both twins merge into the back at -3 dB each, and the
+    // rows are scaled by 1 / (1 + 0.7071).
+    {
+        const double n = 1 / (1 + 1 / sqrt(2.0));
+        const double m = n / sqrt(2.0);
+        const double expected[] =
+        {
+            n, 0, 0, 0, 0, 0, 0, 0,
+            0, n, 0, 0, 0, 0, 0, 0,
+            0, 0, n, 0, 0, 0, 0, 0,
+            0, 0, 0, n, 0, 0, 0, 0,
+            0, 0, 0, 0, n, 0, m, 0,
+            0, 0, 0, 0, 0, n, 0, m,
+        };
+
+        CheckMatrix(MASK_7POINT1, 8, MASK_5POINT1, 6, 0, expected);
+    }
+}
+
+//=============================================================================
+static VOID TestCache()
+{
+    CChannelMatrixCache cache;
+
+    // Mask 0 means the default layout for the count.
+    const CHANNEL_MATRIX *pDefault = cache.Get(0, 6, 0, 2, 0);
+    const CHANNEL_MATRIX *pExplicit = cache.Get(MASK_5POINT1, 6, MASK_STEREO, 2, 0);
+
+    TEST_CHECK(pDefault != NULL);
+    TEST_CHECK(pDefault == pExplicit);
+    TEST_CHECK(cache.Get(0, 6, 0, 2, CHANNEL_MATRIX_MINUS_3DB) != pDefault);
+    TEST_CHECK(cache.Get(0, 9, 0, 2, 0) == NULL);
+}
+
+//=============================================================================
+static VOID TestKernels()
+{
+    static const ULONG shapes[][2] = { { 8, 2 }, { 6, 2 }, { 2, 8 }, { 2, 6 }, { 2, 1 }, { 1, 2 }, { 4, 6 } };
+    const ULONG frames = 4800;
+
+    for (ULONG k = 0; k < ARRAYSIZE(shapes); k++)
+    {
+        ULONG               ulIn = shapes[k][0];
+        ULONG               ulOut = shapes[k][1];
+        CHANNEL_MATRIX      matrix;
+        std::vector<LONG>   input(frames * ulIn);
+        std::vector<LONG>   dense(frames * ulOut);
+        std::vector<LONG>   sparse(frames * ulOut);
+
+        BuildChannelMatrix(&matrix, 0, ulIn, 0, ulOut, CHANNEL_MATRIX_MINUS_3DB);
+
+        // Q29, up to full scale.
+        for (size_t i = 0; i < input.size(); i++)
+        {
+            input[i] = (LONG)((ULONG)(i * 2654435761u) >> 2) - (1L << 29);
+        }
+
+        for (ULONG f = 0; f < frames; f += CHANNEL_MATRIX_BLOCK_FRAMES)
+        {
+            GetChannelMix(ulIn, ulOut)(&matrix, &input[f * ulIn], &dense[f * ulOut], CHANNEL_MATRIX_BLOCK_FRAMES);
+            ChannelMixSparse(&matrix, &input[f * ulIn], &sparse[f * ulOut], CHANNEL_MATRIX_BLOCK_FRAMES);
+        }
+
+        if (dense != sparse)
+        {
+            printf("%u -> %u: dense and sparse kernels differ\n", ulIn, ulOut);
+        }
+        TEST_CHECK(dense == sparse);
+    }
+}
+
+//=============================================================================
+static VOID TestFullScale()
+{
+    CChannelMatrixCache cache;
+    CChannelMixer       mixer;
+    SHORT               in[8 * 2];
+    float               out[2 * 2];
+
+    for (ULONG i = 0; i < 8; i++)
+    {
+        in[i] = 32767;
+        in[8 + i] = -32768;
+    }
+
+    // Float out, so nothing saturates on the way: every channel at full
+    // scale sums to full scale, not past it.
+    TEST_CHECK(mixer.Init(cache.Get(0, 8, 0, 2, 0), 16, FALSE, 32, TRUE));
+    mixer.Process((const BYTE *)in, (PBYTE)out, 2);
+
+    printf("full scale 7.1 -> stereo: %.6f %.6f, %.6f %.6f\n", out[0], out[1], out[2], out[3]);
+    TEST_CHECK(out[0] <= 1.0f && out[0] > 0.999f && out[1] <= 1.0f && out[1] > 0.999f);
+    TEST_CHECK(out[2] >= -1.0f && out[2] < -0.999f && out[3] >= -1.0f && out[3] < -0.999f);
+}
+
+//=============================================================================
+int main()
+{
+    TestFolds();
+    TestTwins();
+    TestCache();
+    TestKernels();
+    TestFullScale();
+
+    return TestResult("channelmatrix");
+}
@@ -0,0 +1,104 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    chorusbench.cpp
+
+Abstract:
+
+    CPU per stream of the chorus: CChorus::Process on 1 ms blocks at
+    48, 96, 192 and 384 kHz, 16-bit and float, stereo and 7.1, with the
+    chorus on and off (recording into the lines only), and the delay line
+    storage each takes.
+--*/
+
+#include "chorus.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define BENCH_AUDIO_SECONDS     4
+#define BENCH_BUFFER_BLOCKS     10      // A 10 ms DMA buffer, cycled.
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// Seconds to process one 1 ms block.
+//
+static double TimeBlocks(CChorus *pChorus, std::vector<BYTE> *pBuffer, ULONG ulBlockBytes, ULONG ulBlocks)
+{
+    double dStart = BenchSeconds();
+
+    for (ULONG b = 0; b < ulBlocks; b++)
+    {
+        pChorus->Process(&(*pBuffer)[(b % BENCH_BUFFER_BLOCKS) * ulBlockBytes], ulBlockBytes);
+    }
+    BenchKeep((*pBuffer)[0]);
+
+    return (BenchSeconds() - dStart) / ulBlocks;
+}
+
+//=============================================================================
+static VOID BenchFormat(ULONG ulSampleRate, ULONG ulBits, ULONG ulChannels, BOOL bFloat)
+{
+    ULONG               ulBlockFrames = ulSampleRate / 1000;
+    ULONG               ulBlockBytes = ulBlockFrames * ulChannels * ulBits / 8;
+    ULONG               ulBlocks = BENCH_AUDIO_SECONDS * 1000;
+    std::vector<BYTE>   buffer(ulBlockBytes * BENCH_BUFFER_BLOCKS);
+    std::vector<BYTE>   storage(CChorus::GetStorageBytes(ulSampleRate, ulChannels));
+    CChorus             chorus;
+    ULONG               ulState = 1;
+    double              dOn;
+    double              dOff;
+
+    // Quiet noise.
+    for (size_t i = 0; i < buffer.size(); i += ulBits / 8)
+    {
+        if (bFloat)
+        {
+            float fValue = (float)((LONG)(Random(&ulState) & 0xFFFF) - 0x8000) / 0x40000;
+            memcpy(&buffer[i], &fValue, sizeof(fValue));
+        }
+        else
+        {
+            SHORT sValue = (SHORT)((LONG)(Random(&ulState) & 0xFFFF) - 0x8000) / 8;
+            memcpy(&buffer[i], &sValue, sizeof(sValue));
+        }
+    }
+
+    chorus.Init(ulSampleRate, ulBits, ulChannels, bFloat, storage.data(), (ULONG)storage.size());
+
+    chorus.SetLevel(-6 * 65536);
+    TimeBlocks(&chorus, &buffer, ulBlockBytes, 100);
+    dOn = TimeBlocks(&chorus, &buffer, ulBlockBytes, ulBlocks);
+
+    chorus.SetLevel(CHORUS_LEVEL_OFF);
+    TimeBlocks(&chorus, &buffer, ulBlockBytes, 100);
+    dOff = TimeBlocks(&chorus, &buffer, ulBlockBytes, ulBlocks);
+
+    printf("%6u Hz %2u%-1s %u ch: %7.2f us per 1 ms block (%5.2f%% of real time), off %5.3f us, %4zu KB of lines\n",
+           ulSampleRate, ulBits, bFloat ? "f" : "", ulChannels,
+           dOn * 1e6, dOn * 1e5, dOff * 1e6, storage.size() / 1024);
+}
+
+//=============================================================================
+int main()
+{
+    static const ULONG rates[] = { 48000, 96000, 192000, 384000 };
+
+    for (ULONG r = 0; r < ARRAYSIZE(rates); r++)
+    {
+        BenchFormat(rates[r], 16, 2, FALSE);
+        BenchFormat(rates[r], 32, 2, TRUE);
+        BenchFormat(rates[r], 16, 8, FALSE);
+        BenchFormat(rates[r], 32, 8, TRUE);
+    }
+
+    return 0;
+}
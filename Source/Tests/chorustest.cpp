@@ -0,0 +1,321 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    chorustest.cpp
+
+Abstract:
+
+    CChorus against the same chorus in double precision: the sweep with
+    each channel's phase offset, exact fractional delays read with the
+    same Catmull-Rom interpolator, and the wet mix fading between levels,
+    on every format, several channel counts and two rates, fed in runs of
+    varying length while the level steps through on, off and back. Also
+    the LFO against sin(), and that off leaves the audio alone.
+--*/
+
+#include "chorus.h"
+#include "testutil.h"
+
+#include <math.h>
+
+#include <vector>
+
+#define TEST_PI             3.14159265358979323846
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CReferenceChorus
+//
+//   The chorus the header describes, in double. The sweep is the LFO's
+//   own, which TestSine holds to within 5e-6 of sin(): scaled by the 4 ms
+//   depth, even that much timing error would hold the comparison to
+//   75 dB at 8 kHz.
+//
+class CReferenceChorus
+{
+protected:
+    ULONG                               m_ulChannels;
+    ULONG                               m_ulWrite;
+    std::vector<std::vector<double>>    m_Lines;
+    double                              m_dPhase;           // Cycles.
+    double                              m_dPhaseIncrement;
+    double                              m_dDelay;           // Samples.
+    double                              m_dDepth;
+    double                              m_dMix;
+    double                              m_dMixStep;
+
+public:
+    CReferenceChorus(ULONG ulSampleRate, ULONG ulChannels) :
+        m_ulChannels(ulChannels),
+        m_ulWrite(0),
+        m_Lines(ulChannels, std::vector<double>(1 << 17)),
+        m_dPhase(0),
+        m_dPhaseIncrement(floor((CHORUS_RATE_MHZ * 4294967296.0 + 500.0 * ulSampleRate) / (1000.0 * ulSampleRate)) / 4294967296.0),
+        m_dDelay(CHORUS_DELAY_US * 1e-6 * ulSampleRate),
+        m_dDepth(CHORUS_DEPTH_US * 1e-6 * ulSampleRate),
+        m_dMix(0),
+        m_dMixStep(1 / (ulSampleRate * CHORUS_FADE_MS / 1000.0))
+    {
+    }
+
+    //
+    // ulFrames interleaved frames in place, moving the mix toward dMix.
+    //
+    VOID Process(double *pdFrames, ULONG ulFrames, double dMix)
+    {
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < m_ulChannels; c++)
+            {
+                double dDry = pdFrames[i * m_ulChannels + c];
+                ULONG ulPhase = (ULONG)(ULONGLONG)((m_dPhase + (double)c / m_ulChannels) * 4294967296.0);
+                double dDelay = m_dDelay + m_dDepth * ChorusSine(ulPhase) / 1073741824.0;
+
+                m_Lines[c][m_ulWrite] = dDry;
+                pdFrames[i * m_ulChannels + c] = dDry + (Read(c, dDelay) - dDry) * m_dMix;
+            }
+
+            m_dMix = (m_dMix < dMix) ? fmin(m_dMix + m_dMixStep, dMix) : fmax(m_dMix - m_dMixStep, dMix);
+            m_ulWrite = (m_ulWrite + 1) % m_Lines[0].size();
+            m_dPhase += m_dPhaseIncrement;
+            m_dPhase -= floor(m_dPhase);
+        }
+    }
+
+private:
+    double Sample(ULONG ulChannel, LONG lBack)
+    {
+        size_t ulLength = m_Lines[0].size();
+
+        return m_Lines[ulChannel][(m_ulWrite + ulLength - lBack) % ulLength];
+    }
+
+    //
+    // Catmull-Rom through the samples either side of dDelay samples ago.
+    //
+    double Read(ULONG ulChannel, double dDelay)
+    {
+        LONG    lBase = (LONG)floor(dDelay);
+        double  t = dDelay - lBase;
+        double  xm1 = Sample(ulChannel, lBase - 1);
+        double  x0 = Sample(ulChannel, lBase);
+        double  x1 = Sample(ulChannel, lBase + 1);
+        double  x2 = Sample(ulChannel, lBase + 2);
+
+        return x0 + 0.5 * t * ((x1 - xm1) + t * ((2 * xm1 - 5 * x0 + 4 * x1 - x2) + t * (3 * (x0 - x1) + x2 - xm1)));
+    }
+};
+
+//
+// Sample k of a buffer in a stream format, full scale 1.
+//
+static double GetSample(const std::vector<BYTE> &buffer, size_t k, ULONG ulBits, BOOL bFloat)
+{
+    ULONG ulBytes = ulBits / 8;
+    ULONG ulValue = 0;
+
+    for (ULONG b = 0; b < ulBytes; b++)
+    {
+        ulValue |= (ULONG)buffer[k * ulBytes + b] << (8 * b);
+    }
+
+    if (bFloat)
+    {
+        float fValue;
+
+        memcpy(&fValue, &ulValue, sizeof(fValue));
+        return fValue;
+    }
+
+    if (ulBits == 8)
+    {
+        return ((LONG)ulValue - 0x80) / 128.0;
+    }
+
+    return (LONG)(ulValue << (32 - ulBits)) / 2147483648.0;
+}
+
+static VOID PutSample(std::vector<BYTE> *pBuffer, size_t k, double dValue, ULONG ulBits, BOOL bFloat)
+{
+    ULONG ulBytes = ulBits / 8;
+    ULONG ulValue;
+
+    if (bFloat)
+    {
+        float fValue = (float)dValue;
+
+        memcpy(&ulValue, &fValue, sizeof(ulValue));
+    }
+    else
+    {
+        ulValue = (ULONG)(LONG)llround(dValue * ldexp(1.0, ulBits - 1)) + (ulBits == 8 ? 0x80 : 0);
+    }
+
+    for (ULONG b = 0; b < ulBytes; b++)
+    {
+        (*pBuffer)[k * ulBytes + b] = (BYTE)(ulValue >> (8 * b));
+    }
+}
+
+//=============================================================================
+// Tests
+//=============================================================================
+static VOID TestSine()
+{
+    double dWorst = 0;
+
+    for (ULONG k = 0; k <= CHORUS_SINE_ENTRIES; k++)
+    {
+        double dError = fabs(g_ChorusSine.Value[k] / 1073741824.0 - sin(2 * TEST_PI * k / CHORUS_SINE_ENTRIES));
+
+        dWorst = dError > dWorst ? dError : dWorst;
+    }
+
+    for (ULONGLONG ullPhase = 0; ullPhase < 0x100000000ULL; ullPhase += 12345)
+    {
+        double dError = fabs(ChorusSine((ULONG)ullPhase) / 1073741824.0 - sin(2 * TEST_PI * ullPhase / 4294967296.0));
+
+        dWorst = dError > dWorst ? dError : dWorst;
+    }
+
+    printf("LFO worst error against sin(): %.2e\n", dWorst);
+    TEST_CHECK(dWorst < 5e-6);
+}
+
+//=============================================================================
+static VOID TestReference()
+{
+    static const struct
+    {
+        ULONG   ulBits;
+        BOOL    bFloat;
+        double  dMinSnr;        // dB, set by the format's quantization and
+                                // beyond 16 bits by the delays' 1/65536.
+    } formats[] =
+    {
+        { 8,  FALSE, 38 },
+        { 16, FALSE, 87 },
+        { 24, FALSE, 110 },
+        { 32, FALSE, 110 },
+        { 32, TRUE,  110 },
+    };
+    static const ULONG rates[] = { 48000, 192000 };
+    static const ULONG channelCounts[] = { 1, 2, 6, 8 };
+
+    // dB for each stretch; -96 is off.
+    static const LONG levels[] = { 0, -6, -96, -3, -20, -96 };
+
+    for (ULONG f = 0; f < ARRAYSIZE(formats); f++)
+    {
+        for (ULONG r = 0; r < ARRAYSIZE(rates); r++)
+        {
+            for (ULONG n = 0; n < ARRAYSIZE(channelCounts); n++)
+            {
+                ULONG               ulBits = formats[f].ulBits;
+                BOOL                bFloat = formats[f].bFloat;
+                ULONG               ulChannels = channelCounts[n];
+                ULONG               ulRate = rates[r];
+                ULONG               ulFrames = ulRate * 3 / 2;
+                ULONG               ulFrameBytes = ulChannels * ulBits / 8;
+                std::vector<BYTE>   storage(CChorus::GetStorageBytes(ulRate, ulChannels));
+                std::vector<BYTE>   buffer((size_t)ulFrames * ulFrameBytes);
+                std::vector<double> reference((size_t)ulFrames * ulChannels);
+                CReferenceChorus    referenceChorus(ulRate, ulChannels);
+                CChorus             chorus;
+                ULONG               ulState = 7;
+                double              dSignal = 0;
+                double              dError = 0;
+
+                // A chord per channel, as the format carries it.
+                for (ULONG i = 0; i < ulFrames; i++)
+                {
+                    for (ULONG c = 0; c < ulChannels; c++)
+                    {
+                        size_t k = (size_t)i * ulChannels + c;
+                        double dValue = 0.3 * sin(2 * TEST_PI * (440 + 110 * c) * i / ulRate) +
+                                        0.2 * sin(2 * TEST_PI * (3000 + 700 * c) * i / ulRate);
+
+                        PutSample(&buffer, k, dValue, ulBits, bFloat);
+                        reference[k] = GetSample(buffer, k, ulBits, bFloat);
+                    }
+                }
+
+                TEST_CHECK(chorus.Init(ulRate, ulBits, ulChannels, bFloat, storage.data(), (ULONG)storage.size()));
+
+                // Runs of 1 to 15 ms; the level changes every 250 ms.
+                for (ULONG i = 0; i < ulFrames; )
+                {
+                    ULONG   ulRun = ulRate / 1000 * (1 + Random(&ulState) % 15) + Random(&ulState) % 7;
+                    LONG    lLevel = levels[(ULONGLONG)i * 4 / ulRate % ARRAYSIZE(levels)];
+
+                    ulRun = ulRun < ulFrames - i ? ulRun : ulFrames - i;
+                    chorus.SetLevel(lLevel * 65536);
+                    chorus.Process(&buffer[(size_t)i * ulFrameBytes], ulRun * ulFrameBytes);
+                    referenceChorus.Process(&reference[(size_t)i * ulChannels], ulRun,
+                                            lLevel <= -96 ? 0 : GainFromVolume(lLevel * 65536) / 1073741824.0);
+                    i += ulRun;
+                }
+
+                for (size_t k = 0; k < reference.size(); k++)
+                {
+                    double dValue = GetSample(buffer, k, ulBits, bFloat);
+
+                    dSignal += reference[k] * reference[k];
+                    dError += (dValue - reference[k]) * (dValue - reference[k]);
+                }
+
+                double dSnr = 10 * log10(dSignal / dError);
+
+                printf("%6u Hz %2u%-1s %u ch: %.1f dB SNR against double precision\n",
+                       ulRate, ulBits, bFloat ? "f" : "", ulChannels, dSnr);
+                TEST_CHECK(dSnr > formats[f].dMinSnr);
+            }
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestOff()
+{
+    std::vector<BYTE>   storage(CChorus::GetStorageBytes(48000, 2));
+    std::vector<SHORT>  samples(48000 * 2);
+    CChorus             chorus;
+    ULONG               ulState = 1;
+
+    for (ULONG i = 0; i < samples.size(); i++)
+    {
+        samples[i] = (SHORT)Random(&ulState);
+    }
+    std::vector<SHORT> input(samples);
+
+    TEST_CHECK(chorus.Init(48000, 16, 2, FALSE, storage.data(), (ULONG)storage.size()));
+    TEST_CHECK(chorus.IsIdle());
+    chorus.SetLevel(CHORUS_LEVEL_OFF);
+    chorus.Process((PBYTE)samples.data(), (ULONG)(samples.size() * sizeof(SHORT)));
+    TEST_CHECK(samples == input);
+
+    // Rates, channel counts and storage it does not take.
+    TEST_CHECK(CChorus::GetStorageBytes(CHORUS_MIN_SAMPLE_RATE - 1, 2) == 0);
+    TEST_CHECK(CChorus::GetStorageBytes(CHORUS_MAX_SAMPLE_RATE + 1, 2) == 0);
+    TEST_CHECK(CChorus::GetStorageBytes(48000, CHORUS_MAX_CHANNELS + 1) == 0);
+    TEST_CHECK(!chorus.Init(48000, 16, 2, FALSE, storage.data(), (ULONG)storage.size() - 1));
+    TEST_CHECK(!chorus.IsActive());
+}
+
+//=============================================================================
+int main()
+{
+    TestSine();
+    TestReference();
+    TestOff();
+
+    return TestResult("chorus");
+}
@@ -0,0 +1,178 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    endpointarenabench.cpp
+
+Abstract:
+
+    Cost of generating the endpoints at adapter start: CEndpointArena
+    copying the speaker and mic array templates into 1 to 64 pairs and
+    the install loop walking them, against the same descriptors and names
+    allocated one by one, and the bytes each pair count takes.
+--*/
+
+#include "endpointarena.h"
+#include "benchutil.h"
+
+#include <stdlib.h>
+
+#include <vector>
+
+#define BENCH_SECONDS           0.25    // Per pair count and method.
+
+//
+// ENDPOINT_MINIPAIR's layout, with the WDK types as the pointers they are.
+//
+typedef struct _BENCH_MINIPAIR
+{
+    ULONG       DeviceType;
+    PWSTR       TopoName;
+    PWSTR       TemplateTopoName;
+    PVOID       TopoCreateCallback;
+    PVOID       TopoDescriptor;
+    ULONG       TopoInterfacePropertyCount;
+    PVOID       TopoInterfaceProperties;
+    PWSTR       WaveName;
+    PWSTR       TemplateWaveName;
+    PVOID       WaveCreateCallback;
+    PVOID       WaveDescriptor;
+    ULONG       WaveInterfacePropertyCount;
+    PVOID       WaveInterfaceProperties;
+    USHORT      DeviceMaxChannels;
+    PVOID       PinDeviceFormatsAndModes;
+    ULONG       PinDeviceFormatsAndModesCount;
+    PVOID       PhysicalConnections;
+    ULONG       PhysicalConnectionCount;
+    ULONG       DeviceFlags;
+    ULONG       PairIndex;
+} BENCH_MINIPAIR;
+
+// WCHAR is char16_t on the host (see portable.h).
+static WCHAR g_szTopologySpeaker[] = u"TopologySpeaker";
+static WCHAR g_szWaveSpeaker[] = u"WaveSpeaker";
+static WCHAR g_szTopologyMicArray1[] = u"TopologyMicArray1";
+static WCHAR g_szWaveMicArray1[] = u"WaveMicArray1";
+
+// The templates the adapter passes, as in minipairs.h.
+static BENCH_MINIPAIR g_Speaker = { 0, g_szTopologySpeaker, NULL, NULL, NULL, 0, NULL, g_szWaveSpeaker, NULL, NULL, NULL, 0, NULL, 8 };
+static BENCH_MINIPAIR g_MicArray = { 1, g_szTopologyMicArray1, NULL, NULL, NULL, 0, NULL, g_szWaveMicArray1, NULL, NULL, NULL, 0, NULL, 2 };
+static BENCH_MINIPAIR * const g_Templates[] = { &g_Speaker, &g_MicArray };
+
+//
+// What an install pass reads of each endpoint.
+//
+static ULONG Install(const CEndpointArena<BENCH_MINIPAIR> &arena, ULONG ulPairs)
+{
+    ULONG ulSum = 0;
+
+    for (ULONG p = 0; p < ulPairs; p++)
+    {
+        for (ULONG t = 0; t < ARRAYSIZE(g_Templates); t++)
+        {
+            const BENCH_MINIPAIR * pEndpoint = arena.GetEndpoint(p, t);
+
+            ulSum += pEndpoint->TopoName[0] + pEndpoint->WaveName[0] + pEndpoint->PairIndex;
+        }
+    }
+
+    return ulSum;
+}
+
+//
+// Seconds to allocate, generate, install and free ulPairs pairs from one
+// block.
+//
+static double TimeArena(ULONG ulPairs, ULONG *pcbArena)
+{
+    ULONG   cbArena = CEndpointArena<BENCH_MINIPAIR>::GetDescriptorBytes(ARRAYSIZE(g_Templates), ulPairs) +
+                      CEndpointArena<BENCH_MINIPAIR>::Align(ulPairs * sizeof(PVOID));
+    ULONG   ulRuns = 0;
+    double  dStart = BenchSeconds();
+    double  dNow;
+
+    do
+    {
+        PVOID                           pStorage = calloc(1, cbArena);
+        CEndpointArena<BENCH_MINIPAIR>  arena;
+
+        arena.Init(pStorage, cbArena);
+        arena.Generate(g_Templates, ARRAYSIZE(g_Templates), ulPairs);
+        BenchKeep(arena.Allocate(ulPairs * sizeof(PVOID)));
+        BenchKeep(Install(arena, ulPairs));
+        free(pStorage);
+
+        ulRuns++;
+        dNow = BenchSeconds();
+    } while (dNow - dStart < BENCH_SECONDS);
+
+    *pcbArena = cbArena;
+
+    return (dNow - dStart) / ulRuns;
+}
+
+//
+// The same descriptors with every descriptor and name allocated on its
+// own. Only the first character of each name is written, so this leaves
+// out the renaming the arena does.
+//
+static double TimeSeparate(ULONG ulPairs)
+{
+    ULONG   ulEndpoints = ulPairs * ARRAYSIZE(g_Templates);
+    ULONG   ulRuns = 0;
+    double  dStart = BenchSeconds();
+    double  dNow;
+
+    do
+    {
+        std::vector<BENCH_MINIPAIR *> endpoints(ulEndpoints);
+        ULONG ulSum = 0;
+
+        for (ULONG e = 0; e < ulEndpoints; e++)
+        {
+            const BENCH_MINIPAIR * pTemplate = g_Templates[e % ARRAYSIZE(g_Templates)];
+
+            endpoints[e] = (BENCH_MINIPAIR *)calloc(1, sizeof(BENCH_MINIPAIR));
+            *endpoints[e] = *pTemplate;
+            endpoints[e]->PairIndex = e / ARRAYSIZE(g_Templates);
+            endpoints[e]->TopoName = (PWSTR)calloc(ENDPOINT_NAME_CHARS, sizeof(WCHAR));
+            endpoints[e]->WaveName = (PWSTR)calloc(ENDPOINT_NAME_CHARS, sizeof(WCHAR));
+            endpoints[e]->TopoName[0] = pTemplate->TopoName[0];
+            endpoints[e]->WaveName[0] = pTemplate->WaveName[0];
+        }
+
+        for (ULONG e = 0; e < ulEndpoints; e++)
+        {
+            ulSum += endpoints[e]->TopoName[0] + endpoints[e]->WaveName[0] + endpoints[e]->PairIndex;
+            free(endpoints[e]->TopoName);
+            free(endpoints[e]->WaveName);
+            free(endpoints[e]);
+        }
+        BenchKeep(ulSum);
+
+        ulRuns++;
+        dNow = BenchSeconds();
+    } while (dNow - dStart < BENCH_SECONDS);
+
+    return (dNow - dStart) / ulRuns;
+}
+
+//=============================================================================
+int main()
+{
+    static const ULONG pairCounts[] = { 1, 2, 8, 16, 64 };
+
+    for (ULONG n = 0; n < ARRAYSIZE(pairCounts); n++)
+    {
+        ULONG   cbArena;
+        double  dArena = TimeArena(pairCounts[n], &cbArena);
+
+        printf("%2u pairs: %7.2f us from one %6u byte block, %7.2f us allocated one by one (%u allocations)\n",
+               pairCounts[n], dArena * 1e6, cbArena, TimeSeparate(pairCounts[n]) * 1e6,
+               pairCounts[n] * (ULONG)ARRAYSIZE(g_Templates) * 3);
+    }
+
+    return 0;
+}
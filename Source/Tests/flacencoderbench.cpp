@@ -0,0 +1,147 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    flacencoderbench.cpp
+
+Abstract:
+
+    CFlacEncoder speed and compression on the capture formats, for a
+    music-like signal, white noise and silence, fed in the 64 KB writes the
+    save data writer thread makes.
+--*/
+
+#include "flacencoder.h"
+#include "benchutil.h"
+
+#include <math.h>
+
+#include <vector>
+
+#define BENCH_SECONDS       60
+#define BENCH_WRITE_BYTES   (64 * 1024)
+#define BENCH_PI            3.14159265358979323846
+
+enum
+{
+    eBenchMusic,
+    eBenchNoise,
+    eBenchSilence,
+};
+
+static const char * const g_signalNames[] = { "music", "noise", "silence" };
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// A few seconds of the signal, looped for the run.
+//
+static VOID MakeSignal(std::vector<BYTE> *pPcm, ULONG ulSignal, ULONG ulRate, ULONG ulChannels, ULONG ulBits)
+{
+    ULONG       ulSampleBytes = ulBits / 8;
+    ULONG       ulFrames = ulRate * 4;
+    ULONG       ulState = 1;
+    double      dFull = ldexp(1.0, ulBits - 1) - 1;
+
+    pPcm->resize((size_t)ulFrames * ulChannels * ulSampleBytes);
+
+    for (ULONG i = 0; i < ulFrames; i++)
+    {
+        double t = (double)i / ulRate;
+
+        for (ULONG c = 0; c < ulChannels; c++)
+        {
+            double  dValue = 0;
+            ULONG   ulValue;
+
+            if (ulSignal == eBenchMusic)
+            {
+                // Chord with a slow tremolo and a little hiss.
+                dValue = (0.2 * sin(2 * BENCH_PI * 220 * t) + 0.15 * sin(2 * BENCH_PI * 277.2 * t + c) +
+                          0.1 * sin(2 * BENCH_PI * 329.6 * t)) * (0.6 + 0.4 * sin(2 * BENCH_PI * 0.5 * t)) +
+                         0.002 * ((double)(Random(&ulState) & 0xFFFF) / 0x8000 - 1);
+            }
+            else if (ulSignal == eBenchNoise)
+            {
+                dValue = (double)(Random(&ulState) & 0xFFFFFF) / 0x800000 - 1;
+            }
+
+            ulValue = (ULONG)(LONG)llround(dValue * dFull) + (ulBits == 8 ? 0x80 : 0);
+            for (ULONG b = 0; b < ulSampleBytes; b++)
+            {
+                (*pPcm)[((size_t)i * ulChannels + c) * ulSampleBytes + b] = (BYTE)(ulValue >> (8 * b));
+            }
+        }
+    }
+}
+
+//=============================================================================
+static VOID BenchFormat(ULONG ulRate, ULONG ulChannels, ULONG ulBits, ULONG ulSignal)
+{
+    std::vector<BYTE>       pcm;
+    std::vector<ULONGLONG>  workspace(CFlacEncoder::GetWorkspaceBytes(ulChannels, ulBits, FLAC_DEFAULT_BLOCK_FRAMES) / 8 + 1);
+    CFlacEncoder            encoder;
+    ULONGLONG               cbIn = (ULONGLONG)ulRate * ulChannels * (ulBits / 8) * BENCH_SECONDS;
+    ULONGLONG               cbOut = 0;
+    size_t                  cbPosition = 0;
+    double                  dStart;
+    double                  dSeconds;
+
+    MakeSignal(&pcm, ulSignal, ulRate, ulChannels, ulBits);
+    encoder.Init(ulRate, ulChannels, ulBits, FLAC_DEFAULT_BLOCK_FRAMES,
+                 workspace.data(), (ULONG)(workspace.size() * sizeof(ULONGLONG)));
+
+    dStart = BenchSeconds();
+    for (ULONGLONG cbDone = 0; cbDone < cbIn; )
+    {
+        ULONG cbWrite = (ULONG)(pcm.size() - cbPosition);
+
+        cbWrite = (cbWrite < BENCH_WRITE_BYTES) ? cbWrite : BENCH_WRITE_BYTES;
+        for (ULONG cbUsed = 0; cbUsed < cbWrite; )
+        {
+            cbUsed += encoder.AddData(&pcm[cbPosition + cbUsed], cbWrite - cbUsed);
+            if (encoder.IsBlockFull())
+            {
+                const BYTE * pFrame;
+                cbOut += encoder.EncodeBlock(&pFrame);
+                BenchKeep(pFrame[0]);
+            }
+        }
+
+        cbDone += cbWrite;
+        cbPosition = (cbPosition + cbWrite) % pcm.size();
+    }
+    dSeconds = BenchSeconds() - dStart;
+
+    printf("%6u Hz %u ch %2u-bit %-7s: %7.1f MB/s in, %6.0fx real time, %.3f of the input size\n",
+           ulRate, ulChannels, ulBits, g_signalNames[ulSignal],
+           cbIn / dSeconds / 1e6, BENCH_SECONDS / dSeconds, (double)cbOut / cbIn);
+}
+
+//=============================================================================
+int main()
+{
+    static const ULONG formats[][3] =
+    {
+        { 44100,  2, 16 },
+        { 48000,  2, 24 },
+        { 48000,  8, 24 },
+        { 192000, 2, 32 },
+    };
+
+    for (ULONG f = 0; f < ARRAYSIZE(formats); f++)
+    {
+        for (ULONG s = eBenchMusic; s <= eBenchSilence; s++)
+        {
+            BenchFormat(formats[f][0], formats[f][1], formats[f][2], s);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,783 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    flacencodertest.cpp
+
+Abstract:
+
+    CFlacEncoder round trips: known signals are encoded, fed in chunks that
+    split frames, and decoded again by a decoder written here from the FLAC
+    format specification. The decoded samples must equal the input bit for
+    bit, every frame's CRC-8, CRC-16, number, block size, sample rate and
+    sample size must check out, and STREAMINFO must carry the format, the
+    total length and the smallest and largest frame actually written.
+    Block sizes, sample rates and frame counts are chosen to reach every
+    frame header encoding the encoder uses.
+--*/
+
+#include "flacencoder.h"
+#include "testutil.h"
+
+#include <math.h>
+
+#include <vector>
+
+#define TEST_PI     3.14159265358979323846
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//=============================================================================
+// Decoder
+//=============================================================================
+
+//
+// MSB-first bit reader; reading past the end yields zeros and sets
+// m_bOverrun.
+//
+class CTestBitReader
+{
+public:
+    const BYTE *    m_pData;
+    size_t          m_cbData;
+    ULONGLONG       m_ullBit;
+    BOOL            m_bOverrun;
+
+    CTestBitReader(const BYTE *pData, size_t cbData) :
+        m_pData(pData),
+        m_cbData(cbData),
+        m_ullBit(0),
+        m_bOverrun(FALSE)
+    {
+    }
+
+    ULONG Get(ULONG ulBits)
+    {
+        ULONG ulValue = 0;
+
+        for (ULONG i = 0; i < ulBits; i++)
+        {
+            if ((m_ullBit >> 3) >= m_cbData)
+            {
+                m_bOverrun = TRUE;
+                return 0;
+            }
+            ulValue = (ulValue << 1) | ((m_pData[m_ullBit >> 3] >> (7 - (m_ullBit & 7))) & 1);
+            m_ullBit++;
+        }
+
+        return ulValue;
+    }
+
+    LONG GetSigned(ULONG ulBits)
+    {
+        ULONG ulValue = Get(ulBits);
+
+        if (ulBits > 0 && ulBits < 32 && (ulValue >> (ulBits - 1)))
+        {
+            ulValue |= ~0UL << ulBits;
+        }
+
+        return (LONG)ulValue;
+    }
+
+    ULONGLONG GetUnary()
+    {
+        ULONGLONG ullZeros = 0;
+
+        while (Get(1) == 0 && !m_bOverrun)
+        {
+            ullZeros++;
+        }
+
+        return ullZeros;
+    }
+
+    VOID Align()
+    {
+        m_ullBit = (m_ullBit + 7) & ~7ULL;
+    }
+
+    size_t GetByte() const
+    {
+        return (size_t)(m_ullBit >> 3);
+    }
+};
+
+static BYTE TestCrc8(const BYTE *pData, size_t cbData)
+{
+    ULONG ulCrc = 0;
+
+    for (size_t i = 0; i < cbData; i++)
+    {
+        ulCrc ^= pData[i];
+        for (ULONG j = 0; j < 8; j++)
+        {
+            ulCrc = ((ulCrc & 0x80) ? ((ulCrc << 1) ^ 0x07) : (ulCrc << 1)) & 0xFF;
+        }
+    }
+
+    return (BYTE)ulCrc;
+}
+
+static USHORT TestCrc16(const BYTE *pData, size_t cbData)
+{
+    ULONG ulCrc = 0;
+
+    for (size_t i = 0; i < cbData; i++)
+    {
+        ulCrc ^= (ULONG)pData[i] << 8;
+        for (ULONG j = 0; j < 8; j++)
+        {
+            ulCrc = ((ulCrc & 0x8000) ? ((ulCrc << 1) ^ 0x8005) : (ulCrc << 1)) & 0xFFFF;
+        }
+    }
+
+    return (USHORT)ulCrc;
+}
+
+typedef struct _TEST_FLAC_STREAM
+{
+    // STREAMINFO.
+    ULONG                   ulMinBlockFrames;
+    ULONG                   ulMaxBlockFrames;
+    ULONG                   ulMinFrameBytes;
+    ULONG                   ulMaxFrameBytes;
+    ULONG                   ulSampleRate;
+    ULONG                   ulChannels;
+    ULONG                   ulBitsPerSample;
+    ULONGLONG               ullTotalFrames;
+    BOOL                    bMd5Set;
+
+    // What the frames held.
+    std::vector<LONG>       samples;            // Interleaved.
+    ULONG                   ulFlacFrames;
+    ULONG                   ulSmallestFrameBytes;
+    ULONG                   ulLargestFrameBytes;
+    ULONG                   ulConstant;
+    ULONG                   ulVerbatim;
+    ULONG                   ulFixed[FLAC_MAX_FIXED_ORDER + 1];
+    ULONG                   ulWasted;
+    ULONG                   ulRice2;
+} TEST_FLAC_STREAM;
+
+//
+// The subset of FLAC this encoder writes: one STREAMINFO block and fixed
+// block size frames of independent channels coded CONSTANT, VERBATIM or
+// FIXED with Rice or Rice2 residuals. Anything else is reported as an
+// error, as is any inconsistency. Returns NULL on success.
+//
+static const char * TestFlacDecode(const BYTE *pData, size_t cbData, TEST_FLAC_STREAM *pStream)
+{
+    static const ULONG rates[] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+    static const ULONG sizes[] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+
+    *pStream = TEST_FLAC_STREAM();
+
+    if (cbData < FLAC_STREAM_HEADER_BYTES || memcmp(pData, "fLaC", 4) != 0)
+    {
+        return "no fLaC marker";
+    }
+
+    CTestBitReader header(pData + 4, cbData - 4);
+
+    if (header.Get(1) != 1 || header.Get(7) != 0 || header.Get(24) != 34)
+    {
+        return "STREAMINFO is not the only metadata block";
+    }
+
+    pStream->ulMinBlockFrames = header.Get(16);
+    pStream->ulMaxBlockFrames = header.Get(16);
+    pStream->ulMinFrameBytes = header.Get(24);
+    pStream->ulMaxFrameBytes = header.Get(24);
+    pStream->ulSampleRate = header.Get(20);
+    pStream->ulChannels = header.Get(3) + 1;
+    pStream->ulBitsPerSample = header.Get(5) + 1;
+    pStream->ullTotalFrames = (ULONGLONG)header.Get(4) << 32;
+    pStream->ullTotalFrames |= header.Get(32);
+    for (ULONG i = 0; i < 4; i++)
+    {
+        pStream->bMd5Set |= (header.Get(32) != 0);
+    }
+
+    if (pStream->ulMinBlockFrames != pStream->ulMaxBlockFrames || pStream->ulMinBlockFrames < 16)
+    {
+        return "STREAMINFO block sizes are not fixed";
+    }
+
+    ULONG                   ulChannels = pStream->ulChannels;
+    ULONG                   ulBlockFrames = pStream->ulMaxBlockFrames;
+    std::vector<LONG>       channel(ulBlockFrames);
+    std::vector<LONG>       residual(ulBlockFrames);
+    BOOL                    bLastBlock = FALSE;
+    size_t                  cbOffset = FLAC_STREAM_HEADER_BYTES;
+
+    while (cbOffset < cbData)
+    {
+        CTestBitReader  br(pData + cbOffset, cbData - cbOffset);
+        ULONG           ulFrames;
+        ULONG           ulRate;
+        ULONG           ulBits;
+
+        if (bLastBlock)
+        {
+            return "short block before the last";
+        }
+
+        if (br.Get(14) != 0x3FFE || br.Get(1) != 0 || br.Get(1) != 0)
+        {
+            return "bad frame sync";
+        }
+
+        ULONG ulBlockCode = br.Get(4);
+        ULONG ulRateCode = br.Get(4);
+        ULONG ulAssignment = br.Get(4);
+        ULONG ulSizeCode = br.Get(3);
+
+        if (br.Get(1) != 0 || ulBlockCode == 0 || ulRateCode == 15 || ulSizeCode == 3)
+        {
+            return "reserved frame header value";
+        }
+        if (ulAssignment >= 8 || ulAssignment + 1 != ulChannels)
+        {
+            return "frame channel assignment";
+        }
+
+        // Frame number, coded like UTF-8.
+        ULONG ulLead = br.Get(8);
+        ULONG ulFollow = 0;
+        while (ulFollow < 7 && (ulLead & (0x80 >> ulFollow)))
+        {
+            ulFollow++;
+        }
+        if (ulFollow == 1 || ulFollow > 6)
+        {
+            return "bad frame number lead byte";
+        }
+        ULONG ulNumber = ulLead & (0x7F >> ulFollow);
+        for (ULONG i = 1; i < ulFollow; i++)
+        {
+            ULONG ulByte = br.Get(8);
+            if ((ulByte & 0xC0) != 0x80)
+            {
+                return "bad frame number continuation byte";
+            }
+            ulNumber = (ulNumber << 6) | (ulByte & 0x3F);
+        }
+        if (ulNumber != pStream->ulFlacFrames)
+        {
+            return "frame number out of sequence";
+        }
+
+        if (ulBlockCode == 1)
+        {
+            ulFrames = 192;
+        }
+        else if (ulBlockCode <= 5)
+        {
+            ulFrames = 576UL << (ulBlockCode - 2);
+        }
+        else if (ulBlockCode == 6)
+        {
+            ulFrames = br.Get(8) + 1;
+        }
+        else if (ulBlockCode == 7)
+        {
+            ulFrames = br.Get(16) + 1;
+        }
+        else
+        {
+            ulFrames = 256UL << (ulBlockCode - 8);
+        }
+
+        if (ulRateCode == 12)
+        {
+            ulRate = br.Get(8) * 1000;
+        }
+        else if (ulRateCode == 13)
+        {
+            ulRate = br.Get(16);
+        }
+        else if (ulRateCode == 14)
+        {
+            ulRate = br.Get(16) * 10;
+        }
+        else
+        {
+            ulRate = (ulRateCode == 0) ? pStream->ulSampleRate : rates[ulRateCode];
+        }
+
+        ulBits = (ulSizeCode == 0) ? pStream->ulBitsPerSample : sizes[ulSizeCode];
+
+        if (br.Get(8) != TestCrc8(pData + cbOffset, br.GetByte() - 1))
+        {
+            return "frame header CRC-8";
+        }
+        if (ulRate != pStream->ulSampleRate || ulBits != pStream->ulBitsPerSample)
+        {
+            return "frame rate or sample size differs from STREAMINFO";
+        }
+        if (ulFrames > ulBlockFrames)
+        {
+            return "frame larger than the STREAMINFO block size";
+        }
+        bLastBlock = (ulFrames < ulBlockFrames);
+
+        size_t ulFirst = pStream->samples.size();
+        pStream->samples.resize(ulFirst + (size_t)ulFrames * ulChannels);
+
+        for (ULONG c = 0; c < ulChannels; c++)
+        {
+            ULONG   ulWasted = 0;
+            ULONG   ulType;
+
+            if (br.Get(1) != 0)
+            {
+                return "subframe padding bit";
+            }
+            ulType = br.Get(6);
+            if (br.Get(1))
+            {
+                ulWasted = (ULONG)br.GetUnary() + 1;
+                pStream->ulWasted++;
+            }
+            if (ulWasted >= ulBits)
+            {
+                return "wasted bits cover the whole sample";
+            }
+
+            ULONG ulCodedBits = ulBits - ulWasted;
+
+            if (ulType == 0)
+            {
+                LONG lValue = br.GetSigned(ulCodedBits);
+                for (ULONG i = 0; i < ulFrames; i++)
+                {
+                    channel[i] = lValue;
+                }
+                pStream->ulConstant++;
+            }
+            else if (ulType == 1)
+            {
+                for (ULONG i = 0; i < ulFrames; i++)
+                {
+                    channel[i] = br.GetSigned(ulCodedBits);
+                }
+                pStream->ulVerbatim++;
+            }
+            else if (ulType >= 8 && ulType <= 8 + FLAC_MAX_FIXED_ORDER)
+            {
+                static const LONG coefficients[FLAC_MAX_FIXED_ORDER + 1][FLAC_MAX_FIXED_ORDER] =
+                {
+                    { 0 }, { 1 }, { 2, -1 }, { 3, -3, 1 }, { 4, -6, 4, -1 },
+                };
+                ULONG ulOrder = ulType - 8;
+
+                if (ulOrder > ulFrames)
+                {
+                    return "predictor order exceeds the block";
+                }
+                for (ULONG i = 0; i < ulOrder; i++)
+                {
+                    channel[i] = br.GetSigned(ulCodedBits);
+                }
+
+                // Residual: Rice partitions, with escapes.
+                ULONG ulMethod = br.Get(2);
+                if (ulMethod > 1)
+                {
+                    return "reserved residual coding method";
+                }
+                pStream->ulRice2 += ulMethod;
+
+                ULONG ulParameterBits = 4 + ulMethod;
+                ULONG ulEscape = (1UL << ulParameterBits) - 1;
+                ULONG ulPartitionOrder = br.Get(4);
+                ULONG ulPartitionFrames = ulFrames >> ulPartitionOrder;
+                ULONG ulResidual = 0;
+
+                if ((ulPartitionFrames << ulPartitionOrder) != ulFrames || ulPartitionFrames < ulOrder)
+                {
+                    return "partition order does not fit the block";
+                }
+
+                for (ULONG p = 0; p < (1UL << ulPartitionOrder); p++)
+                {
+                    ULONG ulCount = (p == 0) ? ulPartitionFrames - ulOrder : ulPartitionFrames;
+                    ULONG k = br.Get(ulParameterBits);
+
+                    if (k == ulEscape)
+                    {
+                        ULONG ulRawBits = br.Get(5);
+                        for (ULONG i = 0; i < ulCount; i++)
+                        {
+                            residual[ulResidual++] = ulRawBits ? br.GetSigned(ulRawBits) : 0;
+                        }
+                        continue;
+                    }
+
+                    for (ULONG i = 0; i < ulCount; i++)
+                    {
+                        ULONGLONG ullValue = (br.GetUnary() << k) | br.Get(k);
+                        if (ullValue > 0xFFFFFFFF)
+                        {
+                            return "residual does not fit 32 bits";
+                        }
+                        residual[ulResidual++] = (LONG)((ULONG)(ullValue >> 1) ^ (0 - (ULONG)(ullValue & 1)));
+                    }
+                }
+
+                for (ULONG i = ulOrder; i < ulFrames; i++)
+                {
+                    LONGLONG llValue = residual[i - ulOrder];
+                    for (ULONG j = 0; j < ulOrder; j++)
+                    {
+                        llValue += (LONGLONG)coefficients[ulOrder][j] * channel[i - 1 - j];
+                    }
+                    if (llValue < -(1LL << (ulCodedBits - 1)) || llValue >= (1LL << (ulCodedBits - 1)))
+                    {
+                        return "predicted sample out of range";
+                    }
+                    channel[i] = (LONG)llValue;
+                }
+                pStream->ulFixed[ulOrder]++;
+            }
+            else
+            {
+                return "subframe type this encoder does not write";
+            }
+
+            for (ULONG i = 0; i < ulFrames; i++)
+            {
+                pStream->samples[ulFirst + (size_t)i * ulChannels + c] = (LONG)((ULONG)channel[i] << ulWasted);
+            }
+        }
+
+        br.Align();
+        size_t cbFrame = br.GetByte();
+        if (br.Get(16) != TestCrc16(pData + cbOffset, cbFrame))
+        {
+            return "frame CRC-16";
+        }
+        if (br.m_bOverrun)
+        {
+            return "frame runs past the end of the stream";
+        }
+        cbFrame += 2;
+
+        if (pStream->ulFlacFrames == 0 || cbFrame < pStream->ulSmallestFrameBytes)
+        {
+            pStream->ulSmallestFrameBytes = (ULONG)cbFrame;
+        }
+        if (cbFrame > pStream->ulLargestFrameBytes)
+        {
+            pStream->ulLargestFrameBytes = (ULONG)cbFrame;
+        }
+        pStream->ulFlacFrames++;
+        cbOffset += cbFrame;
+    }
+
+    return NULL;
+}
+
+//=============================================================================
+// Round trips
+//=============================================================================
+
+//
+// Each block of each channel carries one kind of signal, in rotation, so
+// every stream holds a mix of predictable, unpredictable, constant and
+// wasted-bits blocks.
+//
+enum
+{
+    eSignalSine,            // Fixed predictor.
+    eSignalNoise,           // Full scale, with extremes; verbatim.
+    eSignalConstant,
+    eSignalCoarseSine,      // Low bits always zero.
+    eSignalKinds
+};
+
+static LONG MakeSample(ULONG ulKind, ULONGLONG ullFrame, ULONG c, ULONG ulBits, ULONG *pulState)
+{
+    LONGLONG    llFull = 1LL << (ulBits - 1);
+    double      dPhase = 2 * TEST_PI * (ullFrame % 4800) * (100 + 37 * c) / 48000.0;
+    LONGLONG    llValue;
+
+    switch (ulKind)
+    {
+        case eSignalSine:
+            llValue = llround(0.5 * llFull * sin(dPhase)) + (LONG)(Random(pulState) % 5) - 2;
+            break;
+        case eSignalNoise:
+            if (ullFrame % 97 == 0)
+            {
+                llValue = (ullFrame & 1) ? llFull - 1 : -llFull;
+            }
+            else
+            {
+                llValue = (LONGLONG)(((ULONGLONG)Random(pulState) << 40 | (ULONGLONG)Random(pulState) << 16) >> (64 - ulBits)) - llFull;
+            }
+            break;
+        case eSignalConstant:
+            llValue = (c & 1) ? -llFull / 3 : llFull / 5;
+            break;
+        default:
+            llValue = llround(0.7 * llFull * sin(dPhase)) & ~((1LL << (ulBits / 4)) - 1);
+            break;
+    }
+
+    return (LONG)llValue;
+}
+
+typedef struct _ROUND_TRIP_CASE
+{
+    ULONG       ulSampleRate;
+    ULONG       ulChannels;
+    ULONG       ulBitsPerSample;
+    ULONG       ulBlockFrames;
+    ULONG       ulFrames;
+} ROUND_TRIP_CASE;
+
+//=============================================================================
+static VOID RoundTrip(const ROUND_TRIP_CASE *pCase, TEST_FLAC_STREAM *pTotals)
+{
+    ULONG                   ulChannels = pCase->ulChannels;
+    ULONG                   ulBits = pCase->ulBitsPerSample;
+    ULONG                   ulSampleBytes = ulBits / 8;
+    ULONG                   ulState = pCase->ulSampleRate ^ ulChannels;
+    std::vector<LONG>       samples((size_t)pCase->ulFrames * ulChannels);
+    std::vector<BYTE>       pcm(samples.size() * ulSampleBytes);
+    std::vector<ULONGLONG>  workspace(CFlacEncoder::GetWorkspaceBytes(ulChannels, ulBits, pCase->ulBlockFrames) / 8 + 1);
+    std::vector<BYTE>       stream(FLAC_STREAM_HEADER_BYTES);
+    CFlacEncoder            encoder;
+    ULONG                   cbMaxFrame = CFlacEncoder::GetMaxFrameBytes(ulChannels, ulBits, pCase->ulBlockFrames);
+    BOOL                    bFrameTooLarge = FALSE;
+    TEST_FLAC_STREAM        decoded;
+    const char *            pszError;
+
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        ULONGLONG   ullFrame = i / ulChannels;
+        ULONG       c = (ULONG)(i % ulChannels);
+        ULONG       ulKind = (ULONG)((ullFrame / pCase->ulBlockFrames + c) % eSignalKinds);
+        ULONG       ulValue;
+
+        samples[i] = MakeSample(ulKind, ullFrame, c, ulBits, &ulState);
+
+        // Little-endian, 8-bit unsigned.
+        ulValue = (ULONG)samples[i] + (ulBits == 8 ? 0x80 : 0);
+        for (ULONG b = 0; b < ulSampleBytes; b++)
+        {
+            pcm[i * ulSampleBytes + b] = (BYTE)(ulValue >> (8 * b));
+        }
+    }
+
+    TEST_CHECK(encoder.Init(pCase->ulSampleRate, ulChannels, ulBits, pCase->ulBlockFrames,
+                            workspace.data(), (ULONG)(workspace.size() * sizeof(ULONGLONG))));
+    encoder.GetStreamHeader(stream.data());
+
+    // Chunks of random size, so frames are split across AddData calls.
+    for (size_t cbDone = 0; cbDone < pcm.size(); )
+    {
+        ULONG cbChunk = 1 + Random(&ulState) % 9000;
+
+        cbChunk = (ULONG)((cbChunk < pcm.size() - cbDone) ? cbChunk : pcm.size() - cbDone);
+        while (cbChunk > 0)
+        {
+            ULONG cbUsed = encoder.AddData(&pcm[cbDone], cbChunk);
+
+            cbDone += cbUsed;
+            cbChunk -= cbUsed;
+            if (encoder.IsBlockFull())
+            {
+                const BYTE *    pFrame;
+                ULONG           cbFrame = encoder.EncodeBlock(&pFrame);
+
+                bFrameTooLarge |= (cbFrame > cbMaxFrame);
+                stream.insert(stream.end(), pFrame, pFrame + cbFrame);
+            }
+        }
+    }
+
+    {
+        const BYTE *    pFrame;
+        ULONG           cbFrame = encoder.EncodeBlock(&pFrame);
+
+        bFrameTooLarge |= (cbFrame > cbMaxFrame);
+        stream.insert(stream.end(), pFrame, pFrame + cbFrame);
+    }
+    TEST_CHECK(!bFrameTooLarge);
+    TEST_CHECK(encoder.GetPendingBytes() == 0);
+    TEST_CHECK(encoder.GetTotalFrames() == pCase->ulFrames);
+
+    // The header written at the start carries no length yet.
+    pszError = TestFlacDecode(stream.data(), FLAC_STREAM_HEADER_BYTES, &decoded);
+    TEST_CHECK(pszError == NULL);
+    TEST_CHECK(decoded.ullTotalFrames == 0 && decoded.ulMinFrameBytes == 0 && decoded.ulMaxFrameBytes == 0);
+
+    encoder.GetStreamHeader(stream.data());
+    pszError = TestFlacDecode(stream.data(), stream.size(), &decoded);
+
+    printf("%6u Hz, %u ch, %2u-bit, %5u frame blocks: %u FLAC frames, %.3f of the input size%s%s\n",
+           pCase->ulSampleRate, ulChannels, ulBits, pCase->ulBlockFrames, decoded.ulFlacFrames,
+           (double)stream.size() / pcm.size(), pszError ? ", decode failed: " : "", pszError ? pszError : "");
+    TEST_CHECK(pszError == NULL);
+    if (pszError != NULL)
+    {
+        return;
+    }
+
+    TEST_CHECK(decoded.ulSampleRate == pCase->ulSampleRate);
+    TEST_CHECK(decoded.ulChannels == ulChannels);
+    TEST_CHECK(decoded.ulBitsPerSample == ulBits);
+    TEST_CHECK(decoded.ulMinBlockFrames == pCase->ulBlockFrames);
+    TEST_CHECK(decoded.ullTotalFrames == pCase->ulFrames);
+    TEST_CHECK(decoded.ulMinFrameBytes == decoded.ulSmallestFrameBytes);
+    TEST_CHECK(decoded.ulMaxFrameBytes == decoded.ulLargestFrameBytes);
+    TEST_CHECK(!decoded.bMd5Set);
+    TEST_CHECK(decoded.samples == samples);
+
+    pTotals->ulConstant += decoded.ulConstant;
+    pTotals->ulVerbatim += decoded.ulVerbatim;
+    pTotals->ulWasted += decoded.ulWasted;
+    pTotals->ulRice2 += decoded.ulRice2;
+    for (ULONG k = 0; k <= FLAC_MAX_FIXED_ORDER; k++)
+    {
+        pTotals->ulFixed[k] += decoded.ulFixed[k];
+    }
+}
+
+//=============================================================================
+static VOID TestRoundTrip()
+{
+    static const ROUND_TRIP_CASE cases[] =
+    {
+        // Common block size code, table rate, final partial block.
+        { 44100,  2, 16, FLAC_DEFAULT_BLOCK_FRAMES, 5 * FLAC_DEFAULT_BLOCK_FRAMES + 123 },
+        { 48000,  8, 24, FLAC_DEFAULT_BLOCK_FRAMES, 4 * FLAC_DEFAULT_BLOCK_FRAMES },
+        { 96000,  2, 24, 256,                       40 * 256 + 17 },
+        // 8-bit block size field; 8-bit samples.
+        { 8000,   1, 8,  192,                       300 * 192 + 1 },
+        // 16-bit block size field, rate in tens of Hz.
+        { 384000, 6, 32, 1000,                      20 * 1000 + 999 },
+        // Rate in Hz; three-byte frame numbers at the smallest block size.
+        { 44056,  3, 16, FLAC_MIN_BLOCK_FRAMES,     2500 * FLAC_MIN_BLOCK_FRAMES + 5 },
+        // Four-byte frame numbers; rate in kHz.
+        { 12000,  1, 8,  FLAC_MIN_BLOCK_FRAMES,     70000 * FLAC_MIN_BLOCK_FRAMES },
+        // Rate only in STREAMINFO; the largest block.
+        { 705600, 2, 32, FLAC_MAX_BLOCK_FRAMES,     2 * FLAC_MAX_BLOCK_FRAMES + 1 },
+    };
+    TEST_FLAC_STREAM totals = TEST_FLAC_STREAM();
+
+    for (ULONG i = 0; i < ARRAYSIZE(cases); i++)
+    {
+        RoundTrip(&cases[i], &totals);
+    }
+
+    printf("subframes: %u constant, %u verbatim, fixed orders %u/%u/%u/%u/%u, %u with wasted bits, %u Rice2\n",
+           totals.ulConstant, totals.ulVerbatim, totals.ulFixed[0], totals.ulFixed[1], totals.ulFixed[2],
+           totals.ulFixed[3], totals.ulFixed[4], totals.ulWasted, totals.ulRice2);
+
+    // Every subframe coding the encoder has was exercised.
+    TEST_CHECK(totals.ulConstant > 0);
+    TEST_CHECK(totals.ulVerbatim > 0);
+    TEST_CHECK(totals.ulWasted > 0);
+    TEST_CHECK(totals.ulRice2 > 0);
+    TEST_CHECK(totals.ulFixed[0] + totals.ulFixed[1] + totals.ulFixed[2] + totals.ulFixed[3] + totals.ulFixed[4] > 0);
+}
+
+//=============================================================================
+static VOID TestRestartStream()
+{
+    std::vector<ULONGLONG>  workspace(CFlacEncoder::GetWorkspaceBytes(2, 16, 64) / 8 + 1);
+    std::vector<BYTE>       pcm(64 * 4 * 3);
+    std::vector<BYTE>       stream(FLAC_STREAM_HEADER_BYTES);
+    CFlacEncoder            encoder;
+    const BYTE *            pFrame;
+    TEST_FLAC_STREAM        decoded;
+    ULONG                   ulState = 3;
+
+    for (size_t i = 0; i < pcm.size(); i++)
+    {
+        pcm[i] = (BYTE)Random(&ulState);
+    }
+
+    TEST_CHECK(encoder.Init(48000, 2, 16, 64, workspace.data(), (ULONG)(workspace.size() * sizeof(ULONGLONG))));
+    TEST_CHECK(encoder.AddData(pcm.data(), (ULONG)pcm.size()) == 64 * 4);
+    TEST_CHECK(encoder.EncodeBlock(&pFrame) > 0);
+
+    // The next file starts at frame 0 with a fresh length; the encoder keeps
+    // the format.
+    encoder.RestartStream();
+    TEST_CHECK(encoder.GetTotalFrames() == 0);
+    for (ULONG cbDone = 64 * 4; cbDone < pcm.size(); )
+    {
+        ULONG   cbUsed = encoder.AddData(&pcm[cbDone], (ULONG)pcm.size() - cbDone);
+        ULONG   cbFrame = encoder.EncodeBlock(&pFrame);
+
+        stream.insert(stream.end(), pFrame, pFrame + cbFrame);
+        cbDone += cbUsed;
+    }
+    encoder.GetStreamHeader(stream.data());
+
+    TEST_CHECK(TestFlacDecode(stream.data(), stream.size(), &decoded) == NULL);
+    TEST_CHECK(decoded.ulFlacFrames == 2);
+    TEST_CHECK(decoded.ullTotalFrames == 128);
+    TEST_CHECK(decoded.samples.size() == 256);
+    TEST_CHECK(decoded.samples.size() == 256 && decoded.samples[0] == (SHORT)(pcm[256] | (pcm[257] << 8)));
+}
+
+//=============================================================================
+static VOID TestDecoderRejects()
+{
+    std::vector<ULONGLONG>  workspace(CFlacEncoder::GetWorkspaceBytes(1, 16, 256) / 8 + 1);
+    std::vector<BYTE>       pcm(256 * 2);
+    std::vector<BYTE>       stream(FLAC_STREAM_HEADER_BYTES);
+    CFlacEncoder            encoder;
+    const BYTE *            pFrame;
+    TEST_FLAC_STREAM        decoded;
+    ULONG                   ulState = 4;
+
+    for (size_t i = 0; i < pcm.size(); i += 2)
+    {
+        pcm[i] = (BYTE)Random(&ulState);
+        pcm[i + 1] = (BYTE)(i >> 3);
+    }
+
+    TEST_CHECK(encoder.Init(48000, 1, 16, 256, workspace.data(), (ULONG)(workspace.size() * sizeof(ULONGLONG))));
+    encoder.AddData(pcm.data(), (ULONG)pcm.size());
+    ULONG cbFrame = encoder.EncodeBlock(&pFrame);
+    stream.insert(stream.end(), pFrame, pFrame + cbFrame);
+    encoder.GetStreamHeader(stream.data());
+    TEST_CHECK(TestFlacDecode(stream.data(), stream.size(), &decoded) == NULL);
+
+    // The decoder is only a check if it notices damage: any flipped bit in
+    // the frame fails a CRC or a consistency check.
+    ULONG ulMissed = 0;
+    for (size_t i = FLAC_STREAM_HEADER_BYTES * 8; i < stream.size() * 8; i++)
+    {
+        stream[i / 8] ^= (BYTE)(0x80 >> (i % 8));
+        ulMissed += (TestFlacDecode(stream.data(), stream.size(), &decoded) == NULL);
+        stream[i / 8] ^= (BYTE)(0x80 >> (i % 8));
+    }
+    TEST_CHECK(ulMissed == 0);
+
+    TEST_CHECK(TestFlacDecode(stream.data(), stream.size() - 1, &decoded) != NULL);
+}
+
+//=============================================================================
+int main()
+{
+    TestDecoderRejects();
+    TestRestartStream();
+    TestRoundTrip();
+
+    return TestResult("flacencoder");
+}
@@ -0,0 +1,300 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    formatindextest.cpp
+
+Abstract:
+
+    The format index never changes what a pin accepts: built as
+    BuildFormatIndexes builds it over the speaker and microphone array
+    device format tables, FindIndexedFormat agrees with IsFormatMatch
+    tried on every entry in turn, for each entry of both tables as
+    WAVEFORMATEX and WAVEFORMATEXTENSIBLE probes and for mutations of each
+    that change the rate, valid bits, mask, subformat, block alignment and
+    channels, bits, KS subformat or sizes. Also that equal keys come back
+    in table order, and the limits on entries and storage.
+--*/
+
+#include "definitions.h"
+#include "formatindex.h"
+#include "testutil.h"
+
+#include <vector>
+
+#include "speakerformats.inc"
+#include "micarrayformats.inc"
+
+#define TEST_MUTATIONS      7       // Kinds, each on both probe forms.
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// A pin's device formats and its two indexes, as the miniport keeps them.
+//
+typedef struct
+{
+    const char *                        pszName;
+    PKSDATAFORMAT_WAVEFORMATEXTENSIBLE  pFormats;
+    ULONG                               cFormats;
+    CFormatIndex                        Indexes[2];
+    std::vector<BYTE>                   Storage;
+} TEST_PIN;
+
+//
+// Both indexes over the pin's table, keyed as BuildFormatIndexes keys them.
+//
+static BOOL BuildIndexes(TEST_PIN *pPin)
+{
+    ULONG                           cbIndex = CFormatIndex::GetStorageBytes(pPin->cFormats);
+    std::vector<FORMAT_INDEX_KEY>   keys(pPin->cFormats);
+
+    pPin->Storage.assign(2 * cbIndex, 0);
+    for (ULONG bExtensible = 0; bExtensible < 2; bExtensible++)
+    {
+        for (ULONG i = 0; i < pPin->cFormats; i++)
+        {
+            PWAVEFORMATEXTENSIBLE pWaveFormatExt = &pPin->pFormats[i].WaveFormatExt;
+
+            GetFormatIndexKey(&pWaveFormatExt->Format,
+                              bExtensible ? WAVE_FORMAT_EXTENSIBLE : EXTRACT_WAVEFORMATEX_ID(&pWaveFormatExt->SubFormat),
+                              &keys[i]);
+        }
+
+        if (!pPin->Indexes[bExtensible].Init(keys.data(), pPin->cFormats, &pPin->Storage[bExtensible * cbIndex], cbIndex))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+//
+// IsFormatSupported without the index.
+//
+static BOOL IsScanned(const TEST_PIN *pPin, const KSDATAFORMAT *pDataFormat)
+{
+    for (ULONG i = 0; i < pPin->cFormats; i++)
+    {
+        if (IsFormatMatch(&pPin->pFormats[i], pDataFormat))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// A table entry as a plain WAVEFORMATEX probe with its subformat's tag.
+//
+static KSDATAFORMAT_WAVEFORMATEXTENSIBLE GetPlainProbe(const KSDATAFORMAT_WAVEFORMATEXTENSIBLE &entry)
+{
+    KSDATAFORMAT_WAVEFORMATEXTENSIBLE probe = entry;
+
+    probe.DataFormat.FormatSize = sizeof(KSDATAFORMAT_WAVEFORMATEX);
+    probe.WaveFormatExt.Format.wFormatTag = EXTRACT_WAVEFORMATEX_ID(&entry.WaveFormatExt.SubFormat);
+    probe.WaveFormatExt.Format.cbSize = 0;
+
+    return probe;
+}
+
+//
+// For each table entry: the entry, its plain form, and every kind of
+// mutation on each of the two.
+//
+static VOID AddProbes(const TEST_PIN *pPin, std::vector<KSDATAFORMAT_WAVEFORMATEXTENSIBLE> *pProbes, ULONG *pulState)
+{
+    for (ULONG i = 0; i < pPin->cFormats; i++)
+    {
+        KSDATAFORMAT_WAVEFORMATEXTENSIBLE forms[2] = { pPin->pFormats[i], GetPlainProbe(pPin->pFormats[i]) };
+
+        pProbes->push_back(forms[0]);
+        pProbes->push_back(forms[1]);
+
+        for (ULONG m = 0; m < TEST_MUTATIONS * 2; m++)
+        {
+            BOOL                                bPlain = m & 1;
+            KSDATAFORMAT_WAVEFORMATEXTENSIBLE   probe = forms[bPlain];
+            WAVEFORMATEXTENSIBLE *              pWaveFormatExt = &probe.WaveFormatExt;
+            ULONG                               ulChoice = Random(pulState);
+
+            switch (m / 2)
+            {
+            case 0:
+                // Often another rate in a table, sometimes the same.
+                pWaveFormatExt->Format.nSamplesPerSec += (ulChoice & 1 ? 1 : -1) * (LONG)((ulChoice >> 1) % 3) * 44100 / 3;
+                break;
+            case 1:
+                pWaveFormatExt->Samples.wValidBitsPerSample = (USHORT)(8 * (1 + ulChoice % 4));
+                break;
+            case 2:
+                pWaveFormatExt->dwChannelMask = ulChoice & 1 ? KSAUDIO_SPEAKER_STEREO : KSAUDIO_SPEAKER_5POINT1;
+                break;
+            case 3:
+                pWaveFormatExt->SubFormat = ulChoice & 1 ? KSDATAFORMAT_SUBTYPE_PCM : KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+                if (bPlain)
+                {
+                    pWaveFormatExt->Format.wFormatTag = EXTRACT_WAVEFORMATEX_ID(&pWaveFormatExt->SubFormat);
+                }
+                break;
+            case 4:
+                pWaveFormatExt->Format.nBlockAlign += (USHORT)(ulChoice & 1);
+                pWaveFormatExt->Format.nChannels = (USHORT)(1 + (ulChoice >> 1) % 8);
+                break;
+            case 5:
+                pWaveFormatExt->Format.wBitsPerSample = (USHORT)(8 * (1 + ulChoice % 4));
+                break;
+            default:
+                if (ulChoice % 3 == 0)
+                {
+                    probe.DataFormat.SubFormat = KSDATAFORMAT_SUBTYPE_ANALOG;
+                }
+                else if (ulChoice % 3 == 1)
+                {
+                    pWaveFormatExt->Format.cbSize = (USHORT)((ulChoice >> 2) % 45);
+                }
+                else
+                {
+                    probe.DataFormat.FormatSize -= 1 + (ulChoice >> 2) % 8;
+                }
+                break;
+            }
+
+            pProbes->push_back(probe);
+        }
+    }
+}
+
+//=============================================================================
+// Tests
+//=============================================================================
+static VOID TestTables()
+{
+    TEST_PIN pins[2] =
+    {
+        { "speaker",  SpeakerHostPinSupportedDeviceFormats, ARRAYSIZE(SpeakerHostPinSupportedDeviceFormats), {}, {} },
+        { "micarray", MicArrayPinSupportedDeviceFormats,    ARRAYSIZE(MicArrayPinSupportedDeviceFormats),    {}, {} },
+    };
+    std::vector<KSDATAFORMAT_WAVEFORMATEXTENSIBLE>  probes;
+    ULONG                                           ulState = 7;
+
+    for (ULONG p = 0; p < ARRAYSIZE(pins); p++)
+    {
+        TEST_CHECK(BuildIndexes(&pins[p]));
+        TEST_CHECK(pins[p].Indexes[0].IsActive() && pins[p].Indexes[1].IsActive());
+        AddProbes(&pins[p], &probes, &ulState);
+    }
+
+    for (ULONG p = 0; p < ARRAYSIZE(pins); p++)
+    {
+        ULONG ulAccepted = 0;
+        ULONG ulDisagreed = 0;
+
+        // Every entry, in both forms, is found.
+        for (ULONG i = 0; i < pins[p].cFormats; i++)
+        {
+            KSDATAFORMAT_WAVEFORMATEXTENSIBLE plain = GetPlainProbe(pins[p].pFormats[i]);
+
+            TEST_CHECK(FindIndexedFormat(pins[p].Indexes, pins[p].pFormats, &pins[p].pFormats[i].DataFormat));
+            TEST_CHECK(FindIndexedFormat(pins[p].Indexes, pins[p].pFormats, &plain.DataFormat));
+        }
+
+        for (size_t k = 0; k < probes.size(); k++)
+        {
+            BOOL bScanned = IsScanned(&pins[p], &probes[k].DataFormat);
+            BOOL bIndexed = FindIndexedFormat(pins[p].Indexes, pins[p].pFormats, &probes[k].DataFormat);
+
+            if (bScanned != bIndexed && ulDisagreed++ == 0)
+            {
+                printf("%s: probe %zu is %s by the scan but not the index\n",
+                       pins[p].pszName, k, bScanned ? "accepted" : "rejected");
+            }
+            ulAccepted += bScanned;
+        }
+
+        printf("%-8s %2u entries: %zu probes, %u accepted, %u where the index and the scan disagree\n",
+               pins[p].pszName, pins[p].cFormats, probes.size(), ulAccepted, ulDisagreed);
+        TEST_CHECK(ulDisagreed == 0);
+
+        // Some of each, or the probes prove little.
+        TEST_CHECK(ulAccepted >= 2 * pins[p].cFormats && ulAccepted < probes.size());
+    }
+}
+
+//=============================================================================
+static VOID TestGroups()
+{
+    std::vector<FORMAT_INDEX_KEY>   keys(300);
+    std::vector<BYTE>               storage(CFormatIndex::GetStorageBytes((ULONG)keys.size()));
+    CFormatIndex                    index = {};
+    ULONG                           ulState = 3;
+
+    // 300 entries over 40 keys, in no order.
+    for (ULONG i = 0; i < keys.size(); i++)
+    {
+        memset(&keys[i], 0, sizeof(keys[i]));
+        keys[i].ulSamplesPerSec = 8000 * (1 + Random(&ulState) % 40);
+        keys[i].SubFormat[0] = WAVE_FORMAT_PCM;
+    }
+
+    TEST_CHECK(index.Init(keys.data(), (ULONG)keys.size(), storage.data(), (ULONG)storage.size()));
+    for (ULONG r = 1; r <= 41; r++)
+    {
+        FORMAT_INDEX_KEY    key = keys[0];
+        const USHORT *      pusEntries;
+        ULONG               cEntries;
+        ULONG               cExpected = 0;
+
+        key.ulSamplesPerSec = 8000 * r;
+        cEntries = index.Find(&key, &pusEntries);
+
+        for (ULONG i = 0; i < keys.size(); i++)
+        {
+            if (keys[i].ulSamplesPerSec == key.ulSamplesPerSec)
+            {
+                TEST_CHECK(cExpected < cEntries && pusEntries[cExpected] == i);
+                cExpected++;
+            }
+        }
+        TEST_CHECK(cEntries == cExpected);
+    }
+}
+
+//=============================================================================
+static VOID TestLimits()
+{
+    FORMAT_INDEX_KEY    key = {};
+    std::vector<BYTE>   storage(CFormatIndex::GetStorageBytes(1));
+    CFormatIndex        index = {};
+    const USHORT *      pusEntries;
+
+    TEST_CHECK(!index.IsActive());
+    TEST_CHECK(index.Find(&key, &pusEntries) == 0 && pusEntries == NULL);
+
+    TEST_CHECK(CFormatIndex::GetStorageBytes(0) == 0);
+    TEST_CHECK(CFormatIndex::GetStorageBytes(FORMAT_INDEX_MAX_ENTRIES) > 0);
+    TEST_CHECK(CFormatIndex::GetStorageBytes(FORMAT_INDEX_MAX_ENTRIES + 1) == 0);
+
+    TEST_CHECK(!index.Init(&key, 1, storage.data(), (ULONG)storage.size() - 1));
+    TEST_CHECK(!index.IsActive());
+    TEST_CHECK(index.Init(&key, 1, storage.data(), (ULONG)storage.size()));
+    TEST_CHECK(index.Find(&key, &pusEntries) == 1 && pusEntries[0] == 0);
+}
+
+//=============================================================================
+int main()
+{
+    TestTables();
+    TestGroups();
+    TestLimits();
+
+    return TestResult("formatindex");
+}
@@ -0,0 +1,126 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    frameclocktest.cpp
+
+Abstract:
+
+    CFrameClock: exact frame counts however the clock is sampled, running
+    time across pause and resume, and GetTimeOfFrame in both states.
+--*/
+
+#include "frameclock.h"
+#include "testutil.h"
+
+//=============================================================================
+static VOID TestExactCount()
+{
+    // Rate and hours of irregular ticks from 1 to 1.7 ms apart; the highest
+    // rate runs for three days, where the frame count is largest.
+    static const ULONG rates[][2] =
+    {
+        { 8000, 1 }, { 11025, 1 }, { 44100, 1 }, { 48000, 1 }, { 96000, 1 }, { 192000, 1 }, { 384000, 72 }
+    };
+
+    for (ULONG r = 0; r < ARRAYSIZE(rates); r++)
+    {
+        CFrameClock clock;
+        ULONGLONG   hnsNow = 5000000;
+        ULONGLONG   hnsEnd = hnsNow + rates[r][1] * 3600 * FRAMECLOCK_HNS_PER_SECOND;
+        ULONGLONG   ullTotal = 0;
+
+        clock.Init(rates[r][0]);
+        clock.Start(hnsNow);
+
+        for (ULONG i = 0; hnsNow < hnsEnd; i++)
+        {
+            hnsNow += 10000 + (i * 7919) % 7001;
+            ullTotal += clock.Advance(hnsNow, ~0ULL);
+        }
+
+        TEST_CHECK(ullTotal == clock.GetFramesReported());
+        TEST_CHECK(ullTotal == CFrameClock::FramesFromHns(hnsNow - 5000000, rates[r][0]));
+    }
+
+    // The round trip lands on the first instant the frame is complete.
+    for (ULONGLONG ullFrame = 0; ullFrame < 200000; ullFrame += 37)
+    {
+        ULONGLONG hns = CFrameClock::HnsFromFrames(ullFrame, 44100);
+
+        TEST_CHECK(CFrameClock::FramesFromHns(hns, 44100) == ullFrame);
+        TEST_CHECK(hns == 0 || CFrameClock::FramesFromHns(hns - 1, 44100) < ullFrame);
+    }
+}
+
+//=============================================================================
+static VOID TestAdvanceLimit()
+{
+    CFrameClock clock;
+
+    clock.Init(48000);
+    clock.Start(0);
+
+    // 100 ms due, handed out 1000 frames at a time.
+    TEST_CHECK(clock.Advance(1000000, 1000) == 1000);
+    TEST_CHECK(clock.Advance(1000000, 1000) == 1000);
+    TEST_CHECK(clock.Advance(1000000, ~0ULL) == 2800);
+    TEST_CHECK(clock.Advance(1000000, ~0ULL) == 0);
+}
+
+//=============================================================================
+static VOID TestPauseResume()
+{
+    CFrameClock clock;
+
+    clock.Init(48000);
+    clock.Start(1000000);
+
+    TEST_CHECK(clock.GetFrames(11000000) == 48000);
+
+    // Paused for 20 s: the count holds.
+    clock.Pause(11000000);
+    TEST_CHECK(!clock.IsRunning());
+    TEST_CHECK(clock.GetFrames(21000000) == 48000);
+    TEST_CHECK(clock.GetRunningTime(31000000) == 10000000);
+
+    clock.Start(31000000);
+    TEST_CHECK(clock.GetFrames(36000000) == 72000);
+
+    clock.Reset();
+    TEST_CHECK(clock.GetFrames(36000000) == 0);
+    TEST_CHECK(clock.GetFramesReported() == 0);
+}
+
+//=============================================================================
+static VOID TestTimeOfFrame()
+{
+    CFrameClock clock;
+
+    clock.Init(48000);
+    clock.Start(1000000);
+    TEST_CHECK(clock.GetTimeOfFrame(48000) == 11000000);
+
+    // While paused, frames up to the pause keep their times.
+    clock.Pause(11000000);
+    TEST_CHECK(clock.GetTimeOfFrame(48000) == 11000000);
+    TEST_CHECK(clock.GetTimeOfFrame(24000) == 6000000);
+
+    // After resuming, earlier frames extrapolate back from the new start.
+    clock.Start(31000000);
+    TEST_CHECK(clock.GetTimeOfFrame(48000) == 31000000);
+    TEST_CHECK(clock.GetTimeOfFrame(96000) == 41000000);
+}
+
+//=============================================================================
+int main()
+{
+    TestExactCount();
+    TestAdvanceLimit();
+    TestPauseResume();
+    TestTimeOfFrame();
+
+    return TestResult("frameclock");
+}
@@ -0,0 +1,156 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    loopbackringbench.cpp
+
+Abstract:
+
+    CLoopbackRing throughput for typical transfer sizes, on one thread and
+    with the producer and consumer on their own threads, and the time from
+    a frame's commit until the consumer has it.
+--*/
+
+#include "loopbackring.h"
+#include "benchutil.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// The loopback's LOOPBACK_RING_SIZE.
+#define BENCH_CAPACITY  (256 * 1024)
+#define BENCH_BYTES     (1ULL << 30)
+
+//=============================================================================
+static VOID BenchSingleThread()
+{
+    // Transfer and frame size: a 1 ms and a 10 ms packet of 48 kHz stereo
+    // 16-bit, and of 7.1 32-bit.
+    static const ULONG transfers[][2] = { { 192, 4 }, { 1920, 4 }, { 1536, 32 }, { 15360, 32 } };
+
+    std::vector<BYTE>   storage(BENCH_CAPACITY);
+    std::vector<BYTE>   chunk(15360, 0x5A);
+    std::vector<BYTE>   out(15360);
+
+    for (ULONG i = 0; i < ARRAYSIZE(transfers); i++)
+    {
+        CLoopbackRing   ring;
+        ULONG           cbChunk = transfers[i][0];
+        ULONG           ulFrameBytes = transfers[i][1];
+        ULONGLONG       ullBytes = 0;
+        double          dStart;
+        double          dSeconds;
+
+        ring.Attach(storage.data(), BENCH_CAPACITY);
+        ring.BeginProducerSession(ulFrameBytes);
+
+        dStart = BenchSeconds();
+        while (ullBytes < BENCH_BYTES)
+        {
+            ring.Write(chunk.data(), cbChunk);
+            ullBytes += ring.Read(out.data(), cbChunk, ulFrameBytes);
+        }
+        dSeconds = BenchSeconds() - dStart;
+        BenchKeep(out[0]);
+
+        printf("one thread, %5u byte transfers: %8.0f MB/s, %6.1f ns per write and read\n",
+               cbChunk, ullBytes / dSeconds / 1e6, dSeconds * 1e9 / (ullBytes / cbChunk));
+    }
+}
+
+//=============================================================================
+static VOID BenchTwoThreads()
+{
+    std::vector<BYTE>       storage(BENCH_CAPACITY);
+    CLoopbackRing           ring;
+    std::atomic<BOOL>       bProducerDone(FALSE);
+    std::vector<double>     latencies;
+    ULONGLONG               ullConsumed = 0;
+    double                  dStart;
+    double                  dSeconds;
+
+    // 10 ms packets of 8 byte frames, each frame stamped with the time the
+    // producer committed it.
+    const ULONG             cbPacket = 1920;
+    const ULONGLONG         ullPackets = BENCH_BYTES / 8 / cbPacket;
+
+    ring.Attach(storage.data(), BENCH_CAPACITY);
+    ring.BeginProducerSession(sizeof(double));
+    latencies.reserve(1 << 20);
+
+    dStart = BenchSeconds();
+
+    std::thread producer([&]()
+    {
+        std::vector<double> packet(cbPacket / sizeof(double));
+
+        for (ULONGLONG p = 0; p < ullPackets; p++)
+        {
+            // Waits for room rather than dropping.
+            while (ring.GetCapacity() - ring.GetBytesAvailable() < cbPacket)
+            {
+                std::this_thread::yield();
+            }
+
+            std::fill(packet.begin(), packet.end(), BenchSeconds());
+            ring.Write((const BYTE *)packet.data(), cbPacket);
+        }
+
+        bProducerDone = TRUE;
+    });
+
+    std::thread consumer([&]()
+    {
+        std::vector<double> packet(cbPacket / sizeof(double));
+
+        for (;;)
+        {
+            BOOL    bDone = bProducerDone;
+            ULONG   cbRead = ring.Read((PBYTE)packet.data(), cbPacket, sizeof(double));
+
+            if (cbRead > 0)
+            {
+                if (latencies.size() < latencies.capacity())
+                {
+                    latencies.push_back(BenchSeconds() - packet[0]);
+                }
+                ullConsumed += cbRead;
+            }
+            else if (bDone)
+            {
+                break;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    dSeconds = BenchSeconds() - dStart;
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("two threads, %u byte packets: %8.0f MB/s\n", cbPacket, ullConsumed / dSeconds / 1e6);
+    if (!latencies.empty())
+    {
+        printf("commit to read: median %.2f us, 99th percentile %.2f us, max %.2f us\n",
+               latencies[latencies.size() / 2] * 1e6,
+               latencies[latencies.size() * 99 / 100] * 1e6,
+               latencies.back() * 1e6);
+    }
+}
+
+//=============================================================================
+int main()
+{
+    BenchSingleThread();
+    BenchTwoThreads();
+
+    return 0;
+}
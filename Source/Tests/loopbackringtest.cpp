@@ -0,0 +1,276 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    loopbackringtest.cpp
+
+Abstract:
+
+    CLoopbackRing under a concurrent producer and consumer: every frame
+    the consumer gets is whole and in order, frames are only ever dropped
+    whole, and nothing is lost or duplicated, for frame sizes that do and
+    do not divide the capacity, with the free-running indices crossing
+    2^32, through both Read and Peek/Release.
+--*/
+
+#include "loopbackring.h"
+#include "testutil.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define TEST_CAPACITY   4096
+#define TEST_FRAMES     500000
+
+//
+// Starts the free-running indices just short of 2^32, so they wrap early
+// in the run.
+//
+class CTestLoopbackRing : public CLoopbackRing
+{
+public:
+    VOID SetIndices(ULONG ulIndex)
+    {
+        m_ulWriteIndex = ulIndex;
+        m_ulReadIndex = ulIndex;
+    }
+};
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// Frame k: its number in the first four bytes, then bytes derived from it.
+//
+static VOID MakeFrame(PBYTE pFrame, ULONG ulFrameBytes, ULONG k)
+{
+    memcpy(pFrame, &k, sizeof(k));
+    for (ULONG j = sizeof(k); j < ulFrameBytes; j++)
+    {
+        pFrame[j] = (BYTE)(k * 31 + j);
+    }
+}
+
+static BOOL CheckFrame(const BYTE *pFrame, ULONG ulFrameBytes, ULONG *pk)
+{
+    memcpy(pk, pFrame, sizeof(*pk));
+    for (ULONG j = sizeof(*pk); j < ulFrameBytes; j++)
+    {
+        if (pFrame[j] != (BYTE)(*pk * 31 + j))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+typedef struct _CONSUMER_RESULT
+{
+    ULONGLONG   ullFrames;
+    ULONG       ulBadFrames;
+    ULONG       ulOutOfOrder;
+} CONSUMER_RESULT;
+
+//
+// Checks one received frame against the last one seen.
+//
+static VOID Receive(const BYTE *pFrame, ULONG ulFrameBytes, LONGLONG *pllLast, CONSUMER_RESULT *pResult)
+{
+    ULONG k;
+
+    if (!CheckFrame(pFrame, ulFrameBytes, &k))
+    {
+        pResult->ulBadFrames++;
+    }
+    else if ((LONGLONG)k <= *pllLast)
+    {
+        pResult->ulOutOfOrder++;
+    }
+    *pllLast = k;
+    pResult->ullFrames++;
+}
+
+//=============================================================================
+static VOID RunStress(ULONG ulFrameBytes, BOOL bPeek)
+{
+    std::vector<BYTE>   storage(TEST_CAPACITY);
+    CTestLoopbackRing   ring;
+    std::atomic<BOOL>   bProducerDone(FALSE);
+    ULONGLONG           ullDropped = 0;
+    CONSUMER_RESULT     result = {};
+
+    TEST_CHECK(ring.Attach(storage.data(), TEST_CAPACITY));
+    ring.SetIndices(0xFFFFFFFF - 3 * TEST_CAPACITY);
+    ring.BeginProducerSession(ulFrameBytes);
+
+    // Writes the frames in runs that end mid-frame.
+    std::thread producer([&]()
+    {
+        ULONG               ulState = 1;
+        std::vector<BYTE>   run;
+
+        for (ULONG k = 0; k < TEST_FRAMES; )
+        {
+            ULONG ulFrames = 1 + Random(&ulState) % 64;
+
+            ulFrames = ulFrames < TEST_FRAMES - k ? ulFrames : TEST_FRAMES - k;
+            run.resize(ulFrames * ulFrameBytes);
+            for (ULONG f = 0; f < ulFrames; f++)
+            {
+                MakeFrame(&run[f * ulFrameBytes], ulFrameBytes, k + f);
+            }
+
+            for (ULONG cbDone = 0; cbDone < run.size(); )
+            {
+                ULONG cbChunk = 1 + Random(&ulState) % (ULONG)run.size();
+
+                cbChunk = cbChunk < run.size() - cbDone ? cbChunk : (ULONG)run.size() - cbDone;
+                ullDropped += ring.Write(&run[cbDone], cbChunk);
+                cbDone += cbChunk;
+            }
+
+            k += ulFrames;
+            if (Random(&ulState) % 16 == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        bProducerDone = TRUE;
+    });
+
+    // Reads until the producer is done and the ring is empty.
+    std::thread consumer([&]()
+    {
+        ULONG               ulState = 2;
+        LONGLONG            llLast = -1;
+        std::vector<BYTE>   buffer(TEST_CAPACITY);
+        std::vector<BYTE>   partial(ulFrameBytes);
+        ULONG               cbPartial = 0;
+
+        for (;;)
+        {
+            BOOL bDone = bProducerDone;
+
+            if (bPeek)
+            {
+                // Peek stops at the end of the storage, which can split a
+                // frame; put those back together here.
+                PBYTE   pData;
+                ULONG   cbData = ring.Peek(&pData, 1 + Random(&ulState) % TEST_CAPACITY);
+
+                for (ULONG i = 0; i < cbData; i++)
+                {
+                    partial[cbPartial++] = pData[i];
+                    if (cbPartial == ulFrameBytes)
+                    {
+                        Receive(partial.data(), ulFrameBytes, &llLast, &result);
+                        cbPartial = 0;
+                    }
+                }
+                ring.Release(cbData);
+
+                if (cbData == 0 && bDone)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                ULONG cbRead = ring.Read(buffer.data(), 1 + Random(&ulState) % TEST_CAPACITY, ulFrameBytes);
+
+                for (ULONG i = 0; i < cbRead; i += ulFrameBytes)
+                {
+                    Receive(&buffer[i], ulFrameBytes, &llLast, &result);
+                }
+
+                if (cbRead == 0 && bDone && ring.GetBytesAvailable() < ulFrameBytes)
+                {
+                    break;
+                }
+            }
+        }
+
+        TEST_CHECK(cbPartial == 0);
+    });
+
+    producer.join();
+    consumer.join();
+
+    printf("%2u byte frames%s: %llu received, %llu dropped whole\n",
+           ulFrameBytes, bPeek ? ", peek" : "", (unsigned long long)result.ullFrames,
+           (unsigned long long)(ullDropped / ulFrameBytes));
+
+    TEST_CHECK(result.ulBadFrames == 0);
+    TEST_CHECK(result.ulOutOfOrder == 0);
+    TEST_CHECK(ullDropped % ulFrameBytes == 0);
+    TEST_CHECK(ullDropped == ring.GetDroppedBytes());
+    TEST_CHECK(result.ullFrames + ullDropped / ulFrameBytes == TEST_FRAMES);
+    TEST_CHECK(ring.GetBytesCommitted() == result.ullFrames * ulFrameBytes);
+    TEST_CHECK(ring.GetBytesAvailable() == 0);
+}
+
+//=============================================================================
+static VOID TestStress()
+{
+    // 6, 12 and 24 do not divide the capacity, so frames straddle the end
+    // of the storage.
+    static const ULONG frameSizes[] = { 4, 6, 12, 24, LOOPBACK_MAX_FRAME_BYTES };
+
+    for (ULONG i = 0; i < ARRAYSIZE(frameSizes); i++)
+    {
+        RunStress(frameSizes[i], FALSE);
+        RunStress(frameSizes[i], TRUE);
+    }
+}
+
+//=============================================================================
+static VOID TestFull()
+{
+    std::vector<BYTE>   storage(64);
+    CLoopbackRing       ring;
+    BYTE                data[96];
+    BYTE                out[96];
+
+    for (ULONG i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (BYTE)i;
+    }
+
+    TEST_CHECK(!ring.Attach(storage.data(), 48));
+    TEST_CHECK(ring.Attach(storage.data(), 64));
+
+    // 6 byte frames into 64 bytes: ten fit, the rest are dropped whole.
+    ring.BeginProducerSession(6);
+    TEST_CHECK(ring.Write(data, 96) == 36);
+    TEST_CHECK(ring.GetBytesAvailable() == 60);
+
+    // A partial frame is held back until it is complete.
+    TEST_CHECK(ring.Read(out, 96, 6) == 60);
+    TEST_CHECK(memcmp(out, data, 60) == 0);
+    TEST_CHECK(ring.Write(data, 4) == 0);
+    TEST_CHECK(ring.GetBytesAvailable() == 0);
+    TEST_CHECK(ring.Write(data + 4, 2) == 0);
+    TEST_CHECK(ring.GetBytesAvailable() == 6);
+
+    // Reads round down to whole frames and count the shortfall.
+    TEST_CHECK(ring.Read(out, 10, 6) == 6);
+    TEST_CHECK(memcmp(out, data, 6) == 0);
+    TEST_CHECK(ring.GetUnderrunBytes() == 36 + 4);
+}
+
+//=============================================================================
+int main()
+{
+    TestFull();
+    TestStress();
+
+    return TestResult("loopbackring");
+}
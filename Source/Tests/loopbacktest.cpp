@@ -0,0 +1,311 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    loopbacktest.cpp
+
+Abstract:
+
+    CLoopbackCable: render and capture clocks +-200 ppm apart with jittery
+    10 ms transfers, simulated for minutes, must hold the queue at its
+    target without underruns once primed; remixing inside the drift
+    compensated path keeps levels; matching formats pass byte for byte.
+--*/
+
+#include "definitions.h"
+#include "loopback.h"
+#include "testutil.h"
+
+#include <math.h>
+#include <vector>
+
+#define TEST_PI     3.14159265358979323846
+
+//
+// Exposes the queue and the drift trim to the test.
+//
+class CTestLoopbackCable : public CLoopbackCable
+{
+public:
+    ULONG GetQueuedBytes() const
+    {
+        return m_Ring.GetBytesAvailable();
+    }
+
+    double GetTrimPpm() const
+    {
+        return m_Drift.GetAdjustment() / 1073.741824;
+    }
+};
+
+static WAVEFORMATEX MakeFormat(USHORT wFormatTag, USHORT nChannels, ULONG nSamplesPerSec, USHORT wBitsPerSample)
+{
+    WAVEFORMATEX wfx;
+
+    wfx.wFormatTag = wFormatTag;
+    wfx.nChannels = nChannels;
+    wfx.nSamplesPerSec = nSamplesPerSec;
+    wfx.nBlockAlign = nChannels * wBitsPerSample / 8;
+    wfx.nAvgBytesPerSec = nSamplesPerSec * wfx.nBlockAlign;
+    wfx.wBitsPerSample = wBitsPerSample;
+    wfx.cbSize = 0;
+
+    return wfx;
+}
+
+//
+// Sample i of capture buffer pData, channel c, as a value in [-1, 1).
+//
+static double CaptureSample(const WAVEFORMATEX &wfx, const BYTE *pData, ULONG i, ULONG c)
+{
+    if (wfx.wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    {
+        return ((const float *)pData)[i * wfx.nChannels + c];
+    }
+
+    return ((const SHORT *)pData)[i * wfx.nChannels + c] / 32768.0;
+}
+
+static ULONG g_ulRandom = 1;
+
+// Uniform in [-1, 1].
+static double Random()
+{
+    g_ulRandom = g_ulRandom * 1103515245 + 12345;
+    return (g_ulRandom >> 8) / (double)(1 << 23) - 1;
+}
+
+//=============================================================================
+//
+// Runs the two streams for dSeconds: render at its rate skewed by dPpm,
+// capture at its own, each transferring every 10 +-2 ms. Render carries a
+// tone riding on a DC offset, so a zero in the capture data can only be
+// silence filled in for an underrun.
+//
+static VOID SimulateDrift
+(
+    ULONG       ulRenderRate,
+    ULONG       ulCaptureRate,
+    BOOL        bCaptureFloat,
+    double      dPpm,
+    double      dSeconds
+)
+{
+    CTestLoopbackCable  cable;
+    WAVEFORMATEX        render = MakeFormat(WAVE_FORMAT_PCM, 2, ulRenderRate, 16);
+    WAVEFORMATEX        capture = bCaptureFloat ? MakeFormat(WAVE_FORMAT_IEEE_FLOAT, 2, ulCaptureRate, 32) :
+                                                  MakeFormat(WAVE_FORMAT_PCM, 2, ulCaptureRate, 16);
+    LONG                lCaptureKey = CLoopbackCable::MakeFormatKey(&capture);
+    double              dRenderRate = ulRenderRate * (1 + dPpm * 1e-6);
+    double              tRender = 0, tCapture = 0.0037;
+    ULONGLONG           ullRendered = 0, ullCaptured = 0;
+    double              dPhase = 0;
+    BOOL                bPrimed = FALSE;
+    ULONG               ulUnderruns = 0;
+    double              dQueueSum = 0, dQueueMin = 1e9, dQueueMax = 0, dTrimSum = 0;
+    ULONG               ulSamples = 0;
+    std::vector<SHORT>  in;
+    std::vector<BYTE>   out;
+
+    TEST_CHECK(cable.Init(eResamplerMedium, TRUE) == STATUS_SUCCESS);
+    cable.ConnectRender(&render);
+
+    while (tRender < dSeconds || tCapture < dSeconds)
+    {
+        if (tRender <= tCapture)
+        {
+            double      tNext = tRender + 0.010 + 0.002 * Random();
+            ULONGLONG   ullFrames = (ULONGLONG)(tNext * dRenderRate) - ullRendered;
+
+            in.resize(2 * ullFrames);
+            for (ULONG i = 0; i < ullFrames; i++)
+            {
+                in[2 * i] = in[2 * i + 1] = (SHORT)lrint(8192 + 6000 * sin(dPhase));
+                dPhase += 2 * TEST_PI * 997 / ulRenderRate;
+            }
+            dPhase = fmod(dPhase, 2 * TEST_PI);
+
+            cable.Write((PBYTE)in.data(), (ULONG)(ullFrames * render.nBlockAlign));
+            ullRendered += ullFrames;
+            tRender = tNext;
+        }
+        else
+        {
+            double      tNext = tCapture + 0.010 + 0.002 * Random();
+            ULONGLONG   ullFrames = (ULONGLONG)(tNext * ulCaptureRate) - ullCaptured;
+            BOOL        bSilence = FALSE;
+
+            out.assign((size_t)(ullFrames * capture.nBlockAlign), 0xAA);
+            cable.Read(lCaptureKey, 0, capture.nBlockAlign, out.data(), (ULONG)out.size());
+            ullCaptured += ullFrames;
+            tCapture = tNext;
+
+            for (ULONG i = 0; i < ullFrames; i++)
+            {
+                bSilence = bSilence || CaptureSample(capture, out.data(), i, 0) == 0;
+            }
+
+            // Silence until the queue first reaches its target.
+            if (!bSilence)
+            {
+                bPrimed = TRUE;
+            }
+            else if (bPrimed)
+            {
+                ulUnderruns++;
+            }
+
+            // Settled: the trim has had two minutes to find the skew.
+            if (tCapture > 120)
+            {
+                double dQueueMs = cable.GetQueuedBytes() / (double)render.nBlockAlign * 1000 / ulRenderRate;
+
+                dQueueSum += dQueueMs;
+                dQueueMin = dQueueMs < dQueueMin ? dQueueMs : dQueueMin;
+                dQueueMax = dQueueMs > dQueueMax ? dQueueMs : dQueueMax;
+                dTrimSum += cable.GetTrimPpm();
+                ulSamples++;
+            }
+        }
+    }
+
+    printf("%6u -> %6u %s, skew %+4.0f ppm: queue %.2f ms [%.2f..%.2f], trim %+6.1f ppm, underruns %u\n",
+           ulRenderRate, ulCaptureRate, bCaptureFloat ? "float" : "pcm16", dPpm,
+           dQueueSum / ulSamples, dQueueMin, dQueueMax, dTrimSum / ulSamples, ulUnderruns);
+
+    TEST_CHECK(bPrimed);
+    TEST_CHECK(ulUnderruns == 0);
+    TEST_CHECK(fabs(dQueueSum / ulSamples - LOOPBACK_DRIFT_TARGET_MS) < 2);
+    TEST_CHECK(fabs(dTrimSum / ulSamples - dPpm) < 10);
+}
+
+static VOID TestDrift()
+{
+    // Matching formats, which drift compensation also sends through the
+    // converter, and a rate conversion.
+    SimulateDrift(48000, 48000, FALSE, -200, 180);
+    SimulateDrift(48000, 48000, FALSE, 200, 180);
+    SimulateDrift(44100, 48000, TRUE, -200, 180);
+    SimulateDrift(44100, 48000, TRUE, 200, 180);
+}
+
+//=============================================================================
+//
+// Peak of each capture channel over the last 20 of 200 10 ms blocks of a
+// -6 dBFS 1 kHz tone on every render channel but LFE.
+//
+static VOID RunRemix
+(
+    const WAVEFORMATEX &    render,
+    const WAVEFORMATEX &    capture,
+    double *                pdPeaks
+)
+{
+    CLoopbackCable      cable;
+    LONG                lCaptureKey = CLoopbackCable::MakeFormatKey((PWAVEFORMATEX)&capture);
+    ULONG               ulRenderFrames = render.nSamplesPerSec / 100;
+    ULONG               ulCaptureFrames = capture.nSamplesPerSec / 100;
+    std::vector<SHORT>  in(ulRenderFrames * render.nChannels);
+    std::vector<BYTE>   out(ulCaptureFrames * capture.nBlockAlign);
+    double              dPhase = 0;
+
+    for (ULONG c = 0; c < capture.nChannels; c++)
+    {
+        pdPeaks[c] = 0;
+    }
+
+    TEST_CHECK(cable.Init(eResamplerMedium, TRUE) == STATUS_SUCCESS);
+    cable.ConnectRender((PWAVEFORMATEX)&render);
+
+    for (ULONG b = 0; b < 200; b++)
+    {
+        for (ULONG i = 0; i < ulRenderFrames; i++)
+        {
+            SHORT sample = (SHORT)lrint(16000 * sin(dPhase));
+
+            for (ULONG c = 0; c < render.nChannels; c++)
+            {
+                in[i * render.nChannels + c] = (render.nChannels >= 6 && c == 3) ? 0 : sample;
+            }
+            dPhase += 2 * TEST_PI * 1000 / render.nSamplesPerSec;
+        }
+
+        cable.Write((PBYTE)in.data(), (ULONG)(in.size() * sizeof(SHORT)));
+        cable.Read(lCaptureKey, 0, capture.nBlockAlign, out.data(), (ULONG)out.size());
+
+        for (ULONG i = 0; b >= 180 && i < ulCaptureFrames; i++)
+        {
+            for (ULONG c = 0; c < capture.nChannels; c++)
+            {
+                double d = fabs(CaptureSample(capture, out.data(), i, c));
+
+                pdPeaks[c] = d > pdPeaks[c] ? d : pdPeaks[c];
+            }
+        }
+    }
+}
+
+static VOID TestRemix()
+{
+    const double    dLevel = 16000 / 32768.0;
+    double          dPeaks[8];
+
+    // 5.1 folds down to stereo at the level of any one channel: the matrix
+    // rows sum to unity and every channel carries the same tone.
+    RunRemix(MakeFormat(WAVE_FORMAT_PCM, 6, 48000, 16), MakeFormat(WAVE_FORMAT_IEEE_FLOAT, 2, 48000, 32), dPeaks);
+    printf("5.1 -> stereo: %.4f %.4f\n", dPeaks[0], dPeaks[1]);
+    TEST_CHECK(fabs(dPeaks[0] - dLevel) < 0.01 && fabs(dPeaks[1] - dLevel) < 0.01);
+
+    // Stereo at 44.1 kHz into 5.1 at 48 kHz fills the front pair only.
+    RunRemix(MakeFormat(WAVE_FORMAT_PCM, 2, 44100, 16), MakeFormat(WAVE_FORMAT_PCM, 6, 48000, 16), dPeaks);
+    printf("stereo -> 5.1: %.4f %.4f %.4f %.4f %.4f %.4f\n", dPeaks[0], dPeaks[1], dPeaks[2], dPeaks[3], dPeaks[4], dPeaks[5]);
+    TEST_CHECK(fabs(dPeaks[0] - dLevel) < 0.01 && fabs(dPeaks[1] - dLevel) < 0.01);
+    TEST_CHECK(dPeaks[2] == 0 && dPeaks[3] == 0 && dPeaks[4] == 0 && dPeaks[5] == 0);
+}
+
+//=============================================================================
+static VOID TestPassThrough()
+{
+    CLoopbackCable      cable;
+    WAVEFORMATEX        wfx = MakeFormat(WAVE_FORMAT_PCM, 2, 48000, 16);
+    LONG                lKey = CLoopbackCable::MakeFormatKey(&wfx);
+    std::vector<BYTE>   in(480 * wfx.nBlockAlign);
+    std::vector<BYTE>   out(in.size());
+
+    TEST_CHECK(cable.Init(eResamplerMedium, FALSE) == STATUS_SUCCESS);
+    cable.ConnectRender(&wfx);
+
+    // The consumer drops what was queued before it saw the producer's
+    // format, so let it see it first, as a running capture stream would.
+    cable.Read(lKey, 0, wfx.nBlockAlign, out.data(), (ULONG)out.size());
+
+    for (ULONG b = 0; b < 50; b++)
+    {
+        for (size_t i = 0; i < in.size(); i++)
+        {
+            in[i] = (BYTE)(Random() * 128);
+        }
+
+        cable.Write(in.data(), (ULONG)in.size());
+        cable.Read(lKey, 0, wfx.nBlockAlign, out.data(), (ULONG)out.size());
+        TEST_CHECK(in == out);
+    }
+
+    // Nothing queued once the producer goes away.
+    cable.DisconnectRender();
+    cable.Write(in.data(), (ULONG)in.size());
+    cable.Read(lKey, 0, wfx.nBlockAlign, out.data(), (ULONG)out.size());
+    TEST_CHECK(out == std::vector<BYTE>(out.size(), 0));
+}
+
+//=============================================================================
+int main()
+{
+    TestDrift();
+    TestRemix();
+    TestPassThrough();
+
+    return TestResult("loopback");
+}
@@ -0,0 +1,341 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    micarraysourcetest.cpp
+
+Abstract:
+
+    CMicArraySource on the geometry the mic array advertises: for sources
+    all around it, each microphone's fractional delay and gain against
+    the plane wave the coordinates imply, worked out in double, at every
+    rate of the device format table. Then, on every table format, the
+    delay and gain each channel actually carries, measured from the
+    phase and amplitude of a rendered tone. Also the fixed point sin and
+    cos, and the formats and arrays it turns down.
+--*/
+
+#include "definitions.h"
+#include "micarraysource.h"
+#include "testutil.h"
+
+#include "../Filters/micarraygeometry.h"
+
+#include <math.h>
+
+#include <vector>
+
+#include "micarrayformats.inc"
+
+#define TEST_PI                 3.14159265358979323846
+#define TEST_DELAY_TOLERANCE    1e-4    // Frames, for the computed delays.
+#define TEST_GAIN_TOLERANCE     1e-6
+#define TEST_SOUND_SPEED        343.0   // m/s, in air at 20 C.
+
+//
+// The advertised coordinates, as the capture stream hands them over.
+//
+static VOID GetElements(MIC_SOURCE_ELEMENT elements[MICARRAY_MICROPHONES])
+{
+    for (ULONG i = 0; i < MICARRAY_MICROPHONES; i++)
+    {
+        elements[i].ulType = MicArrayMicrophones[i].usType;
+        elements[i].lX = MicArrayMicrophones[i].wXCoord;
+        elements[i].lY = MicArrayMicrophones[i].wYCoord;
+        elements[i].lZ = MicArrayMicrophones[i].wZCoord;
+        elements[i].lVerticalAngle = MicArrayMicrophones[i].wVerticalAngle;
+        elements[i].lHorizontalAngle = MicArrayMicrophones[i].wHorizontalAngle;
+    }
+}
+
+//
+// Each microphone's delay behind the nearest one, in frames, and its gain
+// towards a source at the angles given in 1/10000 radians.
+//
+static VOID ExpectedResponse(ULONG ulSampleRate, LONG lVerticalAngle, LONG lHorizontalAngle,
+                             double dDelay[MICARRAY_MICROPHONES], double dGain[MICARRAY_MICROPHONES])
+{
+    // Omnidirectional part of each KSMICARRAY_MICTYPE polar pattern.
+    static const double omni[] = { 1.0, 0.7, 0.5, 0.37, 0.25, 0.0 };
+    double  dV = lVerticalAngle / 10000.0;
+    double  dH = lHorizontalAngle / 10000.0;
+    double  dSource[3] = { cos(dV) * cos(dH), cos(dV) * sin(dH), sin(dV) };
+    double  dDistance[MICARRAY_MICROPHONES];
+    double  dNearest = -1e30;
+
+    for (ULONG m = 0; m < MICARRAY_MICROPHONES; m++)
+    {
+        const KSAUDIO_MICROPHONE_COORDINATES & mic = MicArrayMicrophones[m];
+        double dFacingV = mic.wVerticalAngle / 10000.0;
+        double dFacingH = mic.wHorizontalAngle / 10000.0;
+        double dCos = cos(dFacingV) * cos(dFacingH) * dSource[0] +
+                      cos(dFacingV) * sin(dFacingH) * dSource[1] +
+                      sin(dFacingV) * dSource[2];
+        double dOmni = mic.usType < ARRAYSIZE(omni) ? omni[mic.usType] : 1.0;
+
+        dDistance[m] = mic.wXCoord * dSource[0] + mic.wYCoord * dSource[1] + mic.wZCoord * dSource[2];
+        dNearest = dDistance[m] > dNearest ? dDistance[m] : dNearest;
+        dGain[m] = dOmni + (1 - dOmni) * dCos;
+    }
+
+    for (ULONG m = 0; m < MICARRAY_MICROPHONES; m++)
+    {
+        dDelay[m] = (dNearest - dDistance[m]) / 1000 / TEST_SOUND_SPEED * ulSampleRate;
+    }
+}
+
+//
+// Sample k of a buffer in a stream format, full scale 1.
+//
+static double GetSample(const std::vector<BYTE> &buffer, size_t k, ULONG ulBits, BOOL bFloat)
+{
+    ULONG ulBytes = ulBits / 8;
+    ULONG ulValue = 0;
+
+    for (ULONG b = 0; b < ulBytes; b++)
+    {
+        ulValue |= (ULONG)buffer[k * ulBytes + b] << (8 * b);
+    }
+
+    if (bFloat)
+    {
+        float fValue;
+
+        memcpy(&fValue, &ulValue, sizeof(fValue));
+        return fValue;
+    }
+
+    if (ulBits == 8)
+    {
+        return ((LONG)ulValue - 0x80) / 128.0;
+    }
+
+    return (LONG)(ulValue << (32 - ulBits)) / 2147483648.0;
+}
+
+static VOID PutSample(std::vector<BYTE> *pBuffer, size_t k, double dValue, ULONG ulBits, BOOL bFloat)
+{
+    ULONG ulBytes = ulBits / 8;
+    ULONG ulValue;
+
+    if (bFloat)
+    {
+        float fValue = (float)dValue;
+
+        memcpy(&ulValue, &fValue, sizeof(ulValue));
+    }
+    else
+    {
+        ulValue = (ULONG)(LONG)llround(dValue * ldexp(1.0, ulBits - 1)) + (ulBits == 8 ? 0x80 : 0);
+    }
+
+    for (ULONG b = 0; b < ulBytes; b++)
+    {
+        (*pBuffer)[k * ulBytes + b] = (BYTE)(ulValue >> (8 * b));
+    }
+}
+
+//=============================================================================
+// Tests
+//=============================================================================
+static VOID TestSinCos()
+{
+    double dWorst = 0;
+
+    for (LONG lAngle = -100000; lAngle <= 100000; lAngle += 7)
+    {
+        LONG lSin;
+        LONG lCos;
+
+        MicSourceSinCos(lAngle, &lSin, &lCos);
+        dWorst = fmax(dWorst, fabs(lSin / 1073741824.0 - sin(lAngle / 10000.0)));
+        dWorst = fmax(dWorst, fabs(lCos / 1073741824.0 - cos(lAngle / 10000.0)));
+    }
+
+    printf("sin and cos worst error: %.2e\n", dWorst);
+    TEST_CHECK(dWorst < 1e-8);
+}
+
+//=============================================================================
+static VOID TestGeometry()
+{
+    MIC_SOURCE_ELEMENT  elements[MICARRAY_MICROPHONES];
+    std::vector<BYTE>   storage(CMicArraySource::GetStorageBytes(MICARRAY_MICROPHONES));
+
+    GetElements(elements);
+
+    for (ULONG f = 0; f < ARRAYSIZE(MicArrayPinSupportedDeviceFormats); f++)
+    {
+        const WAVEFORMATEX &    format = MicArrayPinSupportedDeviceFormats[f].WaveFormatExt.Format;
+        BOOL                    bFloat = IsEqualGUIDAligned(MicArrayPinSupportedDeviceFormats[f].WaveFormatExt.SubFormat,
+                                                            KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+        double                  dWorstDelay = 0;
+        double                  dWorstGain = 0;
+        double                  dWidest = 0;
+        BOOL                    bSeen = FALSE;
+
+        for (ULONG g = 0; g < f; g++)
+        {
+            bSeen = bSeen || MicArrayPinSupportedDeviceFormats[g].WaveFormatExt.Format.nSamplesPerSec == format.nSamplesPerSec;
+        }
+        if (bSeen)
+        {
+            continue;
+        }
+
+        for (LONG lElevation = -75; lElevation <= 75; lElevation += 15)
+        {
+            for (LONG lAzimuth = -180; lAzimuth <= 180; lAzimuth += 15)
+            {
+                LONG                lVertical = MIC_SOURCE_DEGREES(lElevation);
+                LONG                lHorizontal = MIC_SOURCE_DEGREES(lAzimuth);
+                CMicArraySource     source;
+                double              dDelay[MICARRAY_MICROPHONES];
+                double              dGain[MICARRAY_MICROPHONES];
+
+                TEST_CHECK(source.Init(format.nSamplesPerSec, format.wBitsPerSample, bFloat, elements, MICARRAY_MICROPHONES,
+                                       lVertical, lHorizontal, storage.data(), (ULONG)storage.size()));
+
+                ExpectedResponse(format.nSamplesPerSec, lVertical, lHorizontal, dDelay, dGain);
+                for (ULONG m = 0; m < MICARRAY_MICROPHONES; m++)
+                {
+                    dWorstDelay = fmax(dWorstDelay, fabs(source.GetDelay(m) / 1048576.0 - dDelay[m]));
+                    dWorstGain = fmax(dWorstGain, fabs(source.GetGain(m) / 1073741824.0 - dGain[m]));
+                    dWidest = fmax(dWidest, dDelay[m]);
+                }
+            }
+        }
+
+        printf("%6u Hz: up to %.2f frames apart, worst delay error %.2e frames, gain error %.2e\n",
+               format.nSamplesPerSec, dWidest, dWorstDelay, dWorstGain);
+        TEST_CHECK(dWorstDelay < TEST_DELAY_TOLERANCE);
+        TEST_CHECK(dWorstGain < TEST_GAIN_TOLERANCE);
+    }
+}
+
+//=============================================================================
+static VOID TestRendered()
+{
+    static const LONG directions[][2] = { { 0, 90 }, { 0, -45 }, { 30, 120 }, { -60, 10 } };
+    MIC_SOURCE_ELEMENT elements[MICARRAY_MICROPHONES];
+
+    GetElements(elements);
+
+    for (ULONG f = 0; f < ARRAYSIZE(MicArrayPinSupportedDeviceFormats); f++)
+    {
+        const WAVEFORMATEX &    format = MicArrayPinSupportedDeviceFormats[f].WaveFormatExt.Format;
+        BOOL                    bFloat = IsEqualGUIDAligned(MicArrayPinSupportedDeviceFormats[f].WaveFormatExt.SubFormat,
+                                                            KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+        ULONG                   ulRate = format.nSamplesPerSec;
+        ULONG                   ulBits = format.wBitsPerSample;
+        ULONG                   ulFrames = ulRate / 5 / 128 * 128;  // Halves of whole periods.
+        double                  dFrequency = ulRate * 13 / 64.0;    // 0.4 of Nyquist.
+        double                  dWorstDelay = 0;
+        double                  dWorstGain = 0;
+
+        for (ULONG d = 0; d < ARRAYSIZE(directions); d++)
+        {
+            LONG                lVertical = MIC_SOURCE_DEGREES(directions[d][0]);
+            LONG                lHorizontal = MIC_SOURCE_DEGREES(directions[d][1]);
+            std::vector<BYTE>   storage(CMicArraySource::GetStorageBytes(MICARRAY_MICROPHONES));
+            std::vector<BYTE>   buffer((size_t)ulFrames * MICARRAY_MICROPHONES * ulBits / 8);
+            CMicArraySource     source;
+            double              dDelay[MICARRAY_MICROPHONES];
+            double              dGain[MICARRAY_MICROPHONES];
+
+            // The same tone on every channel, so the source is the tone.
+            for (ULONG i = 0; i < ulFrames; i++)
+            {
+                for (ULONG m = 0; m < MICARRAY_MICROPHONES; m++)
+                {
+                    PutSample(&buffer, (size_t)i * MICARRAY_MICROPHONES + m, 0.5 * sin(2 * TEST_PI * dFrequency * i / ulRate), ulBits, bFloat);
+                }
+            }
+
+            TEST_CHECK(source.Init(ulRate, ulBits, bFloat, elements, MICARRAY_MICROPHONES,
+                                   lVertical, lHorizontal, storage.data(), (ULONG)storage.size()));
+            source.Process(buffer.data(), (ULONG)buffer.size());
+            ExpectedResponse(ulRate, lVertical, lHorizontal, dDelay, dGain);
+
+            // Each channel's component at the tone over the second half,
+            // a whole number of periods: its phase is the delay.
+            for (ULONG m = 0; m < MICARRAY_MICROPHONES; m++)
+            {
+                double dSin = 0;
+                double dCos = 0;
+
+                for (ULONG i = ulFrames / 2; i < ulFrames; i++)
+                {
+                    double dValue = GetSample(buffer, (size_t)i * MICARRAY_MICROPHONES + m, ulBits, bFloat);
+
+                    dSin += dValue * sin(2 * TEST_PI * dFrequency * i / ulRate);
+                    dCos += dValue * cos(2 * TEST_PI * dFrequency * i / ulRate);
+                }
+
+                double dAmplitude = 2 * sqrt(dSin * dSin + dCos * dCos) / (ulFrames / 2);
+                double dLag = -atan2(dCos, dSin) / (2 * TEST_PI) * ulRate / dFrequency;
+                double dExpectedLag = dDelay[m] + MIC_SOURCE_FILTER_TAPS / 2;
+
+                // The lag is only known to within a period.
+                dLag += round((dExpectedLag - dLag) * dFrequency / ulRate) * ulRate / dFrequency;
+
+                dWorstDelay = fmax(dWorstDelay, fabs(dLag - dExpectedLag));
+                dWorstGain = fmax(dWorstGain, fabs(dAmplitude / 0.5 - dGain[m]));
+            }
+        }
+
+        printf("%6u Hz %2u%-1s: worst rendered delay error %.1e frames, gain error %.1e\n",
+               ulRate, ulBits, bFloat ? "f" : "", dWorstDelay, dWorstGain);
+        TEST_CHECK(dWorstDelay < (ulBits == 8 ? 1e-2 : 1e-4));
+        TEST_CHECK(dWorstGain < (ulBits == 8 ? 5e-3 : 1e-4));
+    }
+}
+
+//=============================================================================
+static VOID TestLimits()
+{
+    MIC_SOURCE_ELEMENT  elements[MICARRAY_MICROPHONES];
+    std::vector<BYTE>   storage(CMicArraySource::GetStorageBytes(MICARRAY_MICROPHONES));
+    std::vector<SHORT>  samples(4800 * MICARRAY_MICROPHONES);
+    CMicArraySource     source;
+
+    GetElements(elements);
+
+    for (ULONG i = 0; i < samples.size(); i++)
+    {
+        samples[i] = (SHORT)(i * 2654435761u >> 16);
+    }
+    std::vector<SHORT> input(samples);
+
+    TEST_CHECK(CMicArraySource::GetStorageBytes(0) == 0);
+    TEST_CHECK(CMicArraySource::GetStorageBytes(MIC_SOURCE_MAX_MICS + 1) == 0);
+    TEST_CHECK(!source.Init(48000, 16, FALSE, elements, MICARRAY_MICROPHONES, 0, 0, storage.data(), (ULONG)storage.size() - 1));
+    TEST_CHECK(!source.Init(48000, 20, FALSE, elements, MICARRAY_MICROPHONES, 0, 0, storage.data(), (ULONG)storage.size()));
+    TEST_CHECK(!source.Init(48000, 16, TRUE, elements, MICARRAY_MICROPHONES, 0, 0, storage.data(), (ULONG)storage.size()));
+
+    // An inactive source leaves the audio alone.
+    source.Process((PBYTE)samples.data(), (ULONG)(samples.size() * sizeof(SHORT)));
+    TEST_CHECK(samples == input);
+
+    // Half a metre across at 192 kHz: a source off the end of the array
+    // needs more than MIC_SOURCE_MAX_TAPS taps, one straight ahead none.
+    elements[0].lY = 250;
+    elements[1].lY = -250;
+    TEST_CHECK(!source.Init(192000, 16, FALSE, elements, MICARRAY_MICROPHONES, 0, MIC_SOURCE_DEGREES(90),
+                            storage.data(), (ULONG)storage.size()));
+    TEST_CHECK(source.Init(192000, 16, FALSE, elements, MICARRAY_MICROPHONES, 0, 0,
+                           storage.data(), (ULONG)storage.size()));
+}
+
+//=============================================================================
+int main()
+{
+    TestSinCos();
+    TestGeometry();
+    TestRendered();
+    TestLimits();
+
+    return TestResult("micarraysource");
+}
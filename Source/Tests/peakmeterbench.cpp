@@ -0,0 +1,132 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    peakmeterbench.cpp
+
+Abstract:
+
+    Cost of metering a stream: CPeakMeter::Process on 1 ms blocks of every
+    metered format, up to 8 channels at 384 kHz, against a scan that takes
+    the channel count at run time as the baseline loop did.
+--*/
+
+#include "peakmeter.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define BENCH_BLOCKS            40000
+#define BENCH_BUFFER_BLOCKS     10      // A 10 ms DMA buffer, cycled.
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// The same measurement with the channel loop left to run time.
+//
+template <ULONG Bits, BOOL Float>
+__attribute__((noinline)) static VOID GenericScan(const BYTE *pBuffer, ULONG ulFrames, ULONG ulChannels, ULONG *pulPeak, ULONGLONG *pullEnergy)
+{
+    for (ULONG i = 0; i < ulFrames; i++)
+    {
+        for (ULONG c = 0; c < ulChannels; c++)
+        {
+            ULONG ulMagnitude = PeakMeterSample<Bits, Float>::Magnitude(pBuffer);
+            ULONG ulQ15 = ulMagnitude >> 16;
+
+            pulPeak[c] = ulMagnitude > pulPeak[c] ? ulMagnitude : pulPeak[c];
+            pullEnergy[c] += ulQ15 * ulQ15;
+            pBuffer += Bits / 8;
+        }
+    }
+}
+
+template <ULONG Bits, BOOL Float>
+static double TimeGenericScan(const std::vector<BYTE> &buffer, ULONG ulBlockFrames, ULONG ulChannels)
+{
+    ULONG       ulBlockBytes = ulBlockFrames * ulChannels * Bits / 8;
+    ULONG       ulPeak[PEAK_METER_MAX_CHANNELS] = { 0 };
+    ULONGLONG   ullEnergy[PEAK_METER_MAX_CHANNELS] = { 0 };
+    double      dStart = BenchSeconds();
+
+    for (ULONG b = 0; b < BENCH_BLOCKS; b++)
+    {
+        GenericScan<Bits, Float>(&buffer[(b % BENCH_BUFFER_BLOCKS) * ulBlockBytes], ulBlockFrames, ulChannels, ulPeak, ullEnergy);
+        BenchKeep(ulPeak[0]);
+    }
+
+    return (BenchSeconds() - dStart) / BENCH_BLOCKS;
+}
+
+//=============================================================================
+static VOID BenchFormat(ULONG ulSampleRate, ULONG ulBits, ULONG ulChannels, BOOL bFloat)
+{
+    ULONG               ulBlockFrames = ulSampleRate / 1000;
+    ULONG               ulBlockBytes = ulBlockFrames * ulChannels * ulBits / 8;
+    std::vector<BYTE>   buffer(ulBlockBytes * BENCH_BUFFER_BLOCKS);
+    CPeakMeter          meter;
+    PEAK_METER_LEVELS   levels;
+    ULONG               ulState = 1;
+    double              dStart;
+    double              dMeter;
+    double              dGeneric = 0;
+
+    for (size_t i = 0; i < buffer.size(); i++)
+    {
+        buffer[i] = (BYTE)Random(&ulState);
+    }
+
+    // Float samples within [-2, 2].
+    if (bFloat)
+    {
+        for (size_t i = 3; i < buffer.size(); i += 4)
+        {
+            buffer[i] = (buffer[i] & 0x80) | 0x3F;
+        }
+    }
+
+    meter.Init(ulSampleRate, ulBits, ulChannels, bFloat);
+
+    dStart = BenchSeconds();
+    for (ULONG b = 0; b < BENCH_BLOCKS; b++)
+    {
+        meter.Process(&buffer[(b % BENCH_BUFFER_BLOCKS) * ulBlockBytes], ulBlockBytes);
+    }
+    dMeter = (BenchSeconds() - dStart) / BENCH_BLOCKS;
+    meter.GetLevels(&levels);
+    BenchKeep(levels);
+
+    switch (bFloat ? 0 : ulBits)
+    {
+        case 0:  dGeneric = TimeGenericScan<32, TRUE>(buffer, ulBlockFrames, ulChannels); break;
+        case 8:  dGeneric = TimeGenericScan<8, FALSE>(buffer, ulBlockFrames, ulChannels); break;
+        case 16: dGeneric = TimeGenericScan<16, FALSE>(buffer, ulBlockFrames, ulChannels); break;
+        case 24: dGeneric = TimeGenericScan<24, FALSE>(buffer, ulBlockFrames, ulChannels); break;
+        case 32: dGeneric = TimeGenericScan<32, FALSE>(buffer, ulBlockFrames, ulChannels); break;
+    }
+
+    printf("%6u Hz %2u%-1s %u ch: %7.2f us per 1 ms block (%5.2f%% of real time), run-time channel loop %7.2f us\n",
+           ulSampleRate, ulBits, bFloat ? "f" : "", ulChannels,
+           dMeter * 1e6, dMeter * 1e5, dGeneric * 1e6);
+}
+
+//=============================================================================
+int main()
+{
+    static const ULONG formats[][2] = { { 8, FALSE }, { 16, FALSE }, { 24, FALSE }, { 32, FALSE }, { 32, TRUE } };
+
+    for (ULONG f = 0; f < ARRAYSIZE(formats); f++)
+    {
+        BenchFormat(48000, formats[f][0], 2, formats[f][1]);
+        BenchFormat(384000, formats[f][0], 2, formats[f][1]);
+        BenchFormat(384000, formats[f][0], 8, formats[f][1]);
+    }
+
+    return 0;
+}
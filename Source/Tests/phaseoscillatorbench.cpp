@@ -0,0 +1,130 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    phaseoscillatorbench.cpp
+
+Abstract:
+
+    Test tone generation speed: CPhaseOscillator alone against a sin() per
+    sample in double, and the oscillator feeding each sample writer the
+    tone generator uses, in blocks of TONE_BLOCK_FRAMES. Also prints the
+    oscillator's worst error against the exact sine.
+--*/
+
+#include "phaseoscillator.h"
+#include "samplewriter.h"
+#include "benchutil.h"
+
+#include <math.h>
+#include <vector>
+
+// ToneGenerator.h's block size.
+#define TONE_BLOCK_FRAMES   128
+#define BENCH_FRAMES        (1 << 22)
+
+//=============================================================================
+static VOID BenchAccuracy()
+{
+    CPhaseOscillator    oscillator;
+    const ULONG         ulIncrement = (ULONG)((997ULL << 32) / 48000);
+    double              dMaxError = 0;
+
+    oscillator.Init(997, 48000, 1.0, 0, 0);
+    for (ULONG n = 0; n < 480000; n++)
+    {
+        double dExact = sin(2 * 3.14159265358979323846 * (ULONG)(n * ulIncrement) / 4294967296.0);
+        double dError = fabs(oscillator.NextSample() / (double)PHASEOSC_ONE - dExact);
+
+        dMaxError = dError > dMaxError ? dError : dMaxError;
+    }
+
+    printf("worst error against sin(): %.1f dBFS\n", 20 * log10(dMaxError));
+}
+
+//=============================================================================
+static VOID BenchOscillator()
+{
+    std::vector<LONG>   samples(TONE_BLOCK_FRAMES);
+    CPhaseOscillator    oscillator;
+    double              dPhase = 0;
+    double              dStart;
+    double              dTable;
+    double              dLibm;
+
+    oscillator.Init(1000, 48000, 0.5, 0, 0);
+
+    dStart = BenchSeconds();
+    for (ULONG f = 0; f < BENCH_FRAMES; f += TONE_BLOCK_FRAMES)
+    {
+        oscillator.Generate(samples.data(), TONE_BLOCK_FRAMES);
+        BenchKeep(samples[0]);
+    }
+    dTable = BenchSeconds() - dStart;
+
+    dStart = BenchSeconds();
+    for (ULONG f = 0; f < BENCH_FRAMES; f += TONE_BLOCK_FRAMES)
+    {
+        for (ULONG i = 0; i < TONE_BLOCK_FRAMES; i++)
+        {
+            samples[i] = (LONG)(0.5 * sin(dPhase) * PHASEOSC_ONE);
+            dPhase += 2 * 3.14159265358979323846 * 1000 / 48000;
+            dPhase = dPhase >= 2 * 3.14159265358979323846 ? dPhase - 2 * 3.14159265358979323846 : dPhase;
+        }
+        BenchKeep(samples[0]);
+    }
+    dLibm = BenchSeconds() - dStart;
+
+    printf("oscillator %.1f Msamples/s, sin() in double %.1f Msamples/s\n",
+           BENCH_FRAMES / dTable / 1e6, BENCH_FRAMES / dLibm / 1e6);
+}
+
+//=============================================================================
+static VOID BenchWriters()
+{
+    static const ULONG formats[][2] = { { 8, FALSE }, { 16, FALSE }, { 24, FALSE }, { 32, FALSE }, { 32, TRUE } };
+    static const ULONG channelCounts[] = { 1, 2, 8 };
+
+    std::vector<LONG>   samples(TONE_BLOCK_FRAMES);
+    std::vector<BYTE>   buffer(TONE_BLOCK_FRAMES * SAMPLE_WRITER_MAX_CHANNELS * sizeof(LONG));
+
+    printf("%10s %9s %16s\n", "format", "channels", "Mframes/s");
+
+    for (ULONG f = 0; f < ARRAYSIZE(formats); f++)
+    {
+        for (ULONG c = 0; c < ARRAYSIZE(channelCounts); c++)
+        {
+            CPhaseOscillator    oscillator;
+            SAMPLE_WRITER       writer;
+            double              dStart;
+            double              dSeconds;
+
+            oscillator.Init(1000, 48000, 0.5, 0, 0);
+            GetSampleWriter(formats[f][0], channelCounts[c], formats[f][1], &writer);
+
+            dStart = BenchSeconds();
+            for (ULONG n = 0; n < BENCH_FRAMES; n += TONE_BLOCK_FRAMES)
+            {
+                oscillator.Generate(samples.data(), TONE_BLOCK_FRAMES);
+                writer.pfnWriteBroadcast(buffer.data(), samples.data(), TONE_BLOCK_FRAMES);
+                BenchKeep(buffer[0]);
+            }
+            dSeconds = BenchSeconds() - dStart;
+
+            printf("%7u%-3s %9u %16.1f\n",
+                   formats[f][0], formats[f][1] ? "f" : "", channelCounts[c], BENCH_FRAMES / dSeconds / 1e6);
+        }
+    }
+}
+
+//=============================================================================
+int main()
+{
+    BenchAccuracy();
+    BenchOscillator();
+    BenchWriters();
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    recordfilebench.cpp
+
+Abstract:
+
+    Seeking into a 10 hour capture through its sidecar index: the time to
+    turn a random QPC time into the byte offset of the frame to read from,
+    with RecordIndexFind and, for comparison, a linear scan of the entries.
+--*/
+
+#include "recordfile.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define BENCH_HOURS             10
+#define BENCH_QPC_FREQUENCY     10000000LL
+#define BENCH_LOOKUPS           2000000
+#define BENCH_LINEAR_LOOKUPS    200
+
+static ULONGLONG Random(ULONGLONG *pullState)
+{
+    *pullState ^= *pullState << 13;
+    *pullState ^= *pullState >> 7;
+    *pullState ^= *pullState << 17;
+    return *pullState;
+}
+
+static ULONG LinearFind(const RECORD_INDEX_ENTRY *pEntries, ULONG ulEntries, LONGLONG llQpc)
+{
+    ULONG i = 0;
+
+    while (i + 1 < ulEntries && pEntries[i + 1].llQpc <= llQpc)
+    {
+        i++;
+    }
+
+    return i;
+}
+
+//
+// Byte offset of the frame at llQpc: the entry's block, then whole frames
+// into it.
+//
+static ULONGLONG SeekOffset(const RECORD_INDEX_ENTRY *pEntries, ULONG ulEntry, LONGLONG llQpc, ULONG ulSampleRate, ULONG ulFrameBytes)
+{
+    LONGLONG llFrames = (llQpc - pEntries[ulEntry].llQpc) * ulSampleRate / BENCH_QPC_FREQUENCY;
+
+    return pEntries[ulEntry].ullOffset + (ULONGLONG)(llFrames > 0 ? llFrames : 0) * ulFrameBytes;
+}
+
+//=============================================================================
+static VOID BenchSeek(ULONG ulSampleRate, ULONG ulFrameBytes)
+{
+    ULONGLONG                       ullFrames = (ULONGLONG)BENCH_HOURS * 3600 * ulSampleRate;
+    ULONG                           ulEntries = (ULONG)((ullFrames + RECORD_INDEX_BLOCK_FRAMES - 1) / RECORD_INDEX_BLOCK_FRAMES);
+    std::vector<RECORD_INDEX_ENTRY> entries(ulEntries);
+    LONGLONG                        llSpan;
+    ULONGLONG                       ullState = 88172645463325252ULL;
+    ULONGLONG                       ullSum = 0;
+    double                          dStart;
+    double                          dIndexed;
+    double                          dLinear;
+
+    // One segment, 80 byte header, with a little clock jitter on the times.
+    for (ULONG i = 0; i < ulEntries; i++)
+    {
+        entries[i].llQpc = (LONGLONG)i * RECORD_INDEX_BLOCK_FRAMES * BENCH_QPC_FREQUENCY / ulSampleRate +
+                           (LONGLONG)(Random(&ullState) % 200);
+        entries[i].ullOffset = 80 + (ULONGLONG)i * RECORD_INDEX_BLOCK_FRAMES * ulFrameBytes;
+    }
+    llSpan = entries[ulEntries - 1].llQpc + RECORD_INDEX_BLOCK_FRAMES * BENCH_QPC_FREQUENCY / ulSampleRate;
+
+    dStart = BenchSeconds();
+    for (ULONG i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        LONGLONG llQpc = (LONGLONG)(Random(&ullState) % (ULONGLONG)llSpan);
+        ULONG ulEntry = RecordIndexFind(entries.data(), ulEntries, llQpc);
+
+        ullSum += SeekOffset(entries.data(), ulEntry, llQpc, ulSampleRate, ulFrameBytes);
+    }
+    dIndexed = (BenchSeconds() - dStart) / BENCH_LOOKUPS;
+
+    dStart = BenchSeconds();
+    for (ULONG i = 0; i < BENCH_LINEAR_LOOKUPS; i++)
+    {
+        LONGLONG llQpc = (LONGLONG)(Random(&ullState) % (ULONGLONG)llSpan);
+        ULONG ulEntry = LinearFind(entries.data(), ulEntries, llQpc);
+
+        ullSum += SeekOffset(entries.data(), ulEntry, llQpc, ulSampleRate, ulFrameBytes);
+    }
+    dLinear = (BenchSeconds() - dStart) / BENCH_LINEAR_LOOKUPS;
+    BenchKeep(ullSum);
+
+    printf("%6u Hz, %2u byte frames: %7u entries (%5zu KB index), seek %6.0f ns, linear scan %9.0f ns\n",
+           ulSampleRate, ulFrameBytes, ulEntries, entries.size() * sizeof(RECORD_INDEX_ENTRY) / 1024,
+           dIndexed * 1e9, dLinear * 1e9);
+}
+
+//=============================================================================
+int main()
+{
+    BenchSeek(48000, 4);
+    BenchSeek(192000, 8);
+    BenchSeek(384000, 32);
+
+    return 0;
+}
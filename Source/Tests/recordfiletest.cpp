@@ -0,0 +1,365 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    recordfiletest.cpp
+
+Abstract:
+
+    The recording file layout: WAVE headers on both sides of the 4 GB
+    RIFF/RF64 switch, read back by walking their chunks; segment rollover
+    and the index entries of WAVE segments, driven the way CSaveData's
+    WaveWrite drives RecordGetWaveRun, every entry of which must sit on a
+    block boundary of its segment; and the index search.
+--*/
+
+#include "recordfile.h"
+#include "testutil.h"
+
+#include <vector>
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+static ULONG GetUlong(const BYTE *p)
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+static ULONGLONG GetUlonglong(const BYTE *p)
+{
+    return GetUlong(p) | ((ULONGLONG)GetUlong(p + 4) << 32);
+}
+
+//=============================================================================
+// WAVE/RF64 header
+//=============================================================================
+
+typedef struct _PARSED_WAVE_HEADER
+{
+    BOOL        bRf64;
+    ULONGLONG   ullRiffBytes;
+    ULONGLONG   ullDataBytes;
+    ULONGLONG   ullSampleCount;     // RF64 only.
+    ULONG       ulDataOffset;
+    ULONG       ulFormatOffset;
+    ULONG       cbFormat;
+    BOOL        bJunk;
+} PARSED_WAVE_HEADER;
+
+//
+// Walks the chunks like a reader would, taking the 64-bit sizes from ds64
+// when the 32-bit fields say so. Returns FALSE for anything malformed.
+//
+static BOOL ParseWaveHeader(const BYTE *pHeader, ULONG cbHeader, PARSED_WAVE_HEADER *pParsed)
+{
+    ULONG ulOffset = 12;
+
+    *pParsed = PARSED_WAVE_HEADER();
+
+    if (cbHeader < 12 || memcmp(pHeader + 8, "WAVE", 4) != 0)
+    {
+        return FALSE;
+    }
+
+    pParsed->bRf64 = (memcmp(pHeader, "RF64", 4) == 0);
+    if (!pParsed->bRf64 && memcmp(pHeader, "RIFF", 4) != 0)
+    {
+        return FALSE;
+    }
+    pParsed->ullRiffBytes = GetUlong(pHeader + 4);
+
+    while (ulOffset + 8 <= cbHeader)
+    {
+        const BYTE *    pChunk = pHeader + ulOffset;
+        ULONG           cbChunk = GetUlong(pChunk + 4);
+
+        if (memcmp(pChunk, "ds64", 4) == 0)
+        {
+            // Must come first, and only in RF64.
+            if (!pParsed->bRf64 || ulOffset != 12 || cbChunk < 28 || pParsed->ullRiffBytes != 0xFFFFFFFF)
+            {
+                return FALSE;
+            }
+            pParsed->ullRiffBytes = GetUlonglong(pChunk + 8);
+            pParsed->ullDataBytes = GetUlonglong(pChunk + 16);
+            pParsed->ullSampleCount = GetUlonglong(pChunk + 24);
+            if (GetUlong(pChunk + 32) != 0)
+            {
+                return FALSE;
+            }
+        }
+        else if (memcmp(pChunk, "JUNK", 4) == 0)
+        {
+            pParsed->bJunk = TRUE;
+        }
+        else if (memcmp(pChunk, "fmt ", 4) == 0)
+        {
+            pParsed->ulFormatOffset = ulOffset + 8;
+            pParsed->cbFormat = cbChunk;
+        }
+        else if (memcmp(pChunk, "data", 4) == 0)
+        {
+            ULONG cbData = GetUlong(pChunk + 4);
+
+            if (pParsed->bRf64 ? (cbData != 0xFFFFFFFF) : FALSE)
+            {
+                return FALSE;
+            }
+            if (!pParsed->bRf64)
+            {
+                pParsed->ullDataBytes = cbData;
+            }
+            pParsed->ulDataOffset = ulOffset + 8;
+            return pParsed->cbFormat != 0;
+        }
+        else
+        {
+            return FALSE;
+        }
+
+        // Chunks are padded to even sizes.
+        ulOffset += 8 + ((cbChunk + 1) & ~1UL);
+    }
+
+    return FALSE;
+}
+
+//=============================================================================
+static VOID TestWaveHeader()
+{
+    // PCM WAVEFORMAT, WAVEFORMATEX, an odd size that needs a pad byte, and
+    // WAVEFORMATEXTENSIBLE.
+    static const ULONG formatSizes[] = { 16, 18, 21, 40 };
+    BYTE format[RECORD_WAVE_MAX_FORMAT_BYTES + 1];
+    BYTE header[RECORD_WAVE_MAX_HEADER_BYTES];
+
+    for (ULONG i = 0; i < sizeof(format); i++)
+    {
+        format[i] = (BYTE)(0xA0 + i);
+    }
+
+    for (ULONG f = 0; f < ARRAYSIZE(formatSizes); f++)
+    {
+        ULONG       cbFormat = formatSizes[f];
+        ULONG       cbHeader = RecordGetWaveHeaderBytes(cbFormat);
+        ULONG       ulBlockAlign = 6;
+
+        // The largest RIFF is 4 GB - 1 counted from after the size field.
+        ULONGLONG   ullLastRiff = 0xFFFFFFFFULL - (cbHeader - 8);
+        ULONGLONG   dataSizes[] = { 0, 1000, ullLastRiff - 1, ullLastRiff, ullLastRiff + 1, 5ULL << 30, 1ULL << 40 };
+
+        for (ULONG d = 0; d < ARRAYSIZE(dataSizes); d++)
+        {
+            ULONGLONG           ullData = dataSizes[d];
+            PARSED_WAVE_HEADER  parsed;
+            BOOL                bRf64 = (ullData > ullLastRiff);
+
+            memset(header, 0xEE, sizeof(header));
+            TEST_CHECK(RecordBuildWaveHeader(header, format, cbFormat, ulBlockAlign, ullData) == cbHeader);
+            TEST_CHECK(ParseWaveHeader(header, cbHeader, &parsed));
+
+            TEST_CHECK(parsed.bRf64 == bRf64);
+            TEST_CHECK(parsed.bJunk == !bRf64);
+            TEST_CHECK(parsed.ullRiffBytes == cbHeader - 8 + ullData);
+            TEST_CHECK(parsed.ullDataBytes == ullData);
+            TEST_CHECK(!bRf64 || parsed.ullSampleCount == ullData / ulBlockAlign);
+
+            // Same layout either way, so the switch only rewrites the header.
+            TEST_CHECK(parsed.ulDataOffset == cbHeader);
+            TEST_CHECK(parsed.ulFormatOffset == 12 + 36 + 8);
+            TEST_CHECK(parsed.cbFormat == cbFormat);
+            TEST_CHECK(memcmp(header + parsed.ulFormatOffset, format, cbFormat) == 0);
+            TEST_CHECK((cbFormat & 1) == 0 || header[parsed.ulFormatOffset + cbFormat] == 0);
+            TEST_CHECK(header[cbHeader] == 0xEE);
+        }
+    }
+
+    TEST_CHECK(RecordBuildWaveHeader(header, format, RECORD_WAVE_MAX_FORMAT_BYTES + 1, 4, 0) == 0);
+    TEST_CHECK(RecordBuildWaveHeader(header, format, 16, 0, 0) == 0);
+}
+
+//=============================================================================
+// Segments and index entries
+//=============================================================================
+
+typedef struct _TEST_SEGMENT
+{
+    ULONGLONG                       ullRingStart;
+    ULONGLONG                       ullBytes;
+    std::vector<RECORD_INDEX_ENTRY> entries;    // llQpc holds the ring offset.
+} TEST_SEGMENT;
+
+//
+// Writes ullTotal stream bytes in pieces of cbWrite, or of random size if
+// 0, splitting and indexing them the way CSaveData::WaveWrite does, and
+// checks every segment.
+//
+static VOID RunWaveWrites(ULONG ulFrameBytes, ULONGLONG ullMaxBytes, ULONGLONG ullMaxFrames, ULONG cbWrite, ULONGLONG ullTotal)
+{
+    const ULONG                 cbHeader = 80;
+    ULONGLONG                   ullBlockBytes = (ULONGLONG)RECORD_INDEX_BLOCK_FRAMES * ulFrameBytes;
+    CSegmentPolicy              policy;
+    std::vector<TEST_SEGMENT>   segments(1);
+    ULONGLONG                   ullRing = 0;
+    ULONG                       ulState = ulFrameBytes;
+    ULONG                       ulEmptyRolls = 0;
+    ULONG                       ulBadEntries = 0;
+    ULONG                       ulBadSegments = 0;
+
+    policy.Init(ullMaxBytes, ullMaxFrames);
+
+    while (ullRing < ullTotal)
+    {
+        ULONG cbData = cbWrite ? cbWrite : 1 + Random(&ulState) % 200000;
+
+        cbData = (ULONG)((cbData < ullTotal - ullRing) ? cbData : ullTotal - ullRing);
+        while (cbData > 0)
+        {
+            TEST_SEGMENT *  pSegment = &segments.back();
+            RECORD_WAVE_RUN run;
+
+            RecordGetWaveRun(&policy, ulFrameBytes, pSegment->ullBytes, cbData, &run);
+
+            if (run.cbRun == 0)
+            {
+                // A roll must leave something behind to make progress.
+                ulEmptyRolls += (pSegment->ullBytes == 0);
+                segments.push_back(TEST_SEGMENT());
+                segments.back().ullRingStart = ullRing;
+                continue;
+            }
+
+            for (ULONG i = 0; i < run.ulBlocks; i++)
+            {
+                ULONGLONG           ullBlock = run.ullFirstBlock + i * ullBlockBytes;
+                RECORD_INDEX_ENTRY  entry;
+
+                entry.llQpc = (LONGLONG)(ullRing + (ullBlock - pSegment->ullBytes));
+                entry.ullOffset = cbHeader + ullBlock;
+                pSegment->entries.push_back(entry);
+            }
+
+            pSegment->ullBytes += run.cbRun;
+            ullRing += run.cbRun;
+            cbData -= run.cbRun;
+        }
+    }
+
+    for (size_t s = 0; s < segments.size(); s++)
+    {
+        const TEST_SEGMENT *    pSegment = &segments[s];
+        BOOL                    bLast = (s + 1 == segments.size());
+        ULONGLONG               ullFrames = pSegment->ullBytes / ulFrameBytes;
+
+        // Entry k of a segment is block k: on a block boundary of the file,
+        // at the ring position of that same byte, on a frame boundary of
+        // the stream, and every block has one.
+        for (size_t k = 0; k < pSegment->entries.size(); k++)
+        {
+            const RECORD_INDEX_ENTRY *pEntry = &pSegment->entries[k];
+
+            ulBadEntries += (pEntry->ullOffset != cbHeader + k * ullBlockBytes);
+            ulBadEntries += ((ULONGLONG)pEntry->llQpc != pSegment->ullRingStart + k * ullBlockBytes);
+            ulBadEntries += ((ULONGLONG)pEntry->llQpc % ulFrameBytes != 0);
+        }
+        ulBadEntries += (pSegment->entries.size() != (pSegment->ullBytes + ullBlockBytes - 1) / ullBlockBytes);
+
+        // Segments hold whole frames and end on the frame that fills them.
+        if (!bLast)
+        {
+            ulBadSegments += (pSegment->ullBytes % ulFrameBytes != 0);
+            ulBadSegments += !policy.IsFull(pSegment->ullBytes, ullFrames);
+            ulBadSegments += policy.IsFull(pSegment->ullBytes - ulFrameBytes, ullFrames - 1);
+        }
+    }
+
+    printf("%2u byte frames, limits %llu bytes / %llu frames, %u byte writes: %zu segments\n",
+           ulFrameBytes, (unsigned long long)ullMaxBytes, (unsigned long long)ullMaxFrames, cbWrite, segments.size());
+
+    TEST_CHECK(ullRing == ullTotal);
+    TEST_CHECK(ulEmptyRolls == 0);
+    TEST_CHECK(ulBadEntries == 0);
+    TEST_CHECK(ulBadSegments == 0);
+    TEST_CHECK(ullMaxBytes == 0 && ullMaxFrames == 0 ? segments.size() == 1 : segments.size() > 2);
+}
+
+//=============================================================================
+static VOID TestWaveRuns()
+{
+    static const ULONG frameSizes[] = { 4, 6, 24, 32 };
+
+    for (ULONG f = 0; f < ARRAYSIZE(frameSizes); f++)
+    {
+        ULONG       ulFrameBytes = frameSizes[f];
+        ULONGLONG   ullBlockBytes = (ULONGLONG)RECORD_INDEX_BLOCK_FRAMES * ulFrameBytes;
+        ULONGLONG   ullTotal = 20 * ullBlockBytes + 12345 * ulFrameBytes + 1;
+
+        // No limit, a byte limit that is not a whole number of frames, a
+        // frame limit that is not a whole number of blocks, and both.
+        RunWaveWrites(ulFrameBytes, 0, 0, 0, ullTotal);
+        RunWaveWrites(ulFrameBytes, 3 * ullBlockBytes + 1001, 0, 0, ullTotal);
+        RunWaveWrites(ulFrameBytes, 0, 5 * RECORD_INDEX_BLOCK_FRAMES / 2, 0, ullTotal);
+        RunWaveWrites(ulFrameBytes, 4 * ullBlockBytes, 7 * RECORD_INDEX_BLOCK_FRAMES / 2 + 3, 0, ullTotal);
+
+        // Writes and segments that end exactly on block boundaries.
+        RunWaveWrites(ulFrameBytes, 2 * ullBlockBytes, 0, (ULONG)ullBlockBytes / 2, ullTotal);
+        RunWaveWrites(ulFrameBytes, 0, 3 * RECORD_INDEX_BLOCK_FRAMES, (ULONG)ullBlockBytes, ullTotal);
+    }
+}
+
+//=============================================================================
+static VOID TestSegmentPolicy()
+{
+    CSegmentPolicy policy;
+
+    policy.Init(1000, 0);
+    TEST_CHECK(policy.GetRemainingFrames(0, 0, 6) == 167);
+    TEST_CHECK(policy.GetRemainingFrames(996, 166, 6) == 1);
+    TEST_CHECK(policy.IsFull(1002, 167));
+    TEST_CHECK(policy.GetRemainingFrames(1002, 167, 6) == 0);
+
+    policy.Init(0, 480000);
+    TEST_CHECK(policy.GetRemainingFrames(0, 479999, 4) == 1);
+    TEST_CHECK(policy.IsFull(0, 480000));
+
+    policy.Init(0, 0);
+    TEST_CHECK(!policy.IsFull(~0ULL, ~0ULL));
+}
+
+//=============================================================================
+static VOID TestIndexFind()
+{
+    RECORD_INDEX_ENTRY entries[100];
+
+    for (ULONG i = 0; i < ARRAYSIZE(entries); i++)
+    {
+        entries[i].llQpc = 1000 + (LONGLONG)i * 10;
+        entries[i].ullOffset = i;
+    }
+
+    TEST_CHECK(RecordIndexFind(entries, ARRAYSIZE(entries), 0) == 0);
+    TEST_CHECK(RecordIndexFind(entries, ARRAYSIZE(entries), 1000) == 0);
+    TEST_CHECK(RecordIndexFind(entries, ARRAYSIZE(entries), 1009) == 0);
+    TEST_CHECK(RecordIndexFind(entries, ARRAYSIZE(entries), 1010) == 1);
+    TEST_CHECK(RecordIndexFind(entries, ARRAYSIZE(entries), 1985) == 98);
+    TEST_CHECK(RecordIndexFind(entries, ARRAYSIZE(entries), 1LL << 40) == 99);
+    TEST_CHECK(RecordIndexFind(entries, 1, 5000) == 0);
+    TEST_CHECK(RecordIndexFind(entries, 0, 5000) == 0);
+}
+
+//=============================================================================
+int main()
+{
+    TestWaveHeader();
+    TestSegmentPolicy();
+    TestWaveRuns();
+    TestIndexFind();
+
+    return TestResult("recordfile");
+}
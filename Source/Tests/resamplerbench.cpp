@@ -0,0 +1,129 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    resamplerbench.cpp
+
+Abstract:
+
+    CPU per converted stream: CResampler on 1 ms output blocks of 16-bit
+    audio, stereo and 7.1, for each quality tier and a spread of ratios,
+    with the fixed bank and with the adjustable, interpolated one. Also
+    how long building each bank takes, in total and per Build call.
+--*/
+
+#include "resampler.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define BENCH_BLOCKS            2000
+#define BENCH_BUFFER_BLOCKS     10      // A 10 ms DMA buffer, cycled.
+#define BENCH_BUILD_BUDGET      1024
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// Seconds to produce one 1 ms block of output, writing the input it asks
+// for from a buffer of BENCH_BUFFER_BLOCKS ms.
+//
+static double TimeBlocks(CResampler *pResampler, const std::vector<SHORT> &input, std::vector<SHORT> *pOutput,
+                         ULONG ulInRate, ULONG ulOutRate, ULONG ulChannels, ULONG ulBlocks)
+{
+    ULONG   ulInFrames = ulInRate / 1000 * BENCH_BUFFER_BLOCKS;
+    ULONG   ulBlockFrames = ulOutRate / 1000;
+    ULONG   ulPosition = 0;
+    double  dStart = BenchSeconds();
+
+    for (ULONG b = 0; b < ulBlocks; b++)
+    {
+        SHORT * psOutput = &(*pOutput)[(b % BENCH_BUFFER_BLOCKS) * ulBlockFrames * ulChannels];
+        ULONG   ulProduced = 0;
+
+        while (ulProduced < ulBlockFrames)
+        {
+            ULONG ulNeeded = pResampler->GetInputFrames(ulBlockFrames - ulProduced);
+
+            ulNeeded = ulNeeded < ulInFrames - ulPosition ? ulNeeded : ulInFrames - ulPosition;
+            ulPosition += pResampler->Write((const BYTE *)&input[ulPosition * ulChannels], ulNeeded);
+            ulPosition = ulPosition < ulInFrames ? ulPosition : 0;
+            ulProduced += pResampler->Read((PBYTE)&psOutput[ulProduced * ulChannels], ulBlockFrames - ulProduced);
+        }
+    }
+    BenchKeep((*pOutput)[0]);
+
+    return (BenchSeconds() - dStart) / ulBlocks;
+}
+
+//=============================================================================
+static VOID BenchRatio(ULONG ulInRate, ULONG ulOutRate, ULONG ulChannels, eResamplerQuality eQuality)
+{
+    static const char * tierNames[] = { "low", "medium", "high" };
+    std::vector<BYTE>   storage(CResampler::GetStorageBytes(ulChannels));
+    std::vector<SHORT>  input(ulInRate / 1000 * BENCH_BUFFER_BLOCKS * ulChannels);
+    std::vector<SHORT>  output(ulOutRate / 1000 * BENCH_BUFFER_BLOCKS * ulChannels);
+    ULONG               ulState = 1;
+    double              dSeconds[2];
+    double              dBuild = 0;
+    ULONG               ulCalls = 0;
+
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        input[i] = (SHORT)((LONG)(Random(&ulState) & 0xFFFF) - 0x8000) / 4;
+    }
+
+    for (ULONG bAdjustable = FALSE; bAdjustable <= TRUE; bAdjustable++)
+    {
+        CResampler  resampler;
+        double      dStart;
+
+        resampler.Init(ulInRate, 16, FALSE, ulOutRate, 16, FALSE, ulChannels, eQuality, bAdjustable,
+                       storage.data(), (ULONG)storage.size());
+
+        dStart = BenchSeconds();
+        for (ulCalls = 1; !resampler.Build(BENCH_BUILD_BUDGET); ulCalls++)
+        {
+        }
+        dBuild = BenchSeconds() - dStart;
+
+        resampler.SetAdjustment(bAdjustable ? 100 * 1074 : 0);     // About 100 ppm.
+        TimeBlocks(&resampler, input, &output, ulInRate, ulOutRate, ulChannels, 100);
+        dSeconds[bAdjustable] = TimeBlocks(&resampler, input, &output, ulInRate, ulOutRate, ulChannels, BENCH_BLOCKS);
+    }
+
+    printf("%-6s %6u -> %6u Hz %u ch: %7.2f us per 1 ms block (%5.2f%% of real time), adjustable %7.2f us, "
+           "build %6.0f us in %3u calls\n",
+           tierNames[eQuality], ulInRate, ulOutRate, ulChannels,
+           dSeconds[0] * 1e6, dSeconds[0] * 1e5, dSeconds[1] * 1e6, dBuild * 1e6, ulCalls);
+}
+
+//=============================================================================
+int main()
+{
+    static const ULONG ratios[][2] =
+    {
+        { 44100, 48000 },
+        { 48000, 44100 },
+        { 16000, 48000 },
+        { 48000, 16000 },
+        { 96000, 48000 },
+        { 384000, 48000 },
+    };
+
+    for (ULONG q = 0; q < eResamplerQualityCount; q++)
+    {
+        for (ULONG r = 0; r < ARRAYSIZE(ratios); r++)
+        {
+            BenchRatio(ratios[r][0], ratios[r][1], 2, (eResamplerQuality)q);
+            BenchRatio(ratios[r][0], ratios[r][1], 8, (eResamplerQuality)q);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    resamplertest.cpp
+
+Abstract:
+
+    CResampler: SNR of a converted tone, passband ripple and alias
+    rejection per quality tier, and the rate trim SetAdjustment applies.
+--*/
+
+#include "resampler.h"
+#include "testutil.h"
+
+#include <math.h>
+#include <vector>
+
+#define TEST_PI     3.14159265358979323846
+
+static std::vector<BYTE>    g_Storage(CResampler::GetStorageBytes(1));
+
+//
+// Converts mono float at ulInRate to ulOutRate, in blocks of ulBlock output
+// frames, until the input runs out.
+//
+static std::vector<float> Convert
+(
+    const std::vector<float> &  input,
+    ULONG                       ulInRate,
+    ULONG                       ulOutRate,
+    eResamplerQuality           eQuality,
+    LONG                        lAdjustment,
+    ULONG                       ulBlock
+)
+{
+    CResampler          resampler;
+    std::vector<float>  output;
+    std::vector<float>  block(ulBlock);
+    size_t              position = 0;
+
+    if (!resampler.Init(ulInRate, 32, TRUE, ulOutRate, 32, TRUE, 1, eQuality, lAdjustment != 0,
+                        g_Storage.data(), (ULONG)g_Storage.size()))
+    {
+        return output;
+    }
+
+    while (!resampler.Build(1024))
+    {
+    }
+    resampler.SetAdjustment(lAdjustment);
+
+    for (;;)
+    {
+        ULONG ulNeed = resampler.GetInputFrames(ulBlock);
+        ULONG ulGot;
+
+        if (ulNeed > input.size() - position)
+        {
+            ulNeed = (ULONG)(input.size() - position);
+        }
+        position += resampler.Write((const BYTE *)&input[position], ulNeed);
+
+        ulGot = resampler.Read((PBYTE)block.data(), ulBlock);
+        output.insert(output.end(), block.begin(), block.begin() + ulGot);
+
+        if (ulGot == 0 && position == input.size())
+        {
+            break;
+        }
+    }
+
+    return output;
+}
+
+static std::vector<float> Tone(double dFrequency, ULONG ulRate, size_t frames, double dAmplitude)
+{
+    std::vector<float> tone(frames);
+
+    for (size_t i = 0; i < frames; i++)
+    {
+        tone[i] = (float)(dAmplitude * sin(2 * TEST_PI * dFrequency * i / ulRate));
+    }
+
+    return tone;
+}
+
+//
+// Least squares fit of a sine at dFrequency over the middle half of the
+// signal, so the filter's start-up and tail are left out. Returns the
+// amplitude and the RMS of what the fit leaves.
+//
+static VOID FitTone
+(
+    const std::vector<float> &  signal,
+    ULONG                       ulRate,
+    double                      dFrequency,
+    double *                    pdAmplitude,
+    double *                    pdResidual
+)
+{
+    size_t  first = signal.size() / 4;
+    size_t  last = signal.size() * 3 / 4;
+    double  cc = 0, ss = 0, cs = 0, yc = 0, ys = 0, e = 0;
+    double  a, b, det;
+
+    for (size_t i = first; i < last; i++)
+    {
+        double w = 2 * TEST_PI * dFrequency * i / ulRate;
+
+        cc += cos(w) * cos(w);
+        ss += sin(w) * sin(w);
+        cs += cos(w) * sin(w);
+        yc += signal[i] * cos(w);
+        ys += signal[i] * sin(w);
+    }
+
+    det = cc * ss - cs * cs;
+    a = (yc * ss - ys * cs) / det;
+    b = (ys * cc - yc * cs) / det;
+
+    for (size_t i = first; i < last; i++)
+    {
+        double w = 2 * TEST_PI * dFrequency * i / ulRate;
+        double r = signal[i] - (a * cos(w) + b * sin(w));
+
+        e += r * r;
+    }
+
+    *pdAmplitude = sqrt(a * a + b * b);
+    *pdResidual = sqrt(e / (last - first));
+}
+
+static const ULONG g_RatePairs[][2] =
+{
+    { 44100, 48000 }, { 48000, 44100 }, { 16000, 48000 }, { 48000, 16000 },
+    { 96000, 48000 }, { 48000, 22050 }, { 192000, 44100 }, { 11025, 48000 },
+};
+
+//=============================================================================
+static VOID TestSnr()
+{
+    for (ULONG q = 0; q < eResamplerQualityCount; q++)
+    {
+        for (ULONG p = 0; p < ARRAYSIZE(g_RatePairs); p++)
+        {
+            ULONG   ulIn = g_RatePairs[p][0];
+            ULONG   ulOut = g_RatePairs[p][1];
+            double  dAmplitude, dResidual, dSnr;
+
+            // 997 Hz at -1 dBFS, half a second; the block size is odd on purpose.
+            std::vector<float> out = Convert(Tone(997, ulIn, ulIn / 2, 0.891), ulIn, ulOut, (eResamplerQuality)q, 0, 441);
+
+            TEST_CHECK(out.size() > ulOut / 4);
+            if (out.size() <= ulOut / 4)
+            {
+                continue;
+            }
+
+            FitTone(out, ulOut, 997, &dAmplitude, &dResidual);
+            dSnr = 20 * log10(dAmplitude / sqrt(2) / dResidual);
+
+            printf("quality %u %6u -> %6u: SNR %6.1f dB\n", q, ulIn, ulOut, dSnr);
+            TEST_CHECK(dSnr >= 90);
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestPassbandAndAliasing()
+{
+    // Passband checked, as a fraction of the lower Nyquist rate.
+    static const double edges[eResamplerQualityCount] = { 0.55, 0.70, 0.80 };
+
+    for (ULONG q = eResamplerMedium; q < eResamplerQualityCount; q++)
+    {
+        for (ULONG p = 0; p < 2; p++)
+        {
+            ULONG   ulIn = g_RatePairs[p][0];
+            ULONG   ulOut = g_RatePairs[p][1];
+            double  dNyquist = (ulIn < ulOut ? ulIn : ulOut) / 2.0;
+            double  dMin = 1e9, dMax = -1e9;
+
+            for (ULONG k = 1; k <= 12; k++)
+            {
+                double  dFrequency = edges[q] * dNyquist * k / 12;
+                double  dAmplitude, dResidual, dGain;
+
+                std::vector<float> out = Convert(Tone(dFrequency, ulIn, ulIn / 2, 0.5), ulIn, ulOut, (eResamplerQuality)q, 0, 480);
+
+                FitTone(out, ulOut, dFrequency, &dAmplitude, &dResidual);
+                dGain = 20 * log10(dAmplitude / 0.5);
+                dMin = dGain < dMin ? dGain : dMin;
+                dMax = dGain > dMax ? dGain : dMax;
+            }
+
+            printf("quality %u %6u -> %6u: ripple %.4f dB\n", q, ulIn, ulOut, dMax - dMin);
+            TEST_CHECK(dMax - dMin <= 0.1);
+        }
+
+        // A tone 10% above the output Nyquist rate must not fold back.
+        {
+            double  dFrequency = 8000 * 1.1;
+            double  dEnergy = 0;
+            double  dRejection;
+
+            std::vector<float> out = Convert(Tone(dFrequency, 48000, 24000, 0.891), 48000, 16000, (eResamplerQuality)q, 0, 160);
+
+            for (size_t i = out.size() / 4; i < out.size() * 3 / 4; i++)
+            {
+                dEnergy += out[i] * out[i];
+            }
+            dRejection = -20 * log10(sqrt(dEnergy / (out.size() / 2)) / (0.891 / sqrt(2)));
+
+            printf("quality %u  48000 ->  16000: alias rejection %.1f dB\n", q, dRejection);
+            TEST_CHECK(dRejection >= 90);
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestAdjustment()
+{
+    static const LONG ppms[] = { -1000, -200, 200, 1000 };
+
+    // 10 s in, against a run trimmed by one Q30 step (an adjustable
+    // converter, like the others), so the filter delay cancels.
+    std::vector<float>  input = Tone(997, 44100, 441000, 0.5);
+    double              dUntrimmed = (double)Convert(input, 44100, 48000, eResamplerMedium, 1, 480).size();
+
+    for (ULONG i = 0; i < ARRAYSIZE(ppms); i++)
+    {
+        LONG    lAdjustment = (LONG)(ppms[i] * 1073.741824);
+        double  dExpected = dUntrimmed / (1 + ppms[i] * 1e-6);
+        double  dActual = (double)Convert(input, 44100, 48000, eResamplerMedium, lAdjustment, 480).size();
+
+        printf("adjustment %5d ppm: %.0f frames, expected %.0f\n", ppms[i], dActual, dExpected);
+        TEST_CHECK(fabs(dActual - dExpected) <= 2);
+    }
+
+    // Beyond the limit the trim is clamped.
+    TEST_CHECK(Convert(input, 44100, 48000, eResamplerMedium, 5000 * 1074, 480).size() ==
+               Convert(input, 44100, 48000, eResamplerMedium, RESAMPLER_MAX_ADJUSTMENT, 480).size());
+}
+
+//=============================================================================
+int main()
+{
+    TestSnr();
+    TestPassbandAndAliasing();
+    TestAdjustment();
+
+    return TestResult("resampler");
+}
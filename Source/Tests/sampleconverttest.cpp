@@ -0,0 +1,268 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    sampleconverttest.cpp
+
+Abstract:
+
+    CSampleConverter: the SSE2 and scalar paths give the same bits for
+    every pair of formats, dithered or not, across a split call; plain
+    conversions are within a destination LSB of the exact value, widening
+    is exact; and the dither is TPDF of +-1 LSB.
+--*/
+
+#include "sampleconvert.h"
+#include "testutil.h"
+
+#include <math.h>
+#include <vector>
+
+// Odd, so the vector kernels' scalar tails run; split at SPLIT_SAMPLES.
+#define TEST_SAMPLES    4103
+#define SPLIT_SAMPLES   1000
+
+static const char *g_FormatNames[eSampleFormatCount] =
+{
+    "u8", "s16", "s24", "s24in32", "s32", "f32"
+};
+
+static ULONG g_ulRandom = 5;
+
+static ULONG Random()
+{
+    g_ulRandom = g_ulRandom * 1103515245 + 12345;
+    return g_ulRandom >> 8;
+}
+
+//
+// Random samples with full scale and overload values mixed in; floats
+// spread over 40 octaves.
+//
+static std::vector<BYTE> MakeSource(eSampleFormat eFormat)
+{
+    ULONG               cbSample = CSampleConverter::GetSampleBytes(eFormat);
+    std::vector<BYTE>   source(TEST_SAMPLES * cbSample);
+
+    for (ULONG i = 0; i < source.size(); i++)
+    {
+        source[i] = (BYTE)Random();
+    }
+
+    for (ULONG i = 0; i < TEST_SAMPLES; i++)
+    {
+        PBYTE p = &source[i * cbSample];
+
+        if (eFormat == eSampleFloat32)
+        {
+            float f = (float)(((double)(Random() & 0xFFFFFF) / 0x800000 - 1) * ldexp(1, -(int)(i % 40)));
+
+            if (i % 97 == 0)
+            {
+                f = (i % 2) ? 1.5f : -1.0f;
+            }
+            memcpy(p, &f, sizeof(f));
+        }
+        else if (eFormat == eSampleS24In32)
+        {
+            p[0] = 0;
+        }
+    }
+
+    if (cbSample == 4 && eFormat != eSampleFloat32)
+    {
+        LONG values[] = { 0x7FFFFF00, (LONG)0x80000000, 0x7FFF8000, 0x00008000 };
+
+        memcpy(source.data(), values, sizeof(values));
+    }
+
+    return source;
+}
+
+//
+// The sample at p as a value in [-1, 1), independently of the
+// converter's own codecs.
+//
+static double Decode(eSampleFormat eFormat, const BYTE *p)
+{
+    switch (eFormat)
+    {
+        case eSampleU8:
+            return ((LONG)p[0] - 128) / 128.0;
+        case eSampleS16:
+            return (SHORT)(p[0] | (p[1] << 8)) / 32768.0;
+        case eSampleS24:
+            return (LONG)(((ULONG)p[0] << 8) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 24)) / 2147483648.0;
+        case eSampleS24In32:
+        case eSampleS32:
+            return (LONG)((ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24)) / 2147483648.0;
+        default:
+        {
+            float f;
+
+            memcpy(&f, p, sizeof(f));
+            return f;
+        }
+    }
+}
+
+static ULONG GetBits(eSampleFormat eFormat)
+{
+    static const ULONG bits[eSampleFormatCount] = { 8, 16, 24, 24, 32, 32 };
+
+    return bits[eFormat];
+}
+
+//=============================================================================
+static VOID TestPaths()
+{
+    for (ULONG s = 0; s < eSampleFormatCount; s++)
+    {
+        for (ULONG d = 0; d < eSampleFormatCount; d++)
+        {
+            eSampleFormat       eSource = (eSampleFormat)s;
+            eSampleFormat       eDestination = (eSampleFormat)d;
+            ULONG               cbSource = CSampleConverter::GetSampleBytes(eSource);
+            ULONG               cbDestination = CSampleConverter::GetSampleBytes(eDestination);
+            std::vector<BYTE>   source = MakeSource(eSource);
+
+            for (ULONG bDither = FALSE; bDither <= TRUE; bDither++)
+            {
+                std::vector<BYTE>   scalar(TEST_SAMPLES * cbDestination);
+                std::vector<BYTE>   vector(TEST_SAMPLES * cbDestination);
+                CSampleConverter    scalarConverter;
+                CSampleConverter    vectorConverter;
+
+                TEST_CHECK(scalarConverter.Init(eSource, eDestination, bDither, eSampleConvertScalar));
+                TEST_CHECK(vectorConverter.Init(eSource, eDestination, bDither, eSampleConvertVector));
+
+                scalarConverter.Convert(source.data(), scalar.data(), SPLIT_SAMPLES);
+                scalarConverter.Convert(source.data() + SPLIT_SAMPLES * cbSource,
+                                        scalar.data() + SPLIT_SAMPLES * cbDestination,
+                                        TEST_SAMPLES - SPLIT_SAMPLES);
+                vectorConverter.Convert(source.data(), vector.data(), SPLIT_SAMPLES);
+                vectorConverter.Convert(source.data() + SPLIT_SAMPLES * cbSource,
+                                        vector.data() + SPLIT_SAMPLES * cbDestination,
+                                        TEST_SAMPLES - SPLIT_SAMPLES);
+
+                if (scalar != vector)
+                {
+                    printf("%s -> %s%s: paths differ\n", g_FormatNames[s], g_FormatNames[d], bDither ? " dithered" : "");
+                }
+                TEST_CHECK(scalar == vector);
+            }
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestAccuracy()
+{
+    for (ULONG s = 0; s < eSampleFormatCount; s++)
+    {
+        for (ULONG d = 0; d < eSampleFormatCount; d++)
+        {
+            eSampleFormat       eSource = (eSampleFormat)s;
+            eSampleFormat       eDestination = (eSampleFormat)d;
+            ULONG               cbSource = CSampleConverter::GetSampleBytes(eSource);
+            ULONG               cbDestination = CSampleConverter::GetSampleBytes(eDestination);
+            std::vector<BYTE>   source = MakeSource(eSource);
+            std::vector<BYTE>   destination(TEST_SAMPLES * cbDestination);
+            CSampleConverter    converter;
+            double              dLsb = ldexp(1, 1 - (int)GetBits(eDestination));
+            double              dMaxError = 0;
+            BOOL                bWidening;
+
+            // Float to float passes values through; nothing to measure.
+            if (eSource == eSampleFloat32 && eDestination == eSampleFloat32)
+            {
+                continue;
+            }
+
+            bWidening = eSource != eSampleFloat32 && eDestination != eSampleFloat32 &&
+                        GetBits(eSource) <= GetBits(eDestination);
+
+            converter.Init(eSource, eDestination, FALSE, eSampleConvertVector);
+            converter.Convert(source.data(), destination.data(), TEST_SAMPLES);
+
+            for (ULONG i = 0; i < TEST_SAMPLES; i++)
+            {
+                double x = Decode(eSource, &source[i * cbSource]);
+                double y = Decode(eDestination, &destination[i * cbDestination]);
+                double dError;
+
+                x = x < -1 ? -1 : (x > 1 - 1 / 2147483648.0 ? 1 - 1 / 2147483648.0 : x);
+
+                if (eDestination == eSampleFloat32)
+                {
+                    // Rounded to the float nearest the Q31 value.
+                    dError = fabs(x - y) / (fabs(x) * ldexp(1, -24) + ldexp(1, -31));
+                }
+                else
+                {
+                    dError = fabs(x - y) / dLsb;
+                }
+
+                dMaxError = dError > dMaxError ? dError : dMaxError;
+            }
+
+            if (bWidening ? dMaxError != 0 : dMaxError > 1)
+            {
+                printf("%s -> %s: error %.3f LSB\n", g_FormatNames[s], g_FormatNames[d], dMaxError);
+            }
+            TEST_CHECK(bWidening ? dMaxError == 0 : dMaxError <= 1);
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestDither()
+{
+    // A constant 0.3 LSB into 16 bits: the mean keeps it, and TPDF makes
+    // the error power 1/4 LSB^2 whatever the input.
+    std::vector<LONG>   source(1 << 20, (LONG)(0.3 * 65536));
+    std::vector<SHORT>  destination(source.size());
+    CSampleConverter    converter;
+    double              dMean = 0;
+    double              dVariance = 0;
+
+    converter.Init(eSampleS32, eSampleS16, TRUE, eSampleConvertVector);
+    converter.Convert((const BYTE *)source.data(), (PBYTE)destination.data(), (ULONG)source.size());
+
+    for (size_t i = 0; i < destination.size(); i++)
+    {
+        dMean += destination[i];
+    }
+    dMean /= destination.size();
+
+    for (size_t i = 0; i < destination.size(); i++)
+    {
+        dVariance += (destination[i] - dMean) * (destination[i] - dMean);
+    }
+    dVariance /= destination.size();
+
+    printf("dither: mean %.4f LSB, variance %.4f\n", dMean, dVariance);
+    TEST_CHECK(fabs(dMean - 0.3) < 0.01);
+    TEST_CHECK(fabs(dVariance - 0.25) < 0.01);
+
+    for (size_t i = 0; i < destination.size(); i++)
+    {
+        if (destination[i] < -1 || destination[i] > 1)
+        {
+            TEST_CHECK(destination[i] >= -1 && destination[i] <= 1);
+            break;
+        }
+    }
+}
+
+//=============================================================================
+int main()
+{
+    TestPaths();
+    TestAccuracy();
+    TestDither();
+
+    return TestResult("sampleconvert");
+}
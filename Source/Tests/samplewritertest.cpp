@@ -0,0 +1,213 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    samplewritertest.cpp
+
+Abstract:
+
+    SampleWriter for every entry of the speaker and microphone array
+    device format tables: GetSampleWriter finds an instance, its frame size
+    is the entry's nBlockAlign, and both the broadcast and the interleaved
+    writer store exactly what a scalar reference encoder does, bit for bit,
+    including clamping of out-of-range input, without writing past the
+    last frame.
+--*/
+
+#include "definitions.h"
+#include "samplewriter.h"
+#include "testutil.h"
+
+#include <math.h>
+
+#include <set>
+#include <tuple>
+#include <vector>
+
+#include "speakerformats.inc"
+#include "micarrayformats.inc"
+
+#define TEST_FRAMES     1024
+#define TEST_GUARD      0xCD
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState;
+}
+
+//
+// The stored bytes for one Q30 sample, worked out in floating point from
+// the format's definition rather than the encoder's shifts.
+//
+static VOID ReferenceEncode(PBYTE p, LONG lSample, ULONG ulBits, BOOL bFloat)
+{
+    double  dSample = (double)lSample / SAMPLE_Q30_ONE;
+    ULONG   ulValue;
+
+    if (bFloat)
+    {
+        float fValue = (float)(dSample > 1.0 ? 1.0 : (dSample < -1.0 ? -1.0 : dSample));
+        memcpy(&ulValue, &fValue, sizeof(ulValue));
+    }
+    else
+    {
+        // Full scale is 2^(bits - 1); truncate toward minus infinity.
+        double dFull = ldexp(1.0, (int)ulBits - 1);
+        double dValue = floor(dSample * dFull);
+
+        dValue = dValue > dFull - 1 ? dFull - 1 : (dValue < -dFull ? -dFull : dValue);
+        ulValue = (ULONG)(LONGLONG)dValue;
+        if (ulBits == 8)
+        {
+            ulValue += 0x80;
+        }
+    }
+
+    for (ULONG i = 0; i < ulBits / 8; i++)
+    {
+        p[i] = (BYTE)(ulValue >> (8 * i));
+    }
+}
+
+//
+// Q30 input: the edges of each format's range, values just inside and
+// outside full scale, the extremes of LONG, then random values across the
+// whole LONG range and across [-1, 1].
+//
+static VOID MakeSamples(std::vector<LONG> *pSamples, ULONG ulState)
+{
+    static const LONG edges[] =
+    {
+        0, 1, -1, 127, -128, 1 << 7, 1 << 15, 1 << 23, -(1 << 7), -(1 << 15), -(1 << 23),
+        SAMPLE_Q30_ONE - 1, SAMPLE_Q30_ONE, SAMPLE_Q30_ONE + 1,
+        -SAMPLE_Q30_ONE + 1, -SAMPLE_Q30_ONE, -SAMPLE_Q30_ONE - 1,
+        0x7FFFFFFF, (LONG)0x80000000,
+        // Float ties: 25 and 26 significant bits.
+        0x1000001, 0x1000003, 0x2000002, 0x2000006, -0x1000001, -0x2000006,
+    };
+
+    for (size_t i = 0; i < pSamples->size(); i++)
+    {
+        if (i < ARRAYSIZE(edges))
+        {
+            (*pSamples)[i] = edges[i];
+        }
+        else if (i % 2)
+        {
+            (*pSamples)[i] = (LONG)Random(&ulState);
+        }
+        else
+        {
+            (*pSamples)[i] = (LONG)(Random(&ulState) % (2 * SAMPLE_Q30_ONE + 1)) - SAMPLE_Q30_ONE;
+        }
+    }
+}
+
+//=============================================================================
+static VOID CheckWriter(const WAVEFORMATEXTENSIBLE *pFormat, const char *pszTable, ULONG ulEntry)
+{
+    SAMPLE_WRITER       writer;
+    ULONG               ulBits = pFormat->Format.wBitsPerSample;
+    ULONG               ulChannels = pFormat->Format.nChannels;
+    BOOL                bFloat = IsEqualGUIDAligned(pFormat->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+    ULONG               ulFrameBytes = pFormat->Format.nBlockAlign;
+    std::vector<LONG>   samples(TEST_FRAMES * ulChannels);
+    std::vector<BYTE>   out(TEST_FRAMES * ulFrameBytes + 16);
+    std::vector<BYTE>   expected(out.size(), TEST_GUARD);
+    ULONG               ulMismatches = 0;
+
+    if (!GetSampleWriter(ulBits, ulChannels, bFloat, &writer))
+    {
+        printf("%s[%u]: no writer for %u-bit%s, %u channels\n",
+               pszTable, ulEntry, ulBits, bFloat ? " float" : "", ulChannels);
+        TEST_CHECK(FALSE);
+        return;
+    }
+    TEST_CHECK(writer.ulFrameBytes == ulFrameBytes);
+    if (writer.ulFrameBytes != ulFrameBytes)
+    {
+        return;
+    }
+
+    MakeSamples(&samples, ulEntry + 1);
+
+    // Broadcast: sample i to every channel of frame i.
+    for (ULONG i = 0; i < TEST_FRAMES; i++)
+    {
+        for (ULONG c = 0; c < ulChannels; c++)
+        {
+            ReferenceEncode(&expected[i * ulFrameBytes + c * ulBits / 8], samples[i], ulBits, bFloat);
+        }
+    }
+    memset(out.data(), TEST_GUARD, out.size());
+    writer.pfnWriteBroadcast(out.data(), samples.data(), TEST_FRAMES);
+    ulMismatches += (memcmp(out.data(), expected.data(), out.size()) != 0);
+
+    // Interleaved: sample i * channels + c to channel c of frame i.
+    for (ULONG i = 0; i < TEST_FRAMES * ulChannels; i++)
+    {
+        ReferenceEncode(&expected[i * ulBits / 8], samples[i], ulBits, bFloat);
+    }
+    memset(out.data(), TEST_GUARD, out.size());
+    writer.pfnWriteInterleaved(out.data(), samples.data(), TEST_FRAMES);
+    ulMismatches += (memcmp(out.data(), expected.data(), out.size()) != 0) * 2;
+
+    if (ulMismatches != 0)
+    {
+        printf("%s[%u]: %u-bit%s, %u channels:%s%s differ from the reference\n",
+               pszTable, ulEntry, ulBits, bFloat ? " float" : "", ulChannels,
+               (ulMismatches & 1) ? " broadcast" : "", (ulMismatches & 2) ? " interleaved" : "");
+    }
+    TEST_CHECK(ulMismatches == 0);
+}
+
+//=============================================================================
+static VOID TestTable(const KSDATAFORMAT_WAVEFORMATEXTENSIBLE *pTable, ULONG ulEntries, const char *pszTable)
+{
+    std::set<std::tuple<ULONG, ULONG, BOOL>> instances;
+
+    for (ULONG i = 0; i < ulEntries; i++)
+    {
+        const WAVEFORMATEXTENSIBLE *pFormat = &pTable[i].WaveFormatExt;
+
+        CheckWriter(pFormat, pszTable, i);
+        instances.insert(std::make_tuple((ULONG)pFormat->Format.wBitsPerSample,
+                                         (ULONG)pFormat->Format.nChannels,
+                                         IsEqualGUIDAligned(pFormat->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)));
+    }
+
+    printf("%s: %u entries, %zu writer instances\n", pszTable, ulEntries, instances.size());
+}
+
+//=============================================================================
+static VOID TestReference()
+{
+    BYTE bytes[4];
+
+    // The reference itself, on values worked out by hand.
+    ReferenceEncode(bytes, SAMPLE_Q30_ONE / 2, 16, FALSE);
+    TEST_CHECK(bytes[0] == 0x00 && bytes[1] == 0x40);
+    ReferenceEncode(bytes, -1, 24, FALSE);
+    TEST_CHECK(bytes[0] == 0xFF && bytes[1] == 0xFF && bytes[2] == 0xFF);
+    ReferenceEncode(bytes, SAMPLE_Q30_ONE, 8, FALSE);
+    TEST_CHECK(bytes[0] == 0xFF);
+    ReferenceEncode(bytes, -SAMPLE_Q30_ONE, 8, FALSE);
+    TEST_CHECK(bytes[0] == 0x00);
+    ReferenceEncode(bytes, SAMPLE_Q30_ONE, 32, FALSE);
+    TEST_CHECK(bytes[0] == 0xFF && bytes[3] == 0x7F);
+    ReferenceEncode(bytes, -SAMPLE_Q30_ONE / 2, 32, TRUE);
+    TEST_CHECK(bytes[0] == 0x00 && bytes[1] == 0x00 && bytes[2] == 0x00 && bytes[3] == 0xBF);
+}
+
+//=============================================================================
+int main()
+{
+    TestReference();
+    TestTable(SpeakerHostPinSupportedDeviceFormats, ARRAYSIZE(SpeakerHostPinSupportedDeviceFormats), "speaker");
+    TestTable(MicArrayPinSupportedDeviceFormats, ARRAYSIZE(MicArrayPinSupportedDeviceFormats), "micarray");
+
+    return TestResult("samplewriter");
+}
@@ -0,0 +1,155 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    seqlockbench.cpp
+
+Abstract:
+
+    CSeqLockSnapshot under contention: one writer publishing a position
+    sized snapshot while 0 to 16 pollers read it, against the same with a
+    spin lock around both sides. Prints the cost of a publish, of a read,
+    and the retries per read. The times are wall clock, so with fewer
+    processors than threads they include the other side's time slices.
+--*/
+
+#include "seqlock.h"
+#include "benchutil.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define BENCH_SECONDS   0.5
+
+//
+// The size of the stream's POSITION_SNAPSHOT: six position fields and the
+// frame clock.
+//
+typedef struct _BENCH_SNAPSHOT
+{
+    ULONGLONG       ullValues[10];
+} BENCH_SNAPSHOT;
+
+//
+// The lock the snapshot replaced, for comparison.
+//
+class CBenchSpinLock
+{
+    std::atomic_flag    m_Flag = ATOMIC_FLAG_INIT;
+    BENCH_SNAPSHOT      m_Data = {};
+
+public:
+    VOID Publish(const BENCH_SNAPSHOT &Data)
+    {
+        while (m_Flag.test_and_set(std::memory_order_acquire))
+        {
+            VAD_CPU_PAUSE();
+        }
+        m_Data = Data;
+        m_Flag.clear(std::memory_order_release);
+    }
+
+    ULONG Read(BENCH_SNAPSHOT *pData)
+    {
+        while (m_Flag.test_and_set(std::memory_order_acquire))
+        {
+            VAD_CPU_PAUSE();
+        }
+        *pData = m_Data;
+        m_Flag.clear(std::memory_order_release);
+        return 0;
+    }
+};
+
+typedef struct _BENCH_RESULT
+{
+    double          dPublishNs;
+    double          dReadNs;
+    double          dRetriesPerRead;
+} BENCH_RESULT;
+
+template <typename TSnapshot>
+static BENCH_RESULT Run(ULONG ulPollers)
+{
+    TSnapshot                   snapshot;
+    std::atomic<BOOL>           bDone(FALSE);
+    std::vector<std::thread>    pollers;
+    std::atomic<ULONGLONG>      ullReads(0);
+    std::atomic<ULONGLONG>      ullRetries(0);
+    ULONGLONG                   ullPublishes = 0;
+    BENCH_SNAPSHOT              data = {};
+    BENCH_RESULT                result;
+    double                      dStart;
+    double                      dSeconds;
+
+    for (ULONG p = 0; p < ulPollers; p++)
+    {
+        pollers.push_back(std::thread([&]()
+        {
+            BENCH_SNAPSHOT  copy;
+            ULONGLONG       ullMyReads = 0;
+            ULONGLONG       ullMyRetries = 0;
+
+            while (!bDone)
+            {
+                ullMyRetries += snapshot.Read(&copy);
+                ullMyReads++;
+            }
+
+            BenchKeep(copy);
+            ullReads += ullMyReads;
+            ullRetries += ullMyRetries;
+        }));
+    }
+
+    dStart = BenchSeconds();
+    do
+    {
+        for (ULONG i = 0; i < 1000; i++)
+        {
+            data.ullValues[0]++;
+            snapshot.Publish(data);
+        }
+        ullPublishes += 1000;
+        dSeconds = BenchSeconds() - dStart;
+
+        // Lets the pollers run where they share a processor with the writer.
+        std::this_thread::yield();
+    } while (dSeconds < BENCH_SECONDS);
+
+    bDone = TRUE;
+    for (size_t p = 0; p < pollers.size(); p++)
+    {
+        pollers[p].join();
+    }
+
+    // Poller time is the wall time spread over every poller's reads.
+    result.dPublishNs = dSeconds * 1e9 / ullPublishes;
+    result.dReadNs = ullReads ? dSeconds * 1e9 * ulPollers / ullReads : 0;
+    result.dRetriesPerRead = ullReads ? (double)ullRetries / ullReads : 0;
+    return result;
+}
+
+//=============================================================================
+int main()
+{
+    printf("%8s %13s %13s %13s %13s %13s\n",
+           "pollers", "publish ns", "read ns", "retries/read", "lock pub ns", "lock read ns");
+
+    for (ULONG ulPollers = 0; ulPollers <= 16; ulPollers = ulPollers ? ulPollers * 2 : 1)
+    {
+        BENCH_RESULT seqlock = Run<CSeqLockSnapshot<BENCH_SNAPSHOT> >(ulPollers);
+        BENCH_RESULT spinlock = Run<CBenchSpinLock>(ulPollers);
+
+        printf("%8u %13.1f %13.1f %13.3f %13.1f %13.1f\n",
+               ulPollers, seqlock.dPublishNs, seqlock.dReadNs, seqlock.dRetriesPerRead,
+               spinlock.dPublishNs, spinlock.dReadNs);
+    }
+
+    printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    return 0;
+}
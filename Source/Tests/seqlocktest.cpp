@@ -0,0 +1,152 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    seqlocktest.cpp
+
+Abstract:
+
+    CSeqLockSnapshot: with one writer publishing as fast as it can, every
+    snapshot the reader threads copy out is one the writer published whole,
+    never a mix of two, and a reader never sees time go backwards.
+--*/
+
+#include "seqlock.h"
+#include "testutil.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define TEST_PUBLISHES  2000000
+#define TEST_READERS    4
+
+//
+// Large enough that a copy takes a while; every field is derived from
+// ullGeneration, so a mix of two publishes shows. Generation 0 is the
+// zeroed snapshot the readers may see before the first publish.
+//
+typedef struct _TEST_SNAPSHOT
+{
+    ULONGLONG       ullGeneration;
+    ULONGLONG       ullFields[31];
+} TEST_SNAPSHOT;
+
+static VOID MakeSnapshot(TEST_SNAPSHOT *pSnapshot, ULONGLONG ullGeneration)
+{
+    pSnapshot->ullGeneration = ullGeneration;
+    for (ULONG i = 0; i < ARRAYSIZE(pSnapshot->ullFields); i++)
+    {
+        pSnapshot->ullFields[i] = ullGeneration * 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+}
+
+static BOOL IsWhole(const TEST_SNAPSHOT *pSnapshot)
+{
+    for (ULONG i = 0; i < ARRAYSIZE(pSnapshot->ullFields); i++)
+    {
+        if (pSnapshot->ullFields[i] != pSnapshot->ullGeneration * 0x9E3779B97F4A7C15ULL * (i + 1))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+//=============================================================================
+static VOID TestSequence()
+{
+    CSeqLockSnapshot<TEST_SNAPSHOT> snapshot;
+    TEST_SNAPSHOT                   data;
+
+    // Starts out zeroed, and each publish moves the sequence on by two.
+    TEST_CHECK(snapshot.Read(&data) == 0);
+    TEST_CHECK(data.ullGeneration == 0 && data.ullFields[30] == 0);
+    TEST_CHECK(snapshot.GetSequence() == 0);
+
+    MakeSnapshot(&data, 5);
+    snapshot.Publish(data);
+    TEST_CHECK(snapshot.GetSequence() == 2);
+
+    RtlZeroMemory(&data, sizeof(data));
+    TEST_CHECK(snapshot.Read(&data) == 0);
+    TEST_CHECK(data.ullGeneration == 5 && IsWhole(&data));
+}
+
+//=============================================================================
+static VOID TestConcurrent()
+{
+    CSeqLockSnapshot<TEST_SNAPSHOT> snapshot;
+    std::atomic<BOOL>               bWriterDone(FALSE);
+    std::vector<std::thread>        readers;
+    std::atomic<ULONGLONG>          ullReads(0);
+    std::atomic<ULONGLONG>          ullRetries(0);
+    std::atomic<ULONG>              ulTorn(0);
+    std::atomic<ULONG>              ulBackwards(0);
+
+    for (ULONG r = 0; r < TEST_READERS; r++)
+    {
+        readers.push_back(std::thread([&]()
+        {
+            TEST_SNAPSHOT   data;
+            ULONGLONG       ullLast = 0;
+            ULONGLONG       ullMyReads = 0;
+            ULONGLONG       ullMyRetries = 0;
+
+            while (!bWriterDone)
+            {
+                ullMyRetries += snapshot.Read(&data);
+                ullMyReads++;
+
+                if (!IsWhole(&data))
+                {
+                    ulTorn++;
+                }
+                if (data.ullGeneration < ullLast)
+                {
+                    ulBackwards++;
+                }
+                ullLast = data.ullGeneration;
+            }
+
+            ullReads += ullMyReads;
+            ullRetries += ullMyRetries;
+        }));
+    }
+
+    {
+        TEST_SNAPSHOT data;
+
+        for (ULONGLONG g = 1; g <= TEST_PUBLISHES; g++)
+        {
+            MakeSnapshot(&data, g);
+            snapshot.Publish(data);
+        }
+    }
+
+    bWriterDone = TRUE;
+    for (size_t r = 0; r < readers.size(); r++)
+    {
+        readers[r].join();
+    }
+
+    printf("%u readers: %llu reads, %llu retries, %u torn, %u out of order\n",
+           TEST_READERS, (unsigned long long)ullReads, (unsigned long long)ullRetries,
+           (ULONG)ulTorn, (ULONG)ulBackwards);
+
+    TEST_CHECK(ulTorn == 0);
+    TEST_CHECK(ulBackwards == 0);
+    TEST_CHECK(snapshot.GetSequence() == 2 * TEST_PUBLISHES);
+}
+
+//=============================================================================
+int main()
+{
+    TestSequence();
+    TestConcurrent();
+
+    return TestResult("seqlock");
+}
@@ -0,0 +1,118 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    streamschedulerbench.cpp
+
+Abstract:
+
+    Cost of the adapter-wide tick for 1 to 256 running streams: time per
+    1 ms tick and per callback made, against a scan that checks every
+    stream on every tick.
+--*/
+
+#include "streamscheduler.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define TICK_HNS        10000ULL
+#define BENCH_TICKS     60000       // A minute of 1 ms ticks.
+
+typedef struct _BENCH_STREAM
+{
+    ULONGLONG   hnsPeriod;
+    ULONGLONG   hnsNext;
+} BENCH_STREAM;
+
+static ULONGLONG BenchCallback(PVOID Context, ULONGLONG hnsNow)
+{
+    BENCH_STREAM *pStream = (BENCH_STREAM *)Context;
+
+    while (pStream->hnsNext <= hnsNow)
+    {
+        pStream->hnsNext += pStream->hnsPeriod;
+    }
+
+    return pStream->hnsNext;
+}
+
+//
+// The streams use the usual 10 ms packets, with every eighth at 3 ms and
+// every sixteenth at 20 ms, so a few groups are in use.
+//
+static ULONG GetIntervalMs(ULONG i)
+{
+    return (i % 16 == 15) ? 20 : ((i % 8 == 7) ? 3 : 10);
+}
+
+//=============================================================================
+int main()
+{
+    printf("%8s %14s %14s %14s\n", "streams", "ns/tick", "ns/callback", "scan ns/tick");
+
+    for (ULONG n = 1; n <= 256; n *= 2)
+    {
+        CStreamScheduler                scheduler;
+        std::vector<BENCH_STREAM>       streams(n);
+        std::vector<SCHEDULER_ENTRY>    entries(n);
+        ULONGLONG                       ullCalls = 0;
+        double                          dStart;
+        double                          dScheduler;
+        double                          dScan;
+
+        for (ULONG i = 0; i < n; i++)
+        {
+            // Staggered starts, so the deadlines do not all land on one tick.
+            streams[i].hnsPeriod = GetIntervalMs(i) * TICK_HNS;
+            streams[i].hnsNext = (i % GetIntervalMs(i)) * TICK_HNS;
+            CStreamScheduler::InitializeEntry(&entries[i], BenchCallback, &streams[i]);
+            scheduler.Add(&entries[i], GetIntervalMs(i), streams[i].hnsNext);
+        }
+
+        dStart = BenchSeconds();
+        for (ULONG t = 0; t < BENCH_TICKS; t++)
+        {
+            ullCalls += scheduler.Tick(t * TICK_HNS);
+        }
+        dScheduler = BenchSeconds() - dStart;
+
+        // The same work with every deadline checked on every tick.
+        for (ULONG i = 0; i < n; i++)
+        {
+            streams[i].hnsNext = (i % GetIntervalMs(i)) * TICK_HNS;
+            entries[i].hnsDue = streams[i].hnsNext;
+        }
+
+        dStart = BenchSeconds();
+        for (ULONG t = 0; t < BENCH_TICKS; t++)
+        {
+            ULONGLONG hnsNow = t * TICK_HNS;
+
+            for (ULONG i = 0; i < n; i++)
+            {
+                if (entries[i].hnsDue <= hnsNow)
+                {
+                    entries[i].hnsDue = entries[i].pfnCallback(entries[i].Context, hnsNow);
+                }
+            }
+        }
+        dScan = BenchSeconds() - dStart;
+        BenchKeep(entries[0].hnsDue);
+
+        printf("%8u %14.1f %14.1f %14.1f\n",
+               n,
+               dScheduler * 1e9 / BENCH_TICKS,
+               dScheduler * 1e9 / (ullCalls ? ullCalls : 1),
+               dScan * 1e9 / BENCH_TICKS);
+
+        for (ULONG i = 0; i < n; i++)
+        {
+            scheduler.Remove(&entries[i]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    streamschedulertest.cpp
+
+Abstract:
+
+    CStreamScheduler: every stream runs exactly on its own deadlines, DONE
+    and Remove take an entry out, and an entry in its callback is not
+    collected twice.
+--*/
+
+#include "streamscheduler.h"
+#include "testutil.h"
+
+#include <vector>
+
+#define TICK_HNS    10000ULL
+
+typedef struct _TEST_STREAM
+{
+    ULONGLONG   hnsPeriod;
+    ULONGLONG   hnsNext;
+    ULONG       ulCalls;
+    ULONG       ulFires;
+    ULONG       ulFiresLeft;    // DONE after this many, 0 for never
+} TEST_STREAM;
+
+static ULONGLONG PeriodicCallback(PVOID Context, ULONGLONG hnsNow)
+{
+    TEST_STREAM *pStream = (TEST_STREAM *)Context;
+
+    pStream->ulCalls++;
+    if (hnsNow >= pStream->hnsNext)
+    {
+        pStream->ulFires++;
+        pStream->hnsNext += pStream->hnsPeriod;
+    }
+
+    if (pStream->ulFiresLeft != 0 && pStream->ulFires == pStream->ulFiresLeft)
+    {
+        return SCHEDULER_DONE;
+    }
+
+    return pStream->hnsNext;
+}
+
+//=============================================================================
+static VOID TestIntervals()
+{
+    // More streams than groups, so the catch-all group is exercised too.
+    static const ULONG counts[] = { 1, 16, 256 };
+
+    for (ULONG c = 0; c < ARRAYSIZE(counts); c++)
+    {
+        ULONG                           n = counts[c];
+        CStreamScheduler                scheduler;
+        std::vector<TEST_STREAM>        streams(n);
+        std::vector<SCHEDULER_ENTRY>    entries(n);
+
+        for (ULONG i = 0; i < n; i++)
+        {
+            // 3..37 ms; odd periods fall between ticks.
+            streams[i].hnsPeriod = 30000 + (i % 18) * 20000 + (i % 3) * 1000;
+            streams[i].hnsNext = 0;
+            CStreamScheduler::InitializeEntry(&entries[i], PeriodicCallback, &streams[i]);
+            TEST_CHECK(scheduler.Add(&entries[i], 3 + (i % 18) * 2, 0));
+        }
+        TEST_CHECK(!scheduler.Add(&entries[0], 10, 0));
+        TEST_CHECK(scheduler.GetEntryCount() == n);
+
+        // 10 s of 1 ms ticks.
+        for (ULONGLONG hnsNow = 0; hnsNow < 10 * 10000000ULL; hnsNow += TICK_HNS)
+        {
+            scheduler.Tick(hnsNow);
+        }
+
+        for (ULONG i = 0; i < n; i++)
+        {
+            ULONGLONG ullExpected = (10 * 10000000ULL - 1) / streams[i].hnsPeriod + 1;
+
+            TEST_CHECK(streams[i].ulFires == ullExpected);
+            // Never called before it is due.
+            TEST_CHECK(streams[i].ulCalls == streams[i].ulFires);
+        }
+
+        for (ULONG i = 0; i < n; i++)
+        {
+            scheduler.Remove(&entries[i]);
+        }
+        TEST_CHECK(scheduler.GetEntryCount() == 0);
+    }
+}
+
+//=============================================================================
+static VOID TestDone()
+{
+    CStreamScheduler    scheduler;
+    TEST_STREAM         stream = { 100000, 0, 0, 0, 3 };
+    SCHEDULER_ENTRY     entry;
+
+    CStreamScheduler::InitializeEntry(&entry, PeriodicCallback, &stream);
+    scheduler.Add(&entry, 10, 0);
+
+    for (ULONGLONG hnsNow = 0; hnsNow < 10000000ULL; hnsNow += TICK_HNS)
+    {
+        scheduler.Tick(hnsNow);
+    }
+
+    TEST_CHECK(stream.ulFires == 3);
+    TEST_CHECK(scheduler.GetEntryCount() == 0);
+    TEST_CHECK(!entry.bScheduled);
+
+    // Can be scheduled again.
+    TEST_CHECK(scheduler.Add(&entry, 10, 0));
+    scheduler.Remove(&entry);
+}
+
+//=============================================================================
+static VOID TestInCallback()
+{
+    CStreamScheduler    scheduler;
+    TEST_STREAM         stream = { 100000, 0, 0, 0, 0 };
+    SCHEDULER_ENTRY     entry;
+    PSCHEDULER_ENTRY    pBatch;
+
+    CStreamScheduler::InitializeEntry(&entry, PeriodicCallback, &stream);
+    scheduler.Add(&entry, 10, 0);
+
+    // Collected and still running on the next tick: not collected again.
+    pBatch = scheduler.CollectDue(0);
+    TEST_CHECK(pBatch == &entry);
+    TEST_CHECK(CStreamScheduler::IsInCallback(&entry));
+    TEST_CHECK(scheduler.CollectDue(TICK_HNS) == NULL);
+
+    scheduler.Complete(&entry, entry.pfnCallback(entry.Context, 0));
+    TEST_CHECK(!CStreamScheduler::IsInCallback(&entry));
+    TEST_CHECK(scheduler.CollectDue(50000) == NULL);
+    TEST_CHECK(scheduler.CollectDue(100000) == &entry);
+
+    // Removed while in its callback: stays removed.
+    scheduler.Remove(&entry);
+    scheduler.Complete(&entry, entry.pfnCallback(entry.Context, 100000));
+    TEST_CHECK(scheduler.GetEntryCount() == 0);
+    TEST_CHECK(scheduler.CollectDue(~0ULL - 1) == NULL);
+}
+
+//=============================================================================
+int main()
+{
+    TestIntervals();
+    TestDone();
+    TestInCallback();
+
+    return TestResult("streamscheduler");
+}
@@ -0,0 +1,195 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    subdevicetablebench.cpp
+
+Abstract:
+
+    Cost of the adapter's subdevice cache: CSubdeviceTable lookups (hit
+    and miss) and an insert and remove of every record, at 1, 64 and 1024
+    cached subdevices named as the generated endpoints are, against the
+    linked list walk with a name compare per entry that the table
+    replaced.
+--*/
+
+#include "subdevicetable.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define BENCH_OPERATIONS        4000000     // Per measurement.
+#define BENCH_NAME_CHARS        260         // MAX_PATH, as in MINIPAIR_UNKNOWN.
+
+// Twice the slots of the driver's SUBDEVICE_CACHE_SLOTS, to hold 1024.
+#define BENCH_SLOTS             2048
+
+#define BENCH_MISSING           16          // Names not cached, cycled.
+
+//
+// MINIPAIR_UNKNOWN's name and hash, and a link for the list.
+//
+typedef struct _BENCH_RECORD
+{
+    struct _BENCH_RECORD *  pNext;
+    WCHAR                   Name[BENCH_NAME_CHARS];
+    ULONG                   NameHash;
+} BENCH_RECORD;
+
+typedef CSubdeviceTable<BENCH_RECORD, BENCH_SLOTS> CBenchTable;
+
+//
+// The k-th subdevice name: the four templates' names, then "_<pair>" as
+// CEndpointArena makes them.
+//
+static VOID SetName(BENCH_RECORD *pRecord, ULONG k)
+{
+    static const char * templates[] = { "TopologySpeaker", "WaveSpeaker", "TopologyMicArray1", "WaveMicArray1" };
+    char szName[64];
+    ULONG i;
+
+    if (k < ARRAYSIZE(templates))
+    {
+        snprintf(szName, sizeof(szName), "%s", templates[k]);
+    }
+    else
+    {
+        snprintf(szName, sizeof(szName), "%s_%u", templates[k % ARRAYSIZE(templates)], k / (ULONG)ARRAYSIZE(templates));
+    }
+
+    for (i = 0; szName[i] != '\0'; i++)
+    {
+        pRecord->Name[i] = (WCHAR)szName[i];
+    }
+    pRecord->Name[i] = L'\0';
+    pRecord->pNext = NULL;
+    pRecord->NameHash = 0;
+}
+
+static BOOL NamesEqual(PCWSTR pszA, PCWSTR pszB)
+{
+    while (*pszA != L'\0' && *pszA == *pszB)
+    {
+        pszA++;
+        pszB++;
+    }
+
+    return *pszA == *pszB;
+}
+
+//
+// The list the table replaced: newest first, found by name.
+//
+__attribute__((noinline)) static BENCH_RECORD * ListFind(BENCH_RECORD *pHead, PCWSTR pszName)
+{
+    for (; pHead != NULL; pHead = pHead->pNext)
+    {
+        if (NamesEqual(pHead->Name, pszName))
+        {
+            return pHead;
+        }
+    }
+
+    return NULL;
+}
+
+//=============================================================================
+static VOID BenchCount(CBenchTable *pTable, ULONG ulRecords)
+{
+    std::vector<BENCH_RECORD>   records(ulRecords);
+    BENCH_RECORD                missing[BENCH_MISSING];
+    BENCH_RECORD *              pHead = NULL;
+    ULONG                       ulRounds = BENCH_OPERATIONS / ulRecords;
+    ULONG                       ulListRounds = ulRounds / (ulRecords > 64 ? 64 : 1);
+    ULONG                       ulHits = 0;
+    double                      dStart;
+    double                      dFind;
+    double                      dMiss;
+    double                      dChurn;
+    double                      dListFind;
+
+    for (ULONG k = 0; k < ulRecords; k++)
+    {
+        SetName(&records[k], k);
+        records[k].pNext = pHead;
+        pHead = &records[k];
+    }
+    for (ULONG k = 0; k < BENCH_MISSING; k++)
+    {
+        SetName(&missing[k], ulRecords + k);
+        missing[k].NameHash = CBenchTable::Hash(missing[k].Name);
+    }
+
+    pTable->Reset();
+    for (ULONG k = 0; k < ulRecords; k++)
+    {
+        records[k].NameHash = CBenchTable::Hash(records[k].Name);
+        pTable->Insert(&records[k]);
+    }
+
+    // A lookup by name hashes it first.
+    dStart = BenchSeconds();
+    for (ULONG r = 0; r < ulRounds; r++)
+    {
+        for (ULONG k = 0; k < ulRecords; k++)
+        {
+            ulHits += pTable->Find(records[k].Name, CBenchTable::Hash(records[k].Name)) != NULL;
+        }
+    }
+    dFind = (BenchSeconds() - dStart) / ulRounds / ulRecords;
+
+    dStart = BenchSeconds();
+    for (ULONG r = 0; r < ulRounds * ulRecords; r++)
+    {
+        const BENCH_RECORD & probe = missing[r % BENCH_MISSING];
+
+        ulHits += pTable->Find(probe.Name, probe.NameHash) != NULL;
+    }
+    dMiss = (BenchSeconds() - dStart) / ulRounds / ulRecords;
+
+    // Caching a subdevice hashes its name once; removing it reuses that.
+    dStart = BenchSeconds();
+    for (ULONG r = 0; r < ulRounds; r++)
+    {
+        for (ULONG k = 0; k < ulRecords; k++)
+        {
+            ulHits += pTable->Remove(records[k].Name, records[k].NameHash) != NULL;
+        }
+        for (ULONG k = 0; k < ulRecords; k++)
+        {
+            records[k].NameHash = CBenchTable::Hash(records[k].Name);
+            pTable->Insert(&records[k]);
+        }
+    }
+    dChurn = (BenchSeconds() - dStart) / ulRounds / ulRecords;
+
+    dStart = BenchSeconds();
+    for (ULONG r = 0; r < ulListRounds; r++)
+    {
+        for (ULONG k = 0; k < ulRecords; k++)
+        {
+            ulHits += ListFind(pHead, records[k].Name) != NULL;
+        }
+    }
+    dListFind = (BenchSeconds() - dStart) / ulListRounds / ulRecords;
+    BenchKeep(ulHits);
+
+    printf("%4u subdevices: lookup %5.1f ns, miss %5.1f ns, remove and insert %5.1f ns; list lookup %8.1f ns\n",
+           ulRecords, dFind * 1e9, dMiss * 1e9, dChurn * 1e9, dListFind * 1e9);
+}
+
+//=============================================================================
+int main()
+{
+    static CBenchTable  table;
+    static const ULONG  counts[] = { 1, 64, 1024 };
+
+    for (ULONG n = 0; n < ARRAYSIZE(counts); n++)
+    {
+        BenchCount(&table, counts[n]);
+    }
+
+    return 0;
+}
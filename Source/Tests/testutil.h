@@ -0,0 +1,43 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    testutil.h
+
+Abstract:
+
+    Checks shared by the host tests. A failed check prints where it failed
+    and the test keeps going, so one run reports every failure; TestResult
+    turns the count into the exit code ctest reads.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_TESTUTIL_H_
+#define _VIRTUALAUDIODRIVER_TESTUTIL_H_
+
+#include <stdio.h>
+
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(_a)   (sizeof(_a) / sizeof((_a)[0]))
+#endif
+
+static ULONG g_ulTestFailures = 0;
+
+#define TEST_CHECK(_exp)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(_exp))                                                            \
+        {                                                                       \
+            printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #_exp);    \
+            g_ulTestFailures++;                                                 \
+        }                                                                       \
+    } while (0)
+
+inline int TestResult(const char *pszName)
+{
+    printf("%s: %s\n", pszName, g_ulTestFailures == 0 ? "passed" : "FAILED");
+    return g_ulTestFailures == 0 ? 0 : 1;
+}
+
+#endif // _VIRTUALAUDIODRIVER_TESTUTIL_H_
@@ -0,0 +1,103 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    tonecontrolbench.cpp
+
+Abstract:
+
+    Tone control speed: CToneControl::Process on 1 ms blocks of every
+    filtered format, with both shelves set and with both flat, in samples
+    per second and in time per block.
+--*/
+
+#include "tonecontrol.h"
+#include "benchutil.h"
+
+#include <vector>
+
+#define BENCH_SAMPLES           (1 << 24)
+#define BENCH_BUFFER_BLOCKS     10      // A 10 ms DMA buffer, cycled.
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//=============================================================================
+static VOID BenchFormat(ULONG ulSampleRate, ULONG ulBits, ULONG ulChannels, BOOL bFloat)
+{
+    ULONG               ulBlockFrames = ulSampleRate / 1000;
+    ULONG               ulBlockBytes = ulBlockFrames * ulChannels * ulBits / 8;
+    ULONG               ulBlocks = BENCH_SAMPLES / (ulBlockFrames * ulChannels);
+    std::vector<BYTE>   buffer(ulBlockBytes * BENCH_BUFFER_BLOCKS);
+    ULONG               ulState = 1;
+    double              dSeconds[2];
+
+    for (ULONG bFlat = FALSE; bFlat <= TRUE; bFlat++)
+    {
+        LONG            lBass[TONE_MAX_CHANNELS];
+        LONG            lTreble[TONE_MAX_CHANNELS];
+        CToneControl    tone;
+        double          dStart;
+
+        for (size_t i = 0; i < buffer.size(); i++)
+        {
+            buffer[i] = (BYTE)Random(&ulState);
+        }
+
+        // Float samples within [-1, 1].
+        if (bFloat)
+        {
+            for (size_t i = 3; i < buffer.size(); i += 4)
+            {
+                buffer[i] = (buffer[i] & 0x80) | 0x3E;
+            }
+        }
+
+        for (ULONG c = 0; c < TONE_MAX_CHANNELS; c++)
+        {
+            lBass[c] = bFlat ? 0 : 6 * 65536;
+            lTreble[c] = bFlat ? 0 : -3 * 65536;
+        }
+
+        tone.Init(ulSampleRate, ulBits, ulChannels, bFloat);
+        tone.SetTargets(lBass, lTreble);
+
+        // Past the glide.
+        for (ULONG b = 0; b < 20; b++)
+        {
+            tone.Process(&buffer[(b % BENCH_BUFFER_BLOCKS) * ulBlockBytes], ulBlockBytes);
+        }
+
+        dStart = BenchSeconds();
+        for (ULONG b = 0; b < ulBlocks; b++)
+        {
+            tone.Process(&buffer[(b % BENCH_BUFFER_BLOCKS) * ulBlockBytes], ulBlockBytes);
+        }
+        dSeconds[bFlat] = (BenchSeconds() - dStart) / ulBlocks;
+        BenchKeep(buffer[0]);
+    }
+
+    printf("%6u Hz %2u%-1s %u ch: %6.1f Msamples/s, %7.2f us per 1 ms block (%5.2f%% of real time), flat %5.2f us\n",
+           ulSampleRate, ulBits, bFloat ? "f" : "", ulChannels,
+           ulBlockFrames * ulChannels / dSeconds[0] / 1e6, dSeconds[0] * 1e6, dSeconds[0] * 1e5, dSeconds[1] * 1e6);
+}
+
+//=============================================================================
+int main()
+{
+    static const ULONG formats[][2] = { { 16, FALSE }, { 24, FALSE }, { 32, FALSE }, { 32, TRUE } };
+
+    for (ULONG f = 0; f < ARRAYSIZE(formats); f++)
+    {
+        BenchFormat(48000, formats[f][0], 2, formats[f][1]);
+        BenchFormat(384000, formats[f][0], 2, formats[f][1]);
+        BenchFormat(384000, formats[f][0], 8, formats[f][1]);
+    }
+
+    return 0;
+}
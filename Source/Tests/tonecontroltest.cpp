@@ -0,0 +1,276 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    tonecontroltest.cpp
+
+Abstract:
+
+    Frequency response of the tone control: for every bass and treble
+    setting, the gain CToneControl applies at DC, at Nyquist and at the
+    shelf's corner frequency, measured on the filtered audio. A slope 1
+    RBJ shelf has the full setting on its own side, 0 dB on the other and
+    half the setting at the corner; an octave either side of the corner,
+    which depends on the slope, is checked against the exact shelf. Also
+    the noise the fixed point filters add at low level, and that flat
+    leaves the audio alone.
+--*/
+
+#include "tonecontrol.h"
+#include "testutil.h"
+
+#include <math.h>
+
+#include <vector>
+
+#define TEST_PI             3.14159265358979323846
+#define TEST_AMPLITUDE      0.2     // +12 dB stays below full scale.
+#define TEST_TOLERANCE_DB   0.02
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// Exact gain in dB of the slope 1 RBJ shelf at a frequency.
+//
+static double ShelfResponse(ULONG ulSampleRate, BOOL bTreble, double dSetting, double dFrequency)
+{
+    double  A = pow(10, dSetting / 40);
+    double  w0 = 2 * TEST_PI * (bTreble ? TONE_TREBLE_HZ : TONE_BASS_HZ) / ulSampleRate;
+    double  c = cos(w0);
+    double  beta = sqrt(2 * A) * sin(w0);
+    double  s = bTreble ? -1 : 1;
+    double  b[3] = { A * ((A + 1) - s * (A - 1) * c + beta), s * 2 * A * ((A - 1) - s * (A + 1) * c), A * ((A + 1) - s * (A - 1) * c - beta) };
+    double  a[3] = { (A + 1) + s * (A - 1) * c + beta, -s * 2 * ((A - 1) + s * (A + 1) * c), (A + 1) + s * (A - 1) * c - beta };
+    double  w = 2 * TEST_PI * dFrequency / ulSampleRate;
+    double  dNumerator[2] = { b[0] + b[1] * cos(w) + b[2] * cos(2 * w), -b[1] * sin(w) - b[2] * sin(2 * w) };
+    double  dDenominator[2] = { a[0] + a[1] * cos(w) + a[2] * cos(2 * w), -a[1] * sin(w) - a[2] * sin(2 * w) };
+
+    return 10 * log10((dNumerator[0] * dNumerator[0] + dNumerator[1] * dNumerator[1]) /
+                      (dDenominator[0] * dDenominator[0] + dDenominator[1] * dDenominator[1]));
+}
+
+//
+// Gain in dB CToneControl applies to a cosine, on 32-bit mono: the glide
+// to the setting and the transient are left to settle for 100 ms, then
+// 100 ms, a whole number of periods, are measured. 0 Hz is DC and half the
+// sample rate alternates +-1.
+//
+static double MeasureGain(ULONG ulSampleRate, BOOL bTreble, double dSetting, double dFrequency)
+{
+    ULONG               ulFrames = ulSampleRate / 10;
+    BOOL                bEdge = (dFrequency == 0 || 2 * dFrequency == ulSampleRate);
+    std::vector<LONG>   samples(2 * ulFrames);
+    LONG                lBass[TONE_MAX_CHANNELS] = { 0 };
+    LONG                lTreble[TONE_MAX_CHANNELS] = { 0 };
+    CToneControl        tone;
+    double              dIn = 0;
+    double              dSin = 0;
+    double              dCos = 0;
+
+    for (ULONG i = 0; i < samples.size(); i++)
+    {
+        samples[i] = (LONG)lrint(TEST_AMPLITUDE * cos(2 * TEST_PI * dFrequency * i / ulSampleRate) * 2147483647.0);
+    }
+    std::vector<LONG> input(samples);
+
+    (bTreble ? lTreble : lBass)[0] = (LONG)(dSetting * 65536);
+    tone.Init(ulSampleRate, 32, 1, FALSE);
+    tone.SetTargets(lBass, lTreble);
+    tone.Process((PBYTE)samples.data(), (ULONG)(samples.size() * sizeof(LONG)));
+
+    // Power at DC and Nyquist, where the input is the only component;
+    // otherwise the output's component at the input frequency.
+    for (ULONG i = ulFrames; i < samples.size(); i++)
+    {
+        dIn += (double)input[i] * input[i];
+        if (bEdge)
+        {
+            dCos += (double)samples[i] * samples[i];
+        }
+        else
+        {
+            dSin += samples[i] * sin(2 * TEST_PI * dFrequency * i / ulSampleRate);
+            dCos += samples[i] * cos(2 * TEST_PI * dFrequency * i / ulSampleRate);
+        }
+    }
+
+    return bEdge ? 10 * log10(dCos / dIn) : 10 * log10(2 * (dSin * dSin + dCos * dCos) / ulFrames / dIn);
+}
+
+//=============================================================================
+// Tests
+//=============================================================================
+static VOID TestShelfGains()
+{
+    static const ULONG rates[] = { 8000, 48000, 384000 };
+
+    for (ULONG r = 0; r < ARRAYSIZE(rates); r++)
+    {
+        for (ULONG bTreble = FALSE; bTreble <= TRUE; bTreble++)
+        {
+            double dCorner = bTreble ? TONE_TREBLE_HZ : TONE_BASS_HZ;
+            double dWorst[4] = { 0 };
+
+            for (ULONG i = 0; i < TONE_TABLE_ENTRIES; i++)
+            {
+                double dSetting = ((double)i - TONE_TABLE_FLAT) / 2;
+
+                // DC, the corner and Nyquist: the full setting on the
+                // shelf's side, half at the corner, none on the other side.
+                // Octaves either side of the corner follow the exact shelf.
+                double dFrequency[5] = { 0, dCorner, rates[r] / 2.0, dCorner / 2, dCorner * 2 };
+                double dExpected[5] =
+                {
+                    bTreble ? 0 : dSetting,
+                    dSetting / 2,
+                    bTreble ? dSetting : 0,
+                    ShelfResponse(rates[r], bTreble, dSetting, dFrequency[3]),
+                    ShelfResponse(rates[r], bTreble, dSetting, dFrequency[4]),
+                };
+
+                for (ULONG p = 0; p < ARRAYSIZE(dFrequency); p++)
+                {
+                    if (2 * dFrequency[p] <= rates[r])
+                    {
+                        double dError = fabs(MeasureGain(rates[r], bTreble, dSetting, dFrequency[p]) - dExpected[p]);
+                        ULONG ulWorst = p < 3 ? p : 3;
+
+                        dWorst[ulWorst] = dError > dWorst[ulWorst] ? dError : dWorst[ulWorst];
+                    }
+                }
+            }
+
+            printf("%6u Hz %-6s -12..12 dB: worst gain error at DC %.4f dB, corner %.4f dB, Nyquist %.4f dB, octaves %.4f dB\n",
+                   rates[r], bTreble ? "treble" : "bass", dWorst[0], dWorst[1], dWorst[2], dWorst[3]);
+            for (ULONG p = 0; p < ARRAYSIZE(dWorst); p++)
+            {
+                TEST_CHECK(dWorst[p] < TEST_TOLERANCE_DB);
+            }
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestNoiseFloor()
+{
+    static const ULONG rates[] = { 48000, 384000 };
+
+    for (ULONG r = 0; r < ARRAYSIZE(rates); r++)
+    {
+        for (LONG lBoost = -12; lBoost <= 12; lBoost += 24)
+        {
+            ULONG               ulRate = 0;
+            ULONG               ulFrames = rates[r];
+            std::vector<LONG>   samples(ulFrames);
+            std::vector<double> reference(ulFrames);
+            LONG                lBass[TONE_MAX_CHANNELS] = { lBoost * 65536 };
+            LONG                lTreble[TONE_MAX_CHANNELS] = { -lBoost * 65536 };
+            CToneControl        tone;
+            double              dHistory[2][4] = { { 0 } };
+            double              dSignal = 0;
+            double              dError = 0;
+
+            while (g_ToneRates[ulRate] != rates[r])
+            {
+                ulRate++;
+            }
+
+            // Peaks of -40 dBFS, at 50 Hz and 7 kHz: inside both shelves.
+            for (ULONG i = 0; i < ulFrames; i++)
+            {
+                samples[i] = (LONG)lrint(0.005 * 2147483647.0 * (sin(2 * TEST_PI * 50 * i / rates[r]) + sin(2 * TEST_PI * 7000 * i / rates[r])));
+                reference[i] = samples[i];
+            }
+
+            tone.Init(rates[r], 32, 1, FALSE);
+            tone.SetTargets(lBass, lTreble);
+            tone.Process((PBYTE)samples.data(), ulFrames * sizeof(LONG));
+
+            // The same coefficients in double, compared once the glide is
+            // over and its transient gone.
+            const TONE_BIQUAD * pBiquads[2] =
+            {
+                &g_ToneTable.Bass[ulRate][ToneIndexFromLevel(lBass[0])],
+                &g_ToneTable.Treble[ulRate][ToneIndexFromLevel(lTreble[0])],
+            };
+            for (ULONG i = 0; i < ulFrames; i++)
+            {
+                double dValue = reference[i];
+
+                for (ULONG s = 0; s < 2; s++)
+                {
+                    const double    dScale = 1.0 / (1L << TONE_COEFFICIENT_SHIFT);
+                    double *        h = dHistory[s];
+                    double          dOut = (pBiquads[s]->lB0 * dValue + pBiquads[s]->lB1 * h[0] + pBiquads[s]->lB2 * h[1] -
+                                            pBiquads[s]->lA1 * h[2] - pBiquads[s]->lA2 * h[3]) * dScale;
+
+                    h[1] = h[0];
+                    h[0] = dValue;
+                    h[3] = h[2];
+                    h[2] = dOut;
+                    dValue = dOut;
+                }
+
+                if (i >= ulFrames / 2)
+                {
+                    dSignal += dValue * dValue;
+                    dError += (samples[i] - dValue) * (samples[i] - dValue);
+                }
+            }
+
+            printf("%6u Hz bass %+3d dB, treble %+3d dB: %.1f dB SNR against double precision\n",
+                   rates[r], lBoost, -lBoost, 10 * log10(dSignal / dError));
+            TEST_CHECK(10 * log10(dSignal / dError) > 130);
+        }
+    }
+}
+
+//=============================================================================
+static VOID TestFlat()
+{
+    std::vector<SHORT>  samples(4800 * 2);
+    LONG                lBass[TONE_MAX_CHANNELS] = { 0 };
+    LONG                lTreble[TONE_MAX_CHANNELS] = { 0 };
+    CToneControl        tone;
+    ULONG               ulState = 1;
+
+    for (ULONG i = 0; i < samples.size(); i++)
+    {
+        samples[i] = (SHORT)Random(&ulState);
+    }
+    std::vector<SHORT> input(samples);
+
+    TEST_CHECK(tone.Init(48000, 16, 2, FALSE));
+    TEST_CHECK(tone.IsFlat());
+    tone.Process((PBYTE)samples.data(), (ULONG)(samples.size() * sizeof(SHORT)));
+    TEST_CHECK(samples == input);
+
+    // Rounded to the nearest 0.5 dB: a quarter step below is still flat.
+    lBass[0] = lBass[1] = 16383;
+    lTreble[0] = lTreble[1] = -16383;
+    tone.SetTargets(lBass, lTreble);
+    TEST_CHECK(tone.IsFlat());
+    tone.Process((PBYTE)samples.data(), (ULONG)(samples.size() * sizeof(SHORT)));
+    TEST_CHECK(samples == input);
+
+    // Unsupported rates and formats leave the audio alone too.
+    TEST_CHECK(!tone.Init(47999, 16, 2, FALSE));
+    TEST_CHECK(!tone.Init(48000, 20, 2, FALSE));
+    TEST_CHECK(!tone.Init(48000, 16, TONE_MAX_CHANNELS + 1, FALSE));
+}
+
+//=============================================================================
+int main()
+{
+    TestShelfGains();
+    TestNoiseFloor();
+    TestFlat();
+
+    return TestResult("tonecontrol");
+}
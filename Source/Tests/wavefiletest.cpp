@@ -0,0 +1,564 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    wavefiletest.cpp
+
+Abstract:
+
+    The WAVE file reader behind the capture file source: WaveFileParse and
+    WaveFileLoadSamples on RIFF, RF64 and BW64 files with plain and
+    WAVE_FORMAT_EXTENSIBLE fmt chunks, odd-sized and unknown chunks, and
+    every sample format, decoded samples checked bit for bit; files cut
+    off at every length; malformed fmt, ds64 and chunk structure; and
+    randomly corrupted files, which must either be rejected or described
+    consistently.
+--*/
+
+#include "wavefile.h"
+#include "testutil.h"
+
+#include <math.h>
+
+#include <vector>
+
+static ULONG Random(ULONG *pulState)
+{
+    *pulState = *pulState * 1103515245 + 12345;
+    return *pulState >> 8;
+}
+
+//
+// Reads from a file held in memory; fails past its end.
+//
+static BOOL ReadMemory(PVOID Context, ULONGLONG ullOffset, PVOID pData, ULONG cbData)
+{
+    const std::vector<BYTE> *pFile = (const std::vector<BYTE> *)Context;
+
+    if (ullOffset > pFile->size() || cbData > pFile->size() - ullOffset)
+    {
+        return FALSE;
+    }
+
+    memcpy(pData, pFile->data() + ullOffset, cbData);
+    return TRUE;
+}
+
+static VOID Put16(std::vector<BYTE> *pFile, ULONG ulValue)
+{
+    pFile->push_back((BYTE)ulValue);
+    pFile->push_back((BYTE)(ulValue >> 8));
+}
+
+static VOID Put32(std::vector<BYTE> *pFile, ULONG ulValue)
+{
+    Put16(pFile, ulValue & 0xFFFF);
+    Put16(pFile, ulValue >> 16);
+}
+
+static VOID PutTag(std::vector<BYTE> *pFile, const char *pszTag)
+{
+    pFile->insert(pFile->end(), pszTag, pszTag + 4);
+}
+
+//=============================================================================
+// Test files
+//=============================================================================
+
+enum
+{
+    eContainerRiff,
+    eContainerRf64,
+    eContainerBw64,
+};
+
+typedef struct _TEST_WAVE
+{
+    ULONG       ulContainer;
+    BOOL        bExtensible;
+    BOOL        bFloat;
+    ULONG       ulChannels;
+    ULONG       ulBitsPerSample;
+    ULONG       ulFrames;
+    BOOL        bDataFirst;         // data chunk before fmt.
+} TEST_WAVE;
+
+//
+// Offsets of the pieces BuildWave wrote, for the malformed cases.
+//
+typedef struct _TEST_WAVE_LAYOUT
+{
+    size_t      ulFormat;           // fmt payload.
+    size_t      ulDs64;             // ds64 payload, RF64 and BW64 only.
+    size_t      ulData;             // data payload.
+} TEST_WAVE_LAYOUT;
+
+//
+// The file, with an odd-sized LIST chunk and an unknown chunk in front of
+// the audio, and the Q30 samples it should decode to. Float samples reach
+// a little past full scale, and include the special values.
+//
+static VOID BuildWave(const TEST_WAVE *pSpec, std::vector<BYTE> *pFile, std::vector<LONG> *pExpected, TEST_WAVE_LAYOUT *pLayout)
+{
+    static const ULONG floatSpecials[] = { 0x7FC00000, 0x7F800000, 0xFF800000, 0x80000000, 0x00000001, 0x3F800000, 0xBF800000, 0x3F000000 };
+    ULONG               ulSampleBytes = pSpec->ulBitsPerSample / 8;
+    ULONG               ulBlockAlign = pSpec->ulChannels * ulSampleBytes;
+    ULONGLONG           ullDataBytes = (ULONGLONG)pSpec->ulFrames * ulBlockAlign;
+    BOOL                bRf64 = (pSpec->ulContainer != eContainerRiff);
+    ULONG               ulState = pSpec->ulBitsPerSample * 7 + pSpec->ulChannels;
+    std::vector<BYTE>   format;
+    std::vector<BYTE>   data;
+
+    pFile->clear();
+    pExpected->clear();
+    *pLayout = TEST_WAVE_LAYOUT();
+
+    // fmt payload.
+    Put16(&format, pSpec->bExtensible ? WAVEFILE_TAG_EXTENSIBLE : (pSpec->bFloat ? WAVEFILE_TAG_FLOAT : WAVEFILE_TAG_PCM));
+    Put16(&format, pSpec->ulChannels);
+    Put32(&format, 48000);
+    Put32(&format, 48000 * ulBlockAlign);
+    Put16(&format, ulBlockAlign);
+    Put16(&format, pSpec->ulBitsPerSample);
+    if (pSpec->bExtensible)
+    {
+        static const BYTE tail[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+
+        Put16(&format, 22);
+        Put16(&format, pSpec->ulBitsPerSample);
+        Put32(&format, 0);
+        Put16(&format, pSpec->bFloat ? WAVEFILE_TAG_FLOAT : WAVEFILE_TAG_PCM);
+        format.insert(format.end(), tail, tail + sizeof(tail));
+    }
+
+    // Samples, and what they decode to.
+    for (ULONG i = 0; i < pSpec->ulFrames * pSpec->ulChannels; i++)
+    {
+        ULONG ulRandom = Random(&ulState) << 8 | (Random(&ulState) & 0xFF);
+
+        if (pSpec->bFloat)
+        {
+            float   fValue = (float)((LONG)ulRandom / 2147483648.0 * 1.1);
+            ULONG   ulBits;
+            double  dValue;
+
+            memcpy(&ulBits, &fValue, sizeof(ulBits));
+            if (i < ARRAYSIZE(floatSpecials))
+            {
+                ulBits = floatSpecials[i];
+                memcpy(&fValue, &ulBits, sizeof(fValue));
+            }
+            Put32(&data, ulBits);
+
+            // Nearest, ties away from zero; clamped; NaN is silence.
+            dValue = (fValue != fValue) ? 0 : (fValue > 1 ? 1 : (fValue < -1 ? -1 : (double)fValue));
+            dValue = ldexp(dValue, 30);
+            pExpected->push_back((LONG)(dValue < 0 ? -floor(-dValue + 0.5) : floor(dValue + 0.5)));
+        }
+        else
+        {
+            // Full-scale integers, left-justified to Q30.
+            LONG lValue = (LONG)ulRandom >> (32 - pSpec->ulBitsPerSample);
+            ULONG ulStored = (ULONG)lValue + (pSpec->ulBitsPerSample == 8 ? 0x80 : 0);
+
+            if (i == 0 || i == 1)
+            {
+                lValue = (i == 0) ? -(1L << (pSpec->ulBitsPerSample - 1)) : (LONG)((1UL << (pSpec->ulBitsPerSample - 1)) - 1);
+                ulStored = (ULONG)lValue + (pSpec->ulBitsPerSample == 8 ? 0x80 : 0);
+            }
+            for (ULONG b = 0; b < ulSampleBytes; b++)
+            {
+                data.push_back((BYTE)(ulStored >> (8 * b)));
+            }
+            pExpected->push_back((pSpec->ulBitsPerSample == 32) ? (lValue >> 1) : lValue * (1L << (31 - pSpec->ulBitsPerSample)));
+        }
+    }
+
+    static const char * const containers[] = { "RIFF", "RF64", "BW64" };
+    PutTag(pFile, containers[pSpec->ulContainer]);
+    Put32(pFile, bRf64 ? 0xFFFFFFFF : 0);
+    PutTag(pFile, "WAVE");
+
+    if (bRf64)
+    {
+        PutTag(pFile, "ds64");
+        Put32(pFile, 28);
+        pLayout->ulDs64 = pFile->size();
+        Put32(pFile, 0);
+        Put32(pFile, 0);
+        Put32(pFile, (ULONG)ullDataBytes);
+        Put32(pFile, (ULONG)(ullDataBytes >> 32));
+        Put32(pFile, pSpec->ulFrames);
+        Put32(pFile, 0);
+        Put32(pFile, 0);
+    }
+
+    // An odd-sized chunk, padded, and one this reader does not know.
+    PutTag(pFile, "LIST");
+    Put32(pFile, 5);
+    PutTag(pFile, "INFO");
+    pFile->push_back('x');
+    pFile->push_back(0);
+    PutTag(pFile, "fact");
+    Put32(pFile, 4);
+    Put32(pFile, pSpec->ulFrames);
+
+    for (ULONG pass = 0; pass < 2; pass++)
+    {
+        if ((pass == 0) == !pSpec->bDataFirst)
+        {
+            PutTag(pFile, "fmt ");
+            Put32(pFile, (ULONG)format.size());
+            pLayout->ulFormat = pFile->size();
+            pFile->insert(pFile->end(), format.begin(), format.end());
+        }
+        else
+        {
+            PutTag(pFile, "data");
+            Put32(pFile, bRf64 ? 0xFFFFFFFF : (ULONG)ullDataBytes);
+            pLayout->ulData = pFile->size();
+            pFile->insert(pFile->end(), data.begin(), data.end());
+            if (data.size() & 1)
+            {
+                pFile->push_back(0);
+            }
+        }
+    }
+
+    if (!bRf64)
+    {
+        ULONG cbRiff = (ULONG)pFile->size() - 8;
+        memcpy(pFile->data() + 4, &cbRiff, 4);
+    }
+}
+
+static BOOL Parse(const std::vector<BYTE> *pFile, ULONGLONG ullFileBytes, WAVEFILE_INFO *pInfo)
+{
+    return WaveFileParse(ReadMemory, (PVOID)pFile, ullFileBytes, pInfo);
+}
+
+//=============================================================================
+// Tests
+//=============================================================================
+static VOID TestFormats()
+{
+    static const TEST_WAVE waves[] =
+    {
+        { eContainerRiff, FALSE, FALSE, 1, 8,  1001, FALSE },
+        { eContainerRiff, FALSE, FALSE, 2, 16, 1000, FALSE },
+        { eContainerRiff, FALSE, FALSE, 3, 24, 999,  TRUE  },
+        { eContainerRiff, FALSE, FALSE, 2, 32, 500,  FALSE },
+        { eContainerRiff, FALSE, TRUE,  2, 32, 500,  FALSE },
+        { eContainerRiff, TRUE,  FALSE, 6, 24, 777,  FALSE },
+        { eContainerRiff, TRUE,  TRUE,  8, 32, 333,  FALSE },
+        { eContainerRf64, FALSE, FALSE, 2, 16, 1000, FALSE },
+        { eContainerRf64, TRUE,  FALSE, 3, 32, 401,  TRUE  },
+        { eContainerBw64, TRUE,  TRUE,  2, 32, 400,  FALSE },
+        { eContainerBw64, FALSE, FALSE, 1, 8,  3,    FALSE },
+    };
+
+    for (ULONG w = 0; w < ARRAYSIZE(waves); w++)
+    {
+        const TEST_WAVE *   pSpec = &waves[w];
+        std::vector<BYTE>   file;
+        std::vector<LONG>   expected;
+        TEST_WAVE_LAYOUT    layout;
+        WAVEFILE_INFO       info;
+        BYTE                scratch[100];
+
+        BuildWave(pSpec, &file, &expected, &layout);
+
+        TEST_CHECK(Parse(&file, file.size(), &info));
+        TEST_CHECK(info.bFloat == pSpec->bFloat);
+        TEST_CHECK(info.ulChannels == pSpec->ulChannels);
+        TEST_CHECK(info.ulSampleRate == 48000);
+        TEST_CHECK(info.ulBitsPerSample == pSpec->ulBitsPerSample);
+        TEST_CHECK(info.ulBlockAlign == pSpec->ulChannels * pSpec->ulBitsPerSample / 8);
+        TEST_CHECK(info.ullDataOffset == layout.ulData);
+        TEST_CHECK(info.ullFrames == pSpec->ulFrames);
+        TEST_CHECK(info.ullDataBytes == (ULONGLONG)pSpec->ulFrames * info.ulBlockAlign);
+        TEST_CHECK(WaveFileGetDecodedBytes(&info) == expected.size() * sizeof(LONG));
+
+        // A scratch buffer that does not hold a whole number of chunks.
+        std::vector<LONG> samples(expected.size());
+        TEST_CHECK(WaveFileLoadSamples(ReadMemory, &file, &info, samples.data(), scratch, sizeof(scratch)));
+        TEST_CHECK(samples == expected);
+
+        TEST_CHECK(!WaveFileLoadSamples(ReadMemory, &file, &info, samples.data(), scratch, info.ulBlockAlign - 1));
+    }
+}
+
+//=============================================================================
+static VOID TestFloatToQ30()
+{
+    TEST_CHECK(WaveFileFloatToQ30(0x00000000) == 0);
+    TEST_CHECK(WaveFileFloatToQ30(0x80000000) == 0);
+    TEST_CHECK(WaveFileFloatToQ30(0x3F000000) == (1L << 29));
+    TEST_CHECK(WaveFileFloatToQ30(0xBF000000) == -(1L << 29));
+    TEST_CHECK(WaveFileFloatToQ30(0x3F800000) == SAMPLE_Q30_ONE);
+    TEST_CHECK(WaveFileFloatToQ30(0x40000000) == SAMPLE_Q30_ONE);
+    TEST_CHECK(WaveFileFloatToQ30(0xFF800000) == -SAMPLE_Q30_ONE);
+    TEST_CHECK(WaveFileFloatToQ30(0x7FC00000) == 0);
+    TEST_CHECK(WaveFileFloatToQ30(0xFFFFFFFF) == 0);
+
+    // 2^-30 is one step; 2^-31 rounds away from zero, just below it to 0.
+    TEST_CHECK(WaveFileFloatToQ30(0x30800000) == 1);
+    TEST_CHECK(WaveFileFloatToQ30(0x30000000) == 1);
+    TEST_CHECK(WaveFileFloatToQ30(0xB0000000) == -1);
+    TEST_CHECK(WaveFileFloatToQ30(0x2FFFFFFF) == 0);
+    TEST_CHECK(WaveFileFloatToQ30(0x00000001) == 0);
+}
+
+//=============================================================================
+static VOID TestTruncated()
+{
+    static const TEST_WAVE waves[] =
+    {
+        { eContainerRiff, TRUE,  FALSE, 3, 24, 50, FALSE },
+        { eContainerRf64, FALSE, FALSE, 2, 16, 50, FALSE },
+        { eContainerRiff, FALSE, FALSE, 2, 16, 50, TRUE  },
+    };
+
+    for (ULONG w = 0; w < ARRAYSIZE(waves); w++)
+    {
+        std::vector<BYTE>   file;
+        std::vector<LONG>   expected;
+        TEST_WAVE_LAYOUT    layout;
+        ULONG               ulBlockAlign = waves[w].ulChannels * waves[w].ulBitsPerSample / 8;
+        ULONG               ulBad = 0;
+
+        BuildWave(&waves[w], &file, &expected, &layout);
+
+        // An unfinished recording: the file ends anywhere. Only the whole
+        // frames that are there are played, and the reads must stay inside
+        // the file.
+        for (size_t cbFile = 0; cbFile <= file.size(); cbFile++)
+        {
+            std::vector<BYTE>   cut(file.begin(), file.begin() + cbFile);
+            WAVEFILE_INFO       info;
+            BOOL                bParsed = Parse(&cut, cut.size(), &info);
+            size_t              cbFormatEnd = layout.ulFormat + (waves[w].bExtensible ? 40 : 16);
+            ULONGLONG           ullFrames = (cbFile > layout.ulData) ? (cbFile - layout.ulData) / ulBlockAlign : 0;
+
+            if (ullFrames > waves[w].ulFrames)
+            {
+                ullFrames = waves[w].ulFrames;
+            }
+            if (waves[w].bDataFirst && cbFile < cbFormatEnd)
+            {
+                ullFrames = 0;
+            }
+
+            if (ullFrames == 0)
+            {
+                ulBad += bParsed;
+            }
+            else
+            {
+                ulBad += !bParsed || info.ullFrames != ullFrames || info.ullDataBytes != ullFrames * ulBlockAlign;
+            }
+        }
+
+        printf("truncated %s%s file cut at every one of %zu lengths: %u unexpected results\n",
+               waves[w].ulContainer == eContainerRiff ? "RIFF" : "RF64",
+               waves[w].bDataFirst ? ", data first," : "", file.size() + 1, ulBad);
+        TEST_CHECK(ulBad == 0);
+    }
+}
+
+//=============================================================================
+static VOID TestMalformed()
+{
+    static const TEST_WAVE plain = { eContainerRiff, FALSE, FALSE, 2, 16, 100, FALSE };
+    static const TEST_WAVE extensible = { eContainerRiff, TRUE, FALSE, 2, 16, 100, FALSE };
+    static const TEST_WAVE rf64 = { eContainerRf64, FALSE, FALSE, 2, 16, 100, FALSE };
+    std::vector<BYTE>   file;
+    std::vector<LONG>   expected;
+    TEST_WAVE_LAYOUT    layout;
+    WAVEFILE_INFO       info;
+
+    // Container.
+    BuildWave(&plain, &file, &expected, &layout);
+    memcpy(file.data(), "RIFX", 4);
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+    BuildWave(&plain, &file, &expected, &layout);
+    memcpy(file.data() + 8, "AVI ", 4);
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+
+    // fmt fields: tag, size, sample sizes, channels, rate, block align.
+    static const struct
+    {
+        ULONG   ulOffset;
+        ULONG   ulValue;
+        ULONG   cbValue;
+    } formatEdits[] =
+    {
+        { 0,  0x0002, 2 },          // ADPCM.
+        { 14, 12,     2 },          // 12-bit.
+        { 2,  0,      2 },
+        { 2,  WAVEFILE_MAX_CHANNELS + 1, 2 },
+        { 4,  0,      4 },
+        { 12, 6,      2 },
+    };
+    for (ULONG i = 0; i < ARRAYSIZE(formatEdits); i++)
+    {
+        BuildWave(&plain, &file, &expected, &layout);
+        memcpy(file.data() + layout.ulFormat + formatEdits[i].ulOffset, &formatEdits[i].ulValue, formatEdits[i].cbValue);
+        TEST_CHECK(!Parse(&file, file.size(), &info));
+    }
+
+    // Float that is not 32-bit.
+    {
+        static const TEST_WAVE wave = { eContainerRiff, FALSE, TRUE, 2, 32, 100, FALSE };
+        BuildWave(&wave, &file, &expected, &layout);
+        file[layout.ulFormat + 14] = 16;
+        file[layout.ulFormat + 12] = 4;
+        TEST_CHECK(!Parse(&file, file.size(), &info));
+    }
+
+    // A WAVEFORMAT, without the sample size.
+    BuildWave(&plain, &file, &expected, &layout);
+    file.erase(file.begin() + layout.ulFormat + 14, file.begin() + layout.ulFormat + 16);
+    file[layout.ulFormat - 4] = 14;
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+
+    // Extensible: too short for the subformat, subformat not a wave tag,
+    // subformat of an unsupported tag.
+    BuildWave(&extensible, &file, &expected, &layout);
+    TEST_CHECK(Parse(&file, file.size(), &info));
+    file.erase(file.begin() + layout.ulFormat + 38, file.begin() + layout.ulFormat + 40);
+    file[layout.ulFormat - 4] = 38;
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+    BuildWave(&extensible, &file, &expected, &layout);
+    file[layout.ulFormat + 39] ^= 1;
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+    BuildWave(&extensible, &file, &expected, &layout);
+    file[layout.ulFormat + 24] = 2;
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+
+    // ds64 too short to hold the data size.
+    BuildWave(&rf64, &file, &expected, &layout);
+    file[layout.ulDs64 - 4] = 20;
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+
+    // ds64 data size beyond the file is cut to it; 0 is no audio.
+    BuildWave(&rf64, &file, &expected, &layout);
+    file[layout.ulDs64 + 15] = 0x10;
+    TEST_CHECK(Parse(&file, file.size(), &info) && info.ullFrames == 100);
+    BuildWave(&rf64, &file, &expected, &layout);
+    memset(file.data() + layout.ulDs64 + 8, 0, 8);
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+
+    // A RIFF file's ds64 is just another chunk; its 0xFFFFFFFF data size is
+    // taken as is and cut to the file.
+    BuildWave(&plain, &file, &expected, &layout);
+    memset(file.data() + layout.ulData - 4, 0xFF, 4);
+    TEST_CHECK(Parse(&file, file.size(), &info) && info.ullFrames == 100);
+
+    // No fmt, no data, empty data.
+    BuildWave(&plain, &file, &expected, &layout);
+    memcpy(file.data() + layout.ulFormat - 8, "fmt2", 4);
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+    BuildWave(&plain, &file, &expected, &layout);
+    memcpy(file.data() + layout.ulData - 8, "dat ", 4);
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+    BuildWave(&plain, &file, &expected, &layout);
+    memset(file.data() + layout.ulData - 4, 0, 4);
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+
+    // Less than a frame of data.
+    BuildWave(&plain, &file, &expected, &layout);
+    memset(file.data() + layout.ulData - 4, 0, 4);
+    file[layout.ulData - 4] = 3;
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+
+    // fmt and data behind more chunks than the reader looks at.
+    {
+        std::vector<BYTE> padded(file.begin(), file.begin() + 12);
+
+        BuildWave(&plain, &file, &expected, &layout);
+        for (ULONG i = 0; i < WAVEFILE_MAX_CHUNKS; i++)
+        {
+            PutTag(&padded, "JUNK");
+            Put32(&padded, 0);
+        }
+        padded.insert(padded.end(), file.begin() + 12, file.end());
+        TEST_CHECK(!Parse(&padded, padded.size(), &info));
+    }
+
+    // A chunk size that points past the end of the file.
+    BuildWave(&plain, &file, &expected, &layout);
+    memset(file.data() + 16, 0xFF, 4);
+    TEST_CHECK(!Parse(&file, file.size(), &info));
+}
+
+//=============================================================================
+static VOID TestCorrupted()
+{
+    static const TEST_WAVE waves[] =
+    {
+        { eContainerRiff, TRUE,  TRUE,  2, 32, 40, FALSE },
+        { eContainerRf64, FALSE, FALSE, 3, 24, 40, TRUE  },
+    };
+    ULONG ulState = 5;
+    ULONG ulParsed = 0;
+    ULONG ulBad = 0;
+    ULONG ulRuns = 0;
+
+    for (ULONG w = 0; w < ARRAYSIZE(waves); w++)
+    {
+        std::vector<BYTE>   file;
+        std::vector<LONG>   expected;
+        TEST_WAVE_LAYOUT    layout;
+
+        BuildWave(&waves[w], &file, &expected, &layout);
+
+        // Damage in the headers, where it matters.
+        for (ULONG run = 0; run < 20000; run++)
+        {
+            std::vector<BYTE>   damaged(file);
+            WAVEFILE_INFO       info;
+            ULONG               ulEdits = 1 + Random(&ulState) % 4;
+
+            for (ULONG e = 0; e < ulEdits; e++)
+            {
+                size_t ulOffset = Random(&ulState) % (layout.ulData + 4);
+                damaged[ulOffset] = (Random(&ulState) % 2) ? (BYTE)Random(&ulState) : (BYTE)(damaged[ulOffset] ^ (1 << (Random(&ulState) % 8)));
+            }
+
+            ulRuns++;
+            if (!Parse(&damaged, damaged.size(), &info))
+            {
+                continue;
+            }
+
+            // Whatever it accepts, it describes consistently.
+            ulParsed++;
+            ulBad += (info.ulChannels < 1 || info.ulChannels > WAVEFILE_MAX_CHANNELS);
+            ulBad += (info.ulBlockAlign != info.ulChannels * info.ulBitsPerSample / 8);
+            ulBad += (info.ullFrames == 0 || info.ullDataBytes != info.ullFrames * info.ulBlockAlign);
+            ulBad += (info.ullDataOffset + info.ullDataBytes > damaged.size());
+
+            std::vector<LONG> samples((size_t)(WaveFileGetDecodedBytes(&info) / sizeof(LONG)));
+            std::vector<BYTE> scratch(info.ulBlockAlign * 7);
+            ulBad += !WaveFileLoadSamples(ReadMemory, &damaged, &info, samples.data(), scratch.data(), (ULONG)scratch.size());
+        }
+    }
+
+    printf("corrupted headers: %u files, %u still parsed, %u inconsistent\n", ulRuns, ulParsed, ulBad);
+    TEST_CHECK(ulBad == 0);
+}
+
+//=============================================================================
+int main()
+{
+    TestFloatToQ30();
+    TestFormats();
+    TestTruncated();
+    TestMalformed();
+    TestCorrupted();
+
+    return TestResult("wavefile");
+}
@@ -14,35 +14,8 @@ Abstract:
 #include "definitions.h"
 #include "ToneGenerator.h"
 
-const double TWO_PI = M_PI * 2;
-
 extern DWORD g_DisableToneGenerator;
 
-//
-// Double to long conversion.
-//
-long ConvertToLong(double Value)
-{
-    return (long)(Value * _I32_MAX);
-};
-
-//
-// Double to short conversion.
-//
-short ConvertToShort(double Value)
-{
-    return (short)(Value * _I16_MAX);
-};
-
-//
-// Double to char conversion.
-//
-unsigned char ConvertToUChar(double Value)
-{
-    const double F_127_5 = 127.5;
-    return (unsigned char)(Value * F_127_5 + F_127_5);
-};
-
 //
 // Ctor: basic init.
 //
@@ -56,8 +29,10 @@ ToneGenerator::ToneGenerator()
   m_PartialFrameBytes(0),
   m_FrameSize(0)
 {
-    // Theta (double) and SampleIncrement (double) are init in the Init() method 
-    // after saving the floating point state. 
+    RtlZeroMemory(&m_SampleWriter, sizeof(m_SampleWriter));
+
+    // The oscillator is set up in the Init() method after saving the floating
+    // point state.
 }
 
 //
@@ -73,67 +48,29 @@ ToneGenerator::~ToneGenerator()
     }
 }
 
-// 
-// Init a new frame. 
-// Note: caller will save and restore the floatingpoint state.
 //
-#pragma warning(push)
-// Caller wraps this routine between KeSaveFloatingPointState/KeRestoreFloatingPointState calls.
-#pragma warning(disable: 28110)
-
-VOID ToneGenerator::InitNewFrame
+// Fill whole frames. The oscillator and the sample writer are fixed point,
+// so no floating point state is needed.
+//
+VOID ToneGenerator::WriteFrames
 (
-    _Out_writes_bytes_(FrameSize)    BYTE*  Frame, 
-    _In_                             DWORD  FrameSize
+    _Out_writes_bytes_(Frames * m_FrameSize)    BYTE*  Buffer, 
+    _In_                                        ULONG  Frames
 )
 {
-    double sinValue = m_ToneDCOffset + m_ToneAmplitude * sin( m_Theta );
+    LONG samples[TONE_BLOCK_FRAMES];
 
-    if (FrameSize != (DWORD)m_ChannelCount * m_BitsPerSample/8)
+    while (Frames > 0)
     {
-        ASSERT(FALSE);
-        RtlZeroMemory(Frame, FrameSize);
-        return;
-    }
+        ULONG run = MIN(Frames, TONE_BLOCK_FRAMES);
 
-    /* Use __analysis_assume to suppress the reports of a false OACR error. */
-    for(ULONG i = 0; i < m_ChannelCount; ++i)
-    {
-        if (m_BitsPerSample == 8)
-        {
-            __analysis_assume((DWORD)m_ChannelCount == FrameSize);
-            unsigned char *dataBuffer = reinterpret_cast<unsigned char *>(Frame);
-            dataBuffer[i] = ConvertToUChar(sinValue);
-        }
-        else if (m_BitsPerSample == 16)
-        {
-            __analysis_assume((DWORD)(m_ChannelCount) * 2 == FrameSize);
-            short *dataBuffer = reinterpret_cast<short *>(Frame);
-            dataBuffer[i] = ConvertToShort(sinValue);
-        }
-        else if (m_BitsPerSample == 24)
-        {
-            __analysis_assume((DWORD)(m_ChannelCount) * 3 == FrameSize);
-            BYTE *dataBuffer = Frame;
-            long val = ConvertToLong(sinValue);
-            val = val >> 8;
-            RtlCopyMemory(dataBuffer, &val, 3);
-        }
-        else if (m_BitsPerSample == 32)
-        {
-            __analysis_assume((DWORD)(m_ChannelCount) * 4 == FrameSize);
-            long *dataBuffer = reinterpret_cast<long *>(Frame);
-            dataBuffer[i] = ConvertToLong(sinValue);
-        }
-    }
+        m_Oscillator.Generate(samples, run);
+        m_SampleWriter.pfnWriteBroadcast(Buffer, samples, run);
 
-    m_Theta += m_SampleIncrement;
-    if (m_Theta >= TWO_PI)
-    {
-        m_Theta -= TWO_PI;
+        Buffer += (size_t)run * m_FrameSize;
+        Frames -= run;
     }
 }
-#pragma warning(pop)
 
 //
 // GenerateSamples()
@@ -150,8 +87,6 @@ void ToneGenerator::GenerateSine
     _In_                             size_t      BufferLength
 )
 {
-    NTSTATUS        status;
-    KFLOATING_SAVE  saveData;
     BYTE *          buffer;
     size_t          length;
     size_t          copyBytes;
@@ -163,12 +98,6 @@ void ToneGenerator::GenerateSine
         goto ZeroBuffer;
     }
     
-    status = KeSaveFloatingPointState(&saveData);
-    if (!NT_SUCCESS(status))
-    {
-        goto ZeroBuffer;
-    }
-
     buffer = Buffer;
     length = BufferLength;
 
@@ -195,11 +124,13 @@ void ToneGenerator::GenerateSine
 
     size_t frames = length/m_FrameSize;
 
-    for (size_t i = 0; i < frames; ++i)
+    while (frames > 0)
     {
-        InitNewFrame(buffer, m_FrameSize);
-        buffer += m_FrameSize;
-        length -= m_FrameSize;
+        ULONG run = (ULONG)MIN(frames, (size_t)(ULONG_MAX / m_FrameSize));
+        WriteFrames(buffer, run);
+        buffer += (size_t)run * m_FrameSize;
+        length -= (size_t)run * m_FrameSize;
+        frames -= run;
     }
 
     IF_TRUE_JUMP(length == 0, Done);
@@ -208,13 +139,12 @@ void ToneGenerator::GenerateSine
     // Copy any partial frame at the end.
     //
     ASSERT(m_FrameSize > length);
-    InitNewFrame(m_PartialFrame, m_FrameSize);
+    WriteFrames(m_PartialFrame, 1);
     RtlCopyMemory(buffer, m_PartialFrame, length);
     RtlZeroMemory(m_PartialFrame, length);
     m_PartialFrameBytes = m_FrameSize - (DWORD)length;    
     
 Done:
-    KeRestoreFloatingPointState(&saveData);
     return;
 
 ZeroBuffer:
@@ -233,13 +163,33 @@ NTSTATUS ToneGenerator::Init
 {
     NTSTATUS        status      = STATUS_SUCCESS;
     KFLOATING_SAVE  saveData;
+    BOOL            isFloat     = FALSE;
     
     //
-    // This sample supports PCM formats only. 
+    // This sample supports PCM and IEEE float formats.
+    //
+    if (WfExt->Format.wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    {
+        isFloat = TRUE;
+    }
+    else if (WfExt->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+             IsEqualGUIDAligned(WfExt->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT))
+    {
+        isFloat = TRUE;
+    }
+    else if (WfExt->Format.wFormatTag != WAVE_FORMAT_PCM &&
+             !(WfExt->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+               IsEqualGUIDAligned(WfExt->SubFormat, KSDATAFORMAT_SUBTYPE_PCM)))
+    {
+        status = STATUS_NOT_SUPPORTED;
+    }
+    IF_FAILED_JUMP(status, Done);
+
+    //
+    // Pick the writer for this format once; generation never looks at the
+    // format again.
     //
-    if ((WfExt->Format.wFormatTag != WAVE_FORMAT_PCM &&
-        !(WfExt->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
-          IsEqualGUIDAligned(WfExt->SubFormat, KSDATAFORMAT_SUBTYPE_PCM))))
+    if (!GetSampleWriter(WfExt->Format.wBitsPerSample, WfExt->Format.nChannels, isFloat, &m_SampleWriter))
     {
         status = STATUS_NOT_SUPPORTED;
     }
@@ -254,23 +204,30 @@ NTSTATUS ToneGenerator::Init
     //
     // Basic init.
     //
-    m_Theta             = ToneInitialPhase;
     m_Frequency         = ToneFrequency;
-    m_ToneAmplitude     = ToneAmplitude;
-    m_ToneDCOffset      = ToneDCOffset;
 
     m_ChannelCount      = WfExt->Format.nChannels;      // # channels.
     m_BitsPerSample     = WfExt->Format.wBitsPerSample; // bits per sample.
     m_SamplesPerSecond  = WfExt->Format.nSamplesPerSec; // samples per sec.
     m_Mute              = false;
-    m_SampleIncrement   = (m_Frequency * TWO_PI) / (double)m_SamplesPerSecond;
     m_FrameSize         = (DWORD)m_ChannelCount * m_BitsPerSample/8;
     ASSERT(m_FrameSize == WfExt->Format.nBlockAlign);
+    ASSERT(m_FrameSize == m_SampleWriter.ulFrameBytes);
+
+    //
+    // Build the sine table and the fixed-point phase increment, amplitude
+    // and offset. This is the only floating point work the generator does.
+    //
+    if (!m_Oscillator.Init(m_Frequency, m_SamplesPerSecond, ToneAmplitude, ToneDCOffset, ToneInitialPhase))
+    {
+        status = STATUS_INVALID_PARAMETER;
+    }
     
     //
     // Restore floating state.
     //
     KeRestoreFloatingPointState(&saveData);
+    IF_FAILED_JUMP(status, Done);
 
     // 
     // Allocate a buffer to hold a partial frame.
@@ -16,6 +16,11 @@ Abstract:
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <limits.h>
+#include "phaseoscillator.h"
+#include "samplewriter.h"
+
+// Frames generated per oscillator block.
+#define TONE_BLOCK_FRAMES   128
 
 class ToneGenerator
 {
@@ -24,14 +29,12 @@ public:
     WORD            m_ChannelCount; 
     WORD            m_BitsPerSample;
     DWORD           m_SamplesPerSecond;
-    double          m_Theta;
-    double          m_SampleIncrement;  
     bool            m_Mute;
     BYTE*           m_PartialFrame;
     DWORD           m_PartialFrameBytes;
     DWORD           m_FrameSize;
-    double          m_ToneAmplitude;
-    double          m_ToneDCOffset;
+    CPhaseOscillator m_Oscillator;
+    SAMPLE_WRITER   m_SampleWriter;     // Picked for the stream format in Init.
 
 public:
     ToneGenerator();
@@ -64,10 +67,10 @@ public:
     }
 
 private:
-    VOID InitNewFrame
+    VOID WriteFrames
     (
-        _Out_writes_bytes_(FrameSize)   BYTE*  Frame, 
-        _In_                            DWORD  FrameSize
+        _Out_writes_bytes_(Frames * m_FrameSize)    BYTE*  Buffer, 
+        _In_                                        ULONG  Frames
     );
 };
 
@@ -0,0 +1,572 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    binaural.h
+
+Abstract:
+
+    Binaural virtualizer: renders every speaker channel of a surround
+    stream through a pair of head related impulse responses into stereo
+    for headphones.
+
+    - The responses come from a spherical head model (Brown and Duda, "A
+      structural model for binaural sound synthesis", 1998): each ear
+      hears the speaker through a one-pole one-zero head shadow filter,
+      bilinear transformed, after the travel time around the head. They
+      are BINAURAL_TAPS long and built at compile time for each rate in
+      g_BinauralRates. Speakers sit at their usual azimuths (front 30,
+      side 90 and back 135 degrees); top speakers use the azimuth below
+      them, and LFE goes to both ears unfiltered.
+    - Convolution is uniformly partitioned: blocks of BINAURAL_BLOCK_FRAMES
+      are transformed overlap-save at twice that size (see realfft.h), and
+      each ear sums every channel's BINAURAL_PARTITIONS partitions against
+      a history of input spectra before one inverse transform.
+
+    The output lags the input by one block. Samples run in fixed point
+    (see fixedsample.h), the convolution in Q22 with Q20 taps.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_BINAURAL_H_
+#define _VIRTUALAUDIODRIVER_BINAURAL_H_
+
+#include "portable.h"
+#include "fixedsample.h"
+#include "realfft.h"
+#include "channelmatrix.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+#define BINAURAL_MAX_CHANNELS       8
+
+#define BINAURAL_BLOCK_BITS         6
+#define BINAURAL_BLOCK_FRAMES       (1 << BINAURAL_BLOCK_BITS)
+#define BINAURAL_FFT_BITS           (BINAURAL_BLOCK_BITS + 1)
+#define BINAURAL_BINS               (BINAURAL_BLOCK_FRAMES + 1)
+#define BINAURAL_TAPS               128
+#define BINAURAL_PARTITIONS         (BINAURAL_TAPS / BINAURAL_BLOCK_FRAMES)
+
+// Ears, and the output channels they are, left first.
+#define BINAURAL_EARS               2
+
+// The convolution runs on Q22 samples, kept below 2^23 (twice full
+// scale) so a transform of twice the block stays below 2^31.
+#define BINAURAL_SAMPLE_SHIFT       (FIXED_SAMPLE_SHIFT - 22)
+#define BINAURAL_SAMPLE_LIMIT       (1L << 23)
+
+// Taps are in Q20.
+#define BINAURAL_TAP_SHIFT          20
+
+#define BINAURAL_RATES              2
+
+// Model positions: azimuths 0, 15, 30, 90, 135 and 180 degrees, and LFE.
+#define BINAURAL_POSITIONS          7
+#define BINAURAL_POSITION_LFE       6
+
+//=============================================================================
+// Tables
+//=============================================================================
+constexpr ULONG g_BinauralRates[BINAURAL_RATES] = { 44100, 48000 };
+
+constexpr ULONG g_BinauralAzimuths[BINAURAL_POSITIONS - 1] = { 0, 15, 30, 90, 135, 180 };
+
+//
+// Model position of each speaker bit, and whether it is on the right,
+// which swaps the ears.
+//
+typedef struct _BINAURAL_SPEAKER
+{
+    ULONG       ulPosition;
+    BOOL        bRight;
+} BINAURAL_SPEAKER;
+
+constexpr BINAURAL_SPEAKER g_BinauralSpeakers[CHANNEL_MATRIX_SPEAKERS] =
+{
+    { 2, FALSE }, { 2, TRUE },                              // FL, FR
+    { 0, FALSE }, { BINAURAL_POSITION_LFE, FALSE },         // FC, LFE
+    { 4, FALSE }, { 4, TRUE },                              // BL, BR
+    { 1, FALSE }, { 1, TRUE },                              // FLC, FRC
+    { 5, FALSE },                                           // BC
+    { 3, FALSE }, { 3, TRUE },                              // SL, SR
+    { 0, FALSE },                                           // TC
+    { 2, FALSE }, { 0, FALSE }, { 2, TRUE },                // TFL, TFC, TFR
+    { 4, FALSE }, { 5, FALSE }, { 4, TRUE },                // TBL, TBC, TBR
+};
+
+//
+// cos(x) for 0 <= x <= 4. Only evaluated at compile time.
+//
+constexpr double BinauralCos(double x)
+{
+    double term = 1;
+    double sum = 1;
+
+    for (int n = 2; n < 48; n += 2)
+    {
+        term *= -x * x / ((n - 1) * n);
+        sum += term;
+    }
+
+    return sum;
+}
+
+//
+// Responses of the ear on the speaker's side (Near) and the other (Far),
+// in Q20, for a head of radius 8.75 cm. With theta the angle between the
+// speaker and the ear's axis:
+//   - the shadow is (1 + j alpha w / 2 w0) / (1 + j w / 2 w0), w0 = c / a,
+//     alpha = 1.05 + 0.95 cos(theta 180 / 150): +6 dB of treble facing
+//     the speaker, -20 dB at 150 degrees;
+//   - the delay is -(a / c) cos theta while the ear is lit and
+//     (a / c) (theta - pi / 2) once it is around the head, plus a / c
+//     and one sample to keep it positive, the fraction taken by a first
+//     order Thiran allpass.
+// Every response is scaled by one half.
+//
+struct BINAURAL_RESPONSES
+{
+    LONG Near[BINAURAL_RATES][BINAURAL_POSITIONS][BINAURAL_TAPS];
+    LONG Far[BINAURAL_RATES][BINAURAL_POSITIONS][BINAURAL_TAPS];
+
+    constexpr BINAURAL_RESPONSES() : Near(), Far()
+    {
+        for (ULONG r = 0; r < BINAURAL_RATES; r++)
+        {
+            for (ULONG p = 0; p < BINAURAL_POSITIONS; p++)
+            {
+                // Angles from the near ear's axis and the far one's; LFE
+                // takes the center's delays.
+                double phi = (p == BINAURAL_POSITION_LFE) ? 0 : g_BinauralAzimuths[p];
+
+                Model(g_BinauralRates[r], phi <= 90 ? 90 - phi : phi - 90, p == BINAURAL_POSITION_LFE, Near[r][p]);
+                Model(g_BinauralRates[r], phi <= 90 ? 90 + phi : 270 - phi, p == BINAURAL_POSITION_LFE, Far[r][p]);
+            }
+        }
+    }
+
+    static constexpr VOID Model(ULONG ulRate, double thetaDegrees, BOOL bFlat, LONG * plTaps)
+    {
+        const double pi = 3.1415926535897932384626433832795;
+        const double radius = 0.0875;
+        const double c = 343;
+        double theta = thetaDegrees * pi / 180;
+        double cosTheta = BinauralCos(theta);
+        double alpha = bFlat ? 1 : 1.05 + 0.95 * BinauralCos(theta * 180 / 150);
+        double delay = (theta < pi / 2) ? -(radius / c) * cosTheta : (radius / c) * (theta - pi / 2);
+        double samples = (delay + radius / c) * ulRate + 1;
+        ULONG ulWhole = (ULONG)(samples - 0.5);
+        double fraction = samples - ulWhole;
+        double allpass = (1 - fraction) / (1 + fraction);
+        double beta = 2 * c / radius;
+        double K = 2.0 * ulRate;
+        double b0 = (alpha * K + beta) / (K + beta);
+        double b1 = (beta - alpha * K) / (K + beta);
+        double a1 = (beta - K) / (K + beta);
+        double xPrevious = 0;
+        double aPrevious = 0;
+        double yPrevious = 0;
+
+        for (ULONG n = 0; n < BINAURAL_TAPS; n++)
+        {
+            double x = (n == ulWhole) ? 0.5 : 0;
+            double a = allpass * x + xPrevious - allpass * aPrevious;
+            double y = b0 * a + b1 * aPrevious - a1 * yPrevious;
+
+            plTaps[n] = (LONG)(y * (1L << BINAURAL_TAP_SHIFT) + (y < 0 ? -0.5 : 0.5));
+            xPrevious = x;
+            aPrevious = a;
+            yPrevious = y;
+        }
+    }
+};
+
+constexpr BINAURAL_RESPONSES g_BinauralResponses;
+
+//=============================================================================
+// State
+//=============================================================================
+
+//
+// One input channel's block buffers, input spectrum history and response
+// spectra. Input[p] is the spectrum p blocks before the newest, which is
+// at the head the virtualizer keeps.
+//
+typedef struct _BINAURAL_CHANNEL
+{
+    LONG        lPrevious[BINAURAL_BLOCK_FRAMES];   // Q22.
+    LONG        lInput[BINAURAL_BLOCK_FRAMES];      // Q22.
+    FFT_COMPLEX Input[BINAURAL_PARTITIONS][BINAURAL_BINS];
+    FFT_COMPLEX Response[BINAURAL_EARS][BINAURAL_PARTITIONS][BINAURAL_BINS];
+} BINAURAL_CHANNEL;
+typedef BINAURAL_CHANNEL *PBINAURAL_CHANNEL;
+
+//=============================================================================
+// Format kernels
+//=============================================================================
+
+//
+// Exchange moves ulFrames frames of pIn into the channels' block buffers
+// from offset ulOffset, and writes the stereo output of the previous block
+// at the same offsets to pOut.
+//
+typedef VOID BINAURAL_EXCHANGE_ROUTINE
+(
+    _In_ const BYTE *           pIn,
+    _Out_ PBYTE                 pOut,
+    _In_ ULONG                  ulFrames,
+    _In_ ULONG                  ulOffset,
+    _Inout_ PBINAURAL_CHANNEL   pChannels,
+    _In_ LONG                   lOut[BINAURAL_EARS][BINAURAL_BLOCK_FRAMES]
+);
+typedef BINAURAL_EXCHANGE_ROUTINE *PFN_BINAURAL_EXCHANGE;
+
+typedef struct _BINAURAL_IO
+{
+    PFN_BINAURAL_EXCHANGE   pfnExchange;
+    ULONG                   ulInFrameBytes;
+    ULONG                   ulOutFrameBytes;
+} BINAURAL_IO;
+typedef BINAURAL_IO *PBINAURAL_IO;
+
+///////////////////////////////////////////////////////////////////////////////
+// BinauralIo
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct BinauralIo
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG InFrameBytes = SampleBytes * Channels;
+    static const ULONG OutFrameBytes = SampleBytes * BINAURAL_EARS;
+
+    static VOID Exchange
+    (
+        _In_ const BYTE *           pIn,
+        _Out_ PBYTE                 pOut,
+        _In_ ULONG                  ulFrames,
+        _In_ ULONG                  ulOffset,
+        _Inout_ PBINAURAL_CHANNEL   pChannels,
+        _In_ LONG                   lOut[BINAURAL_EARS][BINAURAL_BLOCK_FRAMES]
+    )
+    {
+        for (ULONG i = ulOffset; i < ulOffset + ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                LONG lSample = FixedSample<Bits, Float>::Load(pIn + c * SampleBytes) >> BINAURAL_SAMPLE_SHIFT;
+
+                pChannels[c].lInput[i] = lSample > BINAURAL_SAMPLE_LIMIT ? BINAURAL_SAMPLE_LIMIT :
+                                         lSample < -BINAURAL_SAMPLE_LIMIT ? -BINAURAL_SAMPLE_LIMIT : lSample;
+            }
+            for (ULONG e = 0; e < BINAURAL_EARS; e++)
+            {
+                FixedSample<Bits, Float>::Store(pOut + e * SampleBytes,
+                                                FixedSaturate((LONGLONG)lOut[e][i] * (1LL << BINAURAL_SAMPLE_SHIFT)));
+            }
+            pIn += InFrameBytes;
+            pOut += OutFrameBytes;
+        }
+    }
+};
+
+template <ULONG Bits, ULONG Channels, BOOL Float>
+VOID SetBinauralIo
+(
+    _Out_ PBINAURAL_IO      pIo
+)
+{
+    pIo->pfnExchange = BinauralIo<Bits, Channels, Float>::Exchange;
+    pIo->ulInFrameBytes = BinauralIo<Bits, Channels, Float>::InFrameBytes;
+    pIo->ulOutFrameBytes = BinauralIo<Bits, Channels, Float>::OutFrameBytes;
+}
+
+template <ULONG Bits, BOOL Float>
+BOOL SelectBinauralIo
+(
+    _In_ ULONG              ulChannels,
+    _Out_ PBINAURAL_IO      pIo
+)
+{
+    switch (ulChannels)
+    {
+        case 1: SetBinauralIo<Bits, 1, Float>(pIo); return TRUE;
+        case 2: SetBinauralIo<Bits, 2, Float>(pIo); return TRUE;
+        case 3: SetBinauralIo<Bits, 3, Float>(pIo); return TRUE;
+        case 4: SetBinauralIo<Bits, 4, Float>(pIo); return TRUE;
+        case 5: SetBinauralIo<Bits, 5, Float>(pIo); return TRUE;
+        case 6: SetBinauralIo<Bits, 6, Float>(pIo); return TRUE;
+        case 7: SetBinauralIo<Bits, 7, Float>(pIo); return TRUE;
+        case 8: SetBinauralIo<Bits, 8, Float>(pIo); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Picks the instance for a stream format: 8/16/24/32-bit PCM and 32-bit
+// float with 1 to BINAURAL_MAX_CHANNELS channels. Returns FALSE otherwise.
+//
+inline BOOL GetBinauralIo
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat,
+    _Out_ PBINAURAL_IO      pIo
+)
+{
+    RtlZeroMemory(pIo, sizeof(*pIo));
+
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectBinauralIo<32, TRUE>(ulChannels, pIo) : FALSE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectBinauralIo<8, FALSE>(ulChannels, pIo);
+        case 16: return SelectBinauralIo<16, FALSE>(ulChannels, pIo);
+        case 24: return SelectBinauralIo<24, FALSE>(ulChannels, pIo);
+        case 32: return SelectBinauralIo<32, FALSE>(ulChannels, pIo);
+    }
+
+    return FALSE;
+}
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CBinauralVirtualizer
+//
+//   Owned by one render stream and only touched from its position update.
+//
+class CBinauralVirtualizer
+{
+protected:
+    BINAURAL_IO                 m_Io;
+    ULONG                       m_ulChannels;
+    PBINAURAL_CHANNEL           m_pChannels;
+    ULONG                       m_ulFill;               // Frames in the current block.
+    ULONG                       m_ulHead;               // Partition of the newest input block.
+    LONG                        m_lTime[2 * BINAURAL_BLOCK_FRAMES];
+    FFT_COMPLEX                 m_Spectrum[BINAURAL_BINS];
+    LONG                        m_lOut[BINAURAL_EARS][BINAURAL_BLOCK_FRAMES]; // Q22.
+
+public:
+    CBinauralVirtualizer() :
+        m_ulChannels(0),
+        m_pChannels(NULL),
+        m_ulFill(0),
+        m_ulHead(0)
+    {
+        RtlZeroMemory(&m_Io, sizeof(m_Io));
+    }
+
+    //
+    // Bytes of state Init needs, 0 if the channel count is not supported.
+    //
+    static ULONG GetStorageBytes
+    (
+        _In_ ULONG      ulChannels
+    )
+    {
+        if (ulChannels == 0 || ulChannels > BINAURAL_MAX_CHANNELS)
+        {
+            return 0;
+        }
+
+        return ulChannels * sizeof(BINAURAL_CHANNEL);
+    }
+
+    //
+    // Binds pStorage, at least GetStorageBytes bytes, as the state and
+    // transforms the responses of the speakers in ulChannelMask (see
+    // ChannelMatrixMask). Returns FALSE for formats and rates the
+    // virtualizer does not cover.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulChannels,
+        _In_ ULONG      ulChannelMask,
+        _In_ BOOL       bFloat,
+        _In_ PVOID      pStorage,
+        _In_ ULONG      cbStorage
+    )
+    {
+        ULONG cbNeeded = GetStorageBytes(ulChannels);
+        ULONG ulRate = 0;
+        ULONG ulMask;
+
+        while (ulRate < BINAURAL_RATES && g_BinauralRates[ulRate] != ulSampleRate)
+        {
+            ulRate++;
+        }
+
+        if (ulRate == BINAURAL_RATES || cbNeeded == 0 || pStorage == NULL || cbStorage < cbNeeded ||
+            !GetBinauralIo(ulBitsPerSample, ulChannels, bFloat, &m_Io))
+        {
+            RtlZeroMemory(&m_Io, sizeof(m_Io));
+            return FALSE;
+        }
+
+        m_pChannels = (PBINAURAL_CHANNEL)pStorage;
+        m_ulChannels = ulChannels;
+
+        ulMask = ChannelMatrixMask(ulChannelMask, ulChannels);
+        for (ULONG c = 0; c < ulChannels; c++)
+        {
+            ULONG ulSpeaker = ulMask & (0 - ulMask);
+            const BINAURAL_SPEAKER & speaker = g_BinauralSpeakers[ChannelMatrixCountBits(ulSpeaker - 1)];
+            const LONG * plEars[BINAURAL_EARS] =
+            {
+                speaker.bRight ? g_BinauralResponses.Far[ulRate][speaker.ulPosition] : g_BinauralResponses.Near[ulRate][speaker.ulPosition],
+                speaker.bRight ? g_BinauralResponses.Near[ulRate][speaker.ulPosition] : g_BinauralResponses.Far[ulRate][speaker.ulPosition],
+            };
+
+            // A block of taps followed by a block of zeros per partition.
+            for (ULONG e = 0; e < BINAURAL_EARS; e++)
+            {
+                for (ULONG p = 0; p < BINAURAL_PARTITIONS; p++)
+                {
+                    RtlZeroMemory(m_lTime, sizeof(m_lTime));
+                    RtlCopyMemory(m_lTime, plEars[e] + p * BINAURAL_BLOCK_FRAMES, BINAURAL_BLOCK_FRAMES * sizeof(LONG));
+                    RealFftForward(BINAURAL_FFT_BITS, m_lTime, m_pChannels[c].Response[e][p]);
+                }
+            }
+            ulMask &= ulMask - 1;
+        }
+
+        Reset();
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_Io.pfnExchange != NULL;
+    }
+
+    //
+    // Bytes of output for cbData bytes of input.
+    //
+    ULONG GetOutputBytes(_In_ ULONG cbData) const
+    {
+        return IsActive() ? (cbData / m_Io.ulInFrameBytes) * m_Io.ulOutFrameBytes : 0;
+    }
+
+    //
+    // Forgets the buffered audio.
+    //
+    VOID Reset()
+    {
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            RtlZeroMemory(m_pChannels[c].lPrevious, sizeof(m_pChannels[c].lPrevious));
+            RtlZeroMemory(m_pChannels[c].lInput, sizeof(m_pChannels[c].lInput));
+            RtlZeroMemory(m_pChannels[c].Input, sizeof(m_pChannels[c].Input));
+        }
+        RtlZeroMemory(m_lOut, sizeof(m_lOut));
+        m_ulFill = 0;
+        m_ulHead = 0;
+    }
+
+    //
+    // Renders the whole frames of pIn to stereo in the same sample format
+    // at pOut, which takes GetOutputBytes(cbData) bytes.
+    //
+    VOID Process
+    (
+        _In_reads_bytes_(cbData) const BYTE *   pIn,
+        _In_ ULONG                              cbData,
+        _Out_ PBYTE                             pOut
+    )
+    {
+        ULONG ulFrames = IsActive() ? cbData / m_Io.ulInFrameBytes : 0;
+
+        while (ulFrames > 0)
+        {
+            ULONG ulRun = BINAURAL_BLOCK_FRAMES - m_ulFill;
+
+            ulRun = ulRun < ulFrames ? ulRun : ulFrames;
+            m_Io.pfnExchange(pIn, pOut, ulRun, m_ulFill, m_pChannels, m_lOut);
+            m_ulFill += ulRun;
+
+            if (m_ulFill == BINAURAL_BLOCK_FRAMES)
+            {
+                RunBlock();
+                m_ulFill = 0;
+            }
+
+            pIn += ulRun * m_Io.ulInFrameBytes;
+            pOut += ulRun * m_Io.ulOutFrameBytes;
+            ulFrames -= ulRun;
+        }
+    }
+
+private:
+    //
+    // One block: transform every channel's input, then per ear sum the
+    // partitions of every channel against its history and transform back.
+    //
+    VOID RunBlock()
+    {
+        const ULONG B = BINAURAL_BLOCK_FRAMES;
+
+        m_ulHead = (m_ulHead + 1) % BINAURAL_PARTITIONS;
+
+        // Overlap-save: each transform spans this block and the last.
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            BINAURAL_CHANNEL & channel = m_pChannels[c];
+
+            for (ULONG n = 0; n < B; n++)
+            {
+                m_lTime[n] = channel.lPrevious[n];
+                m_lTime[B + n] = channel.lInput[n];
+                channel.lPrevious[n] = channel.lInput[n];
+            }
+            RealFftForward(BINAURAL_FFT_BITS, m_lTime, channel.Input[m_ulHead]);
+        }
+
+        for (ULONG e = 0; e < BINAURAL_EARS; e++)
+        {
+            for (ULONG k = 0; k < BINAURAL_BINS; k++)
+            {
+                LONGLONG llRe = 0;
+                LONGLONG llIm = 0;
+
+                for (ULONG c = 0; c < m_ulChannels; c++)
+                {
+                    for (ULONG p = 0; p < BINAURAL_PARTITIONS; p++)
+                    {
+                        const FFT_COMPLEX & x = m_pChannels[c].Input[(m_ulHead + BINAURAL_PARTITIONS - p) % BINAURAL_PARTITIONS][k];
+                        const FFT_COMPLEX & h = m_pChannels[c].Response[e][p][k];
+
+                        llRe += (LONGLONG)x.lRe * h.lRe - (LONGLONG)x.lIm * h.lIm;
+                        llIm += (LONGLONG)x.lRe * h.lIm + (LONGLONG)x.lIm * h.lRe;
+                    }
+                }
+
+                m_Spectrum[k].lRe = FixedSaturate(llRe >> BINAURAL_TAP_SHIFT);
+                m_Spectrum[k].lIm = FixedSaturate(llIm >> BINAURAL_TAP_SHIFT);
+            }
+            RealFftInverse(BINAURAL_FFT_BITS, m_Spectrum, m_lTime);
+
+            // The last half is the linear part.
+            for (ULONG n = 0; n < B; n++)
+            {
+                LONG lSample = m_lTime[B + n];
+
+                m_lOut[e][n] = lSample > BINAURAL_SAMPLE_LIMIT ? BINAURAL_SAMPLE_LIMIT :
+                               lSample < -BINAURAL_SAMPLE_LIMIT ? -BINAURAL_SAMPLE_LIMIT : lSample;
+            }
+        }
+    }
+};
+typedef CBinauralVirtualizer *PCBinauralVirtualizer;
+
+#endif // _VIRTUALAUDIODRIVER_BINAURAL_H_
@@ -0,0 +1,626 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    capturefile.cpp
+
+Abstract:
+
+    Implementation of the file-backed capture source. Files are loaded and
+    decoded at PASSIVE_LEVEL when a stream is created; after that the
+    capture position update only copies rendered bytes out of a ring.
+--*/
+#pragma warning (disable : 4127)
+
+#include "definitions.h"
+#include "capturefile.h"
+#include <ntstrsafe.h>
+
+#define CAPTUREFILE_POOLTAG         'FCDV'
+
+// File data decoded per read while loading.
+#define CAPTUREFILE_LOAD_CHUNK      (64 * 1024)
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+//=============================================================================
+#pragma code_seg("PAGE")
+static BOOL CaptureFileRead
+(
+    _In_ PVOID                          Context,
+    _In_ ULONGLONG                      ullOffset,
+    _Out_writes_bytes_(cbData) PVOID    pData,
+    _In_ ULONG                          cbData
+)
+/*++
+
+Routine Description:
+
+  WAVEFILE_READ_ROUTINE over a file handle.
+
+--*/
+{
+    PAGED_CODE();
+
+    IO_STATUS_BLOCK     ioStatusBlock;
+    LARGE_INTEGER       offset;
+    NTSTATUS            ntStatus;
+
+    offset.QuadPart = (LONGLONG)ullOffset;
+
+    ntStatus = ZwReadFile((HANDLE)Context,
+                          NULL,
+                          NULL,
+                          NULL,
+                          &ioStatusBlock,
+                          pData,
+                          cbData,
+                          &offset,
+                          NULL);
+
+    return NT_SUCCESS(ntStatus) && ioStatusBlock.Information == cbData;
+} // CaptureFileRead
+
+//=============================================================================
+// CCaptureFileCache
+//=============================================================================
+
+//=============================================================================
+#pragma code_seg("PAGE")
+CCaptureFileCache::CCaptureFileCache()
+{
+    PAGED_CODE();
+
+    KeInitializeMutex(&m_Lock, 0);
+} // CCaptureFileCache
+
+//=============================================================================
+#pragma code_seg("PAGE")
+CCaptureFileCache::~CCaptureFileCache()
+{
+    PAGED_CODE();
+
+    // Streams release their assets before the adapter goes away.
+} // ~CCaptureFileCache
+
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+CCaptureFileCache::Acquire
+(
+    _In_  PCUNICODE_STRING  FileName,
+    _Out_ PWAVE_ASSET *     ppAsset
+)
+/*++
+
+Routine Description:
+
+  Returns the decoded asset for FileName with a reference for the caller,
+  loading it if no stream has it yet. Loading happens under the lock, so
+  streams asking for the same file at once load it once.
+
+Arguments:
+
+  FileName - path of a WAVE or RF64 file.
+
+  ppAsset - receives the asset; pass it to Release when done.
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS    ntStatus;
+    WCHAR       name[WAVE_ASSET_MAX_NAME];
+    PWAVE_ASSET pAsset;
+
+    *ppAsset = NULL;
+
+    ntStatus = RtlStringCchCopyNW(name, WAVE_ASSET_MAX_NAME, FileName->Buffer, FileName->Length / sizeof(WCHAR));
+    if (!NT_SUCCESS(ntStatus))
+    {
+        return ntStatus;
+    }
+
+    KeWaitForSingleObject(&m_Lock, Executive, KernelMode, FALSE, NULL);
+
+    pAsset = m_Table.Find(name);
+    if (pAsset == NULL)
+    {
+        ntStatus = Load(name, &pAsset);
+        if (NT_SUCCESS(ntStatus) && !m_Table.Insert(pAsset))
+        {
+            DPF(D_TERSE, ("[CCaptureFileCache::Acquire] Too many capture files"));
+            Free(pAsset);
+            pAsset = NULL;
+            ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    KeReleaseMutex(&m_Lock, FALSE);
+
+    *ppAsset = pAsset;
+
+    return ntStatus;
+} // Acquire
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CCaptureFileCache::Release
+(
+    _In_  PWAVE_ASSET       pAsset
+)
+{
+    PAGED_CODE();
+
+    BOOL fLast;
+
+    KeWaitForSingleObject(&m_Lock, Executive, KernelMode, FALSE, NULL);
+    fLast = m_Table.Release(pAsset);
+    KeReleaseMutex(&m_Lock, FALSE);
+
+    if (fLast)
+    {
+        Free(pAsset);
+    }
+} // Release
+
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+CCaptureFileCache::Load
+(
+    _In_  PCWSTR            FileName,
+    _Out_ PWAVE_ASSET *     ppAsset
+)
+/*++
+
+Routine Description:
+
+  Reads and decodes a whole file into a new asset.
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS                    ntStatus;
+    UNICODE_STRING              fileName;
+    OBJECT_ATTRIBUTES           objectAttributes;
+    IO_STATUS_BLOCK             ioStatusBlock;
+    FILE_STANDARD_INFORMATION   fileInfo;
+    HANDLE                      fileHandle = NULL;
+    WAVEFILE_INFO               waveInfo;
+    ULONGLONG                   cbSamples;
+    PBYTE                       pScratch = NULL;
+    PWAVE_ASSET                 pAsset = NULL;
+
+    *ppAsset = NULL;
+
+    RtlInitUnicodeString(&fileName, FileName);
+    InitializeObjectAttributes(&objectAttributes,
+                               &fileName,
+                               OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE,
+                               NULL,
+                               NULL);
+
+    ntStatus = ZwCreateFile(&fileHandle,
+                            GENERIC_READ | SYNCHRONIZE,
+                            &objectAttributes,
+                            &ioStatusBlock,
+                            NULL,
+                            FILE_ATTRIBUTE_NORMAL,
+                            FILE_SHARE_READ,
+                            FILE_OPEN,
+                            FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                            NULL,
+                            0);
+    if (!NT_SUCCESS(ntStatus))
+    {
+        DPF(D_TERSE, ("[CCaptureFileCache::Load] Cannot open %S, 0x%x", FileName, ntStatus));
+        return ntStatus;
+    }
+
+    ntStatus = ZwQueryInformationFile(fileHandle,
+                                      &ioStatusBlock,
+                                      &fileInfo,
+                                      sizeof(fileInfo),
+                                      FileStandardInformation);
+    IF_FAILED_JUMP(ntStatus, Done);
+
+    if (!WaveFileParse(CaptureFileRead, fileHandle, (ULONGLONG)fileInfo.EndOfFile.QuadPart, &waveInfo))
+    {
+        DPF(D_TERSE, ("[CCaptureFileCache::Load] %S is not a supported WAVE file", FileName));
+        ntStatus = STATUS_NOT_SUPPORTED;
+        goto Done;
+    }
+
+    cbSamples = WaveFileGetDecodedBytes(&waveInfo);
+    if (cbSamples == 0)
+    {
+        DPF(D_TERSE, ("[CCaptureFileCache::Load] %S is too long", FileName));
+        ntStatus = STATUS_FILE_TOO_LARGE;
+        goto Done;
+    }
+
+    pAsset = (PWAVE_ASSET)ExAllocatePool2(POOL_FLAG_PAGED, sizeof(WAVE_ASSET), CAPTUREFILE_POOLTAG);
+    pScratch = (PBYTE)ExAllocatePool2(POOL_FLAG_PAGED, CAPTUREFILE_LOAD_CHUNK, CAPTUREFILE_POOLTAG);
+    if (pAsset == NULL || pScratch == NULL)
+    {
+        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+        goto Done;
+    }
+
+    // Only ever touched at PASSIVE_LEVEL by the players' filler threads.
+    pAsset->pSamples = (PLONG)ExAllocatePool2(POOL_FLAG_PAGED, (SIZE_T)cbSamples, CAPTUREFILE_POOLTAG);
+    if (pAsset->pSamples == NULL)
+    {
+        DPF(D_TERSE, ("[CCaptureFileCache::Load] Insufficient memory for %I64u bytes of samples", cbSamples));
+        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+        goto Done;
+    }
+
+    if (!WaveFileLoadSamples(CaptureFileRead, fileHandle, &waveInfo, pAsset->pSamples, pScratch, CAPTUREFILE_LOAD_CHUNK))
+    {
+        DPF(D_TERSE, ("[CCaptureFileCache::Load] Error reading %S", FileName));
+        ntStatus = STATUS_UNEXPECTED_IO_ERROR;
+        goto Done;
+    }
+
+    RtlStringCchCopyW(pAsset->Name, WAVE_ASSET_MAX_NAME, FileName);
+    pAsset->ulChannels = waveInfo.ulChannels;
+    pAsset->ulSampleRate = waveInfo.ulSampleRate;
+    pAsset->ullFrames = waveInfo.ullFrames;
+
+    DPF(D_VERBOSE, ("[CCaptureFileCache::Load] %S: %u channels, %u Hz, %I64u frames",
+                    FileName, pAsset->ulChannels, pAsset->ulSampleRate, pAsset->ullFrames));
+
+    *ppAsset = pAsset;
+    pAsset = NULL;
+
+Done:
+    if (pAsset)
+    {
+        Free(pAsset);
+    }
+
+    if (pScratch)
+    {
+        ExFreePoolWithTag(pScratch, CAPTUREFILE_POOLTAG);
+    }
+
+    ZwClose(fileHandle);
+
+    return ntStatus;
+} // Load
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CCaptureFileCache::Free
+(
+    _In_  PWAVE_ASSET       pAsset
+)
+{
+    PAGED_CODE();
+
+    if (pAsset->pSamples)
+    {
+        ExFreePoolWithTag(pAsset->pSamples, CAPTUREFILE_POOLTAG);
+    }
+
+    ExFreePoolWithTag(pAsset, CAPTUREFILE_POOLTAG);
+} // Free
+
+//=============================================================================
+// CCaptureFilePlayer
+//=============================================================================
+
+//=============================================================================
+#pragma code_seg("PAGE")
+CCaptureFilePlayer::CCaptureFilePlayer()
+:   m_pCache(NULL),
+    m_pAsset(NULL),
+    m_pRingBuffer(NULL),
+    m_ulFrameBytes(0),
+    m_ulStageBytes(0),
+    m_pStage(NULL),
+    m_pFillerThread(NULL),
+    m_lStopRequested(0)
+{
+    PAGED_CODE();
+
+    KeInitializeEvent(&m_WakeEvent, SynchronizationEvent, FALSE);
+} // CCaptureFilePlayer
+
+//=============================================================================
+#pragma code_seg("PAGE")
+CCaptureFilePlayer::~CCaptureFilePlayer()
+{
+    PAGED_CODE();
+
+    Cleanup();
+} // ~CCaptureFilePlayer
+
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+CCaptureFilePlayer::Init
+(
+    _In_  PCCaptureFileCache    pCache,
+    _In_  PCUNICODE_STRING      FileName,
+    _In_  PWAVEFORMATEX         pWfEx
+)
+/*++
+
+Routine Description:
+
+  Gets the file from the cache, fills the read-ahead ring and starts the
+  filler thread. The file must have the stream's sample rate.
+
+Arguments:
+
+  pCache - the adapter's cache.
+
+  FileName - path of a WAVE or RF64 file.
+
+  pWfEx - capture stream format.
+
+Return Value:
+
+  NT status code. On failure the player stays inactive.
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS    ntStatus;
+    BOOL        bFloat = FALSE;
+    ULONG       ulHalfBytes;
+    HANDLE      threadHandle = NULL;
+
+    if (pWfEx->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    {
+        bFloat = TRUE;
+    }
+    else if (pWfEx->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+             pWfEx->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))
+    {
+        bFloat = IsEqualGUIDAligned(((PWAVEFORMATEXTENSIBLE)pWfEx)->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+    }
+
+    ntStatus = pCache->Acquire(FileName, &m_pAsset);
+    if (!NT_SUCCESS(ntStatus))
+    {
+        return ntStatus;
+    }
+    m_pCache = pCache;
+
+    if (m_pAsset->ulSampleRate != pWfEx->nSamplesPerSec)
+    {
+        DPF(D_TERSE, ("[CCaptureFilePlayer::Init] File is %u Hz, stream is %u Hz", m_pAsset->ulSampleRate, pWfEx->nSamplesPerSec));
+        ntStatus = STATUS_NOT_SUPPORTED;
+        goto Done;
+    }
+
+    if (!m_Reader.Init(m_pAsset, pWfEx->wBitsPerSample, pWfEx->nChannels, bFloat) ||
+        m_Reader.GetFrameBytes() > LOOPBACK_MAX_FRAME_BYTES)
+    {
+        ntStatus = STATUS_NOT_SUPPORTED;
+        goto Done;
+    }
+    m_ulFrameBytes = m_Reader.GetFrameBytes();
+
+    //
+    // Two halves of CAPTURE_FILE_HALF_MS each, rounded up to a power of two
+    // for the ring.
+    //
+    ulHalfBytes = PAGE_SIZE;
+    while (ulHalfBytes < pWfEx->nAvgBytesPerSec / 1000 * CAPTURE_FILE_HALF_MS)
+    {
+        ulHalfBytes <<= 1;
+    }
+    m_ulStageBytes = ulHalfBytes - ulHalfBytes % m_ulFrameBytes;
+
+    m_pRingBuffer = (PBYTE)ExAllocatePool2(POOL_FLAG_NON_PAGED, 2 * ulHalfBytes, CAPTUREFILE_POOLTAG);
+    m_pStage = (PBYTE)ExAllocatePool2(POOL_FLAG_PAGED, m_ulStageBytes, CAPTUREFILE_POOLTAG);
+    if (m_pRingBuffer == NULL || m_pStage == NULL)
+    {
+        DPF(D_TERSE, ("[CCaptureFilePlayer::Init] Insufficient memory for read-ahead"));
+        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+        goto Done;
+    }
+
+    m_Ring.Attach(m_pRingBuffer, 2 * ulHalfBytes);
+    m_Ring.BeginProducerSession(m_ulFrameBytes);
+
+    // Both halves are ready before the first position update.
+    Fill();
+
+    m_lStopRequested = 0;
+    ntStatus = PsCreateSystemThread(&threadHandle,
+                                    THREAD_ALL_ACCESS,
+                                    NULL,
+                                    NULL,
+                                    NULL,
+                                    CaptureFileFillerThread,
+                                    this);
+    IF_FAILED_JUMP(ntStatus, Done);
+
+    ntStatus = ObReferenceObjectByHandle(threadHandle,
+                                         THREAD_ALL_ACCESS,
+                                         *PsThreadType,
+                                         KernelMode,
+                                         (PVOID *)&m_pFillerThread,
+                                         NULL);
+    if (!NT_SUCCESS(ntStatus))
+    {
+        InterlockedExchange(&m_lStopRequested, 1);
+        KeSetEvent(&m_WakeEvent, 0, FALSE);
+        ZwWaitForSingleObject(threadHandle, FALSE, NULL);
+        m_pFillerThread = NULL;
+    }
+
+    ZwClose(threadHandle);
+
+Done:
+    if (!NT_SUCCESS(ntStatus))
+    {
+        Cleanup();
+    }
+
+    return ntStatus;
+} // Init
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CCaptureFilePlayer::Cleanup()
+/*++
+
+Routine Description:
+
+  Stops the filler thread and gives the asset back. The stream must no
+  longer call Read.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (m_pFillerThread)
+    {
+        InterlockedExchange(&m_lStopRequested, 1);
+        KeSetEvent(&m_WakeEvent, 0, FALSE);
+
+        KeWaitForSingleObject(m_pFillerThread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(m_pFillerThread);
+        m_pFillerThread = NULL;
+    }
+
+    if (m_Ring.GetUnderrunBytes() > 0)
+    {
+        DPF(D_TERSE, ("[CCaptureFilePlayer::Cleanup] %I64u bytes of silence, filler fell behind", m_Ring.GetUnderrunBytes()));
+    }
+
+    if (m_pRingBuffer)
+    {
+        ExFreePoolWithTag(m_pRingBuffer, CAPTUREFILE_POOLTAG);
+        m_pRingBuffer = NULL;
+    }
+
+    if (m_pStage)
+    {
+        ExFreePoolWithTag(m_pStage, CAPTUREFILE_POOLTAG);
+        m_pStage = NULL;
+    }
+
+    if (m_pAsset)
+    {
+        m_pCache->Release(m_pAsset);
+        m_pAsset = NULL;
+    }
+} // Cleanup
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CCaptureFilePlayer::Fill()
+/*++
+
+Routine Description:
+
+  Renders the asset into every free half of the ring.
+
+--*/
+{
+    PAGED_CODE();
+
+    while (m_Ring.GetCapacity() - m_Ring.GetBytesAvailable() >= m_ulStageBytes)
+    {
+        m_Reader.Render(m_pStage, m_ulStageBytes / m_ulFrameBytes);
+        m_Ring.Write(m_pStage, m_ulStageBytes);
+    }
+} // Fill
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CCaptureFilePlayer::FillerLoop()
+{
+    PAGED_CODE();
+
+    LARGE_INTEGER timeout;
+
+    // Read wakes the thread as soon as a half is free; the timeout only
+    // covers a missed wake.
+    timeout.QuadPart = -10000LL * CAPTURE_FILE_HALF_MS / 2;
+
+    for (;;)
+    {
+        KeWaitForSingleObject(&m_WakeEvent, Executive, KernelMode, FALSE, &timeout);
+
+        if (m_lStopRequested != 0)
+        {
+            break;
+        }
+
+        Fill();
+    }
+} // FillerLoop
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CaptureFileFillerThread
+(
+    _In_ PVOID      StartContext
+)
+{
+    PAGED_CODE();
+
+    ASSERT(StartContext);
+
+    ((PCCaptureFilePlayer)StartContext)->FillerLoop();
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+} // CaptureFileFillerThread
+
+#pragma code_seg()
+//=============================================================================
+VOID
+CCaptureFilePlayer::Read
+(
+    _Out_writes_bytes_(cbData) PBYTE    pData,
+    _In_ ULONG                          cbData
+)
+/*++
+
+Routine Description:
+
+  Copies the next cbData bytes of the file into the capture buffer. Runs
+  at DISPATCH_LEVEL in the position update. Whatever the ring cannot
+  supply is silence.
+
+--*/
+{
+    ULONG cbFreeBefore = m_Ring.GetCapacity() - m_Ring.GetBytesAvailable();
+    ULONG cbRead = m_Ring.Read(pData, cbData, m_ulFrameBytes);
+
+    if (cbRead < cbData)
+    {
+        RtlZeroMemory(pData + cbRead, cbData - cbRead);
+    }
+
+    // Wake the filler when a half has become free.
+    if (cbFreeBefore < m_ulStageBytes && cbFreeBefore + cbRead >= m_ulStageBytes)
+    {
+        KeSetEvent(&m_WakeEvent, 0, FALSE);
+    }
+} // Read
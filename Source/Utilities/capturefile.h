@@ -0,0 +1,134 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    capturefile.h
+
+Abstract:
+
+    Declaration of the file-backed capture source. The adapter owns one
+    CCaptureFileCache that loads each WAVE/RF64 file once and shares the
+    decoded samples between streams; each capture stream playing a file
+    owns a CCaptureFilePlayer that renders it ahead of the stream into a
+    double-buffered ring, so the position update only copies.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_CAPTUREFILE_H_
+#define _VIRTUALAUDIODRIVER_CAPTUREFILE_H_
+
+#include "wavefile.h"
+#include "loopbackring.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Length of one half of the read-ahead ring.
+#define CAPTURE_FILE_HALF_MS        100
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CCaptureFileCache
+//
+//   Decoded assets by file name. Acquire and Release run at PASSIVE_LEVEL;
+//   the samples are in paged pool.
+//
+class CCaptureFileCache
+{
+protected:
+    KMUTEX                      m_Lock;
+    CWaveAssetTable             m_Table;
+
+public:
+    CCaptureFileCache();
+    ~CCaptureFileCache();
+
+    NTSTATUS Acquire
+    (
+        _In_  PCUNICODE_STRING  FileName,
+        _Out_ PWAVE_ASSET *     ppAsset
+    );
+
+    VOID Release
+    (
+        _In_  PWAVE_ASSET       pAsset
+    );
+
+private:
+    static NTSTATUS Load
+    (
+        _In_  PCWSTR            FileName,
+        _Out_ PWAVE_ASSET *     ppAsset
+    );
+
+    static VOID Free
+    (
+        _In_  PWAVE_ASSET       pAsset
+    );
+};
+typedef CCaptureFileCache *PCCaptureFileCache;
+
+///////////////////////////////////////////////////////////////////////////////
+// CCaptureFilePlayer
+//
+//   A filler thread renders the asset into the ring half a ring at a time
+//   and sleeps until the stream has consumed a half. Read runs in the
+//   capture stream's position update at DISPATCH_LEVEL and never waits; if
+//   the filler falls behind the stream gets silence.
+//
+KSTART_ROUTINE CaptureFileFillerThread;
+
+class CCaptureFilePlayer
+{
+protected:
+    PCCaptureFileCache          m_pCache;           // Owned by the adapter.
+    PWAVE_ASSET                 m_pAsset;
+    CWaveAssetReader            m_Reader;           // Filler thread only.
+    PBYTE                       m_pRingBuffer;
+    CLoopbackRing               m_Ring;             // Filler thread -> Read.
+    ULONG                       m_ulFrameBytes;
+    ULONG                       m_ulStageBytes;     // Whole frames in one half.
+    PBYTE                       m_pStage;           // One half, rendered.
+
+    PKTHREAD                    m_pFillerThread;
+    KEVENT                      m_WakeEvent;        // A half was consumed, or stop.
+    volatile LONG               m_lStopRequested;
+
+public:
+    CCaptureFilePlayer();
+    ~CCaptureFilePlayer();
+
+    NTSTATUS Init
+    (
+        _In_  PCCaptureFileCache    pCache,
+        _In_  PCUNICODE_STRING      FileName,
+        _In_  PWAVEFORMATEX         pWfEx
+    );
+
+    VOID Cleanup();
+
+    BOOL IsActive() const
+    {
+        return m_pFillerThread != NULL;
+    }
+
+    VOID Read
+    (
+        _Out_writes_bytes_(cbData) PBYTE    pData,
+        _In_ ULONG                          cbData
+    );
+
+private:
+    VOID Fill();
+
+    VOID FillerLoop();
+
+    friend
+    KSTART_ROUTINE              CaptureFileFillerThread;
+};
+typedef CCaptureFilePlayer *PCCaptureFilePlayer;
+
+#endif // _VIRTUALAUDIODRIVER_CAPTUREFILE_H_
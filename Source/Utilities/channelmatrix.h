@@ -0,0 +1,646 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    channelmatrix.h
+
+Abstract:
+
+    Up and downmix between speaker layouts.
+
+    - A matrix is built from a pair of WAVEFORMATEXTENSIBLE channel masks.
+      Speakers both layouts have pass straight through. A missing one is
+      folded into its neighbours with the ITU-R BS.775 coefficients: a
+      back speaker to its side twin (and the reverse) at unity, as both
+      name the same surround, or at -3 dB when the source has the twin
+      too and the two are merged, or else to its front speaker at -3 dB; the
+      center to front left and right at -3 dB; front left and right to the
+      center at -3 dB for mono; top speakers to the ones below them at
+      -3 dB. Folds repeat until the speaker lands in the destination.
+      LFE is dropped, as in the ITU downmix, unless an LFE gain is given.
+      When any output row sums to more than unity the whole matrix is
+      scaled down by that sum, so a full scale downmix does not clip.
+    - Matrices are kept in a small cache per pair (CChannelMatrixCache).
+    - CChannelMixer runs one on interleaved frames of any 8/16/24/32-bit
+      PCM or 32-bit float layout, in blocks through the fixed point domain
+      (see fixedsample.h). The 8->2, 6->2, 2->8, 2->6, 2->1 and 1->2 shapes
+      have dense kernels with both channel counts fixed at compile time;
+      every other pair runs the sparse kernel over the non-zero gains.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_CHANNELMATRIX_H_
+#define _VIRTUALAUDIODRIVER_CHANNELMATRIX_H_
+
+#include "portable.h"
+#include "fixedsample.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+#define CHANNEL_MATRIX_MAX_CHANNELS     8
+
+// Gains are in Q30.
+#define CHANNEL_MATRIX_GAIN_SHIFT       30
+#define CHANNEL_MATRIX_UNITY            (1L << CHANNEL_MATRIX_GAIN_SHIFT)
+#define CHANNEL_MATRIX_MINUS_3DB        759250125L      // 1 / sqrt(2)
+
+// Matrices CChannelMatrixCache keeps.
+#define CHANNEL_MATRIX_CACHE_ENTRIES    4
+
+// Frames CChannelMixer converts at a time.
+#define CHANNEL_MATRIX_BLOCK_FRAMES     32
+
+// Folds a missing speaker may take before it is dropped.
+#define CHANNEL_MATRIX_MAX_FOLDS        4
+
+#ifndef SPEAKER_FRONT_LEFT
+#define SPEAKER_FRONT_LEFT              0x1
+#define SPEAKER_FRONT_RIGHT             0x2
+#define SPEAKER_FRONT_CENTER            0x4
+#define SPEAKER_LOW_FREQUENCY           0x8
+#define SPEAKER_BACK_LEFT               0x10
+#define SPEAKER_BACK_RIGHT              0x20
+#define SPEAKER_FRONT_LEFT_OF_CENTER    0x40
+#define SPEAKER_FRONT_RIGHT_OF_CENTER   0x80
+#define SPEAKER_BACK_CENTER             0x100
+#define SPEAKER_SIDE_LEFT               0x200
+#define SPEAKER_SIDE_RIGHT              0x400
+#define SPEAKER_TOP_CENTER              0x800
+#define SPEAKER_TOP_FRONT_LEFT          0x1000
+#define SPEAKER_TOP_FRONT_CENTER        0x2000
+#define SPEAKER_TOP_FRONT_RIGHT         0x4000
+#define SPEAKER_TOP_BACK_LEFT           0x8000
+#define SPEAKER_TOP_BACK_CENTER         0x10000
+#define SPEAKER_TOP_BACK_RIGHT          0x20000
+#endif
+
+// Speaker bits a mask may use.
+#define CHANNEL_MATRIX_SPEAKERS         18
+
+//
+// Where a speaker goes when the destination lacks it: its twin, the other
+// name for the same surround position, if there is one, otherwise each of
+// ulTargets at lGain. A twin takes it at unity unless the source has the
+// twin as well, then both go in at lGain.
+//
+typedef struct _CHANNEL_FOLD
+{
+    ULONG       ulTwin;
+    ULONG       ulTargets;
+    LONG        lGain;
+} CHANNEL_FOLD;
+
+const CHANNEL_FOLD g_ChannelFolds[CHANNEL_MATRIX_SPEAKERS] =
+{
+    { 0,                    SPEAKER_FRONT_CENTER,                       CHANNEL_MATRIX_MINUS_3DB }, // FL
+    { 0,                    SPEAKER_FRONT_CENTER,                       CHANNEL_MATRIX_MINUS_3DB }, // FR
+    { 0,                    SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT,   CHANNEL_MATRIX_MINUS_3DB }, // FC
+    { 0,                    0,                                          0 },                        // LFE, see lLfeGain
+    { SPEAKER_SIDE_LEFT,    SPEAKER_FRONT_LEFT,                         CHANNEL_MATRIX_MINUS_3DB }, // BL
+    { SPEAKER_SIDE_RIGHT,   SPEAKER_FRONT_RIGHT,                        CHANNEL_MATRIX_MINUS_3DB }, // BR
+    { 0,                    SPEAKER_FRONT_LEFT | SPEAKER_FRONT_CENTER,  CHANNEL_MATRIX_MINUS_3DB }, // FLC
+    { 0,                    SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER, CHANNEL_MATRIX_MINUS_3DB }, // FRC
+    { 0,                    SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT,     CHANNEL_MATRIX_MINUS_3DB }, // BC
+    { SPEAKER_BACK_LEFT,    SPEAKER_FRONT_LEFT,                         CHANNEL_MATRIX_MINUS_3DB }, // SL
+    { SPEAKER_BACK_RIGHT,   SPEAKER_FRONT_RIGHT,                        CHANNEL_MATRIX_MINUS_3DB }, // SR
+    { 0,                    SPEAKER_FRONT_CENTER,                       CHANNEL_MATRIX_MINUS_3DB }, // TC
+    { 0,                    SPEAKER_FRONT_LEFT,                         CHANNEL_MATRIX_MINUS_3DB }, // TFL
+    { 0,                    SPEAKER_FRONT_CENTER,                       CHANNEL_MATRIX_MINUS_3DB }, // TFC
+    { 0,                    SPEAKER_FRONT_RIGHT,                        CHANNEL_MATRIX_MINUS_3DB }, // TFR
+    { 0,                    SPEAKER_BACK_LEFT,                          CHANNEL_MATRIX_MINUS_3DB }, // TBL
+    { 0,                    SPEAKER_BACK_CENTER,                        CHANNEL_MATRIX_MINUS_3DB }, // TBC
+    { 0,                    SPEAKER_BACK_RIGHT,                         CHANNEL_MATRIX_MINUS_3DB }, // TBR
+};
+
+//
+// A built matrix, masks as ChannelMatrixMask gives them. Dense gains,
+// output row by input column, and the same gains as a list of the
+// non-zero ones.
+//
+typedef struct _CHANNEL_MATRIX_TAP
+{
+    ULONG       ulIn;
+    ULONG       ulOut;
+    LONG        lGain;
+} CHANNEL_MATRIX_TAP;
+
+typedef struct _CHANNEL_MATRIX
+{
+    ULONG               ulInMask;
+    ULONG               ulInChannels;
+    ULONG               ulOutMask;
+    ULONG               ulOutChannels;
+    LONG                lLfeGain;
+    ULONG               ulTaps;
+    CHANNEL_MATRIX_TAP  Taps[CHANNEL_MATRIX_MAX_CHANNELS * CHANNEL_MATRIX_MAX_CHANNELS];
+    LONG                lGains[CHANNEL_MATRIX_MAX_CHANNELS][CHANNEL_MATRIX_MAX_CHANNELS];
+} CHANNEL_MATRIX;
+typedef CHANNEL_MATRIX *PCHANNEL_MATRIX;
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+inline ULONG ChannelMatrixCountBits(_In_ ULONG ulMask)
+{
+    ULONG ulCount = 0;
+
+    for (; ulMask != 0; ulMask &= ulMask - 1)
+    {
+        ulCount++;
+    }
+
+    return ulCount;
+}
+
+//
+// The mask a stream with ulChannels channels has when it does not say, as
+// the KSAUDIO_SPEAKER layouts of that width. A mask that does not name
+// ulChannels of the known speakers is replaced by it.
+//
+inline ULONG ChannelMatrixMask(_In_ ULONG ulMask, _In_ ULONG ulChannels)
+{
+    if (ulMask != 0 && (ulMask >> CHANNEL_MATRIX_SPEAKERS) == 0 && ChannelMatrixCountBits(ulMask) == ulChannels)
+    {
+        return ulMask;
+    }
+
+    switch (ulChannels)
+    {
+        case 1: return SPEAKER_FRONT_CENTER;
+        case 2: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+        case 3: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER;
+        case 4: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+        case 5: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+        case 6: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
+                       SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+        case 7: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
+                       SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT | SPEAKER_BACK_CENTER;
+        case 8: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
+                       SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT;
+    }
+
+    return 0;
+}
+
+//
+// Channel index of a speaker in a mask: channels follow the mask's bits
+// from the lowest.
+//
+inline ULONG ChannelMatrixIndex(_In_ ULONG ulMask, _In_ ULONG ulSpeaker)
+{
+    return ChannelMatrixCountBits(ulMask & (ulSpeaker - 1));
+}
+
+//
+// Adds lGain of input channel ulIn to the outputs speaker ulSpeaker ends
+// up in.
+//
+inline VOID ChannelMatrixFold
+(
+    _Inout_ PCHANNEL_MATRIX pMatrix,
+    _In_ ULONG              ulIn,
+    _In_ ULONG              ulSpeaker,
+    _In_ LONGLONG           llGain,
+    _In_ ULONG              ulDepth
+)
+{
+    ULONG ulBit = ChannelMatrixCountBits(ulSpeaker - 1);
+    const CHANNEL_FOLD & fold = g_ChannelFolds[ulBit];
+    ULONG ulTargets;
+
+    if (pMatrix->ulOutMask & ulSpeaker)
+    {
+        pMatrix->lGains[ChannelMatrixIndex(pMatrix->ulOutMask, ulSpeaker)][ulIn] += (LONG)llGain;
+        return;
+    }
+
+    if (pMatrix->ulOutMask & fold.ulTwin)
+    {
+        if (pMatrix->ulInMask & fold.ulTwin)
+        {
+            llGain = (llGain * fold.lGain) >> CHANNEL_MATRIX_GAIN_SHIFT;
+        }
+
+        pMatrix->lGains[ChannelMatrixIndex(pMatrix->ulOutMask, fold.ulTwin)][ulIn] += (LONG)llGain;
+        return;
+    }
+
+    if (ulDepth >= CHANNEL_MATRIX_MAX_FOLDS)
+    {
+        return;
+    }
+
+    if (ulSpeaker == SPEAKER_LOW_FREQUENCY)
+    {
+        // Into the center, or where the center goes.
+        ChannelMatrixFold(pMatrix, ulIn, SPEAKER_FRONT_CENTER, (llGain * pMatrix->lLfeGain) >> CHANNEL_MATRIX_GAIN_SHIFT, ulDepth + 1);
+        return;
+    }
+
+    for (ulTargets = fold.ulTargets; ulTargets != 0; ulTargets &= ulTargets - 1)
+    {
+        ChannelMatrixFold(pMatrix, ulIn, ulTargets & (0 - ulTargets), (llGain * fold.lGain) >> CHANNEL_MATRIX_GAIN_SHIFT, ulDepth + 1);
+    }
+}
+
+//
+// Builds the matrix from ulInMask/ulInChannels to ulOutMask/ulOutChannels
+// (masks as ChannelMatrixMask takes them). lLfeGain, Q30, is how much LFE
+// goes to the center when the destination has no LFE. Returns FALSE for
+// channel counts it does not cover.
+//
+inline BOOL BuildChannelMatrix
+(
+    _Out_ PCHANNEL_MATRIX   pMatrix,
+    _In_ ULONG              ulInMask,
+    _In_ ULONG              ulInChannels,
+    _In_ ULONG              ulOutMask,
+    _In_ ULONG              ulOutChannels,
+    _In_ LONG               lLfeGain
+)
+{
+    LONGLONG llLargest = 0;
+
+    RtlZeroMemory(pMatrix, sizeof(*pMatrix));
+
+    if (ulInChannels == 0 || ulInChannels > CHANNEL_MATRIX_MAX_CHANNELS ||
+        ulOutChannels == 0 || ulOutChannels > CHANNEL_MATRIX_MAX_CHANNELS)
+    {
+        return FALSE;
+    }
+
+    ulInMask = ChannelMatrixMask(ulInMask, ulInChannels);
+    ulOutMask = ChannelMatrixMask(ulOutMask, ulOutChannels);
+
+    pMatrix->ulInMask = ulInMask;
+    pMatrix->ulInChannels = ulInChannels;
+    pMatrix->ulOutMask = ulOutMask;
+    pMatrix->ulOutChannels = ulOutChannels;
+    pMatrix->lLfeGain = lLfeGain;
+
+    for (ULONG ulSpeakers = ulInMask; ulSpeakers != 0; ulSpeakers &= ulSpeakers - 1)
+    {
+        ULONG ulSpeaker = ulSpeakers & (0 - ulSpeakers);
+
+        ChannelMatrixFold(pMatrix, ChannelMatrixIndex(ulInMask, ulSpeaker), ulSpeaker, CHANNEL_MATRIX_UNITY, 0);
+    }
+
+    for (ULONG o = 0; o < ulOutChannels; o++)
+    {
+        LONGLONG llSum = 0;
+
+        for (ULONG i = 0; i < ulInChannels; i++)
+        {
+            llSum += pMatrix->lGains[o][i] < 0 ? -pMatrix->lGains[o][i] : pMatrix->lGains[o][i];
+        }
+        llLargest = llSum > llLargest ? llSum : llLargest;
+    }
+
+    for (ULONG o = 0; o < ulOutChannels; o++)
+    {
+        for (ULONG i = 0; i < ulInChannels; i++)
+        {
+            if (llLargest > CHANNEL_MATRIX_UNITY)
+            {
+                pMatrix->lGains[o][i] = (LONG)(((LONGLONG)pMatrix->lGains[o][i] << CHANNEL_MATRIX_GAIN_SHIFT) / llLargest);
+            }
+
+            if (pMatrix->lGains[o][i] != 0)
+            {
+                pMatrix->Taps[pMatrix->ulTaps].ulIn = i;
+                pMatrix->Taps[pMatrix->ulTaps].ulOut = o;
+                pMatrix->Taps[pMatrix->ulTaps].lGain = pMatrix->lGains[o][i];
+                pMatrix->ulTaps++;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernels
+//
+//   Mix ulFrames interleaved Q29 frames.
+//
+typedef VOID CHANNEL_MIX_ROUTINE
+(
+    _In_ const CHANNEL_MATRIX * pMatrix,
+    _In_ const LONG *           plIn,
+    _Out_ PLONG                 plOut,
+    _In_ ULONG                  ulFrames
+);
+typedef CHANNEL_MIX_ROUTINE *PFN_CHANNEL_MIX;
+
+template <ULONG InChannels, ULONG OutChannels>
+struct ChannelMixDense
+{
+    static VOID Mix
+    (
+        _In_ const CHANNEL_MATRIX * pMatrix,
+        _In_ const LONG *           plIn,
+        _Out_ PLONG                 plOut,
+        _In_ ULONG                  ulFrames
+    )
+    {
+        for (ULONG n = 0; n < ulFrames; n++)
+        {
+            for (ULONG o = 0; o < OutChannels; o++)
+            {
+                LONGLONG llSum = 0;
+
+                for (ULONG i = 0; i < InChannels; i++)
+                {
+                    llSum += (LONGLONG)plIn[i] * pMatrix->lGains[o][i];
+                }
+
+                plOut[o] = FixedSaturate(llSum >> CHANNEL_MATRIX_GAIN_SHIFT);
+            }
+
+            plIn += InChannels;
+            plOut += OutChannels;
+        }
+    }
+};
+
+inline VOID ChannelMixSparse
+(
+    _In_ const CHANNEL_MATRIX * pMatrix,
+    _In_ const LONG *           plIn,
+    _Out_ PLONG                 plOut,
+    _In_ ULONG                  ulFrames
+)
+{
+    LONGLONG llSum[CHANNEL_MATRIX_MAX_CHANNELS];
+
+    for (ULONG n = 0; n < ulFrames; n++)
+    {
+        for (ULONG o = 0; o < pMatrix->ulOutChannels; o++)
+        {
+            llSum[o] = 0;
+        }
+
+        for (ULONG t = 0; t < pMatrix->ulTaps; t++)
+        {
+            llSum[pMatrix->Taps[t].ulOut] += (LONGLONG)plIn[pMatrix->Taps[t].ulIn] * pMatrix->Taps[t].lGain;
+        }
+
+        for (ULONG o = 0; o < pMatrix->ulOutChannels; o++)
+        {
+            plOut[o] = FixedSaturate(llSum[o] >> CHANNEL_MATRIX_GAIN_SHIFT);
+        }
+
+        plIn += pMatrix->ulInChannels;
+        plOut += pMatrix->ulOutChannels;
+    }
+}
+
+//
+// The dense kernel for the shapes that have one, otherwise the sparse one.
+//
+inline PFN_CHANNEL_MIX GetChannelMix(_In_ ULONG ulInChannels, _In_ ULONG ulOutChannels)
+{
+    switch (ulInChannels * 16 + ulOutChannels)
+    {
+        case 8 * 16 + 2: return ChannelMixDense<8, 2>::Mix;
+        case 6 * 16 + 2: return ChannelMixDense<6, 2>::Mix;
+        case 2 * 16 + 8: return ChannelMixDense<2, 8>::Mix;
+        case 2 * 16 + 6: return ChannelMixDense<2, 6>::Mix;
+        case 2 * 16 + 1: return ChannelMixDense<2, 1>::Mix;
+        case 1 * 16 + 2: return ChannelMixDense<1, 2>::Mix;
+    }
+
+    return ChannelMixSparse;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ChannelMixIo
+//
+//   Converts ulSamples samples between a stream format and Q29.
+//
+typedef VOID CHANNEL_LOAD_ROUTINE(_In_ const BYTE * pData, _Out_ PLONG plSamples, _In_ ULONG ulSamples);
+typedef CHANNEL_LOAD_ROUTINE *PFN_CHANNEL_LOAD;
+
+typedef VOID CHANNEL_STORE_ROUTINE(_In_ const LONG * plSamples, _Out_ PBYTE pData, _In_ ULONG ulSamples);
+typedef CHANNEL_STORE_ROUTINE *PFN_CHANNEL_STORE;
+
+template <ULONG Bits, BOOL Float>
+struct ChannelMixIo
+{
+    static VOID Load(_In_ const BYTE * pData, _Out_ PLONG plSamples, _In_ ULONG ulSamples)
+    {
+        for (ULONG k = 0; k < ulSamples; k++)
+        {
+            plSamples[k] = FixedSample<Bits, Float>::Load(pData + k * (Bits / 8));
+        }
+    }
+
+    static VOID Store(_In_ const LONG * plSamples, _Out_ PBYTE pData, _In_ ULONG ulSamples)
+    {
+        for (ULONG k = 0; k < ulSamples; k++)
+        {
+            FixedSample<Bits, Float>::Store(pData + k * (Bits / 8), plSamples[k]);
+        }
+    }
+};
+
+inline BOOL GetChannelMixIo
+(
+    _In_ ULONG                  ulBitsPerSample,
+    _In_ BOOL                   bFloat,
+    _Out_ PFN_CHANNEL_LOAD *    ppfnLoad,
+    _Out_ PFN_CHANNEL_STORE *   ppfnStore
+)
+{
+    *ppfnLoad = NULL;
+    *ppfnStore = NULL;
+
+    if (bFloat)
+    {
+        if (ulBitsPerSample != 32)
+        {
+            return FALSE;
+        }
+
+        *ppfnLoad = ChannelMixIo<32, TRUE>::Load;
+        *ppfnStore = ChannelMixIo<32, TRUE>::Store;
+        return TRUE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  *ppfnLoad = ChannelMixIo<8, FALSE>::Load;  *ppfnStore = ChannelMixIo<8, FALSE>::Store;  return TRUE;
+        case 16: *ppfnLoad = ChannelMixIo<16, FALSE>::Load; *ppfnStore = ChannelMixIo<16, FALSE>::Store; return TRUE;
+        case 24: *ppfnLoad = ChannelMixIo<24, FALSE>::Load; *ppfnStore = ChannelMixIo<24, FALSE>::Store; return TRUE;
+        case 32: *ppfnLoad = ChannelMixIo<32, FALSE>::Load; *ppfnStore = ChannelMixIo<32, FALSE>::Store; return TRUE;
+    }
+
+    return FALSE;
+}
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CChannelMatrixCache
+//
+//   The last few matrices built, reused round robin. Not synchronized.
+//
+class CChannelMatrixCache
+{
+protected:
+    CHANNEL_MATRIX              m_Matrices[CHANNEL_MATRIX_CACHE_ENTRIES];
+    BOOL                        m_bValid[CHANNEL_MATRIX_CACHE_ENTRIES];
+    ULONG                       m_ulNext;
+
+public:
+    CChannelMatrixCache()
+    {
+        RtlZeroMemory(m_bValid, sizeof(m_bValid));
+        m_ulNext = 0;
+    }
+
+    //
+    // The matrix for a pair, built on a miss. NULL for channel counts a
+    // matrix does not cover.
+    //
+    const CHANNEL_MATRIX * Get
+    (
+        _In_ ULONG      ulInMask,
+        _In_ ULONG      ulInChannels,
+        _In_ ULONG      ulOutMask,
+        _In_ ULONG      ulOutChannels,
+        _In_ LONG       lLfeGain
+    )
+    {
+        ULONG ulSlot;
+
+        for (ULONG k = 0; k < CHANNEL_MATRIX_CACHE_ENTRIES; k++)
+        {
+            if (m_bValid[k] &&
+                m_Matrices[k].ulInChannels == ulInChannels && m_Matrices[k].ulOutChannels == ulOutChannels &&
+                m_Matrices[k].ulInMask == ChannelMatrixMask(ulInMask, ulInChannels) &&
+                m_Matrices[k].ulOutMask == ChannelMatrixMask(ulOutMask, ulOutChannels) &&
+                m_Matrices[k].lLfeGain == lLfeGain)
+            {
+                return &m_Matrices[k];
+            }
+        }
+
+        ulSlot = m_ulNext;
+        m_ulNext = (m_ulNext + 1) % CHANNEL_MATRIX_CACHE_ENTRIES;
+
+        m_bValid[ulSlot] = BuildChannelMatrix(&m_Matrices[ulSlot], ulInMask, ulInChannels, ulOutMask, ulOutChannels, lLfeGain);
+
+        return m_bValid[ulSlot] ? &m_Matrices[ulSlot] : NULL;
+    }
+};
+typedef CChannelMatrixCache *PCChannelMatrixCache;
+
+///////////////////////////////////////////////////////////////////////////////
+// CChannelMixer
+//
+//   Not synchronized. The matrix must outlive the mixer's use of it.
+//
+class CChannelMixer
+{
+protected:
+    const CHANNEL_MATRIX *      m_pMatrix;
+    PFN_CHANNEL_MIX             m_pfnMix;
+    PFN_CHANNEL_LOAD            m_pfnLoad;
+    PFN_CHANNEL_STORE           m_pfnStore;
+    ULONG                       m_ulInFrameBytes;
+    ULONG                       m_ulOutFrameBytes;
+    LONG                        m_lIn[CHANNEL_MATRIX_BLOCK_FRAMES * CHANNEL_MATRIX_MAX_CHANNELS];
+    LONG                        m_lOut[CHANNEL_MATRIX_BLOCK_FRAMES * CHANNEL_MATRIX_MAX_CHANNELS];
+
+public:
+    CChannelMixer()
+    {
+        m_pMatrix = NULL;
+        m_pfnMix = NULL;
+        m_pfnLoad = NULL;
+        m_pfnStore = NULL;
+        m_ulInFrameBytes = 0;
+        m_ulOutFrameBytes = 0;
+    }
+
+    //
+    // Binds a matrix and the two sample formats. Returns FALSE for formats
+    // it does not cover, which leaves it inactive.
+    //
+    BOOL Init
+    (
+        _In_opt_ const CHANNEL_MATRIX * pMatrix,
+        _In_ ULONG                      ulInBitsPerSample,
+        _In_ BOOL                       bInFloat,
+        _In_ ULONG                      ulOutBitsPerSample,
+        _In_ BOOL                       bOutFloat
+    )
+    {
+        PFN_CHANNEL_STORE pfnUnusedStore;
+        PFN_CHANNEL_LOAD pfnUnusedLoad;
+
+        m_pMatrix = NULL;
+        if (pMatrix == NULL ||
+            !GetChannelMixIo(ulInBitsPerSample, bInFloat, &m_pfnLoad, &pfnUnusedStore) ||
+            !GetChannelMixIo(ulOutBitsPerSample, bOutFloat, &pfnUnusedLoad, &m_pfnStore))
+        {
+            return FALSE;
+        }
+
+        m_pfnMix = GetChannelMix(pMatrix->ulInChannels, pMatrix->ulOutChannels);
+        m_ulInFrameBytes = (ulInBitsPerSample / 8) * pMatrix->ulInChannels;
+        m_ulOutFrameBytes = (ulOutBitsPerSample / 8) * pMatrix->ulOutChannels;
+        m_pMatrix = pMatrix;
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_pMatrix != NULL;
+    }
+
+    ULONG GetInputFrameBytes() const
+    {
+        return m_ulInFrameBytes;
+    }
+
+    ULONG GetOutputFrameBytes() const
+    {
+        return m_ulOutFrameBytes;
+    }
+
+    VOID Process
+    (
+        _In_reads_bytes_(ulFrames * GetInputFrameBytes()) const BYTE *  pIn,
+        _Out_writes_bytes_(ulFrames * GetOutputFrameBytes()) PBYTE      pOut,
+        _In_ ULONG                                                      ulFrames
+    )
+    {
+        if (!IsActive())
+        {
+            return;
+        }
+
+        while (ulFrames > 0)
+        {
+            ULONG ulRun = ulFrames < CHANNEL_MATRIX_BLOCK_FRAMES ? ulFrames : CHANNEL_MATRIX_BLOCK_FRAMES;
+
+            m_pfnLoad(pIn, m_lIn, ulRun * m_pMatrix->ulInChannels);
+            m_pfnMix(m_pMatrix, m_lIn, m_lOut, ulRun);
+            m_pfnStore(m_lOut, pOut, ulRun * m_pMatrix->ulOutChannels);
+
+            pIn += ulRun * m_ulInFrameBytes;
+            pOut += ulRun * m_ulOutFrameBytes;
+            ulFrames -= ulRun;
+        }
+    }
+};
+typedef CChannelMixer *PCChannelMixer;
+
+#endif // _VIRTUALAUDIODRIVER_CHANNELMATRIX_H_
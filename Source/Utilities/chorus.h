@@ -0,0 +1,517 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    chorus.h
+
+Abstract:
+
+    Modulated delay chorus applied to stream audio.
+
+    - Each channel reads its own delay line at CHORUS_DELAY_US, swept by
+      CHORUS_DEPTH_US at CHORUS_RATE_MHZ. The sweep is a fixed point sine
+      LFO; channel c runs c/Channels of a cycle ahead of channel 0, so the
+      channels move apart.
+    - The delay is fractional, in 1/65536 samples, and read with a
+      four-point cubic (Catmull-Rom) interpolator so the sweep does not
+      zipper.
+    - ChorusKernel<Bits, Channels, Float> processes a whole run of frames
+      per call in one stream format, with the LFO and line positions held
+      in locals.
+    - The chorus level is the wet mix, like the reverb's: 0 dB is only
+      the delayed signal, and -96 dB and below is off. The mix moves to a
+      new level over CHORUS_FADE_MS. While off the lines keep recording
+      the input, so turning it on starts without a gap.
+
+    Samples run in fixed point (see fixedsample.h).
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_CHORUS_H_
+#define _VIRTUALAUDIODRIVER_CHORUS_H_
+
+#include "portable.h"
+#include "fixedsample.h"
+#include "gainramp.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Largest channel count with a dedicated instance (7.1).
+#define CHORUS_MAX_CHANNELS         8
+
+#define CHORUS_DELAY_US             15000
+#define CHORUS_DEPTH_US             4000
+#define CHORUS_RATE_MHZ             600
+#define CHORUS_FADE_MS              10
+#define CHORUS_MIN_SAMPLE_RATE      8000
+#define CHORUS_MAX_SAMPLE_RATE      384000
+
+// Lines start on a cache line.
+#define CHORUS_LINE_ALIGNMENT       64
+
+// Level at which the chorus is off, in 1/65536 dB.
+#define CHORUS_LEVEL_OFF            (-96 * 0x10000)
+
+// Delays are in samples with this many fraction bits.
+#define CHORUS_DELAY_SHIFT          16
+
+// The LFO table has a point every 1/CHORUS_SINE_ENTRIES of a cycle and is
+// read with linear interpolation, which is within 5e-6 of a sine.
+#define CHORUS_SINE_BITS            10
+#define CHORUS_SINE_ENTRIES         (1 << CHORUS_SINE_BITS)
+
+//=============================================================================
+// LFO
+//=============================================================================
+
+//
+// One cycle of a sine in Q30, plus the first point again at the end.
+// Built with the recurrence sin((k+1)h) = 2 cos(h) sin(kh) - sin((k-1)h),
+// which only needs cos(h) and sin(h) of the small step h.
+//
+struct CHORUS_SINE
+{
+    LONG        Value[CHORUS_SINE_ENTRIES + 1];
+
+    constexpr CHORUS_SINE() : Value()
+    {
+        double h = 6.283185307179586476925286766559 / CHORUS_SINE_ENTRIES;
+        double sinH = 0;
+        double cosH = 0;
+        double term = 1;
+
+        // Taylor series of cos and sin, term by term.
+        for (ULONG k = 0; k < 16; k++)
+        {
+            if (k % 2 == 0)
+            {
+                cosH += (k % 4 == 0) ? term : -term;
+            }
+            else
+            {
+                sinH += (k % 4 == 1) ? term : -term;
+            }
+            term *= h / (k + 1);
+        }
+
+        double previous = -sinH;
+        double current = 0;
+
+        for (ULONG k = 0; k <= CHORUS_SINE_ENTRIES; k++)
+        {
+            double next = 2 * cosH * current - previous;
+
+            Value[k] = (LONG)(current * (1L << 30) + (current < 0 ? -0.5 : 0.5));
+            previous = current;
+            current = next;
+        }
+    }
+};
+
+constexpr CHORUS_SINE g_ChorusSine;
+
+//
+// sin(2 pi ulPhase / 2^32) in Q30.
+//
+inline LONG ChorusSine
+(
+    _In_ ULONG      ulPhase
+)
+{
+    ULONG ulIndex = ulPhase >> (32 - CHORUS_SINE_BITS);
+    LONG lFraction = (LONG)((ulPhase >> (32 - CHORUS_SINE_BITS - 16)) & 0xFFFF);
+    LONG lA = g_ChorusSine.Value[ulIndex];
+    LONG lB = g_ChorusSine.Value[ulIndex + 1];
+
+    return lA + (LONG)(((LONGLONG)(lB - lA) * lFraction) >> 16);
+}
+
+//=============================================================================
+// Kernels
+//=============================================================================
+
+//
+// Everything a kernel call reads and advances. Each line is ulMask + 1
+// samples long (a power of two) and ulWrite is where the next input
+// sample goes. Delays are in 1/65536 samples and the mix in Q30; the mix
+// moves toward lMixTarget by lMixStep a frame.
+//
+typedef struct _CHORUS_STATE
+{
+    PLONG       plLine[CHORUS_MAX_CHANNELS];
+    ULONG       ulMask;
+    ULONG       ulWrite;
+    ULONG       ulPhase;
+    ULONG       ulPhaseIncrement;
+    LONG        lDelay;
+    LONG        lDepth;
+    LONG        lMix;
+    LONG        lMixTarget;
+    LONG        lMixStep;
+} CHORUS_STATE;
+typedef CHORUS_STATE *PCHORUS_STATE;
+
+//
+// The sample lDelay (in 1/65536 samples) before position ulWrite.
+// Catmull-Rom through the two samples either side, with the products in
+// a LONGLONG: the differences of samples below 2^31 stay below 2^35.
+//
+inline LONG ChorusRead
+(
+    _In_ const LONG *       plLine,
+    _In_ ULONG              ulMask,
+    _In_ ULONG              ulWrite,
+    _In_ LONG               lDelay
+)
+{
+    ULONG ulBase = ulWrite - (ULONG)(lDelay >> CHORUS_DELAY_SHIFT);
+    LONGLONG llT = lDelay & ((1L << CHORUS_DELAY_SHIFT) - 1);
+    LONGLONG llXm1 = plLine[(ulBase + 1) & ulMask];
+    LONGLONG llX0 = plLine[ulBase & ulMask];
+    LONGLONG llX1 = plLine[(ulBase - 1) & ulMask];
+    LONGLONG llX2 = plLine[(ulBase - 2) & ulMask];
+
+    // Twice the polynomial's coefficients.
+    LONGLONG llC1 = llX1 - llXm1;
+    LONGLONG llC2 = 2 * llXm1 - 5 * llX0 + 4 * llX1 - llX2;
+    LONGLONG llC3 = (llX2 - llXm1) + 3 * (llX0 - llX1);
+    LONGLONG llValue;
+
+    llValue = ((llC3 * llT) >> CHORUS_DELAY_SHIFT) + llC2;
+    llValue = ((llValue * llT) >> CHORUS_DELAY_SHIFT) + llC1;
+    llValue = ((llValue * llT) >> CHORUS_DELAY_SHIFT);
+
+    return FixedSaturate(llX0 + (llValue >> 1));
+}
+
+//
+// Process runs ulFrames frames of pBuffer through the lines in place.
+// Track only writes them into the lines, for while the chorus is off.
+//
+typedef VOID CHORUS_PROCESS_ROUTINE
+(
+    _Inout_ PBYTE           pBuffer,
+    _In_ ULONG              ulFrames,
+    _Inout_ PCHORUS_STATE   pState
+);
+typedef CHORUS_PROCESS_ROUTINE *PFN_CHORUS_PROCESS;
+
+typedef VOID CHORUS_TRACK_ROUTINE
+(
+    _In_ const BYTE *       pBuffer,
+    _In_ ULONG              ulFrames,
+    _Inout_ PCHORUS_STATE   pState
+);
+typedef CHORUS_TRACK_ROUTINE *PFN_CHORUS_TRACK;
+
+typedef struct _CHORUS_KERNEL
+{
+    PFN_CHORUS_PROCESS  pfnProcess;
+    PFN_CHORUS_TRACK    pfnTrack;
+    ULONG               ulFrameBytes;
+} CHORUS_KERNEL;
+typedef CHORUS_KERNEL *PCHORUS_KERNEL;
+
+///////////////////////////////////////////////////////////////////////////////
+// ChorusKernel
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct ChorusKernel
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG FrameBytes = SampleBytes * Channels;
+    static const ULONG PhaseOffset = (ULONG)(0x100000000ULL / Channels);
+
+    static VOID Process
+    (
+        _Inout_ PBYTE           pBuffer,
+        _In_ ULONG              ulFrames,
+        _Inout_ PCHORUS_STATE   pState
+    )
+    {
+        const ULONG ulMask = pState->ulMask;
+        const ULONG ulPhaseIncrement = pState->ulPhaseIncrement;
+        const LONG lDelay = pState->lDelay;
+        const LONG lDepth = pState->lDepth;
+        const LONG lMixTarget = pState->lMixTarget;
+        const LONG lMixStep = pState->lMixStep;
+        ULONG ulWrite = pState->ulWrite;
+        ULONG ulPhase = pState->ulPhase;
+        LONG lMix = pState->lMix;
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            ULONG ulChannelPhase = ulPhase;
+
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                PBYTE pSample = pBuffer + c * SampleBytes;
+                PLONG plLine = pState->plLine[c];
+                LONG lDry = FixedSample<Bits, Float>::Load(pSample);
+                LONG lSweep = (LONG)(((LONGLONG)lDepth * ChorusSine(ulChannelPhase)) >> 30);
+                LONG lWet;
+
+                plLine[ulWrite] = lDry;
+                lWet = ChorusRead(plLine, ulMask, ulWrite, lDelay + lSweep);
+                FixedSample<Bits, Float>::Store(pSample,
+                    FixedSaturate(lDry + ((((LONGLONG)lWet - lDry) * lMix) >> 30)));
+
+                ulChannelPhase += PhaseOffset;
+            }
+
+            if (lMix != lMixTarget)
+            {
+                lMix = (lMix < lMixTarget) ?
+                       ((lMixTarget - lMix > lMixStep) ? lMix + lMixStep : lMixTarget) :
+                       ((lMix - lMixTarget > lMixStep) ? lMix - lMixStep : lMixTarget);
+            }
+            ulWrite = (ulWrite + 1) & ulMask;
+            ulPhase += ulPhaseIncrement;
+            pBuffer += FrameBytes;
+        }
+
+        pState->ulWrite = ulWrite;
+        pState->ulPhase = ulPhase;
+        pState->lMix = lMix;
+    }
+
+    static VOID Track
+    (
+        _In_ const BYTE *       pBuffer,
+        _In_ ULONG              ulFrames,
+        _Inout_ PCHORUS_STATE   pState
+    )
+    {
+        // Only the last line length of frames can still be read.
+        ULONG ulSkip = ulFrames > pState->ulMask + 1 ? ulFrames - (pState->ulMask + 1) : 0;
+        ULONG ulWrite = (pState->ulWrite + ulSkip) & pState->ulMask;
+
+        pBuffer += ulSkip * FrameBytes;
+        for (ULONG i = ulSkip; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                pState->plLine[c][ulWrite] = FixedSample<Bits, Float>::Load(pBuffer + c * SampleBytes);
+            }
+            ulWrite = (ulWrite + 1) & pState->ulMask;
+            pBuffer += FrameBytes;
+        }
+
+        pState->ulWrite = ulWrite;
+        pState->ulPhase += pState->ulPhaseIncrement * ulFrames;
+    }
+};
+
+template <ULONG Bits, ULONG Channels, BOOL Float>
+VOID SetChorusKernel
+(
+    _Out_ PCHORUS_KERNEL    pKernel
+)
+{
+    pKernel->pfnProcess = ChorusKernel<Bits, Channels, Float>::Process;
+    pKernel->pfnTrack = ChorusKernel<Bits, Channels, Float>::Track;
+    pKernel->ulFrameBytes = ChorusKernel<Bits, Channels, Float>::FrameBytes;
+}
+
+template <ULONG Bits, BOOL Float>
+BOOL SelectChorusKernel
+(
+    _In_ ULONG              ulChannels,
+    _Out_ PCHORUS_KERNEL    pKernel
+)
+{
+    switch (ulChannels)
+    {
+        case 1: SetChorusKernel<Bits, 1, Float>(pKernel); return TRUE;
+        case 2: SetChorusKernel<Bits, 2, Float>(pKernel); return TRUE;
+        case 3: SetChorusKernel<Bits, 3, Float>(pKernel); return TRUE;
+        case 4: SetChorusKernel<Bits, 4, Float>(pKernel); return TRUE;
+        case 5: SetChorusKernel<Bits, 5, Float>(pKernel); return TRUE;
+        case 6: SetChorusKernel<Bits, 6, Float>(pKernel); return TRUE;
+        case 7: SetChorusKernel<Bits, 7, Float>(pKernel); return TRUE;
+        case 8: SetChorusKernel<Bits, 8, Float>(pKernel); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Picks the instance for a stream format: 8/16/24/32-bit PCM and 32-bit
+// float with 1 to CHORUS_MAX_CHANNELS channels. Returns FALSE otherwise.
+//
+inline BOOL GetChorusKernel
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat,
+    _Out_ PCHORUS_KERNEL    pKernel
+)
+{
+    RtlZeroMemory(pKernel, sizeof(*pKernel));
+
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectChorusKernel<32, TRUE>(ulChannels, pKernel) : FALSE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectChorusKernel<8, FALSE>(ulChannels, pKernel);
+        case 16: return SelectChorusKernel<16, FALSE>(ulChannels, pKernel);
+        case 24: return SelectChorusKernel<24, FALSE>(ulChannels, pKernel);
+        case 32: return SelectChorusKernel<32, FALSE>(ulChannels, pKernel);
+    }
+
+    return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CChorus
+//
+//   Owned by one stream and only touched from its position update.
+//
+class CChorus
+{
+protected:
+    CHORUS_KERNEL               m_Kernel;
+    CHORUS_STATE                m_State;
+
+public:
+    CChorus()
+    {
+        RtlZeroMemory(&m_Kernel, sizeof(m_Kernel));
+        RtlZeroMemory(&m_State, sizeof(m_State));
+    }
+
+    //
+    // Bytes of delay line storage Init needs, 0 if the rate or channel
+    // count is not supported.
+    //
+    static ULONG GetStorageBytes
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulChannels
+    )
+    {
+        if (ulSampleRate < CHORUS_MIN_SAMPLE_RATE || ulSampleRate > CHORUS_MAX_SAMPLE_RATE ||
+            ulChannels == 0 || ulChannels > CHORUS_MAX_CHANNELS)
+        {
+            return 0;
+        }
+
+        return CHORUS_LINE_ALIGNMENT + ulChannels * LineLength(ulSampleRate) * sizeof(LONG);
+    }
+
+    //
+    // Binds pStorage, at least GetStorageBytes bytes, as the delay lines.
+    // Returns FALSE, and leaves the audio alone, for rates and formats the
+    // chorus does not cover.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulChannels,
+        _In_ BOOL       bFloat,
+        _In_ PVOID      pStorage,
+        _In_ ULONG      cbStorage
+    )
+    {
+        ULONG cbNeeded = GetStorageBytes(ulSampleRate, ulChannels);
+        PBYTE pLine = (PBYTE)pStorage;
+
+        RtlZeroMemory(&m_State, sizeof(m_State));
+        if (cbNeeded == 0 || pStorage == NULL || cbStorage < cbNeeded ||
+            !GetChorusKernel(ulBitsPerSample, ulChannels, bFloat, &m_Kernel))
+        {
+            RtlZeroMemory(&m_Kernel, sizeof(m_Kernel));
+            return FALSE;
+        }
+
+        // Lines are a power of two of LONGs, so each one stays aligned.
+        RtlZeroMemory(pLine, cbNeeded);
+        pLine += (CHORUS_LINE_ALIGNMENT - ((ULONG_PTR)pLine & (CHORUS_LINE_ALIGNMENT - 1))) & (CHORUS_LINE_ALIGNMENT - 1);
+        for (ULONG c = 0; c < ulChannels; c++)
+        {
+            m_State.plLine[c] = (PLONG)pLine;
+            pLine += LineLength(ulSampleRate) * sizeof(LONG);
+        }
+
+        m_State.ulMask = LineLength(ulSampleRate) - 1;
+        m_State.ulPhaseIncrement = (ULONG)((((ULONGLONG)CHORUS_RATE_MHZ << 32) + 500ULL * ulSampleRate) / (1000ULL * ulSampleRate));
+        m_State.lDelay = (LONG)(((ULONGLONG)CHORUS_DELAY_US * ulSampleRate << CHORUS_DELAY_SHIFT) / 1000000);
+        m_State.lDepth = (LONG)(((ULONGLONG)CHORUS_DEPTH_US * ulSampleRate << CHORUS_DELAY_SHIFT) / 1000000);
+        m_State.lMixStep = (LONG)(GAIN_Q30_ONE / ((ULONGLONG)ulSampleRate * CHORUS_FADE_MS / 1000));
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_Kernel.pfnProcess != NULL;
+    }
+
+    BOOL IsIdle() const
+    {
+        return m_State.lMix == 0 && m_State.lMixTarget == 0;
+    }
+
+    //
+    // Sets the wet mix from a chorus level in 1/65536 dB.
+    //
+    VOID SetLevel
+    (
+        _In_ LONG       lLevel
+    )
+    {
+        m_State.lMixTarget = (lLevel <= CHORUS_LEVEL_OFF) ? 0 : GainFromVolume(lLevel);
+    }
+
+    //
+    // Adds chorus to the whole frames in pData, which follow the frames
+    // of the previous call.
+    //
+    VOID Process
+    (
+        _Inout_updates_bytes_(cbData) PBYTE     pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        if (!IsActive())
+        {
+            return;
+        }
+
+        if (IsIdle())
+        {
+            m_Kernel.pfnTrack(pData, cbData / m_Kernel.ulFrameBytes, &m_State);
+        }
+        else
+        {
+            m_Kernel.pfnProcess(pData, cbData / m_Kernel.ulFrameBytes, &m_State);
+        }
+    }
+
+private:
+    //
+    // Longest delay plus the interpolator's reach, rounded up to a power
+    // of two.
+    //
+    static ULONG LineLength(_In_ ULONG ulSampleRate)
+    {
+        ULONG ulNeeded = (ULONG)((ULONGLONG)(CHORUS_DELAY_US + CHORUS_DEPTH_US) * ulSampleRate / 1000000) + 4;
+        ULONG ulLength = 16;
+
+        while (ulLength < ulNeeded)
+        {
+            ulLength <<= 1;
+        }
+
+        return ulLength;
+    }
+};
+typedef CChorus *PCChorus;
+
+#endif // _VIRTUALAUDIODRIVER_CHORUS_H_
@@ -0,0 +1,95 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    drainpolicy.h
+
+Abstract:
+
+    When a background writer should drain a byte ring. Data is left to
+    accumulate until a write is worth issuing (a coalescing threshold) but
+    never for longer than a latency bound, so a quiet stream still reaches
+    the disk promptly.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_DRAINPOLICY_H_
+#define _VIRTUALAUDIODRIVER_DRAINPOLICY_H_
+
+#include "portable.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// CDrainPolicy
+//
+class CDrainPolicy
+{
+protected:
+    ULONG                       m_ulCoalesceBytes;
+    ULONG                       m_ulMaxLatencyMs;
+
+public:
+    CDrainPolicy() :
+        m_ulCoalesceBytes(1),
+        m_ulMaxLatencyMs(0)
+    {
+    }
+
+    VOID Init
+    (
+        _In_ ULONG      ulCoalesceBytes,
+        _In_ ULONG      ulMaxLatencyMs
+    )
+    {
+        m_ulCoalesceBytes = (ulCoalesceBytes != 0) ? ulCoalesceBytes : 1;
+        m_ulMaxLatencyMs = ulMaxLatencyMs;
+    }
+
+    //
+    // Producer side: TRUE when queuing moved the ring from below to at or
+    // above the coalescing threshold, i.e. the writer should be woken. Only
+    // the crossing wakes it, so a backed-up writer is not signaled on every
+    // call.
+    //
+    BOOL ShouldWake
+    (
+        _In_ ULONG      cbQueuedBefore,
+        _In_ ULONG      cbQueuedAfter
+    ) const
+    {
+        return cbQueuedBefore < m_ulCoalesceBytes && cbQueuedAfter >= m_ulCoalesceBytes;
+    }
+
+    //
+    // Writer side: whether the cbQueued bytes should be written now, given
+    // the time since the last write. Flushing writes whatever is queued.
+    //
+    BOOL ShouldWrite
+    (
+        _In_ ULONG      cbQueued,
+        _In_ ULONG      ulMsSinceLastWrite,
+        _In_ BOOL       bFlush
+    ) const
+    {
+        if (cbQueued == 0)
+        {
+            return FALSE;
+        }
+
+        return bFlush ||
+               cbQueued >= m_ulCoalesceBytes ||
+               ulMsSinceLastWrite >= m_ulMaxLatencyMs;
+    }
+
+    //
+    // Longest the writer may sleep without missing the latency bound.
+    //
+    ULONG GetWaitMs() const
+    {
+        return m_ulMaxLatencyMs;
+    }
+};
+
+typedef CDrainPolicy *PCDrainPolicy;
+
+#endif // _VIRTUALAUDIODRIVER_DRAINPOLICY_H_
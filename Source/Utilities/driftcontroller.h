@@ -0,0 +1,158 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    driftcontroller.h
+
+Abstract:
+
+    Ratio control for an asynchronous sample rate converter between two
+    clocks.
+
+    - The consumer reports how many input frames are queued ahead of it
+      each time it drains, with the output frames that took. A one pole
+      filter (DRIFT_FILTER_SECONDS) smooths away the sawtooth the two
+      sides' bursts leave in that level.
+    - A PI loop then turns the filtered level's distance from the target
+      into a ratio trim for CResampler::SetAdjustment. The integral
+      settles on the clock skew, so the queue holds the target in steady
+      state; the loop has a natural frequency of 0.01 Hz, well under the
+      filter's, and is critically damped.
+    - Everything is integer math, safe at DISPATCH_LEVEL.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_DRIFTCONTROLLER_H_
+#define _VIRTUALAUDIODRIVER_DRIFTCONTROLLER_H_
+
+#include "portable.h"
+#include "resampler.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Time constant of the level filter.
+#define DRIFT_FILTER_SECONDS        2
+
+// The loop's natural frequency wn = 2 pi 0.01 Hz. Its gains are in Q14, so
+// a Q16 level times a gain is a Q30 trim: proportional 2 wn (critical
+// damping), integral wn^2.
+#define DRIFT_PROPORTIONAL_GAIN     2059
+#define DRIFT_INTEGRAL_GAIN         65
+
+// The queue level is in Q16 frames, the integral in Q38 (Q30 ratio with
+// eight guard bits).
+#define DRIFT_LEVEL_SHIFT           16
+#define DRIFT_INTEGRAL_GUARD_SHIFT  8
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CDriftController
+//
+//   Not synchronized; owned by the consumer.
+//
+class CDriftController
+{
+protected:
+    ULONG                       m_ulInRate;
+    ULONG                       m_ulOutRate;
+    LONGLONG                    m_llTarget;             // Q16 input frames.
+    LONGLONG                    m_llLevel;              // Filtered queue, Q16 input frames.
+    LONGLONG                    m_llIntegral;           // Q38 ratio.
+    LONG                        m_lAdjustment;          // Q30 ratio.
+
+public:
+    CDriftController()
+    {
+        m_ulInRate = 1;
+        m_ulOutRate = 1;
+        m_llTarget = 0;
+        m_llLevel = 0;
+        m_llIntegral = 0;
+        m_lAdjustment = 0;
+    }
+
+    //
+    // Starts over for a new pair of clocks: ulTargetFrames input frames
+    // queued, no skew.
+    //
+    VOID Reset
+    (
+        _In_ ULONG      ulInRate,
+        _In_ ULONG      ulOutRate,
+        _In_ ULONG      ulTargetFrames
+    )
+    {
+        m_ulInRate = ulInRate ? ulInRate : 1;
+        m_ulOutRate = ulOutRate ? ulOutRate : 1;
+        m_llTarget = (LONGLONG)ulTargetFrames << DRIFT_LEVEL_SHIFT;
+        m_llIntegral = 0;
+        Restart();
+    }
+
+    //
+    // The queue was just refilled to the target, after an underrun for
+    // example. The skew learned so far is kept.
+    //
+    VOID Restart()
+    {
+        m_llLevel = m_llTarget;
+        m_lAdjustment = (LONG)(m_llIntegral >> DRIFT_INTEGRAL_GUARD_SHIFT);
+    }
+
+    LONG GetAdjustment() const
+    {
+        return m_lAdjustment;
+    }
+
+    //
+    // Feeds the queue level after the consumer drained ulElapsedFrames
+    // output frames. Returns the ratio trim, Q30, positive when the queue
+    // is too long.
+    //
+    LONG Update
+    (
+        _In_ ULONG      ulQueuedFrames,
+        _In_ ULONG      ulElapsedFrames
+    )
+    {
+        LONGLONG llLimit = (LONGLONG)RESAMPLER_MAX_ADJUSTMENT << DRIFT_INTEGRAL_GUARD_SHIFT;
+        LONGLONG llError;
+        LONGLONG llAdjustment;
+
+        // A long gap is no better evidence than a filter time constant.
+        if (ulElapsedFrames > m_ulOutRate * DRIFT_FILTER_SECONDS)
+        {
+            ulElapsedFrames = m_ulOutRate * DRIFT_FILTER_SECONDS;
+        }
+
+        m_llLevel += ((((LONGLONG)ulQueuedFrames << DRIFT_LEVEL_SHIFT) - m_llLevel) * ulElapsedFrames) /
+                     ((LONGLONG)m_ulOutRate * DRIFT_FILTER_SECONDS);
+        llError = m_llLevel - m_llTarget;
+
+        //
+        // The queue changes by inRate * (skew - trim) frames a second, so
+        // both gains scale with 1 / inRate; the integral also runs in
+        // seconds of output.
+        //
+        m_llIntegral += (((llError * ulElapsedFrames) / m_ulOutRate) *
+                         (DRIFT_INTEGRAL_GAIN << DRIFT_INTEGRAL_GUARD_SHIFT)) / m_ulInRate;
+        m_llIntegral = m_llIntegral < llLimit ? m_llIntegral : llLimit;
+        m_llIntegral = m_llIntegral > -llLimit ? m_llIntegral : -llLimit;
+
+        llAdjustment = (m_llIntegral >> DRIFT_INTEGRAL_GUARD_SHIFT) +
+                       (llError * DRIFT_PROPORTIONAL_GAIN) / m_ulInRate;
+        llAdjustment = llAdjustment < RESAMPLER_MAX_ADJUSTMENT ? llAdjustment : RESAMPLER_MAX_ADJUSTMENT;
+        llAdjustment = llAdjustment > -RESAMPLER_MAX_ADJUSTMENT ? llAdjustment : -RESAMPLER_MAX_ADJUSTMENT;
+
+        m_lAdjustment = (LONG)llAdjustment;
+
+        return m_lAdjustment;
+    }
+};
+typedef CDriftController *PCDriftController;
+
+#endif // _VIRTUALAUDIODRIVER_DRIFTCONTROLLER_H_
@@ -0,0 +1,540 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    echocanceller.h
+
+Abstract:
+
+    Acoustic echo canceller for capture audio.
+
+    - Each microphone channel runs a partitioned block frequency domain
+      adaptive filter (an MDF, normalized LMS per bin) from the same
+      channel of the far end reference, the audio the speaker played, and
+      subtracts its echo estimate.
+    - Blocks are AEC_BLOCK_FRAMES long and transformed overlap-save at
+      twice that size (see realfft.h). AEC_PARTITIONS partitions cover an
+      echo tail of AEC_PARTITIONS * AEC_BLOCK_FRAMES frames. Each block one
+      partition is constrained back to a causal filter of one block, in
+      turn, instead of all of them.
+    - The step is normalized per bin by the smoothed far end power and
+      scaled by how much of the error is residual echo, which keeps near
+      end talk from undoing the filter. The filter only adapts while the
+      far end is active. A block the estimate would make louder is passed
+      through.
+
+    The output lags the input by one block. Samples run in fixed point
+    (see fixedsample.h), the filter in Q19 with Q20 coefficients.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_ECHOCANCELLER_H_
+#define _VIRTUALAUDIODRIVER_ECHOCANCELLER_H_
+
+#include "portable.h"
+#include "fixedsample.h"
+#include "realfft.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Largest channel count with a dedicated instance (7.1).
+#define AEC_MAX_CHANNELS            8
+
+#define AEC_BLOCK_BITS              7
+#define AEC_BLOCK_FRAMES            (1 << AEC_BLOCK_BITS)
+#define AEC_FFT_BITS                (AEC_BLOCK_BITS + 1)
+#define AEC_BINS                    (AEC_BLOCK_FRAMES + 1)
+#define AEC_PARTITIONS              32
+
+// The filter runs on Q19 samples, kept below 2^21 (four times full
+// scale) so a transform of twice the block stays below 2^31.
+#define AEC_SAMPLE_SHIFT            (FIXED_SAMPLE_SHIFT - 19)
+#define AEC_SAMPLE_LIMIT            (1L << 21)
+
+// Coefficients are in Q20. A constrained filter's taps stay below
+// AEC_TAP_LIMIT, so its transform stays below 2^31.
+#define AEC_FILTER_SHIFT            20
+#define AEC_TAP_LIMIT               (1L << 23)
+
+// Step size 2^-AEC_STEP_SHIFT, and far end power smoothing
+// 2^-AEC_POWER_SHIFT per block.
+#define AEC_STEP_SHIFT              6
+#define AEC_POWER_SHIFT             1
+
+// Added to every bin's far end power, which keeps quiet bins from taking
+// huge steps; about the power of far end noise at -75 dBFS.
+#define AEC_REGULARIZATION          (1LL << 24)
+
+// The filter adapts while a block's far end energy is above
+// AEC_FAR_THRESHOLD, about -70 dBFS.
+#define AEC_FAR_THRESHOLD           (1LL << 22)
+
+// The step is scaled by the share of the error that is residual echo,
+// taken as the leak (error over estimate energy, Q24) of past blocks
+// times this block's estimate. Near end talk raises the error, not the
+// estimate, so it slows adaptation. The step never drops below the leak
+// itself, which starts at one for a filter yet to converge. The leak follows increases with
+// smoothing 2^-AEC_LEAK_RISE and decreases with 2^-AEC_LEAK_FALL.
+#define AEC_LEAK_SHIFT              24
+#define AEC_LEAK_ONE                (1LL << AEC_LEAK_SHIFT)
+#define AEC_LEAK_RISE               8
+#define AEC_LEAK_FALL               3
+
+//=============================================================================
+// State
+//=============================================================================
+
+//
+// One channel's filter, far end history and block buffers. Far[p] is the
+// spectrum of the far end p blocks before the newest, which is at the
+// head the canceller keeps.
+//
+typedef struct _AEC_CHANNEL
+{
+    LONG        lFarPrevious[AEC_BLOCK_FRAMES];     // Q19.
+    LONG        lFar[AEC_BLOCK_FRAMES];             // Q19.
+    LONG        lNear[AEC_BLOCK_FRAMES];            // Q29.
+    LONG        lOut[AEC_BLOCK_FRAMES];             // Q29.
+    LONGLONG    llPower[AEC_BINS];
+    LONGLONG    llLeak;                             // Q24, see AEC_LEAK_SHIFT.
+    FFT_COMPLEX Far[AEC_PARTITIONS][AEC_BINS];
+    FFT_COMPLEX Filter[AEC_PARTITIONS][AEC_BINS];
+} AEC_CHANNEL;
+typedef AEC_CHANNEL *PAEC_CHANNEL;
+
+//=============================================================================
+// Format kernels
+//=============================================================================
+
+//
+// Exchange moves ulFrames frames into the channels' block buffers from
+// offset ulOffset: the microphone samples from pMic and the reference
+// from pReference. In their place pMic gets the output of the previous
+// block at the same offsets.
+//
+typedef VOID AEC_EXCHANGE_ROUTINE
+(
+    _Inout_ PBYTE           pMic,
+    _In_ const BYTE *       pReference,
+    _In_ ULONG              ulFrames,
+    _In_ ULONG              ulOffset,
+    _Inout_ PAEC_CHANNEL    pChannels
+);
+typedef AEC_EXCHANGE_ROUTINE *PFN_AEC_EXCHANGE;
+
+typedef struct _AEC_IO
+{
+    PFN_AEC_EXCHANGE    pfnExchange;
+    ULONG               ulFrameBytes;
+} AEC_IO;
+typedef AEC_IO *PAEC_IO;
+
+///////////////////////////////////////////////////////////////////////////////
+// AecIo
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct AecIo
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG FrameBytes = SampleBytes * Channels;
+
+    static VOID Exchange
+    (
+        _Inout_ PBYTE           pMic,
+        _In_ const BYTE *       pReference,
+        _In_ ULONG              ulFrames,
+        _In_ ULONG              ulOffset,
+        _Inout_ PAEC_CHANNEL    pChannels
+    )
+    {
+        for (ULONG i = ulOffset; i < ulOffset + ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                PBYTE pSample = pMic + c * SampleBytes;
+                LONG lFar = FixedSample<Bits, Float>::Load(pReference + c * SampleBytes) >> AEC_SAMPLE_SHIFT;
+
+                pChannels[c].lFar[i] = lFar > AEC_SAMPLE_LIMIT ? AEC_SAMPLE_LIMIT :
+                                       lFar < -AEC_SAMPLE_LIMIT ? -AEC_SAMPLE_LIMIT : lFar;
+                pChannels[c].lNear[i] = FixedSample<Bits, Float>::Load(pSample);
+                FixedSample<Bits, Float>::Store(pSample, pChannels[c].lOut[i]);
+            }
+            pMic += FrameBytes;
+            pReference += FrameBytes;
+        }
+    }
+};
+
+template <ULONG Bits, ULONG Channels, BOOL Float>
+VOID SetAecIo
+(
+    _Out_ PAEC_IO           pIo
+)
+{
+    pIo->pfnExchange = AecIo<Bits, Channels, Float>::Exchange;
+    pIo->ulFrameBytes = AecIo<Bits, Channels, Float>::FrameBytes;
+}
+
+template <ULONG Bits, BOOL Float>
+BOOL SelectAecIo
+(
+    _In_ ULONG              ulChannels,
+    _Out_ PAEC_IO           pIo
+)
+{
+    switch (ulChannels)
+    {
+        case 1: SetAecIo<Bits, 1, Float>(pIo); return TRUE;
+        case 2: SetAecIo<Bits, 2, Float>(pIo); return TRUE;
+        case 3: SetAecIo<Bits, 3, Float>(pIo); return TRUE;
+        case 4: SetAecIo<Bits, 4, Float>(pIo); return TRUE;
+        case 5: SetAecIo<Bits, 5, Float>(pIo); return TRUE;
+        case 6: SetAecIo<Bits, 6, Float>(pIo); return TRUE;
+        case 7: SetAecIo<Bits, 7, Float>(pIo); return TRUE;
+        case 8: SetAecIo<Bits, 8, Float>(pIo); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Picks the instance for a stream format: 8/16/24/32-bit PCM and 32-bit
+// float with 1 to AEC_MAX_CHANNELS channels. Returns FALSE otherwise.
+//
+inline BOOL GetAecIo
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat,
+    _Out_ PAEC_IO           pIo
+)
+{
+    RtlZeroMemory(pIo, sizeof(*pIo));
+
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectAecIo<32, TRUE>(ulChannels, pIo) : FALSE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectAecIo<8, FALSE>(ulChannels, pIo);
+        case 16: return SelectAecIo<16, FALSE>(ulChannels, pIo);
+        case 24: return SelectAecIo<24, FALSE>(ulChannels, pIo);
+        case 32: return SelectAecIo<32, FALSE>(ulChannels, pIo);
+    }
+
+    return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CEchoCanceller
+//
+//   Owned by one capture stream and only touched from its position
+//   update.
+//
+class CEchoCanceller
+{
+protected:
+    AEC_IO                      m_Io;
+    ULONG                       m_ulChannels;
+    PAEC_CHANNEL                m_pChannels;
+    ULONG                       m_ulFill;               // Frames in the current block.
+    ULONG                       m_ulHead;               // Partition of the newest far end block.
+    ULONG                       m_ulConstrain;          // Partition to constrain next.
+    LONG                        m_lTime[2 * AEC_BLOCK_FRAMES];
+    FFT_COMPLEX                 m_Spectrum[AEC_BINS];
+    LONGLONG                    m_llEcho[AEC_BINS][2];  // Echo estimate before saturation.
+    FFT_COMPLEX                 m_Gain[AEC_BINS];       // Step per bin, see Adapt.
+    LONG                        m_lGainShift[AEC_BINS];
+
+public:
+    CEchoCanceller() :
+        m_ulChannels(0),
+        m_pChannels(NULL),
+        m_ulFill(0),
+        m_ulHead(0),
+        m_ulConstrain(0)
+    {
+        RtlZeroMemory(&m_Io, sizeof(m_Io));
+    }
+
+    //
+    // Bytes of filter storage Init needs, 0 if the channel count is not
+    // supported.
+    //
+    static ULONG GetStorageBytes
+    (
+        _In_ ULONG      ulChannels
+    )
+    {
+        if (ulChannels == 0 || ulChannels > AEC_MAX_CHANNELS)
+        {
+            return 0;
+        }
+
+        return ulChannels * sizeof(AEC_CHANNEL);
+    }
+
+    //
+    // Binds pStorage, at least GetStorageBytes bytes, as the filters.
+    // Returns FALSE, and leaves the audio alone, for formats the
+    // canceller does not cover.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulChannels,
+        _In_ BOOL       bFloat,
+        _In_ PVOID      pStorage,
+        _In_ ULONG      cbStorage
+    )
+    {
+        ULONG cbNeeded = GetStorageBytes(ulChannels);
+
+        if (cbNeeded == 0 || pStorage == NULL || cbStorage < cbNeeded ||
+            !GetAecIo(ulBitsPerSample, ulChannels, bFloat, &m_Io))
+        {
+            RtlZeroMemory(&m_Io, sizeof(m_Io));
+            return FALSE;
+        }
+
+        m_pChannels = (PAEC_CHANNEL)pStorage;
+        m_ulChannels = ulChannels;
+        Reset();
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_Io.pfnExchange != NULL;
+    }
+
+    //
+    // Forgets the echo path and the buffered audio.
+    //
+    VOID Reset()
+    {
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            RtlZeroMemory(&m_pChannels[c], sizeof(AEC_CHANNEL));
+            m_pChannels[c].llLeak = AEC_LEAK_ONE;
+        }
+        m_ulFill = 0;
+        m_ulHead = 0;
+        m_ulConstrain = 0;
+    }
+
+    //
+    // Cancels the echo of the reference in the whole frames of pMic. The
+    // reference has the same format and covers the same frames.
+    //
+    VOID Process
+    (
+        _Inout_updates_bytes_(cbData) PBYTE     pMic,
+        _In_reads_bytes_(cbData) const BYTE *   pReference,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG ulFrames = IsActive() ? cbData / m_Io.ulFrameBytes : 0;
+
+        while (ulFrames > 0)
+        {
+            ULONG ulRun = AEC_BLOCK_FRAMES - m_ulFill;
+
+            ulRun = ulRun < ulFrames ? ulRun : ulFrames;
+            m_Io.pfnExchange(pMic, pReference, ulRun, m_ulFill, m_pChannels);
+            m_ulFill += ulRun;
+
+            if (m_ulFill == AEC_BLOCK_FRAMES)
+            {
+                for (ULONG c = 0; c < m_ulChannels; c++)
+                {
+                    RunBlock(m_pChannels[c]);
+                }
+                m_ulFill = 0;
+                m_ulHead = (m_ulHead + 1) % AEC_PARTITIONS;
+                m_ulConstrain = (m_ulConstrain + 1) % AEC_PARTITIONS;
+            }
+
+            pMic += ulRun * m_Io.ulFrameBytes;
+            pReference += ulRun * m_Io.ulFrameBytes;
+            ulFrames -= ulRun;
+        }
+    }
+
+private:
+    //
+    // Far[p] as stored, counting back from the head.
+    //
+    FFT_COMPLEX * FarSpectrum(_In_ AEC_CHANNEL & channel, _In_ ULONG ulAge)
+    {
+        return channel.Far[(m_ulHead + AEC_PARTITIONS - ulAge) % AEC_PARTITIONS];
+    }
+
+    //
+    // One block of one channel: transform the far end, estimate and
+    // subtract the echo, adapt and constrain one partition.
+    //
+    VOID RunBlock(_Inout_ AEC_CHANNEL & channel)
+    {
+        const ULONG B = AEC_BLOCK_FRAMES;
+        LONGLONG llFarEnergy = 0;
+        LONGLONG llNearEnergy = 0;
+        LONGLONG llErrorEnergy = 0;
+        LONGLONG llEchoEnergy = 0;
+        FFT_COMPLEX * pFar = FarSpectrum(channel, 0);
+
+        // Overlap-save: the far end transform spans this block and the last.
+        for (ULONG n = 0; n < B; n++)
+        {
+            m_lTime[n] = channel.lFarPrevious[n];
+            m_lTime[B + n] = channel.lFar[n];
+            channel.lFarPrevious[n] = channel.lFar[n];
+            llFarEnergy += (LONGLONG)channel.lFar[n] * channel.lFar[n];
+        }
+        RealFftForward(AEC_FFT_BITS, m_lTime, pFar);
+
+        for (ULONG k = 0; k < AEC_BINS; k++)
+        {
+            LONGLONG llPower = (LONGLONG)pFar[k].lRe * pFar[k].lRe + (LONGLONG)pFar[k].lIm * pFar[k].lIm;
+
+            channel.llPower[k] += (llPower - channel.llPower[k]) >> AEC_POWER_SHIFT;
+        }
+
+        // Echo estimate: the sum of every partition times its far end.
+        RtlZeroMemory(m_llEcho, sizeof(m_llEcho));
+        for (ULONG p = 0; p < AEC_PARTITIONS; p++)
+        {
+            const FFT_COMPLEX * pFilter = channel.Filter[p];
+            const FFT_COMPLEX * pHistory = FarSpectrum(channel, p);
+
+            for (ULONG k = 0; k < AEC_BINS; k++)
+            {
+                m_llEcho[k][0] += ((LONGLONG)pFilter[k].lRe * pHistory[k].lRe - (LONGLONG)pFilter[k].lIm * pHistory[k].lIm) >> AEC_FILTER_SHIFT;
+                m_llEcho[k][1] += ((LONGLONG)pFilter[k].lRe * pHistory[k].lIm + (LONGLONG)pFilter[k].lIm * pHistory[k].lRe) >> AEC_FILTER_SHIFT;
+            }
+        }
+        for (ULONG k = 0; k < AEC_BINS; k++)
+        {
+            m_Spectrum[k].lRe = FixedSaturate(m_llEcho[k][0]);
+            m_Spectrum[k].lIm = FixedSaturate(m_llEcho[k][1]);
+        }
+        RealFftInverse(AEC_FFT_BITS, m_Spectrum, m_lTime);
+
+        // The last half is the linear part. Error and output.
+        for (ULONG n = 0; n < B; n++)
+        {
+            LONG lEcho = m_lTime[B + n];
+            LONG lNear = channel.lNear[n] >> AEC_SAMPLE_SHIFT;
+            LONG lError = lNear - lEcho;
+
+            lError = lError > AEC_SAMPLE_LIMIT ? AEC_SAMPLE_LIMIT :
+                     lError < -AEC_SAMPLE_LIMIT ? -AEC_SAMPLE_LIMIT : lError;
+            llNearEnergy += (LONGLONG)lNear * lNear;
+            llErrorEnergy += (LONGLONG)lError * lError;
+            llEchoEnergy += (LONGLONG)lEcho * lEcho;
+            m_lTime[n] = 0;
+            m_lTime[B + n] = lError;
+            channel.lOut[n] = FixedSaturate((LONGLONG)channel.lNear[n] - ((LONGLONG)lEcho << AEC_SAMPLE_SHIFT));
+        }
+
+        if (llErrorEnergy > llNearEnergy)
+        {
+            RtlCopyMemory(channel.lOut, channel.lNear, sizeof(channel.lOut));
+        }
+
+        if (llFarEnergy > AEC_FAR_THRESHOLD)
+        {
+            LONGLONG llStep = channel.llLeak;
+            LONGLONG llLeak = AEC_LEAK_ONE;
+
+            if (llEchoEnergy > llErrorEnergy)
+            {
+                llLeak = (llErrorEnergy << AEC_LEAK_SHIFT) / llEchoEnergy;
+            }
+            if (llErrorEnergy > 0)
+            {
+                // The estimate's energy is below 2^53, the product below 2^61.
+                LONGLONG llShare = ((llEchoEnergy >> 16) * channel.llLeak) / ((llErrorEnergy >> 16) | 1);
+
+                llStep = llShare > llStep ? llShare : llStep;
+                llStep = llStep < AEC_LEAK_ONE ? llStep : AEC_LEAK_ONE;
+            }
+            channel.llLeak += (llLeak - channel.llLeak) >> (llLeak > channel.llLeak ? AEC_LEAK_RISE : AEC_LEAK_FALL);
+
+            RealFftForward(AEC_FFT_BITS, m_lTime, m_Spectrum);
+            Adapt(channel, (LONG)llStep);
+        }
+
+        Constrain(channel.Filter[m_ulConstrain]);
+    }
+
+    //
+    // W[p] += mu conj(X[p]) E / (P + delta) in every bin. The step of each
+    // bin is kept as a mantissa and a shift: with 1 / (P + delta) as
+    // r 2^-(31 + L), r in (2^30, 2^31] and L the leading bit, the gain
+    // is (E r 2^-31) 2^-L, with r also scaled by lStep (Q24). The
+    // regularization keeps L, and so the shift, positive.
+    //
+    VOID Adapt(_Inout_ AEC_CHANNEL & channel, _In_ LONG lStep)
+    {
+        for (ULONG k = 0; k < AEC_BINS; k++)
+        {
+            LONGLONG llPower = channel.llPower[k] + AEC_REGULARIZATION;
+            ULONG ulHigh = (ULONG)(llPower >> 32);
+            LONG lLeading = ulHigh ? FixedLeadingBit(ulHigh) + 32 : FixedLeadingBit((ULONG)llPower);
+            LONGLONG llNormal;
+            LONGLONG llReciprocal;
+
+            llNormal = (lLeading >= 30) ? llPower >> (lLeading - 30) : llPower << (30 - lLeading);
+            llReciprocal = (((1LL << 61) / llNormal) * lStep) >> AEC_LEAK_SHIFT;
+
+            m_Gain[k].lRe = (LONG)(((LONGLONG)m_Spectrum[k].lRe * llReciprocal) >> 31);
+            m_Gain[k].lIm = (LONG)(((LONGLONG)m_Spectrum[k].lIm * llReciprocal) >> 31);
+            m_lGainShift[k] = lLeading + AEC_STEP_SHIFT - AEC_FILTER_SHIFT;
+        }
+
+        for (ULONG p = 0; p < AEC_PARTITIONS; p++)
+        {
+            FFT_COMPLEX * pFilter = channel.Filter[p];
+            const FFT_COMPLEX * pFar = FarSpectrum(channel, p);
+
+            for (ULONG k = 0; k < AEC_BINS; k++)
+            {
+                LONG lShift = m_lGainShift[k];
+                LONGLONG llRe = (LONGLONG)pFar[k].lRe * m_Gain[k].lRe + (LONGLONG)pFar[k].lIm * m_Gain[k].lIm;
+                LONGLONG llIm = (LONGLONG)pFar[k].lRe * m_Gain[k].lIm - (LONGLONG)pFar[k].lIm * m_Gain[k].lRe;
+
+                pFilter[k].lRe = FixedSaturate(pFilter[k].lRe + (llRe >> lShift));
+                pFilter[k].lIm = FixedSaturate(pFilter[k].lIm + (llIm >> lShift));
+            }
+        }
+    }
+
+    //
+    // Drops the circular wrap an unconstrained update leaves: keeps the
+    // first block of the partition's impulse response and zeroes the rest.
+    //
+    VOID Constrain(_Inout_updates_(AEC_BINS) FFT_COMPLEX * pFilter)
+    {
+        RtlCopyMemory(m_Spectrum, pFilter, sizeof(m_Spectrum));
+        RealFftInverse(AEC_FFT_BITS, m_Spectrum, m_lTime);
+
+        for (ULONG n = 0; n < AEC_BLOCK_FRAMES; n++)
+        {
+            LONG lTap = m_lTime[n];
+
+            m_lTime[n] = lTap > AEC_TAP_LIMIT ? AEC_TAP_LIMIT : lTap < -AEC_TAP_LIMIT ? -AEC_TAP_LIMIT : lTap;
+            m_lTime[AEC_BLOCK_FRAMES + n] = 0;
+        }
+
+        RealFftForward(AEC_FFT_BITS, m_lTime, pFilter);
+    }
+};
+typedef CEchoCanceller *PCEchoCanceller;
+
+#endif // _VIRTUALAUDIODRIVER_ECHOCANCELLER_H_
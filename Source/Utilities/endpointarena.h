@@ -0,0 +1,257 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    endpointarena.h
+
+Abstract:
+
+    One block of memory for everything the adapter keeps per endpoint:
+    the generated endpoint descriptors and the state that goes with them.
+
+    - Generate copies each template descriptor (ENDPOINT_MINIPAIR) once
+      per endpoint pair, pair by pair. The first pair keeps the templates'
+      names. The others get theirs with a "_<pair>" suffix and name the
+      original as their template, so every copy matches the same INF
+      sections.
+    - Allocate hands out the rest of the block, 8 byte aligned, for the
+      state the descriptors index (mixer registers, loopback cables).
+    - Nothing is freed on its own; the owner frees the block.
+
+    The descriptor type is a template parameter; it needs TopoName,
+    TemplateTopoName, WaveName, TemplateWaveName (PWSTR) and PairIndex
+    (ULONG).
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_ENDPOINTARENA_H_
+#define _VIRTUALAUDIODRIVER_ENDPOINTARENA_H_
+
+#include "portable.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+#define ENDPOINT_ARENA_ALIGN        8
+
+// Longest generated name, terminator included.
+#define ENDPOINT_NAME_CHARS         64
+
+// Names per descriptor: topology and wave.
+#define ENDPOINT_ARENA_NAMES        2
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CEndpointArena
+//
+//   Built once while the adapter starts; read only afterwards.
+//
+template <typename MINIPAIR>
+class CEndpointArena
+{
+protected:
+    PBYTE                       m_pStorage;
+    ULONG                       m_cbStorage;
+    ULONG                       m_cbUsed;
+    MINIPAIR *                  m_pEndpoints;           // [m_ulPairs][m_ulTemplates]
+    ULONG                       m_ulTemplates;
+    ULONG                       m_ulPairs;
+
+public:
+    CEndpointArena() :
+        m_pStorage(NULL),
+        m_cbStorage(0),
+        m_cbUsed(0),
+        m_pEndpoints(NULL),
+        m_ulTemplates(0),
+        m_ulPairs(0)
+    {
+    }
+
+    static ULONG Align(_In_ ULONG cbSize)
+    {
+        return (cbSize + ENDPOINT_ARENA_ALIGN - 1) & ~(ULONG)(ENDPOINT_ARENA_ALIGN - 1);
+    }
+
+    //
+    // Bytes Generate takes for ulTemplates descriptors in ulPairs pairs.
+    //
+    static ULONG GetDescriptorBytes
+    (
+        _In_ ULONG      ulTemplates,
+        _In_ ULONG      ulPairs
+    )
+    {
+        ULONG ulEndpoints = ulTemplates * ulPairs;
+
+        return Align(ulEndpoints * sizeof(MINIPAIR)) +
+               Align(ulEndpoints * ENDPOINT_ARENA_NAMES * ENDPOINT_NAME_CHARS * sizeof(WCHAR));
+    }
+
+    //
+    // Binds pStorage, cbStorage bytes, which the caller zeroed and
+    // aligned to ENDPOINT_ARENA_ALIGN.
+    //
+    VOID Init
+    (
+        _In_ PVOID      pStorage,
+        _In_ ULONG      cbStorage
+    )
+    {
+        m_pStorage = (PBYTE)pStorage;
+        m_cbStorage = pStorage != NULL ? cbStorage : 0;
+        m_cbUsed = 0;
+        m_pEndpoints = NULL;
+        m_ulTemplates = 0;
+        m_ulPairs = 0;
+    }
+
+    //
+    // cbSize bytes of the block, zeroed, or NULL when it runs out.
+    //
+    PVOID Allocate
+    (
+        _In_ ULONG      cbSize
+    )
+    {
+        PVOID pBlock;
+
+        cbSize = Align(cbSize);
+        if (cbSize > m_cbStorage - m_cbUsed)
+        {
+            return NULL;
+        }
+
+        pBlock = m_pStorage + m_cbUsed;
+        m_cbUsed += cbSize;
+
+        return pBlock;
+    }
+
+    //
+    // Copies the ulTemplates descriptors in ppTemplates into ulPairs
+    // pairs. Returns FALSE when the block is too small or a template's
+    // name leaves no room for the suffix.
+    //
+    BOOL Generate
+    (
+        _In_reads_(ulTemplates) MINIPAIR * const *  ppTemplates,
+        _In_ ULONG                                  ulTemplates,
+        _In_ ULONG                                  ulPairs
+    )
+    {
+        ULONG ulEndpoints = ulTemplates * ulPairs;
+        PWSTR pszNames;
+
+        m_pEndpoints = (MINIPAIR *)Allocate(ulEndpoints * sizeof(MINIPAIR));
+        pszNames = (PWSTR)Allocate(ulEndpoints * ENDPOINT_ARENA_NAMES * ENDPOINT_NAME_CHARS * sizeof(WCHAR));
+        if (ulEndpoints == 0 || m_pEndpoints == NULL || pszNames == NULL)
+        {
+            m_pEndpoints = NULL;
+            return FALSE;
+        }
+
+        for (ULONG p = 0; p < ulPairs; p++)
+        {
+            for (ULONG t = 0; t < ulTemplates; t++)
+            {
+                const MINIPAIR * pTemplate = ppTemplates[t];
+                MINIPAIR * pEndpoint = &m_pEndpoints[p * ulTemplates + t];
+
+                RtlCopyMemory(pEndpoint, pTemplate, sizeof(MINIPAIR));
+                pEndpoint->PairIndex = p;
+
+                if (p == 0)
+                {
+                    continue;
+                }
+
+                if (!Rename(pTemplate->TopoName, p, pszNames) ||
+                    !Rename(pTemplate->WaveName, p, pszNames + ENDPOINT_NAME_CHARS))
+                {
+                    m_pEndpoints = NULL;
+                    return FALSE;
+                }
+
+                pEndpoint->TopoName = pszNames;
+                pEndpoint->WaveName = pszNames + ENDPOINT_NAME_CHARS;
+                pEndpoint->TemplateTopoName = pTemplate->TemplateTopoName != NULL ? pTemplate->TemplateTopoName : pTemplate->TopoName;
+                pEndpoint->TemplateWaveName = pTemplate->TemplateWaveName != NULL ? pTemplate->TemplateWaveName : pTemplate->WaveName;
+                pszNames += ENDPOINT_ARENA_NAMES * ENDPOINT_NAME_CHARS;
+            }
+        }
+
+        m_ulTemplates = ulTemplates;
+        m_ulPairs = ulPairs;
+
+        return TRUE;
+    }
+
+    ULONG GetPairCount() const
+    {
+        return m_ulPairs;
+    }
+
+    //
+    // The copy of template ulTemplate in pair ulPair, NULL past the end.
+    //
+    MINIPAIR * GetEndpoint
+    (
+        _In_ ULONG      ulPair,
+        _In_ ULONG      ulTemplate
+    ) const
+    {
+        if (m_pEndpoints == NULL || ulPair >= m_ulPairs || ulTemplate >= m_ulTemplates)
+        {
+            return NULL;
+        }
+
+        return &m_pEndpoints[ulPair * m_ulTemplates + ulTemplate];
+    }
+
+private:
+    //
+    // pszName followed by "_<ulPair>" into ENDPOINT_NAME_CHARS at pszOut.
+    //
+    static BOOL Rename
+    (
+        _In_ PCWSTR     pszName,
+        _In_ ULONG      ulPair,
+        _Out_writes_(ENDPOINT_NAME_CHARS) PWSTR pszOut
+    )
+    {
+        WCHAR szDigits[10];
+        ULONG ulDigits = 0;
+        ULONG ulLength = 0;
+
+        do
+        {
+            szDigits[ulDigits++] = (WCHAR)(L'0' + ulPair % 10);
+            ulPair /= 10;
+        } while (ulPair != 0);
+
+        while (pszName != NULL && pszName[ulLength] != L'\0')
+        {
+            if (ulLength + 1 + ulDigits + 1 > ENDPOINT_NAME_CHARS)
+            {
+                return FALSE;
+            }
+            pszOut[ulLength] = pszName[ulLength];
+            ulLength++;
+        }
+
+        pszOut[ulLength++] = L'_';
+        while (ulDigits > 0)
+        {
+            pszOut[ulLength++] = szDigits[--ulDigits];
+        }
+        pszOut[ulLength] = L'\0';
+
+        return TRUE;
+    }
+};
+
+#endif // _VIRTUALAUDIODRIVER_ENDPOINTARENA_H_
@@ -0,0 +1,242 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    fixedsample.h
+
+Abstract:
+
+    Conversion between stream samples and the fixed point domain the
+    audio effects run in.
+
+    A processing sample is a LONG in Q29: full scale is +-2^29, which
+    leaves 12 dB of headroom before the LONG range ends. FixedSample<Bits,
+    Float> loads one sample of a stream format into that domain and stores
+    one back, rounding to nearest and saturating at the format's limits.
+    Float samples are converted with integer operations only and keep
+    values above full scale up to the headroom.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_FIXEDSAMPLE_H_
+#define _VIRTUALAUDIODRIVER_FIXEDSAMPLE_H_
+
+#include "portable.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+#define FIXED_SAMPLE_SHIFT          29
+#define FIXED_SAMPLE_ONE            (1L << FIXED_SAMPLE_SHIFT)
+#define FIXED_SAMPLE_MAX            0x7FFFFFFFL
+#define FIXED_SAMPLE_MIN            (-0x7FFFFFFFL)
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+//
+// Clamps a wide intermediate to the processing range.
+//
+inline LONG FixedSaturate(_In_ LONGLONG llValue)
+{
+    return llValue > FIXED_SAMPLE_MAX ? FIXED_SAMPLE_MAX :
+           llValue < FIXED_SAMPLE_MIN ? FIXED_SAMPLE_MIN :
+           (LONG)llValue;
+}
+
+//
+// Rounds a processing sample to a signed integer sample of Bits bits.
+//
+template <ULONG Bits>
+inline LONG FixedToInteger(_In_ LONG lValue)
+{
+    const ULONG     Shift = FIXED_SAMPLE_SHIFT + 1 - Bits;
+    const LONGLONG  Max = (1LL << (Bits - 1)) - 1;
+    LONGLONG        llValue = ((LONGLONG)lValue + (1LL << (Shift - 1))) >> Shift;
+
+    return llValue > Max ? (LONG)Max : llValue < -Max - 1 ? (LONG)(-Max - 1) : (LONG)llValue;
+}
+
+//
+// Position of the highest set bit of a nonzero value.
+//
+inline LONG FixedLeadingBit(_In_ ULONG ulValue)
+{
+    LONG lBit = 0;
+
+    if (ulValue >> 16)  { ulValue >>= 16; lBit += 16; }
+    if (ulValue >> 8)   { ulValue >>= 8;  lBit += 8; }
+    if (ulValue >> 4)   { ulValue >>= 4;  lBit += 4; }
+    if (ulValue >> 2)   { ulValue >>= 2;  lBit += 2; }
+    if (ulValue >> 1)   { lBit += 1; }
+
+    return lBit;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FixedSample
+//
+//   Load reads one little-endian sample and returns it in Q29; Store
+//   writes a Q29 value back.
+//
+template <ULONG Bits, BOOL Float>
+struct FixedSample;
+
+template <>
+struct FixedSample<8, FALSE>
+{
+    static LONG Load(_In_ const BYTE * p)
+    {
+        // Unsigned, centered at 0x80.
+        return ((LONG)p[0] - 0x80) * (1L << (FIXED_SAMPLE_SHIFT - 7));
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        p[0] = (BYTE)(FixedToInteger<8>(lValue) + 0x80);
+    }
+};
+
+template <>
+struct FixedSample<16, FALSE>
+{
+    static LONG Load(_In_ const BYTE * p)
+    {
+        return (LONG)(SHORT)(p[0] | (p[1] << 8)) * (1L << (FIXED_SAMPLE_SHIFT - 15));
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        LONG lSample = FixedToInteger<16>(lValue);
+
+        p[0] = (BYTE)lSample;
+        p[1] = (BYTE)(lSample >> 8);
+    }
+};
+
+template <>
+struct FixedSample<24, FALSE>
+{
+    static LONG Load(_In_ const BYTE * p)
+    {
+        // Packed; the top byte is the sample's sign.
+        return (LONG)(((ULONG)p[0] << 8) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 24)) >> (32 - FIXED_SAMPLE_SHIFT - 1);
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        LONG lSample = FixedToInteger<24>(lValue);
+
+        p[0] = (BYTE)lSample;
+        p[1] = (BYTE)(lSample >> 8);
+        p[2] = (BYTE)(lSample >> 16);
+    }
+};
+
+template <>
+struct FixedSample<32, FALSE>
+{
+    static LONG Load(_In_ const BYTE * p)
+    {
+        // The two lowest bits do not fit in Q29.
+        return (LONG)((ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24)) >> (32 - FIXED_SAMPLE_SHIFT - 1);
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        LONGLONG llSample = (LONGLONG)lValue * (1LL << (32 - FIXED_SAMPLE_SHIFT - 1));
+        LONG lSample = llSample > 0x7FFFFFFFLL ? 0x7FFFFFFF : llSample < -0x80000000LL ? (LONG)0x80000000 : (LONG)llSample;
+
+        p[0] = (BYTE)lSample;
+        p[1] = (BYTE)(lSample >> 8);
+        p[2] = (BYTE)(lSample >> 16);
+        p[3] = (BYTE)(lSample >> 24);
+    }
+};
+
+template <>
+struct FixedSample<32, TRUE>
+{
+    //
+    // IEEE single to Q29, truncated. Values beyond the headroom and
+    // infinities saturate; NaNs and values below 2^-29 become 0.
+    //
+    static LONG Load(_In_ const BYTE * p)
+    {
+        ULONG ulBits = (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+        LONG lExponent = (LONG)((ulBits >> 23) & 0xFF);
+        ULONG ulMantissa = (ulBits & 0x7FFFFF) | 0x800000;
+        LONG lShift = lExponent - 127 - 23 + FIXED_SAMPLE_SHIFT;
+        LONG lValue;
+
+        if (lExponent == 0xFF && (ulBits & 0x7FFFFF))
+        {
+            return 0;
+        }
+
+        if (lShift >= 31 - 23)
+        {
+            lValue = FIXED_SAMPLE_MAX;
+        }
+        else if (lShift >= 0)
+        {
+            lValue = (LONG)(ulMantissa << lShift);
+        }
+        else
+        {
+            lValue = (lShift > -24) ? (LONG)(ulMantissa >> -lShift) : 0;
+        }
+
+        return (ulBits & 0x80000000) ? -lValue : lValue;
+    }
+
+    //
+    // Q29 to IEEE single, rounded to nearest even. Every processing value
+    // is in the normal range.
+    //
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        ULONG ulSign = (lValue < 0) ? 0x80000000 : 0;
+        ULONG ulMagnitude = (lValue < 0) ? (ULONG)(-(LONGLONG)lValue) : (ULONG)lValue;
+        ULONG ulBits = ulSign;
+
+        if (ulMagnitude != 0)
+        {
+            LONG lLeading = FixedLeadingBit(ulMagnitude);
+            ULONG ulMantissa;
+
+            if (lLeading > 23)
+            {
+                LONG lShift = lLeading - 23;
+                ULONG ulHalf = 1UL << (lShift - 1);
+                ULONG ulRest = ulMagnitude & ((1UL << lShift) - 1);
+
+                ulMantissa = ulMagnitude >> lShift;
+                if (ulRest > ulHalf || (ulRest == ulHalf && (ulMantissa & 1)))
+                {
+                    ulMantissa++;
+                    if (ulMantissa >> 24)
+                    {
+                        ulMantissa >>= 1;
+                        lLeading++;
+                    }
+                }
+            }
+            else
+            {
+                ulMantissa = ulMagnitude << (23 - lLeading);
+            }
+
+            ulBits |= ((ULONG)(lLeading - FIXED_SAMPLE_SHIFT + 127) << 23) | (ulMantissa & 0x7FFFFF);
+        }
+
+        p[0] = (BYTE)ulBits;
+        p[1] = (BYTE)(ulBits >> 8);
+        p[2] = (BYTE)(ulBits >> 16);
+        p[3] = (BYTE)(ulBits >> 24);
+    }
+};
+
+#endif // _VIRTUALAUDIODRIVER_FIXEDSAMPLE_H_
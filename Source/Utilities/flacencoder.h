@@ -0,0 +1,1010 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    flacencoder.h
+
+Abstract:
+
+    Streaming FLAC encoder. Takes interleaved little-endian PCM and produces
+    a FLAC stream of fixed-size blocks. Every channel is coded on its own
+    with the better of FLAC's fixed polynomial predictors (orders 0 to 4)
+    followed by partitioned Rice residuals, or verbatim when prediction does
+    not pay. The work per block is a fixed number of passes over it, and
+    only integer arithmetic is used.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_FLACENCODER_H_
+#define _VIRTUALAUDIODRIVER_FLACENCODER_H_
+
+#include "portable.h"
+
+#define FLAC_DEFAULT_BLOCK_FRAMES   4096
+#define FLAC_MIN_BLOCK_FRAMES       16
+#define FLAC_MAX_BLOCK_FRAMES       32768
+#define FLAC_MAX_CHANNELS           8
+#define FLAC_MAX_FIXED_ORDER        4
+#define FLAC_MAX_PARTITION_ORDER    8
+#define FLAC_MAX_RICE_PARAMETER     30
+
+// "fLaC" marker plus the STREAMINFO metadata block.
+#define FLAC_STREAM_HEADER_BYTES    42
+
+// Sync code through CRC-8 for the largest header this encoder writes.
+#define FLAC_MAX_FRAME_HEADER_BYTES 16
+
+///////////////////////////////////////////////////////////////////////////////
+// CFlacEncoder
+//
+//   Usage: Init with caller-owned workspace (GetWorkspaceBytes), write
+//   GetStreamHeader at the start of the file, feed data with AddData and
+//   call EncodeBlock whenever IsBlockFull. At the end, EncodeBlock once
+//   more for the partial block and rewrite the header, which then carries
+//   the total length and frame sizes.
+//
+class CFlacEncoder
+{
+protected:
+    ULONG                       m_ulSampleRate;
+    ULONG                       m_ulChannels;
+    ULONG                       m_ulBitsPerSample;
+    ULONG                       m_ulSampleBytes;
+    ULONG                       m_ulFrameBytes;
+    ULONG                       m_ulBlockFrames;
+
+    PLONG                       m_pSamples;         // Planar, m_ulBlockFrames per channel.
+    PLONG                       m_pResidual;
+    ULONGLONG *                 m_pPartitionSums;   // One level of Rice partitions.
+    PBYTE                       m_pOutput;          // One encoded frame.
+    ULONG                       m_ulBufferedFrames;
+
+    BYTE                        m_Stage[FLAC_MAX_CHANNELS * 4];
+    ULONG                       m_ulStagedBytes;
+
+    ULONG                       m_ulFrameNumber;
+    ULONGLONG                   m_ullTotalFrames;
+    ULONG                       m_ulMinFrameBytes;
+    ULONG                       m_ulMaxFrameBytes;
+
+    // Bit writer, MSB first.
+    PBYTE                       m_pBitOut;
+    ULONGLONG                   m_ullBitAccum;
+    ULONG                       m_ulBitCount;
+
+    USHORT                      m_Crc16Table[256];
+
+public:
+    CFlacEncoder() :
+        m_ulSampleRate(0),
+        m_ulChannels(0),
+        m_ulBitsPerSample(0),
+        m_ulSampleBytes(0),
+        m_ulFrameBytes(0),
+        m_ulBlockFrames(0),
+        m_pSamples(NULL),
+        m_pResidual(NULL),
+        m_pPartitionSums(NULL),
+        m_pOutput(NULL),
+        m_ulBufferedFrames(0),
+        m_ulStagedBytes(0),
+        m_ulFrameNumber(0),
+        m_ullTotalFrames(0),
+        m_ulMinFrameBytes(0),
+        m_ulMaxFrameBytes(0),
+        m_pBitOut(NULL),
+        m_ullBitAccum(0),
+        m_ulBitCount(0)
+    {
+        for (ULONG i = 0; i < 256; i++)
+        {
+            ULONG ulCrc = i << 8;
+            for (ULONG j = 0; j < 8; j++)
+            {
+                ulCrc = (ulCrc & 0x8000) ? ((ulCrc << 1) ^ 0x8005) : (ulCrc << 1);
+            }
+            m_Crc16Table[i] = (USHORT)ulCrc;
+        }
+    }
+
+    //
+    // Integer PCM with 8, 16, 24 or 32 bits per sample (8-bit unsigned, the
+    // rest signed) and up to FLAC_MAX_CHANNELS channels.
+    //
+    static BOOL IsFormatSupported
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulChannels,
+        _In_ ULONG      ulBitsPerSample
+    )
+    {
+        return ulSampleRate > 0 && ulSampleRate < (1UL << 20) &&
+               ulChannels > 0 && ulChannels <= FLAC_MAX_CHANNELS &&
+               (ulBitsPerSample == 8 || ulBitsPerSample == 16 ||
+                ulBitsPerSample == 24 || ulBitsPerSample == 32);
+    }
+
+    static ULONG GetMaxFrameBytes
+    (
+        _In_ ULONG      ulChannels,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulBlockFrames
+    )
+    {
+        // Header, then per channel a verbatim subframe (the encoder never
+        // writes anything larger) with its header and wasted-bits field,
+        // then the byte-aligned CRC-16.
+        return FLAC_MAX_FRAME_HEADER_BYTES +
+               ulChannels * (((ulBlockFrames * ulBitsPerSample) + 7) / 8 + 6) +
+               2;
+    }
+
+    static ULONG GetWorkspaceBytes
+    (
+        _In_ ULONG      ulChannels,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulBlockFrames
+    )
+    {
+        return (ulChannels + 1) * ulBlockFrames * (ULONG)sizeof(LONG) +
+               (1UL << FLAC_MAX_PARTITION_ORDER) * (ULONG)sizeof(ULONGLONG) +
+               GetMaxFrameBytes(ulChannels, ulBitsPerSample, ulBlockFrames);
+    }
+
+    //
+    // pWorkspace must hold GetWorkspaceBytes and be 8-byte aligned.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulChannels,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulBlockFrames,
+        _In_ PVOID      pWorkspace,
+        _In_ ULONG      cbWorkspace
+    )
+    {
+        if (!IsFormatSupported(ulSampleRate, ulChannels, ulBitsPerSample) ||
+            ulBlockFrames < FLAC_MIN_BLOCK_FRAMES || ulBlockFrames > FLAC_MAX_BLOCK_FRAMES ||
+            pWorkspace == NULL ||
+            cbWorkspace < GetWorkspaceBytes(ulChannels, ulBitsPerSample, ulBlockFrames))
+        {
+            return FALSE;
+        }
+
+        m_ulSampleRate = ulSampleRate;
+        m_ulChannels = ulChannels;
+        m_ulBitsPerSample = ulBitsPerSample;
+        m_ulSampleBytes = ulBitsPerSample / 8;
+        m_ulFrameBytes = m_ulSampleBytes * ulChannels;
+        m_ulBlockFrames = ulBlockFrames;
+
+        m_pPartitionSums = (ULONGLONG *)pWorkspace;
+        m_pSamples = (PLONG)(m_pPartitionSums + (1UL << FLAC_MAX_PARTITION_ORDER));
+        m_pResidual = m_pSamples + ulChannels * ulBlockFrames;
+        m_pOutput = (PBYTE)(m_pResidual + ulBlockFrames);
+
+        m_ulBufferedFrames = 0;
+        m_ulStagedBytes = 0;
+        m_ulFrameNumber = 0;
+        m_ullTotalFrames = 0;
+        m_ulMinFrameBytes = 0;
+        m_ulMaxFrameBytes = 0;
+
+        return TRUE;
+    }
+
+    ULONG GetFrameBytes() const
+    {
+        return m_ulFrameBytes;
+    }
+
+    ULONGLONG GetTotalFrames() const
+    {
+        return m_ullTotalFrames;
+    }
+
+    BOOL IsBlockFull() const
+    {
+        return m_ulBufferedFrames == m_ulBlockFrames;
+    }
+
+    //
+    // Input bytes taken by AddData that are not encoded yet.
+    //
+    ULONG GetPendingBytes() const
+    {
+        return m_ulBufferedFrames * m_ulFrameBytes + m_ulStagedBytes;
+    }
+
+    //
+    // Starts a new FLAC stream, e.g. in a new file: frame numbers, length
+    // and frame sizes start over. Buffered input is kept.
+    //
+    VOID RestartStream()
+    {
+        m_ulFrameNumber = 0;
+        m_ullTotalFrames = 0;
+        m_ulMinFrameBytes = 0;
+        m_ulMaxFrameBytes = 0;
+    }
+
+    //
+    // Writes the "fLaC" marker and STREAMINFO, FLAC_STREAM_HEADER_BYTES in
+    // all. The length and frame size fields reflect what has been encoded
+    // so far; the MD5 signature is left unset, which FLAC allows.
+    //
+    VOID GetStreamHeader
+    (
+        _Out_writes_bytes_(FLAC_STREAM_HEADER_BYTES) PBYTE pHeader
+    )
+    {
+        BitWriterStart(pHeader);
+
+        PutBits(0x664C6143, 32);                    // "fLaC"
+        PutBits(0x80, 8);                           // Last metadata block, STREAMINFO.
+        PutBits(34, 24);
+        PutBits(m_ulBlockFrames, 16);
+        PutBits(m_ulBlockFrames, 16);
+        PutBits(m_ulMinFrameBytes, 24);
+        PutBits(m_ulMaxFrameBytes, 24);
+        PutBits(m_ulSampleRate, 20);
+        PutBits(m_ulChannels - 1, 3);
+        PutBits(m_ulBitsPerSample - 1, 5);
+        PutBits((ULONG)(m_ullTotalFrames >> 32) & 0xF, 4);
+        PutBits((ULONG)m_ullTotalFrames, 32);
+        for (ULONG i = 0; i < 4; i++)
+        {
+            PutBits(0, 32);                         // MD5 not computed.
+        }
+    }
+
+    //
+    // Buffers interleaved PCM until the block is full. Returns the number of
+    // bytes taken, which is less than cbData only when the block filled up;
+    // encode it and pass the rest again. A frame split across calls is
+    // staged.
+    //
+    ULONG AddData
+    (
+        _In_reads_bytes_(cbData) const BYTE *   pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG cbUsed = 0;
+
+        if (m_ulFrameBytes == 0 || IsBlockFull())
+        {
+            return 0;
+        }
+
+        if (m_ulStagedBytes > 0)
+        {
+            ULONG cbFill = m_ulFrameBytes - m_ulStagedBytes;
+            if (cbFill > cbData)
+            {
+                cbFill = cbData;
+            }
+
+            RtlCopyMemory(m_Stage + m_ulStagedBytes, pData, cbFill);
+            m_ulStagedBytes += cbFill;
+            cbUsed = cbFill;
+
+            if (m_ulStagedBytes < m_ulFrameBytes)
+            {
+                return cbUsed;
+            }
+
+            DecodeFrames(m_Stage, 1);
+            m_ulStagedBytes = 0;
+        }
+
+        ULONG ulFrames = (cbData - cbUsed) / m_ulFrameBytes;
+        if (ulFrames > m_ulBlockFrames - m_ulBufferedFrames)
+        {
+            ulFrames = m_ulBlockFrames - m_ulBufferedFrames;
+        }
+
+        DecodeFrames(pData + cbUsed, ulFrames);
+        cbUsed += ulFrames * m_ulFrameBytes;
+
+        if (!IsBlockFull())
+        {
+            // Less than a frame is left.
+            m_ulStagedBytes = cbData - cbUsed;
+            RtlCopyMemory(m_Stage, pData + cbUsed, m_ulStagedBytes);
+            cbUsed = cbData;
+        }
+
+        return cbUsed;
+    }
+
+    //
+    // Encodes the buffered frames, normally a full block, as one FLAC
+    // frame. Returns its size and points *ppFrame at it; the data stays
+    // valid until the next call. Returns 0 when nothing is buffered. A
+    // staged partial frame is not encoded.
+    //
+    ULONG EncodeBlock
+    (
+        _Out_ const BYTE **     ppFrame
+    )
+    {
+        *ppFrame = m_pOutput;
+
+        if (m_ulBufferedFrames == 0)
+        {
+            return 0;
+        }
+
+        ULONG ulFrames = m_ulBufferedFrames;
+
+        BitWriterStart(m_pOutput);
+        PutFrameHeader(ulFrames);
+        PutBits(Crc8(m_pOutput, (ULONG)(m_pBitOut - m_pOutput)), 8);
+
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            PutSubframe(m_pSamples + c * m_ulBlockFrames, ulFrames);
+        }
+
+        BitWriterAlign();
+        PutBits(Crc16(m_pOutput, (ULONG)(m_pBitOut - m_pOutput)), 16);
+
+        ULONG cbFrame = (ULONG)(m_pBitOut - m_pOutput);
+
+        m_ulFrameNumber++;
+        m_ullTotalFrames += ulFrames;
+        m_ulBufferedFrames = 0;
+
+        if (m_ulMinFrameBytes == 0 || cbFrame < m_ulMinFrameBytes)
+        {
+            m_ulMinFrameBytes = cbFrame;
+        }
+        if (cbFrame > m_ulMaxFrameBytes)
+        {
+            m_ulMaxFrameBytes = cbFrame;
+        }
+
+        return cbFrame;
+    }
+
+protected:
+    //=========================================================================
+    // Input
+    //=========================================================================
+    VOID DecodeFrames
+    (
+        _In_ const BYTE *   pData,
+        _In_ ULONG          ulFrames
+    )
+    {
+        PLONG pOut = m_pSamples + m_ulBufferedFrames;
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < m_ulChannels; c++)
+            {
+                LONG lSample;
+
+                switch (m_ulSampleBytes)
+                {
+                    case 1:
+                        lSample = (LONG)pData[0] - 0x80;
+                        break;
+                    case 2:
+                        lSample = (SHORT)(pData[0] | (pData[1] << 8));
+                        break;
+                    case 3:
+                        lSample = (LONG)(((ULONG)pData[0] << 8) | ((ULONG)pData[1] << 16) | ((ULONG)pData[2] << 24)) >> 8;
+                        break;
+                    default:
+                        lSample = (LONG)((ULONG)pData[0] | ((ULONG)pData[1] << 8) | ((ULONG)pData[2] << 16) | ((ULONG)pData[3] << 24));
+                        break;
+                }
+
+                pOut[c * m_ulBlockFrames + i] = lSample;
+                pData += m_ulSampleBytes;
+            }
+        }
+
+        m_ulBufferedFrames += ulFrames;
+    }
+
+    //=========================================================================
+    // Frame and subframe coding
+    //=========================================================================
+    VOID PutFrameHeader
+    (
+        _In_ ULONG      ulFrames
+    )
+    {
+        ULONG ulBlockCode;
+        ULONG ulRateCode;
+        ULONG ulSizeCode;
+
+        // Block size: 256 * 2^n for n = 0..7 has a code of its own.
+        ulBlockCode = 7;
+        for (ULONG n = 0; n < 8; n++)
+        {
+            if (ulFrames == (256UL << n))
+            {
+                ulBlockCode = 8 + n;
+                break;
+            }
+        }
+        if (ulBlockCode == 7 && ulFrames <= 256)
+        {
+            ulBlockCode = 6;
+        }
+
+        switch (m_ulSampleRate)
+        {
+            case 88200:  ulRateCode = 1;  break;
+            case 176400: ulRateCode = 2;  break;
+            case 192000: ulRateCode = 3;  break;
+            case 8000:   ulRateCode = 4;  break;
+            case 16000:  ulRateCode = 5;  break;
+            case 22050:  ulRateCode = 6;  break;
+            case 24000:  ulRateCode = 7;  break;
+            case 32000:  ulRateCode = 8;  break;
+            case 44100:  ulRateCode = 9;  break;
+            case 48000:  ulRateCode = 10; break;
+            case 96000:  ulRateCode = 11; break;
+            default:
+                if (m_ulSampleRate % 1000 == 0 && m_ulSampleRate <= 255000)
+                {
+                    ulRateCode = 12;
+                }
+                else if (m_ulSampleRate <= 0xFFFF)
+                {
+                    ulRateCode = 13;
+                }
+                else if (m_ulSampleRate % 10 == 0 && m_ulSampleRate <= 655350)
+                {
+                    ulRateCode = 14;
+                }
+                else
+                {
+                    ulRateCode = 0;                 // From STREAMINFO.
+                }
+                break;
+        }
+
+        switch (m_ulBitsPerSample)
+        {
+            case 8:  ulSizeCode = 1; break;
+            case 16: ulSizeCode = 4; break;
+            case 24: ulSizeCode = 6; break;
+            default: ulSizeCode = 7; break;
+        }
+
+        PutBits(0xFFF8, 16);                        // Sync, fixed block size.
+        PutBits(ulBlockCode, 4);
+        PutBits(ulRateCode, 4);
+        PutBits(m_ulChannels - 1, 4);               // Independent channels.
+        PutBits(ulSizeCode, 3);
+        PutBits(0, 1);
+
+        // Frame number, UTF-8 style.
+        ULONG ulNumber = m_ulFrameNumber & 0x7FFFFFFF;
+        if (ulNumber < 0x80)
+        {
+            PutBits(ulNumber, 8);
+        }
+        else
+        {
+            ULONG ulBytes = (ulNumber < 0x800) ? 2 :
+                            (ulNumber < 0x10000) ? 3 :
+                            (ulNumber < 0x200000) ? 4 :
+                            (ulNumber < 0x4000000) ? 5 : 6;
+
+            PutBits(((0xFF00 >> ulBytes) & 0xFF) | (ulNumber >> (6 * (ulBytes - 1))), 8);
+            for (ULONG i = ulBytes - 1; i > 0; i--)
+            {
+                PutBits(0x80 | ((ulNumber >> (6 * (i - 1))) & 0x3F), 8);
+            }
+        }
+
+        if (ulBlockCode == 6)
+        {
+            PutBits(ulFrames - 1, 8);
+        }
+        else if (ulBlockCode == 7)
+        {
+            PutBits(ulFrames - 1, 16);
+        }
+
+        if (ulRateCode == 12)
+        {
+            PutBits(m_ulSampleRate / 1000, 8);
+        }
+        else if (ulRateCode == 13)
+        {
+            PutBits(m_ulSampleRate, 16);
+        }
+        else if (ulRateCode == 14)
+        {
+            PutBits(m_ulSampleRate / 10, 16);
+        }
+    }
+
+    VOID PutSubframe
+    (
+        _Inout_updates_(ulFrames) PLONG pSamples,
+        _In_ ULONG                      ulFrames
+    )
+    {
+        ULONG ulBits = m_ulBitsPerSample;
+        ULONG ulOr = 0;
+        BOOL  bConstant = TRUE;
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            ulOr |= (ULONG)pSamples[i];
+            bConstant &= (pSamples[i] == pSamples[0]);
+        }
+
+        if (bConstant)
+        {
+            PutBits(0x00, 8);                       // CONSTANT, no wasted bits.
+            PutBits((ULONG)pSamples[0], ulBits);
+            return;
+        }
+
+        // Low bits that are zero in every sample (a 24-bit signal in a
+        // 32-bit container) are not coded.
+        ULONG ulWasted = 0;
+        while ((ulOr & 1) == 0)
+        {
+            ulOr >>= 1;
+            ulWasted++;
+        }
+        if (ulWasted > 0)
+        {
+            for (ULONG i = 0; i < ulFrames; i++)
+            {
+                pSamples[i] >>= ulWasted;
+            }
+            ulBits -= ulWasted;
+        }
+
+        ULONG ulOrder = SelectFixedOrder(pSamples, ulFrames);
+        ULONGLONG ullVerbatimBits = (ULONGLONG)ulFrames * ulBits;
+        ULONGLONG ullFixedBits = ~0ULL;
+        ULONG ulPartitionOrder = 0;
+
+        if (ulOrder <= FLAC_MAX_FIXED_ORDER)
+        {
+            ComputeResidual(pSamples, ulFrames, ulOrder);
+            ullFixedBits = (ULONGLONG)ulOrder * ulBits +
+                           SelectPartitionOrder(ulFrames, ulOrder, &ulPartitionOrder);
+        }
+
+        if (ullFixedBits < ullVerbatimBits)
+        {
+            PutBits(0x10 | (ulOrder << 1) | (ulWasted ? 1 : 0), 8);
+            PutWasted(ulWasted);
+
+            for (ULONG i = 0; i < ulOrder; i++)
+            {
+                PutBits((ULONG)pSamples[i], ulBits);
+            }
+
+            PutResidual(ulFrames, ulOrder, ulPartitionOrder);
+        }
+        else
+        {
+            PutBits(0x02 | (ulWasted ? 1 : 0), 8);  // VERBATIM.
+            PutWasted(ulWasted);
+
+            for (ULONG i = 0; i < ulFrames; i++)
+            {
+                PutBits((ULONG)pSamples[i], ulBits);
+            }
+        }
+    }
+
+    VOID PutWasted
+    (
+        _In_ ULONG      ulWasted
+    )
+    {
+        if (ulWasted > 0)
+        {
+            // Unary: ulWasted - 1 zeros, then a one.
+            PutZeros(ulWasted - 1);
+            PutBits(1, 1);
+        }
+    }
+
+    //
+    // The fixed predictor with the smallest sum of absolute residuals, or
+    // FLAC_MAX_FIXED_ORDER + 1 when no order has residuals that fit in 32
+    // bits (possible only for 32-bit input).
+    //
+    ULONG SelectFixedOrder
+    (
+        _In_reads_(ulFrames) const LONG *   pSamples,
+        _In_ ULONG                          ulFrames
+    )
+    {
+        ULONG ulMaxOrder = (ulFrames - 1 < FLAC_MAX_FIXED_ORDER) ? ulFrames - 1 : FLAC_MAX_FIXED_ORDER;
+        ULONGLONG ullSum[FLAC_MAX_FIXED_ORDER + 1] = { 0 };
+        LONGLONG llMax[FLAC_MAX_FIXED_ORDER + 1] = { 0 };
+
+        // Orders are compared over the same samples, but every residual a
+        // lower order would code is range checked.
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            LONGLONG e[FLAC_MAX_FIXED_ORDER + 1];
+            LONGLONG x0 = pSamples[i];
+            LONGLONG x1 = (i >= 1) ? pSamples[i - 1] : 0;
+            LONGLONG x2 = (i >= 2) ? pSamples[i - 2] : 0;
+            LONGLONG x3 = (i >= 3) ? pSamples[i - 3] : 0;
+            LONGLONG x4 = (i >= 4) ? pSamples[i - 4] : 0;
+
+            e[0] = x0;
+            e[1] = x0 - x1;
+            e[2] = x0 - 2 * x1 + x2;
+            e[3] = x0 - 3 * x1 + 3 * x2 - x3;
+            e[4] = x0 - 4 * x1 + 6 * x2 - 4 * x3 + x4;
+
+            for (ULONG k = 0; k <= ulMaxOrder && k <= i; k++)
+            {
+                LONGLONG a = (e[k] < 0) ? -e[k] : e[k];
+                if (i >= ulMaxOrder)
+                {
+                    ullSum[k] += (ULONGLONG)a;
+                }
+                if (a > llMax[k])
+                {
+                    llMax[k] = a;
+                }
+            }
+        }
+
+        ULONG ulBest = FLAC_MAX_FIXED_ORDER + 1;
+        for (ULONG k = 0; k <= ulMaxOrder; k++)
+        {
+            // Must be representable as a 32-bit signed residual.
+            if (llMax[k] <= 0x7FFFFFFF &&
+                (ulBest > FLAC_MAX_FIXED_ORDER || ullSum[k] < ullSum[ulBest]))
+            {
+                ulBest = k;
+            }
+        }
+
+        return ulBest;
+    }
+
+    VOID ComputeResidual
+    (
+        _In_reads_(ulFrames) const LONG *   pSamples,
+        _In_ ULONG                          ulFrames,
+        _In_ ULONG                          ulOrder
+    )
+    {
+        PLONG r = m_pResidual;
+        const LONG * x = pSamples;
+
+        // Wrapping 32-bit arithmetic gives the exact residual, which
+        // SelectFixedOrder has checked to fit.
+        switch (ulOrder)
+        {
+            case 0:
+                for (ULONG i = 0; i < ulFrames; i++)
+                    r[i] = x[i];
+                break;
+            case 1:
+                for (ULONG i = 1; i < ulFrames; i++)
+                    r[i - 1] = (LONG)((ULONG)x[i] - (ULONG)x[i - 1]);
+                break;
+            case 2:
+                for (ULONG i = 2; i < ulFrames; i++)
+                    r[i - 2] = (LONG)((ULONG)x[i] - 2 * (ULONG)x[i - 1] + (ULONG)x[i - 2]);
+                break;
+            case 3:
+                for (ULONG i = 3; i < ulFrames; i++)
+                    r[i - 3] = (LONG)((ULONG)x[i] - 3 * (ULONG)x[i - 1] + 3 * (ULONG)x[i - 2] - (ULONG)x[i - 3]);
+                break;
+            default:
+                for (ULONG i = 4; i < ulFrames; i++)
+                    r[i - 4] = (LONG)((ULONG)x[i] - 4 * (ULONG)x[i - 1] + 6 * (ULONG)x[i - 2] - 4 * (ULONG)x[i - 3] + (ULONG)x[i - 4]);
+                break;
+        }
+    }
+
+    static ULONG ZigZag
+    (
+        _In_ LONG       lValue
+    )
+    {
+        return ((ULONG)lValue << 1) ^ (ULONG)(lValue >> 31);
+    }
+
+    //
+    // Best Rice parameter for ulCount values summing to ullSum, and an
+    // upper bound on their coded size in bits (without the parameter).
+    //
+    static ULONGLONG RiceCost
+    (
+        _In_ ULONGLONG  ullSum,
+        _In_ ULONG      ulCount,
+        _Out_ PULONG    pulParameter
+    )
+    {
+        // Start near log2 of the mean, then walk downhill; the cost is convex
+        // in the parameter.
+        ULONG k = 0;
+        ULONGLONG ullMean = ullSum / ulCount;
+        while (k < FLAC_MAX_RICE_PARAMETER && (ullMean >> (k + 1)) > 0)
+        {
+            k++;
+        }
+
+        ULONGLONG ullCost = (ULONGLONG)ulCount * (k + 1) + (ullSum >> k);
+        for (;;)
+        {
+            if (k > 0)
+            {
+                ULONGLONG ullDown = (ULONGLONG)ulCount * k + (ullSum >> (k - 1));
+                if (ullDown < ullCost)
+                {
+                    k--;
+                    ullCost = ullDown;
+                    continue;
+                }
+            }
+            if (k < FLAC_MAX_RICE_PARAMETER)
+            {
+                ULONGLONG ullUp = (ULONGLONG)ulCount * (k + 2) + (ullSum >> (k + 1));
+                if (ullUp < ullCost)
+                {
+                    k++;
+                    ullCost = ullUp;
+                    continue;
+                }
+            }
+            break;
+        }
+
+        *pulParameter = k;
+        return ullCost;
+    }
+
+    //
+    // Picks the partition order for the residual in m_pResidual. Returns the
+    // bits for the residual section, coding method and order included.
+    // Coarser orders are evaluated by merging the sums of the finest one.
+    //
+    ULONGLONG SelectPartitionOrder
+    (
+        _In_ ULONG      ulFrames,
+        _In_ ULONG      ulOrder,
+        _Out_ PULONG    pulPartitionOrder
+    )
+    {
+        ULONG ulMaxPartitionOrder = 0;
+        while (ulMaxPartitionOrder < FLAC_MAX_PARTITION_ORDER &&
+               (ulFrames & ((2UL << ulMaxPartitionOrder) - 1)) == 0 &&
+               (ulFrames >> (ulMaxPartitionOrder + 1)) > ulOrder)
+        {
+            ulMaxPartitionOrder++;
+        }
+
+        ULONG ulPartitions = 1UL << ulMaxPartitionOrder;
+        ULONG ulPartitionFrames = ulFrames >> ulMaxPartitionOrder;
+        const LONG * r = m_pResidual;
+
+        for (ULONG p = 0; p < ulPartitions; p++)
+        {
+            ULONG ulCount = (p == 0) ? ulPartitionFrames - ulOrder : ulPartitionFrames;
+            ULONGLONG ullSum = 0;
+
+            for (ULONG i = 0; i < ulCount; i++)
+            {
+                ullSum += ZigZag(r[i]);
+            }
+            r += ulCount;
+
+            m_pPartitionSums[p] = ullSum;
+        }
+
+        ULONGLONG ullBest = ~0ULL;
+        for (LONG lLevel = (LONG)ulMaxPartitionOrder; lLevel >= 0; lLevel--)
+        {
+            ULONG ulLevelPartitions = 1UL << lLevel;
+            ULONG ulLevelFrames = ulFrames >> lLevel;
+            ULONGLONG ullBits = 0;
+            ULONG ulMaxParameter = 0;
+
+            for (ULONG p = 0; p < ulLevelPartitions; p++)
+            {
+                ULONG ulParameter;
+                ULONG ulCount = (p == 0) ? ulLevelFrames - ulOrder : ulLevelFrames;
+
+                ullBits += RiceCost(m_pPartitionSums[p], ulCount, &ulParameter);
+                if (ulParameter > ulMaxParameter)
+                {
+                    ulMaxParameter = ulParameter;
+                }
+            }
+
+            ullBits += 2 + 4 + (ULONGLONG)ulLevelPartitions * ((ulMaxParameter > 14) ? 5 : 4);
+
+            if (ullBits <= ullBest)
+            {
+                ullBest = ullBits;
+                *pulPartitionOrder = (ULONG)lLevel;
+            }
+
+            // Merge pairs for the next coarser level.
+            for (ULONG p = 0; p < ulLevelPartitions / 2; p++)
+            {
+                m_pPartitionSums[p] = m_pPartitionSums[2 * p] + m_pPartitionSums[2 * p + 1];
+            }
+        }
+
+        return ullBest;
+    }
+
+    VOID PutResidual
+    (
+        _In_ ULONG      ulFrames,
+        _In_ ULONG      ulOrder,
+        _In_ ULONG      ulPartitionOrder
+    )
+    {
+        ULONG ulPartitions = 1UL << ulPartitionOrder;
+        ULONG ulPartitionFrames = ulFrames >> ulPartitionOrder;
+        ULONG ulParameters[1 << FLAC_MAX_PARTITION_ORDER];
+        ULONG ulMaxParameter = 0;
+        const LONG * r = m_pResidual;
+
+        for (ULONG p = 0; p < ulPartitions; p++)
+        {
+            ULONG ulCount = (p == 0) ? ulPartitionFrames - ulOrder : ulPartitionFrames;
+            ULONGLONG ullSum = 0;
+
+            for (ULONG i = 0; i < ulCount; i++)
+            {
+                ullSum += ZigZag(r[i]);
+            }
+            r += ulCount;
+
+            RiceCost(ullSum, ulCount, &ulParameters[p]);
+            if (ulParameters[p] > ulMaxParameter)
+            {
+                ulMaxParameter = ulParameters[p];
+            }
+        }
+
+        // RICE for parameters up to 14, RICE2 (5-bit parameters) above.
+        ULONG ulMethod = (ulMaxParameter > 14) ? 1 : 0;
+
+        PutBits(ulMethod, 2);
+        PutBits(ulPartitionOrder, 4);
+
+        r = m_pResidual;
+        for (ULONG p = 0; p < ulPartitions; p++)
+        {
+            ULONG ulCount = (p == 0) ? ulPartitionFrames - ulOrder : ulPartitionFrames;
+            ULONG k = ulParameters[p];
+
+            PutBits(k, 4 + ulMethod);
+
+            for (ULONG i = 0; i < ulCount; i++)
+            {
+                ULONG u = ZigZag(r[i]);
+                ULONG q = u >> k;
+
+                if (q + k < 32)
+                {
+                    // Quotient zeros, stop bit and remainder in one go.
+                    PutBits((1UL << k) | (u & ((1UL << k) - 1)), q + k + 1);
+                }
+                else
+                {
+                    PutZeros(q);
+                    PutBits(1, 1);
+                    PutBits(u & ((1UL << k) - 1), k);
+                }
+            }
+            r += ulCount;
+        }
+    }
+
+    //=========================================================================
+    // Bit writer and checksums
+    //=========================================================================
+    VOID BitWriterStart
+    (
+        _In_ PBYTE      pOut
+    )
+    {
+        m_pBitOut = pOut;
+        m_ullBitAccum = 0;
+        m_ulBitCount = 0;
+    }
+
+    VOID PutBits
+    (
+        _In_ ULONG      ulValue,
+        _In_ ULONG      ulBits
+    )
+    {
+        // At most 7 bits are pending, so 32 more always fit.
+        m_ullBitAccum = (m_ullBitAccum << ulBits) | (ulValue & ((1ULL << ulBits) - 1));
+        m_ulBitCount += ulBits;
+
+        while (m_ulBitCount >= 8)
+        {
+            m_ulBitCount -= 8;
+            *m_pBitOut++ = (BYTE)(m_ullBitAccum >> m_ulBitCount);
+        }
+    }
+
+    VOID PutZeros
+    (
+        _In_ ULONG      ulCount
+    )
+    {
+        while (ulCount >= 32)
+        {
+            PutBits(0, 32);
+            ulCount -= 32;
+        }
+        PutBits(0, ulCount);
+    }
+
+    VOID BitWriterAlign()
+    {
+        if (m_ulBitCount > 0)
+        {
+            PutBits(0, 8 - m_ulBitCount);
+        }
+    }
+
+    static BYTE Crc8
+    (
+        _In_reads_bytes_(cbData) const BYTE *   pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG ulCrc = 0;
+
+        for (ULONG i = 0; i < cbData; i++)
+        {
+            ulCrc ^= pData[i];
+            for (ULONG j = 0; j < 8; j++)
+            {
+                ulCrc = (ulCrc & 0x80) ? ((ulCrc << 1) ^ 0x07) : (ulCrc << 1);
+            }
+            ulCrc &= 0xFF;
+        }
+
+        return (BYTE)ulCrc;
+    }
+
+    USHORT Crc16
+    (
+        _In_reads_bytes_(cbData) const BYTE *   pData,
+        _In_ ULONG                              cbData
+    ) const
+    {
+        ULONG ulCrc = 0;
+
+        for (ULONG i = 0; i < cbData; i++)
+        {
+            ulCrc = ((ulCrc << 8) ^ m_Crc16Table[((ulCrc >> 8) ^ pData[i]) & 0xFF]) & 0xFFFF;
+        }
+
+        return (USHORT)ulCrc;
+    }
+};
+
+typedef CFlacEncoder *PCFlacEncoder;
+
+#endif // _VIRTUALAUDIODRIVER_FLACENCODER_H_
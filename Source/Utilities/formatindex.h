@@ -0,0 +1,607 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    formatindex.h
+
+Abstract:
+
+    Perfect hash over a pin's supported device formats, so a format probe
+    costs one lookup instead of a walk of the pin's format table.
+
+    - Table entries with the same key form a group; a lookup returns the
+      group's entries in table order and the caller does its full check
+      on those only, so the index never changes what is accepted.
+    - The groups are placed by hash and displace: keys hash to buckets of
+      about two, and each bucket, biggest first, gets the first
+      displacement that puts all its keys in free slots. Lookups take one
+      hash of the key, one mix with the bucket's displacement and one key
+      compare.
+    - Built once (Init), read only afterwards. Storage is the caller's
+      (GetStorageBytes). If no placement turns up the index stays
+      inactive and the caller scans.
+    - IsFormatMatch is the full check, GetFormatIndexKey the key of a
+      table entry or probe, and FindIndexedFormat the lookup through a
+      pin's pair of indexes. They take the kernel streaming format types,
+      which the includer brings.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_FORMATINDEX_H_
+#define _VIRTUALAUDIODRIVER_FORMATINDEX_H_
+
+#include "portable.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Most table entries one index takes; entry numbers are USHORTs.
+#define FORMAT_INDEX_MAX_ENTRIES        4096
+
+#define FORMAT_INDEX_EMPTY              0xFFFF
+
+// Displacements tried per bucket, and hash seeds tried per build.
+#define FORMAT_INDEX_MAX_DISPLACEMENT   0x1000
+#define FORMAT_INDEX_MAX_SEEDS          8
+
+//
+// What a format probe is matched on. The caller fills every field,
+// usReserved included, with the same rules for table entries and probes;
+// fields it does not match on are zero.
+//
+typedef struct _FORMAT_INDEX_KEY
+{
+    ULONG       ulSamplesPerSec;
+    USHORT      usBitsPerSample;
+    USHORT      usValidBitsPerSample;
+    USHORT      usChannels;
+    USHORT      usReserved;
+    ULONG       ulChannelMask;
+    ULONG       SubFormat[4];           // GUID, as stored
+} FORMAT_INDEX_KEY;
+typedef FORMAT_INDEX_KEY *PFORMAT_INDEX_KEY;
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CFormatIndex
+//
+//   Zeroed memory is a valid, inactive index.
+//
+class CFormatIndex
+{
+protected:
+    struct GROUP
+    {
+        FORMAT_INDEX_KEY        Key;
+        USHORT                  usFirst;            // into m_pusEntries
+        USHORT                  usCount;
+    };
+
+    GROUP *                     m_pGroups;
+    USHORT *                    m_pusEntries;       // Table entries by group
+    USHORT *                    m_pusSlots;         // Group per slot
+    USHORT *                    m_pusDisplacements; // Per bucket
+    ULONG                       m_ulSlotMask;
+    ULONG                       m_ulBuckets;
+    ULONG                       m_ulSeed;
+    BOOL                        m_bActive;
+
+public:
+    //
+    // Bytes Init needs for ulEntries table entries.
+    //
+    static ULONG GetStorageBytes
+    (
+        _In_ ULONG      ulEntries
+    )
+    {
+        ULONG ulSlots = GetSlotCount(ulEntries);
+        ULONG ulBuckets = GetBucketCount(ulEntries);
+
+        if (ulEntries == 0 || ulEntries > FORMAT_INDEX_MAX_ENTRIES)
+        {
+            return 0;
+        }
+
+        return ulEntries * sizeof(GROUP) +
+               Align(ulEntries * sizeof(USHORT)) +
+               Align(ulSlots * sizeof(USHORT)) +
+               Align(ulBuckets * sizeof(USHORT)) +
+               // Build scratch: bucket lists and bucket order.
+               Align(ulEntries * sizeof(USHORT)) +
+               Align(ulBuckets * sizeof(USHORT)) +
+               Align(ulBuckets * sizeof(USHORT));
+    }
+
+    //
+    // Indexes the ulEntries keys in pKeys, one per table entry. Returns
+    // FALSE, leaving the index inactive, when the storage is short or no
+    // placement was found.
+    //
+    BOOL Init
+    (
+        _In_reads_(ulEntries) const FORMAT_INDEX_KEY *  pKeys,
+        _In_ ULONG                                      ulEntries,
+        _Out_writes_bytes_(cbStorage) PVOID             pStorage,
+        _In_ ULONG                                      cbStorage
+    )
+    {
+        PBYTE       pbStorage = (PBYTE)pStorage;
+        ULONG       ulGroups = 0;
+        USHORT *    pusNext;
+        USHORT *    pusHeads;
+        USHORT *    pusOrder;
+
+        m_bActive = FALSE;
+
+        if (pKeys == NULL || pStorage == NULL || ulEntries == 0 ||
+            cbStorage < GetStorageBytes(ulEntries))
+        {
+            return FALSE;
+        }
+
+        m_ulSlotMask = GetSlotCount(ulEntries) - 1;
+        m_ulBuckets = GetBucketCount(ulEntries);
+
+        m_pGroups = (GROUP *)pbStorage;
+        pbStorage += ulEntries * sizeof(GROUP);
+        m_pusEntries = (USHORT *)pbStorage;
+        pbStorage += Align(ulEntries * sizeof(USHORT));
+        m_pusSlots = (USHORT *)pbStorage;
+        pbStorage += Align((m_ulSlotMask + 1) * sizeof(USHORT));
+        m_pusDisplacements = (USHORT *)pbStorage;
+        pbStorage += Align(m_ulBuckets * sizeof(USHORT));
+        pusNext = (USHORT *)pbStorage;
+        pbStorage += Align(ulEntries * sizeof(USHORT));
+        pusHeads = (USHORT *)pbStorage;
+        pbStorage += Align(m_ulBuckets * sizeof(USHORT));
+        pusOrder = (USHORT *)pbStorage;
+
+        //
+        // Group equal keys, in table order. m_pusEntries holds each
+        // entry's group until the groups are laid out.
+        //
+        for (ULONG i = 0; i < ulEntries; i++)
+        {
+            ULONG g;
+
+            for (g = 0; g < ulGroups && !KeysEqual(&m_pGroups[g].Key, &pKeys[i]); g++)
+            {
+            }
+
+            if (g == ulGroups)
+            {
+                m_pGroups[g].Key = pKeys[i];
+                m_pGroups[g].usCount = 0;
+                ulGroups++;
+            }
+
+            m_pGroups[g].usCount++;
+            m_pusEntries[i] = (USHORT)g;
+        }
+
+        for (ULONG g = 0, ulFirst = 0; g < ulGroups; g++)
+        {
+            m_pGroups[g].usFirst = (USHORT)ulFirst;
+            ulFirst += m_pGroups[g].usCount;
+            m_pGroups[g].usCount = 0;
+        }
+
+        // Reuse the build scratch to hold the groups while placing them.
+        for (ULONG i = 0; i < ulEntries; i++)
+        {
+            pusNext[i] = m_pusEntries[i];
+        }
+        for (ULONG i = 0; i < ulEntries; i++)
+        {
+            GROUP * pGroup = &m_pGroups[pusNext[i]];
+
+            m_pusEntries[pGroup->usFirst + pGroup->usCount++] = (USHORT)i;
+        }
+
+        for (m_ulSeed = 0; m_ulSeed < FORMAT_INDEX_MAX_SEEDS; m_ulSeed++)
+        {
+            if (Place(ulGroups, pusNext, pusHeads, pusOrder))
+            {
+                m_bActive = TRUE;
+                break;
+            }
+        }
+
+        return m_bActive;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_bActive;
+    }
+
+    //
+    // The table entries whose key is pKey, in table order, and how many
+    // there are; 0 when none.
+    //
+    ULONG Find
+    (
+        _In_ const FORMAT_INDEX_KEY *   pKey,
+        _Out_ const USHORT **           ppusEntries
+    ) const
+    {
+        ULONG   ulHash;
+        ULONG   ulGroup;
+
+        *ppusEntries = NULL;
+        if (!m_bActive)
+        {
+            return 0;
+        }
+
+        ulHash = Hash(pKey, m_ulSeed);
+        ulGroup = m_pusSlots[GetSlot(ulHash, m_pusDisplacements[GetBucket(ulHash)])];
+        if (ulGroup == FORMAT_INDEX_EMPTY || !KeysEqual(&m_pGroups[ulGroup].Key, pKey))
+        {
+            return 0;
+        }
+
+        *ppusEntries = &m_pusEntries[m_pGroups[ulGroup].usFirst];
+
+        return m_pGroups[ulGroup].usCount;
+    }
+
+private:
+    static ULONG Align(_In_ ULONG cbSize)
+    {
+        return (cbSize + sizeof(ULONG) - 1) & ~(ULONG)(sizeof(ULONG) - 1);
+    }
+
+    //
+    // A power of two, at least twice the entries.
+    //
+    static ULONG GetSlotCount(_In_ ULONG ulEntries)
+    {
+        ULONG ulSlots = 2;
+
+        while (ulSlots < ulEntries * 2)
+        {
+            ulSlots <<= 1;
+        }
+
+        return ulSlots;
+    }
+
+    static ULONG GetBucketCount(_In_ ULONG ulEntries)
+    {
+        return (ulEntries + 1) / 2;
+    }
+
+    static ULONG Mix(_In_ ULONG ulValue)
+    {
+        ulValue ^= ulValue >> 16;
+        ulValue *= 0x85ebca6bu;
+        ulValue ^= ulValue >> 13;
+        ulValue *= 0xc2b2ae35u;
+        ulValue ^= ulValue >> 16;
+
+        return ulValue;
+    }
+
+    static ULONG Hash
+    (
+        _In_ const FORMAT_INDEX_KEY *   pKey,
+        _In_ ULONG                      ulSeed
+    )
+    {
+        ULONG ulHash = 0x9e3779b9u * (ulSeed + 1);
+
+        ulHash = Mix(ulHash ^ pKey->ulSamplesPerSec);
+        ulHash = Mix(ulHash ^ (pKey->usBitsPerSample | ((ULONG)pKey->usValidBitsPerSample << 16)));
+        ulHash = Mix(ulHash ^ (pKey->usChannels | ((ULONG)pKey->usReserved << 16)));
+        ulHash = Mix(ulHash ^ pKey->ulChannelMask);
+        for (ULONG i = 0; i < 4; i++)
+        {
+            ulHash = Mix(ulHash ^ pKey->SubFormat[i]);
+        }
+
+        return ulHash;
+    }
+
+    ULONG GetBucket(_In_ ULONG ulHash) const
+    {
+        return (ULONG)(((ULONGLONG)ulHash * m_ulBuckets) >> 32);
+    }
+
+    ULONG GetSlot(_In_ ULONG ulHash, _In_ ULONG ulDisplacement) const
+    {
+        return Mix(ulHash + ulDisplacement * 0x9e3779b9u) & m_ulSlotMask;
+    }
+
+    static BOOL KeysEqual
+    (
+        _In_ const FORMAT_INDEX_KEY *   pA,
+        _In_ const FORMAT_INDEX_KEY *   pB
+    )
+    {
+        return pA->ulSamplesPerSec == pB->ulSamplesPerSec &&
+               pA->usBitsPerSample == pB->usBitsPerSample &&
+               pA->usValidBitsPerSample == pB->usValidBitsPerSample &&
+               pA->usChannels == pB->usChannels &&
+               pA->usReserved == pB->usReserved &&
+               pA->ulChannelMask == pB->ulChannelMask &&
+               pA->SubFormat[0] == pB->SubFormat[0] &&
+               pA->SubFormat[1] == pB->SubFormat[1] &&
+               pA->SubFormat[2] == pB->SubFormat[2] &&
+               pA->SubFormat[3] == pB->SubFormat[3];
+    }
+
+    //
+    // One placement attempt with m_ulSeed: bucket the groups, then give
+    // each bucket, biggest first, the first displacement that lands its
+    // groups on free, distinct slots.
+    //
+    BOOL Place
+    (
+        _In_ ULONG      ulGroups,
+        _Out_writes_(ulGroups) USHORT * pusNext,
+        _Out_writes_(m_ulBuckets) USHORT * pusHeads,
+        _Out_writes_(m_ulBuckets) USHORT * pusOrder
+    )
+    {
+        ULONG ulOrdered = 0;
+        ULONG ulLargest = 0;
+
+        for (ULONG s = 0; s <= m_ulSlotMask; s++)
+        {
+            m_pusSlots[s] = FORMAT_INDEX_EMPTY;
+        }
+        for (ULONG b = 0; b < m_ulBuckets; b++)
+        {
+            pusHeads[b] = FORMAT_INDEX_EMPTY;
+            m_pusDisplacements[b] = 0;
+        }
+
+        for (ULONG g = 0; g < ulGroups; g++)
+        {
+            ULONG b = GetBucket(Hash(&m_pGroups[g].Key, m_ulSeed));
+
+            pusNext[g] = pusHeads[b];
+            pusHeads[b] = (USHORT)g;
+        }
+
+        //
+        // Order the non-empty buckets by size, largest first. Most hold
+        // one to three groups, so a pass per size is cheap.
+        //
+        for (ULONG b = 0; b < m_ulBuckets; b++)
+        {
+            ULONG ulSize = BucketSize(pusHeads[b], pusNext);
+
+            if (ulSize > ulLargest)
+            {
+                ulLargest = ulSize;
+            }
+        }
+        for (ULONG ulSize = ulLargest; ulSize > 0; ulSize--)
+        {
+            for (ULONG b = 0; b < m_ulBuckets; b++)
+            {
+                if (BucketSize(pusHeads[b], pusNext) == ulSize)
+                {
+                    pusOrder[ulOrdered++] = (USHORT)b;
+                }
+            }
+        }
+
+        for (ULONG i = 0; i < ulOrdered; i++)
+        {
+            ULONG b = pusOrder[i];
+            ULONG d;
+
+            for (d = 0; d < FORMAT_INDEX_MAX_DISPLACEMENT; d++)
+            {
+                if (TryDisplacement(pusHeads[b], pusNext, d))
+                {
+                    break;
+                }
+            }
+
+            if (d == FORMAT_INDEX_MAX_DISPLACEMENT)
+            {
+                return FALSE;
+            }
+
+            m_pusDisplacements[b] = (USHORT)d;
+        }
+
+        return TRUE;
+    }
+
+    static ULONG BucketSize
+    (
+        _In_ USHORT                     usGroup,
+        _In_ const USHORT *             pusNext
+    )
+    {
+        ULONG ulSize = 0;
+
+        for (; usGroup != FORMAT_INDEX_EMPTY; usGroup = pusNext[usGroup])
+        {
+            ulSize++;
+        }
+
+        return ulSize;
+    }
+
+    //
+    // Claims the slots for the bucket starting at usHead with displacement
+    // ulDisplacement if they are all free; otherwise leaves the slots as
+    // they were.
+    //
+    BOOL TryDisplacement
+    (
+        _In_ USHORT                     usHead,
+        _In_ const USHORT *             pusNext,
+        _In_ ULONG                      ulDisplacement
+    )
+    {
+        USHORT usGroup;
+
+        for (usGroup = usHead; usGroup != FORMAT_INDEX_EMPTY; usGroup = pusNext[usGroup])
+        {
+            ULONG ulSlot = GetSlot(Hash(&m_pGroups[usGroup].Key, m_ulSeed), ulDisplacement);
+
+            if (m_pusSlots[ulSlot] != FORMAT_INDEX_EMPTY)
+            {
+                break;
+            }
+
+            m_pusSlots[ulSlot] = usGroup;
+        }
+
+        if (usGroup == FORMAT_INDEX_EMPTY)
+        {
+            return TRUE;
+        }
+
+        // Undo the groups placed before the clash.
+        for (USHORT usPlaced = usHead; usPlaced != usGroup; usPlaced = pusNext[usPlaced])
+        {
+            m_pusSlots[GetSlot(Hash(&m_pGroups[usPlaced].Key, m_ulSeed), ulDisplacement)] = FORMAT_INDEX_EMPTY;
+        }
+
+        return FALSE;
+    }
+};
+
+//=============================================================================
+// Functions
+//=============================================================================
+//
+// Whether pDataFormat is the pin's device format pPinFormat. A probe too
+// short for the wave format it names is not.
+//
+inline BOOL IsFormatMatch
+(
+    _In_ const KSDATAFORMAT_WAVEFORMATEXTENSIBLE *  pPinFormat,
+    _In_ const KSDATAFORMAT *                       pDataFormat
+)
+{
+    // KSDATAFORMAT VALIDATION
+    if (!IsEqualGUIDAligned(pPinFormat->DataFormat.MajorFormat, pDataFormat->MajorFormat)) { return FALSE; }
+    if (!IsEqualGUIDAligned(pPinFormat->DataFormat.SubFormat, pDataFormat->SubFormat)) { return FALSE; }
+    if (!IsEqualGUIDAligned(pPinFormat->DataFormat.Specifier, pDataFormat->Specifier)) { return FALSE; }
+    if (pPinFormat->DataFormat.FormatSize < sizeof(KSDATAFORMAT_WAVEFORMATEX)) { return FALSE; }
+    if (pDataFormat->FormatSize < sizeof(KSDATAFORMAT_WAVEFORMATEX)) { return FALSE; }
+
+    // WAVEFORMATEX VALIDATION
+    const WAVEFORMATEX * pWaveFormat = reinterpret_cast<const WAVEFORMATEX *>(pDataFormat + 1);
+
+    if (pWaveFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE)
+    {
+        if (pWaveFormat->wFormatTag != EXTRACT_WAVEFORMATEX_ID(&(pPinFormat->WaveFormatExt.SubFormat))) { return FALSE; }
+    }
+    if (pWaveFormat->nChannels  != pPinFormat->WaveFormatExt.Format.nChannels) { return FALSE; }
+    if (pWaveFormat->nSamplesPerSec != pPinFormat->WaveFormatExt.Format.nSamplesPerSec) { return FALSE; }
+    if (pWaveFormat->nBlockAlign != pPinFormat->WaveFormatExt.Format.nBlockAlign) { return FALSE; }
+    if (pWaveFormat->wBitsPerSample != pPinFormat->WaveFormatExt.Format.wBitsPerSample) { return FALSE; }
+    if (pWaveFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE)
+    {
+        return TRUE;
+    }
+
+    // WAVEFORMATEXTENSIBLE VALIDATION
+    if (pDataFormat->FormatSize < sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE)) { return FALSE; }
+    if (pWaveFormat->cbSize < sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) { return FALSE; }
+
+    const WAVEFORMATEXTENSIBLE * pWaveFormatExt = reinterpret_cast<const WAVEFORMATEXTENSIBLE *>(pWaveFormat);
+    if (pWaveFormatExt->Samples.wValidBitsPerSample != pPinFormat->WaveFormatExt.Samples.wValidBitsPerSample) { return FALSE; }
+    if (pWaveFormatExt->dwChannelMask != pPinFormat->WaveFormatExt.dwChannelMask) { return FALSE; }
+    if (!IsEqualGUIDAligned(pWaveFormatExt->SubFormat, pPinFormat->WaveFormatExt.SubFormat)) { return FALSE; }
+
+    return TRUE;
+}
+
+//
+// The format index key of pWaveFormat, matched as IsFormatMatch does for
+// a probe with tag usFormatTag: for a device format, WAVE_FORMAT_EXTENSIBLE
+// or the tag its subformat stands for. WAVE_FORMAT_EXTENSIBLE keys take the
+// valid bits, mask and subformat, and pWaveFormat must then be a
+// WAVEFORMATEXTENSIBLE; other tags go in place of the subformat. The block
+// alignment is left to IsFormatMatch.
+//
+inline VOID GetFormatIndexKey
+(
+    _In_ const WAVEFORMATEX *   pWaveFormat,
+    _In_ USHORT                 usFormatTag,
+    _Out_ PFORMAT_INDEX_KEY     pKey
+)
+{
+    RtlZeroMemory(pKey, sizeof(*pKey));
+
+    pKey->ulSamplesPerSec = pWaveFormat->nSamplesPerSec;
+    pKey->usBitsPerSample = pWaveFormat->wBitsPerSample;
+    pKey->usChannels      = pWaveFormat->nChannels;
+
+    if (usFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    {
+        const WAVEFORMATEXTENSIBLE * pWaveFormatExt = reinterpret_cast<const WAVEFORMATEXTENSIBLE *>(pWaveFormat);
+
+        pKey->usValidBitsPerSample = pWaveFormatExt->Samples.wValidBitsPerSample;
+        pKey->ulChannelMask        = pWaveFormatExt->dwChannelMask;
+        RtlCopyMemory(pKey->SubFormat, &pWaveFormatExt->SubFormat, sizeof(pKey->SubFormat));
+    }
+    else
+    {
+        pKey->SubFormat[0] = usFormatTag;
+    }
+}
+
+//
+// Whether pDataFormat is one of a pin's device formats pPinFormats, found
+// through the pin's two active indexes: pIndexes[0] over the entries keyed
+// with their subformat's tag, for WAVEFORMATEX probes, and pIndexes[1]
+// keyed with WAVE_FORMAT_EXTENSIBLE. Agrees with IsFormatMatch on every
+// entry in turn.
+//
+inline BOOL FindIndexedFormat
+(
+    _In_reads_(2) const CFormatIndex *                  pIndexes,
+    _In_ const KSDATAFORMAT_WAVEFORMATEXTENSIBLE *      pPinFormats,
+    _In_ const KSDATAFORMAT *                           pDataFormat
+)
+{
+    const WAVEFORMATEX *    pWaveFormat = reinterpret_cast<const WAVEFORMATEX *>(pDataFormat + 1);
+    BOOL                    bExtensible;
+    FORMAT_INDEX_KEY        key;
+    const USHORT *          pusEntries;
+    ULONG                   cEntries;
+
+    if (pDataFormat->FormatSize < sizeof(KSDATAFORMAT_WAVEFORMATEX))
+    {
+        return FALSE;
+    }
+
+    bExtensible = pWaveFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE;
+    if (bExtensible &&
+        (pDataFormat->FormatSize < sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE) ||
+         pWaveFormat->cbSize < sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)))
+    {
+        return FALSE;
+    }
+
+    GetFormatIndexKey(pWaveFormat, pWaveFormat->wFormatTag, &key);
+    cEntries = pIndexes[bExtensible ? 1 : 0].Find(&key, &pusEntries);
+
+    for (ULONG i = 0; i < cEntries; i++)
+    {
+        if (IsFormatMatch(&pPinFormats[pusEntries[i]], pDataFormat))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+#endif // _VIRTUALAUDIODRIVER_FORMATINDEX_H_
@@ -0,0 +1,242 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    frameclock.h
+
+Abstract:
+
+    Integer frame clock for the simulated DMA engine. Converts running time
+    in 100ns units (hns) to whole frames with exact 64-bit rational
+    arithmetic, so the position never drifts from the wall clock no matter
+    how often or how irregularly it is sampled.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_FRAMECLOCK_H_
+#define _VIRTUALAUDIODRIVER_FRAMECLOCK_H_
+
+#include "portable.h"
+
+#define FRAMECLOCK_HNS_PER_SECOND   10000000ULL
+
+///////////////////////////////////////////////////////////////////////////////
+// CFrameClock
+//
+//   Running time is the sum of all RUN segments: m_hnsAccumulated holds the
+//   length of the finished ones and m_hnsRunStart the start of the current
+//   one; m_hnsPausedAt is the end of the last one while paused. The frame
+//   count is always floor(runningTime * rate / 10^7), computed from the
+//   total rather than from deltas, so no remainder is ever carried.
+//
+class CFrameClock
+{
+protected:
+    ULONG                       m_ulFramesPerSecond;
+    BOOL                        m_bRunning;
+    ULONGLONG                   m_hnsRunStart;
+    ULONGLONG                   m_hnsPausedAt;
+    ULONGLONG                   m_hnsAccumulated;
+    ULONGLONG                   m_ullFramesReported;
+
+public:
+    CFrameClock() :
+        m_ulFramesPerSecond(0),
+        m_bRunning(FALSE),
+        m_hnsRunStart(0),
+        m_hnsPausedAt(0),
+        m_hnsAccumulated(0),
+        m_ullFramesReported(0)
+    {
+    }
+
+    //
+    // Whole frames completed in hnsTime. Splitting at whole seconds keeps
+    // every intermediate product below 2^64 for any realistic rate.
+    //
+    static ULONGLONG FramesFromHns
+    (
+        _In_ ULONGLONG  hnsTime,
+        _In_ ULONG      ulFramesPerSecond
+    )
+    {
+        ULONGLONG seconds = hnsTime / FRAMECLOCK_HNS_PER_SECOND;
+        ULONGLONG hnsRemainder = hnsTime % FRAMECLOCK_HNS_PER_SECOND;
+
+        return seconds * ulFramesPerSecond +
+               (hnsRemainder * ulFramesPerSecond) / FRAMECLOCK_HNS_PER_SECOND;
+    }
+
+    //
+    // Earliest running time at which ullFrames frames are complete, i.e. the
+    // inverse of FramesFromHns rounded up.
+    //
+    static ULONGLONG HnsFromFrames
+    (
+        _In_ ULONGLONG  ullFrames,
+        _In_ ULONG      ulFramesPerSecond
+    )
+    {
+        ULONGLONG seconds = ullFrames / ulFramesPerSecond;
+        ULONGLONG framesRemainder = ullFrames % ulFramesPerSecond;
+
+        return seconds * FRAMECLOCK_HNS_PER_SECOND +
+               (framesRemainder * FRAMECLOCK_HNS_PER_SECOND + ulFramesPerSecond - 1) / ulFramesPerSecond;
+    }
+
+    VOID Init
+    (
+        _In_ ULONG      ulFramesPerSecond
+    )
+    {
+        m_ulFramesPerSecond = ulFramesPerSecond;
+        Reset();
+    }
+
+    //
+    // Back to frame zero (KSSTATE_STOP).
+    //
+    VOID Reset()
+    {
+        m_bRunning = FALSE;
+        m_hnsRunStart = 0;
+        m_hnsPausedAt = 0;
+        m_hnsAccumulated = 0;
+        m_ullFramesReported = 0;
+    }
+
+    //
+    // Begins a RUN segment at hnsNow. No-op if already running.
+    //
+    VOID Start
+    (
+        _In_ ULONGLONG  hnsNow
+    )
+    {
+        if (!m_bRunning)
+        {
+            m_hnsRunStart = hnsNow;
+            m_bRunning = TRUE;
+        }
+    }
+
+    //
+    // Ends the RUN segment at hnsNow; the running time stops advancing.
+    //
+    VOID Pause
+    (
+        _In_ ULONGLONG  hnsNow
+    )
+    {
+        if (m_bRunning)
+        {
+            m_hnsAccumulated = GetRunningTime(hnsNow);
+            m_hnsPausedAt = hnsNow < m_hnsRunStart ? m_hnsRunStart : hnsNow;
+            m_bRunning = FALSE;
+        }
+    }
+
+    BOOL IsRunning() const
+    {
+        return m_bRunning;
+    }
+
+    ULONG GetFramesPerSecond() const
+    {
+        return m_ulFramesPerSecond;
+    }
+
+    ULONGLONG GetRunningTime
+    (
+        _In_ ULONGLONG  hnsNow
+    ) const
+    {
+        if (!m_bRunning || hnsNow < m_hnsRunStart)
+        {
+            return m_hnsAccumulated;
+        }
+
+        return m_hnsAccumulated + (hnsNow - m_hnsRunStart);
+    }
+
+    //
+    // Total whole frames elapsed at hnsNow. Does not change the clock.
+    //
+    ULONGLONG GetFrames
+    (
+        _In_ ULONGLONG  hnsNow
+    ) const
+    {
+        if (m_ulFramesPerSecond == 0)
+        {
+            return 0;
+        }
+
+        return FramesFromHns(GetRunningTime(hnsNow), m_ulFramesPerSecond);
+    }
+
+    //
+    // Frames handed out by Advance so far.
+    //
+    ULONGLONG GetFramesReported() const
+    {
+        return m_ullFramesReported;
+    }
+
+    //
+    // Returns the whole frames elapsed since the previous call, at most
+    // ullMaxFrames. Frames held back by the limit are returned by later
+    // calls, so the reported total always converges on GetFrames.
+    //
+    ULONGLONG Advance
+    (
+        _In_ ULONGLONG  hnsNow,
+        _In_ ULONGLONG  ullMaxFrames
+    )
+    {
+        ULONGLONG ullFrames = GetFrames(hnsNow);
+        ULONGLONG ullDelta = 0;
+
+        if (ullFrames > m_ullFramesReported)
+        {
+            ullDelta = ullFrames - m_ullFramesReported;
+            if (ullDelta > ullMaxFrames)
+            {
+                ullDelta = ullMaxFrames;
+            }
+            m_ullFramesReported += ullDelta;
+        }
+
+        return ullDelta;
+    }
+
+    //
+    // Timestamp, in the same hns domain as hnsNow, at which frame ullFrame
+    // completed (or will complete) assuming the current RUN segment. Frames
+    // from an earlier segment extrapolate back from the current start.
+    // While paused the last segment stands in for the current one, so
+    // frames up to the pause keep their times and later frames are placed
+    // as if the clock had resumed right at the pause.
+    //
+    LONGLONG GetTimeOfFrame
+    (
+        _In_ ULONGLONG  ullFrame
+    ) const
+    {
+        // Where running time zero falls, seen from the current or last segment.
+        LONGLONG hnsOrigin = (LONGLONG)(m_bRunning ? m_hnsRunStart : m_hnsPausedAt) -
+                             (LONGLONG)m_hnsAccumulated;
+
+        if (m_ulFramesPerSecond == 0)
+        {
+            return hnsOrigin + (LONGLONG)m_hnsAccumulated;
+        }
+
+        return hnsOrigin + (LONGLONG)HnsFromFrames(ullFrame, m_ulFramesPerSecond);
+    }
+};
+
+typedef CFrameClock *PCFrameClock;
+
+#endif // _VIRTUALAUDIODRIVER_FRAMECLOCK_H_
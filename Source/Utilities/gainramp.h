@@ -0,0 +1,589 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    gainramp.h
+
+Abstract:
+
+    Per-channel volume and mute applied to stream audio.
+
+    - GainFromVolume maps a topology volume (1/65536 dB, -96 dB to 0 dB)
+      to a Q30 gain through a table built at compile time.
+    - GainScaler<Bits, Channels, Float> scales samples in place in one
+      stream format, at a constant gain or along a linear ramp, with the
+      container size and channel count fixed at compile time.
+    - CGainRamp moves each channel to a new gain over GAIN_RAMP_MS, so
+      volume changes and mutes do not click.
+
+    Unity gain leaves every format bit-exact. Float samples are scaled with
+    integer operations only, so no caller needs the floating point state
+    saved.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_GAINRAMP_H_
+#define _VIRTUALAUDIODRIVER_GAINRAMP_H_
+
+#include "portable.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Unity in the Q30 gain domain.
+#define GAIN_Q30_ONE                (1L << 30)
+
+// Largest channel count with a dedicated instance (7.1).
+#define GAIN_MAX_CHANNELS           8
+
+// Length of the ramp to a new gain.
+#define GAIN_RAMP_MS                10
+
+// The table has an entry every 0.5 dB (the topology volume stepping) from
+// 0 dB down to -96 dB, the volume range.
+#define GAIN_TABLE_STEP_SHIFT       15
+#define GAIN_TABLE_ENTRIES          193
+
+// Ramps run in Q30 with this many extra fraction bits.
+#define GAIN_RAMP_SHIFT             16
+
+//=============================================================================
+// dB to linear
+//=============================================================================
+
+//
+// e^x for x of a few units either side of 0. Only evaluated at compile
+// time: squares the series for e^(x / 1024) ten times.
+//
+constexpr double GainExp(double x)
+{
+    double y = x / 1024;
+    double term = 1;
+    double sum = 1;
+
+    for (int n = 1; n < 12; n++)
+    {
+        term *= y / n;
+        sum += term;
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        sum *= sum;
+    }
+
+    return sum;
+}
+
+struct GAIN_TABLE
+{
+    LONG        Gain[GAIN_TABLE_ENTRIES];
+
+    constexpr GAIN_TABLE() : Gain()
+    {
+        // 10^(-i * 0.5 / 20) in Q30.
+        for (ULONG i = 0; i < GAIN_TABLE_ENTRIES; i++)
+        {
+            Gain[i] = (LONG)(GainExp(-(double)i * 0.5 * 2.302585092994045684 / 20) * GAIN_Q30_ONE + 0.5);
+        }
+    }
+};
+
+constexpr GAIN_TABLE g_GainTable;
+
+//
+// Q30 gain of a volume in 1/65536 dB. Volumes between table entries are
+// interpolated; volumes outside -96 dB to 0 dB are clamped.
+//
+inline LONG GainFromVolume
+(
+    _In_ LONG           lVolume
+)
+{
+    if (lVolume >= 0)
+    {
+        return GAIN_Q30_ONE;
+    }
+
+    ULONG ulAttenuation = (ULONG)(-(LONGLONG)lVolume);
+    ULONG ulIndex = ulAttenuation >> GAIN_TABLE_STEP_SHIFT;
+
+    if (ulIndex >= GAIN_TABLE_ENTRIES - 1)
+    {
+        return g_GainTable.Gain[GAIN_TABLE_ENTRIES - 1];
+    }
+
+    LONGLONG llFraction = ulAttenuation & ((1UL << GAIN_TABLE_STEP_SHIFT) - 1);
+    LONG lLow = g_GainTable.Gain[ulIndex];
+    LONG lHigh = g_GainTable.Gain[ulIndex + 1];
+
+    return lLow + (LONG)(((lHigh - lLow) * llFraction) >> GAIN_TABLE_STEP_SHIFT);
+}
+
+//=============================================================================
+// Scaling kernels
+//=============================================================================
+
+//
+// A Q30 gain, also as a float mantissa (bit 23 set, 0 for a zero gain)
+// and exponent, so float samples can be scaled without floating point:
+// gain = ulMantissa / 2^23 * 2^lExponent.
+//
+typedef struct _GAIN_FACTOR
+{
+    LONG        lGain;
+    ULONG       ulMantissa;
+    LONG        lExponent;
+} GAIN_FACTOR;
+typedef GAIN_FACTOR *PGAIN_FACTOR;
+
+//
+// Scales ulFrames frames of pBuffer in place. Constant scalers take one
+// Q30 gain per channel. Ramp scalers take one gain per channel in Q30
+// with GAIN_RAMP_SHIFT extra bits, add the per-frame step after every
+// frame, and return the advanced gains.
+//
+typedef VOID GAIN_SCALE_ROUTINE
+(
+    _Inout_ PBYTE       pBuffer,
+    _In_ ULONG          ulFrames,
+    _In_ const LONG *   plGain
+);
+typedef GAIN_SCALE_ROUTINE *PFN_GAIN_SCALE;
+
+typedef VOID GAIN_RAMP_ROUTINE
+(
+    _Inout_ PBYTE           pBuffer,
+    _In_ ULONG              ulFrames,
+    _Inout_ LONGLONG *      pllGain,
+    _In_ const LONGLONG *   pllStep
+);
+typedef GAIN_RAMP_ROUTINE *PFN_GAIN_RAMP;
+
+typedef struct _GAIN_SCALER
+{
+    PFN_GAIN_SCALE      pfnScale;
+    PFN_GAIN_RAMP       pfnRamp;
+    ULONG               ulFrameBytes;
+} GAIN_SCALER;
+typedef GAIN_SCALER *PGAIN_SCALER;
+
+//
+// Integer samples are scaled and rounded to nearest. The gain is at most
+// unity, so nothing needs clamping.
+//
+inline LONG GainScaleInteger(_In_ LONG lSample, _In_ LONG lGain)
+{
+    return (LONG)(((LONGLONG)lSample * lGain + (1LL << 29)) >> 30);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GainSample
+//
+//   Prepare turns a Q30 gain into the factor Scale uses; Scale scales one
+//   sample in place.
+//
+template <ULONG Bits, BOOL Float>
+struct GainSample;
+
+struct GainSampleInteger
+{
+    static GAIN_FACTOR Prepare(_In_ LONG lGain)
+    {
+        GAIN_FACTOR factor = { lGain, 0, 0 };
+        return factor;
+    }
+};
+
+template <>
+struct GainSample<8, FALSE> : GainSampleInteger
+{
+    static VOID Scale(_Inout_ PBYTE p, _In_ const GAIN_FACTOR & factor)
+    {
+        // Unsigned, centered at 0x80.
+        p[0] = (BYTE)(GainScaleInteger((LONG)p[0] - 0x80, factor.lGain) + 0x80);
+    }
+};
+
+template <>
+struct GainSample<16, FALSE> : GainSampleInteger
+{
+    static VOID Scale(_Inout_ PBYTE p, _In_ const GAIN_FACTOR & factor)
+    {
+        LONG lValue = GainScaleInteger((SHORT)(p[0] | (p[1] << 8)), factor.lGain);
+        p[0] = (BYTE)lValue;
+        p[1] = (BYTE)(lValue >> 8);
+    }
+};
+
+template <>
+struct GainSample<24, FALSE> : GainSampleInteger
+{
+    static VOID Scale(_Inout_ PBYTE p, _In_ const GAIN_FACTOR & factor)
+    {
+        // Packed little-endian.
+        LONG lValue = (LONG)(((ULONG)p[0] << 8) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 24)) >> 8;
+        lValue = GainScaleInteger(lValue, factor.lGain);
+        p[0] = (BYTE)lValue;
+        p[1] = (BYTE)(lValue >> 8);
+        p[2] = (BYTE)(lValue >> 16);
+    }
+};
+
+template <>
+struct GainSample<32, FALSE> : GainSampleInteger
+{
+    static VOID Scale(_Inout_ PBYTE p, _In_ const GAIN_FACTOR & factor)
+    {
+        LONG lValue = (LONG)((ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24));
+        lValue = GainScaleInteger(lValue, factor.lGain);
+        p[0] = (BYTE)lValue;
+        p[1] = (BYTE)(lValue >> 8);
+        p[2] = (BYTE)(lValue >> 16);
+        p[3] = (BYTE)(lValue >> 24);
+    }
+};
+
+template <>
+struct GainSample<32, TRUE>
+{
+    static GAIN_FACTOR Prepare(_In_ LONG lGain)
+    {
+        GAIN_FACTOR factor = { lGain, 0, -256 };
+        ULONG ulGain = (ULONG)lGain;
+        LONG lLeading = 30;
+
+        if (ulGain == 0)
+        {
+            // The exponent is low enough that every product underflows to 0.
+            return factor;
+        }
+
+        // Position of the leading one, for gains up to 2^30.
+        if ((ulGain >> 15) == 0)                { ulGain <<= 16; lLeading -= 16; }
+        if ((ulGain >> 23) == 0)                { ulGain <<= 8;  lLeading -= 8; }
+        if ((ulGain >> 27) == 0)                { ulGain <<= 4;  lLeading -= 4; }
+        if ((ulGain >> 29) == 0)                { ulGain <<= 2;  lLeading -= 2; }
+        if ((ulGain >> 30) == 0)                { ulGain <<= 1;  lLeading -= 1; }
+
+        factor.ulMantissa = ulGain >> 7;
+        factor.lExponent = lLeading - 30;
+        return factor;
+    }
+
+    //
+    // IEEE single times the gain, truncated. Zeros, denormals (flushed to
+    // zero) and results below the normal range become signed zeros;
+    // infinities and NaNs pass through.
+    //
+    static VOID Scale(_Inout_ PBYTE p, _In_ const GAIN_FACTOR & factor)
+    {
+        ULONG ulBits = (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+        ULONG ulSign = ulBits & 0x80000000;
+        LONG lExponent = (LONG)((ulBits >> 23) & 0xFF);
+
+        // Both mantissas have bit 23 set, so the product is in [2^46, 2^48).
+        ULONGLONG ullProduct = (ULONGLONG)((ulBits & 0x7FFFFF) | 0x800000) * factor.ulMantissa;
+        ULONG ulHigh = (ULONG)(ullProduct >> 47);
+        ULONG ulMantissa = ulHigh ? (ULONG)(ullProduct >> 24) : (ULONG)(ullProduct >> 23);
+        LONG lResult = lExponent + factor.lExponent + (LONG)ulHigh;
+
+        ULONG ulValue = (lResult > 0 && lExponent != 0) ?
+                        (ulSign | ((ULONG)lResult << 23) | (ulMantissa & 0x7FFFFF)) :
+                        ulSign;
+        ulValue = (lExponent == 0xFF) ? ulBits : ulValue;
+
+        p[0] = (BYTE)ulValue;
+        p[1] = (BYTE)(ulValue >> 8);
+        p[2] = (BYTE)(ulValue >> 16);
+        p[3] = (BYTE)(ulValue >> 24);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// GainScaler
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct GainScaler
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG FrameBytes = SampleBytes * Channels;
+
+    static VOID Scale
+    (
+        _Inout_ PBYTE       pBuffer,
+        _In_ ULONG          ulFrames,
+        _In_ const LONG *   plGain
+    )
+    {
+        GAIN_FACTOR factor[Channels];
+
+        for (ULONG c = 0; c < Channels; c++)
+        {
+            factor[c] = GainSample<Bits, Float>::Prepare(plGain[c]);
+        }
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                GainSample<Bits, Float>::Scale(pBuffer + c * SampleBytes, factor[c]);
+            }
+            pBuffer += FrameBytes;
+        }
+    }
+
+    static VOID Ramp
+    (
+        _Inout_ PBYTE           pBuffer,
+        _In_ ULONG              ulFrames,
+        _Inout_ LONGLONG *      pllGain,
+        _In_ const LONGLONG *   pllStep
+    )
+    {
+        LONGLONG llGain[Channels];
+
+        for (ULONG c = 0; c < Channels; c++)
+        {
+            llGain[c] = pllGain[c];
+        }
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                GAIN_FACTOR factor = GainSample<Bits, Float>::Prepare((LONG)(llGain[c] >> GAIN_RAMP_SHIFT));
+
+                GainSample<Bits, Float>::Scale(pBuffer + c * SampleBytes, factor);
+                llGain[c] += pllStep[c];
+            }
+            pBuffer += FrameBytes;
+        }
+
+        for (ULONG c = 0; c < Channels; c++)
+        {
+            pllGain[c] = llGain[c];
+        }
+    }
+};
+
+template <ULONG Bits, ULONG Channels, BOOL Float>
+VOID SetGainScaler
+(
+    _Out_ PGAIN_SCALER      pScaler
+)
+{
+    pScaler->pfnScale = GainScaler<Bits, Channels, Float>::Scale;
+    pScaler->pfnRamp = GainScaler<Bits, Channels, Float>::Ramp;
+    pScaler->ulFrameBytes = GainScaler<Bits, Channels, Float>::FrameBytes;
+}
+
+template <ULONG Bits, BOOL Float>
+BOOL SelectGainScaler
+(
+    _In_ ULONG              ulChannels,
+    _Out_ PGAIN_SCALER      pScaler
+)
+{
+    switch (ulChannels)
+    {
+        case 1: SetGainScaler<Bits, 1, Float>(pScaler); return TRUE;
+        case 2: SetGainScaler<Bits, 2, Float>(pScaler); return TRUE;
+        case 3: SetGainScaler<Bits, 3, Float>(pScaler); return TRUE;
+        case 4: SetGainScaler<Bits, 4, Float>(pScaler); return TRUE;
+        case 5: SetGainScaler<Bits, 5, Float>(pScaler); return TRUE;
+        case 6: SetGainScaler<Bits, 6, Float>(pScaler); return TRUE;
+        case 7: SetGainScaler<Bits, 7, Float>(pScaler); return TRUE;
+        case 8: SetGainScaler<Bits, 8, Float>(pScaler); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Picks the instance for a stream format: 8/16/24/32-bit PCM and 32-bit
+// float with 1 to GAIN_MAX_CHANNELS channels. Returns FALSE otherwise.
+//
+inline BOOL GetGainScaler
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat,
+    _Out_ PGAIN_SCALER      pScaler
+)
+{
+    RtlZeroMemory(pScaler, sizeof(*pScaler));
+
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectGainScaler<32, TRUE>(ulChannels, pScaler) : FALSE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectGainScaler<8, FALSE>(ulChannels, pScaler);
+        case 16: return SelectGainScaler<16, FALSE>(ulChannels, pScaler);
+        case 24: return SelectGainScaler<24, FALSE>(ulChannels, pScaler);
+        case 32: return SelectGainScaler<32, FALSE>(ulChannels, pScaler);
+    }
+
+    return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CGainRamp
+//
+//   Owned by one stream and only touched from its position update. A new
+//   set of gains starts a GAIN_RAMP_MS ramp from wherever the current one
+//   is; at unity with no ramp in progress Process leaves the audio alone,
+//   and callers can skip it entirely (IsUnity).
+//
+class CGainRamp
+{
+protected:
+    GAIN_SCALER                 m_Scaler;
+    ULONG                       m_ulChannels;
+    ULONG                       m_ulRampFrames;
+    ULONG                       m_ulRampRemaining;
+    BOOL                        m_bUnity;
+    LONG                        m_lTarget[GAIN_MAX_CHANNELS];
+    LONGLONG                    m_llGain[GAIN_MAX_CHANNELS];    // Q30 << GAIN_RAMP_SHIFT.
+    LONGLONG                    m_llStep[GAIN_MAX_CHANNELS];
+
+public:
+    CGainRamp() :
+        m_ulChannels(0),
+        m_ulRampFrames(0),
+        m_ulRampRemaining(0),
+        m_bUnity(TRUE)
+    {
+        RtlZeroMemory(&m_Scaler, sizeof(m_Scaler));
+        RtlZeroMemory(m_llStep, sizeof(m_llStep));
+
+        for (ULONG c = 0; c < GAIN_MAX_CHANNELS; c++)
+        {
+            m_lTarget[c] = GAIN_Q30_ONE;
+            m_llGain[c] = (LONGLONG)GAIN_Q30_ONE << GAIN_RAMP_SHIFT;
+        }
+    }
+
+    //
+    // Returns FALSE, and leaves the audio alone, for formats GetGainScaler
+    // does not cover.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulChannels,
+        _In_ BOOL       bFloat
+    )
+    {
+        if (!GetGainScaler(ulBitsPerSample, ulChannels, bFloat, &m_Scaler))
+        {
+            return FALSE;
+        }
+
+        m_ulChannels = ulChannels;
+        m_ulRampFrames = ulSampleRate / 1000 * GAIN_RAMP_MS;
+        if (m_ulRampFrames == 0)
+        {
+            m_ulRampFrames = 1;
+        }
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_Scaler.pfnScale != NULL;
+    }
+
+    BOOL IsUnity() const
+    {
+        return m_bUnity;
+    }
+
+    //
+    // Sets the Q30 gain of every channel. Gains that differ from the
+    // current targets start a new ramp.
+    //
+    VOID SetTargets
+    (
+        _In_reads_(GAIN_MAX_CHANNELS) const LONG *  plGain
+    )
+    {
+        BOOL bChanged = FALSE;
+
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            bChanged |= (plGain[c] != m_lTarget[c]);
+        }
+
+        if (!bChanged)
+        {
+            return;
+        }
+
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            LONGLONG llTarget = (LONGLONG)plGain[c] << GAIN_RAMP_SHIFT;
+
+            m_lTarget[c] = plGain[c];
+            m_llStep[c] = (llTarget - m_llGain[c]) / (LONGLONG)m_ulRampFrames;
+        }
+
+        m_ulRampRemaining = m_ulRampFrames;
+        m_bUnity = FALSE;
+    }
+
+    //
+    // Scales the whole frames in pData, which follow the frames of the
+    // previous call.
+    //
+    VOID Process
+    (
+        _Inout_updates_bytes_(cbData) PBYTE     pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG ulFrames = IsActive() ? cbData / m_Scaler.ulFrameBytes : 0;
+
+        if (m_bUnity || ulFrames == 0)
+        {
+            return;
+        }
+
+        if (m_ulRampRemaining > 0)
+        {
+            ULONG ulRamp = ulFrames < m_ulRampRemaining ? ulFrames : m_ulRampRemaining;
+
+            m_Scaler.pfnRamp(pData, ulRamp, m_llGain, m_llStep);
+            m_ulRampRemaining -= ulRamp;
+            pData += ulRamp * m_Scaler.ulFrameBytes;
+            ulFrames -= ulRamp;
+
+            if (m_ulRampRemaining > 0)
+            {
+                return;
+            }
+
+            // Land exactly on the targets; the steps are truncated.
+            m_bUnity = TRUE;
+            for (ULONG c = 0; c < m_ulChannels; c++)
+            {
+                m_llGain[c] = (LONGLONG)m_lTarget[c] << GAIN_RAMP_SHIFT;
+                m_bUnity &= (m_lTarget[c] == GAIN_Q30_ONE);
+            }
+        }
+
+        if (!m_bUnity && ulFrames > 0)
+        {
+            m_Scaler.pfnScale(pData, ulFrames, m_lTarget);
+        }
+    }
+};
+typedef CGainRamp *PCGainRamp;
+
+#endif // _VIRTUALAUDIODRIVER_GAINRAMP_H_
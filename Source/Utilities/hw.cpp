@@ -22,7 +22,9 @@ Abstract:
 //=============================================================================
 #pragma code_seg("PAGE")
 CVirtualAudioDriverHW::CVirtualAudioDriverHW()
-: m_ulMux(0),
+: m_pNodes(NULL),
+    m_ulNodes(0),
+    m_ulMux(0),
     m_bDevSpecific(FALSE),
     m_iDevSpecific(0),
     m_uiDevSpecific(0)
@@ -44,6 +46,41 @@ Return Value:
     
     MixerReset();
 } // VirtualAudioDriverHW
+
+//=============================================================================
+void
+CVirtualAudioDriverHW::AttachNodes
+(
+    _In_reads_(ulNodes) PMIXER_NODE_REGISTERS   pNodes,
+    _In_  ULONG                                 ulNodes
+)
+/*++
+
+Routine Description:
+
+  Binds the bank of mixer registers, MIXER_NODE numbered, and resets it.
+  The bank comes zeroed from the adapter's endpoint arena and outlives
+  this object.
+
+Arguments:
+
+  pNodes - the registers
+
+  ulNodes - how many there are
+
+Return Value:
+
+    void
+
+--*/
+{
+    PAGED_CODE();
+
+    m_pNodes = pNodes;
+    m_ulNodes = ulNodes;
+
+    MixerReset();
+} // AttachNodes
 #pragma code_seg()
 
 
@@ -214,11 +251,9 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(ulChannel);
-    
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes && ulChannel < MAX_TOPOLOGY_CHANNELS)
     {
-        return m_MuteControls[ulNode];
+        return m_pNodes[ulNode].Mute[ulChannel];
     }
 
     return 0;
@@ -269,11 +304,9 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(ulChannel);
-
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes && ulChannel < MAX_TOPOLOGY_CHANNELS)
     {
-        return m_VolumeControls[ulNode];
+        return m_pNodes[ulNode].Volume[ulChannel];
     }
 
     return 0;
@@ -304,15 +337,99 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(ulChannel);
+    PEAK_METER_LEVELS levels;
 
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes)
     {
-        return m_PeakMeterControls[ulNode];
+        m_pNodes[ulNode].PeakMeter.Read(&levels);
+
+        if (ulChannel < levels.ulChannels)
+        {
+            return levels.lPeak[ulChannel];
+        }
     }
 
     return 0;
-} // GetMixerVolume
+} // GetMixerPeakMeter
+
+//=============================================================================
+LONG
+CVirtualAudioDriverHW::GetMixerRmsMeter
+(   
+    _In_  ULONG                   ulNode,
+    _In_  ULONG                   ulChannel
+)
+/*++
+
+Routine Description:
+
+  Gets the RMS level metered alongside the peak meter.
+
+Arguments:
+
+  ulNode - topology node id
+
+  ulChannel - which channel are we reading?
+
+Return Value:
+
+  LONG - RMS level
+
+--*/
+{
+    PEAK_METER_LEVELS levels;
+
+    if (ulNode < m_ulNodes)
+    {
+        m_pNodes[ulNode].PeakMeter.Read(&levels);
+
+        if (ulChannel < levels.ulChannels)
+        {
+            return levels.lRms[ulChannel];
+        }
+    }
+
+    return 0;
+} // GetMixerRmsMeter
+
+//=============================================================================
+void
+CVirtualAudioDriverHW::SetMixerPeakMeter
+(
+    _In_  ULONG                   ulNode,
+    _In_  PPEAK_METER_LEVELS      pLevels
+)
+/*++
+
+Routine Description:
+
+  Publishes the levels metered by a stream. Called from the stream's
+  position update, at up to DISPATCH_LEVEL; readers never wait on it.
+
+Arguments:
+
+  ulNode - topology node id
+
+  pLevels - levels to publish
+
+Return Value:
+
+  void
+
+--*/
+{
+    if (ulNode < m_ulNodes)
+    {
+        // Streams on the same endpoint publish independently. Rather than
+        // wait, a stream that finds another one publishing drops this
+        // update; it publishes again on its next position update.
+        if (InterlockedCompareExchange(&m_pNodes[ulNode].PeakMeterPublishing, 1, 0) == 0)
+        {
+            m_pNodes[ulNode].PeakMeter.Publish(*pLevels);
+            InterlockedExchange(&m_pNodes[ulNode].PeakMeterPublishing, 0);
+        }
+    }
+} // SetMixerPeakMeter
 
 //=============================================================================
 #pragma code_seg("PAGE")
@@ -334,21 +451,24 @@ Return Value:
 {
     PAGED_CODE();
     
-    RtlFillMemory(m_VolumeControls, sizeof(LONG) * MAX_TOPOLOGY_NODES, 0xFF);
-    // Endpoints are not muted by default.
-    RtlZeroMemory(m_MuteControls, sizeof(BOOL) * MAX_TOPOLOGY_NODES);
-
-    for (ULONG i=0; i<MAX_TOPOLOGY_NODES; ++i)
+    for (ULONG i=0; i<m_ulNodes; ++i)
     {
-        m_PeakMeterControls[i] = PEAKMETER_SIGNED_MAXIMUM/2;
+        // Endpoints are not muted by default.
+        RtlZeroMemory(m_pNodes[i].Mute, sizeof(m_pNodes[i].Mute));
         // Initialize tone controls to neutral (0 = no boost/cut)
-        m_BassControls[i] = 0;
-        m_TrebleControls[i] = 0;
-        // Initialize audio effects to off (0 = no effect)
-        m_ReverbControls[i] = 0;
-        m_ChorusControls[i] = 0;
+        RtlZeroMemory(m_pNodes[i].Bass, sizeof(m_pNodes[i].Bass));
+        RtlZeroMemory(m_pNodes[i].Treble, sizeof(m_pNodes[i].Treble));
+        // Full volume, which leaves the audio untouched.
+        for (ULONG j=0; j<MAX_TOPOLOGY_CHANNELS; ++j)
+        {
+            m_pNodes[i].Volume[j] = VOLUME_SIGNED_MAXIMUM;
+        }
+        // Effects off; their levels are the wet mix, so 0 dB would be all
+        // effect.
+        m_pNodes[i].Reverb = VOLUME_SIGNED_MINIMUM;
+        m_pNodes[i].Chorus = VOLUME_SIGNED_MINIMUM;
         // Initialize AEC to disabled
-        m_AecEnabled[i] = FALSE;
+        m_pNodes[i].AecEnabled = FALSE;
     }
     
     // BUGBUG change this depending on the topology
@@ -384,11 +504,9 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(ulChannel);
-
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes && ulChannel < MAX_TOPOLOGY_CHANNELS)
     {
-        m_MuteControls[ulNode] = fMute;
+        m_pNodes[ulNode].Mute[ulChannel] = fMute;
     }
 } // SetMixerMute
 
@@ -445,18 +563,17 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(ulChannel);
-
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes && ulChannel < MAX_TOPOLOGY_CHANNELS)
     {
-        m_VolumeControls[ulNode] = lVolume;
+        m_pNodes[ulNode].Volume[ulChannel] = lVolume;
     }
 } // SetMixerVolume
 
 //=============================================================================
 // Tone Control (Bass/Treble)
 //=============================================================================
-#pragma code_seg("PAGE")
+// The stream's position update reads the settings.
+#pragma code_seg()
 LONG
 CVirtualAudioDriverHW::GetMixerBass
 (
@@ -464,51 +581,45 @@ CVirtualAudioDriverHW::GetMixerBass
     _In_  ULONG                   ulChannel
 )
 {
-    PAGED_CODE();
-    UNREFERENCED_PARAMETER(ulChannel);
-
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes && ulChannel < MAX_TOPOLOGY_CHANNELS)
     {
-        return m_BassControls[ulNode];
+        return m_pNodes[ulNode].Bass[ulChannel];
     }
 
     return 0;
 } // GetMixerBass
 
-void
-CVirtualAudioDriverHW::SetMixerBass
+LONG
+CVirtualAudioDriverHW::GetMixerTreble
 (
     _In_  ULONG                   ulNode,
-    _In_  ULONG                   ulChannel,
-    _In_  LONG                    lBass
+    _In_  ULONG                   ulChannel
 )
 {
-    PAGED_CODE();
-    UNREFERENCED_PARAMETER(ulChannel);
-
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes && ulChannel < MAX_TOPOLOGY_CHANNELS)
     {
-        m_BassControls[ulNode] = lBass;
+        return m_pNodes[ulNode].Treble[ulChannel];
     }
-} // SetMixerBass
 
-LONG
-CVirtualAudioDriverHW::GetMixerTreble
+    return 0;
+} // GetMixerTreble
+
+#pragma code_seg("PAGE")
+void
+CVirtualAudioDriverHW::SetMixerBass
 (
     _In_  ULONG                   ulNode,
-    _In_  ULONG                   ulChannel
+    _In_  ULONG                   ulChannel,
+    _In_  LONG                    lBass
 )
 {
     PAGED_CODE();
-    UNREFERENCED_PARAMETER(ulChannel);
 
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes && ulChannel < MAX_TOPOLOGY_CHANNELS)
     {
-        return m_TrebleControls[ulNode];
+        m_pNodes[ulNode].Bass[ulChannel] = lBass;
     }
-
-    return 0;
-} // GetMixerTreble
+} // SetMixerBass
 
 void
 CVirtualAudioDriverHW::SetMixerTreble
@@ -519,11 +630,10 @@ CVirtualAudioDriverHW::SetMixerTreble
 )
 {
     PAGED_CODE();
-    UNREFERENCED_PARAMETER(ulChannel);
 
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes && ulChannel < MAX_TOPOLOGY_CHANNELS)
     {
-        m_TrebleControls[ulNode] = lTreble;
+        m_pNodes[ulNode].Treble[ulChannel] = lTreble;
     }
 } // SetMixerTreble
 #pragma code_seg()
@@ -531,7 +641,8 @@ CVirtualAudioDriverHW::SetMixerTreble
 //=============================================================================
 // Audio Effects (Reverb/Chorus)
 //=============================================================================
-#pragma code_seg("PAGE")
+// The stream's position update reads the effect levels.
+#pragma code_seg()
 LONG
 CVirtualAudioDriverHW::GetMixerReverb
 (
@@ -539,51 +650,50 @@ CVirtualAudioDriverHW::GetMixerReverb
     _In_  ULONG                   ulChannel
 )
 {
-    PAGED_CODE();
     UNREFERENCED_PARAMETER(ulChannel);
 
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes)
     {
-        return m_ReverbControls[ulNode];
+        return m_pNodes[ulNode].Reverb;
     }
 
     return 0;
 } // GetMixerReverb
 
-void
-CVirtualAudioDriverHW::SetMixerReverb
+LONG
+CVirtualAudioDriverHW::GetMixerChorus
 (
     _In_  ULONG                   ulNode,
-    _In_  ULONG                   ulChannel,
-    _In_  LONG                    lReverb
+    _In_  ULONG                   ulChannel
 )
 {
-    PAGED_CODE();
     UNREFERENCED_PARAMETER(ulChannel);
 
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes)
     {
-        m_ReverbControls[ulNode] = lReverb;
+        return m_pNodes[ulNode].Chorus;
     }
-} // SetMixerReverb
 
-LONG
-CVirtualAudioDriverHW::GetMixerChorus
+    return 0;
+} // GetMixerChorus
+
+#pragma code_seg("PAGE")
+void
+CVirtualAudioDriverHW::SetMixerReverb
 (
     _In_  ULONG                   ulNode,
-    _In_  ULONG                   ulChannel
+    _In_  ULONG                   ulChannel,
+    _In_  LONG                    lReverb
 )
 {
     PAGED_CODE();
     UNREFERENCED_PARAMETER(ulChannel);
 
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes)
     {
-        return m_ChorusControls[ulNode];
+        m_pNodes[ulNode].Reverb = lReverb;
     }
-
-    return 0;
-} // GetMixerChorus
+} // SetMixerReverb
 
 void
 CVirtualAudioDriverHW::SetMixerChorus
@@ -596,9 +706,9 @@ CVirtualAudioDriverHW::SetMixerChorus
     PAGED_CODE();
     UNREFERENCED_PARAMETER(ulChannel);
 
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes)
     {
-        m_ChorusControls[ulNode] = lChorus;
+        m_pNodes[ulNode].Chorus = lChorus;
     }
 } // SetMixerChorus
 #pragma code_seg()
@@ -606,23 +716,23 @@ CVirtualAudioDriverHW::SetMixerChorus
 //=============================================================================
 // Acoustic Echo Cancellation
 //=============================================================================
-#pragma code_seg("PAGE")
+// The capture stream's position update reads the AEC switch.
+#pragma code_seg()
 BOOL
 CVirtualAudioDriverHW::GetAecEnabled
 (
     _In_  ULONG                   ulNode
 )
 {
-    PAGED_CODE();
-
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes)
     {
-        return m_AecEnabled[ulNode];
+        return m_pNodes[ulNode].AecEnabled;
     }
 
     return FALSE;
 } // GetAecEnabled
 
+#pragma code_seg("PAGE")
 void
 CVirtualAudioDriverHW::SetAecEnabled
 (
@@ -632,9 +742,9 @@ CVirtualAudioDriverHW::SetAecEnabled
 {
     PAGED_CODE();
 
-    if (ulNode < MAX_TOPOLOGY_NODES)
+    if (ulNode < m_ulNodes)
     {
-        m_AecEnabled[ulNode] = fEnabled;
+        m_pNodes[ulNode].AecEnabled = fEnabled;
     }
 } // SetAecEnabled
 #pragma code_seg()
@@ -9,18 +9,44 @@ Module Name:
 Abstract:
 
     Declaration of Simple Audio Sample HW class. 
-    Simple Audio Sample HW has an array for storing mixer and volume settings
-    for the topology.
+    Simple Audio Sample HW has a bank of registers for storing mixer and
+    volume settings for the topology.
 --*/
 
 #ifndef _VIRTUALAUDIODRIVER_HW_H_
 #define _VIRTUALAUDIODRIVER_HW_H_
 
+#include "peakmeter.h"
+#include "seqlock.h"
+
 //=============================================================================
 // Defines
 //=============================================================================
-// BUGBUG we should dynamically allocate this...
-#define MAX_TOPOLOGY_NODES      20
+// Channels with their own volume and mute registers (7.1).
+#define MAX_TOPOLOGY_CHANNELS   8
+
+//
+// One topology node's registers. The adapter allocates a bank of them,
+// numbered by MIXER_NODE, with its endpoints; zeroed storage is a valid
+// initial state.
+//
+typedef struct _MIXER_NODE_REGISTERS
+{
+    BOOL                        Mute[MAX_TOPOLOGY_CHANNELS];
+    LONG                        Volume[MAX_TOPOLOGY_CHANNELS];
+    // Levels published by the streams metering a peak meter node.
+    CSeqLockSnapshot<PEAK_METER_LEVELS> PeakMeter;
+    volatile LONG               PeakMeterPublishing;
+    // Tone Control (Bass/Treble)
+    LONG                        Bass[MAX_TOPOLOGY_CHANNELS];
+    LONG                        Treble[MAX_TOPOLOGY_CHANNELS];
+    // Audio Effects
+    LONG                        Reverb;                 // Reverb level
+    LONG                        Chorus;                 // Chorus level
+    // Acoustic Echo Cancellation
+    BOOL                        AecEnabled;             // AEC enable/disable
+} MIXER_NODE_REGISTERS;
+typedef MIXER_NODE_REGISTERS *PMIXER_NODE_REGISTERS;
 
 //=============================================================================
 // Classes
@@ -34,27 +60,23 @@ class CVirtualAudioDriverHW
 {
 public:
 protected:
-    BOOL                        m_MuteControls[MAX_TOPOLOGY_NODES];
-    LONG                        m_VolumeControls[MAX_TOPOLOGY_NODES];
-    LONG                        m_PeakMeterControls[MAX_TOPOLOGY_NODES];
+    PMIXER_NODE_REGISTERS       m_pNodes;           // Owned by the adapter.
+    ULONG                       m_ulNodes;
     ULONG                       m_ulMux;            // Mux selection
     BOOL                        m_bDevSpecific;
     INT                         m_iDevSpecific;
     UINT                        m_uiDevSpecific;
-    // Tone Control (Bass/Treble)
-    LONG                        m_BassControls[MAX_TOPOLOGY_NODES];
-    LONG                        m_TrebleControls[MAX_TOPOLOGY_NODES];
-    // Audio Effects
-    LONG                        m_ReverbControls[MAX_TOPOLOGY_NODES];      // Reverb level
-    LONG                        m_ChorusControls[MAX_TOPOLOGY_NODES];     // Chorus level
-    // Acoustic Echo Cancellation
-    BOOL                        m_AecEnabled[MAX_TOPOLOGY_NODES];         // AEC enable/disable
 
 private:
 
 public:
     CVirtualAudioDriverHW();
     
+    void                        AttachNodes
+    (
+        _In_reads_(ulNodes) PMIXER_NODE_REGISTERS   pNodes,
+        _In_  ULONG                                 ulNodes
+    );
     void                        MixerReset();
     BOOL                        bGetDevSpecific();
     void                        bSetDevSpecific
@@ -104,6 +126,16 @@ public:
         _In_  ULONG               ulNode,
         _In_  ULONG               ulChannel
     );
+    LONG                        GetMixerRmsMeter
+    (   
+        _In_  ULONG               ulNode,
+        _In_  ULONG               ulChannel
+    );
+    void                        SetMixerPeakMeter
+    (
+        _In_  ULONG               ulNode,
+        _In_  PPEAK_METER_LEVELS  pLevels
+    );
 
     // Tone Control (Bass/Treble)
     LONG                        GetMixerBass
@@ -409,6 +409,104 @@ Return Value:
     return ntStatus;
 } // PropertyHandlerBasicSupportVolume
 
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+PropertyHandler_BasicSupportTone
+(
+    _In_  PPCPROPERTY_REQUEST   PropertyRequest,
+    _In_  ULONG                 MaxChannels
+)
+/*++
+
+Routine Description:
+
+  Handles BasicSupport for Bass and Treble nodes.
+
+Arguments:
+    
+  PropertyRequest - property request structure.
+
+  MaxChannels - # of supported channels.
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS                    ntStatus = STATUS_SUCCESS;
+    ULONG                       cbFullProperty = 
+        sizeof(KSPROPERTY_DESCRIPTION) +
+        sizeof(KSPROPERTY_MEMBERSHEADER) +
+        sizeof(KSPROPERTY_STEPPING_LONG) * MaxChannels;
+    
+    ASSERT(MaxChannels > 0);
+
+    if (PropertyRequest->ValueSize >= (sizeof(KSPROPERTY_DESCRIPTION)))
+    {
+        PKSPROPERTY_DESCRIPTION PropDesc = 
+            PKSPROPERTY_DESCRIPTION(PropertyRequest->Value);
+
+        PropDesc->AccessFlags       = KSPROPERTY_TYPE_ALL;
+        PropDesc->DescriptionSize   = cbFullProperty;
+        PropDesc->PropTypeSet.Set   = KSPROPTYPESETID_General;
+        PropDesc->PropTypeSet.Id    = VT_I4;
+        PropDesc->PropTypeSet.Flags = 0;
+        PropDesc->MembersListCount  = 1;
+        PropDesc->Reserved          = 0;
+
+        // if return buffer can also hold a range description, return it too
+        if(PropertyRequest->ValueSize >= cbFullProperty)
+        {
+            // fill in the members header
+            PKSPROPERTY_MEMBERSHEADER Members = 
+                PKSPROPERTY_MEMBERSHEADER(PropDesc + 1);
+
+            Members->MembersFlags   = KSPROPERTY_MEMBER_STEPPEDRANGES;
+            Members->MembersSize    = sizeof(KSPROPERTY_STEPPING_LONG);
+            Members->MembersCount   = MaxChannels;
+            Members->Flags          = KSPROPERTY_MEMBER_FLAG_BASICSUPPORT_MULTICHANNEL;
+
+            // fill in the stepped range
+            PKSPROPERTY_STEPPING_LONG Range = 
+                PKSPROPERTY_STEPPING_LONG(Members + 1);
+
+            for (ULONG i=0; i<MaxChannels; ++i)
+            {
+                Range[i].Bounds.SignedMaximum = TONE_SIGNED_MAXIMUM;     //  12 dB
+                Range[i].Bounds.SignedMinimum = TONE_SIGNED_MINIMUM;     // -12 dB
+                Range[i].SteppingDelta        = TONE_STEPPING_DELTA;     //  .5 dB
+                Range[i].Reserved             = 0;
+            }
+
+            // set the return value size
+            PropertyRequest->ValueSize = cbFullProperty;
+        } 
+        else
+        {
+            PropertyRequest->ValueSize = sizeof(KSPROPERTY_DESCRIPTION);
+        }
+    } 
+    else if(PropertyRequest->ValueSize >= sizeof(ULONG))
+    {
+        // if return buffer can hold a ULONG, return the access flags
+        PULONG AccessFlags = PULONG(PropertyRequest->Value);
+
+        PropertyRequest->ValueSize = sizeof(ULONG);
+        *AccessFlags = KSPROPERTY_TYPE_ALL;
+    }
+    else
+    {
+        PropertyRequest->ValueSize = 0;
+        ntStatus = STATUS_BUFFER_TOO_SMALL;
+    }
+
+    return ntStatus;
+} // PropertyHandler_BasicSupportTone
+
 //=============================================================================
 #pragma code_seg("PAGE")
 NTSTATUS
@@ -664,7 +762,8 @@ PropertyHandler_Volume
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 )
 /*++
 
@@ -680,6 +779,8 @@ Arguments:
 
   MaxChannels - # of supported channels.
 
+  MixerNode - mixer register of the node.
+
 Return Value:
 
   NT status code.
@@ -724,7 +825,7 @@ Return Value:
                 *plVolume = 
                     AdapterCommon->MixerVolumeRead
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel == ALL_CHANNELS_ID ? 0 : ulChannel
                     );
                 PropertyRequest->ValueSize = sizeof(ULONG);                
@@ -733,11 +834,11 @@ Return Value:
             {
                 if (ALL_CHANNELS_ID == ulChannel)
                 {
-                    for (ULONG i=0; i<ulChannel; ++i)
+                    for (ULONG i=0; i<MaxChannels; ++i)
                     {
                         AdapterCommon->MixerVolumeWrite
                         (
-                            PropertyRequest->Node, 
+                            MixerNode, 
                             i, 
                             VOLUME_NORMALIZE_IN_RANGE(*plVolume)
                         );
@@ -747,7 +848,7 @@ Return Value:
                 {
                     AdapterCommon->MixerVolumeWrite
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel, 
                         VOLUME_NORMALIZE_IN_RANGE(*plVolume)
                     );
@@ -773,7 +874,8 @@ PropertyHandler_Bass
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 )
 {
     PAGED_CODE();
@@ -786,7 +888,7 @@ PropertyHandler_Bass
 
     if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
     {
-        ntStatus = PropertyHandler_BasicSupportVolume(
+        ntStatus = PropertyHandler_BasicSupportTone(
                             PropertyRequest,
                             MaxChannels);
     }
@@ -814,7 +916,7 @@ PropertyHandler_Bass
                 *plBass = 
                     AdapterCommon->MixerBassRead
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel == ALL_CHANNELS_ID ? 0 : ulChannel
                     );
                 PropertyRequest->ValueSize = sizeof(ULONG);                
@@ -827,9 +929,9 @@ PropertyHandler_Bass
                     {
                         AdapterCommon->MixerBassWrite
                         (
-                            PropertyRequest->Node, 
+                            MixerNode, 
                             i, 
-                            VOLUME_NORMALIZE_IN_RANGE(*plBass)
+                            TONE_NORMALIZE_IN_RANGE(*plBass)
                         );
                     }
                 }
@@ -837,9 +939,9 @@ PropertyHandler_Bass
                 {
                     AdapterCommon->MixerBassWrite
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel, 
-                        VOLUME_NORMALIZE_IN_RANGE(*plBass)
+                        TONE_NORMALIZE_IN_RANGE(*plBass)
                     );
                 }
             }
@@ -859,7 +961,8 @@ PropertyHandler_Treble
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 )
 {
     PAGED_CODE();
@@ -872,7 +975,7 @@ PropertyHandler_Treble
 
     if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
     {
-        ntStatus = PropertyHandler_BasicSupportVolume(
+        ntStatus = PropertyHandler_BasicSupportTone(
                             PropertyRequest,
                             MaxChannels);
     }
@@ -900,7 +1003,7 @@ PropertyHandler_Treble
                 *plTreble = 
                     AdapterCommon->MixerTrebleRead
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel == ALL_CHANNELS_ID ? 0 : ulChannel
                     );
                 PropertyRequest->ValueSize = sizeof(ULONG);                
@@ -913,9 +1016,9 @@ PropertyHandler_Treble
                     {
                         AdapterCommon->MixerTrebleWrite
                         (
-                            PropertyRequest->Node, 
+                            MixerNode, 
                             i, 
-                            VOLUME_NORMALIZE_IN_RANGE(*plTreble)
+                            TONE_NORMALIZE_IN_RANGE(*plTreble)
                         );
                     }
                 }
@@ -923,9 +1026,9 @@ PropertyHandler_Treble
                 {
                     AdapterCommon->MixerTrebleWrite
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel, 
-                        VOLUME_NORMALIZE_IN_RANGE(*plTreble)
+                        TONE_NORMALIZE_IN_RANGE(*plTreble)
                     );
                 }
             }
@@ -948,7 +1051,8 @@ PropertyHandler_Reverb
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 )
 {
     PAGED_CODE();
@@ -989,7 +1093,7 @@ PropertyHandler_Reverb
                 *plReverb = 
                     AdapterCommon->MixerReverbRead
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel == ALL_CHANNELS_ID ? 0 : ulChannel
                     );
                 PropertyRequest->ValueSize = sizeof(ULONG);                
@@ -1002,7 +1106,7 @@ PropertyHandler_Reverb
                     {
                         AdapterCommon->MixerReverbWrite
                         (
-                            PropertyRequest->Node, 
+                            MixerNode, 
                             i, 
                             VOLUME_NORMALIZE_IN_RANGE(*plReverb)
                         );
@@ -1012,7 +1116,7 @@ PropertyHandler_Reverb
                 {
                     AdapterCommon->MixerReverbWrite
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel, 
                         VOLUME_NORMALIZE_IN_RANGE(*plReverb)
                     );
@@ -1034,7 +1138,8 @@ PropertyHandler_Chorus
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 )
 {
     PAGED_CODE();
@@ -1075,7 +1180,7 @@ PropertyHandler_Chorus
                 *plChorus = 
                     AdapterCommon->MixerChorusRead
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel == ALL_CHANNELS_ID ? 0 : ulChannel
                     );
                 PropertyRequest->ValueSize = sizeof(ULONG);                
@@ -1088,7 +1193,7 @@ PropertyHandler_Chorus
                     {
                         AdapterCommon->MixerChorusWrite
                         (
-                            PropertyRequest->Node, 
+                            MixerNode, 
                             i, 
                             VOLUME_NORMALIZE_IN_RANGE(*plChorus)
                         );
@@ -1098,7 +1203,7 @@ PropertyHandler_Chorus
                 {
                     AdapterCommon->MixerChorusWrite
                     (
-                        PropertyRequest->Node, 
+                        MixerNode, 
                         ulChannel, 
                         VOLUME_NORMALIZE_IN_RANGE(*plChorus)
                     );
@@ -1123,7 +1228,8 @@ PropertyHandler_AcousticEchoCancel
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 )
 {
     PAGED_CODE();
@@ -1159,7 +1265,7 @@ PropertyHandler_AcousticEchoCancel
                 *pfEnabled = 
                     AdapterCommon->AecEnabledRead
                     (
-                        PropertyRequest->Node
+                        MixerNode
                     );
                 PropertyRequest->ValueSize = sizeof(BOOL);                
             }
@@ -1167,7 +1273,7 @@ PropertyHandler_AcousticEchoCancel
             {
                 AdapterCommon->AecEnabledWrite
                 (
-                    PropertyRequest->Node, 
+                    MixerNode, 
                     *pfEnabled
                 );
             }
@@ -1190,7 +1296,8 @@ PropertyHandler_Mute
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 )
 /*++
 
@@ -1206,6 +1313,8 @@ Arguments:
 
   MaxChannels - # of supported channels.
 
+  MixerNode - mixer register of the node.
+
 Return Value:
 
   NT status code.
@@ -1250,7 +1359,7 @@ Return Value:
                 *pfMute = 
                     AdapterCommon->MixerMuteRead
                     (
-                        PropertyRequest->Node,
+                        MixerNode,
                         ulChannel == ALL_CHANNELS_ID ? 0 : ulChannel
                     );
                 PropertyRequest->ValueSize = sizeof(BOOL);
@@ -1259,11 +1368,11 @@ Return Value:
             {
                 if (ALL_CHANNELS_ID == ulChannel)
                 {
-                    for (ULONG i=0; i<ulChannel; ++i)
+                    for (ULONG i=0; i<MaxChannels; ++i)
                     {
                         AdapterCommon->MixerMuteWrite
                         (
-                            PropertyRequest->Node,
+                            MixerNode,
                             i,
                             (*pfMute) ? TRUE : FALSE
                         );
@@ -1273,7 +1382,7 @@ Return Value:
                 {
                     AdapterCommon->MixerMuteWrite
                     (
-                        PropertyRequest->Node,
+                        MixerNode,
                         ulChannel,
                         (*pfMute) ? TRUE : FALSE
                     );
@@ -1297,7 +1406,8 @@ PropertyHandler_PeakMeter2
 (
     _In_  PADAPTERCOMMON        AdapterCommon,
     _In_  PPCPROPERTY_REQUEST   PropertyRequest,
-    _In_  ULONG                 MaxChannels
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
 )
 /*++
 
@@ -1313,6 +1423,8 @@ Arguments:
 
   MaxChannels - # of supported channels.
 
+  MixerNode - mixer register of the node.
+
 Return Value:
 
   NT status code.
@@ -1358,7 +1470,7 @@ Return Value:
                     PEAKMETER_NORMALIZE_IN_RANGE(
                         AdapterCommon->MixerPeakMeterRead
                         (
-                            PropertyRequest->Node, 
+                            MixerNode, 
                             ulChannel == ALL_CHANNELS_ID ? 0 : ulChannel
                         ));
                 
@@ -1374,5 +1486,95 @@ Return Value:
 
     return ntStatus;
 } // PropertyHandler_PeakMeter2
+
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+PropertyHandler_PeakMeterRms
+(
+    _In_  PADAPTERCOMMON        AdapterCommon,
+    _In_  PPCPROPERTY_REQUEST   PropertyRequest,
+    _In_  ULONG                 MaxChannels,
+    _In_  ULONG                 MixerNode
+)
+/*++
+
+Routine Description:
+
+  Property handler for KSPROPERTY_AUDIO_DEV_SPECIFIC on a peak meter node:
+  the RMS level metered alongside the peak, in the same range and with
+  the same per-channel instance as KSPROPERTY_AUDIO_PEAKMETER2.
+
+Arguments:
+
+  AdapterCommon - interface to the common adapter object.
+  
+  PropertyRequest - property request structure.
+
+  MaxChannels - # of supported channels.
+
+  MixerNode - mixer register of the node.
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    PAGED_CODE();
+
+    DPF_ENTER(("[%s]",__FUNCTION__));
+
+    NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+    ULONG    ulChannel;
+    PLONG    plSample;
+
+    if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+    {
+        ntStatus = PropertyHandler_BasicSupportPeakMeter2(
+                            PropertyRequest,
+                            MaxChannels);
+    }
+    else
+    {
+        ntStatus = 
+            ValidatePropertyParams
+            (
+                PropertyRequest, 
+                sizeof(LONG),    // sample value is a LONG
+                sizeof(ULONG)    // instance is the channel number
+            );
+        if (NT_SUCCESS(ntStatus))
+        {
+            ulChannel = * (PULONG (PropertyRequest->Instance));
+            plSample  = PLONG (PropertyRequest->Value);
+
+            if (ulChannel >= MaxChannels &&
+                ulChannel != ALL_CHANNELS_ID)
+            {
+               ntStatus = STATUS_INVALID_PARAMETER;
+            }
+            else if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+            {
+                *plSample = 
+                    PEAKMETER_NORMALIZE_IN_RANGE(
+                        AdapterCommon->MixerRmsMeterRead
+                        (
+                            MixerNode, 
+                            ulChannel == ALL_CHANNELS_ID ? 0 : ulChannel
+                        ));
+                
+                PropertyRequest->ValueSize = sizeof(ULONG);                
+            }
+        }
+
+        if (!NT_SUCCESS(ntStatus))
+        {
+            DPF(D_TERSE, ("[%s - ntStatus=0x%08x]",__FUNCTION__,ntStatus));
+        }
+    }
+
+    return ntStatus;
+} // PropertyHandler_PeakMeterRms
 #pragma code_seg()
 
@@ -0,0 +1,788 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    loopback.cpp
+
+Abstract:
+
+    Implementation of the speaker-to-microphone loopback cable. Write runs
+    in the render stream's position update, Read in the capture stream's,
+    both at DISPATCH_LEVEL and without taking a lock.
+--*/
+#pragma warning (disable : 4127)
+
+#include "definitions.h"
+#include "loopback.h"
+
+#define LOOPBACK_POOLTAG            'BLDV'
+
+//
+// Format key layout: sample rate in bits 0-19, channels in bits 20-24,
+// container bytes in bits 25-27 and the float flag in bit 28.
+//
+#define LOOPBACK_KEY_RATE_MASK      0x000FFFFF
+#define LOOPBACK_KEY_CHANNEL_SHIFT  20
+#define LOOPBACK_KEY_CHANNEL_MASK   0x1F
+#define LOOPBACK_KEY_BYTES_SHIFT    25
+#define LOOPBACK_KEY_BYTES_MASK     0x7
+#define LOOPBACK_KEY_FLOAT          0x10000000
+#define LOOPBACK_KEY_SAMPLE_MASK    ((LOOPBACK_KEY_BYTES_MASK << LOOPBACK_KEY_BYTES_SHIFT) | LOOPBACK_KEY_FLOAT)
+
+//=============================================================================
+// CLoopbackCable
+//=============================================================================
+
+//=============================================================================
+#pragma code_seg("PAGE")
+CLoopbackCable::CLoopbackCable()
+:   m_pRingBuffer(NULL),
+    m_lRenderFormatKey(0),
+    m_ulRenderChannelMask(0),
+    m_lConsumerFormatKey(0),
+    m_eResamplerQuality(eResamplerMedium),
+    m_pResamplerStorage(NULL),
+    m_pResamplerInput(NULL),
+    m_pResamplerMixed(NULL),
+    m_lConverterRenderKey(0),
+    m_lConverterCaptureKey(0),
+    m_lResamplerRenderKey(0),
+    m_lResamplerCaptureKey(0),
+    m_ulResamplerRenderMask(0),
+    m_ulResamplerCaptureMask(0),
+    m_lMixerRenderKey(0),
+    m_lMixerCaptureKey(0),
+    m_ulMixerRenderMask(0),
+    m_ulMixerCaptureMask(0),
+    m_bDriftCompensation(FALSE),
+    m_bPrimed(FALSE),
+    m_ulTargetFrames(0)
+{
+    PAGED_CODE();
+} // CLoopbackCable
+
+//=============================================================================
+#pragma code_seg("PAGE")
+CLoopbackCable::~CLoopbackCable()
+{
+    PAGED_CODE();
+
+    if (m_pRingBuffer)
+    {
+        ExFreePoolWithTag(m_pRingBuffer, LOOPBACK_POOLTAG);
+        m_pRingBuffer = NULL;
+    }
+
+    if (m_pResamplerStorage)
+    {
+        ExFreePoolWithTag(m_pResamplerStorage, LOOPBACK_POOLTAG);
+        m_pResamplerStorage = NULL;
+    }
+
+    if (m_pResamplerInput)
+    {
+        ExFreePoolWithTag(m_pResamplerInput, LOOPBACK_POOLTAG);
+        m_pResamplerInput = NULL;
+    }
+
+    if (m_pResamplerMixed)
+    {
+        ExFreePoolWithTag(m_pResamplerMixed, LOOPBACK_POOLTAG);
+        m_pResamplerMixed = NULL;
+    }
+} // ~CLoopbackCable
+
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+CLoopbackCable::Init
+(
+    _In_ ULONG          ulResamplerQuality,
+    _In_ BOOL           bDriftCompensation
+)
+/*++
+
+Routine Description:
+
+  Allocates the ring and the conversion storage. Called once from the
+  adapter's Init.
+
+Arguments:
+
+  ulResamplerQuality - eResamplerQuality used when formats differ; out of
+                       range values select the highest.
+
+  bDriftCompensation - also convert matching formats, to hold the latency
+                       when the two clocks drift.
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    PAGED_CODE();
+
+    m_pRingBuffer = (PBYTE)ExAllocatePool2(POOL_FLAG_NON_PAGED, LOOPBACK_RING_SIZE, LOOPBACK_POOLTAG);
+    if (!m_pRingBuffer)
+    {
+        DPF(D_TERSE, ("[CLoopbackCable::Init] Insufficient memory for loopback ring"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (!m_Ring.Attach(m_pRingBuffer, LOOPBACK_RING_SIZE))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    m_pResamplerStorage = ExAllocatePool2(POOL_FLAG_NON_PAGED, CResampler::GetStorageBytes(RESAMPLER_MAX_CHANNELS), LOOPBACK_POOLTAG);
+    m_pResamplerInput = (PBYTE)ExAllocatePool2(POOL_FLAG_NON_PAGED, RESAMPLER_BLOCK_FRAMES * LOOPBACK_MAX_FRAME_BYTES, LOOPBACK_POOLTAG);
+    m_pResamplerMixed = (PBYTE)ExAllocatePool2(POOL_FLAG_NON_PAGED, RESAMPLER_BLOCK_FRAMES * LOOPBACK_MAX_FRAME_BYTES, LOOPBACK_POOLTAG);
+    if (!m_pResamplerStorage || !m_pResamplerInput || !m_pResamplerMixed)
+    {
+        DPF(D_TERSE, ("[CLoopbackCable::Init] Insufficient memory for loopback resampler"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    m_eResamplerQuality = (ulResamplerQuality < eResamplerQualityCount) ?
+                          (eResamplerQuality)ulResamplerQuality : eResamplerHigh;
+    m_bDriftCompensation = bDriftCompensation;
+
+    return STATUS_SUCCESS;
+} // Init
+
+//=============================================================================
+#pragma code_seg()
+LONG
+CLoopbackCable::MakeFormatKey
+(
+    _In_ PWAVEFORMATEX  pWfEx
+)
+/*++
+
+Routine Description:
+
+  Packs the properties that must match for a byte-exact transfer into one
+  value that can be published with a single interlocked store.
+
+Arguments:
+
+  pWfEx - stream format.
+
+Return Value:
+
+  Non-zero format key, or 0 if the format cannot be carried.
+
+--*/
+{
+    BOOL bFloat = FALSE;
+    ULONG ulBytes = pWfEx->wBitsPerSample / 8;
+
+    if (pWfEx->nChannels == 0 || pWfEx->nChannels > 8 ||
+        ulBytes == 0 || ulBytes > LOOPBACK_KEY_BYTES_MASK ||
+        pWfEx->nSamplesPerSec > LOOPBACK_KEY_RATE_MASK ||
+        pWfEx->nBlockAlign > LOOPBACK_MAX_FRAME_BYTES)
+    {
+        return 0;
+    }
+
+    if (pWfEx->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    {
+        bFloat = TRUE;
+    }
+    else if (pWfEx->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+             pWfEx->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))
+    {
+        bFloat = IsEqualGUIDAligned(((PWAVEFORMATEXTENSIBLE)pWfEx)->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+    }
+
+    return (LONG)(pWfEx->nSamplesPerSec |
+                  ((ULONG)pWfEx->nChannels << LOOPBACK_KEY_CHANNEL_SHIFT) |
+                  (ulBytes << LOOPBACK_KEY_BYTES_SHIFT) |
+                  (bFloat ? LOOPBACK_KEY_FLOAT : 0));
+} // MakeFormatKey
+
+//=============================================================================
+#pragma code_seg()
+ULONG
+CLoopbackCable::GetChannelMask
+(
+    _In_ PWAVEFORMATEX  pWfEx
+)
+/*++
+
+Routine Description:
+
+  Speaker positions of a stream's channels.
+
+Arguments:
+
+  pWfEx - stream format.
+
+Return Value:
+
+  dwChannelMask of an extensible format, otherwise 0 (the default layout
+  for the channel count, see ChannelMatrixMask).
+
+--*/
+{
+    if (pWfEx->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+        pWfEx->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))
+    {
+        return ((PWAVEFORMATEXTENSIBLE)pWfEx)->dwChannelMask;
+    }
+
+    return 0;
+} // GetChannelMask
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CLoopbackCable::ConnectRender
+(
+    _In_ PWAVEFORMATEX  pWfEx
+)
+/*++
+
+Routine Description:
+
+  Registers the render stream as producer. The producer session is reset
+  before the key is published so the consumer never pairs the new key with
+  frames staged for the old format.
+
+Arguments:
+
+  pWfEx - render stream format.
+
+--*/
+{
+    PAGED_CODE();
+
+    m_Ring.BeginProducerSession(pWfEx->nBlockAlign);
+    m_ulRenderChannelMask = GetChannelMask(pWfEx);
+    InterlockedExchange(&m_lRenderFormatKey, MakeFormatKey(pWfEx));
+} // ConnectRender
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CLoopbackCable::DisconnectRender()
+{
+    PAGED_CODE();
+
+    InterlockedExchange(&m_lRenderFormatKey, 0);
+} // DisconnectRender
+
+//=============================================================================
+#pragma code_seg()
+VOID
+CLoopbackCable::Write
+(
+    _In_reads_bytes_(cbData) PBYTE  pData,
+    _In_ ULONG                      cbData
+)
+/*++
+
+Routine Description:
+
+  Queues render bytes for the capture side. Frames that do not fit because
+  the capture side is not draining are dropped.
+
+Arguments:
+
+  pData - render DMA bytes.
+
+  cbData - number of bytes.
+
+--*/
+{
+    if (m_lRenderFormatKey == 0)
+    {
+        return;
+    }
+
+    m_Ring.Write(pData, cbData);
+} // Write
+
+//=============================================================================
+#pragma code_seg()
+VOID
+CLoopbackCable::ResetCapture()
+/*++
+
+Routine Description:
+
+  Drops queued audio so a capture stream entering RUN starts with the
+  lowest possible latency instead of replaying stale render data.
+
+--*/
+{
+    m_Ring.Discard();
+    m_Resampler.Reset();
+    m_bPrimed = FALSE;
+} // ResetCapture
+
+//=============================================================================
+#pragma code_seg()
+VOID
+CLoopbackCable::Read
+(
+    _In_ LONG                       lCaptureFormatKey,
+    _In_ ULONG                      ulCaptureChannelMask,
+    _In_ ULONG                      ulFrameBytes,
+    _Out_writes_bytes_(cbData) PBYTE pData,
+    _In_ ULONG                      cbData
+)
+/*++
+
+Routine Description:
+
+  Fills pData with queued render audio, converted when the render format
+  differs from the capture format or drift compensation is on. Drift
+  compensation sends every pair through ReadConverted, which also remixes
+  and reformats. Any shortfall, and everything when the formats cannot be
+  converted, is silence.
+
+Arguments:
+
+  lCaptureFormatKey - MakeFormatKey of the capture stream.
+
+  ulCaptureChannelMask - GetChannelMask of the capture stream.
+
+  ulFrameBytes - capture block alignment.
+
+  pData - capture DMA bytes.
+
+  cbData - number of bytes.
+
+--*/
+{
+    ULONG cbRead = 0;
+    LONG lRenderFormatKey = m_lRenderFormatKey;
+
+    if (lRenderFormatKey != m_lConsumerFormatKey)
+    {
+        // Producer changed format (or went away); what is queued belongs to
+        // a different stream layout.
+        m_Ring.Discard();
+        m_Resampler.Reset();
+        m_bPrimed = FALSE;
+        m_lConsumerFormatKey = lRenderFormatKey;
+    }
+
+    if (lRenderFormatKey != 0)
+    {
+        if (lRenderFormatKey == lCaptureFormatKey && !m_bDriftCompensation)
+        {
+            cbRead = m_Ring.Read(pData, cbData, ulFrameBytes);
+        }
+        else if (((lRenderFormatKey ^ lCaptureFormatKey) & ~LOOPBACK_KEY_SAMPLE_MASK) == 0 && !m_bDriftCompensation)
+        {
+            cbRead = ReadReformatted(lRenderFormatKey, lCaptureFormatKey, pData, cbData);
+        }
+        else if (((lRenderFormatKey ^ lCaptureFormatKey) & LOOPBACK_KEY_RATE_MASK) == 0 && !m_bDriftCompensation)
+        {
+            cbRead = ReadRemixed(lRenderFormatKey, lCaptureFormatKey, ulCaptureChannelMask, pData, cbData);
+        }
+        else
+        {
+            cbRead = ReadConverted(lRenderFormatKey, lCaptureFormatKey, ulCaptureChannelMask, pData, cbData);
+        }
+    }
+
+    if (cbRead < cbData)
+    {
+        // Unsigned 8-bit PCM is centered at 0x80.
+        BYTE silence = (((lCaptureFormatKey >> LOOPBACK_KEY_BYTES_SHIFT) & LOOPBACK_KEY_BYTES_MASK) == 1) ? 0x80 : 0;
+        RtlFillMemory(pData + cbRead, cbData - cbRead, silence);
+    }
+} // Read
+
+//=============================================================================
+#pragma code_seg()
+ULONG
+CLoopbackCable::ReadRemixed
+(
+    _In_ LONG                       lRenderFormatKey,
+    _In_ LONG                       lCaptureFormatKey,
+    _In_ ULONG                      ulCaptureChannelMask,
+    _Out_writes_bytes_(cbData) PBYTE pData,
+    _In_ ULONG                      cbData
+)
+/*++
+
+Routine Description:
+
+  Fills pData with queued render audio mixed to the capture speaker layout
+  and sample format, for streams at the same rate. The matrix comes from
+  the two channel masks and is kept per pair.
+
+Arguments:
+
+  lRenderFormatKey - MakeFormatKey of the render stream.
+
+  lCaptureFormatKey - MakeFormatKey of the capture stream.
+
+  ulCaptureChannelMask - GetChannelMask of the capture stream.
+
+  pData - capture DMA bytes.
+
+  cbData - number of bytes.
+
+Return Value:
+
+  Number of bytes filled, whole capture frames.
+
+--*/
+{
+    ULONG cbRead = 0;
+    ULONG ulRenderChannelMask = m_ulRenderChannelMask;
+
+    if (lRenderFormatKey != m_lMixerRenderKey || lCaptureFormatKey != m_lMixerCaptureKey ||
+        ulRenderChannelMask != m_ulMixerRenderMask || ulCaptureChannelMask != m_ulMixerCaptureMask)
+    {
+        m_lMixerRenderKey = lRenderFormatKey;
+        m_lMixerCaptureKey = lCaptureFormatKey;
+        m_ulMixerRenderMask = ulRenderChannelMask;
+        m_ulMixerCaptureMask = ulCaptureChannelMask;
+
+        if (!m_Mixer.Init(m_Matrices.Get(ulRenderChannelMask,
+                                         ((ULONG)lRenderFormatKey >> LOOPBACK_KEY_CHANNEL_SHIFT) & LOOPBACK_KEY_CHANNEL_MASK,
+                                         ulCaptureChannelMask,
+                                         ((ULONG)lCaptureFormatKey >> LOOPBACK_KEY_CHANNEL_SHIFT) & LOOPBACK_KEY_CHANNEL_MASK,
+                                         LOOPBACK_LFE_GAIN),
+                          (((ULONG)lRenderFormatKey >> LOOPBACK_KEY_BYTES_SHIFT) & LOOPBACK_KEY_BYTES_MASK) * 8,
+                          (lRenderFormatKey & LOOPBACK_KEY_FLOAT) != 0,
+                          (((ULONG)lCaptureFormatKey >> LOOPBACK_KEY_BYTES_SHIFT) & LOOPBACK_KEY_BYTES_MASK) * 8,
+                          (lCaptureFormatKey & LOOPBACK_KEY_FLOAT) != 0))
+        {
+            DPF(D_VERBOSE, ("[CLoopbackCable::ReadRemixed] Cannot mix 0x%08x to 0x%08x", lRenderFormatKey, lCaptureFormatKey));
+        }
+    }
+
+    if (!m_Mixer.IsActive() || lCaptureFormatKey == 0)
+    {
+        m_Ring.Discard();
+        return 0;
+    }
+
+    ULONG ulInFrameBytes = m_Mixer.GetInputFrameBytes();
+    ULONG ulOutFrameBytes = m_Mixer.GetOutputFrameBytes();
+    ULONG ulFrames = cbData / ulOutFrameBytes;
+
+    while (ulFrames > 0)
+    {
+        ULONG ulWanted = (ulFrames < RESAMPLER_BLOCK_FRAMES) ? ulFrames : RESAMPLER_BLOCK_FRAMES;
+        ULONG ulGot = m_Ring.Read(m_pResamplerInput, ulWanted * ulInFrameBytes, ulInFrameBytes) / ulInFrameBytes;
+
+        m_Mixer.Process(m_pResamplerInput, pData + cbRead, ulGot);
+        cbRead += ulGot * ulOutFrameBytes;
+        ulFrames -= ulGot;
+
+        if (ulGot < ulWanted)
+        {
+            break;
+        }
+    }
+
+    return cbRead;
+} // ReadRemixed
+
+//=============================================================================
+#pragma code_seg()
+ULONG
+CLoopbackCable::ReadReformatted
+(
+    _In_ LONG                       lRenderFormatKey,
+    _In_ LONG                       lCaptureFormatKey,
+    _Out_writes_bytes_(cbData) PBYTE pData,
+    _In_ ULONG                      cbData
+)
+/*++
+
+Routine Description:
+
+  Fills pData with queued render audio in the capture sample format, for
+  streams that only differ in that. Narrowing is dithered.
+
+Arguments:
+
+  lRenderFormatKey - MakeFormatKey of the render stream.
+
+  lCaptureFormatKey - MakeFormatKey of the capture stream.
+
+  pData - capture DMA bytes.
+
+  cbData - number of bytes.
+
+Return Value:
+
+  Number of bytes filled, whole capture frames.
+
+--*/
+{
+    ULONG cbRead = 0;
+    ULONG ulChannels = ((ULONG)lRenderFormatKey >> LOOPBACK_KEY_CHANNEL_SHIFT) & LOOPBACK_KEY_CHANNEL_MASK;
+
+    if (lRenderFormatKey != m_lConverterRenderKey || lCaptureFormatKey != m_lConverterCaptureKey)
+    {
+        m_lConverterRenderKey = lRenderFormatKey;
+        m_lConverterCaptureKey = lCaptureFormatKey;
+
+        m_Converter.Init(CSampleConverter::GetSampleFormat((((ULONG)lRenderFormatKey >> LOOPBACK_KEY_BYTES_SHIFT) & LOOPBACK_KEY_BYTES_MASK) * 8,
+                                                           0,
+                                                           (lRenderFormatKey & LOOPBACK_KEY_FLOAT) != 0),
+                         CSampleConverter::GetSampleFormat((((ULONG)lCaptureFormatKey >> LOOPBACK_KEY_BYTES_SHIFT) & LOOPBACK_KEY_BYTES_MASK) * 8,
+                                                           0,
+                                                           (lCaptureFormatKey & LOOPBACK_KEY_FLOAT) != 0),
+                         TRUE,
+                         eSampleConvertVector);
+    }
+
+    if (!m_Converter.IsActive() || ulChannels == 0)
+    {
+        m_Ring.Discard();
+        return 0;
+    }
+
+    ULONG ulInFrameBytes = m_Converter.GetSourceSampleBytes() * ulChannels;
+    ULONG ulOutFrameBytes = m_Converter.GetDestinationSampleBytes() * ulChannels;
+    ULONG ulFrames = cbData / ulOutFrameBytes;
+
+    while (ulFrames > 0)
+    {
+        ULONG ulWanted = (ulFrames < RESAMPLER_BLOCK_FRAMES) ? ulFrames : RESAMPLER_BLOCK_FRAMES;
+        ULONG ulGot = m_Ring.Read(m_pResamplerInput, ulWanted * ulInFrameBytes, ulInFrameBytes) / ulInFrameBytes;
+
+        m_Converter.Convert(m_pResamplerInput, pData + cbRead, ulGot * ulChannels);
+        cbRead += ulGot * ulOutFrameBytes;
+        ulFrames -= ulGot;
+
+        if (ulGot < ulWanted)
+        {
+            break;
+        }
+    }
+
+    return cbRead;
+} // ReadReformatted
+
+//=============================================================================
+#pragma code_seg()
+ULONG
+CLoopbackCable::ReadConverted
+(
+    _In_ LONG                       lRenderFormatKey,
+    _In_ LONG                       lCaptureFormatKey,
+    _In_ ULONG                      ulCaptureChannelMask,
+    _Out_writes_bytes_(cbData) PBYTE pData,
+    _In_ ULONG                      cbData
+)
+/*++
+
+Routine Description:
+
+  Fills pData with queued render audio converted to the capture rate,
+  speaker layout and sample format. The converter is set up on the first
+  Read for a pair of formats and its bank built over the next few; until
+  then the render audio is dropped.
+
+  When the layouts differ the render audio is mixed to the capture layout
+  ahead of the resampler, as ReadRemixed mixes it, into 32-bit PCM. When
+  the sample formats differ the resampler produces 32-bit PCM, which is
+  converted with dither, as ReadReformatted converts it.
+
+  Output then waits until LOOPBACK_DRIFT_TARGET_MS is queued, and each
+  Read feeds the queue left behind to the drift controller, whose trim
+  the next Read converts with. An underrun waits for the target again; a
+  queue LOOPBACK_DRIFT_OVERRUN times the target is dropped.
+
+Arguments:
+
+  lRenderFormatKey - MakeFormatKey of the render stream.
+
+  lCaptureFormatKey - MakeFormatKey of the capture stream.
+
+  ulCaptureChannelMask - GetChannelMask of the capture stream.
+
+  pData - capture DMA bytes.
+
+  cbData - number of bytes.
+
+Return Value:
+
+  Number of bytes filled, whole capture frames.
+
+--*/
+{
+    ULONG cbRead = 0;
+    ULONG ulRenderChannelMask = m_ulRenderChannelMask;
+    ULONG ulRenderBytes = ((ULONG)lRenderFormatKey >> LOOPBACK_KEY_BYTES_SHIFT) & LOOPBACK_KEY_BYTES_MASK;
+    ULONG ulCaptureBytes = ((ULONG)lCaptureFormatKey >> LOOPBACK_KEY_BYTES_SHIFT) & LOOPBACK_KEY_BYTES_MASK;
+    ULONG ulRenderChannels = ((ULONG)lRenderFormatKey >> LOOPBACK_KEY_CHANNEL_SHIFT) & LOOPBACK_KEY_CHANNEL_MASK;
+    ULONG ulCaptureChannels = ((ULONG)lCaptureFormatKey >> LOOPBACK_KEY_CHANNEL_SHIFT) & LOOPBACK_KEY_CHANNEL_MASK;
+
+    if (lRenderFormatKey != m_lResamplerRenderKey || lCaptureFormatKey != m_lResamplerCaptureKey ||
+        ulRenderChannelMask != m_ulResamplerRenderMask || ulCaptureChannelMask != m_ulResamplerCaptureMask)
+    {
+        BOOL bMix = ulRenderChannels != ulCaptureChannels ||
+                    ChannelMatrixMask(ulRenderChannelMask, ulRenderChannels) != ChannelMatrixMask(ulCaptureChannelMask, ulCaptureChannels);
+        BOOL bConvert = ((lRenderFormatKey ^ lCaptureFormatKey) & LOOPBACK_KEY_SAMPLE_MASK) != 0;
+        BOOL bStages = TRUE;
+
+        m_lResamplerRenderKey = lRenderFormatKey;
+        m_lResamplerCaptureKey = lCaptureFormatKey;
+        m_ulResamplerRenderMask = ulRenderChannelMask;
+        m_ulResamplerCaptureMask = ulCaptureChannelMask;
+        m_bPrimed = FALSE;
+
+        // A quarter of the ring leaves room for the overrun margin.
+        m_ulTargetFrames = ((lRenderFormatKey & LOOPBACK_KEY_RATE_MASK) * LOOPBACK_DRIFT_TARGET_MS) / 1000;
+        if (ulRenderChannels != 0 && ulRenderBytes != 0 &&
+            m_ulTargetFrames > LOOPBACK_RING_SIZE / (4 * ulRenderChannels * ulRenderBytes))
+        {
+            m_ulTargetFrames = LOOPBACK_RING_SIZE / (4 * ulRenderChannels * ulRenderBytes);
+        }
+        m_Drift.Reset(lRenderFormatKey & LOOPBACK_KEY_RATE_MASK,
+                      lCaptureFormatKey & LOOPBACK_KEY_RATE_MASK,
+                      m_ulTargetFrames);
+
+        // An unused stage is left inactive.
+        m_ResamplerMixer.Init(NULL, 0, FALSE, 0, FALSE);
+        m_ResamplerConverter.Init(eSampleFormatCount, eSampleFormatCount, FALSE, eSampleConvertVector);
+
+        if (lCaptureFormatKey == 0)
+        {
+            bStages = FALSE;
+        }
+        else if (bMix &&
+                 !m_ResamplerMixer.Init(m_Matrices.Get(ulRenderChannelMask,
+                                                       ulRenderChannels,
+                                                       ulCaptureChannelMask,
+                                                       ulCaptureChannels,
+                                                       LOOPBACK_LFE_GAIN),
+                                        ulRenderBytes * 8,
+                                        (lRenderFormatKey & LOOPBACK_KEY_FLOAT) != 0,
+                                        32,
+                                        FALSE))
+        {
+            bStages = FALSE;
+        }
+        else if (bConvert &&
+                 !m_ResamplerConverter.Init(eSampleS32,
+                                            CSampleConverter::GetSampleFormat(ulCaptureBytes * 8,
+                                                                              0,
+                                                                              (lCaptureFormatKey & LOOPBACK_KEY_FLOAT) != 0),
+                                            TRUE,
+                                            eSampleConvertVector))
+        {
+            bStages = FALSE;
+        }
+
+        // Init leaves the converter inactive for any pair it cannot take,
+        // and for no channels when a stage could not be set up.
+        if (!m_Resampler.Init(lRenderFormatKey & LOOPBACK_KEY_RATE_MASK,
+                              bMix ? 32 : ulRenderBytes * 8,
+                              bMix ? FALSE : (lRenderFormatKey & LOOPBACK_KEY_FLOAT) != 0,
+                              lCaptureFormatKey & LOOPBACK_KEY_RATE_MASK,
+                              bConvert ? 32 : ulCaptureBytes * 8,
+                              bConvert ? FALSE : (lCaptureFormatKey & LOOPBACK_KEY_FLOAT) != 0,
+                              bStages ? ulCaptureChannels : 0,
+                              m_eResamplerQuality,
+                              TRUE,
+                              m_pResamplerStorage,
+                              CResampler::GetStorageBytes(RESAMPLER_MAX_CHANNELS)))
+        {
+            DPF(D_VERBOSE, ("[CLoopbackCable::ReadConverted] Cannot convert 0x%08x to 0x%08x", lRenderFormatKey, lCaptureFormatKey));
+        }
+    }
+
+    if (!m_Resampler.Build(LOOPBACK_RESAMPLER_BUDGET))
+    {
+        m_Ring.Discard();
+        return 0;
+    }
+
+    ULONG ulInFrameBytes = ulRenderBytes * ulRenderChannels;
+    ULONG ulOutFrameBytes = ulCaptureBytes * ulCaptureChannels;
+    ULONG ulFrames = cbData / ulOutFrameBytes;
+    ULONG ulQueued = m_Ring.GetBytesAvailable() / ulInFrameBytes;
+
+    if (!m_bPrimed)
+    {
+        if (ulQueued < m_ulTargetFrames + m_Resampler.GetInputFrames(ulFrames))
+        {
+            return 0;
+        }
+
+        m_bPrimed = TRUE;
+        m_Drift.Restart();
+        m_Resampler.SetAdjustment(m_Drift.GetAdjustment());
+    }
+    else if (ulQueued > m_ulTargetFrames * LOOPBACK_DRIFT_OVERRUN)
+    {
+        m_Ring.Discard();
+        m_bPrimed = FALSE;
+        return 0;
+    }
+
+    for (;;)
+    {
+        ULONG ulProduced;
+        ULONG ulWanted;
+        ULONG cbInput;
+
+        if (m_ResamplerConverter.IsActive())
+        {
+            // Through the input block, which is free until the next refill.
+            ulWanted = (ulFrames < RESAMPLER_BLOCK_FRAMES) ? ulFrames : RESAMPLER_BLOCK_FRAMES;
+            ulProduced = m_Resampler.Read(m_pResamplerInput, ulWanted);
+            m_ResamplerConverter.Convert(m_pResamplerInput, pData + cbRead, ulProduced * ulCaptureChannels);
+        }
+        else
+        {
+            ulWanted = ulFrames;
+            ulProduced = m_Resampler.Read(pData + cbRead, ulWanted);
+        }
+
+        cbRead += ulProduced * ulOutFrameBytes;
+        ulFrames -= ulProduced;
+        if (ulFrames == 0)
+        {
+            break;
+        }
+        else if (ulProduced == ulWanted)
+        {
+            continue;
+        }
+
+        ulWanted = m_Resampler.GetInputFrames(ulFrames);
+        ulWanted = (ulWanted < RESAMPLER_BLOCK_FRAMES) ? ulWanted : RESAMPLER_BLOCK_FRAMES;
+        cbInput = m_Ring.Read(m_pResamplerInput, ulWanted * ulInFrameBytes, ulInFrameBytes);
+        if (cbInput == 0)
+        {
+            // Underrun; wait for the target again.
+            m_bPrimed = FALSE;
+            break;
+        }
+
+        if (m_ResamplerMixer.IsActive())
+        {
+            m_ResamplerMixer.Process(m_pResamplerInput, m_pResamplerMixed, cbInput / ulInFrameBytes);
+            m_Resampler.Write(m_pResamplerMixed, cbInput / ulInFrameBytes);
+        }
+        else
+        {
+            m_Resampler.Write(m_pResamplerInput, cbInput / ulInFrameBytes);
+        }
+    }
+
+    if (m_bPrimed)
+    {
+        m_Resampler.SetAdjustment(m_Drift.Update(m_Ring.GetBytesAvailable() / ulInFrameBytes, cbRead / ulOutFrameBytes));
+    }
+
+    return cbRead;
+} // ReadConverted
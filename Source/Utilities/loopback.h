@@ -0,0 +1,181 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    loopback.h
+
+Abstract:
+
+    Declaration of the speaker-to-microphone loopback ("virtual cable").
+    The adapter owns one cable; the render stream feeds it from its DMA
+    buffer and the capture stream drains it into its own DMA buffer,
+    converting the sample rate, sample format and speaker layout when they
+    differ and holding the latency across the two streams' clocks.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_LOOPBACK_H_
+#define _VIRTUALAUDIODRIVER_LOOPBACK_H_
+
+#include "loopbackring.h"
+#include "resampler.h"
+#include "driftcontroller.h"
+#include "sampleconvert.h"
+#include "channelmatrix.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Ring size in bytes, must be a power of two. ~1.3 s of 48 kHz/16-bit stereo.
+#define LOOPBACK_RING_SIZE          (256 * 1024)
+
+// Bank coefficients the consumer builds per Read while a conversion starts.
+#define LOOPBACK_RESAMPLER_BUDGET   1024
+
+// Render audio a converting consumer keeps queued, in ms, and the multiple
+// of it past which it drops the queue and starts over.
+#define LOOPBACK_DRIFT_TARGET_MS    20
+#define LOOPBACK_DRIFT_OVERRUN      4
+
+// Share of the render LFE a capture layout without one gets, Q30. The ITU
+// downmix drops it.
+#define LOOPBACK_LFE_GAIN           0
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CLoopbackCable
+//
+//   Pairs one producer (render) and one consumer (capture) over a
+//   CLoopbackRing. The producer publishes a compact format key and the
+//   consumer discards anything queued under a different key. Matching
+//   formats pass byte for byte. When only the sample format differs the
+//   consumer converts it with a CSampleConverter; when the rate differs
+//   too it runs the audio through a CResampler. A different channel count
+//   at the same rate is up or downmixed between the two channel masks with
+//   a CChannelMixer. At a different rate the CResampler is fed by a
+//   CChannelMixer of its own when the layouts differ and feeds a
+//   CSampleConverter of its own when the sample formats differ.
+//
+//   The two streams run on their own clocks. A converting consumer keeps
+//   LOOPBACK_DRIFT_TARGET_MS of render audio queued, trimming the
+//   converter's ratio with a CDriftController to follow the skew; all
+//   formats take the same path when drift compensation is enabled.
+//
+class CLoopbackCable
+{
+protected:
+    PBYTE                       m_pRingBuffer;
+    CLoopbackRing               m_Ring;
+    volatile LONG               m_lRenderFormatKey;     // 0 when no producer.
+    volatile ULONG              m_ulRenderChannelMask;  // Stored before the key.
+    LONG                        m_lConsumerFormatKey;   // Consumer-owned.
+
+    // Consumer-owned conversion state.
+    CResampler                  m_Resampler;
+    eResamplerQuality           m_eResamplerQuality;
+    PVOID                       m_pResamplerStorage;
+    PBYTE                       m_pResamplerInput;      // RESAMPLER_BLOCK_FRAMES render frames.
+    PBYTE                       m_pResamplerMixed;      // The same frames in the capture layout.
+    CSampleConverter            m_Converter;
+    LONG                        m_lConverterRenderKey;  // Keys m_Converter was set up for.
+    LONG                        m_lConverterCaptureKey;
+    LONG                        m_lResamplerRenderKey;  // Keys m_Resampler was set up for.
+    LONG                        m_lResamplerCaptureKey;
+    ULONG                       m_ulResamplerRenderMask;
+    ULONG                       m_ulResamplerCaptureMask;
+    CChannelMixer               m_ResamplerMixer;       // Ahead of m_Resampler when the layouts differ.
+    CSampleConverter            m_ResamplerConverter;   // After it when the sample formats differ.
+    CChannelMatrixCache         m_Matrices;
+    CChannelMixer               m_Mixer;
+    LONG                        m_lMixerRenderKey;      // Keys and masks m_Mixer was set up for.
+    LONG                        m_lMixerCaptureKey;
+    ULONG                       m_ulMixerRenderMask;
+    ULONG                       m_ulMixerCaptureMask;
+    CDriftController            m_Drift;
+    BOOL                        m_bDriftCompensation;   // Also for matching formats.
+    BOOL                        m_bPrimed;              // Queue has reached the target.
+    ULONG                       m_ulTargetFrames;
+
+public:
+    CLoopbackCable();
+    ~CLoopbackCable();
+
+    NTSTATUS Init
+    (
+        _In_ ULONG          ulResamplerQuality,
+        _In_ BOOL           bDriftCompensation
+    );
+
+    static LONG MakeFormatKey
+    (
+        _In_ PWAVEFORMATEX  pWfEx
+    );
+
+    static ULONG GetChannelMask
+    (
+        _In_ PWAVEFORMATEX  pWfEx
+    );
+
+    //
+    // Producer (render stream).
+    //
+    VOID ConnectRender
+    (
+        _In_ PWAVEFORMATEX  pWfEx
+    );
+
+    VOID DisconnectRender();
+
+    VOID Write
+    (
+        _In_reads_bytes_(cbData) PBYTE  pData,
+        _In_ ULONG                      cbData
+    );
+
+    //
+    // Consumer (capture stream).
+    //
+    VOID ResetCapture();
+
+    VOID Read
+    (
+        _In_ LONG                       lCaptureFormatKey,
+        _In_ ULONG                      ulCaptureChannelMask,
+        _In_ ULONG                      ulFrameBytes,
+        _Out_writes_bytes_(cbData) PBYTE pData,
+        _In_ ULONG                      cbData
+    );
+
+protected:
+    ULONG ReadRemixed
+    (
+        _In_ LONG                       lRenderFormatKey,
+        _In_ LONG                       lCaptureFormatKey,
+        _In_ ULONG                      ulCaptureChannelMask,
+        _Out_writes_bytes_(cbData) PBYTE pData,
+        _In_ ULONG                      cbData
+    );
+
+    ULONG ReadReformatted
+    (
+        _In_ LONG                       lRenderFormatKey,
+        _In_ LONG                       lCaptureFormatKey,
+        _Out_writes_bytes_(cbData) PBYTE pData,
+        _In_ ULONG                      cbData
+    );
+
+    ULONG ReadConverted
+    (
+        _In_ LONG                       lRenderFormatKey,
+        _In_ LONG                       lCaptureFormatKey,
+        _In_ ULONG                      ulCaptureChannelMask,
+        _Out_writes_bytes_(cbData) PBYTE pData,
+        _In_ ULONG                      cbData
+    );
+};
+typedef CLoopbackCable *PCLoopbackCable;
+
+#endif // _VIRTUALAUDIODRIVER_LOOPBACK_H_
@@ -0,0 +1,372 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    loopbackring.h
+
+Abstract:
+
+    Lock-free single-producer/single-consumer byte ring used by the
+    speaker-to-microphone loopback and by the render data file writer. The
+    producer only ever commits whole audio frames, so the consumer can hand
+    out whole frames without any knowledge of where the producer's DMA runs
+    were split.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_LOOPBACKRING_H_
+#define _VIRTUALAUDIODRIVER_LOOPBACKRING_H_
+
+#include "portable.h"
+
+// Largest frame the producer stages: 8 channels of 32-bit samples.
+#define LOOPBACK_MAX_FRAME_BYTES    (8 * sizeof(LONG))
+
+///////////////////////////////////////////////////////////////////////////////
+// CLoopbackRing
+//
+//   m_ulWriteIndex is only written by the producer and m_ulReadIndex only by
+//   the consumer. Both are free-running and wrap at 2^32; the capacity is a
+//   power of two so (index & m_ulMask) addresses the storage.
+//
+class CLoopbackRing
+{
+protected:
+    PBYTE                       m_pBuffer;
+    ULONG                       m_ulCapacity;
+    ULONG                       m_ulMask;
+    volatile ULONG              m_ulWriteIndex;
+    volatile ULONG              m_ulReadIndex;
+
+    // Producer-owned state.
+    ULONG                       m_ulFrameBytes;
+    ULONG                       m_ulStagedBytes;
+    BYTE                        m_Stage[LOOPBACK_MAX_FRAME_BYTES];
+    ULONGLONG                   m_ullCommittedBytes;
+    volatile ULONGLONG          m_ullDroppedBytes;
+
+    // Consumer-owned state.
+    volatile ULONGLONG          m_ullUnderrunBytes;
+
+public:
+    CLoopbackRing() :
+        m_pBuffer(NULL),
+        m_ulCapacity(0),
+        m_ulMask(0),
+        m_ulWriteIndex(0),
+        m_ulReadIndex(0),
+        m_ulFrameBytes(1),
+        m_ulStagedBytes(0),
+        m_ullCommittedBytes(0),
+        m_ullDroppedBytes(0),
+        m_ullUnderrunBytes(0)
+    {
+    }
+
+    //=========================================================================
+    // Attach
+    //
+    //   Binds caller-owned storage. ulCapacity must be a power of two. Must
+    //   not race with either side.
+    //
+    BOOL Attach
+    (
+        _In_ PBYTE  pBuffer,
+        _In_ ULONG  ulCapacity
+    )
+    {
+        if (pBuffer == NULL || ulCapacity == 0 || (ulCapacity & (ulCapacity - 1)) != 0)
+        {
+            return FALSE;
+        }
+
+        m_pBuffer = pBuffer;
+        m_ulCapacity = ulCapacity;
+        m_ulMask = ulCapacity - 1;
+        m_ulWriteIndex = 0;
+        m_ulReadIndex = 0;
+        m_ulStagedBytes = 0;
+        m_ullCommittedBytes = 0;
+        m_ullDroppedBytes = 0;
+        m_ullUnderrunBytes = 0;
+
+        return TRUE;
+    }
+
+    ULONG GetCapacity() const
+    {
+        return m_ulCapacity;
+    }
+
+    ULONG GetBytesAvailable() const
+    {
+        return m_ulWriteIndex - m_ulReadIndex;
+    }
+
+    //
+    // Bytes committed since Attach, without wrapping. Producer only.
+    //
+    ULONGLONG GetBytesCommitted() const
+    {
+        return m_ullCommittedBytes;
+    }
+
+    ULONGLONG GetDroppedBytes() const
+    {
+        return m_ullDroppedBytes;
+    }
+
+    ULONGLONG GetUnderrunBytes() const
+    {
+        return m_ullUnderrunBytes;
+    }
+
+    //=========================================================================
+    // Producer side
+    //=========================================================================
+
+    //
+    // Starts a new producer session with the given frame size. Any partially
+    // staged frame of the previous session is thrown away.
+    //
+    VOID BeginProducerSession
+    (
+        _In_ ULONG  ulFrameBytes
+    )
+    {
+        if (ulFrameBytes == 0 || ulFrameBytes > LOOPBACK_MAX_FRAME_BYTES)
+        {
+            ulFrameBytes = 1;
+        }
+
+        m_ulFrameBytes = ulFrameBytes;
+        m_ulStagedBytes = 0;
+    }
+
+    //
+    // Appends cbData bytes of producer stream. Whole frames are committed;
+    // the trailing partial frame is staged until the next call. Frames that
+    // do not fit are dropped whole. Returns the number of bytes dropped.
+    //
+    ULONG Write
+    (
+        _In_reads_bytes_(cbData) const BYTE *   pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG ulDropped = 0;
+
+        if (m_pBuffer == NULL)
+        {
+            return cbData;
+        }
+
+        // Complete a frame left over from the previous call first.
+        if (m_ulStagedBytes > 0)
+        {
+            ULONG cbFill = m_ulFrameBytes - m_ulStagedBytes;
+            if (cbFill > cbData)
+            {
+                cbFill = cbData;
+            }
+
+            RtlCopyMemory(m_Stage + m_ulStagedBytes, pData, cbFill);
+            m_ulStagedBytes += cbFill;
+            pData += cbFill;
+            cbData -= cbFill;
+
+            if (m_ulStagedBytes < m_ulFrameBytes)
+            {
+                return 0;
+            }
+
+            if (Commit(m_Stage, m_ulFrameBytes) == 0)
+            {
+                ulDropped += m_ulFrameBytes;
+            }
+            m_ulStagedBytes = 0;
+        }
+
+        ULONG cbFrames = cbData - (cbData % m_ulFrameBytes);
+        ULONG cbCommitted = Commit(pData, cbFrames);
+        ulDropped += cbFrames - cbCommitted;
+
+        m_ulStagedBytes = cbData - cbFrames;
+        RtlCopyMemory(m_Stage, pData + cbFrames, m_ulStagedBytes);
+
+        if (ulDropped > 0)
+        {
+            m_ullDroppedBytes += ulDropped;
+        }
+
+        return ulDropped;
+    }
+
+    //=========================================================================
+    // Consumer side
+    //=========================================================================
+
+    //
+    // Copies up to cbData bytes, rounded down to whole ulFrameBytes frames,
+    // into pData. Returns the number of bytes copied; the shortfall is
+    // accounted as underrun.
+    //
+    ULONG Read
+    (
+        _Out_writes_bytes_to_(cbData, return) PBYTE pData,
+        _In_ ULONG                                  cbData,
+        _In_ ULONG                                  ulFrameBytes
+    )
+    {
+        if (m_pBuffer == NULL || ulFrameBytes == 0)
+        {
+            return 0;
+        }
+
+        ULONG ulRead = m_ulReadIndex;
+        ULONG ulWrite = m_ulWriteIndex;
+
+        // Pairs with the barrier in Commit: payload is visible once the
+        // index is.
+        VAD_MEMORY_BARRIER();
+
+        ULONG cbAvailable = ulWrite - ulRead;
+        ULONG cbCopy = (cbData < cbAvailable) ? cbData : cbAvailable;
+        cbCopy -= cbCopy % ulFrameBytes;
+
+        ULONG ulOffset = ulRead & m_ulMask;
+        ULONG cbFirst = m_ulCapacity - ulOffset;
+        if (cbFirst > cbCopy)
+        {
+            cbFirst = cbCopy;
+        }
+
+        RtlCopyMemory(pData, m_pBuffer + ulOffset, cbFirst);
+        RtlCopyMemory(pData + cbFirst, m_pBuffer, cbCopy - cbFirst);
+
+        // The copy must complete before the producer may reuse the space.
+        VAD_MEMORY_BARRIER();
+        m_ulReadIndex = ulRead + cbCopy;
+
+        if (cbCopy < cbData)
+        {
+            m_ullUnderrunBytes += cbData - cbCopy;
+        }
+
+        return cbCopy;
+    }
+
+    //
+    // Zero-copy access for consumers that hand the data on in place: returns
+    // the number of committed bytes readable contiguously at *ppData (at
+    // most cbMax). Nothing is consumed until Release.
+    //
+    ULONG Peek
+    (
+        _Out_ PBYTE *   ppData,
+        _In_ ULONG      cbMax
+    )
+    {
+        *ppData = NULL;
+
+        if (m_pBuffer == NULL)
+        {
+            return 0;
+        }
+
+        ULONG ulRead = m_ulReadIndex;
+        ULONG ulWrite = m_ulWriteIndex;
+
+        // Pairs with the barrier in Commit.
+        VAD_MEMORY_BARRIER();
+
+        ULONG ulOffset = ulRead & m_ulMask;
+        ULONG cbContiguous = ulWrite - ulRead;
+
+        if (cbContiguous > m_ulCapacity - ulOffset)
+        {
+            cbContiguous = m_ulCapacity - ulOffset;
+        }
+        if (cbContiguous > cbMax)
+        {
+            cbContiguous = cbMax;
+        }
+
+        *ppData = m_pBuffer + ulOffset;
+        return cbContiguous;
+    }
+
+    //
+    // Consumes cbData bytes returned by Peek.
+    //
+    VOID Release
+    (
+        _In_ ULONG      cbData
+    )
+    {
+        // The consumer must be done with the bytes before the producer may
+        // reuse the space.
+        VAD_MEMORY_BARRIER();
+        m_ulReadIndex = m_ulReadIndex + cbData;
+    }
+
+    //
+    // Drops everything the producer has committed so far. Consumer only.
+    //
+    VOID Discard()
+    {
+        ULONG ulWrite = m_ulWriteIndex;
+        VAD_MEMORY_BARRIER();
+        m_ulReadIndex = ulWrite;
+    }
+
+protected:
+    //
+    // Commits as many whole frames of pData as fit and returns the number of
+    // bytes committed. Frames never straddle a drop.
+    //
+    ULONG Commit
+    (
+        _In_reads_bytes_(cbData) const BYTE *   pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG ulWrite = m_ulWriteIndex;
+        ULONG ulRead = m_ulReadIndex;
+
+        VAD_MEMORY_BARRIER();
+
+        ULONG cbSpace = m_ulCapacity - (ulWrite - ulRead);
+        if (cbData > cbSpace)
+        {
+            // Keep as many whole frames as fit.
+            cbData = cbSpace - (cbSpace % m_ulFrameBytes);
+        }
+
+        if (cbData == 0)
+        {
+            return 0;
+        }
+
+        ULONG ulOffset = ulWrite & m_ulMask;
+        ULONG cbFirst = m_ulCapacity - ulOffset;
+        if (cbFirst > cbData)
+        {
+            cbFirst = cbData;
+        }
+
+        RtlCopyMemory(m_pBuffer + ulOffset, pData, cbFirst);
+        RtlCopyMemory(m_pBuffer, pData + cbFirst, cbData - cbFirst);
+
+        VAD_MEMORY_BARRIER();
+        m_ulWriteIndex = ulWrite + cbData;
+        m_ullCommittedBytes += cbData;
+
+        return cbData;
+    }
+};
+
+typedef CLoopbackRing *PCLoopbackRing;
+
+#endif // _VIRTUALAUDIODRIVER_LOOPBACKRING_H_
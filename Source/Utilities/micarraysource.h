@@ -0,0 +1,557 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    micarraysource.h
+
+Abstract:
+
+    Spatial source simulator for the mic array: renders one far field
+    source, from a virtual direction, to each microphone of the advertised
+    geometry (KSAUDIO_MIC_ARRAY_GEOMETRY).
+
+    - The source is the average of the stream's channels, arriving as a
+      plane wave. Each microphone hears it late by its distance behind the
+      nearest one along the direction of arrival, over the speed of sound,
+      and scaled by its polar pattern (a + (1 - a) cos) towards the source.
+    - Each delay is a windowed sinc fractional delay filter of
+      MIC_SOURCE_FILTER_TAPS taps (the resampler's sinc and window, see
+      resampler.h), shifted to start at the whole part of the delay. All
+      microphones' filters span the same taps and are interleaved tap by
+      tap, so one pass over the source history accumulates every channel
+      from the same sample.
+    - The geometry and direction are fixed while streaming, so the filters
+      are built once by Init; the trigonometry runs in fixed point there.
+
+    The output lags the source by MIC_SOURCE_FILTER_TAPS / 2 frames.
+    Samples run in fixed point (see fixedsample.h).
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_MICARRAYSOURCE_H_
+#define _VIRTUALAUDIODRIVER_MICARRAYSOURCE_H_
+
+#include "portable.h"
+#include "fixedsample.h"
+#include "resampler.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+#define MIC_SOURCE_MAX_MICS         8
+
+// Taps of one fractional delay filter, and of the span every microphone's
+// filter has to fit in with its whole delay: at 192 kHz that is an
+// aperture of about 0.4 m.
+#define MIC_SOURCE_FILTER_TAPS      16
+#define MIC_SOURCE_MAX_TAPS         256
+
+// Filter passband, Q30 of the Nyquist rate.
+#define MIC_SOURCE_CUTOFF           ((LONG)(0.9 * (1L << 30)))
+
+// Speed of sound, mm/s.
+#define MIC_SOURCE_SOUND_SPEED      343000
+
+// Geometry angles are in 1/10000 radians; this converts whole degrees.
+#define MIC_SOURCE_DEGREES(d)       ((LONG)(((LONGLONG)(d) * 174533) / 1000))
+
+// Directions are unit vectors and gains are in Q30; delays are in Q20
+// frames.
+#define MIC_SOURCE_UNIT_SHIFT       30
+#define MIC_SOURCE_DELAY_SHIFT      20
+
+//
+// Omnidirectional part a of each KSMICARRAY_MICTYPE polar pattern,
+// a + (1 - a) cos, in Q30. Vendor defined patterns are taken as
+// omnidirectional.
+//
+#define MIC_SOURCE_PATTERNS         6
+
+const LONG g_MicSourcePatterns[MIC_SOURCE_PATTERNS] =
+{
+    (LONG)(1.00 * (1L << 30)),      // Omnidirectional.
+    (LONG)(0.70 * (1L << 30)),      // Subcardioid.
+    (LONG)(0.50 * (1L << 30)),      // Cardioid.
+    (LONG)(0.37 * (1L << 30)),      // Supercardioid.
+    (LONG)(0.25 * (1L << 30)),      // Hypercardioid.
+    0,                              // Figure eight.
+};
+
+//
+// One microphone, as in KSAUDIO_MICROPHONE_COORDINATES: its pattern
+// (KSMICARRAY_MICTYPE), position in mm and the direction it faces.
+//
+typedef struct _MIC_SOURCE_ELEMENT
+{
+    ULONG       ulType;
+    LONG        lX;
+    LONG        lY;
+    LONG        lZ;
+    LONG        lVerticalAngle;     // 1/10000 radians.
+    LONG        lHorizontalAngle;   // 1/10000 radians.
+} MIC_SOURCE_ELEMENT;
+typedef MIC_SOURCE_ELEMENT *PMIC_SOURCE_ELEMENT;
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+//
+// sin and cos of lAngle, in 1/10000 radians, in Q30. The angle is folded
+// to within a quarter turn of 0, where the Taylor series converge fast.
+//
+inline VOID MicSourceSinCos
+(
+    _In_ LONG       lAngle,
+    _Out_ PLONG     plSin,
+    _Out_ PLONG     plCos
+)
+{
+    const LONGLONG One = 1LL << MIC_SOURCE_UNIT_SHIFT;
+    const LONGLONG Pi = 3373259426LL;
+    LONGLONG x = ((LONGLONG)lAngle << MIC_SOURCE_UNIT_SHIFT) / 10000;
+    LONGLONG llTerm = One;
+    LONGLONG llSin = 0;
+    LONGLONG llCos = 0;
+    BOOL bFlip = FALSE;
+
+    x %= 2 * Pi;
+    x = x > Pi ? x - 2 * Pi : x < -Pi ? x + 2 * Pi : x;
+
+    // sin(pi - x) = sin x and cos(pi - x) = -cos x.
+    if (x > Pi / 2)
+    {
+        x = Pi - x;
+        bFlip = TRUE;
+    }
+    else if (x < -Pi / 2)
+    {
+        x = -Pi - x;
+        bFlip = TRUE;
+    }
+
+    for (ULONG k = 0; k < 16; k++)
+    {
+        if (k % 2 == 0)
+        {
+            llCos += (k % 4 == 0) ? llTerm : -llTerm;
+        }
+        else
+        {
+            llSin += (k % 4 == 1) ? llTerm : -llTerm;
+        }
+        llTerm = llTerm * x / One / (LONGLONG)(k + 1);
+    }
+
+    *plSin = (LONG)(llSin > One ? One : llSin < -One ? -One : llSin);
+    llCos = bFlip ? -llCos : llCos;
+    *plCos = (LONG)(llCos > One ? One : llCos < -One ? -One : llCos);
+}
+
+//
+// Unit vector, Q30, towards the elevation and azimuth given in 1/10000
+// radians: x ahead, y to the left, z up.
+//
+inline VOID MicSourceDirection
+(
+    _In_ LONG       lVerticalAngle,
+    _In_ LONG       lHorizontalAngle,
+    _Out_ LONG      lDirection[3]
+)
+{
+    LONG lSinV, lCosV, lSinH, lCosH;
+
+    MicSourceSinCos(lVerticalAngle, &lSinV, &lCosV);
+    MicSourceSinCos(lHorizontalAngle, &lSinH, &lCosH);
+
+    lDirection[0] = (LONG)(((LONGLONG)lCosV * lCosH) >> MIC_SOURCE_UNIT_SHIFT);
+    lDirection[1] = (LONG)(((LONGLONG)lCosV * lSinH) >> MIC_SOURCE_UNIT_SHIFT);
+    lDirection[2] = lSinV;
+}
+
+//=============================================================================
+// Format kernels
+//=============================================================================
+
+//
+// Render replaces ulFrames frames of pData in place. Each frame's source
+// sample is written twice to the history, MIC_SOURCE_MAX_TAPS apart, so
+// the newest ulTaps samples are always contiguous; plTaps holds ulTaps
+// rows of one Q30 tap per channel.
+//
+typedef VOID MIC_SOURCE_RENDER_ROUTINE
+(
+    _Inout_ PBYTE       pData,
+    _In_ ULONG          ulFrames,
+    _Inout_ PLONG       plHistory,
+    _Inout_ PULONG      pulPosition,
+    _In_ const LONG *   plTaps,
+    _In_ ULONG          ulTaps
+);
+typedef MIC_SOURCE_RENDER_ROUTINE *PFN_MIC_SOURCE_RENDER;
+
+typedef struct _MIC_SOURCE_IO
+{
+    PFN_MIC_SOURCE_RENDER   pfnRender;
+    ULONG                   ulFrameBytes;
+} MIC_SOURCE_IO;
+typedef MIC_SOURCE_IO *PMIC_SOURCE_IO;
+
+///////////////////////////////////////////////////////////////////////////////
+// MicSourceIo
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct MicSourceIo
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG FrameBytes = SampleBytes * Channels;
+
+    static VOID Render
+    (
+        _Inout_ PBYTE       pData,
+        _In_ ULONG          ulFrames,
+        _Inout_ PLONG       plHistory,
+        _Inout_ PULONG      pulPosition,
+        _In_ const LONG *   plTaps,
+        _In_ ULONG          ulTaps
+    )
+    {
+        ULONG ulPosition = *pulPosition;
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            LONGLONG llSource = 0;
+            LONGLONG llAcc[Channels];
+            const LONG * plNewest;
+
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                llSource += FixedSample<Bits, Float>::Load(pData + c * SampleBytes);
+                llAcc[c] = 0;
+            }
+
+            ulPosition = (ulPosition + 1) % MIC_SOURCE_MAX_TAPS;
+            plHistory[ulPosition] = (LONG)(llSource / (LONG)Channels);
+            plHistory[ulPosition + MIC_SOURCE_MAX_TAPS] = plHistory[ulPosition];
+            plNewest = plHistory + ulPosition + MIC_SOURCE_MAX_TAPS;
+
+            for (ULONG t = 0; t < ulTaps; t++)
+            {
+                LONGLONG llSample = plNewest[-(LONG)t];
+                const LONG * plRow = plTaps + t * Channels;
+
+                for (ULONG c = 0; c < Channels; c++)
+                {
+                    llAcc[c] += llSample * plRow[c];
+                }
+            }
+
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                FixedSample<Bits, Float>::Store(pData + c * SampleBytes,
+                                                FixedSaturate(llAcc[c] >> MIC_SOURCE_UNIT_SHIFT));
+            }
+            pData += FrameBytes;
+        }
+
+        *pulPosition = ulPosition;
+    }
+};
+
+template <ULONG Bits, ULONG Channels, BOOL Float>
+VOID SetMicSourceIo
+(
+    _Out_ PMIC_SOURCE_IO    pIo
+)
+{
+    pIo->pfnRender = MicSourceIo<Bits, Channels, Float>::Render;
+    pIo->ulFrameBytes = MicSourceIo<Bits, Channels, Float>::FrameBytes;
+}
+
+template <ULONG Bits, BOOL Float>
+BOOL SelectMicSourceIo
+(
+    _In_ ULONG              ulChannels,
+    _Out_ PMIC_SOURCE_IO    pIo
+)
+{
+    switch (ulChannels)
+    {
+        case 1: SetMicSourceIo<Bits, 1, Float>(pIo); return TRUE;
+        case 2: SetMicSourceIo<Bits, 2, Float>(pIo); return TRUE;
+        case 3: SetMicSourceIo<Bits, 3, Float>(pIo); return TRUE;
+        case 4: SetMicSourceIo<Bits, 4, Float>(pIo); return TRUE;
+        case 5: SetMicSourceIo<Bits, 5, Float>(pIo); return TRUE;
+        case 6: SetMicSourceIo<Bits, 6, Float>(pIo); return TRUE;
+        case 7: SetMicSourceIo<Bits, 7, Float>(pIo); return TRUE;
+        case 8: SetMicSourceIo<Bits, 8, Float>(pIo); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Picks the instance for a stream format: 8/16/24/32-bit PCM and 32-bit
+// float with 1 to MIC_SOURCE_MAX_MICS channels. Returns FALSE otherwise.
+//
+inline BOOL GetMicSourceIo
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat,
+    _Out_ PMIC_SOURCE_IO    pIo
+)
+{
+    RtlZeroMemory(pIo, sizeof(*pIo));
+
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectMicSourceIo<32, TRUE>(ulChannels, pIo) : FALSE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectMicSourceIo<8, FALSE>(ulChannels, pIo);
+        case 16: return SelectMicSourceIo<16, FALSE>(ulChannels, pIo);
+        case 24: return SelectMicSourceIo<24, FALSE>(ulChannels, pIo);
+        case 32: return SelectMicSourceIo<32, FALSE>(ulChannels, pIo);
+    }
+
+    return FALSE;
+}
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CMicArraySource
+//
+//   Owned by one capture stream and only touched from its position update.
+//
+class CMicArraySource
+{
+protected:
+    MIC_SOURCE_IO               m_Io;
+    ULONG                       m_ulMics;
+    ULONG                       m_ulTaps;               // Span of the filters.
+    ULONG                       m_ulPosition;           // Newest sample in m_plHistory.
+    PLONG                       m_plTaps;               // [m_ulTaps][m_ulMics], Q30.
+    PLONG                       m_plHistory;            // 2 * MIC_SOURCE_MAX_TAPS source samples.
+    LONG                        m_lDelay[MIC_SOURCE_MAX_MICS]; // Q20 frames.
+    LONG                        m_lGain[MIC_SOURCE_MAX_MICS];  // Q30.
+
+public:
+    CMicArraySource() :
+        m_ulMics(0),
+        m_ulTaps(0),
+        m_ulPosition(0),
+        m_plTaps(NULL),
+        m_plHistory(NULL)
+    {
+        RtlZeroMemory(&m_Io, sizeof(m_Io));
+        RtlZeroMemory(m_lDelay, sizeof(m_lDelay));
+        RtlZeroMemory(m_lGain, sizeof(m_lGain));
+    }
+
+    //
+    // Bytes of state Init needs, 0 if the microphone count is not
+    // supported.
+    //
+    static ULONG GetStorageBytes
+    (
+        _In_ ULONG      ulMics
+    )
+    {
+        if (ulMics == 0 || ulMics > MIC_SOURCE_MAX_MICS)
+        {
+            return 0;
+        }
+
+        return (MIC_SOURCE_MAX_TAPS * ulMics + 2 * MIC_SOURCE_MAX_TAPS) * sizeof(LONG);
+    }
+
+    //
+    // Binds pStorage, at least GetStorageBytes bytes, as the state and
+    // builds each microphone's filter for a source at lVerticalAngle and
+    // lHorizontalAngle (1/10000 radians). There is one channel per element
+    // of pElements. Returns FALSE for formats it does not cover and arrays
+    // too wide for MIC_SOURCE_MAX_TAPS at this rate.
+    //
+    BOOL Init
+    (
+        _In_ ULONG                          ulSampleRate,
+        _In_ ULONG                          ulBitsPerSample,
+        _In_ BOOL                           bFloat,
+        _In_reads_(ulMics) const MIC_SOURCE_ELEMENT * pElements,
+        _In_ ULONG                          ulMics,
+        _In_ LONG                           lVerticalAngle,
+        _In_ LONG                           lHorizontalAngle,
+        _In_ PVOID                          pStorage,
+        _In_ ULONG                          cbStorage
+    )
+    {
+        ULONG cbNeeded = GetStorageBytes(ulMics);
+        LONG lSource[3];
+        LONGLONG llDistance[MIC_SOURCE_MAX_MICS];
+        LONGLONG llNearest = 0;
+        LONG lLatest = 0;
+
+        if (cbNeeded == 0 || pStorage == NULL || cbStorage < cbNeeded || ulSampleRate == 0 ||
+            !GetMicSourceIo(ulBitsPerSample, ulMics, bFloat, &m_Io))
+        {
+            RtlZeroMemory(&m_Io, sizeof(m_Io));
+            return FALSE;
+        }
+
+        //
+        // Each microphone's distance along the direction of arrival (mm,
+        // Q30) and its pattern's gain towards the source.
+        //
+        MicSourceDirection(lVerticalAngle, lHorizontalAngle, lSource);
+        for (ULONG m = 0; m < ulMics; m++)
+        {
+            const MIC_SOURCE_ELEMENT & element = pElements[m];
+            LONG lFacing[3];
+            LONG lOmni = element.ulType < MIC_SOURCE_PATTERNS ? g_MicSourcePatterns[element.ulType] :
+                                                                g_MicSourcePatterns[0];
+            LONGLONG llCos;
+
+            llDistance[m] = (LONGLONG)element.lX * lSource[0] +
+                            (LONGLONG)element.lY * lSource[1] +
+                            (LONGLONG)element.lZ * lSource[2];
+            llNearest = (m == 0 || llDistance[m] > llNearest) ? llDistance[m] : llNearest;
+
+            MicSourceDirection(element.lVerticalAngle, element.lHorizontalAngle, lFacing);
+            llCos = ((LONGLONG)lFacing[0] * lSource[0] +
+                     (LONGLONG)lFacing[1] * lSource[1] +
+                     (LONGLONG)lFacing[2] * lSource[2]) >> MIC_SOURCE_UNIT_SHIFT;
+            m_lGain[m] = (LONG)(lOmni + (((1LL << MIC_SOURCE_UNIT_SHIFT) - lOmni) * llCos >> MIC_SOURCE_UNIT_SHIFT));
+        }
+
+        // The nearest microphone hears the wave first.
+        for (ULONG m = 0; m < ulMics; m++)
+        {
+            LONGLONG llBehind = (llNearest - llDistance[m]) >> (MIC_SOURCE_UNIT_SHIFT - MIC_SOURCE_DELAY_SHIFT);
+
+            llBehind = llBehind * ulSampleRate / MIC_SOURCE_SOUND_SPEED;
+            llBehind = llBehind < ((LONGLONG)MIC_SOURCE_MAX_TAPS << MIC_SOURCE_DELAY_SHIFT) ? llBehind :
+                       ((LONGLONG)MIC_SOURCE_MAX_TAPS << MIC_SOURCE_DELAY_SHIFT);
+            m_lDelay[m] = (LONG)llBehind;
+            lLatest = m_lDelay[m] > lLatest ? m_lDelay[m] : lLatest;
+        }
+
+        m_ulTaps = (ULONG)(lLatest >> MIC_SOURCE_DELAY_SHIFT) + MIC_SOURCE_FILTER_TAPS + 1;
+        if (m_ulTaps > MIC_SOURCE_MAX_TAPS)
+        {
+            RtlZeroMemory(&m_Io, sizeof(m_Io));
+            return FALSE;
+        }
+
+        m_ulMics = ulMics;
+        m_plTaps = (PLONG)pStorage;
+        m_plHistory = m_plTaps + MIC_SOURCE_MAX_TAPS * ulMics;
+
+        for (ULONG m = 0; m < ulMics; m++)
+        {
+            BuildFilter(m);
+        }
+
+        Reset();
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_Io.pfnRender != NULL;
+    }
+
+    //
+    // A microphone's delay behind the nearest one, Q20 frames, and its
+    // gain, Q30.
+    //
+    LONG GetDelay(_In_ ULONG ulMic) const
+    {
+        return ulMic < m_ulMics ? m_lDelay[ulMic] : 0;
+    }
+
+    LONG GetGain(_In_ ULONG ulMic) const
+    {
+        return ulMic < m_ulMics ? m_lGain[ulMic] : 0;
+    }
+
+    //
+    // Forgets the source history.
+    //
+    VOID Reset()
+    {
+        if (m_plHistory != NULL)
+        {
+            RtlZeroMemory(m_plHistory, 2 * MIC_SOURCE_MAX_TAPS * sizeof(LONG));
+        }
+        m_ulPosition = 0;
+    }
+
+    //
+    // Replaces the whole frames of pData with what each microphone hears
+    // of their average.
+    //
+    VOID Process
+    (
+        _Inout_updates_bytes_(cbData) PBYTE     pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        if (IsActive())
+        {
+            m_Io.pfnRender(pData, cbData / m_Io.ulFrameBytes, m_plHistory, &m_ulPosition, m_plTaps, m_ulTaps);
+        }
+    }
+
+private:
+    //
+    // Windowed sinc centred MIC_SOURCE_FILTER_TAPS / 2 frames after the
+    // microphone's delay, normalized to unit DC gain and then scaled by the
+    // pattern's gain, into its column of m_plTaps.
+    //
+    VOID BuildFilter
+    (
+        _In_ ULONG      ulMic
+    )
+    {
+        const LONG lHalf = MIC_SOURCE_FILTER_TAPS / 2;
+        LONGLONG llCentre = (LONGLONG)m_lDelay[ulMic] + ((LONGLONG)lHalf << MIC_SOURCE_DELAY_SHIFT);
+        LONGLONG llSum = 0;
+
+        for (ULONG t = 0; t < m_ulTaps; t++)
+        {
+            // Filter time in Q20 frames.
+            LONGLONG llTime = ((LONGLONG)t << MIC_SOURCE_DELAY_SHIFT) - llCentre;
+            LONG lTap = 0;
+
+            llTime = llTime < 0 ? -llTime : llTime;
+            if (llTime < ((LONGLONG)lHalf << MIC_SOURCE_DELAY_SHIFT))
+            {
+                LONGLONG llSinc = ResamplerLookup(g_ResamplerSinc.Value, RESAMPLER_SINC_ENTRIES,
+                                                  ((llTime * MIC_SOURCE_CUTOFF) >> RESAMPLER_COEFFICIENT_SHIFT) * RESAMPLER_SINC_STEPS);
+                LONGLONG llWindow = ResamplerLookup(g_ResamplerWindow.Value, RESAMPLER_WINDOW_STEPS,
+                                                    llTime * RESAMPLER_WINDOW_STEPS / lHalf);
+
+                lTap = (LONG)((((llSinc * MIC_SOURCE_CUTOFF) >> RESAMPLER_COEFFICIENT_SHIFT) * llWindow) >> RESAMPLER_COEFFICIENT_SHIFT);
+            }
+            m_plTaps[t * m_ulMics + ulMic] = lTap;
+            llSum += lTap;
+        }
+
+        for (ULONG t = 0; t < m_ulTaps && llSum > 0; t++)
+        {
+            LONGLONG llTap = ((LONGLONG)m_plTaps[t * m_ulMics + ulMic] << MIC_SOURCE_UNIT_SHIFT) / llSum;
+
+            m_plTaps[t * m_ulMics + ulMic] = (LONG)((llTap * m_lGain[ulMic]) >> MIC_SOURCE_UNIT_SHIFT);
+        }
+    }
+};
+typedef CMicArraySource *PCMicArraySource;
+
+#endif // _VIRTUALAUDIODRIVER_MICARRAYSOURCE_H_
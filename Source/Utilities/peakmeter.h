@@ -0,0 +1,443 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    peakmeter.h
+
+Abstract:
+
+    Per-channel level metering of stream audio. PeakMeterScan<Bits,
+    Channels, Float> finds the largest magnitude and the energy of each
+    channel in a run of frames; the loops have the container size and
+    channel count fixed at compile time and carry no branches, so the
+    compiler vectorizes them. CPeakMeter applies meter ballistics to the
+    scans and produces the levels the topology peak meter nodes report.
+
+    Levels are Q31 magnitudes (full scale = 0x7FFFFFFF), the range
+    KSPROPERTY_AUDIO_PEAKMETER2 reports in:
+
+    - Peak: sample peak with instant attack and a release that falls
+      linearly in dB, 20 dB in 1.7 s (IEC 60268-10 type I).
+    - RMS: the mean square smoothed with a 300 ms time constant.
+
+    Everything is integer arithmetic, so no caller needs the floating point
+    state saved.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_PEAKMETER_H_
+#define _VIRTUALAUDIODRIVER_PEAKMETER_H_
+
+#include "portable.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Largest channel count that is metered (7.1).
+#define PEAK_METER_MAX_CHANNELS     8
+
+#define PEAK_METER_Q31_MAX          0x7FFFFFFFUL
+#define PEAK_METER_Q30_ONE          (1UL << 30)
+
+// 2^30 * ln(10) / 1.7 s: per-frame release of 20 dB in 1.7 s is
+// exp(-this / 2^30 / SampleRate).
+#define PEAK_METER_RELEASE_RATE     1454342305ULL
+
+// 2^30 / 0.3 s: per-frame RMS smoothing for a 300 ms time constant.
+#define PEAK_METER_RMS_RATE         3579139413ULL
+
+typedef struct _PEAK_METER_LEVELS
+{
+    ULONG       ulChannels;
+    LONG        lPeak[PEAK_METER_MAX_CHANNELS];
+    LONG        lRms[PEAK_METER_MAX_CHANNELS];
+} PEAK_METER_LEVELS;
+typedef PEAK_METER_LEVELS *PPEAK_METER_LEVELS;
+
+//
+// Scans ulFrames frames of pBuffer. For each channel, raises pulPeak to the
+// largest Q31 magnitude seen and adds the sum of the squared Q15 magnitudes
+// to pullEnergy.
+//
+typedef VOID PEAK_METER_SCAN_ROUTINE
+(
+    _In_ const BYTE *   pBuffer,
+    _In_ ULONG          ulFrames,
+    _Inout_ ULONG *     pulPeak,
+    _Inout_ ULONGLONG * pullEnergy
+);
+typedef PEAK_METER_SCAN_ROUTINE *PFN_PEAK_METER_SCAN;
+
+///////////////////////////////////////////////////////////////////////////////
+// PeakMeterSample
+//
+//   Q31 magnitude of one sample. Negative full scale and float values
+//   outside [-1, 1] read as PEAK_METER_Q31_MAX.
+//
+template <ULONG Bits, BOOL Float>
+struct PeakMeterSample;
+
+template <>
+struct PeakMeterSample<8, FALSE>
+{
+    static ULONG Magnitude(_In_ const BYTE * p)
+    {
+        // Unsigned, centered at 0x80.
+        LONG lValue = (LONG)p[0] - 0x80;
+        ULONG ulMagnitude = (ULONG)(lValue < 0 ? -lValue : lValue) << 24;
+        return ulMagnitude > PEAK_METER_Q31_MAX ? PEAK_METER_Q31_MAX : ulMagnitude;
+    }
+};
+
+template <>
+struct PeakMeterSample<16, FALSE>
+{
+    static ULONG Magnitude(_In_ const BYTE * p)
+    {
+        LONG lValue = (SHORT)(p[0] | (p[1] << 8));
+        ULONG ulMagnitude = (ULONG)(lValue < 0 ? -lValue : lValue) << 16;
+        return ulMagnitude > PEAK_METER_Q31_MAX ? PEAK_METER_Q31_MAX : ulMagnitude;
+    }
+};
+
+template <>
+struct PeakMeterSample<24, FALSE>
+{
+    static ULONG Magnitude(_In_ const BYTE * p)
+    {
+        // Packed little-endian.
+        LONG lValue = (LONG)(((ULONG)p[0] << 8) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 24)) >> 8;
+        ULONG ulMagnitude = (ULONG)(lValue < 0 ? -lValue : lValue) << 8;
+        return ulMagnitude > PEAK_METER_Q31_MAX ? PEAK_METER_Q31_MAX : ulMagnitude;
+    }
+};
+
+template <>
+struct PeakMeterSample<32, FALSE>
+{
+    static ULONG Magnitude(_In_ const BYTE * p)
+    {
+        ULONG ulValue = (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+        ULONG ulMagnitude = (ulValue & 0x80000000) ? 0 - ulValue : ulValue;
+        return ulMagnitude > PEAK_METER_Q31_MAX ? PEAK_METER_Q31_MAX : ulMagnitude;
+    }
+};
+
+template <>
+struct PeakMeterSample<32, TRUE>
+{
+    static ULONG Magnitude(_In_ const BYTE * p)
+    {
+        ULONG ulBits = (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+        ULONG ulExponent = (ulBits >> 23) & 0xFF;
+        ULONG ulMantissa = (ulBits & 0x7FFFFF) | 0x800000;
+
+        // |x| = ulMantissa * 2^(ulExponent - 150), so in Q31 the mantissa
+        // moves left by ulExponent - 119. Exponents from 127 up (|x| >= 1,
+        // infinities, NaNs) are full scale; below 96 (|x| < 2^-31, and
+        // denormals) the magnitude is 0.
+        ULONG ulLeft = (ulExponent - 119) & 7;
+        ULONG ulRight = (119 - ulExponent) & 31;
+        ULONG ulMagnitude = (ulExponent >= 119) ? (ulMantissa << ulLeft) : (ulMantissa >> ulRight);
+
+        ulMagnitude = (ulExponent >= 127) ? PEAK_METER_Q31_MAX : ulMagnitude;
+        return (ulExponent < 96) ? 0 : ulMagnitude;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PeakMeterScan
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct PeakMeterScan
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG FrameBytes = SampleBytes * Channels;
+
+    static VOID Scan
+    (
+        _In_ const BYTE *   pBuffer,
+        _In_ ULONG          ulFrames,
+        _Inout_ ULONG *     pulPeak,
+        _Inout_ ULONGLONG * pullEnergy
+    )
+    {
+        ULONG ulPeak[Channels];
+        ULONGLONG ullEnergy[Channels];
+
+        for (ULONG c = 0; c < Channels; c++)
+        {
+            ulPeak[c] = pulPeak[c];
+            ullEnergy[c] = 0;
+        }
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                ULONG ulMagnitude = PeakMeterSample<Bits, Float>::Magnitude(pBuffer + c * SampleBytes);
+                ULONG ulQ15 = ulMagnitude >> 16;
+
+                ulPeak[c] = ulMagnitude > ulPeak[c] ? ulMagnitude : ulPeak[c];
+                ullEnergy[c] += ulQ15 * ulQ15;
+            }
+            pBuffer += FrameBytes;
+        }
+
+        for (ULONG c = 0; c < Channels; c++)
+        {
+            pulPeak[c] = ulPeak[c];
+            pullEnergy[c] += ullEnergy[c];
+        }
+    }
+};
+
+template <ULONG Bits, BOOL Float>
+PFN_PEAK_METER_SCAN SelectPeakMeterScan
+(
+    _In_ ULONG              ulChannels
+)
+{
+    switch (ulChannels)
+    {
+        case 1: return PeakMeterScan<Bits, 1, Float>::Scan;
+        case 2: return PeakMeterScan<Bits, 2, Float>::Scan;
+        case 3: return PeakMeterScan<Bits, 3, Float>::Scan;
+        case 4: return PeakMeterScan<Bits, 4, Float>::Scan;
+        case 5: return PeakMeterScan<Bits, 5, Float>::Scan;
+        case 6: return PeakMeterScan<Bits, 6, Float>::Scan;
+        case 7: return PeakMeterScan<Bits, 7, Float>::Scan;
+        case 8: return PeakMeterScan<Bits, 8, Float>::Scan;
+    }
+
+    return NULL;
+}
+
+//
+// Picks the scan for a stream format: 8/16/24/32-bit PCM and 32-bit float
+// with 1 to PEAK_METER_MAX_CHANNELS channels. Returns NULL otherwise.
+//
+inline PFN_PEAK_METER_SCAN GetPeakMeterScan
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat
+)
+{
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectPeakMeterScan<32, TRUE>(ulChannels) : NULL;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectPeakMeterScan<8, FALSE>(ulChannels);
+        case 16: return SelectPeakMeterScan<16, FALSE>(ulChannels);
+        case 24: return SelectPeakMeterScan<24, FALSE>(ulChannels);
+        case 32: return SelectPeakMeterScan<32, FALSE>(ulChannels);
+    }
+
+    return NULL;
+}
+
+//
+// Q30 coefficient^ulFrames, by repeated squaring.
+//
+inline ULONG PeakMeterPower
+(
+    _In_ ULONG          ulCoefficient,
+    _In_ ULONG          ulFrames
+)
+{
+    ULONGLONG ullResult = PEAK_METER_Q30_ONE;
+    ULONGLONG ullBase = ulCoefficient;
+
+    while (ulFrames != 0)
+    {
+        if (ulFrames & 1)
+        {
+            ullResult = (ullResult * ullBase + (1ULL << 29)) >> 30;
+        }
+        ullBase = (ullBase * ullBase + (1ULL << 29)) >> 30;
+        ulFrames >>= 1;
+    }
+
+    return (ULONG)ullResult;
+}
+
+//
+// Q30 exp(-ullRate / 2^30 / ulSampleRate), the per-frame factor of a decay
+// with the given rate. The rate per frame is far below 1 for any audio
+// sample rate, so the second-order series is exact to Q30.
+//
+inline ULONG PeakMeterDecay
+(
+    _In_ ULONGLONG      ullRate,
+    _In_ ULONG          ulSampleRate
+)
+{
+    ULONGLONG ullX = (ullRate + ulSampleRate / 2) / ulSampleRate;
+
+    if (ullX >= PEAK_METER_Q30_ONE)
+    {
+        return 0;
+    }
+
+    return (ULONG)(PEAK_METER_Q30_ONE - ullX + ((ullX * ullX) >> 31));
+}
+
+//
+// floor(sqrt(ullValue)).
+//
+inline ULONG PeakMeterSqrt
+(
+    _In_ ULONGLONG      ullValue
+)
+{
+    ULONGLONG ullRoot = 0;
+    ULONGLONG ullBit = 1ULL << 62;
+
+    while (ullBit > ullValue)
+    {
+        ullBit >>= 2;
+    }
+
+    while (ullBit != 0)
+    {
+        if (ullValue >= ullRoot + ullBit)
+        {
+            ullValue -= ullRoot + ullBit;
+            ullRoot = (ullRoot >> 1) + ullBit;
+        }
+        else
+        {
+            ullRoot >>= 1;
+        }
+        ullBit >>= 2;
+    }
+
+    return (ULONG)ullRoot;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CPeakMeter
+//
+//   Owned by one stream and only touched from its position update; the
+//   stream publishes GetLevels for the topology to read.
+//
+class CPeakMeter
+{
+protected:
+    PFN_PEAK_METER_SCAN         m_pfnScan;
+    ULONG                       m_ulChannels;
+    ULONG                       m_ulFrameBytes;
+    ULONG                       m_ulReleaseDecay;   // Q30, per frame.
+    ULONG                       m_ulRmsDecay;       // Q30, per frame.
+    ULONG                       m_ulPeak[PEAK_METER_MAX_CHANNELS];              // Q31.
+    ULONGLONG                   m_ullMeanSquare[PEAK_METER_MAX_CHANNELS];       // Q30.
+
+public:
+    CPeakMeter() :
+        m_pfnScan(NULL),
+        m_ulChannels(0),
+        m_ulFrameBytes(0),
+        m_ulReleaseDecay(0),
+        m_ulRmsDecay(0)
+    {
+        Reset();
+    }
+
+    //
+    // Returns FALSE, and meters nothing, for formats GetPeakMeterScan does
+    // not cover.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulChannels,
+        _In_ BOOL       bFloat
+    )
+    {
+        m_pfnScan = (ulSampleRate != 0) ? GetPeakMeterScan(ulBitsPerSample, ulChannels, bFloat) : NULL;
+        if (m_pfnScan == NULL)
+        {
+            return FALSE;
+        }
+
+        m_ulChannels = ulChannels;
+        m_ulFrameBytes = ulBitsPerSample / 8 * ulChannels;
+        m_ulReleaseDecay = PeakMeterDecay(PEAK_METER_RELEASE_RATE, ulSampleRate);
+        m_ulRmsDecay = PeakMeterDecay(PEAK_METER_RMS_RATE, ulSampleRate);
+        Reset();
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_pfnScan != NULL;
+    }
+
+    VOID Reset()
+    {
+        RtlZeroMemory(m_ulPeak, sizeof(m_ulPeak));
+        RtlZeroMemory(m_ullMeanSquare, sizeof(m_ullMeanSquare));
+    }
+
+    //
+    // Meters the whole frames in pData, which follow the frames of the
+    // previous call.
+    //
+    VOID Process
+    (
+        _In_reads_bytes_(cbData) const BYTE *   pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG ulFrames = (m_ulFrameBytes != 0) ? cbData / m_ulFrameBytes : 0;
+        ULONG ulPeak[PEAK_METER_MAX_CHANNELS] = { 0 };
+        ULONGLONG ullEnergy[PEAK_METER_MAX_CHANNELS] = { 0 };
+
+        if (ulFrames == 0)
+        {
+            return;
+        }
+
+        m_pfnScan(pData, ulFrames, ulPeak, ullEnergy);
+
+        ULONGLONG ullRelease = PeakMeterPower(m_ulReleaseDecay, ulFrames);
+        ULONGLONG ullKeep = PeakMeterPower(m_ulRmsDecay, ulFrames);
+
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            ULONG ulHeld = (ULONG)((m_ulPeak[c] * ullRelease) >> 30);
+
+            m_ulPeak[c] = ulPeak[c] > ulHeld ? ulPeak[c] : ulHeld;
+            m_ullMeanSquare[c] = (m_ullMeanSquare[c] * ullKeep +
+                                  (ullEnergy[c] / ulFrames) * (PEAK_METER_Q30_ONE - ullKeep)) >> 30;
+        }
+    }
+
+    VOID GetLevels
+    (
+        _Out_ PPEAK_METER_LEVELS    pLevels
+    ) const
+    {
+        RtlZeroMemory(pLevels, sizeof(*pLevels));
+
+        pLevels->ulChannels = m_ulChannels;
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            // sqrt(MeanSquare / 2^30) in Q31.
+            ULONG ulRms = PeakMeterSqrt(m_ullMeanSquare[c] << 32);
+
+            pLevels->lPeak[c] = (LONG)m_ulPeak[c];
+            pLevels->lRms[c] = (LONG)(ulRms > PEAK_METER_Q31_MAX ? PEAK_METER_Q31_MAX : ulRms);
+        }
+    }
+};
+typedef CPeakMeter *PCPeakMeter;
+
+#endif // _VIRTUALAUDIODRIVER_PEAKMETER_H_
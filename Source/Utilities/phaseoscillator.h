@@ -0,0 +1,168 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    phaseoscillator.h
+
+Abstract:
+
+    Fixed-point wavetable sine oscillator. A 32-bit phase accumulator indexes
+    a sine table with linear interpolation; the output is Q30. Floating point
+    is only used by Init to build the table, so Generate can run at any IRQL
+    without saving the floating point state.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_PHASEOSCILLATOR_H_
+#define _VIRTUALAUDIODRIVER_PHASEOSCILLATOR_H_
+
+#include "portable.h"
+#include <math.h>
+
+//
+// 2048 points with linear interpolation keep the error around -118 dBFS,
+// well under the noise floor of 16-bit audio.
+//
+#define PHASEOSC_TABLE_BITS     11
+#define PHASEOSC_TABLE_SIZE     (1 << PHASEOSC_TABLE_BITS)
+#define PHASEOSC_FRAC_BITS      (32 - PHASEOSC_TABLE_BITS)
+#define PHASEOSC_FRAC_MASK      ((1UL << PHASEOSC_FRAC_BITS) - 1)
+
+// Unity in the oscillator's Q30 output.
+#define PHASEOSC_ONE            (1L << 30)
+
+///////////////////////////////////////////////////////////////////////////////
+// CPhaseOscillator
+//
+//   Output is DCOffset + Amplitude * sin(phase), clamped to [-1, 1]. The
+//   phase increment is round-down(frequency * 2^32 / rate), so the pitch is
+//   exact to 1/2^32 of the sample rate.
+//
+class CPhaseOscillator
+{
+protected:
+    ULONG                       m_ulPhase;
+    ULONG                       m_ulPhaseIncrement;
+    LONG                        m_lAmplitude;       // Q30
+    LONG                        m_lDCOffset;        // Q30
+    LONG                        m_Table[PHASEOSC_TABLE_SIZE + 1];   // Q30, last entry wraps
+
+public:
+    CPhaseOscillator() :
+        m_ulPhase(0),
+        m_ulPhaseIncrement(0),
+        m_lAmplitude(0),
+        m_lDCOffset(0)
+    {
+        RtlZeroMemory(m_Table, sizeof(m_Table));
+    }
+
+    //
+    // Builds the table and the fixed-point parameters. Uses floating point;
+    // in kernel mode the caller saves the floating point state.
+    //
+    // InitialPhase is in radians; Amplitude and DCOffset are fractions of
+    // full scale.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulFrequency,
+        _In_ ULONG      ulSampleRate,
+        _In_ double     Amplitude,
+        _In_ double     DCOffset,
+        _In_ double     InitialPhase
+    )
+    {
+        const double TWO_PI = 6.283185307179586476925286766559;
+
+        if (ulSampleRate == 0)
+        {
+            return FALSE;
+        }
+
+        for (ULONG i = 0; i <= PHASEOSC_TABLE_SIZE; i++)
+        {
+            double value = sin(TWO_PI * i / PHASEOSC_TABLE_SIZE) * PHASEOSC_ONE;
+            m_Table[i] = (LONG)(value >= 0 ? value + 0.5 : value - 0.5);
+        }
+        m_Table[PHASEOSC_TABLE_SIZE] = m_Table[0];
+
+        m_ulPhaseIncrement = (ULONG)(((ULONGLONG)(ulFrequency % ulSampleRate) << 32) / ulSampleRate);
+
+        double cycles = fmod(InitialPhase / TWO_PI, 1.0);
+        if (cycles < 0)
+        {
+            cycles += 1.0;
+        }
+        m_ulPhase = (ULONG)(ULONGLONG)(cycles * 4294967296.0);
+
+        m_lAmplitude = ToQ30(Amplitude);
+        m_lDCOffset = ToQ30(DCOffset);
+
+        return TRUE;
+    }
+
+    //
+    // Next Q30 sample; advances the phase by one frame.
+    //
+    LONG NextSample()
+    {
+        ULONG ulIndex = m_ulPhase >> PHASEOSC_FRAC_BITS;
+        LONG lSine0 = m_Table[ulIndex];
+        LONG lSine1 = m_Table[ulIndex + 1];
+        LONG lSine = lSine0 + (LONG)(((LONGLONG)(lSine1 - lSine0) * (LONGLONG)(m_ulPhase & PHASEOSC_FRAC_MASK)) >> PHASEOSC_FRAC_BITS);
+
+        m_ulPhase += m_ulPhaseIncrement;
+
+        LONG lSample = m_lDCOffset + (LONG)(((LONGLONG)m_lAmplitude * lSine) >> 30);
+
+        if (lSample > PHASEOSC_ONE)
+        {
+            lSample = PHASEOSC_ONE;
+        }
+        else if (lSample < -PHASEOSC_ONE)
+        {
+            lSample = -PHASEOSC_ONE;
+        }
+
+        return lSample;
+    }
+
+    //
+    // Fills pSamples with the next ulCount Q30 samples, one per frame.
+    //
+    VOID Generate
+    (
+        _Out_writes_(ulCount) LONG *    pSamples,
+        _In_ ULONG                      ulCount
+    )
+    {
+        for (ULONG i = 0; i < ulCount; i++)
+        {
+            pSamples[i] = NextSample();
+        }
+    }
+
+protected:
+    static LONG ToQ30
+    (
+        _In_ double     Value
+    )
+    {
+        if (Value > 1.0)
+        {
+            Value = 1.0;
+        }
+        else if (Value < -1.0)
+        {
+            Value = -1.0;
+        }
+
+        return (LONG)(Value * PHASEOSC_ONE);
+    }
+};
+
+typedef CPhaseOscillator *PCPhaseOscillator;
+
+#endif // _VIRTUALAUDIODRIVER_PHASEOSCILLATOR_H_
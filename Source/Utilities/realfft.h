@@ -0,0 +1,348 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    realfft.h
+
+Abstract:
+
+    Fixed point FFT of real signals, for processing audio in the frequency
+    domain.
+
+    - An N point real transform runs as an N/2 point complex transform of
+      the even and odd samples packed as real and imaginary parts, plus a
+      split step that separates their spectra.
+    - The complex transform is decimation in time over bit reversed
+      input. Radix-4 butterflies do two radix-2 stages per pass; a size
+      with an odd number of stages starts with one radix-2 stage.
+    - Twiddles come from one table of REAL_FFT_MAX_POINTS roots in Q30,
+      built at compile time; smaller sizes step through it.
+
+    The forward transform is unscaled, so inputs must stay below 2^31 / N
+    in magnitude. The inverse divides by N, a halving per radix-2 stage,
+    so it cannot overflow. Everything runs in integers with 64-bit
+    intermediates.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_REALFFT_H_
+#define _VIRTUALAUDIODRIVER_REALFFT_H_
+
+#include "portable.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Largest real transform, 2^REAL_FFT_MAX_BITS points.
+#define REAL_FFT_MAX_BITS           10
+#define REAL_FFT_MAX_POINTS         (1 << REAL_FFT_MAX_BITS)
+
+// Twiddles are in Q30.
+#define REAL_FFT_TWIDDLE_SHIFT      30
+
+//=============================================================================
+// Types
+//=============================================================================
+typedef struct _FFT_COMPLEX
+{
+    LONG        lRe;
+    LONG        lIm;
+} FFT_COMPLEX;
+typedef FFT_COMPLEX *PFFT_COMPLEX;
+
+//=============================================================================
+// Twiddles
+//=============================================================================
+
+//
+// e^(-2 pi i k / REAL_FFT_MAX_POINTS) for k below REAL_FFT_MAX_POINTS, in
+// Q30. Built by rotating one step at a time, in double, which stays far
+// inside the Q30 rounding over this many steps.
+//
+struct REAL_FFT_TWIDDLES
+{
+    FFT_COMPLEX Root[REAL_FFT_MAX_POINTS];
+
+    constexpr REAL_FFT_TWIDDLES() : Root()
+    {
+        double h = 6.283185307179586476925286766559 / REAL_FFT_MAX_POINTS;
+        double sinH = 0;
+        double cosH = 0;
+        double term = 1;
+
+        // Taylor series of cos and sin, term by term.
+        for (ULONG k = 0; k < 16; k++)
+        {
+            if (k % 2 == 0)
+            {
+                cosH += (k % 4 == 0) ? term : -term;
+            }
+            else
+            {
+                sinH += (k % 4 == 1) ? term : -term;
+            }
+            term *= h / (k + 1);
+        }
+
+        double re = 1;
+        double im = 0;
+
+        for (ULONG k = 0; k < REAL_FFT_MAX_POINTS; k++)
+        {
+            double next = re * cosH + im * sinH;
+
+            Root[k].lRe = (LONG)(re * (1L << REAL_FFT_TWIDDLE_SHIFT) + (re < 0 ? -0.5 : 0.5));
+            Root[k].lIm = (LONG)(im * (1L << REAL_FFT_TWIDDLE_SHIFT) + (im < 0 ? -0.5 : 0.5));
+            im = im * cosH - re * sinH;
+            re = next;
+        }
+    }
+};
+
+constexpr REAL_FFT_TWIDDLES g_RealFftTwiddles;
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+//
+// a * w, w a Q30 twiddle, conjugated for the inverse transform.
+//
+inline VOID FftRotate
+(
+    _In_ const FFT_COMPLEX &    a,
+    _In_ const FFT_COMPLEX &    w,
+    _In_ BOOL                   bInverse,
+    _Out_ LONGLONG &            llRe,
+    _Out_ LONGLONG &            llIm
+)
+{
+    const LONGLONG llRound = 1LL << (REAL_FFT_TWIDDLE_SHIFT - 1);
+    LONGLONG llWIm = bInverse ? -(LONGLONG)w.lIm : w.lIm;
+
+    llRe = ((LONGLONG)a.lRe * w.lRe - (LONGLONG)a.lIm * llWIm + llRound) >> REAL_FFT_TWIDDLE_SHIFT;
+    llIm = ((LONGLONG)a.lRe * llWIm + (LONGLONG)a.lIm * w.lRe + llRound) >> REAL_FFT_TWIDDLE_SHIFT;
+}
+
+//
+// Rounds away a scaling of 2^lShift; 0 leaves the value as it is.
+//
+inline LONG FftScale
+(
+    _In_ LONGLONG       llValue,
+    _In_ LONG           lShift
+)
+{
+    return (LONG)((lShift > 0) ? (llValue + (1LL << (lShift - 1))) >> lShift : llValue);
+}
+
+//
+// In place complex transform of 2^ulBits points, ulBits at most
+// REAL_FFT_MAX_BITS - 1. The inverse uses conjugate twiddles and divides
+// by the size.
+//
+inline VOID ComplexFft
+(
+    _In_ ULONG                                  ulBits,
+    _Inout_updates_(1 << ulBits) PFFT_COMPLEX   pData,
+    _In_ BOOL                                   bInverse
+)
+{
+    const ULONG ulPoints = 1UL << ulBits;
+    const LONG lScale2 = bInverse ? 1 : 0;
+    const LONG lScale4 = bInverse ? 2 : 0;
+    ULONG ulSpan = 1;
+
+    // Bit reversed order.
+    for (ULONG i = 1, j = 0; i < ulPoints; i++)
+    {
+        ULONG ulBit = ulPoints >> 1;
+
+        for (; j & ulBit; ulBit >>= 1)
+        {
+            j ^= ulBit;
+        }
+        j ^= ulBit;
+
+        if (i < j)
+        {
+            FFT_COMPLEX temp = pData[i];
+
+            pData[i] = pData[j];
+            pData[j] = temp;
+        }
+    }
+
+    // An odd stage count starts with one radix-2 stage; its twiddles are 1.
+    if (ulBits & 1)
+    {
+        for (ULONG i = 0; i < ulPoints; i += 2)
+        {
+            FFT_COMPLEX a = pData[i];
+            FFT_COMPLEX b = pData[i + 1];
+
+            pData[i].lRe = FftScale((LONGLONG)a.lRe + b.lRe, lScale2);
+            pData[i].lIm = FftScale((LONGLONG)a.lIm + b.lIm, lScale2);
+            pData[i + 1].lRe = FftScale((LONGLONG)a.lRe - b.lRe, lScale2);
+            pData[i + 1].lIm = FftScale((LONGLONG)a.lIm - b.lIm, lScale2);
+        }
+        ulSpan = 2;
+    }
+
+    //
+    // Radix-4: the radix-2 stages of spans s and 2s at once. With W the
+    // root of order 4s and t1 = W^2j x1, t2 = W^j x2, t3 = W^3j x3:
+    //   X0 = x0 + t1 + (t2 + t3)      X2 = x0 + t1 - (t2 + t3)
+    //   X1 = x0 - t1 - i (t2 - t3)    X3 = x0 - t1 + i (t2 - t3)
+    // with the sign of i flipped for the inverse.
+    //
+    for (; ulSpan < ulPoints; ulSpan <<= 2)
+    {
+        ULONG ulStride = REAL_FFT_MAX_POINTS / (4 * ulSpan);
+
+        for (ULONG j = 0; j < ulSpan; j++)
+        {
+            const FFT_COMPLEX & w1 = g_RealFftTwiddles.Root[j * ulStride];
+            const FFT_COMPLEX & w2 = g_RealFftTwiddles.Root[2 * j * ulStride];
+            const FFT_COMPLEX & w3 = g_RealFftTwiddles.Root[3 * j * ulStride];
+
+            for (ULONG i = j; i < ulPoints; i += 4 * ulSpan)
+            {
+                LONGLONG llT1Re, llT1Im, llT2Re, llT2Im, llT3Re, llT3Im;
+
+                FftRotate(pData[i + ulSpan], w2, bInverse, llT1Re, llT1Im);
+                FftRotate(pData[i + 2 * ulSpan], w1, bInverse, llT2Re, llT2Im);
+                FftRotate(pData[i + 3 * ulSpan], w3, bInverse, llT3Re, llT3Im);
+
+                LONGLONG llARe = (LONGLONG)pData[i].lRe + llT1Re;
+                LONGLONG llAIm = (LONGLONG)pData[i].lIm + llT1Im;
+                LONGLONG llBRe = (LONGLONG)pData[i].lRe - llT1Re;
+                LONGLONG llBIm = (LONGLONG)pData[i].lIm - llT1Im;
+                LONGLONG llSRe = llT2Re + llT3Re;
+                LONGLONG llSIm = llT2Im + llT3Im;
+                // -i (t2 - t3) forward, +i (t2 - t3) inverse.
+                LONGLONG llDRe = bInverse ? llT3Im - llT2Im : llT2Im - llT3Im;
+                LONGLONG llDIm = bInverse ? llT2Re - llT3Re : llT3Re - llT2Re;
+
+                pData[i].lRe = FftScale(llARe + llSRe, lScale4);
+                pData[i].lIm = FftScale(llAIm + llSIm, lScale4);
+                pData[i + ulSpan].lRe = FftScale(llBRe + llDRe, lScale4);
+                pData[i + ulSpan].lIm = FftScale(llBIm + llDIm, lScale4);
+                pData[i + 2 * ulSpan].lRe = FftScale(llARe - llSRe, lScale4);
+                pData[i + 2 * ulSpan].lIm = FftScale(llAIm - llSIm, lScale4);
+                pData[i + 3 * ulSpan].lRe = FftScale(llBRe - llDRe, lScale4);
+                pData[i + 3 * ulSpan].lIm = FftScale(llBIm - llDIm, lScale4);
+            }
+        }
+    }
+}
+
+//=============================================================================
+// Real transforms
+//=============================================================================
+
+//
+// Spectrum of 2^ulBits real samples: bins 0 to N/2 go to pSpectrum, which
+// needs N/2 + 1 entries. Unscaled.
+//
+inline VOID RealFftForward
+(
+    _In_ ULONG                                              ulBits,
+    _In_reads_(1 << ulBits) const LONG *                    plInput,
+    _Out_writes_((1 << ulBits) / 2 + 1) PFFT_COMPLEX        pSpectrum
+)
+{
+    const ULONG ulHalf = 1UL << (ulBits - 1);
+    const ULONG ulStride = REAL_FFT_MAX_POINTS >> ulBits;
+
+    for (ULONG n = 0; n < ulHalf; n++)
+    {
+        pSpectrum[n].lRe = plInput[2 * n];
+        pSpectrum[n].lIm = plInput[2 * n + 1];
+    }
+
+    ComplexFft(ulBits - 1, pSpectrum, FALSE);
+
+    //
+    // With Z the packed transform, E[k] = (Z[k] + conj Z[M-k]) / 2 and
+    // O[k] = (Z[k] - conj Z[M-k]) / 2i are the transforms of the even and
+    // odd samples, and X[k] = E[k] + W^k O[k]. Bins k and M - k come out
+    // of the same pair.
+    //
+    FFT_COMPLEX z0 = pSpectrum[0];
+
+    pSpectrum[0].lRe = z0.lRe + z0.lIm;
+    pSpectrum[0].lIm = 0;
+    pSpectrum[ulHalf].lRe = z0.lRe - z0.lIm;
+    pSpectrum[ulHalf].lIm = 0;
+
+    for (ULONG k = 1; k <= ulHalf / 2; k++)
+    {
+        FFT_COMPLEX a = pSpectrum[k];
+        FFT_COMPLEX b = pSpectrum[ulHalf - k];
+        FFT_COMPLEX e = { (LONG)(((LONGLONG)a.lRe + b.lRe) >> 1), (LONG)(((LONGLONG)a.lIm - b.lIm) >> 1) };
+        FFT_COMPLEX o2 = { (LONG)(((LONGLONG)a.lIm + b.lIm) >> 1), (LONG)(((LONGLONG)b.lRe - a.lRe) >> 1) };
+        LONGLONG llRe, llIm;
+
+        FftRotate(o2, g_RealFftTwiddles.Root[k * ulStride], FALSE, llRe, llIm);
+
+        // X[M-k] = conj(E[k] - W^k O[k]).
+        pSpectrum[k].lRe = (LONG)(e.lRe + llRe);
+        pSpectrum[k].lIm = (LONG)(e.lIm + llIm);
+        pSpectrum[ulHalf - k].lRe = (LONG)(e.lRe - llRe);
+        pSpectrum[ulHalf - k].lIm = (LONG)(llIm - e.lIm);
+    }
+}
+
+//
+// 2^ulBits real samples from bins 0 to N/2 of their spectrum, divided by
+// N. Uses pSpectrum as its workspace.
+//
+inline VOID RealFftInverse
+(
+    _In_ ULONG                                              ulBits,
+    _Inout_updates_((1 << ulBits) / 2 + 1) PFFT_COMPLEX     pSpectrum,
+    _Out_writes_(1 << ulBits) LONG *                        plOutput
+)
+{
+    const ULONG ulHalf = 1UL << (ulBits - 1);
+    const ULONG ulStride = REAL_FFT_MAX_POINTS >> ulBits;
+
+    //
+    // Back to the packed transform, Z[k] = E[k] + i O[k], with
+    // E[k] = (X[k] + conj X[M-k]) / 2 and O[k] = W^-k (X[k] - conj X[M-k]) / 2.
+    //
+    FFT_COMPLEX x0 = pSpectrum[0];
+    FFT_COMPLEX xM = pSpectrum[ulHalf];
+
+    pSpectrum[0].lRe = (LONG)(((LONGLONG)x0.lRe + xM.lRe + 1) >> 1);
+    pSpectrum[0].lIm = (LONG)(((LONGLONG)x0.lRe - xM.lRe + 1) >> 1);
+
+    for (ULONG k = 1; k <= ulHalf / 2; k++)
+    {
+        FFT_COMPLEX a = pSpectrum[k];
+        FFT_COMPLEX b = pSpectrum[ulHalf - k];
+        FFT_COMPLEX e = { (LONG)(((LONGLONG)a.lRe + b.lRe) >> 1), (LONG)(((LONGLONG)a.lIm - b.lIm) >> 1) };
+        FFT_COMPLEX d = { (LONG)(((LONGLONG)a.lRe - b.lRe) >> 1), (LONG)(((LONGLONG)a.lIm + b.lIm) >> 1) };
+        LONGLONG llORe, llOIm;
+
+        FftRotate(d, g_RealFftTwiddles.Root[k * ulStride], TRUE, llORe, llOIm);
+
+        // Z[k] = E + i O and Z[M-k] = conj(E) + i conj(O).
+        pSpectrum[k].lRe = (LONG)(e.lRe - llOIm);
+        pSpectrum[k].lIm = (LONG)(e.lIm + llORe);
+        pSpectrum[ulHalf - k].lRe = (LONG)(e.lRe + llOIm);
+        pSpectrum[ulHalf - k].lIm = (LONG)(llORe - e.lIm);
+    }
+
+    ComplexFft(ulBits - 1, pSpectrum, TRUE);
+
+    for (ULONG n = 0; n < ulHalf; n++)
+    {
+        plOutput[2 * n] = pSpectrum[n].lRe;
+        plOutput[2 * n + 1] = pSpectrum[n].lIm;
+    }
+}
+
+#endif // _VIRTUALAUDIODRIVER_REALFFT_H_
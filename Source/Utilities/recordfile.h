@@ -0,0 +1,322 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    recordfile.h
+
+Abstract:
+
+    Layout of the segmented recording files written by CSaveData:
+
+    - WAVE headers that switch to RF64 (EBU Tech 3306, the layout BW64 also
+      uses) once a segment passes 4 GB. The ds64 chunk is reserved as JUNK
+      up front, so the switch only rewrites the header.
+    - The policy that rolls a recording over to a new segment by size or by
+      duration.
+    - The sidecar index stored next to each segment: one entry per block of
+      frames, mapping the QPC time of the block's first frame to its byte
+      offset in the segment.
+    - How a write to a WAVE segment is split where the segment fills, and
+      which index blocks start in each piece.
+
+    The formats build on the host too, so recordings can be read back and
+    the index searched off the target machine.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_RECORDFILE_H_
+#define _VIRTUALAUDIODRIVER_RECORDFILE_H_
+
+#include "portable.h"
+
+//=============================================================================
+// WAVE/RF64 header
+//=============================================================================
+
+// Format chunk payloads up to WAVEFORMATEXTENSIBLE and then some.
+#define RECORD_WAVE_MAX_FORMAT_BYTES    64
+
+// RIFF/RF64 header + ds64/JUNK chunk + fmt chunk header + data chunk header.
+#define RECORD_WAVE_FIXED_HEADER_BYTES  (12 + 36 + 8 + 8)
+#define RECORD_WAVE_MAX_HEADER_BYTES    (RECORD_WAVE_FIXED_HEADER_BYTES + RECORD_WAVE_MAX_FORMAT_BYTES)
+
+inline VOID RecordPutUlong(_Out_writes_bytes_(4) PBYTE p, _In_ ULONG ulValue)
+{
+    p[0] = (BYTE)ulValue;
+    p[1] = (BYTE)(ulValue >> 8);
+    p[2] = (BYTE)(ulValue >> 16);
+    p[3] = (BYTE)(ulValue >> 24);
+}
+
+inline VOID RecordPutUlonglong(_Out_writes_bytes_(8) PBYTE p, _In_ ULONGLONG ullValue)
+{
+    RecordPutUlong(p, (ULONG)ullValue);
+    RecordPutUlong(p + 4, (ULONG)(ullValue >> 32));
+}
+
+inline ULONG RecordGetWaveHeaderBytes
+(
+    _In_ ULONG          cbFormat
+)
+{
+    return RECORD_WAVE_FIXED_HEADER_BYTES + ((cbFormat + 1) & ~1UL);
+}
+
+//
+// Builds the header for a segment holding ullDataBytes of audio. pFormat
+// is the WAVEFORMATEX (or extensible) payload of the fmt chunk. Returns
+// the header size, which does not depend on ullDataBytes, or 0 if the
+// format is too large.
+//
+inline ULONG RecordBuildWaveHeader
+(
+    _Out_writes_bytes_(RECORD_WAVE_MAX_HEADER_BYTES)    PBYTE           pHeader,
+    _In_reads_bytes_(cbFormat)                          const VOID *    pFormat,
+    _In_                                                ULONG           cbFormat,
+    _In_                                                ULONG           ulBlockAlign,
+    _In_                                                ULONGLONG       ullDataBytes
+)
+{
+    if (cbFormat > RECORD_WAVE_MAX_FORMAT_BYTES || ulBlockAlign == 0)
+    {
+        return 0;
+    }
+
+    ULONG cbHeader = RecordGetWaveHeaderBytes(cbFormat);
+    ULONGLONG ullRiffBytes = cbHeader - 8 + ullDataBytes;
+    BOOL bRf64 = (ullRiffBytes > 0xFFFFFFFF);
+    PBYTE p = pHeader;
+
+    RtlZeroMemory(pHeader, cbHeader);
+
+    RtlCopyMemory(p, bRf64 ? "RF64" : "RIFF", 4);
+    RecordPutUlong(p + 4, bRf64 ? 0xFFFFFFFF : (ULONG)ullRiffBytes);
+    RtlCopyMemory(p + 8, "WAVE", 4);
+    p += 12;
+
+    // ds64 for RF64; the same space as a JUNK chunk otherwise.
+    RtlCopyMemory(p, bRf64 ? "ds64" : "JUNK", 4);
+    RecordPutUlong(p + 4, 28);
+    if (bRf64)
+    {
+        RecordPutUlonglong(p + 8, ullRiffBytes);
+        RecordPutUlonglong(p + 16, ullDataBytes);
+        RecordPutUlonglong(p + 24, ullDataBytes / ulBlockAlign);
+        RecordPutUlong(p + 32, 0);                  // No table entries.
+    }
+    p += 36;
+
+    RtlCopyMemory(p, "fmt ", 4);
+    RecordPutUlong(p + 4, cbFormat);
+    RtlCopyMemory(p + 8, pFormat, cbFormat);
+    p += 8 + ((cbFormat + 1) & ~1UL);
+
+    RtlCopyMemory(p, "data", 4);
+    RecordPutUlong(p + 4, bRf64 ? 0xFFFFFFFF : (ULONG)ullDataBytes);
+
+    return cbHeader;
+}
+
+//=============================================================================
+// Segment policy
+//=============================================================================
+
+///////////////////////////////////////////////////////////////////////////////
+// CSegmentPolicy
+//
+//   A segment is full once its payload reaches the byte limit or its length
+//   reaches the frame limit. A limit of 0 means none.
+//
+class CSegmentPolicy
+{
+protected:
+    ULONGLONG                   m_ullMaxDataBytes;
+    ULONGLONG                   m_ullMaxFrames;
+
+public:
+    CSegmentPolicy() :
+        m_ullMaxDataBytes(0),
+        m_ullMaxFrames(0)
+    {
+    }
+
+    VOID Init
+    (
+        _In_ ULONGLONG  ullMaxDataBytes,
+        _In_ ULONGLONG  ullMaxFrames
+    )
+    {
+        m_ullMaxDataBytes = ullMaxDataBytes;
+        m_ullMaxFrames = ullMaxFrames;
+    }
+
+    BOOL IsFull
+    (
+        _In_ ULONGLONG  ullDataBytes,
+        _In_ ULONGLONG  ullFrames
+    ) const
+    {
+        return (m_ullMaxDataBytes != 0 && ullDataBytes >= m_ullMaxDataBytes) ||
+               (m_ullMaxFrames != 0 && ullFrames >= m_ullMaxFrames);
+    }
+
+    //
+    // Whole frames of uncompressed audio that still fit in the segment.
+    //
+    ULONGLONG GetRemainingFrames
+    (
+        _In_ ULONGLONG  ullDataBytes,
+        _In_ ULONGLONG  ullFrames,
+        _In_ ULONG      ulFrameBytes
+    ) const
+    {
+        ULONGLONG ullRemaining = ~0ULL;
+
+        if (IsFull(ullDataBytes, ullFrames))
+        {
+            return 0;
+        }
+
+        if (m_ullMaxDataBytes != 0 && ulFrameBytes != 0)
+        {
+            // Rounded up so a limit that is not a whole number of frames
+            // still ends on a frame boundary.
+            ullRemaining = (m_ullMaxDataBytes - ullDataBytes + ulFrameBytes - 1) / ulFrameBytes;
+        }
+
+        if (m_ullMaxFrames != 0 && m_ullMaxFrames - ullFrames < ullRemaining)
+        {
+            ullRemaining = m_ullMaxFrames - ullFrames;
+        }
+
+        return ullRemaining;
+    }
+};
+
+//=============================================================================
+// Sidecar index
+//=============================================================================
+
+#define RECORD_INDEX_MAGIC          0x58444156      // 'VADX'
+#define RECORD_INDEX_VERSION        1
+
+// Frames per index entry. Matches the FLAC block size, so every FLAC frame
+// gets an entry.
+#define RECORD_INDEX_BLOCK_FRAMES   4096
+
+//
+// Little-endian on disk. Entry i describes the block starting at stream
+// frame ullFirstFrame + i * ulBlockFrames.
+//
+typedef struct _RECORD_INDEX_HEADER
+{
+    ULONG       ulMagic;
+    USHORT      usVersion;
+    USHORT      usEntryBytes;
+    ULONG       ulSegment;
+    ULONG       ulSampleRate;
+    ULONG       ulBlockFrames;
+    ULONG       ulReserved;
+    LONGLONG    llQpcFrequency;
+    ULONGLONG   ullFirstFrame;      // Stream frame at the start of the segment.
+} RECORD_INDEX_HEADER;
+typedef RECORD_INDEX_HEADER *PRECORD_INDEX_HEADER;
+
+typedef struct _RECORD_INDEX_ENTRY
+{
+    LONGLONG    llQpc;              // Time of the block's first frame.
+    ULONGLONG   ullOffset;          // Byte offset of the block in the segment.
+} RECORD_INDEX_ENTRY;
+typedef RECORD_INDEX_ENTRY *PRECORD_INDEX_ENTRY;
+
+//
+// Index of the last entry at or before llQpc, i.e. the block to start
+// reading from. Entries are in time order. Returns 0 for times before the
+// first entry.
+//
+inline ULONG RecordIndexFind
+(
+    _In_reads_(ulEntries) const RECORD_INDEX_ENTRY *    pEntries,
+    _In_ ULONG                                          ulEntries,
+    _In_ LONGLONG                                       llQpc
+)
+{
+    ULONG ulLow = 0;
+    ULONG ulHigh = ulEntries;
+
+    // Invariant: entries below ulLow are at or before llQpc, entries from
+    // ulHigh on are after it.
+    while (ulLow < ulHigh)
+    {
+        ULONG ulMid = ulLow + (ulHigh - ulLow) / 2;
+
+        if (pEntries[ulMid].llQpc <= llQpc)
+        {
+            ulLow = ulMid + 1;
+        }
+        else
+        {
+            ulHigh = ulMid;
+        }
+    }
+
+    return (ulLow > 0) ? ulLow - 1 : 0;
+}
+
+//=============================================================================
+// WAVE segment writes
+//=============================================================================
+
+typedef struct _RECORD_WAVE_RUN
+{
+    ULONG       cbRun;              // 0: the segment is full, start a new one.
+    ULONG       ulBlocks;           // Index blocks that start in the run.
+    ULONGLONG   ullFirstBlock;      // Payload offset of the first of them.
+} RECORD_WAVE_RUN;
+typedef RECORD_WAVE_RUN *PRECORD_WAVE_RUN;
+
+//
+// The next piece of a cbData byte write to a WAVE segment whose payload is
+// ullSegmentBytes so far: all of it, or up to the frame where the policy
+// says the segment is full. Block i of the run starts at payload offset
+// ullFirstBlock + i * RECORD_INDEX_BLOCK_FRAMES * ulFrameBytes.
+//
+inline VOID RecordGetWaveRun
+(
+    _In_ const CSegmentPolicy *     pPolicy,
+    _In_ ULONG                      ulFrameBytes,
+    _In_ ULONGLONG                  ullSegmentBytes,
+    _In_ ULONG                      cbData,
+    _Out_ PRECORD_WAVE_RUN          pRun
+)
+{
+    ULONGLONG   ullBlockBytes = (ULONGLONG)RECORD_INDEX_BLOCK_FRAMES * ulFrameBytes;
+    ULONGLONG   ullFrames = ullSegmentBytes / ulFrameBytes;
+    ULONG       ulPartial = (ULONG)(ullSegmentBytes % ulFrameBytes);
+    ULONGLONG   ullRoom = pPolicy->GetRemainingFrames(ullFrames * ulFrameBytes, ullFrames, ulFrameBytes);
+
+    pRun->cbRun = cbData;
+    pRun->ulBlocks = 0;
+    pRun->ullFirstBlock = (ullSegmentBytes + ullBlockBytes - 1) / ullBlockBytes * ullBlockBytes;
+
+    // Runs end on the frame where the segment fills, so a full segment
+    // never has a partial frame pending.
+    if (ullRoom == 0 && ulPartial == 0)
+    {
+        pRun->cbRun = 0;
+        return;
+    }
+
+    if (ullRoom < 0xFFFFFFFF / ulFrameBytes && ullRoom * ulFrameBytes - ulPartial < cbData)
+    {
+        pRun->cbRun = (ULONG)(ullRoom * ulFrameBytes - ulPartial);
+    }
+
+    if (pRun->ullFirstBlock < ullSegmentBytes + pRun->cbRun)
+    {
+        pRun->ulBlocks = (ULONG)((ullSegmentBytes + pRun->cbRun - 1 - pRun->ullFirstBlock) / ullBlockBytes + 1);
+    }
+}
+
+#endif // _VIRTUALAUDIODRIVER_RECORDFILE_H_
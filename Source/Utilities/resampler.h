@@ -0,0 +1,830 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    resampler.h
+
+Abstract:
+
+    Polyphase windowed sinc sample rate converter.
+
+    - Converts between any two rates in the ratio L/M (out/in, reduced).
+      Each output frame is the dot product of the input around its time
+      with one row of a filter bank. When the L rows fit the bank is exact;
+      otherwise it holds a power of two rows, at least
+      RESAMPLER_INTERPOLATED_PHASES, plus one and blends the two around the
+      output's phase.
+    - An adjustable converter always interpolates, so its ratio can be
+      trimmed while it runs (SetAdjustment) to follow a drifting clock.
+    - The filter is a sinc with a Blackman-Harris window, cut off below
+      the lower of the two Nyquist rates. The quality tier sets its length
+      and passband; when the filter would pass RESAMPLER_MAX_TAPS, which
+      only happens well into decimation, it is shortened instead.
+    - The bank is built in pieces (Build) so no single call runs long. It
+      is built from tabulated sinc and window curves in integer math.
+    - Input and output are whole frames in any of 8/16/24/32-bit PCM and
+      32-bit float, each side its own; the filter runs in fixed point (see
+      fixedsample.h) on per channel histories, a layout the compiler can
+      vectorize.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_RESAMPLER_H_
+#define _VIRTUALAUDIODRIVER_RESAMPLER_H_
+
+#include "portable.h"
+#include "fixedsample.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Largest channel count with a dedicated instance (7.1).
+#define RESAMPLER_MAX_CHANNELS          8
+
+// Taps of the longest filter, a multiple of 4, and the fewest phases of an
+// interpolated bank.
+#define RESAMPLER_MAX_TAPS              128
+#define RESAMPLER_INTERPOLATED_PHASES   128
+#define RESAMPLER_MAX_COEFFICIENTS      ((RESAMPLER_INTERPOLATED_PHASES + 1) * RESAMPLER_MAX_TAPS)
+
+// Input frames each history holds beyond the taps.
+#define RESAMPLER_BLOCK_FRAMES          256
+#define RESAMPLER_HISTORY_FRAMES        (RESAMPLER_MAX_TAPS + RESAMPLER_BLOCK_FRAMES)
+
+// Coefficients are in Q30.
+#define RESAMPLER_COEFFICIENT_SHIFT     30
+
+// Output phase is kept in 1/(L << RESAMPLER_PHASE_SHIFT) input frames and
+// blends between bank rows in Q16.
+#define RESAMPLER_PHASE_SHIFT           20
+#define RESAMPLER_BLEND_SHIFT           16
+
+// Largest ratio trim SetAdjustment takes, Q30 (about 1950 ppm).
+#define RESAMPLER_MAX_ADJUSTMENT        (1L << 21)
+
+// The sinc is tabulated to RESAMPLER_SINC_ZEROS zero crossings,
+// RESAMPLER_SINC_STEPS points apart, and the window over its half width
+// in RESAMPLER_WINDOW_STEPS points. Both are read with four point
+// Lagrange interpolation, in Q20.
+#define RESAMPLER_SINC_ZEROS            36
+#define RESAMPLER_SINC_STEPS            32
+#define RESAMPLER_SINC_ENTRIES          (RESAMPLER_SINC_ZEROS * RESAMPLER_SINC_STEPS)
+#define RESAMPLER_WINDOW_STEPS          1024
+#define RESAMPLER_LOOKUP_SHIFT          20
+
+//
+// Quality tiers. Each doubles the filter length of the one before and
+// widens the passband.
+//
+typedef enum
+{
+    eResamplerLow = 0,
+    eResamplerMedium,
+    eResamplerHigh,
+    eResamplerQualityCount
+} eResamplerQuality;
+
+typedef struct _RESAMPLER_TIER
+{
+    ULONG       ulZeroCrossings;    // Each side, at unit cutoff.
+    LONG        lCutoff;            // Q30 of the lower Nyquist rate.
+} RESAMPLER_TIER;
+
+const RESAMPLER_TIER g_ResamplerTiers[eResamplerQualityCount] =
+{
+    {  8, (LONG)(0.78 * (1L << 30)) },
+    { 16, (LONG)(0.87 * (1L << 30)) },
+    { 32, (LONG)(0.93 * (1L << 30)) },
+};
+
+//=============================================================================
+// Tables
+//=============================================================================
+
+//
+// cos h and sin h of a small angle, from their Taylor series.
+//
+constexpr VOID ResamplerCosSin(double h, double & cosH, double & sinH)
+{
+    double term = 1;
+
+    cosH = 0;
+    sinH = 0;
+    for (ULONG k = 0; k < 16; k++)
+    {
+        if (k % 2 == 0)
+        {
+            cosH += (k % 4 == 0) ? term : -term;
+        }
+        else
+        {
+            sinH += (k % 4 == 1) ? term : -term;
+        }
+        term *= h / (k + 1);
+    }
+}
+
+//
+// sin(pi x) / (pi x) at x = k / RESAMPLER_SINC_STEPS, in Q30.
+//
+struct RESAMPLER_SINC
+{
+    LONG Value[RESAMPLER_SINC_ENTRIES + 4];
+
+    constexpr RESAMPLER_SINC() : Value()
+    {
+        const double pi = 3.1415926535897932384626433832795;
+        double h = pi / RESAMPLER_SINC_STEPS;
+        double cosH = 0;
+        double sinH = 0;
+
+        ResamplerCosSin(h, cosH, sinH);
+
+        double previous = -sinH;
+        double current = 0;
+
+        for (ULONG k = 0; k < RESAMPLER_SINC_ENTRIES + 4; k++)
+        {
+            double next = 2 * cosH * current - previous;
+            double sinc = (k == 0) ? 1.0 : current / (h * k);
+
+            Value[k] = (LONG)(sinc * (1L << 30) + (sinc < 0 ? -0.5 : 0.5));
+            previous = current;
+            current = next;
+        }
+    }
+};
+
+constexpr RESAMPLER_SINC g_ResamplerSinc;
+
+//
+// The 4-term Blackman-Harris window at u = k / RESAMPLER_WINDOW_STEPS of
+// its half width, in Q30; 1 at the center and zero past the edge.
+//
+struct RESAMPLER_WINDOW
+{
+    LONG Value[RESAMPLER_WINDOW_STEPS + 4];
+
+    constexpr RESAMPLER_WINDOW() : Value()
+    {
+        const double pi = 3.1415926535897932384626433832795;
+        const double a[4] = { 0.35875, 0.48829, 0.14128, 0.01168 };
+        double cosH[4] = { 1, 0, 0, 0 };
+        double previous[4] = { 1, 0, 0, 0 };
+        double current[4] = { 1, 1, 1, 1 };
+
+        for (ULONG m = 1; m < 4; m++)
+        {
+            double sinH = 0;
+
+            ResamplerCosSin(m * pi / RESAMPLER_WINDOW_STEPS, cosH[m], sinH);
+            previous[m] = cosH[m];
+        }
+
+        for (ULONG k = 0; k <= RESAMPLER_WINDOW_STEPS; k++)
+        {
+            double w = a[0];
+
+            for (ULONG m = 1; m < 4; m++)
+            {
+                double next = 2 * cosH[m] * current[m] - previous[m];
+
+                w += a[m] * current[m];
+                previous[m] = current[m];
+                current[m] = next;
+            }
+            Value[k] = (LONG)(w * (1L << 30) + 0.5);
+        }
+    }
+};
+
+constexpr RESAMPLER_WINDOW g_ResamplerWindow;
+
+//
+// Reads a table at lPosition (Q20 steps) with four point Lagrange
+// interpolation. The table is even around 0 and zero past ulEntries.
+//
+inline LONG ResamplerLookup
+(
+    _In_ const LONG *   plTable,
+    _In_ ULONG          ulEntries,
+    _In_ LONGLONG       llPosition
+)
+{
+    const LONGLONG One = 1LL << RESAMPLER_LOOKUP_SHIFT;
+    LONGLONG llIndex = llPosition >> RESAMPLER_LOOKUP_SHIFT;
+    LONGLONG t = llPosition & (One - 1);
+    LONGLONG tm1 = t - One;
+    LONGLONG tm2 = t - 2 * One;
+    LONGLONG tp1 = t + One;
+    LONGLONG llWeight[4];
+    LONGLONG llSum = 0;
+
+    // Weights of points -1 to 2, in Q20.
+    llWeight[0] = -(((t * tm1) >> RESAMPLER_LOOKUP_SHIFT) * tm2 >> RESAMPLER_LOOKUP_SHIFT) / 6;
+    llWeight[1] = (((tp1 * tm1) >> RESAMPLER_LOOKUP_SHIFT) * tm2 >> RESAMPLER_LOOKUP_SHIFT) / 2;
+    llWeight[2] = -(((tp1 * t) >> RESAMPLER_LOOKUP_SHIFT) * tm2 >> RESAMPLER_LOOKUP_SHIFT) / 2;
+    llWeight[3] = (((tp1 * t) >> RESAMPLER_LOOKUP_SHIFT) * tm1 >> RESAMPLER_LOOKUP_SHIFT) / 6;
+
+    for (LONG i = 0; i < 4; i++)
+    {
+        LONGLONG llPoint = llIndex - 1 + i;
+
+        llPoint = llPoint < 0 ? -llPoint : llPoint;
+        if (llPoint <= (LONGLONG)ulEntries)
+        {
+            llSum += llWeight[i] * plTable[llPoint];
+        }
+    }
+
+    return (LONG)(llSum >> RESAMPLER_LOOKUP_SHIFT);
+}
+
+//=============================================================================
+// Format kernels
+//=============================================================================
+
+//
+// Load appends ulFrames interleaved frames to the channel histories, which
+// are RESAMPLER_HISTORY_FRAMES apart, at ulOffset. Store writes one
+// frame of Q29 samples.
+//
+typedef VOID RESAMPLER_LOAD_ROUTINE
+(
+    _In_ const BYTE *   pData,
+    _In_ ULONG          ulFrames,
+    _In_ ULONG          ulChannels,
+    _Inout_ PLONG       plHistory,
+    _In_ ULONG          ulOffset
+);
+typedef RESAMPLER_LOAD_ROUTINE *PFN_RESAMPLER_LOAD;
+
+typedef VOID RESAMPLER_STORE_ROUTINE
+(
+    _Out_ PBYTE         pData,
+    _In_ const LONG *   plFrame,
+    _In_ ULONG          ulChannels
+);
+typedef RESAMPLER_STORE_ROUTINE *PFN_RESAMPLER_STORE;
+
+typedef struct _RESAMPLER_IO
+{
+    PFN_RESAMPLER_LOAD  pfnLoad;
+    PFN_RESAMPLER_STORE pfnStore;
+    ULONG               ulSampleBytes;
+} RESAMPLER_IO;
+typedef RESAMPLER_IO *PRESAMPLER_IO;
+
+///////////////////////////////////////////////////////////////////////////////
+// ResamplerIo
+//
+template <ULONG Bits, BOOL Float>
+struct ResamplerIo
+{
+    static const ULONG SampleBytes = Bits / 8;
+
+    static VOID Load
+    (
+        _In_ const BYTE *   pData,
+        _In_ ULONG          ulFrames,
+        _In_ ULONG          ulChannels,
+        _Inout_ PLONG       plHistory,
+        _In_ ULONG          ulOffset
+    )
+    {
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < ulChannels; c++)
+            {
+                plHistory[c * RESAMPLER_HISTORY_FRAMES + ulOffset + i] = FixedSample<Bits, Float>::Load(pData);
+                pData += SampleBytes;
+            }
+        }
+    }
+
+    static VOID Store
+    (
+        _Out_ PBYTE         pData,
+        _In_ const LONG *   plFrame,
+        _In_ ULONG          ulChannels
+    )
+    {
+        for (ULONG c = 0; c < ulChannels; c++)
+        {
+            FixedSample<Bits, Float>::Store(pData, plFrame[c]);
+            pData += SampleBytes;
+        }
+    }
+};
+
+template <ULONG Bits, BOOL Float>
+VOID SetResamplerIo
+(
+    _Out_ PRESAMPLER_IO     pIo
+)
+{
+    pIo->pfnLoad = ResamplerIo<Bits, Float>::Load;
+    pIo->pfnStore = ResamplerIo<Bits, Float>::Store;
+    pIo->ulSampleBytes = ResamplerIo<Bits, Float>::SampleBytes;
+}
+
+//
+// Picks the kernels for a sample format: 8/16/24/32-bit PCM and 32-bit
+// float. Returns FALSE otherwise.
+//
+inline BOOL GetResamplerIo
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ BOOL               bFloat,
+    _Out_ PRESAMPLER_IO     pIo
+)
+{
+    RtlZeroMemory(pIo, sizeof(*pIo));
+
+    if (bFloat)
+    {
+        if (ulBitsPerSample != 32)
+        {
+            return FALSE;
+        }
+        SetResamplerIo<32, TRUE>(pIo);
+        return TRUE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  SetResamplerIo<8, FALSE>(pIo);  return TRUE;
+        case 16: SetResamplerIo<16, FALSE>(pIo); return TRUE;
+        case 24: SetResamplerIo<24, FALSE>(pIo); return TRUE;
+        case 32: SetResamplerIo<32, FALSE>(pIo); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Sum of ulTaps (a multiple of 4) products, with independent partial sums
+// so the loop has no serial dependency. Samples are Q29 and coefficients
+// Q30; a row's absolute sum stays below 4, so the sum fits.
+//
+inline LONGLONG ResamplerDot
+(
+    _In_reads_(ulTaps) const LONG *     plSamples,
+    _In_reads_(ulTaps) const LONG *     plCoefficients,
+    _In_ ULONG                          ulTaps
+)
+{
+    LONGLONG llSum0 = 0;
+    LONGLONG llSum1 = 0;
+    LONGLONG llSum2 = 0;
+    LONGLONG llSum3 = 0;
+
+    for (ULONG k = 0; k < ulTaps; k += 4)
+    {
+        llSum0 += (LONGLONG)plSamples[k] * plCoefficients[k];
+        llSum1 += (LONGLONG)plSamples[k + 1] * plCoefficients[k + 1];
+        llSum2 += (LONGLONG)plSamples[k + 2] * plCoefficients[k + 2];
+        llSum3 += (LONGLONG)plSamples[k + 3] * plCoefficients[k + 3];
+    }
+
+    return (llSum0 + llSum1) + (llSum2 + llSum3);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CResampler
+//
+//   Not synchronized; one side feeds it with Write and drains it with
+//   Read.
+//
+class CResampler
+{
+protected:
+    RESAMPLER_IO                m_In;
+    RESAMPLER_IO                m_Out;
+    ULONG                       m_ulChannels;
+    ULONG                       m_ulInFrameBytes;
+    ULONG                       m_ulOutFrameBytes;
+    ULONG                       m_ulUp;                 // L, output rate over the common divisor.
+    ULONG                       m_ulDown;               // M, input rate over the common divisor.
+    ULONG                       m_ulPhases;             // Bank rows in a unit delay.
+    ULONG                       m_ulTaps;
+    LONG                        m_lCutoff;              // Q30 of the input Nyquist rate.
+    ULONG                       m_ulRowsBuilt;
+    ULONG                       m_ulIndex;              // History frame the next output's taps start at.
+    ULONGLONG                   m_ullPhase;             // Its delay past that, in m_ullPhaseUnit.
+    ULONGLONG                   m_ullPhaseUnit;         // L << RESAMPLER_PHASE_SHIFT.
+    ULONG                       m_ulStepFrames;         // Input advance per output, whole frames
+    ULONGLONG                   m_ullStepPhase;         // and the rest in m_ullPhaseUnit.
+    BOOL                        m_bAdjustable;
+    ULONG                       m_ulFilled;             // History frames written.
+    PLONG                       m_plBank;
+    PLONG                       m_plHistory;
+
+public:
+    CResampler()
+    {
+        RtlZeroMemory(&m_In, sizeof(m_In));
+        RtlZeroMemory(&m_Out, sizeof(m_Out));
+        m_ulChannels = 0;
+        m_ulInFrameBytes = 0;
+        m_ulOutFrameBytes = 0;
+        m_ulUp = 1;
+        m_ulDown = 1;
+        m_ulPhases = 1;
+        m_ulTaps = 0;
+        m_lCutoff = 0;
+        m_ulRowsBuilt = 0;
+        m_ulIndex = 0;
+        m_ullPhase = 0;
+        m_ullPhaseUnit = 1;
+        m_ulStepFrames = 1;
+        m_ullStepPhase = 0;
+        m_bAdjustable = FALSE;
+        m_ulFilled = 0;
+        m_plBank = NULL;
+        m_plHistory = NULL;
+    }
+
+    //
+    // Bytes of storage Init needs, 0 if the channel count is not supported.
+    //
+    static ULONG GetStorageBytes
+    (
+        _In_ ULONG      ulChannels
+    )
+    {
+        if (ulChannels == 0 || ulChannels > RESAMPLER_MAX_CHANNELS)
+        {
+            return 0;
+        }
+
+        return (RESAMPLER_MAX_COEFFICIENTS + ulChannels * RESAMPLER_HISTORY_FRAMES) * sizeof(LONG);
+    }
+
+    //
+    // Sets up a conversion and binds pStorage, at least GetStorageBytes
+    // bytes. The bank still has to be built. bAdjustable allows
+    // SetAdjustment. Returns FALSE for formats and ratios it does not
+    // cover, which leaves it inactive.
+    //
+    BOOL Init
+    (
+        _In_ ULONG              ulInRate,
+        _In_ ULONG              ulInBitsPerSample,
+        _In_ BOOL               bInFloat,
+        _In_ ULONG              ulOutRate,
+        _In_ ULONG              ulOutBitsPerSample,
+        _In_ BOOL               bOutFloat,
+        _In_ ULONG              ulChannels,
+        _In_ eResamplerQuality  eQuality,
+        _In_ BOOL               bAdjustable,
+        _In_ PVOID              pStorage,
+        _In_ ULONG              cbStorage
+    )
+    {
+        ULONG cbNeeded = GetStorageBytes(ulChannels);
+        ULONG ulA = ulInRate;
+        ULONG ulB = ulOutRate;
+
+        m_plBank = NULL;
+        if (cbNeeded == 0 || pStorage == NULL || cbStorage < cbNeeded ||
+            ulInRate == 0 || ulOutRate == 0 || (ULONG)eQuality >= eResamplerQualityCount ||
+            !GetResamplerIo(ulInBitsPerSample, bInFloat, &m_In) ||
+            !GetResamplerIo(ulOutBitsPerSample, bOutFloat, &m_Out))
+        {
+            return FALSE;
+        }
+
+        while (ulB != 0)
+        {
+            ULONG ulRemainder = ulA % ulB;
+
+            ulA = ulB;
+            ulB = ulRemainder;
+        }
+        m_ulUp = ulOutRate / ulA;
+        m_ulDown = ulInRate / ulA;
+
+        // The taps have to span a step.
+        if (m_ulDown / m_ulUp >= RESAMPLER_MAX_TAPS / 2)
+        {
+            return FALSE;
+        }
+
+        //
+        // Cut off below the lower Nyquist rate. Decimating stretches the
+        // filter by the ratio, in taps. A filter cut short spans fewer zero
+        // crossings than its tier; it gets the passband of the tier it
+        // still reaches.
+        //
+        const RESAMPLER_TIER * pTier = &g_ResamplerTiers[eQuality];
+        ULONG ulHalf = pTier->ulZeroCrossings;
+        ULONG ulSpan;
+
+        if (m_ulDown > m_ulUp)
+        {
+            ulHalf = (ULONG)(((ULONGLONG)ulHalf * m_ulDown + m_ulUp - 1) / m_ulUp);
+        }
+        m_ulTaps = ((2 * ulHalf + 3) / 4) * 4;
+        m_ulTaps = m_ulTaps < RESAMPLER_MAX_TAPS ? m_ulTaps : RESAMPLER_MAX_TAPS;
+
+        ulSpan = (m_ulDown > m_ulUp) ? (ULONG)(((ULONGLONG)m_ulTaps / 2 * m_ulUp) / m_ulDown) : m_ulTaps / 2;
+        while (pTier > g_ResamplerTiers && pTier->ulZeroCrossings > ulSpan)
+        {
+            pTier--;
+        }
+
+        m_lCutoff = pTier->lCutoff;
+        if (m_ulDown > m_ulUp)
+        {
+            m_lCutoff = (LONG)(((LONGLONG)m_lCutoff * m_ulUp) / m_ulDown);
+        }
+
+        if (!bAdjustable && (ULONGLONG)m_ulUp * m_ulTaps <= RESAMPLER_MAX_COEFFICIENTS)
+        {
+            m_ulPhases = m_ulUp;
+        }
+        else
+        {
+            // Shorter filters leave room for finer phases.
+            m_ulPhases = RESAMPLER_INTERPOLATED_PHASES;
+            while ((2 * m_ulPhases + 1) * m_ulTaps <= RESAMPLER_MAX_COEFFICIENTS)
+            {
+                m_ulPhases *= 2;
+            }
+        }
+
+        m_bAdjustable = bAdjustable;
+        m_ullPhaseUnit = (ULONGLONG)m_ulUp << RESAMPLER_PHASE_SHIFT;
+
+        m_ulChannels = ulChannels;
+        m_ulInFrameBytes = m_In.ulSampleBytes * ulChannels;
+        m_ulOutFrameBytes = m_Out.ulSampleBytes * ulChannels;
+        m_plBank = (PLONG)pStorage;
+        m_plHistory = m_plBank + RESAMPLER_MAX_COEFFICIENTS;
+        m_ulRowsBuilt = 0;
+        SetAdjustment(0);
+        Reset();
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_plBank != NULL;
+    }
+
+    BOOL IsReady() const
+    {
+        return IsActive() && m_ulRowsBuilt > GetLastRow();
+    }
+
+    //
+    // Builds bank rows, as many as fit in ulBudget coefficients but at
+    // least one. Returns TRUE once the bank is complete.
+    //
+    BOOL Build
+    (
+        _In_ ULONG      ulBudget
+    )
+    {
+        ULONG ulBuilt = 0;
+
+        while (IsActive() && m_ulRowsBuilt <= GetLastRow() && (ulBuilt == 0 || ulBuilt + m_ulTaps <= ulBudget))
+        {
+            BuildRow(m_ulRowsBuilt);
+            m_ulRowsBuilt++;
+            ulBuilt += m_ulTaps;
+        }
+
+        return IsReady();
+    }
+
+    //
+    // Trims the ratio: each output advances the input by M/L * (1 +
+    // lAdjustment), lAdjustment in Q30 and clamped to
+    // RESAMPLER_MAX_ADJUSTMENT. Positive values use the input up faster.
+    // Ignored unless the converter is adjustable.
+    //
+    VOID SetAdjustment
+    (
+        _In_ LONG       lAdjustment
+    )
+    {
+        ULONGLONG ullStep = (ULONGLONG)m_ulDown << RESAMPLER_PHASE_SHIFT;
+
+        if (m_bAdjustable)
+        {
+            lAdjustment = lAdjustment < RESAMPLER_MAX_ADJUSTMENT ? lAdjustment : RESAMPLER_MAX_ADJUSTMENT;
+            lAdjustment = lAdjustment > -RESAMPLER_MAX_ADJUSTMENT ? lAdjustment : -RESAMPLER_MAX_ADJUSTMENT;
+            ullStep = (ULONGLONG)((LONGLONG)ullStep + (((LONGLONG)ullStep * lAdjustment) >> 30));
+        }
+
+        m_ulStepFrames = (ULONG)(ullStep / m_ullPhaseUnit);
+        m_ullStepPhase = ullStep % m_ullPhaseUnit;
+    }
+
+    //
+    // Forgets the input. The first output lines up with the next input
+    // frame.
+    //
+    VOID Reset()
+    {
+        if (!IsActive())
+        {
+            return;
+        }
+
+        RtlZeroMemory(m_plHistory, m_ulChannels * RESAMPLER_HISTORY_FRAMES * sizeof(LONG));
+        m_ulIndex = 0;
+        m_ullPhase = 0;
+        m_ulFilled = m_ulTaps / 2 - 1;
+    }
+
+    ULONG GetInputFrameBytes() const
+    {
+        return m_ulInFrameBytes;
+    }
+
+    ULONG GetOutputFrameBytes() const
+    {
+        return m_ulOutFrameBytes;
+    }
+
+    //
+    // Input frames Write should be given before Read can produce
+    // ulOutFrames, as many as it can take now.
+    //
+    ULONG GetInputFrames
+    (
+        _In_ ULONG      ulOutFrames
+    )
+    {
+        ULONGLONG ullEnd;
+        ULONG ulSpace;
+
+        if (!IsActive() || ulOutFrames == 0)
+        {
+            return 0;
+        }
+
+        // Taps of the last output start this far on.
+        ullEnd = (ULONGLONG)(ulOutFrames - 1) * m_ulStepFrames +
+                 (m_ullPhase + (ULONGLONG)(ulOutFrames - 1) * m_ullStepPhase) / m_ullPhaseUnit;
+        ullEnd += m_ulIndex + m_ulTaps;
+        ulSpace = RESAMPLER_HISTORY_FRAMES - (m_ulFilled - m_ulIndex);
+
+        if (ullEnd <= m_ulFilled)
+        {
+            return 0;
+        }
+
+        return (ullEnd - m_ulFilled < ulSpace) ? (ULONG)(ullEnd - m_ulFilled) : ulSpace;
+    }
+
+    //
+    // Takes up to ulFrames input frames. Returns the number taken.
+    //
+    ULONG Write
+    (
+        _In_reads_bytes_(ulFrames * GetInputFrameBytes()) const BYTE *  pData,
+        _In_ ULONG                                                      ulFrames
+    )
+    {
+        if (!IsActive())
+        {
+            return 0;
+        }
+
+        if (m_ulFilled + ulFrames > RESAMPLER_HISTORY_FRAMES && m_ulIndex > 0)
+        {
+            // Move what the next outputs still need to the front.
+            for (ULONG c = 0; c < m_ulChannels; c++)
+            {
+                PLONG plHistory = m_plHistory + c * RESAMPLER_HISTORY_FRAMES;
+
+                RtlMoveMemory(plHistory, plHistory + m_ulIndex, (m_ulFilled - m_ulIndex) * sizeof(LONG));
+            }
+            m_ulFilled -= m_ulIndex;
+            m_ulIndex = 0;
+        }
+
+        if (ulFrames > RESAMPLER_HISTORY_FRAMES - m_ulFilled)
+        {
+            ulFrames = RESAMPLER_HISTORY_FRAMES - m_ulFilled;
+        }
+
+        m_In.pfnLoad(pData, ulFrames, m_ulChannels, m_plHistory, m_ulFilled);
+        m_ulFilled += ulFrames;
+
+        return ulFrames;
+    }
+
+    //
+    // Produces up to ulFrames output frames from the input written so far.
+    // Returns the number produced. The bank must be ready.
+    //
+    ULONG Read
+    (
+        _Out_writes_bytes_(ulFrames * GetOutputFrameBytes()) PBYTE  pData,
+        _In_ ULONG                                                  ulFrames
+    )
+    {
+        ULONG ulProduced = 0;
+        LONG lFrame[RESAMPLER_MAX_CHANNELS];
+
+        if (!IsReady())
+        {
+            return 0;
+        }
+
+        while (ulProduced < ulFrames && m_ulIndex + m_ulTaps <= m_ulFilled)
+        {
+            ULONGLONG ullScaled = m_ullPhase * m_ulPhases;
+            ULONG ulRow = (ULONG)(ullScaled / m_ullPhaseUnit);
+            LONG lBlend = (LONG)(((ullScaled % m_ullPhaseUnit) << RESAMPLER_BLEND_SHIFT) / m_ullPhaseUnit);
+            const LONG * plRow = m_plBank + ulRow * m_ulTaps;
+
+            for (ULONG c = 0; c < m_ulChannels; c++)
+            {
+                const LONG * plSamples = m_plHistory + c * RESAMPLER_HISTORY_FRAMES + m_ulIndex;
+                LONGLONG llOut = ResamplerDot(plSamples, plRow, m_ulTaps) >> RESAMPLER_COEFFICIENT_SHIFT;
+
+                if (lBlend != 0)
+                {
+                    // Between two rows of an interpolated bank.
+                    LONGLONG llNext = ResamplerDot(plSamples, plRow + m_ulTaps, m_ulTaps) >> RESAMPLER_COEFFICIENT_SHIFT;
+
+                    llOut += ((llNext - llOut) * lBlend) >> RESAMPLER_BLEND_SHIFT;
+                }
+
+                lFrame[c] = FixedSaturate(llOut);
+            }
+
+            m_Out.pfnStore(pData, lFrame, m_ulChannels);
+            pData += m_ulOutFrameBytes;
+            ulProduced++;
+
+            m_ulIndex += m_ulStepFrames;
+            m_ullPhase += m_ullStepPhase;
+            if (m_ullPhase >= m_ullPhaseUnit)
+            {
+                m_ullPhase -= m_ullPhaseUnit;
+                m_ulIndex++;
+            }
+        }
+
+        return ulProduced;
+    }
+
+private:
+    //
+    // An exact bank has a row per phase; an interpolated one also has the
+    // row a whole frame on, to blend the last phase with.
+    //
+    ULONG GetLastRow() const
+    {
+        return (m_ulPhases == m_ulUp) ? m_ulPhases - 1 : m_ulPhases;
+    }
+
+    //
+    // Row ulRow, for a delay of ulRow / m_ulPhases frames: tap k is the
+    // filter at k - (taps / 2 - 1) - delay frames, normalized to unit
+    // gain.
+    //
+    VOID BuildRow
+    (
+        _In_ ULONG      ulRow
+    )
+    {
+        PLONG plRow = m_plBank + ulRow * m_ulTaps;
+        LONG lHalf = (LONG)m_ulTaps / 2;
+        LONGLONG llSum = 0;
+
+        for (ULONG k = 0; k < m_ulTaps; k++)
+        {
+            // Filter time in Q20 frames.
+            LONGLONG llTime = ((((LONGLONG)k - lHalf + 1) * m_ulPhases - ulRow) << RESAMPLER_LOOKUP_SHIFT) / (LONGLONG)m_ulPhases;
+            LONGLONG llSinc;
+            LONGLONG llWindow;
+
+            llTime = llTime < 0 ? -llTime : llTime;
+            llSinc = ResamplerLookup(g_ResamplerSinc.Value, RESAMPLER_SINC_ENTRIES,
+                                     ((llTime * m_lCutoff) >> RESAMPLER_COEFFICIENT_SHIFT) * RESAMPLER_SINC_STEPS);
+            llWindow = ResamplerLookup(g_ResamplerWindow.Value, RESAMPLER_WINDOW_STEPS,
+                                       llTime * RESAMPLER_WINDOW_STEPS / lHalf);
+
+            plRow[k] = (LONG)((((llSinc * m_lCutoff) >> RESAMPLER_COEFFICIENT_SHIFT) * llWindow) >> RESAMPLER_COEFFICIENT_SHIFT);
+            llSum += plRow[k];
+        }
+
+        for (ULONG k = 0; k < m_ulTaps && llSum > 0; k++)
+        {
+            plRow[k] = (LONG)(((LONGLONG)plRow[k] << RESAMPLER_COEFFICIENT_SHIFT) / llSum);
+        }
+    }
+};
+typedef CResampler *PCResampler;
+
+#endif // _VIRTUALAUDIODRIVER_RESAMPLER_H_
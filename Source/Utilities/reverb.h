@@ -0,0 +1,534 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    reverb.h
+
+Abstract:
+
+    Feedback delay network reverb applied to stream audio.
+
+    - Eight delay lines of mutually prime lengths (21 ms to 58 ms) feed
+      back through a Hadamard matrix, with a gain per line for a
+      REVERB_T60_MS decay and a one-pole lowpass per line so high
+      frequencies die away sooner.
+    - The network runs a block of REVERB_BLOCK_FRAMES frames at a time.
+      Every line is longer than a block, so a block's delayed samples are
+      all in the lines before it starts: each step (read and damp, mix,
+      write back) is a loop over the block for one line, or across the
+      lines for each frame, and the matrix is a halving fast Walsh-
+      Hadamard transform over plain arrays that the compiler can
+      vectorize.
+    - The input is the downmix of every channel; channel c takes row c of
+      the matrix output, so the channels are decorrelated.
+    - The reverb level is the wet mix: 0 dB is all reverb, and -96 dB and
+      below is off. A level change crossfades over REVERB_FADE_BLOCKS
+      blocks.
+
+    Samples run in fixed point (see fixedsample.h).
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_REVERB_H_
+#define _VIRTUALAUDIODRIVER_REVERB_H_
+
+#include "portable.h"
+#include "fixedsample.h"
+#include "gainramp.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Largest channel count with a dedicated instance (7.1), which is also
+// the number of decorrelated outputs.
+#define REVERB_MAX_CHANNELS         8
+
+#define REVERB_LINES                8
+#define REVERB_BLOCK_FRAMES         64
+#define REVERB_T60_MS               1800
+#define REVERB_DAMPING_HZ           5000
+#define REVERB_MIN_SAMPLE_RATE      8000
+#define REVERB_MAX_SAMPLE_RATE      384000
+
+// Lines start on a cache line.
+#define REVERB_LINE_ALIGNMENT       64
+
+// Blocks a crossfade between off and 0 dB takes.
+#define REVERB_FADE_BLOCKS          8
+
+// Level at which the reverb is off, in 1/65536 dB.
+#define REVERB_LEVEL_OFF            (-96 * 0x10000)
+
+// Share of the downmix fed into each line, in Q30, and gain of the wet
+// outputs (after the halving transform) in Q27, set so the reverb of
+// noise is about as loud as the noise.
+#define REVERB_INPUT_GAIN           (1L << 29)
+#define REVERB_OUTPUT_GAIN          (10L << 27)
+
+//=============================================================================
+// Parameters
+//=============================================================================
+
+// Line lengths at 48 kHz, all prime; other rates scale them.
+constexpr ULONG g_ReverbLineLengths[REVERB_LINES] =
+{
+    1031, 1327, 1523, 1801, 2053, 2311, 2539, 2797
+};
+
+// Sign of each line's input.
+constexpr LONG g_ReverbInputSigns[REVERB_LINES] =
+{
+    1, -1, 1, 1, -1, -1, 1, -1
+};
+
+//
+// Feedback gain of each line in Q29: sqrt(8), which undoes the halving
+// transform's 1/8 scaling for an orthonormal matrix, times the decay
+// over the line's length, 10^(-3 t / T60).
+//
+struct REVERB_FEEDBACK
+{
+    LONG        Gain[REVERB_LINES];
+
+    constexpr REVERB_FEEDBACK() : Gain()
+    {
+        for (ULONG i = 0; i < REVERB_LINES; i++)
+        {
+            double t = g_ReverbLineLengths[i] / 48000.0;
+            double decay = GainExp(-3 * 2.302585092994045684 * t * 1000 / REVERB_T60_MS);
+
+            Gain[i] = (LONG)(2.828427124746190098 * decay * (1L << 29) + 0.5);
+        }
+    }
+};
+
+constexpr REVERB_FEEDBACK g_ReverbFeedback;
+
+//=============================================================================
+// Format kernels
+//=============================================================================
+
+//
+// Downmix writes the average of every channel of ulFrames frames. Mix
+// replaces each sample with dry + (wet - dry) * mix, where the mix starts
+// at lMix and moves by lMixStep every frame (both Q30), and wet is row c
+// of the network output, plWet[c * REVERB_BLOCK_FRAMES + frame].
+//
+typedef VOID REVERB_DOWNMIX_ROUTINE
+(
+    _In_ const BYTE *       pBuffer,
+    _In_ ULONG              ulFrames,
+    _Out_ LONG *            plMono
+);
+typedef REVERB_DOWNMIX_ROUTINE *PFN_REVERB_DOWNMIX;
+
+typedef VOID REVERB_MIX_ROUTINE
+(
+    _Inout_ PBYTE           pBuffer,
+    _In_ ULONG              ulFrames,
+    _In_ const LONG *       plWet,
+    _In_ LONG               lMix,
+    _In_ LONG               lMixStep
+);
+typedef REVERB_MIX_ROUTINE *PFN_REVERB_MIX;
+
+typedef struct _REVERB_IO
+{
+    PFN_REVERB_DOWNMIX  pfnDownmix;
+    PFN_REVERB_MIX      pfnMix;
+    ULONG               ulFrameBytes;
+} REVERB_IO;
+typedef REVERB_IO *PREVERB_IO;
+
+///////////////////////////////////////////////////////////////////////////////
+// ReverbIo
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct ReverbIo
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG FrameBytes = SampleBytes * Channels;
+
+    static VOID Downmix
+    (
+        _In_ const BYTE *       pBuffer,
+        _In_ ULONG              ulFrames,
+        _Out_ LONG *            plMono
+    )
+    {
+        const LONGLONG llScale = (1LL << 30) / Channels;
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            LONGLONG llSum = 0;
+
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                llSum += FixedSample<Bits, Float>::Load(pBuffer + c * SampleBytes);
+            }
+            plMono[i] = (LONG)((llSum * llScale) >> 30);
+            pBuffer += FrameBytes;
+        }
+    }
+
+    static VOID Mix
+    (
+        _Inout_ PBYTE           pBuffer,
+        _In_ ULONG              ulFrames,
+        _In_ const LONG *       plWet,
+        _In_ LONG               lMix,
+        _In_ LONG               lMixStep
+    )
+    {
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                PBYTE pSample = pBuffer + c * SampleBytes;
+                LONG lDry = FixedSample<Bits, Float>::Load(pSample);
+                LONGLONG llWet = ((LONGLONG)plWet[c * REVERB_BLOCK_FRAMES + i] * REVERB_OUTPUT_GAIN) >> 27;
+
+                FixedSample<Bits, Float>::Store(pSample, FixedSaturate(lDry + (((llWet - lDry) * lMix) >> 30)));
+            }
+            lMix += lMixStep;
+            pBuffer += FrameBytes;
+        }
+    }
+};
+
+template <ULONG Bits, ULONG Channels, BOOL Float>
+VOID SetReverbIo
+(
+    _Out_ PREVERB_IO        pIo
+)
+{
+    pIo->pfnDownmix = ReverbIo<Bits, Channels, Float>::Downmix;
+    pIo->pfnMix = ReverbIo<Bits, Channels, Float>::Mix;
+    pIo->ulFrameBytes = ReverbIo<Bits, Channels, Float>::FrameBytes;
+}
+
+template <ULONG Bits, BOOL Float>
+BOOL SelectReverbIo
+(
+    _In_ ULONG              ulChannels,
+    _Out_ PREVERB_IO        pIo
+)
+{
+    switch (ulChannels)
+    {
+        case 1: SetReverbIo<Bits, 1, Float>(pIo); return TRUE;
+        case 2: SetReverbIo<Bits, 2, Float>(pIo); return TRUE;
+        case 3: SetReverbIo<Bits, 3, Float>(pIo); return TRUE;
+        case 4: SetReverbIo<Bits, 4, Float>(pIo); return TRUE;
+        case 5: SetReverbIo<Bits, 5, Float>(pIo); return TRUE;
+        case 6: SetReverbIo<Bits, 6, Float>(pIo); return TRUE;
+        case 7: SetReverbIo<Bits, 7, Float>(pIo); return TRUE;
+        case 8: SetReverbIo<Bits, 8, Float>(pIo); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Picks the instance for a stream format: 8/16/24/32-bit PCM and 32-bit
+// float with 1 to REVERB_MAX_CHANNELS channels. Returns FALSE otherwise.
+//
+inline BOOL GetReverbIo
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat,
+    _Out_ PREVERB_IO        pIo
+)
+{
+    RtlZeroMemory(pIo, sizeof(*pIo));
+
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectReverbIo<32, TRUE>(ulChannels, pIo) : FALSE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectReverbIo<8, FALSE>(ulChannels, pIo);
+        case 16: return SelectReverbIo<16, FALSE>(ulChannels, pIo);
+        case 24: return SelectReverbIo<24, FALSE>(ulChannels, pIo);
+        case 32: return SelectReverbIo<32, FALSE>(ulChannels, pIo);
+    }
+
+    return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CReverb
+//
+//   Owned by one stream and only touched from its position update. While
+//   the level is off and the last crossfade has finished the network does
+//   not run (IsIdle); it restarts from silence.
+//
+class CReverb
+{
+protected:
+    REVERB_IO                   m_Io;
+    ULONG                       m_ulChannels;
+    LONG                        m_lDamping;                     // Q30 lowpass coefficient.
+    LONG                        m_lMix;                         // Q30.
+    LONG                        m_lMixTarget;
+    BOOL                        m_bSilent;                      // Lines hold no tail.
+    PLONG                       m_plLine[REVERB_LINES];
+    ULONG                       m_ulLength[REVERB_LINES];
+    ULONG                       m_ulPosition[REVERB_LINES];     // Oldest sample, written next.
+    LONG                        m_lLowpass[REVERB_LINES];
+    LONG                        m_lMono[REVERB_BLOCK_FRAMES];
+    LONG                        m_lWork[REVERB_LINES * REVERB_BLOCK_FRAMES];
+
+public:
+    CReverb() :
+        m_ulChannels(0),
+        m_lDamping(0),
+        m_lMix(0),
+        m_lMixTarget(0),
+        m_bSilent(TRUE)
+    {
+        RtlZeroMemory(&m_Io, sizeof(m_Io));
+        RtlZeroMemory(m_plLine, sizeof(m_plLine));
+        RtlZeroMemory(m_ulLength, sizeof(m_ulLength));
+        RtlZeroMemory(m_ulPosition, sizeof(m_ulPosition));
+        RtlZeroMemory(m_lLowpass, sizeof(m_lLowpass));
+    }
+
+    //
+    // Bytes of delay line storage Init needs at a sample rate, 0 if the
+    // rate is not supported.
+    //
+    static ULONG GetStorageBytes
+    (
+        _In_ ULONG      ulSampleRate
+    )
+    {
+        ULONG cbStorage = REVERB_LINE_ALIGNMENT;
+
+        if (ulSampleRate < REVERB_MIN_SAMPLE_RATE || ulSampleRate > REVERB_MAX_SAMPLE_RATE)
+        {
+            return 0;
+        }
+
+        for (ULONG i = 0; i < REVERB_LINES; i++)
+        {
+            cbStorage += LineBytes(LineLength(i, ulSampleRate));
+        }
+
+        return cbStorage;
+    }
+
+    //
+    // Binds pStorage, at least GetStorageBytes(ulSampleRate) bytes, as the
+    // delay lines. Returns FALSE, and leaves the audio alone, for rates
+    // and formats the reverb does not cover.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulChannels,
+        _In_ BOOL       bFloat,
+        _In_ PVOID      pStorage,
+        _In_ ULONG      cbStorage
+    )
+    {
+        ULONG cbNeeded = GetStorageBytes(ulSampleRate);
+        PBYTE pLine = (PBYTE)pStorage;
+
+        if (cbNeeded == 0 || pStorage == NULL || cbStorage < cbNeeded ||
+            !GetReverbIo(ulBitsPerSample, ulChannels, bFloat, &m_Io))
+        {
+            RtlZeroMemory(&m_Io, sizeof(m_Io));
+            return FALSE;
+        }
+
+        pLine += (REVERB_LINE_ALIGNMENT - ((ULONG_PTR)pLine & (REVERB_LINE_ALIGNMENT - 1))) & (REVERB_LINE_ALIGNMENT - 1);
+        for (ULONG i = 0; i < REVERB_LINES; i++)
+        {
+            m_plLine[i] = (PLONG)pLine;
+            m_ulLength[i] = LineLength(i, ulSampleRate);
+            pLine += LineBytes(m_ulLength[i]);
+        }
+
+        // 1 - e^(-2 pi f / fs); e^-x is the gain of a volume of
+        // -x * 20 / ln(10) dB.
+        m_lDamping = GAIN_Q30_ONE -
+                     GainFromVolume((LONG)(-(LONGLONG)REVERB_DAMPING_HZ * 3576631 / ulSampleRate));
+        m_ulChannels = ulChannels;
+        m_bSilent = FALSE;
+        Clear();
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_Io.pfnMix != NULL;
+    }
+
+    BOOL IsIdle() const
+    {
+        return m_lMix == 0 && m_lMixTarget == 0;
+    }
+
+    //
+    // Sets the wet mix from a reverb level in 1/65536 dB.
+    //
+    VOID SetLevel
+    (
+        _In_ LONG       lLevel
+    )
+    {
+        m_lMixTarget = (lLevel <= REVERB_LEVEL_OFF) ? 0 : GainFromVolume(lLevel);
+    }
+
+    //
+    // Adds reverb to the whole frames in pData, which follow the frames
+    // of the previous call.
+    //
+    VOID Process
+    (
+        _Inout_updates_bytes_(cbData) PBYTE     pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG ulFrames = IsActive() ? cbData / m_Io.ulFrameBytes : 0;
+
+        if (IsIdle())
+        {
+            if (!m_bSilent)
+            {
+                Clear();
+            }
+            return;
+        }
+
+        m_bSilent = FALSE;
+        while (ulFrames > 0)
+        {
+            ULONG ulBlock = ulFrames < REVERB_BLOCK_FRAMES ? ulFrames : REVERB_BLOCK_FRAMES;
+            // Move at most 1/REVERB_FADE_BLOCKS of full scale per full block.
+            LONG lMaxStep = (LONG)(GAIN_Q30_ONE / (REVERB_FADE_BLOCKS * REVERB_BLOCK_FRAMES) * ulBlock);
+            LONG lMix = m_lMixTarget;
+            LONG lMixStep;
+
+            lMix = (lMix > m_lMix + lMaxStep) ? m_lMix + lMaxStep :
+                   (lMix < m_lMix - lMaxStep) ? m_lMix - lMaxStep : lMix;
+            lMixStep = (LONG)(((LONGLONG)lMix - m_lMix) / (LONG)ulBlock);
+
+            m_Io.pfnDownmix(pData, ulBlock, m_lMono);
+            RunNetwork(ulBlock);
+            m_Io.pfnMix(pData, ulBlock, m_lWork, m_lMix, lMixStep);
+
+            m_lMix = lMix;
+            pData += ulBlock * m_Io.ulFrameBytes;
+            ulFrames -= ulBlock;
+        }
+    }
+
+private:
+    static ULONG LineLength(_In_ ULONG ulLine, _In_ ULONG ulSampleRate)
+    {
+        return (ULONG)(((ULONGLONG)g_ReverbLineLengths[ulLine] * ulSampleRate + 24000) / 48000);
+    }
+
+    static ULONG LineBytes(_In_ ULONG ulLength)
+    {
+        return (ulLength * sizeof(LONG) + REVERB_LINE_ALIGNMENT - 1) & ~(REVERB_LINE_ALIGNMENT - 1);
+    }
+
+    VOID Clear()
+    {
+        for (ULONG i = 0; i < REVERB_LINES; i++)
+        {
+            RtlZeroMemory(m_plLine[i], m_ulLength[i] * sizeof(LONG));
+            m_ulPosition[i] = 0;
+            m_lLowpass[i] = 0;
+        }
+        m_bSilent = TRUE;
+    }
+
+    //
+    // One block through the network; leaves row c of the output in
+    // m_lWork[c * REVERB_BLOCK_FRAMES ...].
+    //
+    VOID RunNetwork(_In_ ULONG ulBlock)
+    {
+        // Read and damp each line's next ulBlock samples.
+        for (ULONG i = 0; i < REVERB_LINES; i++)
+        {
+            PLONG plLine = m_plLine[i];
+            PLONG plWork = m_lWork + i * REVERB_BLOCK_FRAMES;
+            ULONG ulPosition = m_ulPosition[i];
+            LONG lLowpass = m_lLowpass[i];
+
+            for (ULONG n = 0; n < ulBlock; n++)
+            {
+                lLowpass += (LONG)((((LONGLONG)plLine[ulPosition] - lLowpass) * m_lDamping) >> 30);
+                plWork[n] = lLowpass;
+                ulPosition = (ulPosition + 1 == m_ulLength[i]) ? 0 : ulPosition + 1;
+            }
+            m_lLowpass[i] = lLowpass;
+        }
+
+        // H x / 8 across the lines for every frame: three butterfly stages,
+        // each halving so nothing overflows.
+        for (ULONG ulSpan = 1; ulSpan < REVERB_LINES; ulSpan <<= 1)
+        {
+            for (ULONG i = 0; i < REVERB_LINES; i += 2 * ulSpan)
+            {
+                for (ULONG j = i; j < i + ulSpan; j++)
+                {
+                    PLONG plA = m_lWork + j * REVERB_BLOCK_FRAMES;
+                    PLONG plB = m_lWork + (j + ulSpan) * REVERB_BLOCK_FRAMES;
+
+                    for (ULONG n = 0; n < ulBlock; n++)
+                    {
+                        LONG lA = plA[n] >> 1;
+                        LONG lB = plB[n] >> 1;
+
+                        plA[n] = lA + lB;
+                        plB[n] = lA - lB;
+                    }
+                }
+            }
+        }
+
+        // Feed back, decayed, with the input.
+        for (ULONG i = 0; i < REVERB_LINES; i++)
+        {
+            PLONG plLine = m_plLine[i];
+            const LONG * plWork = m_lWork + i * REVERB_BLOCK_FRAMES;
+            ULONG ulPosition = m_ulPosition[i];
+            LONG lGain = g_ReverbFeedback.Gain[i];
+            LONG lInput = g_ReverbInputSigns[i] * REVERB_INPUT_GAIN;
+
+            // In runs up to the end of the line.
+            for (ULONG n = 0; n < ulBlock; )
+            {
+                ULONG ulRun = m_ulLength[i] - ulPosition;
+                PLONG plOut = plLine + ulPosition;
+
+                ulRun = ulRun < ulBlock - n ? ulRun : ulBlock - n;
+                for (ULONG k = 0; k < ulRun; k++)
+                {
+                    plOut[k] = FixedSaturate((((LONGLONG)plWork[n + k] * lGain) >> 29) +
+                                             (((LONGLONG)m_lMono[n + k] * lInput) >> 30));
+                }
+
+                n += ulRun;
+                ulPosition += ulRun;
+                ulPosition = (ulPosition == m_ulLength[i]) ? 0 : ulPosition;
+            }
+            m_ulPosition[i] = ulPosition;
+        }
+    }
+};
+typedef CReverb *PCReverb;
+
+#endif // _VIRTUALAUDIODRIVER_REVERB_H_
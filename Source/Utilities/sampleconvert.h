@@ -0,0 +1,843 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    sampleconvert.h
+
+Abstract:
+
+    Sample format conversion between any two of unsigned 8-bit, 16-bit,
+    packed 24-bit, 24-bit in a 32-bit container, 32-bit PCM and 32-bit
+    float.
+
+    - Samples pass through a Q31 value (full scale +-2^31). Widening is
+      exact; narrowing rounds to nearest and saturates, with TPDF dither
+      of +-1 destination LSB when asked for. Float output is rounded to
+      nearest even. Everything is integer math, so no conversion needs
+      the floating point state saved.
+    - Every pair has a scalar kernel. The vector path replaces the common
+      16 <-> 24-in-32/32 and 16/24-in-32/32 -> float pairs with SSE2 on
+      x64, where SSE2 is the baseline; other pairs and architectures keep
+      the scalar kernel. Both paths give the same bits, dither included:
+      the vector path runs the two dither generators four samples ahead.
+
+    A converter is picked once per pair of formats (CSampleConverter::Init)
+    and then only moves samples.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_SAMPLECONVERT_H_
+#define _VIRTUALAUDIODRIVER_SAMPLECONVERT_H_
+
+#include "portable.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SAMPLE_CONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Dither generators: two linear congruential sequences, one uniform
+// value per sample from the top 16 bits of each.
+#define SAMPLE_DITHER_A_MULTIPLIER  1664525UL
+#define SAMPLE_DITHER_A_INCREMENT   1013904223UL
+#define SAMPLE_DITHER_B_MULTIPLIER  22695477UL
+#define SAMPLE_DITHER_B_INCREMENT   1UL
+
+typedef enum
+{
+    eSampleU8 = 0,
+    eSampleS16,
+    eSampleS24,                     // Packed.
+    eSampleS24In32,                 // Left-justified, low byte zero.
+    eSampleS32,
+    eSampleFloat32,
+    eSampleFormatCount
+} eSampleFormat;
+
+typedef enum
+{
+    eSampleConvertScalar = 0,
+    eSampleConvertVector
+} eSampleConvertPath;
+
+typedef struct _SAMPLE_DITHER
+{
+    ULONG       ulA;
+    ULONG       ulB;
+} SAMPLE_DITHER;
+typedef SAMPLE_DITHER *PSAMPLE_DITHER;
+
+//
+// Converts ulSamples samples, channels interleaved or not.
+//
+typedef VOID SAMPLE_CONVERT_ROUTINE
+(
+    _In_ const BYTE *       pSource,
+    _Out_ PBYTE             pDestination,
+    _In_ ULONG              ulSamples,
+    _Inout_ PSAMPLE_DITHER  pDither
+);
+typedef SAMPLE_CONVERT_ROUTINE *PFN_SAMPLE_CONVERT;
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+//
+// Inverse of an odd multiplier modulo 2^32, by Newton's iteration; each
+// step doubles the correct low bits.
+//
+constexpr ULONG SampleInverse(ULONG ulMultiplier)
+{
+    ULONG ulInverse = ulMultiplier;
+
+    for (ULONG k = 0; k < 5; k++)
+    {
+        ulInverse *= 2 - ulMultiplier * ulInverse;
+    }
+
+    return ulInverse;
+}
+
+//
+// Next TPDF value, in 2^-16 LSB: the sum of two uniform values, between
+// -65535 and 65535.
+//
+inline LONG SampleDitherNext(_Inout_ PSAMPLE_DITHER pDither)
+{
+    pDither->ulA = pDither->ulA * SAMPLE_DITHER_A_MULTIPLIER + SAMPLE_DITHER_A_INCREMENT;
+    pDither->ulB = pDither->ulB * SAMPLE_DITHER_B_MULTIPLIER + SAMPLE_DITHER_B_INCREMENT;
+
+    return (LONG)(pDither->ulA >> 16) + (LONG)(pDither->ulB >> 16) - 0xFFFF;
+}
+
+//
+// Rounds a Q31 value to Bits bits after adding lDither (2^-16 LSB), and
+// saturates. The result is still Q31 with the low bits clear.
+//
+template <ULONG Bits>
+inline LONG SampleQuantize(_In_ LONG lValue, _In_ LONG lDither)
+{
+    const ULONG     Shift = 32 - Bits;
+    const LONGLONG  Max = (1LL << (Bits - 1)) - 1;
+    LONGLONG        llDither = (Shift >= 16) ? ((LONGLONG)lDither << (Shift - 16)) : ((LONGLONG)lDither >> (16 - Shift));
+    LONGLONG        llValue = ((LONGLONG)lValue + (1LL << (Shift - 1)) + llDither) >> Shift;
+
+    llValue = llValue > Max ? Max : llValue < -Max - 1 ? -Max - 1 : llValue;
+
+    return (LONG)((ULONG)llValue << Shift);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SampleCodec
+//
+//   Load reads one little-endian sample as Q31; Store writes a Q31 value
+//   the format can hold exactly (integers) or rounds it (float). Bits is
+//   the precision the format carries.
+//
+template <eSampleFormat Format>
+struct SampleCodec;
+
+template <>
+struct SampleCodec<eSampleU8>
+{
+    static const ULONG Bytes = 1;
+    static const ULONG Bits = 8;
+
+    static LONG Load(_In_ const BYTE * p)
+    {
+        return (LONG)(((ULONG)p[0] ^ 0x80) << 24);
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        p[0] = (BYTE)(((ULONG)lValue >> 24) ^ 0x80);
+    }
+};
+
+template <>
+struct SampleCodec<eSampleS16>
+{
+    static const ULONG Bytes = 2;
+    static const ULONG Bits = 16;
+
+    static LONG Load(_In_ const BYTE * p)
+    {
+        return (LONG)(((ULONG)p[0] << 16) | ((ULONG)p[1] << 24));
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        p[0] = (BYTE)((ULONG)lValue >> 16);
+        p[1] = (BYTE)((ULONG)lValue >> 24);
+    }
+};
+
+template <>
+struct SampleCodec<eSampleS24>
+{
+    static const ULONG Bytes = 3;
+    static const ULONG Bits = 24;
+
+    static LONG Load(_In_ const BYTE * p)
+    {
+        return (LONG)(((ULONG)p[0] << 8) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 24));
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        p[0] = (BYTE)((ULONG)lValue >> 8);
+        p[1] = (BYTE)((ULONG)lValue >> 16);
+        p[2] = (BYTE)((ULONG)lValue >> 24);
+    }
+};
+
+template <>
+struct SampleCodec<eSampleS24In32>
+{
+    static const ULONG Bytes = 4;
+    static const ULONG Bits = 24;
+
+    static LONG Load(_In_ const BYTE * p)
+    {
+        return (LONG)(((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24));
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        p[0] = 0;
+        p[1] = (BYTE)((ULONG)lValue >> 8);
+        p[2] = (BYTE)((ULONG)lValue >> 16);
+        p[3] = (BYTE)((ULONG)lValue >> 24);
+    }
+};
+
+template <>
+struct SampleCodec<eSampleS32>
+{
+    static const ULONG Bytes = 4;
+    static const ULONG Bits = 32;
+
+    static LONG Load(_In_ const BYTE * p)
+    {
+        return (LONG)((ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24));
+    }
+
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        p[0] = (BYTE)lValue;
+        p[1] = (BYTE)((ULONG)lValue >> 8);
+        p[2] = (BYTE)((ULONG)lValue >> 16);
+        p[3] = (BYTE)((ULONG)lValue >> 24);
+    }
+};
+
+template <>
+struct SampleCodec<eSampleFloat32>
+{
+    static const ULONG Bytes = 4;
+    static const ULONG Bits = 32;       // Near zero a float holds more than its 24-bit mantissa.
+
+    //
+    // IEEE single to Q31, truncated. Magnitudes of 1 and above and
+    // infinities saturate; NaNs become 0.
+    //
+    static LONG Load(_In_ const BYTE * p)
+    {
+        ULONG ulBits = (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+        LONG lExponent = (LONG)((ulBits >> 23) & 0xFF);
+        ULONG ulMantissa = (ulBits & 0x7FFFFF) | 0x800000;
+        LONG lShift = lExponent - 127 - 23 + 31;
+        ULONG ulMagnitude;
+
+        if (lExponent == 0xFF && (ulBits & 0x7FFFFF))
+        {
+            return 0;
+        }
+
+        if (lShift >= 31 - 23)
+        {
+            // -1.0 is the one value at the limit that fits.
+            return (ulBits & 0x80000000) ? (LONG)0x80000000 : 0x7FFFFFFF;
+        }
+
+        ulMagnitude = (lShift >= 0) ? (ulMantissa << lShift) : (lShift > -24) ? (ulMantissa >> -lShift) : 0;
+
+        return (ulBits & 0x80000000) ? -(LONG)ulMagnitude : (LONG)ulMagnitude;
+    }
+
+    //
+    // Q31 to IEEE single, rounded to nearest even.
+    //
+    static VOID Store(_Out_ PBYTE p, _In_ LONG lValue)
+    {
+        ULONG ulSign = (lValue < 0) ? 0x80000000 : 0;
+        ULONG ulMagnitude = (lValue < 0) ? (ULONG)0 - (ULONG)lValue : (ULONG)lValue;
+        ULONG ulBits = 0;
+
+        if (ulMagnitude != 0)
+        {
+            LONG lLeading = 31;
+            ULONG ulMantissa;
+
+            // Normalize so the leading one is bit 31.
+            while ((ulMagnitude & 0xFF000000) == 0) { ulMagnitude <<= 8; lLeading -= 8; }
+            while ((ulMagnitude & 0x80000000) == 0) { ulMagnitude <<= 1; lLeading -= 1; }
+
+            ulMantissa = ulMagnitude >> 8;
+            if ((ulMagnitude & 0xFF) > 0x80 || ((ulMagnitude & 0xFF) == 0x80 && (ulMantissa & 1)))
+            {
+                ulMantissa++;
+                if (ulMantissa >> 24)
+                {
+                    ulMantissa >>= 1;
+                    lLeading++;
+                }
+            }
+
+            ulBits = ulSign | ((ULONG)(lLeading - 31 + 127) << 23) | (ulMantissa & 0x7FFFFF);
+        }
+
+        p[0] = (BYTE)ulBits;
+        p[1] = (BYTE)(ulBits >> 8);
+        p[2] = (BYTE)(ulBits >> 16);
+        p[3] = (BYTE)(ulBits >> 24);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// SampleConvertScalar
+//
+//   Integer destinations narrower than the source are quantized, with
+//   dither when Dither is set.
+//
+template <eSampleFormat Source, eSampleFormat Destination, BOOL Dither>
+struct SampleConvertScalar
+{
+    static const BOOL Narrowing = (Destination != eSampleFloat32) &&
+                                  (SampleCodec<Destination>::Bits < SampleCodec<Source>::Bits);
+
+    static VOID Convert
+    (
+        _In_ const BYTE *       pSource,
+        _Out_ PBYTE             pDestination,
+        _In_ ULONG              ulSamples,
+        _Inout_ PSAMPLE_DITHER  pDither
+    )
+    {
+        for (ULONG i = 0; i < ulSamples; i++)
+        {
+            LONG lValue = SampleCodec<Source>::Load(pSource);
+
+            if (Narrowing)
+            {
+                lValue = SampleQuantize<Narrowing ? SampleCodec<Destination>::Bits : 16>(lValue, Dither ? SampleDitherNext(pDither) : 0);
+            }
+
+            SampleCodec<Destination>::Store(pDestination, lValue);
+            pSource += SampleCodec<Source>::Bytes;
+            pDestination += SampleCodec<Destination>::Bytes;
+        }
+    }
+};
+
+#ifdef SAMPLE_CONVERT_SSE2
+///////////////////////////////////////////////////////////////////////////////
+// SSE2 kernels
+//
+//   Four samples a step; the tail goes through the scalar kernel.
+//
+
+//
+// Low 32 bits of the lane products.
+//
+inline __m128i SampleMultiplyLow(_In_ __m128i a, _In_ __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+//
+// The dither generators four samples at a time. The lanes hold the next
+// four states of each sequence; a step moves every lane four on.
+//
+struct SampleDitherVector
+{
+    __m128i     A;
+    __m128i     B;
+    __m128i     AMultiplier;
+    __m128i     AIncrement;
+    __m128i     BMultiplier;
+    __m128i     BIncrement;
+
+    VOID Begin(_In_ const SAMPLE_DITHER * pDither)
+    {
+        SAMPLE_DITHER dither = *pDither;
+        ULONG ulA[4];
+        ULONG ulB[4];
+        ULONG ulAMultiplier = 1;
+        ULONG ulAIncrement = 0;
+        ULONG ulBMultiplier = 1;
+        ULONG ulBIncrement = 0;
+
+        for (ULONG k = 0; k < 4; k++)
+        {
+            SampleDitherNext(&dither);
+            ulA[k] = dither.ulA;
+            ulB[k] = dither.ulB;
+
+            // Four steps of x -> m x + c compose to x -> m^4 x + c (1 + m + m^2 + m^3).
+            ulAIncrement = ulAIncrement * SAMPLE_DITHER_A_MULTIPLIER + SAMPLE_DITHER_A_INCREMENT;
+            ulAMultiplier *= SAMPLE_DITHER_A_MULTIPLIER;
+            ulBIncrement = ulBIncrement * SAMPLE_DITHER_B_MULTIPLIER + SAMPLE_DITHER_B_INCREMENT;
+            ulBMultiplier *= SAMPLE_DITHER_B_MULTIPLIER;
+        }
+
+        A = _mm_setr_epi32((int)ulA[0], (int)ulA[1], (int)ulA[2], (int)ulA[3]);
+        B = _mm_setr_epi32((int)ulB[0], (int)ulB[1], (int)ulB[2], (int)ulB[3]);
+        AMultiplier = _mm_set1_epi32((int)ulAMultiplier);
+        AIncrement = _mm_set1_epi32((int)ulAIncrement);
+        BMultiplier = _mm_set1_epi32((int)ulBMultiplier);
+        BIncrement = _mm_set1_epi32((int)ulBIncrement);
+    }
+
+    //
+    // TPDF values of the four lanes, then steps them.
+    //
+    __m128i Next()
+    {
+        __m128i dither = _mm_sub_epi32(_mm_add_epi32(_mm_srli_epi32(A, 16), _mm_srli_epi32(B, 16)), _mm_set1_epi32(0xFFFF));
+
+        A = _mm_add_epi32(SampleMultiplyLow(A, AMultiplier), AIncrement);
+        B = _mm_add_epi32(SampleMultiplyLow(B, BMultiplier), BIncrement);
+
+        return dither;
+    }
+
+    //
+    // Leaves pDither where the scalar generator would be after the values
+    // taken so far: one step before lane 0.
+    //
+    VOID End(_Out_ PSAMPLE_DITHER pDither)
+    {
+        const ULONG ulAInverse = SampleInverse(SAMPLE_DITHER_A_MULTIPLIER);
+        const ULONG ulBInverse = SampleInverse(SAMPLE_DITHER_B_MULTIPLIER);
+
+        pDither->ulA = ((ULONG)_mm_cvtsi128_si32(A) - SAMPLE_DITHER_A_INCREMENT) * ulAInverse;
+        pDither->ulB = ((ULONG)_mm_cvtsi128_si32(B) - SAMPLE_DITHER_B_INCREMENT) * ulBInverse;
+    }
+};
+
+//
+// 16-bit to Q31 in 32-bit lanes (24-in-32 and 32-bit PCM).
+//
+struct SampleConvertWiden16
+{
+    static VOID Convert
+    (
+        _In_ const BYTE *       pSource,
+        _Out_ PBYTE             pDestination,
+        _In_ ULONG              ulSamples,
+        _Inout_ PSAMPLE_DITHER  pDither
+    )
+    {
+        const __m128i zero = _mm_setzero_si128();
+        ULONG i = 0;
+
+        for (; i + 8 <= ulSamples; i += 8)
+        {
+            __m128i samples = _mm_loadu_si128((const __m128i *)(pSource + i * 2));
+
+            _mm_storeu_si128((__m128i *)(pDestination + i * 4), _mm_unpacklo_epi16(zero, samples));
+            _mm_storeu_si128((__m128i *)(pDestination + i * 4 + 16), _mm_unpackhi_epi16(zero, samples));
+        }
+
+        SampleConvertScalar<eSampleS16, eSampleS32, FALSE>::Convert(pSource + i * 2, pDestination + i * 4, ulSamples - i, pDither);
+    }
+};
+
+//
+// Q31 lanes to float. The conversion is exact up to the rounding the
+// scalar kernel does, to nearest even; scaling by 2^-31 only moves the
+// exponent.
+//
+inline __m128i SampleFloatBits(_In_ __m128i values)
+{
+    __m128i bits = _mm_castps_si128(_mm_cvtepi32_ps(values));
+    __m128i nonzero = _mm_andnot_si128(_mm_cmpeq_epi32(values, _mm_setzero_si128()), _mm_set1_epi32(-1));
+
+    return _mm_sub_epi32(bits, _mm_and_si128(nonzero, _mm_set1_epi32(31 << 23)));
+}
+
+template <eSampleFormat Source>
+struct SampleConvertToFloat
+{
+    static VOID Convert
+    (
+        _In_ const BYTE *       pSource,
+        _Out_ PBYTE             pDestination,
+        _In_ ULONG              ulSamples,
+        _Inout_ PSAMPLE_DITHER  pDither
+    )
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i mask = _mm_set1_epi32((Source == eSampleS24In32) ? (int)0xFFFFFF00 : -1);
+        ULONG i = 0;
+
+        for (; i + 4 <= ulSamples; i += 4)
+        {
+            __m128i values;
+
+            if (Source == eSampleS16)
+            {
+                values = _mm_unpacklo_epi16(zero, _mm_loadl_epi64((const __m128i *)(pSource + i * 2)));
+            }
+            else
+            {
+                values = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pSource + i * 4)), mask);
+            }
+
+            _mm_storeu_si128((__m128i *)(pDestination + i * 4), SampleFloatBits(values));
+        }
+
+        SampleConvertScalar<Source, eSampleFloat32, FALSE>::Convert(pSource + i * SampleCodec<Source>::Bytes, pDestination + i * 4, ulSamples - i, pDither);
+    }
+};
+
+//
+// 24-in-32 or 32-bit PCM to 16-bit, rounded after the dither exactly as
+// SampleQuantize<16> does: the high half plus the carry out of the low
+// half, then saturated by the pack.
+//
+template <eSampleFormat Source, BOOL Dither>
+struct SampleConvertNarrow16
+{
+    static VOID Convert
+    (
+        _In_ const BYTE *       pSource,
+        _Out_ PBYTE             pDestination,
+        _In_ ULONG              ulSamples,
+        _Inout_ PSAMPLE_DITHER  pDither
+    )
+    {
+        const __m128i mask = _mm_set1_epi32((Source == eSampleS24In32) ? (int)0xFFFFFF00 : -1);
+        const __m128i lowMask = _mm_set1_epi32(0xFFFF);
+        const __m128i half = _mm_set1_epi32(0x8000);
+        SampleDitherVector dither;
+        ULONG i = 0;
+
+        if (Dither)
+        {
+            dither.Begin(pDither);
+        }
+
+        for (; i + 8 <= ulSamples; i += 8)
+        {
+            __m128i low = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pSource + i * 4)), mask);
+            __m128i high = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pSource + i * 4 + 16)), mask);
+            __m128i lowRest = _mm_add_epi32(_mm_and_si128(low, lowMask), half);
+            __m128i highRest = _mm_add_epi32(_mm_and_si128(high, lowMask), half);
+
+            if (Dither)
+            {
+                lowRest = _mm_add_epi32(lowRest, dither.Next());
+                highRest = _mm_add_epi32(highRest, dither.Next());
+            }
+
+            low = _mm_add_epi32(_mm_srai_epi32(low, 16), _mm_srai_epi32(lowRest, 16));
+            high = _mm_add_epi32(_mm_srai_epi32(high, 16), _mm_srai_epi32(highRest, 16));
+
+            _mm_storeu_si128((__m128i *)(pDestination + i * 2), _mm_packs_epi32(low, high));
+        }
+
+        if (Dither)
+        {
+            dither.End(pDither);
+        }
+
+        SampleConvertScalar<Source, eSampleS16, Dither>::Convert(pSource + i * 4, pDestination + i * 2, ulSamples - i, pDither);
+    }
+};
+#endif // SAMPLE_CONVERT_SSE2
+
+///////////////////////////////////////////////////////////////////////////////
+// SampleConvertCopy
+//
+template <ULONG Bytes>
+struct SampleConvertCopy
+{
+    static VOID Convert
+    (
+        _In_ const BYTE *       pSource,
+        _Out_ PBYTE             pDestination,
+        _In_ ULONG              ulSamples,
+        _Inout_ PSAMPLE_DITHER  pDither
+    )
+    {
+        UNREFERENCED_PARAMETER(pDither);
+
+        RtlCopyMemory(pDestination, pSource, ulSamples * Bytes);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// SampleConvertPick
+//
+//   The kernel for a pair. Specialized where the vector path has its own.
+//
+template <eSampleFormat Source, eSampleFormat Destination>
+struct SampleConvertPick
+{
+    static PFN_SAMPLE_CONVERT Get(_In_ BOOL bDither, _In_ eSampleConvertPath ePath)
+    {
+        UNREFERENCED_PARAMETER(ePath);
+
+        if (Source == Destination)
+        {
+            return SampleConvertCopy<SampleCodec<Source>::Bytes>::Convert;
+        }
+
+        return bDither ? SampleConvertScalar<Source, Destination, TRUE>::Convert :
+                         SampleConvertScalar<Source, Destination, FALSE>::Convert;
+    }
+};
+
+#ifdef SAMPLE_CONVERT_SSE2
+template <eSampleFormat Destination>
+struct SampleConvertPickWiden16
+{
+    static PFN_SAMPLE_CONVERT Get(_In_ BOOL bDither, _In_ eSampleConvertPath ePath)
+    {
+        UNREFERENCED_PARAMETER(bDither);
+
+        return (ePath == eSampleConvertVector) ? SampleConvertWiden16::Convert :
+                                                 SampleConvertScalar<eSampleS16, Destination, FALSE>::Convert;
+    }
+};
+
+template <> struct SampleConvertPick<eSampleS16, eSampleS24In32> : SampleConvertPickWiden16<eSampleS24In32> {};
+template <> struct SampleConvertPick<eSampleS16, eSampleS32> : SampleConvertPickWiden16<eSampleS32> {};
+
+template <eSampleFormat Source>
+struct SampleConvertPickToFloat
+{
+    static PFN_SAMPLE_CONVERT Get(_In_ BOOL bDither, _In_ eSampleConvertPath ePath)
+    {
+        UNREFERENCED_PARAMETER(bDither);
+
+        return (ePath == eSampleConvertVector) ? SampleConvertToFloat<Source>::Convert :
+                                                 SampleConvertScalar<Source, eSampleFloat32, FALSE>::Convert;
+    }
+};
+
+template <> struct SampleConvertPick<eSampleS16, eSampleFloat32> : SampleConvertPickToFloat<eSampleS16> {};
+template <> struct SampleConvertPick<eSampleS24In32, eSampleFloat32> : SampleConvertPickToFloat<eSampleS24In32> {};
+template <> struct SampleConvertPick<eSampleS32, eSampleFloat32> : SampleConvertPickToFloat<eSampleS32> {};
+
+template <eSampleFormat Source>
+struct SampleConvertPickNarrow16
+{
+    static PFN_SAMPLE_CONVERT Get(_In_ BOOL bDither, _In_ eSampleConvertPath ePath)
+    {
+        if (ePath == eSampleConvertVector)
+        {
+            return bDither ? SampleConvertNarrow16<Source, TRUE>::Convert :
+                             SampleConvertNarrow16<Source, FALSE>::Convert;
+        }
+
+        return bDither ? SampleConvertScalar<Source, eSampleS16, TRUE>::Convert :
+                         SampleConvertScalar<Source, eSampleS16, FALSE>::Convert;
+    }
+};
+
+template <> struct SampleConvertPick<eSampleS24In32, eSampleS16> : SampleConvertPickNarrow16<eSampleS24In32> {};
+template <> struct SampleConvertPick<eSampleS32, eSampleS16> : SampleConvertPickNarrow16<eSampleS32> {};
+#endif // SAMPLE_CONVERT_SSE2
+
+template <eSampleFormat Source>
+PFN_SAMPLE_CONVERT SelectSampleConvert
+(
+    _In_ eSampleFormat      eDestination,
+    _In_ BOOL               bDither,
+    _In_ eSampleConvertPath ePath
+)
+{
+    switch (eDestination)
+    {
+        case eSampleU8:         return SampleConvertPick<Source, eSampleU8>::Get(bDither, ePath);
+        case eSampleS16:        return SampleConvertPick<Source, eSampleS16>::Get(bDither, ePath);
+        case eSampleS24:        return SampleConvertPick<Source, eSampleS24>::Get(bDither, ePath);
+        case eSampleS24In32:    return SampleConvertPick<Source, eSampleS24In32>::Get(bDither, ePath);
+        case eSampleS32:        return SampleConvertPick<Source, eSampleS32>::Get(bDither, ePath);
+        case eSampleFloat32:    return SampleConvertPick<Source, eSampleFloat32>::Get(bDither, ePath);
+        default:                break;
+    }
+
+    return NULL;
+}
+
+//
+// Picks the kernel for a pair of formats, NULL for an unknown format.
+//
+inline PFN_SAMPLE_CONVERT GetSampleConvert
+(
+    _In_ eSampleFormat      eSource,
+    _In_ eSampleFormat      eDestination,
+    _In_ BOOL               bDither,
+    _In_ eSampleConvertPath ePath
+)
+{
+    switch (eSource)
+    {
+        case eSampleU8:         return SelectSampleConvert<eSampleU8>(eDestination, bDither, ePath);
+        case eSampleS16:        return SelectSampleConvert<eSampleS16>(eDestination, bDither, ePath);
+        case eSampleS24:        return SelectSampleConvert<eSampleS24>(eDestination, bDither, ePath);
+        case eSampleS24In32:    return SelectSampleConvert<eSampleS24In32>(eDestination, bDither, ePath);
+        case eSampleS32:        return SelectSampleConvert<eSampleS32>(eDestination, bDither, ePath);
+        case eSampleFloat32:    return SelectSampleConvert<eSampleFloat32>(eDestination, bDither, ePath);
+        default:                break;
+    }
+
+    return NULL;
+}
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CSampleConverter
+//
+//   Not synchronized; the dither state belongs to one stream.
+//
+class CSampleConverter
+{
+protected:
+    PFN_SAMPLE_CONVERT          m_pfnConvert;
+    SAMPLE_DITHER               m_Dither;
+    ULONG                       m_ulSourceBytes;
+    ULONG                       m_ulDestinationBytes;
+
+public:
+    CSampleConverter()
+    {
+        m_pfnConvert = NULL;
+        m_Dither.ulA = 0;
+        m_Dither.ulB = 0;
+        m_ulSourceBytes = 0;
+        m_ulDestinationBytes = 0;
+    }
+
+    //
+    // The format of a stream's samples, eSampleFormatCount if none fits.
+    // ulValidBits may be 0 when the format does not say.
+    //
+    static eSampleFormat GetSampleFormat
+    (
+        _In_ ULONG      ulContainerBits,
+        _In_ ULONG      ulValidBits,
+        _In_ BOOL       bFloat
+    )
+    {
+        if (bFloat)
+        {
+            return (ulContainerBits == 32) ? eSampleFloat32 : eSampleFormatCount;
+        }
+
+        switch (ulContainerBits)
+        {
+            case 8:  return eSampleU8;
+            case 16: return eSampleS16;
+            case 24: return eSampleS24;
+            case 32: return (ulValidBits == 24) ? eSampleS24In32 : eSampleS32;
+        }
+
+        return eSampleFormatCount;
+    }
+
+    static ULONG GetSampleBytes
+    (
+        _In_ eSampleFormat  eFormat
+    )
+    {
+        switch (eFormat)
+        {
+            case eSampleU8:         return SampleCodec<eSampleU8>::Bytes;
+            case eSampleS16:        return SampleCodec<eSampleS16>::Bytes;
+            case eSampleS24:        return SampleCodec<eSampleS24>::Bytes;
+            case eSampleS24In32:    return SampleCodec<eSampleS24In32>::Bytes;
+            case eSampleS32:        return SampleCodec<eSampleS32>::Bytes;
+            case eSampleFloat32:    return SampleCodec<eSampleFloat32>::Bytes;
+            default:                break;
+        }
+
+        return 0;
+    }
+
+    //
+    // Picks the kernel. bDither adds TPDF dither where an integer format
+    // narrows. Returns FALSE for an unknown format, which leaves the
+    // converter inactive.
+    //
+    BOOL Init
+    (
+        _In_ eSampleFormat      eSource,
+        _In_ eSampleFormat      eDestination,
+        _In_ BOOL               bDither,
+        _In_ eSampleConvertPath ePath
+    )
+    {
+        m_pfnConvert = GetSampleConvert(eSource, eDestination, bDither, ePath);
+        m_ulSourceBytes = GetSampleBytes(eSource);
+        m_ulDestinationBytes = GetSampleBytes(eDestination);
+        Reset();
+
+        return IsActive();
+    }
+
+    BOOL IsActive() const
+    {
+        return m_pfnConvert != NULL;
+    }
+
+    //
+    // Restarts the dither sequence.
+    //
+    VOID Reset()
+    {
+        m_Dither.ulA = 0x2545F491;
+        m_Dither.ulB = 0x9E3779B9;
+    }
+
+    ULONG GetSourceSampleBytes() const
+    {
+        return m_ulSourceBytes;
+    }
+
+    ULONG GetDestinationSampleBytes() const
+    {
+        return m_ulDestinationBytes;
+    }
+
+    VOID Convert
+    (
+        _In_reads_bytes_(ulSamples * GetSourceSampleBytes()) const BYTE *  pSource,
+        _Out_writes_bytes_(ulSamples * GetDestinationSampleBytes()) PBYTE  pDestination,
+        _In_ ULONG                                                          ulSamples
+    )
+    {
+        if (IsActive())
+        {
+            m_pfnConvert(pSource, pDestination, ulSamples, &m_Dither);
+        }
+    }
+};
+typedef CSampleConverter *PCSampleConverter;
+
+#endif // _VIRTUALAUDIODRIVER_SAMPLECONVERT_H_
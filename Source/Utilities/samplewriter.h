@@ -0,0 +1,296 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    samplewriter.h
+
+Abstract:
+
+    Compile-time specialized sample writers. SampleWriter<Bits, Channels,
+    Float> stores Q30 samples (unity = 1 << 30) in one stream format with the
+    container size and channel count fixed at compile time, so the loops
+    carry no per-sample format checks. A stream picks its instance once with
+    GetSampleWriter.
+
+    Float output is encoded with integer operations only, so no writer
+    needs the floating point state saved.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_SAMPLEWRITER_H_
+#define _VIRTUALAUDIODRIVER_SAMPLEWRITER_H_
+
+#include "portable.h"
+
+// Unity in the Q30 sample domain.
+#define SAMPLE_Q30_ONE              (1L << 30)
+
+// Largest channel count with a dedicated instance (7.1).
+#define SAMPLE_WRITER_MAX_CHANNELS  8
+
+//
+// Writes ulFrames frames to pBuffer. Broadcast writers take one sample per
+// frame and copy it to every channel; interleaved writers take one sample
+// per channel.
+//
+typedef VOID SAMPLE_WRITE_ROUTINE
+(
+    _Out_ PBYTE         pBuffer,
+    _In_ const LONG *   pSamples,
+    _In_ ULONG          ulFrames
+);
+typedef SAMPLE_WRITE_ROUTINE *PFN_SAMPLE_WRITE;
+
+typedef struct _SAMPLE_WRITER
+{
+    PFN_SAMPLE_WRITE    pfnWriteBroadcast;
+    PFN_SAMPLE_WRITE    pfnWriteInterleaved;
+    ULONG               ulFrameBytes;
+} SAMPLE_WRITER;
+typedef SAMPLE_WRITER *PSAMPLE_WRITER;
+
+///////////////////////////////////////////////////////////////////////////////
+// SampleEncoder
+//
+//   Stores one Q30 sample. Inputs outside [-1, 1] are clamped.
+//
+template <ULONG Bits, BOOL Float>
+struct SampleEncoder;
+
+template <>
+struct SampleEncoder<8, FALSE>
+{
+    static VOID Put(_Out_ PBYTE p, _In_ LONG lSample)
+    {
+        // Unsigned, centered at 0x80.
+        LONG lValue = (lSample >> 23) + 0x80;
+        p[0] = (BYTE)(lValue > 0xFF ? 0xFF : (lValue < 0 ? 0 : lValue));
+    }
+};
+
+template <>
+struct SampleEncoder<16, FALSE>
+{
+    static VOID Put(_Out_ PBYTE p, _In_ LONG lSample)
+    {
+        LONG lValue = lSample >> 15;
+        lValue = lValue > 0x7FFF ? 0x7FFF : (lValue < -0x8000 ? -0x8000 : lValue);
+        p[0] = (BYTE)lValue;
+        p[1] = (BYTE)(lValue >> 8);
+    }
+};
+
+template <>
+struct SampleEncoder<24, FALSE>
+{
+    static VOID Put(_Out_ PBYTE p, _In_ LONG lSample)
+    {
+        // Packed little-endian.
+        LONG lValue = lSample >> 7;
+        lValue = lValue > 0x7FFFFF ? 0x7FFFFF : (lValue < -0x800000 ? -0x800000 : lValue);
+        p[0] = (BYTE)lValue;
+        p[1] = (BYTE)(lValue >> 8);
+        p[2] = (BYTE)(lValue >> 16);
+    }
+};
+
+template <>
+struct SampleEncoder<32, FALSE>
+{
+    static VOID Put(_Out_ PBYTE p, _In_ LONG lSample)
+    {
+        ULONG ulValue;
+
+        if (lSample >= SAMPLE_Q30_ONE)
+        {
+            ulValue = 0x7FFFFFFF;
+        }
+        else if (lSample <= -SAMPLE_Q30_ONE)
+        {
+            ulValue = 0x80000000;
+        }
+        else
+        {
+            ulValue = (ULONG)lSample << 1;
+        }
+
+        p[0] = (BYTE)ulValue;
+        p[1] = (BYTE)(ulValue >> 8);
+        p[2] = (BYTE)(ulValue >> 16);
+        p[3] = (BYTE)(ulValue >> 24);
+    }
+};
+
+template <>
+struct SampleEncoder<32, TRUE>
+{
+    //
+    // IEEE single for lSample / 2^30, rounded to nearest even exactly like
+    // (float)lSample * 2^-30 would be.
+    //
+    static ULONG FloatBits(_In_ LONG lSample)
+    {
+        if (lSample == 0)
+        {
+            return 0;
+        }
+
+        if (lSample > SAMPLE_Q30_ONE)
+        {
+            lSample = SAMPLE_Q30_ONE;
+        }
+        else if (lSample < -SAMPLE_Q30_ONE)
+        {
+            lSample = -SAMPLE_Q30_ONE;
+        }
+
+        ULONG ulSign = (lSample < 0) ? 0x80000000 : 0;
+        ULONG ulMagnitude = (lSample < 0) ? (ULONG)(-lSample) : (ULONG)lSample;
+        LONG lExponent = 31;
+
+        // Normalize so the leading one is bit 31.
+        if ((ulMagnitude & 0xFFFF0000) == 0) { ulMagnitude <<= 16; lExponent -= 16; }
+        if ((ulMagnitude & 0xFF000000) == 0) { ulMagnitude <<= 8;  lExponent -= 8; }
+        if ((ulMagnitude & 0xF0000000) == 0) { ulMagnitude <<= 4;  lExponent -= 4; }
+        if ((ulMagnitude & 0xC0000000) == 0) { ulMagnitude <<= 2;  lExponent -= 2; }
+        if ((ulMagnitude & 0x80000000) == 0) { ulMagnitude <<= 1;  lExponent -= 1; }
+
+        ULONG ulMantissa = ulMagnitude >> 8;
+        ULONG ulRest = ulMagnitude & 0xFF;
+
+        if (ulRest > 0x80 || (ulRest == 0x80 && (ulMantissa & 1)))
+        {
+            ulMantissa++;
+            if (ulMantissa == 0x1000000)
+            {
+                ulMantissa >>= 1;
+                lExponent++;
+            }
+        }
+
+        // Leading one at bit lExponent of a Q30 value: 2^(lExponent - 30).
+        return ulSign | ((ULONG)(lExponent - 30 + 127) << 23) | (ulMantissa & 0x7FFFFF);
+    }
+
+    static VOID Put(_Out_ PBYTE p, _In_ LONG lSample)
+    {
+        ULONG ulValue = FloatBits(lSample);
+
+        p[0] = (BYTE)ulValue;
+        p[1] = (BYTE)(ulValue >> 8);
+        p[2] = (BYTE)(ulValue >> 16);
+        p[3] = (BYTE)(ulValue >> 24);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// SampleWriter
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct SampleWriter
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG FrameBytes = SampleBytes * Channels;
+
+    static VOID WriteBroadcast
+    (
+        _Out_ PBYTE         pBuffer,
+        _In_ const LONG *   pSamples,
+        _In_ ULONG          ulFrames
+    )
+    {
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                SampleEncoder<Bits, Float>::Put(pBuffer + c * SampleBytes, pSamples[i]);
+            }
+            pBuffer += FrameBytes;
+        }
+    }
+
+    static VOID WriteInterleaved
+    (
+        _Out_ PBYTE         pBuffer,
+        _In_ const LONG *   pSamples,
+        _In_ ULONG          ulFrames
+    )
+    {
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                SampleEncoder<Bits, Float>::Put(pBuffer + c * SampleBytes, pSamples[c]);
+            }
+            pSamples += Channels;
+            pBuffer += FrameBytes;
+        }
+    }
+};
+
+template <ULONG Bits, ULONG Channels, BOOL Float>
+VOID SetSampleWriter
+(
+    _Out_ PSAMPLE_WRITER    pWriter
+)
+{
+    pWriter->pfnWriteBroadcast = SampleWriter<Bits, Channels, Float>::WriteBroadcast;
+    pWriter->pfnWriteInterleaved = SampleWriter<Bits, Channels, Float>::WriteInterleaved;
+    pWriter->ulFrameBytes = SampleWriter<Bits, Channels, Float>::FrameBytes;
+}
+
+template <ULONG Bits, BOOL Float>
+BOOL SelectSampleWriter
+(
+    _In_ ULONG              ulChannels,
+    _Out_ PSAMPLE_WRITER    pWriter
+)
+{
+    switch (ulChannels)
+    {
+        case 1: SetSampleWriter<Bits, 1, Float>(pWriter); return TRUE;
+        case 2: SetSampleWriter<Bits, 2, Float>(pWriter); return TRUE;
+        case 3: SetSampleWriter<Bits, 3, Float>(pWriter); return TRUE;
+        case 4: SetSampleWriter<Bits, 4, Float>(pWriter); return TRUE;
+        case 5: SetSampleWriter<Bits, 5, Float>(pWriter); return TRUE;
+        case 6: SetSampleWriter<Bits, 6, Float>(pWriter); return TRUE;
+        case 7: SetSampleWriter<Bits, 7, Float>(pWriter); return TRUE;
+        case 8: SetSampleWriter<Bits, 8, Float>(pWriter); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Picks the instance for a stream format. Covers 8/16/24/32-bit PCM and
+// 32-bit float with 1 to SAMPLE_WRITER_MAX_CHANNELS channels, a superset of
+// the speaker and microphone array pin formats. Returns FALSE otherwise.
+//
+inline BOOL GetSampleWriter
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat,
+    _Out_ PSAMPLE_WRITER    pWriter
+)
+{
+    RtlZeroMemory(pWriter, sizeof(*pWriter));
+
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectSampleWriter<32, TRUE>(ulChannels, pWriter) : FALSE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectSampleWriter<8, FALSE>(ulChannels, pWriter);
+        case 16: return SelectSampleWriter<16, FALSE>(ulChannels, pWriter);
+        case 24: return SelectSampleWriter<24, FALSE>(ulChannels, pWriter);
+        case 32: return SelectSampleWriter<32, FALSE>(ulChannels, pWriter);
+    }
+
+    return FALSE;
+}
+
+#endif // _VIRTUALAUDIODRIVER_SAMPLEWRITER_H_
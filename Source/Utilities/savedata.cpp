@@ -10,11 +10,15 @@ Abstract:
 
     Implementation of Simple Audio Sample data saving class.
 
-    To save the playback data to disk, this class maintains a circular data
-    buffer, associated frame structures and worker items to save frames to
-    disk.
-    Each frame structure represents a portion of buffer. When that portion
-    of frame is full, a workitem is scheduled to save it to disk.
+    To save the playback data to disk, this class queues the stream's bytes
+    in a lock-free single-producer/single-consumer ring from the position
+    update at DISPATCH_LEVEL. A writer thread owned by each stream drains
+    the ring into the data file, which it keeps open, in large coalesced
+    writes. If the writer falls behind, whole frames are dropped and
+    counted rather than overwriting queued data.
+
+    Endpoints can ask for FLAC instead of WAVE files. The writer thread then
+    runs the data through CFlacEncoder before it reaches the file.
 --*/
 #pragma warning (disable : 4127)
 #pragma warning (disable : 26165)
@@ -35,14 +39,20 @@ Abstract:
 //=============================================================================
 // Defines
 //=============================================================================
-#define RIFF_TAG                    0x46464952;
-#define WAVE_TAG                    0x45564157;
-#define FMT__TAG                    0x20746D66;
-#define DATA_TAG                    0x61746164;
+#define DEFAULT_BUFFER_SIZE         (PAGE_SIZE * 16)
 
-#define DEFAULT_FRAME_COUNT         4
-#define DEFAULT_FRAME_SIZE          PAGE_SIZE * 4 
-#define DEFAULT_BUFFER_SIZE         DEFAULT_FRAME_SIZE * DEFAULT_FRAME_COUNT
+// The ring holds at least this much audio, comfortably more than the writer's
+// latency bound below.
+#define SAVEDATA_MIN_BUFFER_MS      500
+#define SAVEDATA_MAX_LATENCY_MS     100
+#define SAVEDATA_MAX_WRITE_BYTES    (1024 * 1024)
+
+// SetMaxWriteSize sizes the ring for this many of the stream's largest writes.
+#define SAVEDATA_WRITES_PER_BUFFER  4
+
+// Index entries are collected and appended to the sidecar this many at a time
+// (and at the end of every drain).
+#define SAVEDATA_INDEX_BATCH        256
 
 #define DEFAULT_FILE_FOLDER1        L"\\DriverData\\Audio_Samples"
 #define DEFAULT_FILE_FOLDER2        L"\\DriverData\\Audio_Samples\\VirtualAudioDriver"
@@ -50,13 +60,26 @@ Abstract:
 #define OFFLOAD_FILE_NAME           L"OFFLOAD"
 #define HOST_FILE_NAME              L"HOST"
 
-#define MAX_WORKER_ITEM_COUNT       15
-
 //=============================================================================
 // Statics
 //=============================================================================
 ULONG CSaveData::m_ulStreamId = 0;
 
+//=============================================================================
+// Helpers
+//=============================================================================
+static ULONG RoundUpToPowerOfTwo(_In_ ULONG ulValue)
+{
+    ULONG ulResult = 1;
+
+    while (ulResult < ulValue && ulResult < 0x80000000)
+    {
+        ulResult <<= 1;
+    }
+
+    return ulResult;
+}
+
 #pragma code_seg("PAGE")
 //=============================================================================
 // CSaveData
@@ -66,29 +89,39 @@ ULONG CSaveData::m_ulStreamId = 0;
 CSaveData::CSaveData()
 :   m_pDataBuffer(NULL),
     m_FileHandle(NULL),
-    m_ulFrameCount(DEFAULT_FRAME_COUNT),
     m_ulBufferSize(DEFAULT_BUFFER_SIZE),
-    m_ulFrameSize(DEFAULT_FRAME_SIZE),
-    m_ulBufferOffset(0),
-    m_ulFrameIndex(0),
-    m_fFrameUsed(NULL),
+    m_pWriterThread(NULL),
+    m_lFlushRequested(0),
+    m_lStopRequested(0),
+    m_IndexHandle(NULL),
+    m_pIndexEntries(NULL),
+    m_ulIndexEntries(0),
+    m_ulFileId(0),
+    m_ulSegment(0),
+    m_ullSegmentFirstFrame(0),
+    m_ullSegmentBytes(0),
+    m_ulHeaderBytes(0),
+    m_ullRingBytes(0),
+    m_Format(eSaveDataWave),
+    m_pFlacWorkspace(NULL),
     m_waveFormat(NULL),
-    m_pFilePtr(NULL),
     m_fWriteDisabled(FALSE),
     m_bInitialized(FALSE)
 {
     PAGED_CODE();
 
-    m_FileHeader.dwRiff           = RIFF_TAG;
-    m_FileHeader.dwFileSize       = 0;
-    m_FileHeader.dwWave           = WAVE_TAG;
-    m_FileHeader.dwFormat         = FMT__TAG;
-    m_FileHeader.dwFormatLength   = sizeof(WAVEFORMATEX);
+    m_FilePtr.QuadPart = 0;
+    m_IndexPtr.QuadPart = 0;
+    m_QpcFrequency.QuadPart = 0;
 
-    m_DataHeader.dwData           = DATA_TAG;
-    m_DataHeader.dwDataLength     = 0;
+    RtlZeroMemory(&m_DrainAnchor, sizeof(m_DrainAnchor));
 
     RtlZeroMemory(&m_objectAttributes, sizeof(m_objectAttributes));
+    RtlZeroMemory(&m_FileName, sizeof(m_FileName));
+
+    KeInitializeMutex(&m_FileSync, 1);
+    KeInitializeEvent(&m_WakeEvent, SynchronizationEvent, FALSE);
+    KeInitializeEvent(&m_FlushDoneEvent, SynchronizationEvent, FALSE);
 } // CSaveData
 
 //=============================================================================
@@ -98,35 +131,21 @@ CSaveData::~CSaveData()
 
     DPF_ENTER(("[CSaveData::~CSaveData]"));
 
-    // Update the wave header in data file with real file size.
+    // The writer thread flushes the ring, updates the header with the real
+    // length and closes the segment on its way out.
     //
-    if(m_pFilePtr)
-    {
-        m_FileHeader.dwFileSize =
-            (DWORD) m_pFilePtr->QuadPart - 2 * sizeof(DWORD);
-        m_DataHeader.dwDataLength = (DWORD) m_pFilePtr->QuadPart -
-                                     sizeof(m_FileHeader)        -
-                                     m_FileHeader.dwFormatLength -
-                                     sizeof(m_DataHeader);
-
-        if (STATUS_SUCCESS == KeWaitForSingleObject
-            (
-                &m_FileSync,
-                Executive,
-                KernelMode,
-                FALSE,
-                NULL
-            ))
-        {
-            if (NT_SUCCESS(FileOpen(FALSE)))
-            {
-                FileWriteHeader();
+    StopWriter();
+    FileClose();
 
-                FileClose();
-            }
+    if (m_IndexHandle)
+    {
+        ZwClose(m_IndexHandle);
+        m_IndexHandle = NULL;
+    }
 
-            KeReleaseMutex(&m_FileSync, FALSE);
-        }
+    if (m_Ring.GetDroppedBytes() > 0)
+    {
+        DPF(D_TERSE, ("[CSaveData::~CSaveData] %I64u bytes dropped, writer fell behind", m_Ring.GetDroppedBytes()));
     }
 
     if (m_waveFormat)
@@ -135,13 +154,6 @@ CSaveData::~CSaveData()
         m_waveFormat = NULL;
     }
 
-    if (m_fFrameUsed)
-    {
-        ExFreePoolWithTag(m_fFrameUsed, SAVEDATA_POOLTAG2);
-        m_fFrameUsed = NULL;
-        // NOTE : Do not release m_pFilePtr.
-    }
-
     if (m_FileName.Buffer)
     {
         ExFreePoolWithTag(m_FileName.Buffer, SAVEDATA_POOLTAG3);
@@ -153,32 +165,19 @@ CSaveData::~CSaveData()
         ExFreePoolWithTag(m_pDataBuffer, SAVEDATA_POOLTAG4);
         m_pDataBuffer = NULL;
     }
-} // CSaveData
-
-//=============================================================================
-void
-CSaveData::DestroyWorkItems
-(
-    void
-)
-{
-    PAGED_CODE();
 
-    if (m_pWorkItems)
+    if (m_pFlacWorkspace)
     {
-        for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
-        {
-            if (m_pWorkItems[i].WorkItem!=NULL)
-            {
-                IoFreeWorkItem(m_pWorkItems[i].WorkItem);
-                m_pWorkItems[i].WorkItem = NULL;
-            }
-        }
-        ExFreePoolWithTag(m_pWorkItems, SAVEDATA_POOLTAG);
-        m_pWorkItems = NULL;
+        ExFreePoolWithTag(m_pFlacWorkspace, SAVEDATA_POOLTAG5);
+        m_pFlacWorkspace = NULL;
     }
 
-} // DestroyWorkItems
+    if (m_pIndexEntries)
+    {
+        ExFreePoolWithTag(m_pIndexEntries, SAVEDATA_POOLTAG6);
+        m_pIndexEntries = NULL;
+    }
+} // CSaveData
 
 //=============================================================================
 void
@@ -263,7 +262,6 @@ CSaveData::FileWrite
     PAGED_CODE();
 
     ASSERT(pData);
-    ASSERT(m_pFilePtr);
 
     NTSTATUS                    ntStatus;
 
@@ -278,14 +276,14 @@ CSaveData::FileWrite
                                 &ioStatusBlock,
                                 pData,
                                 ulDataSize,
-                                m_pFilePtr,
+                                &m_FilePtr,
                                 NULL);
 
         if (NT_SUCCESS(ntStatus))
         {
             ASSERT(ioStatusBlock.Information == ulDataSize);
 
-            m_pFilePtr->QuadPart += ulDataSize;
+            m_FilePtr.QuadPart += ulDataSize;
         }
         else
         {
@@ -309,63 +307,73 @@ CSaveData::FileWriteHeader(void)
 
     NTSTATUS                    ntStatus;
 
-    if (m_FileHandle && m_waveFormat)
+    if (m_FileHandle && m_Format == eSaveDataFlac)
     {
         IO_STATUS_BLOCK         ioStatusBlock;
+        BYTE                    flacHeader[FLAC_STREAM_HEADER_BYTES];
 
-        m_pFilePtr->QuadPart = 0;
+        m_FilePtr.QuadPart = 0;
 
-        m_FileHeader.dwFormatLength = (m_waveFormat->wFormatTag == WAVE_FORMAT_PCM) ?
-                                        sizeof( PCMWAVEFORMAT ) :
-                                        sizeof( WAVEFORMATEX ) + m_waveFormat->cbSize;
+        m_FlacEncoder.GetStreamHeader(flacHeader);
 
         ntStatus = ZwWriteFile( m_FileHandle,
                                 NULL,
                                 NULL,
                                 NULL,
                                 &ioStatusBlock,
-                                &m_FileHeader,
-                                sizeof(m_FileHeader),
-                                m_pFilePtr,
+                                flacHeader,
+                                sizeof(flacHeader),
+                                &m_FilePtr,
                                 NULL);
         if (!NT_SUCCESS(ntStatus))
         {
-            DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Write File Header Error]"));
+            DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Write FLAC Header Error]"));
         }
 
-        m_pFilePtr->QuadPart += sizeof(m_FileHeader);
-
-        ntStatus = ZwWriteFile( m_FileHandle,
-                                NULL,
-                                NULL,
-                                NULL,
-                                &ioStatusBlock,
-                                m_waveFormat,
-                                m_FileHeader.dwFormatLength,
-                                m_pFilePtr,
-                                NULL);
-        if (!NT_SUCCESS(ntStatus))
+        m_FilePtr.QuadPart += sizeof(flacHeader);
+        m_ulHeaderBytes = sizeof(flacHeader);
+    }
+    else if (m_FileHandle && m_waveFormat)
+    {
+        IO_STATUS_BLOCK         ioStatusBlock;
+        BYTE                    waveHeader[RECORD_WAVE_MAX_HEADER_BYTES];
+        ULONG                   cbFormat;
+        ULONG                   cbHeader;
+
+        m_FilePtr.QuadPart = 0;
+
+        cbFormat = (m_waveFormat->wFormatTag == WAVE_FORMAT_PCM) ?
+                    sizeof( PCMWAVEFORMAT ) :
+                    sizeof( WAVEFORMATEX ) + m_waveFormat->cbSize;
+
+        // RIFF, or RF64 once the segment has grown past 4 GB.
+        cbHeader = RecordBuildWaveHeader(waveHeader,
+                                         m_waveFormat,
+                                         cbFormat,
+                                         m_waveFormat->nBlockAlign,
+                                         m_ullSegmentBytes);
+        if (cbHeader == 0)
         {
-            DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Write Format Error]"));
+            DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Format too large]"));
+            return STATUS_NOT_SUPPORTED;
         }
 
-        m_pFilePtr->QuadPart += m_FileHeader.dwFormatLength;
-
         ntStatus = ZwWriteFile( m_FileHandle,
                                 NULL,
                                 NULL,
                                 NULL,
                                 &ioStatusBlock,
-                                &m_DataHeader,
-                                sizeof(m_DataHeader),
-                                m_pFilePtr,
+                                waveHeader,
+                                cbHeader,
+                                &m_FilePtr,
                                 NULL);
         if (!NT_SUCCESS(ntStatus))
         {
-            DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Write Data Header Error]"));
+            DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Write File Header Error]"));
         }
 
-        m_pFilePtr->QuadPart += sizeof(m_DataHeader);
+        m_FilePtr.QuadPart += cbHeader;
+        m_ulHeaderBytes = cbHeader;
     }
     else
     {
@@ -402,52 +410,16 @@ CSaveData::GetDeviceObject
     return m_pDeviceObject;
 }
 
-#pragma code_seg()
-//=============================================================================
-PSAVEWORKER_PARAM
-CSaveData::GetNewWorkItem
-(
-    void
-)
-{
-    LARGE_INTEGER               timeOut = { 0 };
-    NTSTATUS                    ntStatus;
-
-    for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
-    {
-        ntStatus =
-            KeWaitForSingleObject
-            (
-                &m_pWorkItems[i].EventDone,
-                Executive,
-                KernelMode,
-                FALSE,
-                &timeOut
-            );
-        if (STATUS_SUCCESS == ntStatus)
-        {
-            if (m_pWorkItems[i].WorkItem)
-                return &(m_pWorkItems[i]);
-            else
-                return NULL;
-        }
-    }
-
-    return NULL;
-} // GetNewWorkItem
-#pragma code_seg("PAGE")
-
 //=============================================================================
 NTSTATUS
 CSaveData::Initialize
 (
+    _In_  eSaveDataFormat       Format
 )
 {
     PAGED_CODE();
 
     NTSTATUS            ntStatus = STATUS_SUCCESS;
-    WCHAR               szTemp[MAX_PATH];
-    size_t              cLen = 0;   
     IO_STATUS_BLOCK     ioStatusBlock = {0};
     HANDLE              fileHandle;
     OBJECT_ATTRIBUTES   objectAttributes;
@@ -457,6 +429,15 @@ CSaveData::Initialize
 
     m_ulStreamId++;
 
+    // FLAC needs integer PCM; anything else is saved as WAVE.
+    //
+    m_Format = Format;
+    if (m_Format == eSaveDataFlac && !NT_SUCCESS(FlacInitialize()))
+    {
+        DPF(D_TERSE, ("[CSaveData::Initialize : FLAC not available for this format, saving WAVE]"));
+        m_Format = eSaveDataWave;
+    }
+
     RtlInitUnicodeString(&fileName, DEFAULT_FILE_FOLDER1);
     InitializeObjectAttributes(
             &objectAttributes,
@@ -515,16 +496,12 @@ CSaveData::Initialize
 
     if (NT_SUCCESS(ntStatus))
     {
-        // Allocate data file name.
+        // Allocate data file name. SegmentFileName fills it in for every
+        // segment and its index.
         //
-        RtlStringCchPrintfW(szTemp, MAX_PATH, L"%s_%s_%d.wav", DEFAULT_FILE_NAME, HOST_FILE_NAME, m_ulStreamId);
+        m_ulFileId = m_ulStreamId;
         m_FileName.Length = 0;
-        ntStatus = RtlStringCchLengthW (szTemp, sizeof(szTemp)/sizeof(szTemp[0]), &cLen);
-    }
-
-    if (NT_SUCCESS(ntStatus))
-    {
-        m_FileName.MaximumLength = (USHORT)((cLen * sizeof(WCHAR)) + sizeof(WCHAR));//convert to wchar and add room for NULL
+        m_FileName.MaximumLength = MAX_PATH * sizeof(WCHAR);
         m_FileName.Buffer = (PWSTR)
             ExAllocatePool2
             (
@@ -539,13 +516,17 @@ CSaveData::Initialize
         }
     }
 
-    // Allocate memory for data buffer.
+    // Allocate memory for the ring. It holds at least SAVEDATA_MIN_BUFFER_MS
+    // of audio so the writer can sleep up to its latency bound without drops.
     //
     if (NT_SUCCESS(ntStatus))
     {
-        RtlStringCbCopyW(m_FileName.Buffer, m_FileName.MaximumLength, szTemp);
-        m_FileName.Length = (USHORT)wcslen(m_FileName.Buffer) * sizeof(WCHAR);
-        DPF(D_BLAB, ("[New DataFile -- %S", m_FileName.Buffer));
+        if (m_waveFormat)
+        {
+            ULONG ulMinBytes = (ULONG)((ULONGLONG)m_waveFormat->nAvgBytesPerSec * SAVEDATA_MIN_BUFFER_MS / 1000);
+            m_ulBufferSize = max(m_ulBufferSize, ulMinBytes);
+        }
+        m_ulBufferSize = RoundUpToPowerOfTwo(m_ulBufferSize);
 
         m_pDataBuffer = (PBYTE)
             ExAllocatePool2
@@ -561,42 +542,44 @@ CSaveData::Initialize
         }
     }
 
-    // Allocate memory for frame usage flags and m_pFilePtr.
+    if (NT_SUCCESS(ntStatus))
+    {
+        m_Ring.Attach(m_pDataBuffer, m_ulBufferSize);
+        m_Ring.BeginProducerSession(m_waveFormat ? m_waveFormat->nBlockAlign : 1);
+        m_DrainPolicy.Init(m_ulBufferSize / 4, SAVEDATA_MAX_LATENCY_MS);
+        ResetAnchor();
+    }
+
+    // Segmentation and the sidecar index.
     //
     if (NT_SUCCESS(ntStatus))
     {
-        m_fFrameUsed = (PBOOL)
+        m_pIndexEntries = (PRECORD_INDEX_ENTRY)
             ExAllocatePool2
             (
-                POOL_FLAG_NON_PAGED,
-                m_ulFrameCount * sizeof(BOOL) +
-                sizeof(LARGE_INTEGER),
-                SAVEDATA_POOLTAG2
+                POOL_FLAG_PAGED,
+                SAVEDATA_INDEX_BATCH * sizeof(RECORD_INDEX_ENTRY),
+                SAVEDATA_POOLTAG6
             );
-        if (!m_fFrameUsed)
+        if (!m_pIndexEntries)
         {
-            DPF(D_TERSE, ("[Could not allocate memory for frame flags]"));
+            DPF(D_TERSE, ("[Could not allocate memory for the index]"));
             ntStatus = STATUS_INSUFFICIENT_RESOURCES;
         }
     }
 
-    // Initialize the spinlock to synchronize access to the frames
-    //
-    KeInitializeSpinLock ( &m_FrameInUseSpinLock ) ;
+    if (NT_SUCCESS(ntStatus))
+    {
+        m_SegmentPolicy.Init((ULONGLONG)g_DataFileSegmentMB * 1024 * 1024,
+                             m_waveFormat ? (ULONGLONG)g_DataFileSegmentSeconds * m_waveFormat->nSamplesPerSec : 0);
 
-    // Initialize the file mutex
-    //
-    KeInitializeMutex( &m_FileSync, 1 ) ;
+        KeQueryPerformanceCounter(&m_QpcFrequency);
+    }
 
     // Open the data file.
     //
     if (NT_SUCCESS(ntStatus))
     {
-        // m_fFrameUsed has additional memory to hold m_pFilePtr
-        //
-        m_pFilePtr = (PLARGE_INTEGER)
-            (((PBYTE) m_fFrameUsed) + m_ulFrameCount * sizeof(BOOL));
-
         // Create data file.
         InitializeObjectAttributes
         (
@@ -609,145 +592,53 @@ CSaveData::Initialize
 
         m_bInitialized = TRUE;
 
-        // Write wave header information to data file.
-        ntStatus = KeWaitForSingleObject
-            (
-                &m_FileSync,
-                Executive,
-                KernelMode,
-                FALSE,
-                NULL
-            );
-
-        if (STATUS_SUCCESS == ntStatus)
-        {
-            ntStatus = FileOpen(TRUE);
-            if (NT_SUCCESS(ntStatus))
-            {
-                ntStatus = FileWriteHeader();
-
-                FileClose();
-            }
-
-            KeReleaseMutex( &m_FileSync, FALSE );
-        }
-    }
-
-    return ntStatus;
-} // Initialize
-
-//=============================================================================
-NTSTATUS
-CSaveData::InitializeWorkItems
-(
-    _In_  PDEVICE_OBJECT        DeviceObject
-)
-{
-    PAGED_CODE();
-
-    ASSERT(DeviceObject);
-
-    NTSTATUS                    ntStatus = STATUS_SUCCESS;
-
-    DPF_ENTER(("[CSaveData::InitializeWorkItems]"));
-
-    if (m_pWorkItems != NULL)
-    {
-        return ntStatus;
+        // Open the first segment and write its header. The file then stays
+        // open for the writer thread.
+        ntStatus = SegmentOpen();
     }
 
-    m_pWorkItems = (PSAVEWORKER_PARAM)
-        ExAllocatePool2
-        (
-            POOL_FLAG_NON_PAGED,
-            sizeof(SAVEWORKER_PARAM) * MAX_WORKER_ITEM_COUNT,
-            SAVEDATA_POOLTAG
-        );
-    if (m_pWorkItems)
+    // Start the writer thread.
+    //
+    if (NT_SUCCESS(ntStatus))
     {
-        for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
+        HANDLE threadHandle = NULL;
+
+        ntStatus = PsCreateSystemThread(&threadHandle,
+                                        THREAD_ALL_ACCESS,
+                                        NULL,
+                                        NULL,
+                                        NULL,
+                                        SaveDataWriterThread,
+                                        this);
+        if (NT_SUCCESS(ntStatus))
         {
-
-            m_pWorkItems[i].WorkItem = IoAllocateWorkItem(DeviceObject);
-            if(m_pWorkItems[i].WorkItem == NULL)
+            ntStatus = ObReferenceObjectByHandle(threadHandle,
+                                                 THREAD_ALL_ACCESS,
+                                                 *PsThreadType,
+                                                 KernelMode,
+                                                 (PVOID *)&m_pWriterThread,
+                                                 NULL);
+            if (!NT_SUCCESS(ntStatus))
             {
-              return STATUS_INSUFFICIENT_RESOURCES;
+                // Cannot happen for a handle just created, but never leave the
+                // thread running unobserved.
+                InterlockedExchange(&m_lStopRequested, 1);
+                KeSetEvent(&m_WakeEvent, 0, FALSE);
+                ZwWaitForSingleObject(threadHandle, FALSE, NULL);
+                m_pWriterThread = NULL;
             }
-            KeInitializeEvent
-            (
-                &m_pWorkItems[i].EventDone,
-                NotificationEvent,
-                TRUE
-            );
-        }
-    }
-    else
-    {
-        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
-    }
-
-    return ntStatus;
-} // InitializeWorkItems
-
-//=============================================================================
-
-IO_WORKITEM_ROUTINE SaveFrameWorkerCallback;
-
-VOID
-SaveFrameWorkerCallback
-(
-    _In_        PDEVICE_OBJECT         pDeviceObject, 
-    _In_opt_    PVOID                  Context
-)
-{
-    UNREFERENCED_PARAMETER(pDeviceObject);
-
-    PAGED_CODE();
-
-    ASSERT(Context);
-
-    PSAVEWORKER_PARAM           pParam = (PSAVEWORKER_PARAM) Context;
-    PCSaveData                  pSaveData;
-    
-    if (NULL == pParam)
-    {
-        // This is completely unexpected, assert here.
-        //
-        ASSERT(pParam);
-        return;
-    }
-
-    DPF(D_VERBOSE, ("[SaveFrameWorkerCallback], %d", pParam->ulFrameNo));
 
-    ASSERT(pParam->pSaveData);
-    ASSERT(pParam->pSaveData->m_fFrameUsed);
-
-    if (pParam->WorkItem)
-    {
-        pSaveData = pParam->pSaveData;
-
-        if (STATUS_SUCCESS == KeWaitForSingleObject
-            (
-                &pSaveData->m_FileSync,
-                Executive,
-                KernelMode,
-                FALSE,
-                NULL
-            ))
+            ZwClose(threadHandle);
+        }
+        else
         {
-            if (NT_SUCCESS(pSaveData->FileOpen(FALSE)))
-            { 
-                pSaveData->FileWrite(pParam->pData, pParam->ulDataSize);
-                pSaveData->FileClose();
-            }
-            InterlockedExchange( (LONG *)&(pSaveData->m_fFrameUsed[pParam->ulFrameNo]), FALSE );
-
-            KeReleaseMutex( &pSaveData->m_FileSync, FALSE );
+            DPF(D_TERSE, ("[CSaveData::Initialize : Could not start writer thread]"));
+            FileClose();
         }
     }
 
-    KeSetEvent(&pParam->EventDone, 0, FALSE);
-} // SaveFrameWorkerCallback
+    return ntStatus;
+} // Initialize
 
 //=============================================================================
 NTSTATUS
@@ -827,16 +718,23 @@ CSaveData::SetMaxWriteSize
     DPF_ENTER(("[CSaveData::SetMaxWriteSize]"));
 
     // 
-    // Compute new buffer size.
+    // Compute new buffer size. The ring only ever grows.
     //
-    ntStatus = RtlULongMult(ulMaxWriteSize, DEFAULT_FRAME_COUNT, &bufferSize);
-    if (!NT_SUCCESS(ntStatus))
+    ntStatus = RtlULongMult(ulMaxWriteSize, SAVEDATA_WRITES_PER_BUFFER, &bufferSize);
+    if (!NT_SUCCESS(ntStatus) || bufferSize > 0x80000000)
     {
         DPF(D_TERSE, ("[Could not allocate memory for Saving Data, MaxWriteSize %u is too big]", ulMaxWriteSize));
         ntStatus = STATUS_INSUFFICIENT_RESOURCES;
         goto Done;
     }
 
+    bufferSize = RoundUpToPowerOfTwo(bufferSize);
+    if (m_pDataBuffer && bufferSize <= m_ulBufferSize)
+    {
+        ntStatus = STATUS_SUCCESS;
+        goto Done;
+    }
+
     //
     // Alloc memory for buffer.
     //
@@ -855,207 +753,758 @@ CSaveData::SetMaxWriteSize
     }
 
     //
-    // Free old one.
+    // Swap the ring storage. The stream is not running, so only the writer
+    // thread can be looking at the ring; keep it out while the ring moves.
     //
+    KeWaitForSingleObject(&m_FileSync, Executive, KernelMode, FALSE, NULL);
+
+    if (m_Ring.GetBytesAvailable() > 0)
+    {
+        DrainRing();
+    }
+
     if (m_pDataBuffer)
     {
         ExFreePoolWithTag(m_pDataBuffer, SAVEDATA_POOLTAG4);
         m_pDataBuffer = NULL;
     }
 
-    //
-    // Init new buffer settings.
-    //
     m_pDataBuffer  = buffer;
     m_ulBufferSize = bufferSize;
-    m_ulFrameSize  = ulMaxWriteSize;
+    m_Ring.Attach(m_pDataBuffer, m_ulBufferSize);
+    m_Ring.BeginProducerSession(m_waveFormat ? m_waveFormat->nBlockAlign : 1);
+    m_DrainPolicy.Init(m_ulBufferSize / 4, SAVEDATA_MAX_LATENCY_MS);
+    ResetAnchor();
+
+    KeReleaseMutex(&m_FileSync, FALSE);
     
     ntStatus = STATUS_SUCCESS;
 
 Done:
     return ntStatus;
-} // SetDataFormat
+} // SetMaxWriteSize
 
 //=============================================================================
 void
-CSaveData::ReadData
+CSaveData::Flush
 (
-    _Inout_updates_bytes_all_(ulByteCount)  PBYTE   pBuffer,
-    _In_                                    ULONG   ulByteCount
+    void
 )
-{
-    UNREFERENCED_PARAMETER(pBuffer);
-    UNREFERENCED_PARAMETER(ulByteCount);
+/*++
 
-    PAGED_CODE();
+Routine Description:
 
-    // Not implemented yet.
-} // ReadData
+  Waits until everything queued so far is in the file. Called when the
+  stream stops.
 
-//=============================================================================
-#pragma code_seg()
-void
-CSaveData::SaveFrame
-(
-    _In_ ULONG                  ulFrameNo,
-    _In_ ULONG                  ulDataSize
-)
+--*/
 {
-    PSAVEWORKER_PARAM           pParam = NULL;
+    PAGED_CODE();
 
-    DPF_ENTER(("[CSaveData::SaveFrame]"));
+    DPF_ENTER(("[CSaveData::Flush]"));
 
-    pParam = GetNewWorkItem();
-    if (pParam)
+    if (m_pWriterThread == NULL)
     {
-        pParam->pSaveData = this;
-        pParam->ulFrameNo = ulFrameNo;
-        pParam->ulDataSize = ulDataSize;
-        pParam->pData = m_pDataBuffer + ulFrameNo * m_ulFrameSize;
-        KeResetEvent(&pParam->EventDone);
-        IoQueueWorkItem(pParam->WorkItem, SaveFrameWorkerCallback,
-                        CriticalWorkQueue, (PVOID)pParam);
+        return;
     }
-} // SaveFrame
-#pragma code_seg("PAGE")
+
+    InterlockedExchange(&m_lFlushRequested, 1);
+    KeSetEvent(&m_WakeEvent, 0, FALSE);
+
+    KeWaitForSingleObject(&m_FlushDoneEvent, Executive, KernelMode, FALSE, NULL);
+} // Flush
+
 //=============================================================================
 void
-CSaveData::WaitAllWorkItems
+CSaveData::StopWriter
 (
     void
 )
 {
     PAGED_CODE();
 
-    DPF_ENTER(("[CSaveData::WaitAllWorkItems]"));
-
-    // Save the last partially-filled frame
-    if (m_ulBufferOffset > m_ulFrameIndex * m_ulFrameSize)
+    if (m_pWriterThread == NULL)
     {
-        ULONG size;
-        
-        size = m_ulBufferOffset - m_ulFrameIndex * m_ulFrameSize;
-        SaveFrame(m_ulFrameIndex, size);
-    }
-    
-    for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
-    {
-        DPF(D_VERBOSE, ("[Waiting for WorkItem] %d", i));
-        KeWaitForSingleObject
-        (
-            &(m_pWorkItems[i].EventDone),
-            Executive,
-            KernelMode,
-            FALSE,
-            NULL
-        );
+        return;
     }
-} // WaitAllWorkItems
 
-#pragma code_seg()
+    InterlockedExchange(&m_lStopRequested, 1);
+    KeSetEvent(&m_WakeEvent, 0, FALSE);
+
+    KeWaitForSingleObject(m_pWriterThread, Executive, KernelMode, FALSE, NULL);
+    ObDereferenceObject(m_pWriterThread);
+    m_pWriterThread = NULL;
+} // StopWriter
+
 //=============================================================================
 void
-CSaveData::WriteData
+CSaveData::DrainRing
 (
-    _In_reads_bytes_(ulByteCount)   PBYTE   pBuffer,
-    _In_                            ULONG   ulByteCount
+    void
 )
-{
-    ASSERT(pBuffer);
-
-    BOOL                        fSaveFrame = FALSE;
-    ULONG                       ulSaveFrameIndex = 0;
-    KIRQL                       oldIrql;
-
-    // If stream writing is disabled, then exit.
-    //
-    if (m_fWriteDisabled)
-    {
-        return;
-    }
-
-    DPF_ENTER(("[CSaveData::WriteData ulByteCount=%lu]", ulByteCount));
-
-    if( 0 == ulByteCount )
-    {
-        return;
-    }
+/*++
 
-    // The logic below assumes that write size is <= than frame size.
-    if (ulByteCount > m_ulFrameSize)
-    {
-        ulByteCount = m_ulFrameSize;
-    }
-        
-    // Check to see if this frame is available.
-    KeAcquireSpinLock(&m_FrameInUseSpinLock, &oldIrql);
-    if (!m_fFrameUsed[m_ulFrameIndex])
-    {
-        KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql );
+Routine Description:
 
-        ULONG ulWriteBytes = ulByteCount;
+  Writes everything queued when the call starts to the file, in as few
+  writes as the ring's wrap allows. Caller holds m_FileSync.
 
-        if( (m_ulBufferSize - m_ulBufferOffset) < ulWriteBytes )
-        {
-            ulWriteBytes = m_ulBufferSize - m_ulBufferOffset;
-        }
+--*/
+{
+    PAGED_CODE();
 
-        RtlCopyMemory(m_pDataBuffer + m_ulBufferOffset, pBuffer, ulWriteBytes);
-        m_ulBufferOffset += ulWriteBytes;
+    // Take the anchor first: every byte counted below was committed before
+    // it was published, or is at most one WriteData call newer.
+    m_Anchor.Read(&m_DrainAnchor);
 
-        // Check to see if we need to save this frame
-        if (m_ulBufferOffset >= ((m_ulFrameIndex + 1) * m_ulFrameSize))
-        {
-            fSaveFrame = TRUE;
-        }
+    ULONG cbRemaining = m_Ring.GetBytesAvailable();
 
-        // Loop the buffer, if we reached the end.
-        if (m_ulBufferOffset == m_ulBufferSize)
-        {
-            fSaveFrame = TRUE;
-            m_ulBufferOffset = 0;
-        }
+    while (cbRemaining > 0)
+    {
+        PBYTE pData;
+        ULONG cbData = m_Ring.Peek(&pData, min(cbRemaining, (ULONG)SAVEDATA_MAX_WRITE_BYTES));
 
-        if (fSaveFrame)
+        if (cbData == 0)
         {
-            InterlockedExchange( (LONG *)&(m_fFrameUsed[m_ulFrameIndex]), TRUE );
-            ulSaveFrameIndex = m_ulFrameIndex;
-            m_ulFrameIndex = (m_ulFrameIndex + 1) % m_ulFrameCount;
+            break;
         }
 
-        // Write the left over if the next frame is available.
-        if (ulWriteBytes != ulByteCount)
+        if (m_FileHandle)
         {
-            KeAcquireSpinLock(&m_FrameInUseSpinLock, &oldIrql );
-            if (!m_fFrameUsed[m_ulFrameIndex])
+            if (m_Format == eSaveDataFlac)
             {
-                KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql );
-                RtlCopyMemory
-                (
-                    m_pDataBuffer + m_ulBufferOffset,
-                    pBuffer + ulWriteBytes,
-                    ulByteCount - ulWriteBytes
-                );
-                
-                m_ulBufferOffset += ulByteCount - ulWriteBytes;
+                FlacWrite(pData, cbData);
             }
             else
             {
-                KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql);
-                DPF(D_BLAB, ("[Frame overflow, next frame is in use]"));
+                WaveWrite(pData, cbData);
             }
         }
-
-        if (fSaveFrame)
+        else
         {
-            SaveFrame(ulSaveFrameIndex, m_ulFrameSize);
+            m_ullRingBytes += cbData;
         }
-    }
-    else
-    {
-        KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql );
-        DPF(D_BLAB, ("[Frame %d is in use]", m_ulFrameIndex));
+
+        m_Ring.Release(cbData);
+        cbRemaining -= cbData;
     }
 
-} // WriteData
+    IndexFlush();
+} // DrainRing
 
+//=============================================================================
+NTSTATUS
+CSaveData::FlacInitialize
+(
+    void
+)
+/*++
+
+Routine Description:
+
+  Sets up the FLAC encoder for the current data format. Only integer PCM
+  can be encoded.
+
+--*/
+{
+    PAGED_CODE();
+
+    BOOL    fPcm;
+    ULONG   cbWorkspace;
+
+    if (m_waveFormat == NULL)
+    {
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    fPcm = (m_waveFormat->wFormatTag == WAVE_FORMAT_PCM);
+    if (m_waveFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+        m_waveFormat->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))
+    {
+        fPcm = IsEqualGUIDAligned(((PWAVEFORMATEXTENSIBLE)m_waveFormat)->SubFormat, KSDATAFORMAT_SUBTYPE_PCM);
+    }
+
+    if (!fPcm ||
+        !CFlacEncoder::IsFormatSupported(m_waveFormat->nSamplesPerSec,
+                                         m_waveFormat->nChannels,
+                                         m_waveFormat->wBitsPerSample))
+    {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    cbWorkspace = CFlacEncoder::GetWorkspaceBytes(m_waveFormat->nChannels,
+                                                  m_waveFormat->wBitsPerSample,
+                                                  FLAC_DEFAULT_BLOCK_FRAMES);
+
+    // Only the writer thread touches the workspace.
+    m_pFlacWorkspace = ExAllocatePool2(POOL_FLAG_PAGED, cbWorkspace, SAVEDATA_POOLTAG5);
+    if (!m_pFlacWorkspace)
+    {
+        DPF(D_TERSE, ("[Could not allocate memory for FLAC encoder]"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (!m_FlacEncoder.Init(m_waveFormat->nSamplesPerSec,
+                            m_waveFormat->nChannels,
+                            m_waveFormat->wBitsPerSample,
+                            FLAC_DEFAULT_BLOCK_FRAMES,
+                            m_pFlacWorkspace,
+                            cbWorkspace))
+    {
+        ExFreePoolWithTag(m_pFlacWorkspace, SAVEDATA_POOLTAG5);
+        m_pFlacWorkspace = NULL;
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    return STATUS_SUCCESS;
+} // FlacInitialize
+
+//=============================================================================
+void
+CSaveData::FlacWrite
+(
+    _In_reads_bytes_(ulDataSize)    PBYTE   pData,
+    _In_                            ULONG   ulDataSize
+)
+/*++
+
+Routine Description:
+
+  Feeds stream bytes to the FLAC encoder and writes each block as it
+  completes, starting a new segment first if the current one is full.
+  Caller holds m_FileSync.
+
+--*/
+{
+    PAGED_CODE();
+
+    while (ulDataSize > 0)
+    {
+        ULONG cbUsed = m_FlacEncoder.AddData(pData, ulDataSize);
+
+        pData += cbUsed;
+        ulDataSize -= cbUsed;
+        m_ullRingBytes += cbUsed;
+
+        if (m_FlacEncoder.IsBlockFull())
+        {
+            const BYTE *    pFrame;
+            ULONG           cbFrame;
+
+            // The full block stays buffered in the encoder across the roll.
+            if (m_SegmentPolicy.IsFull(m_ullSegmentBytes, m_FlacEncoder.GetTotalFrames()))
+            {
+                SegmentClose(FALSE);
+                if (!NT_SUCCESS(SegmentOpen()))
+                {
+                    m_ullRingBytes += ulDataSize;
+                    return;
+                }
+            }
+
+            IndexAppend(m_ullRingBytes - m_FlacEncoder.GetPendingBytes(), (ULONGLONG)m_FilePtr.QuadPart);
+
+            cbFrame = m_FlacEncoder.EncodeBlock(&pFrame);
+            FileWrite((PBYTE)pFrame, cbFrame);
+            m_ullSegmentBytes += cbFrame;
+        }
+    }
+} // FlacWrite
+
+//=============================================================================
+void
+CSaveData::WaveWrite
+(
+    _In_reads_bytes_(ulDataSize)    PBYTE   pData,
+    _In_                            ULONG   ulDataSize
+)
+/*++
+
+Routine Description:
+
+  Writes stream bytes to the wave segment, splitting them where the
+  segment policy starts a new segment and adding an index entry at every
+  block boundary they cross. Caller holds m_FileSync.
+
+--*/
+{
+    PAGED_CODE();
+
+    ULONGLONG   ullBlockBytes = (ULONGLONG)RECORD_INDEX_BLOCK_FRAMES * m_waveFormat->nBlockAlign;
+
+    while (ulDataSize > 0)
+    {
+        RECORD_WAVE_RUN run;
+
+        RecordGetWaveRun(&m_SegmentPolicy, m_waveFormat->nBlockAlign, m_ullSegmentBytes, ulDataSize, &run);
+
+        if (run.cbRun == 0)
+        {
+            SegmentClose(FALSE);
+            if (!NT_SUCCESS(SegmentOpen()))
+            {
+                m_ullRingBytes += ulDataSize;
+                return;
+            }
+            continue;
+        }
+
+        // Index entries for the blocks that start inside this run.
+        for (ULONG i = 0; i < run.ulBlocks; i++)
+        {
+            ULONGLONG ullBlock = run.ullFirstBlock + i * ullBlockBytes;
+
+            IndexAppend(m_ullRingBytes + (ullBlock - m_ullSegmentBytes), m_ulHeaderBytes + ullBlock);
+        }
+
+        FileWrite(pData, run.cbRun);
+
+        pData += run.cbRun;
+        ulDataSize -= run.cbRun;
+        m_ullSegmentBytes += run.cbRun;
+        m_ullRingBytes += run.cbRun;
+    }
+} // WaveWrite
+
+//=============================================================================
+NTSTATUS
+CSaveData::SegmentFileName
+(
+    _In_  PCWSTR            Extension
+)
+/*++
+
+Routine Description:
+
+  Points m_FileName (and so m_objectAttributes) at a file of the current
+  segment.
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS    ntStatus;
+    size_t      cLen = 0;
+
+    ntStatus = RtlStringCchPrintfW(m_FileName.Buffer,
+                                   m_FileName.MaximumLength / sizeof(WCHAR),
+                                   L"%s_%s_%u_%03u.%s",
+                                   DEFAULT_FILE_NAME,
+                                   HOST_FILE_NAME,
+                                   m_ulFileId,
+                                   m_ulSegment,
+                                   Extension);
+    if (NT_SUCCESS(ntStatus))
+    {
+        ntStatus = RtlStringCchLengthW(m_FileName.Buffer, m_FileName.MaximumLength / sizeof(WCHAR), &cLen);
+    }
+
+    m_FileName.Length = NT_SUCCESS(ntStatus) ? (USHORT)(cLen * sizeof(WCHAR)) : 0;
+
+    return ntStatus;
+} // SegmentFileName
+
+//=============================================================================
+NTSTATUS
+CSaveData::SegmentOpen
+(
+    void
+)
+/*++
+
+Routine Description:
+
+  Creates the data file of the current segment, writes its header, and
+  starts its index. A missing index does not stop the recording.
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS                ntStatus;
+    IO_STATUS_BLOCK         ioStatusBlock;
+    RECORD_INDEX_HEADER     indexHeader;
+
+    m_ullSegmentBytes = 0;
+    m_ulIndexEntries = 0;
+    m_IndexPtr.QuadPart = 0;
+
+    if (m_Format == eSaveDataFlac)
+    {
+        m_FlacEncoder.RestartStream();
+    }
+
+    ntStatus = SegmentFileName((m_Format == eSaveDataFlac) ? L"flac" : L"wav");
+    if (NT_SUCCESS(ntStatus))
+    {
+        DPF(D_BLAB, ("[New DataFile -- %S", m_FileName.Buffer));
+
+        ntStatus = FileOpen(TRUE);
+    }
+    if (NT_SUCCESS(ntStatus))
+    {
+        ntStatus = FileWriteHeader();
+        if (!NT_SUCCESS(ntStatus))
+        {
+            FileClose();
+        }
+    }
+    if (!NT_SUCCESS(ntStatus))
+    {
+        return ntStatus;
+    }
+
+    if (NT_SUCCESS(SegmentFileName(L"idx")))
+    {
+        NTSTATUS indexStatus =
+            ZwCreateFile
+            (
+                &m_IndexHandle,
+                GENERIC_WRITE | SYNCHRONIZE,
+                &m_objectAttributes,
+                &ioStatusBlock,
+                NULL,
+                FILE_ATTRIBUTE_NORMAL,
+                0,
+                FILE_OVERWRITE_IF,
+                FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                NULL,
+                0
+            );
+        if (NT_SUCCESS(indexStatus))
+        {
+            RtlZeroMemory(&indexHeader, sizeof(indexHeader));
+            indexHeader.ulMagic = RECORD_INDEX_MAGIC;
+            indexHeader.usVersion = RECORD_INDEX_VERSION;
+            indexHeader.usEntryBytes = sizeof(RECORD_INDEX_ENTRY);
+            indexHeader.ulSegment = m_ulSegment;
+            indexHeader.ulSampleRate = m_waveFormat->nSamplesPerSec;
+            indexHeader.ulBlockFrames = RECORD_INDEX_BLOCK_FRAMES;
+            indexHeader.llQpcFrequency = m_QpcFrequency.QuadPart;
+            indexHeader.ullFirstFrame = m_ullSegmentFirstFrame;
+
+            indexStatus = ZwWriteFile(m_IndexHandle,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      &ioStatusBlock,
+                                      &indexHeader,
+                                      sizeof(indexHeader),
+                                      &m_IndexPtr,
+                                      NULL);
+            if (NT_SUCCESS(indexStatus))
+            {
+                m_IndexPtr.QuadPart = sizeof(indexHeader);
+            }
+        }
+        if (!NT_SUCCESS(indexStatus))
+        {
+            DPF(D_TERSE, ("[CSaveData::SegmentOpen : Could not create index]"));
+            if (m_IndexHandle)
+            {
+                ZwClose(m_IndexHandle);
+                m_IndexHandle = NULL;
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+} // SegmentOpen
+
+//=============================================================================
+void
+CSaveData::SegmentClose
+(
+    _In_  BOOL              fFinal
+)
+/*++
+
+Routine Description:
+
+  Finalizes the header of the current segment and closes it and its index.
+  On the final close the last, partial FLAC block is encoded; otherwise it
+  carries over to the next segment.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (m_FileHandle == NULL)
+    {
+        return;
+    }
+
+    if (m_Format == eSaveDataFlac && fFinal && m_FlacEncoder.GetPendingBytes() > 0)
+    {
+        const BYTE *    pFrame;
+        ULONG           cbFrame;
+
+        IndexAppend(m_ullRingBytes - m_FlacEncoder.GetPendingBytes(), (ULONGLONG)m_FilePtr.QuadPart);
+
+        cbFrame = m_FlacEncoder.EncodeBlock(&pFrame);
+        if (cbFrame > 0)
+        {
+            FileWrite((PBYTE)pFrame, cbFrame);
+            m_ullSegmentBytes += cbFrame;
+        }
+    }
+
+    // Rewrite the header with the real length: the RIFF/RF64 sizes, or
+    // STREAMINFO for FLAC.
+    FileWriteHeader();
+    FileClose();
+
+    IndexFlush();
+    if (m_IndexHandle)
+    {
+        ZwClose(m_IndexHandle);
+        m_IndexHandle = NULL;
+    }
+
+    m_ullSegmentFirstFrame += (m_Format == eSaveDataFlac) ?
+                              m_FlacEncoder.GetTotalFrames() :
+                              m_ullSegmentBytes / m_waveFormat->nBlockAlign;
+    m_ulSegment++;
+} // SegmentClose
+
+//=============================================================================
+void
+CSaveData::IndexAppend
+(
+    _In_  ULONGLONG         ullRingOffset,
+    _In_  ULONGLONG         ullFileOffset
+)
+/*++
+
+Routine Description:
+
+  Queues the index entry of a block. Its time is extrapolated back from the
+  anchor, the newest ring position WriteData published with its QPC time.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (m_IndexHandle == NULL)
+    {
+        return;
+    }
+
+    LONGLONG llFramesAhead = (LONGLONG)(m_DrainAnchor.ullCommittedBytes - ullRingOffset) / (LONGLONG)m_waveFormat->nBlockAlign;
+
+    m_pIndexEntries[m_ulIndexEntries].llQpc =
+        m_DrainAnchor.llQpc - llFramesAhead * m_QpcFrequency.QuadPart / (LONGLONG)m_waveFormat->nSamplesPerSec;
+    m_pIndexEntries[m_ulIndexEntries].ullOffset = ullFileOffset;
+
+    if (++m_ulIndexEntries == SAVEDATA_INDEX_BATCH)
+    {
+        IndexFlush();
+    }
+} // IndexAppend
+
+//=============================================================================
+void
+CSaveData::IndexFlush
+(
+    void
+)
+{
+    PAGED_CODE();
+
+    if (m_IndexHandle && m_ulIndexEntries > 0)
+    {
+        IO_STATUS_BLOCK ioStatusBlock;
+        ULONG           cbEntries = m_ulIndexEntries * sizeof(RECORD_INDEX_ENTRY);
+        NTSTATUS        ntStatus;
+
+        ntStatus = ZwWriteFile(m_IndexHandle,
+                               NULL,
+                               NULL,
+                               NULL,
+                               &ioStatusBlock,
+                               m_pIndexEntries,
+                               cbEntries,
+                               &m_IndexPtr,
+                               NULL);
+        if (NT_SUCCESS(ntStatus))
+        {
+            m_IndexPtr.QuadPart += cbEntries;
+        }
+        else
+        {
+            DPF(D_TERSE, ("[CSaveData::IndexFlush : Write Index Error]"));
+        }
+    }
+
+    m_ulIndexEntries = 0;
+} // IndexFlush
+
+//=============================================================================
+void
+CSaveData::ResetAnchor
+(
+    void
+)
+/*++
+
+Routine Description:
+
+  Restarts ring positions after the ring is attached. The stream is not
+  running, so nothing else publishes.
+
+--*/
+{
+    PAGED_CODE();
+
+    SAVEDATA_ANCHOR anchor;
+
+    anchor.ullCommittedBytes = 0;
+    anchor.llQpc = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    m_ullRingBytes = 0;
+    m_Anchor.Publish(anchor);
+} // ResetAnchor
+
+//=============================================================================
+void
+CSaveData::WriterLoop
+(
+    void
+)
+/*++
+
+Routine Description:
+
+  Body of the writer thread. Sleeps until the producer crosses the
+  coalescing threshold or the latency bound expires, drains the ring, and on
+  stop finalizes and closes the last segment.
+
+--*/
+{
+    PAGED_CODE();
+
+    LARGE_INTEGER   timeout;
+    ULONGLONG       ullLastWrite = KeQueryInterruptTime();
+
+    timeout.QuadPart = -10000LL * m_DrainPolicy.GetWaitMs();
+
+    for (;;)
+    {
+        KeWaitForSingleObject(&m_WakeEvent, Executive, KernelMode, FALSE, &timeout);
+
+        BOOL fStop = (m_lStopRequested != 0);
+        BOOL fFlush = (InterlockedExchange(&m_lFlushRequested, 0) != 0);
+
+        KeWaitForSingleObject(&m_FileSync, Executive, KernelMode, FALSE, NULL);
+
+        ULONGLONG ullNow = KeQueryInterruptTime();
+        ULONG ulMsSinceLastWrite = (ULONG)min((ullNow - ullLastWrite) / 10000, (ULONGLONG)MAXULONG);
+
+        if (m_DrainPolicy.ShouldWrite(m_Ring.GetBytesAvailable(), ulMsSinceLastWrite, fStop || fFlush))
+        {
+            DrainRing();
+            ullLastWrite = ullNow;
+        }
+        else if (m_Ring.GetBytesAvailable() == 0)
+        {
+            // Nothing pending; the latency bound restarts with the next byte.
+            ullLastWrite = ullNow;
+        }
+
+        if (fStop)
+        {
+            SegmentClose(TRUE);
+        }
+
+        KeReleaseMutex(&m_FileSync, FALSE);
+
+        if (fFlush)
+        {
+            KeSetEvent(&m_FlushDoneEvent, 0, FALSE);
+        }
+
+        if (fStop)
+        {
+            break;
+        }
+    }
+} // WriterLoop
+
+//=============================================================================
+VOID
+SaveDataWriterThread
+(
+    _In_ PVOID      StartContext
+)
+{
+    PAGED_CODE();
+
+    ASSERT(StartContext);
+
+    ((PCSaveData)StartContext)->WriterLoop();
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+} // SaveDataWriterThread
+
+#pragma code_seg()
+//=============================================================================
+ULONGLONG
+CSaveData::GetDroppedBytes
+(
+    void
+)
+{
+    return m_Ring.GetDroppedBytes();
+} // GetDroppedBytes
+
+//=============================================================================
+void
+CSaveData::WriteData
+(
+    _In_reads_bytes_(ulByteCount)   PBYTE   pBuffer,
+    _In_                            ULONG   ulByteCount
+)
+/*++
+
+Routine Description:
+
+  Queues stream bytes for the writer thread. Runs at DISPATCH_LEVEL in the
+  position update and never blocks; if the ring is full the frames that do
+  not fit are dropped and counted.
+
+--*/
+{
+    ASSERT(pBuffer);
+
+    // If stream writing is disabled, then exit.
+    //
+    if (m_fWriteDisabled || m_pDataBuffer == NULL)
+    {
+        return;
+    }
+
+    DPF_ENTER(("[CSaveData::WriteData ulByteCount=%lu]", ulByteCount));
+
+    if( 0 == ulByteCount )
+    {
+        return;
+    }
+
+    ULONG           cbQueuedBefore = m_Ring.GetBytesAvailable();
+    SAVEDATA_ANCHOR anchor;
+
+    if (m_Ring.Write(pBuffer, ulByteCount) > 0)
+    {
+        DPF(D_BLAB, ("[Ring full, frames dropped]"));
+    }
+
+    // Timestamp the newest data for the writer's index.
+    anchor.ullCommittedBytes = m_Ring.GetBytesCommitted();
+    anchor.llQpc = KeQueryPerformanceCounter(NULL).QuadPart;
+    m_Anchor.Publish(anchor);
+
+    if (m_DrainPolicy.ShouldWake(cbQueuedBefore, m_Ring.GetBytesAvailable()))
+    {
+        KeSetEvent(&m_WakeEvent, 0, FALSE);
+    }
+} // WriteData
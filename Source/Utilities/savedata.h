@@ -16,6 +16,12 @@ to save data to disk.
 #ifndef _VIRTUALAUDIODRIVER_SAVEDATA_H
 #define _VIRTUALAUDIODRIVER_SAVEDATA_H
 
+#include "loopbackring.h"
+#include "drainpolicy.h"
+#include "flacencoder.h"
+#include "recordfile.h"
+#include "seqlock.h"
+
 //-----------------------------------------------------------------------------
 //  Forward declaration
 //-----------------------------------------------------------------------------
@@ -23,43 +29,25 @@ class CSaveData;
 typedef CSaveData *PCSaveData;
 
 
+//-----------------------------------------------------------------------------
+//  Enums
+//-----------------------------------------------------------------------------
+typedef enum
+{
+    eSaveDataWave = 0,
+    eSaveDataFlac,
+} eSaveDataFormat;
+
 //-----------------------------------------------------------------------------
 //  Structs
 //-----------------------------------------------------------------------------
 
-// Parameter to workitem.
-#include <pshpack1.h>
-typedef struct _SAVEWORKER_PARAM {
-    PIO_WORKITEM     WorkItem;
-    ULONG            ulFrameNo;
-    ULONG            ulDataSize;
-    PBYTE            pData;
-    PCSaveData       pSaveData;
-    KEVENT           EventDone;
-} SAVEWORKER_PARAM;
-typedef SAVEWORKER_PARAM *PSAVEWORKER_PARAM;
-#include <poppack.h>
-
-// wave file header.
-#include <pshpack1.h>
-typedef struct _OUTPUT_FILE_HEADER
-{
-    DWORD           dwRiff;
-    DWORD           dwFileSize;
-    DWORD           dwWave;
-    DWORD           dwFormat;
-    DWORD           dwFormatLength;
-} OUTPUT_FILE_HEADER;
-typedef OUTPUT_FILE_HEADER *POUTPUT_FILE_HEADER;
-
-typedef struct _OUTPUT_DATA_HEADER
+// Ring position and time of the newest data, published by WriteData.
+typedef struct _SAVEDATA_ANCHOR
 {
-    DWORD           dwData;
-    DWORD           dwDataLength;
-} OUTPUT_DATA_HEADER;
-typedef OUTPUT_DATA_HEADER *POUTPUT_DATA_HEADER;
-
-#include <poppack.h>
+    ULONGLONG       ullCommittedBytes;
+    LONGLONG        llQpc;
+} SAVEDATA_ANCHOR;
 
 //-----------------------------------------------------------------------------
 //  Classes
@@ -67,36 +55,58 @@ typedef OUTPUT_DATA_HEADER *POUTPUT_DATA_HEADER;
 
 ///////////////////////////////////////////////////////////////////////////////
 // CSaveData
-//   Saves the wave data to disk.
+//   Saves the wave data to disk. WriteData queues the stream's bytes in a
+//   lock-free ring; a writer thread owned by the object drains it to the
+//   file in large writes, FLAC encoding it on the way if asked to. Long
+//   recordings are split into segments, each with a sidecar time index.
 //
-IO_WORKITEM_ROUTINE SaveFrameWorkerCallback;
+KSTART_ROUTINE SaveDataWriterThread;
 
 class CSaveData
 {
 protected:
     UNICODE_STRING              m_FileName;         // DataFile name.
     HANDLE                      m_FileHandle;       // DataFile handle.
-    PBYTE                       m_pDataBuffer;      // Data buffer.
-    ULONG                       m_ulBufferSize;     // Total buffer size.
-
-    ULONG                       m_ulFrameIndex;     // Current Frame.
-    ULONG                       m_ulFrameCount;     // Frame count.
-    ULONG                       m_ulFrameSize;
-    ULONG                       m_ulBufferOffset;   // index in buffer.
-    PBOOL                       m_fFrameUsed;       // Frame usage table.
-    KSPIN_LOCK                  m_FrameInUseSpinLock; // Spinlock for synch.
-    KMUTEX                      m_FileSync;         // Synchronizes file access
+    PBYTE                       m_pDataBuffer;      // Ring storage.
+    ULONG                       m_ulBufferSize;     // Ring size, a power of two.
+    CLoopbackRing               m_Ring;             // WriteData -> writer thread.
+    CDrainPolicy                m_DrainPolicy;
+    KMUTEX                      m_FileSync;         // Writer thread vs. ring/file changes.
+
+    PKTHREAD                    m_pWriterThread;
+    KEVENT                      m_WakeEvent;        // Data queued, flush or stop.
+    KEVENT                      m_FlushDoneEvent;
+    volatile LONG               m_lFlushRequested;
+    volatile LONG               m_lStopRequested;
 
     OBJECT_ATTRIBUTES           m_objectAttributes; // Used for opening file.
+    HANDLE                      m_IndexHandle;      // Sidecar index of the segment.
+    LARGE_INTEGER               m_IndexPtr;
+    PRECORD_INDEX_ENTRY         m_pIndexEntries;    // Not yet written to the index.
+    ULONG                       m_ulIndexEntries;
+
+    // Segments. Byte counts are uncompressed stream bytes unless noted.
+    CSegmentPolicy              m_SegmentPolicy;
+    ULONG                       m_ulFileId;         // Stream number in the file names.
+    ULONG                       m_ulSegment;
+    ULONGLONG                   m_ullSegmentFirstFrame;
+    ULONGLONG                   m_ullSegmentBytes;
+    ULONG                       m_ulHeaderBytes;    // File bytes before the audio.
+    ULONGLONG                   m_ullRingBytes;     // Taken from the ring since Attach.
+
+    CSeqLockSnapshot<SAVEDATA_ANCHOR> m_Anchor;
+    SAVEDATA_ANCHOR             m_DrainAnchor;      // Writer's copy for one drain.
+    LARGE_INTEGER               m_QpcFrequency;
+
+    eSaveDataFormat             m_Format;
+    CFlacEncoder                m_FlacEncoder;      // Writer thread only.
+    PVOID                       m_pFlacWorkspace;
 
-    OUTPUT_FILE_HEADER          m_FileHeader;
     PWAVEFORMATEX               m_waveFormat;
-    OUTPUT_DATA_HEADER          m_DataHeader;
-    PLARGE_INTEGER              m_pFilePtr;
+    LARGE_INTEGER               m_FilePtr;
 
     static PDEVICE_OBJECT       m_pDeviceObject;
     static ULONG                m_ulStreamId;
-    static PSAVEWORKER_PARAM    m_pWorkItems;
 
     BOOL                        m_fWriteDisabled;
 
@@ -106,24 +116,21 @@ public:
     CSaveData();
     ~CSaveData();
 
-    static NTSTATUS             InitializeWorkItems
+    void                        Disable
     (
-        _In_  PDEVICE_OBJECT    DeviceObject
+        _In_ BOOL               fDisable
     );
-    static void                 DestroyWorkItems
+    void                        Flush
     (
         void
     );
-    void                        Disable
-    (
-        _In_ BOOL               fDisable
-    );
-    static PSAVEWORKER_PARAM    GetNewWorkItem
+    ULONGLONG                   GetDroppedBytes
     (
         void
     );
     NTSTATUS                    Initialize
     (
+        _In_  eSaveDataFormat   Format
     );
 	static NTSTATUS             SetDeviceObject
 	(
@@ -133,11 +140,6 @@ public:
 	(
 	    void
 	);
-    void                        ReadData
-    (
-        _Inout_updates_bytes_all_(ulByteCount)  PBYTE   pBuffer,
-        _In_                                    ULONG   ulByteCount
-    );
     NTSTATUS                    SetDataFormat
     (
         _In_  PKSDATAFORMAT     pDataFormat
@@ -146,10 +148,6 @@ public:
     (
         _In_  ULONG             ulMaxWriteSize
     );  
-    void                        WaitAllWorkItems
-    (
-        void
-    );
     void                        WriteData
     (
         _In_reads_bytes_(ulByteCount)   PBYTE   pBuffer,
@@ -174,15 +172,60 @@ private:
     (
         void
     );
-
-    void                        SaveFrame
+    void                        DrainRing
     (
-        _In_ ULONG              ulFrameNo,
-        _In_ ULONG              ulDataSize
+        void
+    );
+    NTSTATUS                    FlacInitialize
+    (
+        void
+    );
+    void                        FlacWrite
+    (
+        _In_reads_bytes_(ulDataSize)    PBYTE   pData,
+        _In_                            ULONG   ulDataSize
+    );
+    void                        WaveWrite
+    (
+        _In_reads_bytes_(ulDataSize)    PBYTE   pData,
+        _In_                            ULONG   ulDataSize
+    );
+    NTSTATUS                    SegmentFileName
+    (
+        _In_  PCWSTR            Extension
+    );
+    NTSTATUS                    SegmentOpen
+    (
+        void
+    );
+    void                        SegmentClose
+    (
+        _In_  BOOL              fFinal
+    );
+    void                        IndexAppend
+    (
+        _In_  ULONGLONG         ullRingOffset,
+        _In_  ULONGLONG         ullFileOffset
+    );
+    void                        IndexFlush
+    (
+        void
+    );
+    void                        ResetAnchor
+    (
+        void
+    );
+    void                        WriterLoop
+    (
+        void
+    );
+    void                        StopWriter
+    (
+        void
     );
 
     friend
-    IO_WORKITEM_ROUTINE         SaveFrameWorkerCallback;
+    KSTART_ROUTINE              SaveDataWriterThread;
 };
 typedef CSaveData *PCSaveData;
 
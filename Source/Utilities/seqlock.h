@@ -0,0 +1,99 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    seqlock.h
+
+Abstract:
+
+    Sequence-counter protected snapshot. A single (externally serialized)
+    writer publishes a plain-data value; any number of readers copy it out
+    without taking a lock and retry if a publish overlapped their copy.
+    Readers never block the writer.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_SEQLOCK_H_
+#define _VIRTUALAUDIODRIVER_SEQLOCK_H_
+
+#include "portable.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// CSeqLockSnapshot
+//
+//   m_ulSequence is odd while a publish is in progress. T must be plain data
+//   that can be copied byte-wise.
+//
+template <typename T>
+class CSeqLockSnapshot
+{
+protected:
+    volatile ULONG              m_ulSequence;
+    T                           m_Data;
+
+public:
+    CSeqLockSnapshot() :
+        m_ulSequence(0)
+    {
+        RtlZeroMemory(&m_Data, sizeof(m_Data));
+    }
+
+    //
+    // Writer side. Callers must serialize Publish among themselves.
+    //
+    VOID Publish
+    (
+        _In_ const T &              Data
+    )
+    {
+        ULONG ulSequence = m_ulSequence;
+
+        m_ulSequence = ulSequence + 1;
+        VAD_MEMORY_BARRIER();
+
+        RtlCopyMemory((PVOID)&m_Data, &Data, sizeof(T));
+
+        VAD_MEMORY_BARRIER();
+        m_ulSequence = ulSequence + 2;
+    }
+
+    //
+    // Reader side. Returns the number of retries, which is only of interest
+    // for profiling.
+    //
+    ULONG Read
+    (
+        _Out_ T *                   pData
+    ) const
+    {
+        ULONG ulRetries = 0;
+
+        for (;;)
+        {
+            ULONG ulBefore = m_ulSequence;
+
+            if ((ulBefore & 1) == 0)
+            {
+                VAD_MEMORY_BARRIER();
+                RtlCopyMemory(pData, (const VOID *)&m_Data, sizeof(T));
+                VAD_MEMORY_BARRIER();
+
+                if (m_ulSequence == ulBefore)
+                {
+                    return ulRetries;
+                }
+            }
+
+            ulRetries++;
+            VAD_CPU_PAUSE();
+        }
+    }
+
+    ULONG GetSequence() const
+    {
+        return m_ulSequence;
+    }
+};
+
+#endif // _VIRTUALAUDIODRIVER_SEQLOCK_H_
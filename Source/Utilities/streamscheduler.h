@@ -0,0 +1,337 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    streamscheduler.h
+
+Abstract:
+
+    Scheduling core behind the adapter-wide stream timer. One periodic tick
+    services every running stream. Streams are grouped by notification
+    interval and each group caches its earliest deadline, so a tick only
+    touches the groups (and within them the streams) that are due.
+
+    A tick is split so the callbacks can run outside the caller's lock:
+    CollectDue picks the due entries and marks them in a callback, the
+    caller runs them unlocked and hands each result back with Complete.
+    The core does no locking and no allocation; the caller serializes all
+    calls and waits out IsInCallback before it lets go of an entry.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_STREAMSCHEDULER_H_
+#define _VIRTUALAUDIODRIVER_STREAMSCHEDULER_H_
+
+#include "portable.h"
+
+// Distinct notification intervals tracked separately. Streams beyond that
+// share the catch-all group 0, which is still exact but checked every tick.
+#define SCHEDULER_MAX_GROUPS        16
+
+// Returned by a callback that wants to be removed from the schedule.
+#define SCHEDULER_DONE              ((ULONGLONG)-1)
+
+//
+// Per-stream callback. Returns the time at which it next needs to run, in
+// the same units as hnsNow; anything <= the next tick's time means "next
+// tick".
+//
+typedef ULONGLONG SCHEDULER_CALLBACK
+(
+    _In_opt_ PVOID      Context,
+    _In_ ULONGLONG      hnsNow
+);
+typedef SCHEDULER_CALLBACK *PFN_SCHEDULER_CALLBACK;
+
+typedef struct _SCHEDULER_ENTRY
+{
+    struct _SCHEDULER_ENTRY    *pNext;
+    struct _SCHEDULER_ENTRY    *pNextDue;       // Batch from CollectDue
+    PFN_SCHEDULER_CALLBACK      pfnCallback;
+    PVOID                       Context;
+    ULONGLONG                   hnsDue;
+    ULONG                       ulGroup;
+    BOOL                        bScheduled;
+    volatile BOOL               bInCallback;    // Collected, not yet completed
+} SCHEDULER_ENTRY;
+typedef SCHEDULER_ENTRY *PSCHEDULER_ENTRY;
+
+///////////////////////////////////////////////////////////////////////////////
+// CStreamScheduler
+//
+class CStreamScheduler
+{
+protected:
+    struct SCHEDULER_GROUP
+    {
+        PSCHEDULER_ENTRY        pHead;
+        ULONG                   ulIntervalMs;
+        ULONG                   ulCount;
+        ULONGLONG               hnsNextDue;
+    };
+
+    SCHEDULER_GROUP             m_Groups[SCHEDULER_MAX_GROUPS];
+    ULONG                       m_ulEntryCount;
+
+public:
+    CStreamScheduler() :
+        m_ulEntryCount(0)
+    {
+        RtlZeroMemory(m_Groups, sizeof(m_Groups));
+        for (ULONG i = 0; i < SCHEDULER_MAX_GROUPS; i++)
+        {
+            m_Groups[i].hnsNextDue = SCHEDULER_DONE;
+        }
+    }
+
+    static VOID InitializeEntry
+    (
+        _Out_ PSCHEDULER_ENTRY          pEntry,
+        _In_ PFN_SCHEDULER_CALLBACK     pfnCallback,
+        _In_opt_ PVOID                  Context
+    )
+    {
+        RtlZeroMemory(pEntry, sizeof(*pEntry));
+        pEntry->pfnCallback = pfnCallback;
+        pEntry->Context = Context;
+    }
+
+    ULONG GetEntryCount() const
+    {
+        return m_ulEntryCount;
+    }
+
+    //
+    // Adds pEntry to the group for ulIntervalMs; it first runs on the tick
+    // at or after hnsDue. Returns FALSE if the entry is already scheduled.
+    //
+    BOOL Add
+    (
+        _Inout_ PSCHEDULER_ENTRY    pEntry,
+        _In_ ULONG                  ulIntervalMs,
+        _In_ ULONGLONG              hnsDue
+    )
+    {
+        if (pEntry->bScheduled)
+        {
+            return FALSE;
+        }
+
+        ULONG ulGroup = FindGroup(ulIntervalMs);
+        SCHEDULER_GROUP *pGroup = &m_Groups[ulGroup];
+
+        pEntry->hnsDue = hnsDue;
+        pEntry->ulGroup = ulGroup;
+        pEntry->pNext = pGroup->pHead;
+        pEntry->bScheduled = TRUE;
+
+        pGroup->pHead = pEntry;
+        pGroup->ulCount++;
+        if (hnsDue < pGroup->hnsNextDue)
+        {
+            pGroup->hnsNextDue = hnsDue;
+        }
+
+        m_ulEntryCount++;
+        return TRUE;
+    }
+
+    //
+    // Removes pEntry; no-op if it is not scheduled. Once this returns under
+    // the caller's lock the callback will not be collected again; one that
+    // was already collected may still be running (IsInCallback).
+    //
+    VOID Remove
+    (
+        _Inout_ PSCHEDULER_ENTRY    pEntry
+    )
+    {
+        if (!pEntry->bScheduled)
+        {
+            return;
+        }
+
+        SCHEDULER_GROUP *pGroup = &m_Groups[pEntry->ulGroup];
+        PSCHEDULER_ENTRY *ppLink = &pGroup->pHead;
+
+        while (*ppLink != NULL)
+        {
+            if (*ppLink == pEntry)
+            {
+                *ppLink = pEntry->pNext;
+                break;
+            }
+            ppLink = &(*ppLink)->pNext;
+        }
+
+        pEntry->pNext = NULL;
+        pEntry->bScheduled = FALSE;
+        pGroup->ulCount--;
+        m_ulEntryCount--;
+
+        if (pGroup->ulCount == 0)
+        {
+            // Free the slot for another interval.
+            pGroup->ulIntervalMs = 0;
+            pGroup->hnsNextDue = SCHEDULER_DONE;
+        }
+        // A stale (early) hnsNextDue only costs one extra scan.
+    }
+
+    static BOOL IsInCallback
+    (
+        _In_ const SCHEDULER_ENTRY *pEntry
+    )
+    {
+        return pEntry->bInCallback;
+    }
+
+    //
+    // Marks every entry whose deadline is <= hnsNow as in its callback and
+    // returns them linked through pNextDue, NULL if none is due. Entries
+    // still in a callback from an earlier tick are skipped.
+    //
+    PSCHEDULER_ENTRY CollectDue
+    (
+        _In_ ULONGLONG              hnsNow
+    )
+    {
+        PSCHEDULER_ENTRY pBatch = NULL;
+
+        for (ULONG i = 0; i < SCHEDULER_MAX_GROUPS; i++)
+        {
+            SCHEDULER_GROUP *pGroup = &m_Groups[i];
+
+            if (pGroup->ulCount == 0 || pGroup->hnsNextDue > hnsNow)
+            {
+                continue;
+            }
+
+            // Collected entries come back through Complete with their next due.
+            ULONGLONG hnsNextDue = SCHEDULER_DONE;
+
+            for (PSCHEDULER_ENTRY pEntry = pGroup->pHead; pEntry != NULL; pEntry = pEntry->pNext)
+            {
+                if (pEntry->bInCallback)
+                {
+                    continue;
+                }
+
+                if (pEntry->hnsDue <= hnsNow)
+                {
+                    pEntry->bInCallback = TRUE;
+                    pEntry->pNextDue = pBatch;
+                    pBatch = pEntry;
+                    continue;
+                }
+
+                if (pEntry->hnsDue < hnsNextDue)
+                {
+                    hnsNextDue = pEntry->hnsDue;
+                }
+            }
+
+            pGroup->hnsNextDue = hnsNextDue;
+        }
+
+        return pBatch;
+    }
+
+    //
+    // Ends the callback of an entry from CollectDue with the deadline it
+    // returned. Drops the entry on SCHEDULER_DONE; an entry removed while
+    // in its callback stays removed. The caller must not touch pEntry
+    // after this once it has released its lock.
+    //
+    VOID Complete
+    (
+        _Inout_ PSCHEDULER_ENTRY    pEntry,
+        _In_ ULONGLONG              hnsNextDue
+    )
+    {
+        if (pEntry->bScheduled)
+        {
+            if (hnsNextDue == SCHEDULER_DONE)
+            {
+                Remove(pEntry);
+            }
+            else
+            {
+                SCHEDULER_GROUP *pGroup = &m_Groups[pEntry->ulGroup];
+
+                pEntry->hnsDue = hnsNextDue;
+                if (hnsNextDue < pGroup->hnsNextDue)
+                {
+                    pGroup->hnsNextDue = hnsNextDue;
+                }
+            }
+        }
+
+        pEntry->pNextDue = NULL;
+        VAD_MEMORY_BARRIER();
+        pEntry->bInCallback = FALSE;
+    }
+
+    //
+    // Runs every entry whose deadline is <= hnsNow, in place, for callers
+    // that need no lock. Returns the number of callbacks made.
+    //
+    ULONG Tick
+    (
+        _In_ ULONGLONG              hnsNow
+    )
+    {
+        ULONG ulCalls = 0;
+        PSCHEDULER_ENTRY pEntry = CollectDue(hnsNow);
+
+        while (pEntry != NULL)
+        {
+            PSCHEDULER_ENTRY pNextDue = pEntry->pNextDue;
+
+            Complete(pEntry, pEntry->pfnCallback(pEntry->Context, hnsNow));
+            ulCalls++;
+            pEntry = pNextDue;
+        }
+
+        return ulCalls;
+    }
+
+protected:
+    //
+    // Group 0 is the catch-all; groups 1..N are keyed by interval.
+    //
+    ULONG FindGroup
+    (
+        _In_ ULONG                  ulIntervalMs
+    )
+    {
+        ULONG ulFree = 0;
+
+        for (ULONG i = 1; i < SCHEDULER_MAX_GROUPS; i++)
+        {
+            if (m_Groups[i].ulCount > 0)
+            {
+                if (m_Groups[i].ulIntervalMs == ulIntervalMs)
+                {
+                    return i;
+                }
+            }
+            else if (ulFree == 0)
+            {
+                ulFree = i;
+            }
+        }
+
+        if (ulFree != 0)
+        {
+            m_Groups[ulFree].ulIntervalMs = ulIntervalMs;
+        }
+
+        return ulFree;
+    }
+};
+
+typedef CStreamScheduler *PCStreamScheduler;
+
+#endif // _VIRTUALAUDIODRIVER_STREAMSCHEDULER_H_
@@ -0,0 +1,225 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    subdevicetable.h
+
+Abstract:
+
+    Name index over the adapter's cached subdevices.
+
+    - Fixed capacity open addressing: SLOTS (a power of two) slots of
+      { hash, record } with linear probing, filled at most half way so a
+      probe run stays short. Removal shifts the run back instead of
+      leaving tombstones, so install/remove churn never degrades lookups.
+    - Records are the caller's; the table neither allocates nor frees
+      them. A record carries its own name and the hash of it (NameHash),
+      which the caller computes once when it caches the record.
+    - Callers serialize access (the adapter only touches its cache at
+      PASSIVE_LEVEL from PnP and power paths).
+
+    The record type is a template parameter; it needs Name (WCHAR array)
+    and NameHash (ULONG).
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_SUBDEVICETABLE_H_
+#define _VIRTUALAUDIODRIVER_SUBDEVICETABLE_H_
+
+#include "portable.h"
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CSubdeviceTable
+//
+template <typename RECORD, ULONG SLOTS>
+class CSubdeviceTable
+{
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+
+protected:
+    struct SLOT
+    {
+        ULONG                   ulHash;
+        RECORD *                pRecord;            // NULL when empty
+    };
+
+    SLOT                        m_Slots[SLOTS];
+    ULONG                       m_ulCount;
+
+public:
+    // Records the table takes before Insert fails.
+    static const ULONG          Capacity = SLOTS / 2;
+
+    CSubdeviceTable()
+    {
+        Reset();
+    }
+
+    VOID Reset()
+    {
+        RtlZeroMemory(m_Slots, sizeof(m_Slots));
+        m_ulCount = 0;
+    }
+
+    ULONG GetCount() const
+    {
+        return m_ulCount;
+    }
+
+    //
+    // FNV-1a over the name's characters, then a murmur finalizer so the
+    // low bits that pick the slot depend on the whole name.
+    //
+    static ULONG Hash
+    (
+        _In_ PCWSTR     pszName
+    )
+    {
+        ULONG ulHash = 2166136261u;
+
+        for (; *pszName != L'\0'; pszName++)
+        {
+            ulHash = (ulHash ^ (ULONG)*pszName) * 16777619u;
+        }
+
+        ulHash ^= ulHash >> 16;
+        ulHash *= 0x85ebca6bu;
+        ulHash ^= ulHash >> 13;
+        ulHash *= 0xc2b2ae35u;
+        ulHash ^= ulHash >> 16;
+
+        return ulHash;
+    }
+
+    //
+    // The record named pszName, whose Hash is ulHash, or NULL.
+    //
+    RECORD * Find
+    (
+        _In_ PCWSTR     pszName,
+        _In_ ULONG      ulHash
+    ) const
+    {
+        ULONG ulSlot = Lookup(pszName, ulHash);
+
+        return ulSlot < SLOTS ? m_Slots[ulSlot].pRecord : NULL;
+    }
+
+    //
+    // Indexes pRecord under pRecord->NameHash. Returns FALSE when the
+    // table is at Capacity.
+    //
+    BOOL Insert
+    (
+        _In_ RECORD *   pRecord
+    )
+    {
+        ULONG ulSlot;
+
+        if (m_ulCount >= Capacity)
+        {
+            return FALSE;
+        }
+
+        for (ulSlot = pRecord->NameHash & (SLOTS - 1);
+             m_Slots[ulSlot].pRecord != NULL;
+             ulSlot = (ulSlot + 1) & (SLOTS - 1))
+        {
+        }
+
+        m_Slots[ulSlot].ulHash = pRecord->NameHash;
+        m_Slots[ulSlot].pRecord = pRecord;
+        m_ulCount++;
+
+        return TRUE;
+    }
+
+    //
+    // Drops the record named pszName from the index and returns it, or
+    // NULL if there is none.
+    //
+    RECORD * Remove
+    (
+        _In_ PCWSTR     pszName,
+        _In_ ULONG      ulHash
+    )
+    {
+        ULONG       ulHole = Lookup(pszName, ulHash);
+        RECORD *    pRecord;
+
+        if (ulHole >= SLOTS)
+        {
+            return NULL;
+        }
+
+        pRecord = m_Slots[ulHole].pRecord;
+
+        //
+        // Pull later entries of the run into the hole unless that would
+        // move them in front of their home slot.
+        //
+        for (ULONG ulNext = (ulHole + 1) & (SLOTS - 1);
+             m_Slots[ulNext].pRecord != NULL;
+             ulNext = (ulNext + 1) & (SLOTS - 1))
+        {
+            ULONG ulHome = m_Slots[ulNext].ulHash & (SLOTS - 1);
+
+            if (((ulNext - ulHome) & (SLOTS - 1)) >= ((ulNext - ulHole) & (SLOTS - 1)))
+            {
+                m_Slots[ulHole] = m_Slots[ulNext];
+                ulHole = ulNext;
+            }
+        }
+
+        m_Slots[ulHole].ulHash = 0;
+        m_Slots[ulHole].pRecord = NULL;
+        m_ulCount--;
+
+        return pRecord;
+    }
+
+private:
+    //
+    // Slot of the record named pszName, SLOTS if there is none.
+    //
+    ULONG Lookup
+    (
+        _In_ PCWSTR     pszName,
+        _In_ ULONG      ulHash
+    ) const
+    {
+        for (ULONG ulSlot = ulHash & (SLOTS - 1);
+             m_Slots[ulSlot].pRecord != NULL;
+             ulSlot = (ulSlot + 1) & (SLOTS - 1))
+        {
+            if (m_Slots[ulSlot].ulHash == ulHash &&
+                NamesEqual(m_Slots[ulSlot].pRecord->Name, pszName))
+            {
+                return ulSlot;
+            }
+        }
+
+        return SLOTS;
+    }
+
+    static BOOL NamesEqual
+    (
+        _In_ PCWSTR     pszA,
+        _In_ PCWSTR     pszB
+    )
+    {
+        while (*pszA != L'\0' && *pszA == *pszB)
+        {
+            pszA++;
+            pszB++;
+        }
+
+        return *pszA == *pszB;
+    }
+};
+
+#endif // _VIRTUALAUDIODRIVER_SUBDEVICETABLE_H_
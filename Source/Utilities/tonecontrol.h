@@ -0,0 +1,613 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    tonecontrol.h
+
+Abstract:
+
+    Bass and treble tone control applied to stream audio.
+
+    - Each channel runs a low shelf at TONE_BASS_HZ and a high shelf at
+      TONE_TREBLE_HZ, both biquads (RBJ cookbook, slope 1). The
+      coefficients for every supported sample rate and every 0.5 dB
+      setting are in a table built at compile time.
+    - ToneFilter<Bits, Channels, Float> filters samples in place in one
+      stream format, a frame at a time across the interleaved channels,
+      with the container size and channel count fixed at compile time.
+    - CToneControl glides to a new setting through the table one step at
+      a time, so a change never swaps a whole filter at once.
+
+    The filters run in fixed point (see fixedsample.h) in direct form I,
+    which tolerates changing coefficients, with second-order error
+    feedback so the shelves keep their noise floor at low frequencies and
+    high sample rates. With both shelves flat the audio is left alone.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_TONECONTROL_H_
+#define _VIRTUALAUDIODRIVER_TONECONTROL_H_
+
+#include "portable.h"
+#include "fixedsample.h"
+#include "gainramp.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+// Largest channel count with a dedicated instance (7.1).
+#define TONE_MAX_CHANNELS           8
+
+// Shelf frequencies.
+#define TONE_BASS_HZ                200
+#define TONE_TREBLE_HZ              3000
+
+// The table has an entry every 0.5 dB (the topology stepping) from -12 dB
+// to 12 dB, the tone control range. Entry TONE_TABLE_FLAT is 0 dB.
+#define TONE_TABLE_STEP_SHIFT       15
+#define TONE_TABLE_ENTRIES          49
+#define TONE_TABLE_FLAT             24
+
+// Sample rates with coefficients.
+#define TONE_RATES                  13
+
+// A glide moves one table entry every 1/TONE_GLIDE_STEPS_PER_SECOND s,
+// 12 ms across the whole range.
+#define TONE_GLIDE_STEPS_PER_SECOND 2000
+
+// Coefficients are in Q27.
+#define TONE_COEFFICIENT_SHIFT      27
+
+//=============================================================================
+// Coefficients
+//=============================================================================
+
+//
+// Biquad coefficients in Q27, normalized so a0 is 1:
+// y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2].
+//
+typedef struct _TONE_BIQUAD
+{
+    LONG        lB0;
+    LONG        lB1;
+    LONG        lB2;
+    LONG        lA1;
+    LONG        lA2;
+} TONE_BIQUAD;
+typedef TONE_BIQUAD *PTONE_BIQUAD;
+
+constexpr ULONG g_ToneRates[TONE_RATES] =
+{
+    8000, 11025, 16000, 22050, 32000, 44100, 48000,
+    88200, 96000, 176400, 192000, 352800, 384000
+};
+
+//
+// cos(x) and sin(x) for 0 <= x <= pi. Only evaluated at compile time.
+//
+constexpr double ToneCos(double x)
+{
+    double term = 1;
+    double sum = 1;
+
+    for (int n = 2; n < 40; n += 2)
+    {
+        term *= -x * x / ((n - 1) * n);
+        sum += term;
+    }
+
+    return sum;
+}
+
+constexpr double ToneSin(double x)
+{
+    double term = x;
+    double sum = x;
+
+    for (int n = 3; n < 41; n += 2)
+    {
+        term *= -x * x / ((n - 1) * n);
+        sum += term;
+    }
+
+    return sum;
+}
+
+constexpr LONG ToneCoefficient(double x)
+{
+    return (LONG)(x * (1L << TONE_COEFFICIENT_SHIFT) + (x < 0 ? -0.5 : 0.5));
+}
+
+//
+// Shelf of gain A^2 (A = 10^(dB / 40)) at w0 = 2 pi f / fs, given cos(w0)
+// and sin(w0). The slope is 1, so 2 sqrt(A) alpha = sqrt(2 A) sin(w0).
+//
+constexpr TONE_BIQUAD ToneShelf(BOOL bHigh, double A, double sqrtA, double c, double sn)
+{
+    double beta = 1.414213562373095049 * sqrtA * sn;
+    double s = bHigh ? -1 : 1;
+    TONE_BIQUAD biquad = {};
+    double a0 = (A + 1) + s * (A - 1) * c + beta;
+
+    biquad.lB0 = ToneCoefficient(A * ((A + 1) - s * (A - 1) * c + beta) / a0);
+    biquad.lB1 = ToneCoefficient(s * 2 * A * ((A - 1) - s * (A + 1) * c) / a0);
+    biquad.lB2 = ToneCoefficient(A * ((A + 1) - s * (A - 1) * c - beta) / a0);
+    biquad.lA1 = ToneCoefficient(-s * 2 * ((A - 1) + s * (A + 1) * c) / a0);
+    biquad.lA2 = ToneCoefficient(((A + 1) + s * (A - 1) * c - beta) / a0);
+
+    return biquad;
+}
+
+struct TONE_TABLE
+{
+    TONE_BIQUAD Bass[TONE_RATES][TONE_TABLE_ENTRIES];
+    TONE_BIQUAD Treble[TONE_RATES][TONE_TABLE_ENTRIES];
+
+    constexpr TONE_TABLE() : Bass(), Treble()
+    {
+        double A[TONE_TABLE_ENTRIES] = {};
+        double sqrtA[TONE_TABLE_ENTRIES] = {};
+
+        // The series are evaluated once per gain and once per rate, which
+        // keeps the compile-time work small.
+        for (ULONG i = 0; i < TONE_TABLE_ENTRIES; i++)
+        {
+            // 10^((i - TONE_TABLE_FLAT) * 0.5 / 40) and its square root.
+            double lnA = ((double)i - TONE_TABLE_FLAT) * 0.5 * 2.302585092994045684 / 40;
+
+            A[i] = GainExp(lnA);
+            sqrtA[i] = GainExp(lnA / 2);
+        }
+
+        for (ULONG r = 0; r < TONE_RATES; r++)
+        {
+            double wBass = 2 * 3.14159265358979323846 * TONE_BASS_HZ / g_ToneRates[r];
+            double wTreble = 2 * 3.14159265358979323846 * TONE_TREBLE_HZ / g_ToneRates[r];
+            double cBass = ToneCos(wBass);
+            double sBass = ToneSin(wBass);
+            double cTreble = ToneCos(wTreble);
+            double sTreble = ToneSin(wTreble);
+
+            for (ULONG i = 0; i < TONE_TABLE_ENTRIES; i++)
+            {
+                Bass[r][i] = ToneShelf(FALSE, A[i], sqrtA[i], cBass, sBass);
+                Treble[r][i] = ToneShelf(TRUE, A[i], sqrtA[i], cTreble, sTreble);
+            }
+        }
+    }
+};
+
+constexpr TONE_TABLE g_ToneTable;
+
+//
+// Table entry of a tone setting in 1/65536 dB, rounded to the nearest
+// 0.5 dB. Settings outside -12 dB to 12 dB are clamped.
+//
+inline ULONG ToneIndexFromLevel
+(
+    _In_ LONG           lLevel
+)
+{
+    LONGLONG llIndex = ((LONGLONG)lLevel + (1LL << (TONE_TABLE_STEP_SHIFT - 1))) >> TONE_TABLE_STEP_SHIFT;
+
+    llIndex += TONE_TABLE_FLAT;
+    return llIndex < 0 ? 0 :
+           llIndex >= TONE_TABLE_ENTRIES ? TONE_TABLE_ENTRIES - 1 :
+           (ULONG)llIndex;
+}
+
+//=============================================================================
+// Filter kernels
+//=============================================================================
+
+//
+// One biquad's coefficients and history. The error terms are the
+// fractions the last two outputs were truncated by.
+//
+typedef struct _TONE_SECTION
+{
+    TONE_BIQUAD Biquad;
+    LONG        lX1;
+    LONG        lX2;
+    LONG        lY1;
+    LONG        lY2;
+    LONG        lE1;
+    LONG        lE2;
+} TONE_SECTION;
+typedef TONE_SECTION *PTONE_SECTION;
+
+// Bass, then treble.
+typedef struct _TONE_CHANNEL
+{
+    TONE_SECTION    Section[2];
+} TONE_CHANNEL;
+typedef TONE_CHANNEL *PTONE_CHANNEL;
+
+//
+// One sample through one section. The coefficients of any entry add up
+// to less than 32 in magnitude and samples stay below 2^31, so the five
+// products and the error terms fit a LONGLONG.
+// Adding 2 e[n-1] - e[n-2] shapes the truncation noise by (1 - z^-1)^2,
+// which cancels the shelves' poles near DC.
+//
+inline LONG ToneSectionStep
+(
+    _Inout_ TONE_SECTION &  section,
+    _In_ LONG               lX
+)
+{
+    LONGLONG llAccumulator =
+        (LONGLONG)section.Biquad.lB0 * lX +
+        (LONGLONG)section.Biquad.lB1 * section.lX1 +
+        (LONGLONG)section.Biquad.lB2 * section.lX2 -
+        (LONGLONG)section.Biquad.lA1 * section.lY1 -
+        (LONGLONG)section.Biquad.lA2 * section.lY2 +
+        2 * (LONGLONG)section.lE1 - section.lE2;
+    LONG lY = FixedSaturate(llAccumulator >> TONE_COEFFICIENT_SHIFT);
+
+    section.lE2 = section.lE1;
+    section.lE1 = (LONG)(llAccumulator & ((1LL << TONE_COEFFICIENT_SHIFT) - 1));
+    section.lX2 = section.lX1;
+    section.lX1 = lX;
+    section.lY2 = section.lY1;
+    section.lY1 = lY;
+
+    return lY;
+}
+
+//
+// Filters ulFrames frames of pBuffer in place. Tracks records the last
+// two frames as the history of a flat filter instead, so filtering can
+// resume without a transient.
+//
+typedef VOID TONE_FILTER_ROUTINE
+(
+    _Inout_ PBYTE           pBuffer,
+    _In_ ULONG              ulFrames,
+    _Inout_ PTONE_CHANNEL   pChannels
+);
+typedef TONE_FILTER_ROUTINE *PFN_TONE_FILTER;
+
+typedef VOID TONE_TRACK_ROUTINE
+(
+    _In_ const BYTE *       pBuffer,
+    _In_ ULONG              ulFrames,
+    _Inout_ PTONE_CHANNEL   pChannels
+);
+typedef TONE_TRACK_ROUTINE *PFN_TONE_TRACK;
+
+typedef struct _TONE_FILTER
+{
+    PFN_TONE_FILTER     pfnFilter;
+    PFN_TONE_TRACK      pfnTrack;
+    ULONG               ulFrameBytes;
+} TONE_FILTER;
+typedef TONE_FILTER *PTONE_FILTER;
+
+///////////////////////////////////////////////////////////////////////////////
+// ToneFilter
+//
+template <ULONG Bits, ULONG Channels, BOOL Float>
+struct ToneFilter
+{
+    static const ULONG SampleBytes = Bits / 8;
+    static const ULONG FrameBytes = SampleBytes * Channels;
+
+    static VOID Filter
+    (
+        _Inout_ PBYTE           pBuffer,
+        _In_ ULONG              ulFrames,
+        _Inout_ PTONE_CHANNEL   pChannels
+    )
+    {
+        TONE_CHANNEL channel[Channels];
+
+        for (ULONG c = 0; c < Channels; c++)
+        {
+            channel[c] = pChannels[c];
+        }
+
+        for (ULONG i = 0; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                PBYTE pSample = pBuffer + c * SampleBytes;
+                LONG lValue = FixedSample<Bits, Float>::Load(pSample);
+
+                lValue = ToneSectionStep(channel[c].Section[0], lValue);
+                lValue = ToneSectionStep(channel[c].Section[1], lValue);
+                FixedSample<Bits, Float>::Store(pSample, lValue);
+            }
+            pBuffer += FrameBytes;
+        }
+
+        for (ULONG c = 0; c < Channels; c++)
+        {
+            pChannels[c] = channel[c];
+        }
+    }
+
+    static VOID Track
+    (
+        _In_ const BYTE *       pBuffer,
+        _In_ ULONG              ulFrames,
+        _Inout_ PTONE_CHANNEL   pChannels
+    )
+    {
+        ULONG ulFirst = ulFrames > 2 ? ulFrames - 2 : 0;
+
+        pBuffer += ulFirst * FrameBytes;
+        for (ULONG i = ulFirst; i < ulFrames; i++)
+        {
+            for (ULONG c = 0; c < Channels; c++)
+            {
+                LONG lValue = FixedSample<Bits, Float>::Load(pBuffer + c * SampleBytes);
+
+                for (ULONG s = 0; s < 2; s++)
+                {
+                    TONE_SECTION & section = pChannels[c].Section[s];
+
+                    section.lX2 = section.lY2 = section.lX1;
+                    section.lX1 = section.lY1 = lValue;
+                    section.lE1 = section.lE2 = 0;
+                }
+            }
+            pBuffer += FrameBytes;
+        }
+    }
+};
+
+template <ULONG Bits, ULONG Channels, BOOL Float>
+VOID SetToneFilter
+(
+    _Out_ PTONE_FILTER      pFilter
+)
+{
+    pFilter->pfnFilter = ToneFilter<Bits, Channels, Float>::Filter;
+    pFilter->pfnTrack = ToneFilter<Bits, Channels, Float>::Track;
+    pFilter->ulFrameBytes = ToneFilter<Bits, Channels, Float>::FrameBytes;
+}
+
+template <ULONG Bits, BOOL Float>
+BOOL SelectToneFilter
+(
+    _In_ ULONG              ulChannels,
+    _Out_ PTONE_FILTER      pFilter
+)
+{
+    switch (ulChannels)
+    {
+        case 1: SetToneFilter<Bits, 1, Float>(pFilter); return TRUE;
+        case 2: SetToneFilter<Bits, 2, Float>(pFilter); return TRUE;
+        case 3: SetToneFilter<Bits, 3, Float>(pFilter); return TRUE;
+        case 4: SetToneFilter<Bits, 4, Float>(pFilter); return TRUE;
+        case 5: SetToneFilter<Bits, 5, Float>(pFilter); return TRUE;
+        case 6: SetToneFilter<Bits, 6, Float>(pFilter); return TRUE;
+        case 7: SetToneFilter<Bits, 7, Float>(pFilter); return TRUE;
+        case 8: SetToneFilter<Bits, 8, Float>(pFilter); return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Picks the instance for a stream format: 8/16/24/32-bit PCM and 32-bit
+// float with 1 to TONE_MAX_CHANNELS channels. Returns FALSE otherwise.
+//
+inline BOOL GetToneFilter
+(
+    _In_ ULONG              ulBitsPerSample,
+    _In_ ULONG              ulChannels,
+    _In_ BOOL               bFloat,
+    _Out_ PTONE_FILTER      pFilter
+)
+{
+    RtlZeroMemory(pFilter, sizeof(*pFilter));
+
+    if (bFloat)
+    {
+        return (ulBitsPerSample == 32) ? SelectToneFilter<32, TRUE>(ulChannels, pFilter) : FALSE;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:  return SelectToneFilter<8, FALSE>(ulChannels, pFilter);
+        case 16: return SelectToneFilter<16, FALSE>(ulChannels, pFilter);
+        case 24: return SelectToneFilter<24, FALSE>(ulChannels, pFilter);
+        case 32: return SelectToneFilter<32, FALSE>(ulChannels, pFilter);
+    }
+
+    return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CToneControl
+//
+//   Owned by one stream and only touched from its position update. A new
+//   setting starts a glide from wherever the current one is: every
+//   1/TONE_GLIDE_STEPS_PER_SECOND s each shelf moves one table entry
+//   toward its target. With both shelves flat and no glide in progress
+//   Process only records the history (IsFlat).
+//
+class CToneControl
+{
+protected:
+    TONE_FILTER                 m_Filter;
+    ULONG                       m_ulChannels;
+    ULONG                       m_ulRate;               // Row of the table.
+    ULONG                       m_ulGlideFrames;
+    ULONG                       m_ulGlideRemaining;     // 0 when not gliding.
+    BOOL                        m_bFlat;
+    ULONG                       m_ulBass[TONE_MAX_CHANNELS];
+    ULONG                       m_ulTreble[TONE_MAX_CHANNELS];
+    ULONG                       m_ulBassTarget[TONE_MAX_CHANNELS];
+    ULONG                       m_ulTrebleTarget[TONE_MAX_CHANNELS];
+    TONE_CHANNEL                m_Channels[TONE_MAX_CHANNELS];
+
+public:
+    CToneControl() :
+        m_ulChannels(0),
+        m_ulRate(0),
+        m_ulGlideFrames(0),
+        m_ulGlideRemaining(0),
+        m_bFlat(TRUE)
+    {
+        RtlZeroMemory(&m_Filter, sizeof(m_Filter));
+        RtlZeroMemory(m_Channels, sizeof(m_Channels));
+
+        for (ULONG c = 0; c < TONE_MAX_CHANNELS; c++)
+        {
+            m_ulBass[c] = m_ulBassTarget[c] = TONE_TABLE_FLAT;
+            m_ulTreble[c] = m_ulTrebleTarget[c] = TONE_TABLE_FLAT;
+        }
+    }
+
+    //
+    // Returns FALSE, and leaves the audio alone, for sample rates without
+    // coefficients and formats GetToneFilter does not cover.
+    //
+    BOOL Init
+    (
+        _In_ ULONG      ulSampleRate,
+        _In_ ULONG      ulBitsPerSample,
+        _In_ ULONG      ulChannels,
+        _In_ BOOL       bFloat
+    )
+    {
+        ULONG ulRate = 0;
+
+        while (ulRate < TONE_RATES && g_ToneRates[ulRate] != ulSampleRate)
+        {
+            ulRate++;
+        }
+
+        if (ulRate == TONE_RATES ||
+            !GetToneFilter(ulBitsPerSample, ulChannels, bFloat, &m_Filter))
+        {
+            return FALSE;
+        }
+
+        m_ulChannels = ulChannels;
+        m_ulRate = ulRate;
+        m_ulGlideFrames = ulSampleRate / TONE_GLIDE_STEPS_PER_SECOND;
+        LoadCoefficients();
+
+        return TRUE;
+    }
+
+    BOOL IsActive() const
+    {
+        return m_Filter.pfnFilter != NULL;
+    }
+
+    BOOL IsFlat() const
+    {
+        return m_bFlat;
+    }
+
+    //
+    // Sets the bass and treble of every channel in 1/65536 dB. A change
+    // starts a glide; the first step is taken right away.
+    //
+    VOID SetTargets
+    (
+        _In_reads_(TONE_MAX_CHANNELS) const LONG *  plBass,
+        _In_reads_(TONE_MAX_CHANNELS) const LONG *  plTreble
+    )
+    {
+        BOOL bChanged = FALSE;
+
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            ULONG ulBass = ToneIndexFromLevel(plBass[c]);
+            ULONG ulTreble = ToneIndexFromLevel(plTreble[c]);
+
+            bChanged |= (ulBass != m_ulBassTarget[c] || ulTreble != m_ulTrebleTarget[c]);
+            m_ulBassTarget[c] = ulBass;
+            m_ulTrebleTarget[c] = ulTreble;
+        }
+
+        if (bChanged && m_ulGlideRemaining == 0)
+        {
+            Step();
+        }
+    }
+
+    //
+    // Filters the whole frames in pData, which follow the frames of the
+    // previous call.
+    //
+    VOID Process
+    (
+        _Inout_updates_bytes_(cbData) PBYTE     pData,
+        _In_ ULONG                              cbData
+    )
+    {
+        ULONG ulFrames = IsActive() ? cbData / m_Filter.ulFrameBytes : 0;
+
+        while (ulFrames > 0)
+        {
+            ULONG ulRun = ulFrames;
+
+            if (m_bFlat)
+            {
+                m_Filter.pfnTrack(pData, ulFrames, m_Channels);
+                return;
+            }
+
+            if (m_ulGlideRemaining > 0 && ulRun > m_ulGlideRemaining)
+            {
+                ulRun = m_ulGlideRemaining;
+            }
+
+            m_Filter.pfnFilter(pData, ulRun, m_Channels);
+            pData += ulRun * m_Filter.ulFrameBytes;
+            ulFrames -= ulRun;
+
+            if (m_ulGlideRemaining > 0)
+            {
+                m_ulGlideRemaining -= ulRun;
+                if (m_ulGlideRemaining == 0)
+                {
+                    Step();
+                }
+            }
+        }
+    }
+
+private:
+    //
+    // Moves each shelf one entry toward its target. Keeps gliding while
+    // any shelf is short of it; a glide may pass through flat.
+    //
+    VOID Step()
+    {
+        BOOL bGliding = FALSE;
+        BOOL bFlat = TRUE;
+
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            m_ulBass[c] += (m_ulBass[c] < m_ulBassTarget[c]) - (m_ulBass[c] > m_ulBassTarget[c]);
+            m_ulTreble[c] += (m_ulTreble[c] < m_ulTrebleTarget[c]) - (m_ulTreble[c] > m_ulTrebleTarget[c]);
+            bGliding |= (m_ulBass[c] != m_ulBassTarget[c] || m_ulTreble[c] != m_ulTrebleTarget[c]);
+            bFlat &= (m_ulBass[c] == TONE_TABLE_FLAT && m_ulTreble[c] == TONE_TABLE_FLAT);
+        }
+
+        LoadCoefficients();
+        m_ulGlideRemaining = bGliding ? (m_ulGlideFrames ? m_ulGlideFrames : 1) : 0;
+        m_bFlat = bFlat && !bGliding;
+    }
+
+    VOID LoadCoefficients()
+    {
+        for (ULONG c = 0; c < m_ulChannels; c++)
+        {
+            m_Channels[c].Section[0].Biquad = g_ToneTable.Bass[m_ulRate][m_ulBass[c]];
+            m_Channels[c].Section[1].Biquad = g_ToneTable.Treble[m_ulRate][m_ulTreble[c]];
+        }
+    }
+};
+typedef CToneControl *PCToneControl;
+
+#endif // _VIRTUALAUDIODRIVER_TONECONTROL_H_
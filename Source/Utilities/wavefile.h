@@ -0,0 +1,657 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    wavefile.h
+
+Abstract:
+
+    Reading WAVE and RF64 files into memory for playback as a capture
+    source:
+
+    - WaveFileParse walks the chunks of a file through a caller-supplied
+      read routine and describes its fmt and data chunks.
+    - WaveFileLoadSamples decodes the data chunk to interleaved Q30 samples
+      (unity = 1 << 30), so an asset is decoded once when loaded.
+    - CWaveAssetTable keeps loaded assets shared and reference counted.
+    - CWaveAssetReader plays an asset in a loop into one stream format
+      through the sample writers.
+
+    Float data is decoded with integer operations only. Locking and file
+    access are left to the caller.
+--*/
+
+#ifndef _VIRTUALAUDIODRIVER_WAVEFILE_H_
+#define _VIRTUALAUDIODRIVER_WAVEFILE_H_
+
+#include "portable.h"
+#include "samplewriter.h"
+
+#define WAVEFILE_TAG_PCM            0x0001
+#define WAVEFILE_TAG_FLOAT          0x0003
+#define WAVEFILE_TAG_EXTENSIBLE     0xFFFE
+
+#define WAVEFILE_MAX_CHANNELS       SAMPLE_WRITER_MAX_CHANNELS
+
+// Chunks looked at before giving up on finding fmt and data.
+#define WAVEFILE_MAX_CHUNKS         64
+
+// Largest decoded asset. 512 MB of Q30 is ~23 minutes of 48 kHz stereo.
+#define WAVE_ASSET_MAX_DECODED_BYTES    (512ULL * 1024 * 1024)
+
+// Distinct assets loaded at once.
+#define WAVE_ASSET_TABLE_SLOTS      8
+
+// Path length, including the terminator (MAX_PATH).
+#define WAVE_ASSET_MAX_NAME         260
+
+// Frames CWaveAssetReader converts per pass when remapping channels.
+#define WAVE_ASSET_READ_FRAMES      128
+
+//
+// Reads cbData bytes at ullOffset of the file. Returns FALSE unless all of
+// them were read.
+//
+typedef BOOL WAVEFILE_READ_ROUTINE
+(
+    _In_ PVOID                          Context,
+    _In_ ULONGLONG                      ullOffset,
+    _Out_writes_bytes_(cbData) PVOID    pData,
+    _In_ ULONG                          cbData
+);
+typedef WAVEFILE_READ_ROUTINE *PFN_WAVEFILE_READ;
+
+typedef struct _WAVEFILE_INFO
+{
+    BOOL        bFloat;
+    ULONG       ulChannels;
+    ULONG       ulSampleRate;
+    ULONG       ulBitsPerSample;    // Container size.
+    ULONG       ulBlockAlign;
+    ULONGLONG   ullDataOffset;
+    ULONGLONG   ullDataBytes;       // Whole frames only.
+    ULONGLONG   ullFrames;
+} WAVEFILE_INFO;
+typedef WAVEFILE_INFO *PWAVEFILE_INFO;
+
+//
+// A decoded file, shared by every stream that plays it.
+//
+typedef struct _WAVE_ASSET
+{
+    WCHAR       Name[WAVE_ASSET_MAX_NAME];
+    LONG        lRefs;
+    ULONG       ulChannels;
+    ULONG       ulSampleRate;
+    ULONGLONG   ullFrames;
+    PLONG       pSamples;           // Q30, interleaved.
+} WAVE_ASSET;
+typedef WAVE_ASSET *PWAVE_ASSET;
+
+inline ULONG WaveFileGetUshort(_In_reads_bytes_(2) const BYTE * p)
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8);
+}
+
+inline ULONG WaveFileGetUlong(_In_reads_bytes_(4) const BYTE * p)
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+inline ULONGLONG WaveFileGetUlonglong(_In_reads_bytes_(8) const BYTE * p)
+{
+    return (ULONGLONG)WaveFileGetUlong(p) | ((ULONGLONG)WaveFileGetUlong(p + 4) << 32);
+}
+
+inline BOOL WaveFileIsTag(_In_reads_bytes_(4) const BYTE * p, _In_reads_bytes_(4) const char * pTag)
+{
+    return p[0] == (BYTE)pTag[0] && p[1] == (BYTE)pTag[1] && p[2] == (BYTE)pTag[2] && p[3] == (BYTE)pTag[3];
+}
+
+//
+// Checks a fmt chunk payload and fills in the format part of pInfo. Takes
+// PCM of 8 to 32 bits and 32-bit float, plain or extensible.
+//
+inline BOOL WaveFileParseFormat
+(
+    _In_reads_bytes_(cbFormat) const BYTE * pFormat,
+    _In_ ULONG                              cbFormat,
+    _Inout_ PWAVEFILE_INFO                  pInfo
+)
+{
+    // KSDATAFORMAT_SUBTYPE_* after the leading format tag.
+    static const BYTE SubFormatTail[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+                                            0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+
+    if (cbFormat < 16)
+    {
+        return FALSE;
+    }
+
+    ULONG ulTag = WaveFileGetUshort(pFormat);
+
+    pInfo->ulChannels = WaveFileGetUshort(pFormat + 2);
+    pInfo->ulSampleRate = WaveFileGetUlong(pFormat + 4);
+    pInfo->ulBlockAlign = WaveFileGetUshort(pFormat + 12);
+    pInfo->ulBitsPerSample = WaveFileGetUshort(pFormat + 14);
+
+    if (ulTag == WAVEFILE_TAG_EXTENSIBLE)
+    {
+        if (cbFormat < 40 || memcmp(pFormat + 26, SubFormatTail, sizeof(SubFormatTail)) != 0)
+        {
+            return FALSE;
+        }
+        ulTag = WaveFileGetUshort(pFormat + 24);
+    }
+
+    if (ulTag == WAVEFILE_TAG_PCM)
+    {
+        pInfo->bFloat = FALSE;
+        if (pInfo->ulBitsPerSample != 8 && pInfo->ulBitsPerSample != 16 &&
+            pInfo->ulBitsPerSample != 24 && pInfo->ulBitsPerSample != 32)
+        {
+            return FALSE;
+        }
+    }
+    else if (ulTag == WAVEFILE_TAG_FLOAT)
+    {
+        pInfo->bFloat = TRUE;
+        if (pInfo->ulBitsPerSample != 32)
+        {
+            return FALSE;
+        }
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    return pInfo->ulChannels >= 1 && pInfo->ulChannels <= WAVEFILE_MAX_CHANNELS &&
+           pInfo->ulSampleRate != 0 &&
+           pInfo->ulBlockAlign == pInfo->ulChannels * pInfo->ulBitsPerSample / 8;
+}
+
+//
+// Describes a RIFF or RF64 WAVE file of ullFileBytes bytes. A data chunk
+// that runs past the end of the file (an unfinished recording) is cut to
+// what is there.
+//
+inline BOOL WaveFileParse
+(
+    _In_ PFN_WAVEFILE_READ      pfnRead,
+    _In_ PVOID                  Context,
+    _In_ ULONGLONG              ullFileBytes,
+    _Out_ PWAVEFILE_INFO        pInfo
+)
+{
+    BYTE        header[40];
+    BOOL        bRf64;
+    BOOL        bFormat = FALSE;
+    BOOL        bData = FALSE;
+    ULONGLONG   ullDs64DataBytes = 0;
+    ULONGLONG   ullOffset = 12;
+
+    RtlZeroMemory(pInfo, sizeof(*pInfo));
+
+    if (ullFileBytes < 12 || !pfnRead(Context, 0, header, 12))
+    {
+        return FALSE;
+    }
+
+    bRf64 = WaveFileIsTag(header, "RF64") || WaveFileIsTag(header, "BW64");
+    if ((!bRf64 && !WaveFileIsTag(header, "RIFF")) || !WaveFileIsTag(header + 8, "WAVE"))
+    {
+        return FALSE;
+    }
+
+    for (ULONG i = 0; i < WAVEFILE_MAX_CHUNKS && ullOffset + 8 <= ullFileBytes; i++)
+    {
+        ULONGLONG ullChunkBytes;
+
+        if (!pfnRead(Context, ullOffset, header, 8))
+        {
+            return FALSE;
+        }
+
+        ullChunkBytes = WaveFileGetUlong(header + 4);
+
+        if (WaveFileIsTag(header, "ds64") && bRf64)
+        {
+            if (ullChunkBytes < 24 || !pfnRead(Context, ullOffset + 8, header, 24))
+            {
+                return FALSE;
+            }
+            ullDs64DataBytes = WaveFileGetUlonglong(header + 8);
+        }
+        else if (WaveFileIsTag(header, "fmt "))
+        {
+            ULONG cbFormat = (ullChunkBytes < sizeof(header)) ? (ULONG)ullChunkBytes : (ULONG)sizeof(header);
+
+            if (!pfnRead(Context, ullOffset + 8, header, cbFormat) ||
+                !WaveFileParseFormat(header, cbFormat, pInfo))
+            {
+                return FALSE;
+            }
+            bFormat = TRUE;
+        }
+        else if (WaveFileIsTag(header, "data"))
+        {
+            if (bRf64 && ullChunkBytes == 0xFFFFFFFF)
+            {
+                ullChunkBytes = ullDs64DataBytes;
+            }
+
+            pInfo->ullDataOffset = ullOffset + 8;
+            pInfo->ullDataBytes = ullChunkBytes;
+            if (pInfo->ullDataBytes > ullFileBytes - pInfo->ullDataOffset)
+            {
+                pInfo->ullDataBytes = ullFileBytes - pInfo->ullDataOffset;
+            }
+            bData = TRUE;
+        }
+
+        if (bFormat && bData)
+        {
+            break;
+        }
+
+        // Chunks are padded to an even size.
+        ullOffset += 8 + ullChunkBytes + (ullChunkBytes & 1);
+    }
+
+    if (!bFormat || !bData)
+    {
+        return FALSE;
+    }
+
+    pInfo->ullFrames = pInfo->ullDataBytes / pInfo->ulBlockAlign;
+    pInfo->ullDataBytes = pInfo->ullFrames * pInfo->ulBlockAlign;
+
+    return pInfo->ullFrames > 0;
+}
+
+//
+// Q30 for an IEEE single, rounded to nearest. Values outside [-1, 1] are
+// clamped and NaN decodes as silence.
+//
+inline LONG WaveFileFloatToQ30(_In_ ULONG ulBits)
+{
+    ULONG   ulExponent = (ulBits >> 23) & 0xFF;
+    ULONG   ulMantissa = ulBits & 0x7FFFFF;
+    LONG    lValue;
+
+    if (ulExponent == 0xFF && ulMantissa != 0)
+    {
+        return 0;
+    }
+
+    if (ulExponent >= 127)
+    {
+        lValue = SAMPLE_Q30_ONE;
+    }
+    else if (ulExponent < 96)
+    {
+        // Below 2^-31, rounds to 0.
+        lValue = 0;
+    }
+    else
+    {
+        // value = (1.m) * 2^(e - 127), so Q30 = mantissa24 * 2^(e - 120).
+        ulMantissa |= 0x800000;
+        if (ulExponent >= 120)
+        {
+            lValue = (LONG)(ulMantissa << (ulExponent - 120));
+        }
+        else
+        {
+            ULONG ulShift = 120 - ulExponent;
+            lValue = (LONG)((ulMantissa + (1UL << (ulShift - 1))) >> ulShift);
+        }
+    }
+
+    return (ulBits & 0x80000000) ? -lValue : lValue;
+}
+
+//
+// Decodes ulSamples samples of the file's format to Q30.
+//
+inline VOID WaveFileDecode
+(
+    _In_ const BYTE *               pSource,
+    _In_ ULONG                      ulSamples,
+    _In_ ULONG                      ulBitsPerSample,
+    _In_ BOOL                       bFloat,
+    _Out_writes_(ulSamples) PLONG   pSamples
+)
+{
+    ULONG i;
+
+    if (bFloat)
+    {
+        for (i = 0; i < ulSamples; i++, pSource += 4)
+        {
+            pSamples[i] = WaveFileFloatToQ30(WaveFileGetUlong(pSource));
+        }
+        return;
+    }
+
+    switch (ulBitsPerSample)
+    {
+        case 8:
+            for (i = 0; i < ulSamples; i++, pSource += 1)
+            {
+                pSamples[i] = ((LONG)pSource[0] - 0x80) * (1L << 23);
+            }
+            break;
+
+        case 16:
+            for (i = 0; i < ulSamples; i++, pSource += 2)
+            {
+                pSamples[i] = (LONG)(SHORT)WaveFileGetUshort(pSource) * (1L << 15);
+            }
+            break;
+
+        case 24:
+            for (i = 0; i < ulSamples; i++, pSource += 3)
+            {
+                // Sign-extend through the top byte.
+                LONG lValue = (LONG)(((ULONG)pSource[0] << 8) | ((ULONG)pSource[1] << 16) | ((ULONG)pSource[2] << 24));
+                pSamples[i] = lValue >> 1;
+            }
+            break;
+
+        case 32:
+            for (i = 0; i < ulSamples; i++, pSource += 4)
+            {
+                pSamples[i] = (LONG)WaveFileGetUlong(pSource) >> 1;
+            }
+            break;
+    }
+}
+
+//
+// Bytes of Q30 samples the file decodes to, or 0 if that is more than
+// WAVE_ASSET_MAX_DECODED_BYTES.
+//
+inline ULONGLONG WaveFileGetDecodedBytes
+(
+    _In_ const WAVEFILE_INFO *  pInfo
+)
+{
+    if (pInfo->ullFrames > WAVE_ASSET_MAX_DECODED_BYTES / (pInfo->ulChannels * sizeof(LONG)))
+    {
+        return 0;
+    }
+
+    return pInfo->ullFrames * pInfo->ulChannels * sizeof(LONG);
+}
+
+//
+// Decodes the whole data chunk into pSamples, which holds
+// WaveFileGetDecodedBytes bytes. pScratch holds file data on its way and
+// must fit at least one frame.
+//
+inline BOOL WaveFileLoadSamples
+(
+    _In_ PFN_WAVEFILE_READ              pfnRead,
+    _In_ PVOID                          Context,
+    _In_ const WAVEFILE_INFO *          pInfo,
+    _Out_ PLONG                         pSamples,
+    _Out_writes_bytes_(cbScratch) PBYTE pScratch,
+    _In_ ULONG                          cbScratch
+)
+{
+    ULONG       ulChunkFrames = cbScratch / pInfo->ulBlockAlign;
+    ULONGLONG   ullFrame = 0;
+
+    if (ulChunkFrames == 0)
+    {
+        return FALSE;
+    }
+
+    while (ullFrame < pInfo->ullFrames)
+    {
+        ULONG ulFrames = (pInfo->ullFrames - ullFrame < ulChunkFrames) ?
+                         (ULONG)(pInfo->ullFrames - ullFrame) : ulChunkFrames;
+
+        if (!pfnRead(Context,
+                     pInfo->ullDataOffset + ullFrame * pInfo->ulBlockAlign,
+                     pScratch,
+                     ulFrames * pInfo->ulBlockAlign))
+        {
+            return FALSE;
+        }
+
+        WaveFileDecode(pScratch,
+                       ulFrames * pInfo->ulChannels,
+                       pInfo->ulBitsPerSample,
+                       pInfo->bFloat,
+                       pSamples + ullFrame * pInfo->ulChannels);
+
+        ullFrame += ulFrames;
+    }
+
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CWaveAssetTable
+//
+//   Loaded assets by name. The table only counts references; the caller
+//   serializes calls, allocates assets and frees the ones Release hands
+//   back.
+//
+class CWaveAssetTable
+{
+protected:
+    PWAVE_ASSET                 m_Slots[WAVE_ASSET_TABLE_SLOTS];
+
+public:
+    CWaveAssetTable()
+    {
+        RtlZeroMemory(m_Slots, sizeof(m_Slots));
+    }
+
+    //
+    // The asset loaded from Name with a reference added, or NULL.
+    //
+    PWAVE_ASSET Find
+    (
+        _In_ PCWSTR     Name
+    )
+    {
+        for (ULONG i = 0; i < WAVE_ASSET_TABLE_SLOTS; i++)
+        {
+            if (m_Slots[i] && IsSameName(m_Slots[i]->Name, Name))
+            {
+                m_Slots[i]->lRefs++;
+                return m_Slots[i];
+            }
+        }
+
+        return NULL;
+    }
+
+    //
+    // Adds a newly loaded asset with one reference. FALSE if the table is
+    // full.
+    //
+    BOOL Insert
+    (
+        _In_ PWAVE_ASSET    pAsset
+    )
+    {
+        for (ULONG i = 0; i < WAVE_ASSET_TABLE_SLOTS; i++)
+        {
+            if (m_Slots[i] == NULL)
+            {
+                pAsset->lRefs = 1;
+                m_Slots[i] = pAsset;
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    }
+
+    //
+    // Drops a reference. TRUE when it was the last one; the asset is then
+    // out of the table and the caller frees it.
+    //
+    BOOL Release
+    (
+        _In_ PWAVE_ASSET    pAsset
+    )
+    {
+        if (--pAsset->lRefs > 0)
+        {
+            return FALSE;
+        }
+
+        for (ULONG i = 0; i < WAVE_ASSET_TABLE_SLOTS; i++)
+        {
+            if (m_Slots[i] == pAsset)
+            {
+                m_Slots[i] = NULL;
+            }
+        }
+
+        return TRUE;
+    }
+
+protected:
+    static BOOL IsSameName
+    (
+        _In_ PCWSTR     Name1,
+        _In_ PCWSTR     Name2
+    )
+    {
+        ULONG i = 0;
+
+        for (; i < WAVE_ASSET_MAX_NAME && Name1[i] == Name2[i]; i++)
+        {
+            if (Name1[i] == 0)
+            {
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CWaveAssetReader
+//
+//   Plays an asset from start to end and around again in a stream format.
+//   A mono asset goes to every channel; otherwise channels map one to one
+//   and stream channels the asset lacks are silent. The sample rate is not
+//   converted.
+//
+class CWaveAssetReader
+{
+protected:
+    const WAVE_ASSET *          m_pAsset;
+    ULONGLONG                   m_ullFrame;
+    SAMPLE_WRITER               m_Writer;
+    ULONG                       m_ulChannels;
+    LONG                        m_Scratch[WAVE_ASSET_READ_FRAMES * SAMPLE_WRITER_MAX_CHANNELS];
+
+public:
+    CWaveAssetReader() :
+        m_pAsset(NULL),
+        m_ullFrame(0),
+        m_ulChannels(0)
+    {
+        RtlZeroMemory(&m_Writer, sizeof(m_Writer));
+    }
+
+    BOOL Init
+    (
+        _In_ const WAVE_ASSET *     pAsset,
+        _In_ ULONG                  ulBitsPerSample,
+        _In_ ULONG                  ulChannels,
+        _In_ BOOL                   bFloat
+    )
+    {
+        m_pAsset = NULL;
+        m_ullFrame = 0;
+
+        if (pAsset == NULL || pAsset->ullFrames == 0 ||
+            !GetSampleWriter(ulBitsPerSample, ulChannels, bFloat, &m_Writer))
+        {
+            return FALSE;
+        }
+
+        m_pAsset = pAsset;
+        m_ulChannels = ulChannels;
+
+        return TRUE;
+    }
+
+    ULONG GetFrameBytes() const
+    {
+        return m_Writer.ulFrameBytes;
+    }
+
+    //
+    // Writes the next ulFrames frames to pBuffer.
+    //
+    VOID Render
+    (
+        _Out_ PBYTE     pBuffer,
+        _In_ ULONG      ulFrames
+    )
+    {
+        ULONG ulAssetChannels = m_pAsset->ulChannels;
+
+        while (ulFrames > 0)
+        {
+            ULONGLONG       ullLeft = m_pAsset->ullFrames - m_ullFrame;
+            ULONG           ulRun = (ullLeft < ulFrames) ? (ULONG)ullLeft : ulFrames;
+            const LONG *    pSource = m_pAsset->pSamples + m_ullFrame * ulAssetChannels;
+
+            if (ulAssetChannels == 1)
+            {
+                m_Writer.pfnWriteBroadcast(pBuffer, pSource, ulRun);
+            }
+            else if (ulAssetChannels == m_ulChannels)
+            {
+                m_Writer.pfnWriteInterleaved(pBuffer, pSource, ulRun);
+            }
+            else
+            {
+                if (ulRun > WAVE_ASSET_READ_FRAMES)
+                {
+                    ulRun = WAVE_ASSET_READ_FRAMES;
+                }
+
+                for (ULONG i = 0; i < ulRun; i++)
+                {
+                    for (ULONG c = 0; c < m_ulChannels; c++)
+                    {
+                        m_Scratch[i * m_ulChannels + c] = (c < ulAssetChannels) ? pSource[c] : 0;
+                    }
+                    pSource += ulAssetChannels;
+                }
+
+                m_Writer.pfnWriteInterleaved(pBuffer, m_Scratch, ulRun);
+            }
+
+            pBuffer += ulRun * m_Writer.ulFrameBytes;
+            ulFrames -= ulRun;
+
+            m_ullFrame += ulRun;
+            if (m_ullFrame == m_pAsset->ullFrames)
+            {
+                m_ullFrame = 0;
+            }
+        }
+    }
+};
+
+typedef CWaveAssetReader *PCWaveAssetReader;
+
+#endif // _VIRTUALAUDIODRIVER_WAVEFILE_H_